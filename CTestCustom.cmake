@@ -1,3 +1 @@
-CTestCustom.cmake
-￼
-￼
+# Settings of ctest, read from the build directory, where it is copied
@@ -0,0 +1,34 @@
+#!/bin/bash
+
+# Checks that the query and target ranges of each PAF record span the bases its CIGAR (cg:Z:)
+# aligns, printing the records that do not. Records without a CIGAR are skipped.
+
+if [ $# -ne 1 ]; then
+    echo "Usage: $0 <alignments.paf>"
+    exit 1
+fi
+
+awk -F '\t' '{
+    cigar = "";
+    for (i = 13; i <= NF; ++i) {
+        if (substr($i, 1, 5) == "cg:Z:") {
+            cigar = substr($i, 6);
+        }
+    }
+    if (cigar == "") next;
+    query_span = 0; target_span = 0;
+    while (match(cigar, /^[0-9]+[MIDX=]/)) {
+        len = substr(cigar, 1, RLENGTH - 1) + 0;
+        op = substr(cigar, RLENGTH, 1);
+        if (op != "D") query_span += len;
+        if (op != "I") target_span += len;
+        cigar = substr(cigar, RLENGTH + 1);
+    }
+    if (cigar != "" || query_span != $4 - $3 || target_span != $9 - $8) {
+        printf("Record %d (%s:%d-%d, %s:%d-%d) spans %d query and %d target bases in its CIGAR\n",
+               NR, $1, $3, $4, $6, $8, $9, query_span, target_span);
+        flag = 1
+    }
+} END {
+    if (flag) exit 1
+}' "$1"
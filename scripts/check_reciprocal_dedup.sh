@@ -0,0 +1,61 @@
+#!/bin/bash
+
+# Checks the PAF output of an all-vs-all run with --reciprocal-dedup against that of the same
+# run without it. Each record is put the way round whose query name sorts first (the one
+# starting first on a sequence mapped on itself), swapping its query and target fields and
+# inverting its CIGAR as --reciprocal-dedup does, without the md:f: tag, which it rewrites.
+# Both runs must then have the same query-target pairs, and each record of the run with
+# --reciprocal-dedup must be one of the run without it.
+
+if [ $# -ne 2 ]; then
+    echo "Usage: $0 <without_dedup.paf> <with_dedup.paf>"
+    exit 1
+fi
+
+canonical() {
+    awk -F '\t' -v OFS='\t' '{
+        swap = $1 > $6 || ($1 == $6 && $3 + 0 > $8 + 0);
+        if (swap) {
+            for (i = 1; i <= 4; ++i) { t = $i; $i = $(i + 5); $(i + 5) = t; }
+        }
+        line = $1;
+        for (i = 2; i <= 12; ++i) line = line OFS $i;
+        for (i = 13; i <= NF; ++i) {
+            if (substr($i, 1, 5) == "md:f:") continue;
+            if (swap && substr($i, 1, 5) == "cg:Z:") {
+                cigar = substr($i, 6); n = 0;
+                while (match(cigar, /^[0-9]+[MIDX=]/)) {
+                    op = substr(cigar, RLENGTH, 1);
+                    op = op == "I" ? "D" : op == "D" ? "I" : op;
+                    ops[++n] = substr(cigar, 1, RLENGTH - 1) op;
+                    cigar = substr(cigar, RLENGTH + 1);
+                }
+                inverted = "";
+                for (j = 1; j <= n; ++j) inverted = inverted ops[$5 == "-" ? n + 1 - j : j];
+                line = line OFS "cg:Z:" inverted;
+            } else {
+                line = line OFS $i;
+            }
+        }
+        print line;
+    }' "$1" | LC_ALL=C sort
+}
+
+plain=$(mktemp)
+dedup=$(mktemp)
+trap 'rm -f "$plain" "$dedup"' EXIT
+canonical "$1" > "$plain"
+canonical "$2" > "$dedup"
+
+status=0
+if ! diff <(cut -f 1,5,6 "$plain" | LC_ALL=C sort -u) <(cut -f 1,5,6 "$dedup" | LC_ALL=C sort -u); then
+    echo "The query-target pairs of $1 and $2 differ"
+    status=1
+fi
+extra=$(LC_ALL=C comm -13 "$plain" <(uniq "$dedup"))
+if [ -n "$extra" ]; then
+    echo "Records of $2 not in $1:"
+    echo "$extra"
+    status=1
+fi
+exit $status
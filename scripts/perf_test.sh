@@ -0,0 +1,87 @@
+#!/bin/bash
+
+# Runs wfmash and checks its wall time, peak memory and output against those of a baseline run:
+# fails if the run is slower or bigger than the baseline by more than the tolerances, or if its
+# output differs. A test missing from the baseline is skipped, exiting with 77, until it is
+# recorded there by a run with WFMASH_PERF_UPDATE=1 set, as it is again once a change of time,
+# memory or output is intended. The times and memory are those of --report-json.
+
+usage() {
+    echo "Usage: $0 -n <name> -b <baseline.tsv> -o <output> [-a] [-T <time_tolerance>] [-M <memory_tolerance>] -- <wfmash> [args...]"
+    echo "  -n    name of the test in the baseline"
+    echo "  -b    baseline, with a line per test: name, wall seconds, peak RSS in kB, output checksum"
+    echo "  -o    file the output of wfmash is written to"
+    echo "  -a    only time the alignment: map first with -m, untimed, and align those mappings with -i"
+    echo "  -T    relative wall time over the baseline that fails the test [default: 0.25]"
+    echo "  -M    relative peak RSS over the baseline that fails the test [default: 0.10]"
+    exit 1
+}
+
+TIME_TOLERANCE=0.25
+MEMORY_TOLERANCE=0.10
+ALIGN_ONLY=0
+while getopts "n:b:o:aT:M:" opt; do
+    case "$opt" in
+        n) NAME=$OPTARG ;;
+        b) BASELINE=$OPTARG ;;
+        o) OUTPUT=$OPTARG ;;
+        a) ALIGN_ONLY=1 ;;
+        T) TIME_TOLERANCE=$OPTARG ;;
+        M) MEMORY_TOLERANCE=$OPTARG ;;
+        *) usage ;;
+    esac
+done
+shift $((OPTIND - 1))
+if [ -z "$NAME" ] || [ -z "$BASELINE" ] || [ -z "$OUTPUT" ] || [ $# -lt 1 ]; then
+    usage
+fi
+
+BASE=$( [ -f "$BASELINE" ] && awk -v name="$NAME" -F '\t' '$1 == name' "$BASELINE" )
+if [ -z "$BASE" ] && [ "$WFMASH_PERF_UPDATE" != "1" ]; then
+    echo "[perf_test] $NAME: not in the baseline $BASELINE, skipped: record it with WFMASH_PERF_UPDATE=1"
+    exit 77
+fi
+
+if [ "$ALIGN_ONLY" = "1" ]; then
+    MAPPINGS=$OUTPUT.mappings.paf
+    "$@" -m > "$MAPPINGS" || { echo "[perf_test] $NAME: wfmash failed to map"; exit 1; }
+    set -- "$@" -i "$MAPPINGS"
+fi
+
+REPORT=$OUTPUT.report.json
+"$@" --report-json "$REPORT" > "$OUTPUT" || { echo "[perf_test] $NAME: wfmash failed"; exit 1; }
+
+# the totals come first in the report, before those of the stages
+WALL=$(grep -m 1 '"wall_seconds"' "$REPORT" | sed 's/.*: *\([0-9.]*\).*/\1/')
+RSS=$(grep -m 1 '"peak_rss_kb"' "$REPORT" | sed 's/.*: *\([0-9.]*\).*/\1/')
+# the timing tags of diagnosed alignments change from run to run, and unordered records are allowed
+CHECKSUM=$(sed -E 's/\t(wt|pt):i:[0-9]+//g' "$OUTPUT" | LC_ALL=C sort | md5sum | cut -d ' ' -f 1)
+echo "[perf_test] $NAME: $WALL s, $RSS kB, output $CHECKSUM"
+
+if [ "$WFMASH_PERF_UPDATE" = "1" ]; then
+    touch "$BASELINE"
+    awk -v name="$NAME" -F '\t' '$1 != name' "$BASELINE" > "$BASELINE.tmp"
+    printf "%s\t%s\t%s\t%s\n" "$NAME" "$WALL" "$RSS" "$CHECKSUM" >> "$BASELINE.tmp"
+    mv "$BASELINE.tmp" "$BASELINE"
+    echo "[perf_test] $NAME: recorded as the baseline in $BASELINE"
+    exit 0
+fi
+
+echo "$BASE" | awk -F '\t' -v name="$NAME" -v wall="$WALL" -v rss="$RSS" -v checksum="$CHECKSUM" \
+    -v time_tolerance="$TIME_TOLERANCE" -v memory_tolerance="$MEMORY_TOLERANCE" '{
+    printf("[perf_test] %s: baseline %s s, %s kB, output %s\n", name, $2, $3, $4);
+    if (wall > $2 * (1 + time_tolerance)) {
+        printf("[perf_test] %s: wall time regressed by %.1f%%, over the %.1f%% allowed\n", name, (wall / $2 - 1) * 100, time_tolerance * 100);
+        flag = 1
+    }
+    if (rss > $3 * (1 + memory_tolerance)) {
+        printf("[perf_test] %s: peak memory regressed by %.1f%%, over the %.1f%% allowed\n", name, (rss / $3 - 1) * 100, memory_tolerance * 100);
+        flag = 1
+    }
+    if (checksum != $4) {
+        printf("[perf_test] %s: output differs from the baseline\n", name);
+        flag = 1
+    }
+} END {
+    if (flag) exit 1
+}'
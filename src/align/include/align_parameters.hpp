@@ -17,6 +17,7 @@ struct Parameters {
     int threads;                                  //execution thread count
     //float percentageIdentity;                     //user defined threshold for good similarity
     float min_identity;                           // drop alignments below this identity threshold
+    bool screen_identity;                         // drop the mappings whose k-mer identity estimate is clearly below min_identity unaligned
     //int wf_min;                                   // minimum wavefront length to trigger WF_reduce wavefront pruning
     //int wf_diff;                                  // max distance threshold that a wavefront may lag behind the best wavefront and not be removed
     //bool exact_wfa;                               // use exact WFA, avoiding adaptive wavefront reduction
@@ -24,6 +25,7 @@ struct Parameters {
 
     //wflambda
     uint16_t wflambda_segment_length;             //segment length for wflambda
+    bool wflign_auto;                             //pick the segment length and WFlign heuristic of each mapping
 
     bool force_biwfa_alignment;				   //force biwfa alignment
 
@@ -56,20 +58,52 @@ struct Parameters {
     std::vector<std::string> querySequences;      //query sequence(s)
     std::string mashmapPafFile;                   //mashmap paf mapping file
     std::string pafOutputFile;                    //paf/sam output file name
+    bool bgzf_output;                             //compress the output in the BGZF format
+    bool bam_output;                              //write the SAM records as BAM
+    bool cram_output;                             //write the SAM records as CRAM, against the target sequences
+    bool unordered_output;                        //write the alignments as they are done rather than in input order
+    bool deterministic_output;                    //write the alignments in input order without waiting on the oldest
+    int output_shards;                            //files the output is split over, named after pafOutputFile, 0 for a single one
+    std::string shard_by;                         //records going to the same shard: query, target, query-sample or target-sample
+    std::string sort_by;                          //coordinates the output is sorted and indexed by: target or query, empty for none
+    size_t reorder_window;                        //mappings aligned grouped by target at a time, 0 to align them in input order
+    uint64_t in_flight_bytes;                     //bytes of sequences of the mappings being aligned and of their outputs not written yet, at most
+    bool longest_first;                           //align the most costly mappings of each window first
+    int chunk_index;                              //chunk of the mappings aligned, of chunk_count balanced by estimated cost
+    int chunk_count;                              //chunks the mappings are split in, 1 to align them all
+    uint64_t align_chunk_length;                  //query bases per chunk of the long mappings aligned in parallel, 0 to align them whole
+    uint64_t anchor_min_run;                      //exact-match runs at least this long are not aligned again, 0 to align all of the mappings
+    bool seed_anchors;                            //skip the wflambda cells far from the seed anchors of the mappings, when they have some
+    uint64_t wfa_max_memory;                      //bytes each WFA aligner of a thread may use, 0 for no ceiling
+    int biwfa_threads;                            //threads of the biWFA alignment of a whole mapping
+    bool wfa_stats;                               //report the statistics of the WFA alignments at the end
+    std::string wfa_stats_tsv;                    //statistics of the WFA alignments of each record in TSV, empty for none
+    std::string checkpoint_file;                  //progress of the alignment of mashmapPafFile, to resume it, empty for none
+    double capture_slow_seconds;                  //alignments taking longer are kept as replay bundles in capture_dir, 0 for none
+    std::string capture_dir;                      //directory of the replay bundles of the slow alignments
 
     bool emit_md_tag;                             //Output the MD tag
     bool sam_format;                              //Emit the output in SAM format (PAF default)
     bool no_seq_in_sam;                           //Do not fill the SEQ field in SAM format
+    bool score_only;                              //PAF records with the alignment score instead of the CIGAR
     bool multithread_fasta_input;                 //Multithreaded fasta input
+    bool in_memory_sequences;                     //load the inputs in memory once instead of fetching each window
+    uint64_t fetch_cache_bytes;                   //bases of compressed inputs kept for the fetches of neighbouring mappings, 0 for none
+    int prefetch_threads;                         //threads fetching the regions of the upcoming mappings ahead into the fetch cache, -1 for 8 with remote inputs only
+    bool readahead;                               //have the kernel read the regions of the upcoming mappings of local inputs ahead
+    uint64_t alignment_cache_bytes;               //bytes of alignments of pairs of windows kept to reuse, 0 for none
+    std::string alignment_cache_file;             //alignment cache read before aligning and written after, empty for none
+    bool reciprocal_dedup;                        //output the reciprocal mappings of all-vs-all runs inverted instead of aligned again
+    std::string reuse_alignments_file;            //PAF output of a previous run whose records are reused for the same mappings, empty for none
 
-#ifdef WFA_PNG_TSV_TIMING
     // plotting
     std::string tsvOutputPrefix;                  //tsv files with wavefront information for each alignment
     uint64_t wfplot_max_size;                     // Max size (width/height) of the wfplot
     std::string prefix_wavefront_plot_in_png;     // Prefix of PNG files with wavefront plot for each alignment
 
     std::string path_patching_info_in_tsv;        // TSV file with patching statistics
-#endif
+    uint64_t diagnostics_every;                   //one of each this many alignments is diagnosed
+    double diagnostics_slower_than;               //only the alignments taking longer are diagnosed, aligned again, 0 for all
 };
 
 }
@@ -7,8 +7,10 @@
 #ifndef ALIGN_TYPES_MAP_HPP 
 #define ALIGN_TYPES_MAP_HPP
 
+#include <memory>
 #include <tuple>
 #include <unordered_map>
+#include <vector>
 
 namespace align
 {
@@ -26,6 +28,7 @@ namespace align
     skch::offset_t rEndPos;             //mapping boundary end offset on ref
     skch::strand_t strand;              //mapping strand
     float mashmap_estimated_identity;
+    std::shared_ptr<const std::vector<skch::SeedAnchor>> anchors;   //seeds shared with the target, from the mapping stage, if any
   };
 
   typedef std::unordered_map <std::string, std::string> refSequenceMap_t;
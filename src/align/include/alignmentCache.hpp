@@ -0,0 +1,285 @@
+/**
+ * @file    alignmentCache.hpp
+ * @brief   alignments of sequence pairs met before, shared by the alignment threads
+ */
+
+#ifndef ALIGNMENT_CACHE_HPP
+#define ALIGNMENT_CACHE_HPP
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+//External includes
+#include "common/wflign/src/murmur3.hpp"
+
+namespace align
+{
+  /**
+   * @brief     least recently used cache of PAF alignments, keyed by the content of what
+   *            was aligned
+   * @details   duplicated contigs across haplotypes give byte-identical pairs of windows,
+   *            whose alignment is the same up to the names and offsets of the sequences.
+   *            The records are kept without them, and the key is a 128-bit hash of the
+   *            query and target windows, the target padding included as patching reads it,
+   *            and of everything else the alignment depends on. The cache can be read from
+   *            a file and written back to it, for the next runs
+   */
+  class AlignmentCache
+  {
+    public:
+
+      struct Key
+      {
+        uint64_t low;
+        uint64_t high;
+
+        bool operator==(const Key& other) const
+        {
+          return low == other.low && high == other.high;
+        }
+      };
+
+    private:
+
+      struct KeyHash
+      {
+        size_t operator()(const Key& k) const
+        {
+          return k.low;
+        }
+      };
+
+      using Entry = std::pair<Key, std::string>;
+
+      static constexpr const char* magic = "wfmash-alignment-cache-1";
+
+      const uint64_t maxBytes;
+
+      std::mutex mutex;
+      std::list<Entry> recent;          //most recently used first
+      std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> entries;
+      uint64_t cachedBytes = 0;
+
+      static uint64_t entryBytes(const Entry& e)
+      {
+        return sizeof(Entry) + e.second.size();
+      }
+
+      //keeps the cache within maxBytes, with the lock held
+      void evict()
+      {
+        while (cachedBytes > maxBytes && !recent.empty())
+        {
+          cachedBytes -= entryBytes(recent.back());
+          entries.erase(recent.back().first);
+          recent.pop_back();
+        }
+      }
+
+    public:
+
+      /**
+       * @param[in] maxBytes      bytes of records kept at most
+       */
+      explicit AlignmentCache(uint64_t maxBytes) : maxBytes(maxBytes) {}
+
+      AlignmentCache(const AlignmentCache&) = delete;
+      AlignmentCache& operator=(const AlignmentCache&) = delete;
+
+      /**
+       * @brief             key of the alignment of query against target[targetBegin, targetEnd)
+       * @param[in] query   query window, in the orientation it is aligned in
+       * @param[in] target  target window with its padding
+       * @param[in] salt    everything else the alignment depends on
+       */
+      static Key key(const char* query, uint64_t queryLength,
+                     const char* target, uint64_t targetLength, uint64_t targetBegin, uint64_t targetEnd,
+                     const std::string& salt)
+      {
+        // the 128-bit hashes of each part, hashed again together with the lengths
+        uint64_t parts[9];
+        MurmurHash3_x64_128(query, queryLength, 42, &parts[0]);
+        MurmurHash3_x64_128(target, targetLength, 43, &parts[2]);
+        MurmurHash3_x64_128(salt.data(), salt.size(), 44, &parts[4]);
+        parts[6] = queryLength;
+        parts[7] = targetBegin;
+        parts[8] = targetLength - targetEnd;
+        uint64_t out[2];
+        MurmurHash3_x64_128(parts, sizeof(parts), 45, out);
+        return Key {out[0], out[1]};
+      }
+
+      /**
+       * @brief             the record kept for key, if any
+       */
+      bool get(const Key& key, std::string& record)
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = entries.find(key);
+        if (it == entries.end())
+          return false;
+        recent.splice(recent.begin(), recent, it->second);
+        record = it->second->second;
+        return true;
+      }
+
+      void put(const Key& key, std::string record)
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        // another thread may have aligned the same pair meanwhile
+        if (entries.count(key))
+          return;
+        recent.emplace_front(key, std::move(record));
+        entries.emplace(key, recent.begin());
+        cachedBytes += entryBytes(recent.front());
+        evict();
+      }
+
+      /**
+       * @brief             records of fileName, if it exists, exits if it is not a cache
+       */
+      void load(const std::string& fileName)
+      {
+        std::ifstream in(fileName, std::ios::binary);
+        if (!in.is_open())
+          return;
+        std::string tag;
+        if (!std::getline(in, tag) || tag != magic)
+        {
+          std::cerr << "[wfmash::align::AlignmentCache] ERROR: " << fileName << " is not an alignment cache" << std::endl;
+          exit(1);
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        Key key;
+        uint64_t size;
+        // most recently used first, so that the oldest are the ones left out past maxBytes
+        while (in.read(reinterpret_cast<char*>(&key), sizeof(key)) && in.read(reinterpret_cast<char*>(&size), sizeof(size)))
+        {
+          std::string record(size, '\0');
+          if (!in.read(&record[0], size))
+            break;
+          if (entries.count(key))
+            continue;
+          recent.emplace_back(key, std::move(record));
+          entries.emplace(key, std::prev(recent.end()));
+          cachedBytes += entryBytes(recent.back());
+        }
+        evict();
+      }
+
+      /**
+       * @brief             write the records to fileName, through a rename so that an
+       *                    interruption leaves either the old or the new cache
+       */
+      bool save(const std::string& fileName)
+      {
+        const std::string tmp = fileName + ".tmp";
+        {
+          std::ofstream out(tmp, std::ios::binary);
+          out << magic << "\n";
+          std::lock_guard<std::mutex> lock(mutex);
+          for (const Entry& e : recent)
+          {
+            const uint64_t size = e.second.size();
+            out.write(reinterpret_cast<const char*>(&e.first), sizeof(e.first));
+            out.write(reinterpret_cast<const char*>(&size), sizeof(size));
+            out.write(e.second.data(), size);
+          }
+          if (!out.flush())
+            return false;
+        }
+        return std::rename(tmp.c_str(), fileName.c_str()) == 0;
+      }
+
+      /**
+       * @brief             PAF lines without the names and lengths of the sequences, their
+       *                    coordinates relative to the offsets of the windows
+       */
+      static std::string relative(const std::string& paf, uint64_t queryOffset, uint64_t targetOffset)
+      {
+        std::string out;
+        out.reserve(paf.size());
+        size_t pos = 0;
+        while (pos < paf.size())
+        {
+          size_t end = paf.find('\n', pos);
+          if (end == std::string::npos)
+            end = paf.size();
+          size_t field = pos;
+          for (int i = 0; i < 9 && field < end; ++i)
+          {
+            size_t next = paf.find('\t', field);
+            if (next == std::string::npos || next > end)
+              next = end;
+            if (i == 2 || i == 3)
+              out += std::to_string(std::strtoll(paf.c_str() + field, nullptr, 10) - (int64_t)queryOffset) + "\t";
+            else if (i == 7 || i == 8)
+              out += std::to_string(std::strtoll(paf.c_str() + field, nullptr, 10) - (int64_t)targetOffset) + "\t";
+            else if (i == 4)
+              out.append(paf, field, next - field + 1);
+            field = next + 1;
+          }
+          if (field < end)
+            out.append(paf, field, end - field);
+          out += '\n';
+          pos = end + 1;
+        }
+        return out;
+      }
+
+      /**
+       * @brief             append the PAF lines of a record given by relative, for the
+       *                    sequences and windows given
+       */
+      static void absolute(const std::string& record,
+                           const std::string& queryName, uint64_t queryLength, uint64_t queryOffset,
+                           const std::string& targetName, uint64_t targetLength, uint64_t targetOffset,
+                           std::string& out)
+      {
+        const std::string queryLen = std::to_string(queryLength);
+        const std::string targetLen = std::to_string(targetLength);
+        size_t pos = 0;
+        while (pos < record.size())
+        {
+          const size_t end = record.find('\n', pos);
+          char* field = const_cast<char*>(record.c_str()) + pos;
+          const int64_t qBegin = std::strtoll(field, &field, 10);
+          const int64_t qEnd = std::strtoll(field + 1, &field, 10);
+          const char* strand = field + 1;
+          const int64_t tBegin = std::strtoll(strand + 2, &field, 10);
+          const int64_t tEnd = std::strtoll(field + 1, &field, 10);
+          out += queryName;
+          out += '\t';
+          out += queryLen;
+          out += '\t';
+          out += std::to_string(qBegin + (int64_t)queryOffset);
+          out += '\t';
+          out += std::to_string(qEnd + (int64_t)queryOffset);
+          out += '\t';
+          out += *strand;
+          out += '\t';
+          out += targetName;
+          out += '\t';
+          out += targetLen;
+          out += '\t';
+          out += std::to_string(tBegin + (int64_t)targetOffset);
+          out += '\t';
+          out += std::to_string(tEnd + (int64_t)targetOffset);
+          out.append(record, field - record.c_str(), end + 1 - (field - record.c_str()));
+          pos = end + 1;
+        }
+      }
+  };
+}
+
+#endif
@@ -0,0 +1,81 @@
+/**
+ * @file    alignmentCheckpoint.hpp
+ * @brief   progress of the alignment of a mapping file, kept to resume it after an interruption
+ */
+
+#ifndef ALIGNMENT_CHECKPOINT_HPP
+#define ALIGNMENT_CHECKPOINT_HPP
+
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <sys/stat.h>
+
+namespace align
+{
+  /**
+   * @brief     records of the input whose alignments are all in the output, and the output
+   *            bytes they took
+   * @details   alignments are written in input order, so the records done are always the
+   *            first ones: those in the reorder window are aligned again when resuming. The
+   *            size of the input is kept to refuse resuming the alignment of another input
+   */
+  struct Checkpoint
+  {
+    uint64_t records = 0;
+    uint64_t outputBytes = 0;
+
+    static constexpr const char* magic = "wfmash-alignment-checkpoint-1";
+
+    static uint64_t fileSize(const std::string& fileName)
+    {
+      struct stat st;
+      return stat(fileName.c_str(), &st) == 0 ? st.st_size : 0;
+    }
+
+    /**
+     * @brief             checkpoint of inputFile kept in fileName
+     * @return            false if there is none, exits if it is of another input
+     */
+    bool load(const std::string& fileName, const std::string& inputFile)
+    {
+      std::ifstream in(fileName);
+      if (!in.is_open())
+        return false;
+      std::string tag;
+      uint64_t inputBytes = 0;
+      if (!(in >> tag >> inputBytes >> records >> outputBytes) || tag != magic)
+      {
+        std::cerr << "[wfmash::align::Checkpoint] ERROR: " << fileName << " is not an alignment checkpoint" << std::endl;
+        exit(1);
+      }
+      if (inputBytes != fileSize(inputFile))
+      {
+        std::cerr << "[wfmash::align::Checkpoint] ERROR: " << fileName << " is the checkpoint of another input than "
+                  << inputFile << std::endl;
+        exit(1);
+      }
+      return true;
+    }
+
+    /**
+     * @brief             replace the checkpoint in fileName, through a rename so that an
+     *                    interruption leaves either the old or the new one
+     */
+    bool save(const std::string& fileName, const std::string& inputFile) const
+    {
+      const std::string tmp = fileName + ".tmp";
+      {
+        std::ofstream out(tmp);
+        out << magic << "\t" << fileSize(inputFile) << "\t" << records << "\t" << outputBytes << "\n";
+        if (!out.flush())
+          return false;
+      }
+      return std::rename(tmp.c_str(), fileName.c_str()) == 0;
+    }
+  };
+}
+
+#endif
@@ -0,0 +1,169 @@
+/**
+ * @file    alignmentReplay.hpp
+ * @brief   bundles of the slow alignments of a run, to replay them on their own
+ */
+
+#ifndef ALIGNMENT_REPLAY_HPP
+#define ALIGNMENT_REPLAY_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <sys/stat.h>
+
+#include "align/include/align_parameters.hpp"
+
+namespace align
+{
+  /**
+   * @brief     everything WFlign is given for the alignment of a record: the settings of the
+   *            run (those picked for the record with --wflign-auto), the mapping, and the
+   *            query region, on the strand of the mapping, and target window it aligns, so
+   *            that wfmash-bench --replay aligns it again exactly, without the inputs
+   * @details   kept as a line per field, name and value, then the two sequences
+   */
+  struct ReplayRecord
+  {
+    static constexpr const char* magic = "wfmash-replay-1";
+
+    Parameters param;
+    double seconds = 0;                 //of the alignment in the run it was captured from
+    float identity = 0;                 //mashmap estimated identity of the mapping
+    std::string queryName;
+    uint64_t queryTotalLength = 0;
+    uint64_t queryStart = 0;
+    uint64_t queryLength = 0;
+    bool reverse = false;
+    std::string targetName;
+    uint64_t targetTotalLength = 0;
+    uint64_t targetStart = 0;
+    uint64_t targetLength = 0;
+    uint64_t targetOffset = 0;          //of targetStart in the target window
+    std::string query;
+    std::string target;                 //window, with the padding fetched around the mapping
+
+    /**
+     * @brief     calls f with the name and a reference of each field but the sequences
+     */
+    template <typename F>
+    void fields(F&& f)
+    {
+      f("seconds", seconds);
+      f("identity", identity);
+      f("query_name", queryName);
+      f("query_total_length", queryTotalLength);
+      f("query_start", queryStart);
+      f("query_length", queryLength);
+      f("reverse", reverse);
+      f("target_name", targetName);
+      f("target_total_length", targetTotalLength);
+      f("target_start", targetStart);
+      f("target_length", targetLength);
+      f("target_offset", targetOffset);
+      f("segment_length", param.wflambda_segment_length);
+      f("min_identity", param.min_identity);
+      f("force_biwfa_alignment", param.force_biwfa_alignment);
+      f("wfa_mismatch_score", param.wfa_mismatch_score);
+      f("wfa_gap_opening_score", param.wfa_gap_opening_score);
+      f("wfa_gap_extension_score", param.wfa_gap_extension_score);
+      f("wfa_patching_mismatch_score", param.wfa_patching_mismatch_score);
+      f("wfa_patching_gap_opening_score1", param.wfa_patching_gap_opening_score1);
+      f("wfa_patching_gap_extension_score1", param.wfa_patching_gap_extension_score1);
+      f("wfa_patching_gap_opening_score2", param.wfa_patching_gap_opening_score2);
+      f("wfa_patching_gap_extension_score2", param.wfa_patching_gap_extension_score2);
+      f("wflign_mismatch_score", param.wflign_mismatch_score);
+      f("wflign_gap_opening_score", param.wflign_gap_opening_score);
+      f("wflign_gap_extension_score", param.wflign_gap_extension_score);
+      f("wflign_max_mash_dist", param.wflign_max_mash_dist);
+      f("wflign_min_wavefront_length", param.wflign_min_wavefront_length);
+      f("wflign_max_distance_threshold", param.wflign_max_distance_threshold);
+      f("wflign_max_len_major", param.wflign_max_len_major);
+      f("wflign_max_len_minor", param.wflign_max_len_minor);
+      f("wflign_erode_k", param.wflign_erode_k);
+      f("chain_gap", param.chain_gap);
+      f("wflign_min_inv_patch_len", param.wflign_min_inv_patch_len);
+      f("wflign_max_patching_score", param.wflign_max_patching_score);
+      f("wfa_max_memory", param.wfa_max_memory);
+      f("biwfa_threads", param.biwfa_threads);
+      f("emit_md_tag", param.emit_md_tag);
+      f("sam_format", param.sam_format);
+      f("no_seq_in_sam", param.no_seq_in_sam);
+      f("score_only", param.score_only);
+      f("screen_identity", param.screen_identity);
+    }
+
+    template <typename T>
+    static bool read(std::istream& field, T& value)
+    {
+      return static_cast<bool>(field >> value);
+    }
+
+    static bool read(std::istream& field, std::string& value)
+    {
+      return static_cast<bool>(std::getline(field, value)) || field.eof();
+    }
+
+    bool save(const std::string& fileName)
+    {
+      std::ofstream out(fileName);
+      out.precision(9);
+      out << magic << '\n';
+      fields([&](const char* name, const auto& value) { out << name << '\t' << value << '\n'; });
+      out << "query\t" << query << '\n' << "target\t" << target << '\n';
+      return static_cast<bool>(out.flush());
+    }
+
+    /**
+     * @brief     the bundle of fileName, exits if it is not one
+     */
+    void load(const std::string& fileName)
+    {
+      std::ifstream in(fileName);
+      std::string line;
+      if (!std::getline(in, line) || line != magic)
+      {
+        std::cerr << "[wfmash::align::ReplayRecord] ERROR: " << fileName << " is not a replay bundle" << std::endl;
+        exit(1);
+      }
+      std::map<std::string, std::string> values;
+      while (std::getline(in, line))
+      {
+        const size_t tab = line.find('\t');
+        if (tab != std::string::npos)
+          values[line.substr(0, tab)] = line.substr(tab + 1);
+      }
+      fields([&](const char* name, auto& value) {
+        auto it = values.find(name);
+        std::istringstream field(it == values.end() ? std::string() : it->second);
+        if (it == values.end() || !read(field, value))
+        {
+          std::cerr << "[wfmash::align::ReplayRecord] ERROR: " << fileName << " has no valid " << name << std::endl;
+          exit(1);
+        }
+      });
+      query = values["query"];
+      target = values["target"];
+      if (query.size() != queryLength || targetOffset + targetLength > target.size())
+      {
+        std::cerr << "[wfmash::align::ReplayRecord] ERROR: the sequences of " << fileName << " do not match its mapping" << std::endl;
+        exit(1);
+      }
+    }
+
+    /**
+     * @brief     path of the next bundle captured in directory, made if missing
+     */
+    static std::string nextFile(const std::string& directory)
+    {
+      static std::atomic<uint64_t> captured(0);
+      mkdir(directory.c_str(), 0755);
+      return directory + "/slow-" + std::to_string(captured.fetch_add(1)) + ".replay";
+    }
+  };
+}
+
+#endif
@@ -0,0 +1,378 @@
+/**
+ * @file    chunkedAlignment.hpp
+ * @brief   alignment of a long mapping as overlapping chunks, stitched back into one record
+ * @details chunks follow the diagonal of the mapping, each overlapping the next one. Once
+ *          aligned, consecutive chunks are cut at a point of the overlap where both of
+ *          their paths go through the same match, and their CIGARs joined there. Positions
+ *          are in the orientation of the alignment: query positions are offsets from the
+ *          mapping start on the forward strand, and from the mapping end on the reverse one.
+ *          Long exact-match runs of a mapping can also be taken as they are, with only the
+ *          pieces between them aligned, stitched to the runs in the same way.
+ */
+
+#ifndef CHUNKED_ALIGNMENT_HPP
+#define CHUNKED_ALIGNMENT_HPP
+
+#include <cmath>
+#include <cstdint>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace align
+{
+  namespace chunked
+  {
+    struct Chunk
+    {
+      uint64_t queryBegin;            //query range, in alignment orientation
+      uint64_t queryEnd;
+      uint64_t targetBegin;           //target range, from the mapping start
+      uint64_t targetEnd;
+    };
+
+    /**
+     * @brief     chunks of about chunkLength query bases along the diagonal of a mapping,
+     *            each reaching overlap bases into the next one
+     * @return    a single chunk if the mapping is not longer than two chunks
+     */
+    inline std::vector<Chunk> plan(uint64_t queryLength, uint64_t targetLength, uint64_t chunkLength, uint64_t overlap)
+    {
+      const uint64_t count = std::max<uint64_t>(1, queryLength / chunkLength);
+      std::vector<Chunk> chunks;
+      for (uint64_t i = 0; i < count; i++)
+      {
+        const uint64_t begin = i * queryLength / count;
+        const uint64_t end = i + 1 == count ? queryLength : std::min(queryLength, (i + 1) * queryLength / count + overlap);
+        chunks.push_back(Chunk {begin, end,
+            begin * targetLength / queryLength,
+            i + 1 == count ? targetLength : std::min(targetLength, end * targetLength / queryLength)});
+      }
+      return chunks;
+    }
+
+    /**
+     * @brief     co-linear exact-match runs of at least minRun bases between a query and a target,
+     *            in query order
+     * @details   runs are found from the k-mers of the query occurring once among the k-mers of
+     *            the target sampled every few positions, extended both ways. Every run of at
+     *            least k + sampling - 1 bases holds such a k-mer, unless it is repeated
+     */
+    inline std::vector<Chunk> anchors(const std::string& query, const std::string& target, uint64_t minRun)
+    {
+      constexpr uint64_t k = 32;              //bases of a k-mer, packed in 64 bits
+      constexpr uint64_t sampling = 16;
+      std::vector<Chunk> runs;
+      if (query.size() < minRun || target.size() < minRun || minRun < k + sampling - 1)
+        return runs;
+
+      const auto code = [](char c) -> int {
+        switch (c)
+        {
+          case 'A': return 0;
+          case 'C': return 1;
+          case 'G': return 2;
+          case 'T': return 3;
+          default: return -1;
+        }
+      };
+
+      //start of each sampled k-mer of the target, -1 for the repeated ones
+      std::unordered_map<uint64_t, int64_t> index;
+      {
+        uint64_t kmer = 0, valid = 0;
+        for (uint64_t p = 0; p < target.size(); ++p)
+        {
+          const int c = code(target[p]);
+          if (c < 0)
+          {
+            valid = 0;
+            continue;
+          }
+          kmer = (kmer << 2) | c;
+          if (++valid >= k && (p + 1 - k) % sampling == 0)
+          {
+            auto inserted = index.emplace(kmer, p + 1 - k);
+            if (!inserted.second)
+              inserted.first->second = -1;
+          }
+        }
+      }
+
+      uint64_t kmer = 0, valid = 0;
+      for (uint64_t p = 0; p < query.size(); ++p)
+      {
+        const int c = code(query[p]);
+        if (c < 0)
+        {
+          valid = 0;
+          continue;
+        }
+        kmer = (kmer << 2) | c;
+        if (++valid < k)
+          continue;
+        const auto hit = index.find(kmer);
+        if (hit == index.end() || hit->second < 0)
+          continue;
+
+        Chunk run {p + 1 - k, p + 1, uint64_t(hit->second), uint64_t(hit->second) + k};
+        while (run.queryBegin > 0 && run.targetBegin > 0 && query[run.queryBegin - 1] == target[run.targetBegin - 1])
+        {
+          --run.queryBegin;
+          --run.targetBegin;
+        }
+        while (run.queryEnd < query.size() && run.targetEnd < target.size() && query[run.queryEnd] == target[run.targetEnd])
+        {
+          ++run.queryEnd;
+          ++run.targetEnd;
+        }
+        if (run.queryEnd - run.queryBegin < minRun)
+          continue;
+
+        //the longer of the runs crossing each other is kept
+        while (!runs.empty() && (runs.back().queryEnd > run.queryBegin || runs.back().targetEnd > run.targetBegin)
+               && runs.back().queryEnd - runs.back().queryBegin < run.queryEnd - run.queryBegin)
+          runs.pop_back();
+        if (runs.empty() || (runs.back().queryEnd <= run.queryBegin && runs.back().targetEnd <= run.targetBegin))
+          runs.push_back(run);
+
+        //scan on from the end of the run
+        p = run.queryEnd - 1;
+        valid = 0;
+      }
+      return runs;
+    }
+
+    /**
+     * @brief     path of an alignment, from its start through its CIGAR operations
+     */
+    struct Path
+    {
+      int64_t queryBegin = 0;
+      int64_t targetBegin = 0;        //absolute
+      std::vector<std::pair<uint64_t, char>> ops;
+
+      void push(uint64_t len, char op)
+      {
+        if (len == 0)
+          return;
+        if (!ops.empty() && ops.back().second == op)
+          ops.back().first += len;
+        else
+          ops.emplace_back(len, op);
+      }
+
+      //query and target bases an operation consumes
+      static int64_t queryStep(char op)
+      {
+        return op == 'D' ? 0 : 1;
+      }
+
+      static int64_t targetStep(char op)
+      {
+        return op == 'I' ? 0 : 1;
+      }
+
+      std::pair<int64_t, int64_t> end() const
+      {
+        int64_t q = queryBegin, t = targetBegin;
+        for (const auto& op : ops)
+        {
+          q += queryStep(op.second) * op.first;
+          t += targetStep(op.second) * op.first;
+        }
+        return {q, t};
+      }
+    };
+
+    static inline std::vector<std::string> splitFields(const std::string& line)
+    {
+      std::vector<std::string> fields;
+      size_t begin = 0;
+      while (begin <= line.size())
+      {
+        size_t end = line.find('\t', begin);
+        if (end == std::string::npos)
+          end = line.size();
+        fields.push_back(line.substr(begin, end - begin));
+        begin = end + 1;
+      }
+      return fields;
+    }
+
+    /**
+     * @brief     path of the PAF record a chunk was aligned into
+     * @param[in] record            output of the chunk, which has to be a single PAF record
+     * @param[in] mappingQueryBegin mapping start on the query
+     * @param[in] mappingQueryEnd   mapping end on the query
+     * @return    false if the chunk did not give a single record with a CIGAR
+     */
+    inline bool parse(const std::string& record, bool reverse, uint64_t mappingQueryBegin, uint64_t mappingQueryEnd,
+                      Path& path, std::vector<std::string>* fields = nullptr)
+    {
+      if (record.empty() || record.find('\n') != record.size() - 1)
+        return false;
+      std::vector<std::string> f = splitFields(record.substr(0, record.size() - 1));
+      if (f.size() < 12 || f.back().compare(0, 5, "cg:Z:") != 0)
+        return false;
+
+      const int64_t queryStart = std::stoll(f[2]);
+      const int64_t queryEnd = std::stoll(f[3]);
+      path.queryBegin = reverse ? int64_t(mappingQueryEnd) - queryEnd : queryStart - int64_t(mappingQueryBegin);
+      path.targetBegin = std::stoll(f[7]);
+      path.ops.clear();
+      const std::string& cigar = f.back();
+      uint64_t len = 0;
+      for (size_t i = 5; i < cigar.size(); i++)
+      {
+        if (cigar[i] >= '0' && cigar[i] <= '9')
+        {
+          len = len * 10 + (cigar[i] - '0');
+          continue;
+        }
+        if (cigar[i] != '=' && cigar[i] != 'X' && cigar[i] != 'I' && cigar[i] != 'D')
+          return false;
+        path.push(len, cigar[i]);
+        len = 0;
+      }
+      if (fields != nullptr)
+        *fields = std::move(f);
+      return true;
+    }
+
+    /**
+     * @brief     join the path of the next chunk to the end of path, at a point of their
+     *            overlap where both go through the same match
+     * @return    false if their paths have no such point
+     */
+    inline bool stitch(Path& path, const Path& next)
+    {
+      const auto pathEnd = path.end();
+      struct PointHash
+      {
+        size_t operator()(const std::pair<int64_t, int64_t>& p) const
+        {
+          return std::hash<int64_t>()(p.first) ^ (std::hash<int64_t>()(p.second) * 0x9e3779b97f4a7c15ULL);
+        }
+      };
+
+      //points of the matches of next within the end of path, with the operation they are in
+      std::unordered_map<std::pair<int64_t, int64_t>, std::pair<size_t, uint64_t>, PointHash> nextPoints;
+      {
+        int64_t q = next.queryBegin, t = next.targetBegin;
+        for (size_t i = 0; i < next.ops.size() && q <= pathEnd.first && t <= pathEnd.second; i++)
+        {
+          const auto& op = next.ops[i];
+          if (op.second == '=')
+            for (uint64_t k = 0; k <= op.first && q + int64_t(k) <= pathEnd.first; k++)
+              nextPoints.emplace(std::make_pair(q + int64_t(k), t + int64_t(k)), std::make_pair(i, k));
+          q += Path::queryStep(op.second) * op.first;
+          t += Path::targetStep(op.second) * op.first;
+        }
+      }
+      if (nextPoints.empty())
+        return false;
+
+      //points of path that next goes through, in path order
+      struct Cut
+      {
+        size_t pathOp;
+        uint64_t pathOffset;
+        size_t nextOp;
+        uint64_t nextOffset;
+      };
+      std::vector<Cut> cuts;
+      {
+        int64_t q = path.queryBegin, t = path.targetBegin;
+        for (size_t i = 0; i < path.ops.size(); i++)
+        {
+          const auto& op = path.ops[i];
+          if (op.second == '=' && q + int64_t(op.first) >= next.queryBegin)
+          {
+            for (uint64_t k = 0; k <= op.first; k++)
+            {
+              auto it = nextPoints.find(std::make_pair(q + int64_t(k), t + int64_t(k)));
+              if (it != nextPoints.end())
+                cuts.push_back(Cut {i, k, it->second.first, it->second.second});
+            }
+          }
+          q += Path::queryStep(op.second) * op.first;
+          t += Path::targetStep(op.second) * op.first;
+        }
+      }
+      if (cuts.empty())
+        return false;
+
+      //away from the ends of both chunks, where their alignments are the least reliable
+      const Cut& cut = cuts[cuts.size() / 2];
+      path.ops.resize(cut.pathOp + 1);
+      path.ops.back().first = cut.pathOffset;
+      if (path.ops.back().first == 0)
+        path.ops.pop_back();
+      path.push(next.ops[cut.nextOp].first - cut.nextOffset, next.ops[cut.nextOp].second);
+      for (size_t i = cut.nextOp + 1; i < next.ops.size(); i++)
+        path.push(next.ops[i].first, next.ops[i].second);
+      return true;
+    }
+
+    /**
+     * @brief     PAF record of a stitched path, as WFlign writes one
+     * @param[in] fields    fields of the record of a chunk, for the names, lengths and tags
+     * @return    empty if the alignment is below min_identity
+     */
+    template <typename Phred>
+    inline std::string format(const Path& path, const std::vector<std::string>& fields, bool reverse,
+                              uint64_t mappingQueryBegin, uint64_t mappingQueryEnd, double min_identity,
+                              const Phred& float2phred)
+    {
+      uint64_t matches = 0, mismatches = 0, insertions = 0, inserted_bp = 0, deletions = 0, deleted_bp = 0;
+      std::string cigar;
+      for (const auto& op : path.ops)
+      {
+        switch (op.second)
+        {
+          case '=': matches += op.first; break;
+          case 'X': mismatches += op.first; break;
+          case 'I': ++insertions; inserted_bp += op.first; break;
+          case 'D': ++deletions; deleted_bp += op.first; break;
+        }
+        cigar += std::to_string(op.first);
+        cigar += op.second;
+      }
+
+      const double gap_compressed_identity =
+        (double)matches / (double)(matches + mismatches + insertions + deletions);
+      if (gap_compressed_identity < min_identity)
+        return "";
+      const uint64_t edit_distance = mismatches + inserted_bp + deleted_bp;
+      const double block_identity = (double)matches / (double)(matches + edit_distance);
+
+      const auto end = path.end();
+      const int64_t queryStart = reverse ? int64_t(mappingQueryEnd) - end.first : int64_t(mappingQueryBegin) + path.queryBegin;
+      const int64_t queryEnd = reverse ? int64_t(mappingQueryEnd) - path.queryBegin : int64_t(mappingQueryBegin) + end.first;
+
+      //the estimated identity tag, md:f:, is the same for all chunks
+      std::string estimatedIdentity;
+      for (const auto& f : fields)
+        if (f.compare(0, 5, "md:f:") == 0)
+          estimatedIdentity = f;
+
+      std::ostringstream out;
+      out << fields[0] << "\t" << fields[1] << "\t"
+          << queryStart << "\t" << queryEnd << "\t"
+          << fields[4] << "\t" << fields[5] << "\t" << fields[6] << "\t"
+          << path.targetBegin << "\t" << end.second << "\t" << matches << "\t"
+          << matches + mismatches + inserted_bp + deleted_bp << "\t"
+          << std::round(float2phred(1.0 - block_identity)) << "\t"
+          << "gi:f:" << gap_compressed_identity << "\t"
+          << "bi:f:" << block_identity << "\t"
+          << estimatedIdentity << "\t"
+          << "cg:Z:" << cigar << "\n";
+      return out.str();
+    }
+  }
+}
+
+#endif
@@ -10,26 +10,57 @@
 
 #include <vector>
 #include <algorithm>
+#include <chrono>
 #include <fstream>
 #include <sstream>
 #include <zlib.h>
 #include <cassert>
 #include <thread>
 #include <memory>
+#include <functional>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <numeric>
+#include <deque>
+#include <unordered_map>
 #include <htslib/faidx.h>
 
 //Own includes
 #include "align/include/align_types.hpp"
 #include "align/include/align_parameters.hpp"
+#include "align/include/sequenceCache.hpp"
+#include "align/include/reverseComplementCache.hpp"
+#include "align/include/sequenceStore.hpp"
+#include "align/include/sequencePrefetcher.hpp"
+#include "align/include/regionReadahead.hpp"
+#include "align/include/chunkedAlignment.hpp"
+#include "align/include/alignmentCheckpoint.hpp"
+#include "align/include/alignmentCache.hpp"
+#include "align/include/alignmentReplay.hpp"
+#include "align/include/reciprocalAlignments.hpp"
+#include "align/include/reusedAlignments.hpp"
+#include "align/include/fetchGate.hpp"
 #include "map/include/base_types.hpp"
 #include "map/include/commonFunc.hpp"
+#include "map/include/ThreadPool.hpp"
+#include "map/include/mappingQueue.hpp"
+#include "map/include/binaryMappings.hpp"
 
 //External includes
 #include "common/wflign/src/wflign.hpp"
-#include "common/atomic_queue/atomic_queue.h"
+#include "common/task_executor.hpp"
 #include "common/seqiter.hpp"
 #include "common/progress.hpp"
 #include "common/utils.hpp"
+#include "common/output_writer.hpp"
+#include "common/bam_writer.hpp"
+#include "common/run_report.hpp"
+#include "common/hot_counters.hpp"
+#include "common/trace.hpp"
+#include "common/probes.hpp"
+#include "common/memory_accounting.hpp"
 
 namespace align
 {
@@ -55,6 +86,20 @@ struct seq_record_t {
     uint64_t queryStartPos;
     uint64_t queryLen;
     uint64_t queryTotalLength;
+    // Windows read in place from the sequence stores, instead of refSequence and querySequence
+    const char* refView = nullptr;
+    const char* queryView = nullptr;
+    // Bases [refFilledBegin, refFilledEnd) of refSequence are fetched; the padding around them,
+    // 'N's until then, only once patching reaches into it, through refFaidx
+    uint64_t refFilledBegin = 0;
+    uint64_t refFilledEnd = 0;
+    faidx_t* refFaidx = nullptr;
+    FetchGate* fetchGate = nullptr;
+    // Bytes of the buffers counted in memory_accounting::align_records
+    int64_t accountedBytes = 0;
+
+    // Empty, for a seq_record_pool_t to fill
+    seq_record_t() = default;
 
     seq_record_t(const MappingBoundaryRow& c, const std::string& r, 
                  const std::string& ref, uint64_t refStart, uint64_t refLength, uint64_t refTotalLength,
@@ -69,42 +114,136 @@ struct seq_record_t {
         , queryStartPos(queryStart)
         , queryLen(queryLength)
         , queryTotalLength(queryTotalLength)
+        , refFilledEnd(refSequence.size())
+        {
+            account();
+        }
+
+    seq_record_t(const seq_record_t&) = delete;
+    seq_record_t& operator=(const seq_record_t&) = delete;
+
+    ~seq_record_t() {
+        memory_accounting::add(memory_accounting::align_records, -accountedBytes);
+    }
+
+    /**
+     * Counts the buffers as they are now in memory_accounting::align_records
+     */
+    void account() {
+        const int64_t bytes = refSequence.capacity() + querySequence.capacity();
+        memory_accounting::add(memory_accounting::align_records, bytes - accountedBytes);
+        accountedBytes = bytes;
+    }
+
+    /**
+     * Frees the buffers grown past maxBytes, the others keep their capacity
+     */
+    void shrink(size_t maxBytes) {
+        if (refSequence.capacity() > maxBytes) {
+            std::string().swap(refSequence);
+        }
+        if (querySequence.capacity() > maxBytes) {
+            std::string().swap(querySequence);
+        }
+        account();
+    }
+
+    seq_record_t(const MappingBoundaryRow& c, const std::string& r,
+                 const char* refView, uint64_t refStart, uint64_t refLength, uint64_t refTotalLength,
+                 const char* queryView, uint64_t queryStart, uint64_t queryLength, uint64_t queryTotalLength)
+        : currentRecord(c)
+        , mappingRecordLine(r)
+        , refStartPos(refStart)
+        , refLen(refLength)
+        , refTotalLength(refTotalLength)
+        , queryStartPos(queryStart)
+        , queryLen(queryLength)
+        , queryTotalLength(queryTotalLength)
+        , refView(refView)
+        , queryView(queryView)
         { }
 };
 
 /**
- * @brief A single-producer, multi-consumer (SPMC) atomic queue for storing pointers to seq_record_t objects.
- *
- * This queue is designed for a setup where there is a single producer and multiple consumers.
- * The producer enqueues pointers to seq_record_t objects, which represent sequences to be processed.
- * Multiple consumers dequeue these pointers and perform long-running alignment processes on the sequences.
- *
- * The queue has the following characteristics:
- * - Capacity: 1024 elements
- * - Default value for empty elements: nullptr
- * - MINIMIZE_CONTENTION: true (minimizes contention among consumers)
- * - MAXIMIZE_THROUGHPUT: true (optimized for high throughput)
- * - TOTAL_ORDER: false (relaxed memory ordering for better performance)
- * - SPSC: false (single-producer, multi-consumer mode)
+ * Records of the mappings being aligned, given back once aligned rather than
+ * deleted, so that their buffers keep their capacity from one record to the
+ * next. At most maxSpare records are kept, without the buffers grown past
+ * maxKeptBytes by a long mapping
  */
-typedef atomic_queue::AtomicQueue<seq_record_t*, 1024, nullptr, true, true, false, false> seq_atomic_queue_t;
+class seq_record_pool_t {
+public:
 
-/**
- * @brief A multi-producer, single-consumer (MPSC) atomic queue for storing pointers to std::string objects.
- *
- * This queue is designed for a setup where there are multiple producers and a single consumer.
- * Multiple producers enqueue pointers to std::string objects, which represent PAF (Pairwise Alignment Format) strings.
- * The single consumer dequeues these pointers and writes out the PAF strings.
- *
- * The queue has the following characteristics:
- * - Capacity: 1024 elements
- * - Default value for empty elements: nullptr
- * - MINIMIZE_CONTENTION: true (minimizes contention among producers)
- * - MAXIMIZE_THROUGHPUT: true (optimized for high throughput)
- * - TOTAL_ORDER: false (relaxed memory ordering for better performance)
- * - SPSC: false (multi-producer, single-consumer mode)
- */
-typedef atomic_queue::AtomicQueue<std::string*, 1024, nullptr, true, true, false, false> paf_atomic_queue_t;
+    struct release_t {
+        seq_record_pool_t* pool;
+        void operator()(seq_record_t* rec) const {
+            pool->release(rec);
+        }
+    };
+    using ptr = std::unique_ptr<seq_record_t, release_t>;
+
+    explicit seq_record_pool_t(size_t maxSpare) : maxSpare(maxSpare) {}
+
+    seq_record_pool_t(const seq_record_pool_t&) = delete;
+    seq_record_pool_t& operator=(const seq_record_pool_t&) = delete;
+
+    ~seq_record_pool_t() {
+        for (seq_record_t* rec : spare) {
+            delete rec;
+        }
+    }
+
+    /**
+     * A record to fill, with the buffers of one aligned before if any
+     */
+    ptr acquire() {
+        seq_record_t* rec = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!spare.empty()) {
+                rec = spare.back();
+                spare.pop_back();
+            }
+        }
+        if (rec == nullptr) {
+            rec = new seq_record_t();
+        }
+        rec->refView = nullptr;
+        rec->queryView = nullptr;
+        rec->refFaidx = nullptr;
+        rec->fetchGate = nullptr;
+        return ptr(rec, release_t{this});
+    }
+
+private:
+
+    static constexpr size_t maxKeptBytes = 1 << 21;
+
+    const size_t maxSpare;
+    std::mutex mutex;
+    std::vector<seq_record_t*> spare;
+
+    void release(seq_record_t* rec) {
+        rec->shrink(maxKeptBytes);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (spare.size() < maxSpare) {
+                spare.push_back(rec);
+                return;
+            }
+        }
+        delete rec;
+    }
+};
+
+// A mapping to align, as a PAF line parsed by the alignment task, or as a record
+// read from the binary format, which comes with the sequence lengths
+struct mapping_input_t {
+    std::string line;
+    MappingBoundaryRow record;
+    int64_t refTotalLength = -1;
+    int64_t queryTotalLength = -1;
+    uint64_t bytes = 0;                 // estimated bytes of its sequences, counted in flight
+};
 
 
   /**
@@ -119,16 +258,148 @@ typedef atomic_queue::AtomicQueue<std::string*, 1024, nullptr, true, true, false
       //algorithm parameters
       const align::Parameters &param;
 
+      //Mappings ordered by cost at a time with --longest-first and no --reorder-window
+      static constexpr size_t defaultLongestFirstWindow = 4096;
+
+      //Mappings whose regions are prefetched at a time, with prefetching and no --reorder-window
+      static constexpr size_t defaultPrefetchWindow = 1024;
+
+      //Bytes of alignments held in memory ahead of their turn with --deterministic-output, the
+      //others being spilled to a temporary file
+      static constexpr size_t deterministicWindowBytes = size_t(256) << 20;
+
+      //Prefetching helpers for remote inputs, unless --prefetch-threads is given
+      static constexpr int defaultRemotePrefetchThreads = 8;
+
+      //Query bases at least where consecutive chunks of a long mapping overlap
+      static constexpr uint64_t minChunkOverlap = 2048;
+
+      //Bases the pieces between exact-match runs reach into the runs, to stitch with them
+      static constexpr uint64_t anchorOverlap = 250;
+
+      //Bases of the reverse complemented query regions kept for the records of the same region
+      static constexpr uint64_t revcompCacheBytes = 1 << 26;
+
+      //Bytes of alignments kept for the mappings of the other direction, with --reciprocal-dedup
+      static constexpr uint64_t reciprocalBytes = uint64_t(1) << 30;
+
+      //Seconds between checkpoints of the progress, with --checkpoint
+      static constexpr int checkpointSeconds = 300;
+
       faidx_t* ref_faidx;
       faidx_t* query_faidx;
 
+      //Regions fetched from compressed or remote inputs, shared when the query and reference file are one
+      std::shared_ptr<SequenceCache> ref_cache;
+      std::shared_ptr<SequenceCache> query_cache;
+
+      //Whole inputs in memory, shared when the query and reference file are one
+      std::shared_ptr<SequenceStore> ref_store;
+      std::shared_ptr<SequenceStore> query_store;
+
+      //Alignments of the pairs of windows met before, with --align-cache, and the parameters
+      //they depend on, in their keys
+      std::unique_ptr<AlignmentCache> alignment_cache;
+      std::string alignment_cache_salt;
+
+      //Statistics of the WFA alignments, summed over the records with --wfa-stats, and
+      //written for each record aligned with --wfa-stats-tsv
+      std::mutex wfa_stats_mutex;
+      wavefront_stats_t wfa_stats_wflambda;
+      wavefront_stats_t wfa_stats_alignments;
+      std::ofstream wfa_stats_tsv;
+
+      //Wavefront and patching TSVs of a record diagnosed, written once it is aligned
+      struct Diagnostics
+      {
+          std::ostringstream wavefronts;
+          std::ostringstream patching;
+      };
+
+      //Records that could be diagnosed so far, sampled with --diagnostics-every, and the
+      //patching TSV they are appended to
+      std::atomic<uint64_t> diagnostics_candidates{0};
+      std::mutex diagnostics_mutex;
+      std::ofstream patching_tsv;
+
+      //Reverse complements of the query regions of the records on the reverse strand
+      ReverseComplementCache revcomp_cache{revcompCacheBytes};
+
+      //Alignments of an all-vs-all run kept for the mappings the other way, with --reciprocal-dedup
+      std::unique_ptr<ReciprocalAlignments> reciprocal_alignments;
+
+      //Records of the previous output reused for the mappings that did not change, with
+      //--reuse-alignments, and the parameters they depend on, in their keys
+      std::unique_ptr<ReusedAlignments> reused_alignments;
+      std::string reused_alignments_salt;
+
+      //Held while alignWithQuery reads the target file
+      FetchGate in_memory_fetch_gate;
+
+      //Records of the mappings being aligned, about two per thread kept for reuse
+      seq_record_pool_t record_pool;
+
     public:
 
-      explicit Aligner(const align::Parameters &p) : param(p) {
+      explicit Aligner(const align::Parameters &p) : param(p), record_pool(2 * std::max(1, p.threads)) {
+          wavefront_stats_clear(&wfa_stats_wflambda);
+          wavefront_stats_clear(&wfa_stats_alignments);
           assert(param.refSequences.size() == 1);
           assert(param.querySequences.size() == 1);
           ref_faidx = fai_load(param.refSequences.front().c_str());
           query_faidx = fai_load(param.querySequences.front().c_str());
+
+          if (param.in_memory_sequences) {
+              auto t0 = skch::Time::now();
+              // those the mapping stage of the run read are not read again
+              ref_store = SequenceStore::takeKept(param.refSequences.front());
+              if (ref_store == nullptr) {
+                  ref_store = std::make_shared<SequenceStore>(param.refSequences.front(), param.threads);
+              }
+              if (param.querySequences.front() == param.refSequences.front()) {
+                  query_store = ref_store;
+              } else if ((query_store = SequenceStore::takeKept(param.querySequences.front())) == nullptr) {
+                  query_store = std::make_shared<SequenceStore>(param.querySequences.front(), param.threads);
+              }
+              std::chrono::duration<double> timeLoad = skch::Time::now() - t0;
+              std::cerr << "[wfmash::align] loaded "
+                        << ref_store->totalBases() + (query_store != ref_store ? query_store->totalBases() : 0)
+                        << " bases of input sequences in " << timeLoad.count() << " sec" << std::endl;
+          } else if (param.fetch_cache_bytes > 0) {
+              if (SequenceCache::isCompressed(param.refSequences.front())
+                  || SequenceCache::isRemote(param.refSequences.front())) {
+                  ref_cache = std::make_shared<SequenceCache>(param.fetch_cache_bytes);
+              }
+              if (param.querySequences.front() == param.refSequences.front()) {
+                  query_cache = ref_cache;
+              } else if (SequenceCache::isCompressed(param.querySequences.front())
+                         || SequenceCache::isRemote(param.querySequences.front())) {
+                  query_cache = std::make_shared<SequenceCache>(param.fetch_cache_bytes);
+              }
+          }
+
+          if (param.alignment_cache_bytes > 0 && !param.sam_format) {
+              alignment_cache.reset(new AlignmentCache(param.alignment_cache_bytes));
+              if (!param.alignment_cache_file.empty()) {
+                  alignment_cache->load(param.alignment_cache_file);
+              }
+              alignment_cache_salt = alignmentSalt();
+          }
+
+          // the CIGAR is all that is inverted, the MD tag and SAM records are left to align
+          if (param.reciprocal_dedup && !param.sam_format && !param.emit_md_tag
+              && param.querySequences.front() == param.refSequences.front()) {
+              reciprocal_alignments.reset(new ReciprocalAlignments(reciprocalBytes));
+          }
+
+          // records of a mapping also depend on how it is split to be aligned
+          if (!param.reuse_alignments_file.empty() && !param.sam_format) {
+              reused_alignments.reset(new ReusedAlignments(param.reuse_alignments_file));
+              std::ostringstream salt;
+              salt << alignmentSalt() << ' ' << (useChunks() ? param.align_chunk_length : 0)
+                   << ' ' << (useAnchors() ? param.anchor_min_run : 0);
+              reused_alignments_salt = salt.str();
+          }
       }
 
       ~Aligner() {
@@ -137,11 +408,215 @@ typedef atomic_queue::AtomicQueue<std::string*, 1024, nullptr, true, true, false
       }
       
       /**
-       * @brief                 compute alignments
+       * @brief                 compute alignments of the mappings in param.mashmapPafFile
        */
       void compute()
       {
-        this->computeAlignments();
+        // Mappings of our own mapping stage come in the binary format
+        const bool binary = skch::binmap::isBinaryFile(param.mashmapPafFile);
+
+        // The total to align is in the trailer of a binary file, else it grows as the
+        // mappings are read, so that the input is read only once
+        // (with --chunk, that of the mappings of the chunk, added as they are picked)
+        uint64_t total_alignment_length = 0;
+        const bool chunked = param.chunk_count > 1;
+        const bool totalKnown = chunked || (binary && skch::binmap::readTotalQuerySpan(param.mashmapPafFile, total_alignment_length));
+        progress_meter::ProgressMeter progress(total_alignment_length, "[wfmash::align::computeAlignments] aligned", "align");
+
+        // A compressed mapping file is inflated as it is read
+        std::unique_ptr<std::istream> mappingListFile;
+        if (SequenceCache::isCompressed(param.mashmapPafFile)) {
+            mappingListFile.reset(new igzstream(param.mashmapPafFile.c_str()));
+        } else {
+            mappingListFile.reset(new std::ifstream(param.mashmapPafFile, binary ? std::ios::binary : std::ios::in));
+        }
+        std::istream& mappingListStream = *mappingListFile;
+        if (!mappingListStream.good()) {
+            throw std::runtime_error("[wfmash::align::computeAlignments] Error! Failed to open input mapping file: " + param.mashmapPafFile);
+        }
+
+        if (binary) {
+            skch::binmap::Reader reader(mappingListStream);
+            this->computeAlignments([&](mapping_input_t& m) {
+                skch::binmap::Record r;
+                if (!reader.next(r)) {
+                    return false;
+                }
+                const skch::ContigInfo& query = reader.queries[r.queryId];
+                const skch::ContigInfo& ref = reader.refs[r.refId];
+                m.record.qId = query.name;
+                m.record.qStartPos = r.queryStartPos;
+                m.record.qEndPos = r.queryEndPos;
+                m.record.strand = r.strand ? skch::strnd::FWD : skch::strnd::REV;
+                m.record.refId = ref.name;
+                m.record.rStartPos = r.refStartPos;
+                m.record.rEndPos = r.refEndPos;
+                m.record.mashmap_estimated_identity = r.nucIdentity;
+                m.record.anchors = param.seed_anchors && !reader.anchors.empty()
+                    ? seedAnchors(r, reader.anchors) : nullptr;
+                m.queryTotalLength = query.len;
+                m.refTotalLength = ref.len;
+                if (!totalKnown) {
+                    progress.add_total(r.queryEndPos - r.queryStartPos);
+                }
+                return true;
+            }, &progress);
+        } else {
+            this->computeAlignments([&](mapping_input_t& m) {
+                while (std::getline(mappingListStream, m.line)) {
+                    if (!m.line.empty()) {
+                        if (!chunked) {
+                            progress.add_total(querySpan(m.line));
+                        }
+                        return true;
+                    }
+                }
+                return false;
+            }, &progress);
+        }
+      }
+
+      /**
+       * @brief                 seed anchors of a binary mapping record, in sequence coordinates
+       */
+      static std::shared_ptr<const std::vector<skch::SeedAnchor>> seedAnchors(
+              const skch::binmap::Record& r, const std::vector<skch::binmap::Anchor>& anchors) {
+          auto points = std::make_shared<std::vector<skch::SeedAnchor>>();
+          points->reserve(anchors.size());
+          for (const skch::binmap::Anchor& a : anchors) {
+              points->push_back(skch::SeedAnchor{r.queryStartPos + a.queryOffset, r.refStartPos + a.refOffset});
+          }
+          return points;
+      }
+
+      /**
+       * @brief                 compute alignments of the mappings handed over by the mapping
+       *                        stage, as they come
+       * @details               the total to align is not known upfront, so there is no progress meter
+       */
+      void compute(skch::MappingQueue& mappings)
+      {
+        std::string chunk;
+        size_t pos = 0;
+        this->computeAlignments([&](mapping_input_t& m) {
+            while (pos >= chunk.size()) {
+                if (!mappings.pop(chunk)) {
+                    return false;
+                }
+                pos = 0;
+            }
+            size_t end = chunk.find('\n', pos);
+            if (end == std::string::npos) {
+                end = chunk.size();
+            }
+            m.line.assign(chunk, pos, end - pos);
+            pos = end + 1;
+            return true;
+        }, nullptr);
+      }
+
+      /**
+       * @brief       query end minus query start of a mashmap row, without parsing the rest
+       * @details     0 for a malformed row, which parseMashmapRow reports
+       */
+      inline static uint64_t querySpan(const std::string &mappingRecordLine) {
+          return columnSpan(mappingRecordLine, 2);
+      }
+
+      /**
+       * @brief       end minus start of a mashmap row, its start in column startColumn (from 0)
+       *              and its end in the next one, 0 for a malformed row
+       */
+      inline static uint64_t columnSpan(const std::string &mappingRecordLine, int startColumn) {
+          size_t field = 0;
+          for (int tabs = 0; tabs < startColumn; ++tabs) {
+              field = mappingRecordLine.find('\t', field);
+              if (field == std::string::npos) {
+                  return 0;
+              }
+              ++field;
+          }
+          char* end;
+          const uint64_t start = std::strtoull(mappingRecordLine.c_str() + field, &end, 10);
+          const uint64_t stop = std::strtoull(end, nullptr, 10);
+          return stop > start ? stop - start : 0;
+      }
+
+      /**
+       * @brief       value of column (from 0) of a mashmap row, 0 for a malformed row
+       */
+      inline static uint64_t columnValue(const std::string &mappingRecordLine, int column) {
+          size_t field = 0;
+          for (int tabs = 0; tabs < column; ++tabs) {
+              field = mappingRecordLine.find('\t', field);
+              if (field == std::string::npos) {
+                  return 0;
+              }
+              ++field;
+          }
+          return std::strtoull(mappingRecordLine.c_str() + field, nullptr, 10);
+      }
+
+      /**
+       * @brief       target name and start of a mapping, to group mappings by target
+       * @details     read from the row without parsing the rest, for a mapping given as a row
+       */
+      inline static std::pair<std::string, uint64_t> targetKey(const mapping_input_t &mapping) {
+          if (mapping.line.empty()) {
+              return {mapping.record.refId, mapping.record.rStartPos};
+          }
+          const std::string &row = mapping.line;
+          size_t field = 0;
+          for (int tabs = 0; tabs < 5; ++tabs) {
+              field = row.find('\t', field);
+              if (field == std::string::npos) {
+                  return {std::string(), 0};
+              }
+              ++field;
+          }
+          const size_t nameEnd = std::min(row.find('\t', field), row.size());
+          std::pair<std::string, uint64_t> key(row.substr(field, nameEnd - field), 0);
+          // skip the target length to its start
+          const size_t lenEnd = row.find('\t', nameEnd + 1);
+          if (nameEnd < row.size() && lenEnd != std::string::npos) {
+              key.second = std::strtoull(row.c_str() + lenEnd + 1, nullptr, 10);
+          }
+          return key;
+      }
+
+      /**
+       * @brief       rough cost of aligning a mapping, growing with its length and divergence
+       * @details     the estimated identity is read from the id:f: tag of a mapping given as a row
+       */
+      inline static double estimatedCost(const mapping_input_t &mapping) {
+          uint64_t length;
+          float identity;
+          if (mapping.line.empty()) {
+              length = mapping.record.qEndPos - mapping.record.qStartPos;
+              identity = mapping.record.mashmap_estimated_identity;
+          } else {
+              length = querySpan(mapping.line);
+              const size_t tag = mapping.line.find("\tid:f:");
+              identity = tag != std::string::npos
+                  ? std::strtof(mapping.line.c_str() + tag + 6, nullptr)
+                  : skch::fixed::percentage_identity;
+          }
+          // wavefronts grow with the edit distance, which grows with the divergence
+          const double divergence = std::max(0.0, 1.0 - identity);
+          return double(length) * (0.01 + divergence);
+      }
+
+      /**
+       * @brief       bases of the sequences a mapping is aligned with, its target window padded
+       *              as createSeqRecord does, to bound the bytes of the mappings in flight
+       */
+      uint64_t estimatedBytes(const mapping_input_t &mapping) const {
+          const uint64_t padding = 2 * param.wflign_max_len_minor;
+          if (mapping.line.empty()) {
+              return (mapping.record.qEndPos - mapping.record.qStartPos)
+                  + (mapping.record.rEndPos - mapping.record.rStartPos) + padding;
+          }
+          return querySpan(mapping.line) + columnSpan(mapping.line, 7) + padding;
       }
 
       /**
@@ -182,16 +657,106 @@ typedef atomic_queue::AtomicQueue<std::string*, 1024, nullptr, true, true, false
           }
       }
 
+      /**
+       * @brief       align a mapping of a query held in memory, its target window being fetched
+       *              from the reference as for the mappings of compute(); safe to call from
+       *              several threads at once
+       * @param[in]   record    mapping, of query qId on target refId
+       * @param[in]   query     whole sequence of the query
+       * @return      the PAF or SAM record(s) of the alignment, as written to the output
+       */
+      std::string alignWithQuery(const MappingBoundaryRow& record, const std::string& query) {
+          if (record.qStartPos > record.qEndPos || record.qEndPos > query.size()) {
+              throw std::runtime_error("[wfmash::align::alignWithQuery] Error! Mapping outside of query " + record.qId);
+          }
+          int64_t ref_size;
+          {
+              std::lock_guard<FetchGate> lock(in_memory_fetch_gate);
+              ref_size = faidx_seq_len(ref_faidx, record.refId.c_str());
+          }
+          if (ref_size < 0 || record.rEndPos > (uint64_t)ref_size) {
+              throw std::runtime_error("[wfmash::align::alignWithQuery] Error! Mapping outside of target " + record.refId);
+          }
+          const uint64_t head_padding = std::min<uint64_t>(record.rStartPos, param.wflign_max_len_minor);
+          const uint64_t tail_padding = std::min<uint64_t>(ref_size - record.rEndPos, param.wflign_max_len_minor);
+          const std::string ref_seq = fetchSequence(ref_cache.get(), ref_faidx, record.refId,
+                                                    record.rStartPos - head_padding,
+                                                    record.rEndPos - 1 + tail_padding, &in_memory_fetch_gate);
+          seq_record_t rec(record, "",
+                           ref_seq, record.rStartPos - head_padding, ref_seq.size(), ref_size,
+                           query.substr(record.qStartPos, record.qEndPos - record.qStartPos),
+                           record.qStartPos, record.qEndPos - record.qStartPos, query.size());
+          std::string out;
+          processAlignment(&rec, out);
+          return out;
+      }
+
   private:
 
-seq_record_t* createSeqRecord(const MappingBoundaryRow& currentRecord, 
+/**
+ * @brief       bases [begin, end] of a sequence, through the cache if there is one
+ * @param[in]   fetch_gate    held while reading the file, unless null
+ * @param[out]  out           replaced by the bases, keeping its capacity
+ */
+void fetchSequence(SequenceCache* cache, faidx_t* faidx, const std::string& name,
+                   int64_t begin, int64_t end, FetchGate* fetch_gate, std::string& out) {
+    const auto fetch_into = [&](int64_t from, int64_t to, std::string& into) {
+        std::unique_lock<FetchGate> lock;
+        if (fetch_gate != nullptr) {
+            lock = std::unique_lock<FetchGate>(*fetch_gate);
+        }
+        int64_t len;
+        char* seq = faidx_fetch_seq64(faidx, name.c_str(), from, to, &len);
+        if (seq == nullptr) {
+            throw std::runtime_error("[wfmash::align::fetchSequence] Error! Failed to fetch " + name
+                                     + ":" + std::to_string(from) + "-" + std::to_string(to));
+        }
+        hot_counters::add(hot_counters::faidx_bytes, len);
+        into.assign(seq, len);
+        free(seq);
+    };
+    if (cache == nullptr) {
+        fetch_into(begin, end, out);
+        return;
+    }
+    cache->get(name, begin, end, [&](int64_t from, int64_t to) {
+        std::string chunk;
+        fetch_into(from, to, chunk);
+        return chunk;
+    }, out);
+}
+
+std::string fetchSequence(SequenceCache* cache, faidx_t* faidx, const std::string& name,
+                          int64_t begin, int64_t end, FetchGate* fetch_gate) {
+    std::string out;
+    fetchSequence(cache, faidx, name, begin, end, fetch_gate, out);
+    return out;
+}
+
+seq_record_pool_t::ptr createSeqRecord(const MappingBoundaryRow& currentRecord, 
                               const std::string& mappingRecordLine,
                               faidx_t* ref_faidx,
-                              faidx_t* query_faidx) {
-    // Get the reference sequence length
-    const int64_t ref_size = faidx_seq_len(ref_faidx, currentRecord.refId.c_str());
-    // Get the query sequence length
-    const int64_t query_size = faidx_seq_len(query_faidx, currentRecord.qId.c_str());
+                              faidx_t* query_faidx,
+                              FetchGate* fetch_gate,
+                              int64_t ref_size = -1,
+                              int64_t query_size = -1) {
+    if (ref_store != nullptr) {
+        return createSeqRecordInPlace(currentRecord, mappingRecordLine);
+    }
+
+    // Get the sequence lengths, unless the mapping came with them
+    if (ref_size < 0 || query_size < 0) {
+        std::unique_lock<FetchGate> lock;
+        if (fetch_gate != nullptr) {
+            lock = std::unique_lock<FetchGate>(*fetch_gate);
+        }
+        if (ref_size < 0) {
+            ref_size = faidx_seq_len(ref_faidx, currentRecord.refId.c_str());
+        }
+        if (query_size < 0) {
+            query_size = faidx_seq_len(query_faidx, currentRecord.qId.c_str());
+        }
+    }
 
     // Compute padding
     const uint64_t head_padding = currentRecord.rStartPos >= param.wflign_max_len_minor
@@ -199,51 +764,505 @@ seq_record_t* createSeqRecord(const MappingBoundaryRow& currentRecord,
     const uint64_t tail_padding = ref_size - currentRecord.rEndPos >= param.wflign_max_len_minor
         ? param.wflign_max_len_minor : ref_size - currentRecord.rEndPos;
 
-    // Extract reference sequence
-    int64_t ref_len;
-    char* ref_seq = faidx_fetch_seq64(ref_faidx, currentRecord.refId.c_str(),
-                                      currentRecord.rStartPos - head_padding, 
-                                      currentRecord.rEndPos - 1 + tail_padding, &ref_len);
+    // Fill a record of the pool for the alignment, the sequences fetched into its buffers
+    seq_record_pool_t::ptr rec = record_pool.acquire();
+    rec->currentRecord = currentRecord;
+    rec->mappingRecordLine = mappingRecordLine;
+
+    // Extract reference sequence: the padding, which most alignments do not patch into, is
+    // fetched by processAlignment only if they do, unless the alignment cache keys the whole
+    // window
+    if (alignment_cache) {
+        fetchSequence(ref_cache.get(), ref_faidx, currentRecord.refId,
+                      currentRecord.rStartPos - head_padding,
+                      currentRecord.rEndPos - 1 + tail_padding, fetch_gate, rec->refSequence);
+        rec->refFilledBegin = 0;
+        rec->refFilledEnd = rec->refSequence.size();
+    } else {
+        fetchSequence(ref_cache.get(), ref_faidx, currentRecord.refId,
+                      currentRecord.rStartPos, currentRecord.rEndPos - 1, fetch_gate, rec->refSequence);
+        rec->refFilledBegin = head_padding;
+        rec->refFilledEnd = head_padding + rec->refSequence.size();
+        rec->refSequence.insert(0, head_padding, 'N');
+        rec->refSequence.append(tail_padding, 'N');
+        rec->refFaidx = ref_faidx;
+        rec->fetchGate = fetch_gate;
+    }
 
     // Extract query sequence
-    int64_t query_len;
-    char* query_seq = faidx_fetch_seq64(query_faidx, currentRecord.qId.c_str(),
-                                        currentRecord.qStartPos, currentRecord.qEndPos - 1, &query_len);
+    fetchSequence(query_cache.get(), query_faidx, currentRecord.qId,
+                  currentRecord.qStartPos, currentRecord.qEndPos - 1, fetch_gate, rec->querySequence);
+
+    rec->refStartPos = currentRecord.rStartPos - head_padding;
+    rec->refLen = rec->refSequence.size();
+    rec->refTotalLength = ref_size;
+    rec->queryStartPos = currentRecord.qStartPos;
+    rec->queryLen = rec->querySequence.size();
+    rec->queryTotalLength = query_size;
+    rec->account();
+    return rec;
+}
 
-    // Create a new seq_record_t object for the alignment
-    seq_record_t* rec = new seq_record_t(currentRecord, mappingRecordLine,
-                                         std::string(ref_seq, ref_len), 
-                                         currentRecord.rStartPos - head_padding, ref_len, ref_size,
-                                         std::string(query_seq, query_len), 
-                                         currentRecord.qStartPos, query_len, query_size);
+/**
+ * @brief       record of a mapping whose windows are read in place from the sequence stores,
+ *              padded as createSeqRecord does
+ */
+seq_record_pool_t::ptr createSeqRecordInPlace(const MappingBoundaryRow& currentRecord,
+                                              const std::string& mappingRecordLine) {
+    const uint32_t ref_id = ref_store->id(currentRecord.refId);
+    const uint32_t query_id = query_store->id(currentRecord.qId);
+    const uint64_t ref_size = ref_store->length(ref_id);
+    const uint64_t query_size = query_store->length(query_id);
+
+    const uint64_t head_padding = std::min<uint64_t>(currentRecord.rStartPos, param.wflign_max_len_minor);
+    const uint64_t ref_end = std::min<uint64_t>(currentRecord.rEndPos + param.wflign_max_len_minor, ref_size);
+    const uint64_t ref_start = currentRecord.rStartPos - head_padding;
+    const uint64_t query_end = std::min<uint64_t>(currentRecord.qEndPos, query_size);
+
+    seq_record_pool_t::ptr rec = record_pool.acquire();
+    rec->currentRecord = currentRecord;
+    rec->mappingRecordLine = mappingRecordLine;
+    rec->refView = ref_store->data(ref_id) + ref_start;
+    rec->refStartPos = ref_start;
+    rec->refLen = ref_end - ref_start;
+    rec->refTotalLength = ref_size;
+    rec->queryView = query_store->data(query_id) + currentRecord.qStartPos;
+    rec->queryStartPos = currentRecord.qStartPos;
+    rec->queryLen = query_end - currentRecord.qStartPos;
+    rec->queryTotalLength = query_size;
+    return rec;
+}
 
-    // Clean up
-    free(ref_seq);
-    free(query_seq);
+/**
+ * @brief       the parameters the alignment of a pair of windows depends on, for the keys of
+ *              the alignments reused
+ */
+std::string alignmentSalt() const {
+    std::ostringstream salt;
+    salt << param.wflambda_segment_length << ' ' << param.min_identity << ' ' << param.force_biwfa_alignment
+         << ' ' << param.wfa_mismatch_score << ' ' << param.wfa_gap_opening_score << ' ' << param.wfa_gap_extension_score
+         << ' ' << param.wfa_patching_mismatch_score
+         << ' ' << param.wfa_patching_gap_opening_score1 << ' ' << param.wfa_patching_gap_extension_score1
+         << ' ' << param.wfa_patching_gap_opening_score2 << ' ' << param.wfa_patching_gap_extension_score2
+         << ' ' << param.wflign_mismatch_score << ' ' << param.wflign_gap_opening_score << ' ' << param.wflign_gap_extension_score
+         << ' ' << param.wflign_max_mash_dist << ' ' << param.wflign_min_wavefront_length
+         << ' ' << param.wflign_max_distance_threshold << ' ' << param.wflign_max_len_major << ' ' << param.wflign_max_len_minor
+         << ' ' << param.wflign_erode_k << ' ' << param.chain_gap << ' ' << param.wflign_min_inv_patch_len
+         << ' ' << param.wflign_max_patching_score << ' ' << param.emit_md_tag << ' ' << param.wfa_max_memory
+         << ' ' << param.wflign_auto << ' ' << param.score_only << ' ' << param.screen_identity
+         << ' ' << param.seed_anchors;
+    return salt.str();
+}
 
-    return rec;
+/**
+ * @brief       true if long mappings are aligned in chunks, only for PAF records with CIGARs but no MD tags
+ */
+bool useChunks() const {
+    return param.align_chunk_length > 0 && !param.sam_format && !param.emit_md_tag && !param.score_only;
 }
 
-std::string processAlignment(seq_record_t* rec) {
-    std::string& ref_seq = rec->refSequence;
-    std::string& query_seq = rec->querySequence;
+/**
+ * @brief       true if the long exact-match runs of mappings are taken as they are, only for
+ *              PAF records with CIGARs but no MD tags
+ */
+/**
+ * @brief       helpers prefetching the regions of the upcoming mappings, 0 for none
+ */
+int prefetchThreads() const {
+    if (ref_cache == nullptr && query_cache == nullptr) {
+        return 0;
+    }
+    if (param.prefetch_threads >= 0) {
+        return param.prefetch_threads;
+    }
+    return SequenceCache::isRemote(param.refSequences.front()) || SequenceCache::isRemote(param.querySequences.front())
+        ? defaultRemotePrefetchThreads : 0;
+}
+
+/**
+ * @brief       queues the regions createSeqRecord will fetch for a mapping, its target
+ *              window padded as there (and clipped at the end of the target by the fetch),
+ *              to a SequencePrefetcher or a RegionReadahead
+ */
+template <typename Prefetcher>
+void prefetchRecord(Prefetcher& prefetcher, const mapping_input_t& mapping) const {
+    MappingBoundaryRow record = mapping.record;
+    if (!mapping.line.empty()) {
+        parseMashmapRow(mapping.line, record);
+    }
+    const uint64_t head_padding = std::min<uint64_t>(record.rStartPos, param.wflign_max_len_minor);
+    prefetcher.enqueue(true, record.refId, record.rStartPos - head_padding,
+                       record.rEndPos - 1 + param.wflign_max_len_minor);
+    prefetcher.enqueue(false, record.qId, record.qStartPos, record.qEndPos - 1);
+}
+
+bool useAnchors() const {
+    return param.anchor_min_run > 0 && !param.sam_format && !param.emit_md_tag && !param.score_only;
+}
+
+/**
+ * @brief       segment length and WFlign heuristic thresholds of a mapping with -W auto,
+ *              from its estimated identity and length
+ * @details     calibrated on simulated pairs of 20kbp to 5Mbp at 0.2-20% divergence: 1024bp
+ *              segments are the fastest for megabase mappings of near identical sequences,
+ *              128bp ones for divergent mappings, where they also align more bases, and 256bp
+ *              ones for the rest. The heuristic thresholds count wflambda steps, so those not
+ *              given are scaled to span the bases their defaults span with 256bp segments
+ */
+void autoWflignSettings(const MappingBoundaryRow& record, uint16_t& segment_length,
+                        int& min_wavefront_length, int& max_distance_threshold) const {
+    const double identity = record.mashmap_estimated_identity;
+    if (identity >= 0.995 && record.qEndPos - record.qStartPos >= 1000000) {
+        segment_length = 1024;
+    } else if (identity < 0.9) {
+        segment_length = 128;
+    } else {
+        segment_length = 256;
+    }
+    if (param.wflign_min_wavefront_length <= 0) {
+        min_wavefront_length = 1024 * 256 / segment_length;
+    }
+    if (param.wflign_max_distance_threshold <= 0) {
+        max_distance_threshold = (int) (2048.0 / (identity * identity)) * 256 / segment_length;
+    }
+}
+
+/**
+ * @brief       the part of a mapping covered by a chunk
+ */
+static MappingBoundaryRow chunkRecord(const MappingBoundaryRow& record, const chunked::Chunk& chunk) {
+    const bool reverse = record.strand != skch::strnd::FWD;
+    MappingBoundaryRow chunk_record = record;
+    chunk_record.qStartPos = reverse ? record.qEndPos - chunk.queryEnd : record.qStartPos + chunk.queryBegin;
+    chunk_record.qEndPos = reverse ? record.qEndPos - chunk.queryBegin : record.qStartPos + chunk.queryEnd;
+    chunk_record.rStartPos = record.rStartPos + chunk.targetBegin;
+    chunk_record.rEndPos = record.rStartPos + chunk.targetEnd;
+    return chunk_record;
+}
+
+/**
+ * @brief       align a mapping around its long exact-match runs, only the pieces between them
+ *              being aligned, on as many threads, and stitched with the runs into one record
+ * @details     the mapping is aligned whole if it has no such run, or if a piece does not give
+ *              a single record stitching with the runs around it
+ * @param[in]   align_record    appends the alignment output of a mapping to its second argument
+ * @param[in]   fetch_record    sequences of a mapping
+ * @param[out]  out             the output of the mapping is appended to it
+ */
+template <typename AlignFn, typename FetchFn>
+void alignAroundAnchors(const MappingBoundaryRow& record, tasks::Executor& executor, const AlignFn& align_record,
+                        const FetchFn& fetch_record, std::string& out) {
+    const bool reverse = record.strand != skch::strnd::FWD;
+    std::vector<chunked::Chunk> anchors;
+    {
+        seq_record_pool_t::ptr rec = fetch_record(record);
+        const char* ref_window = rec->refView != nullptr ? rec->refView : rec->refSequence.data();
+        const char* query_window = rec->queryView != nullptr ? rec->queryView : rec->querySequence.data();
+        const uint64_t target_begin = record.rStartPos - rec->refStartPos;
+        std::string target(ref_window + target_begin,
+                           std::min<uint64_t>(record.rEndPos - record.rStartPos, rec->refLen - target_begin));
+        std::string query(rec->queryLen, 'N');
+        if (reverse) {
+            skch::CommonFunc::reverseComplement(query_window, &query[0], rec->queryLen);
+        } else {
+            std::copy(query_window, query_window + rec->queryLen, query.begin());
+        }
+        skch::CommonFunc::makeUpperCaseAndValidDNA(&target[0], target.size());
+        skch::CommonFunc::makeUpperCaseAndValidDNA(&query[0], query.size());
+        anchors = chunked::anchors(query, target, std::max<uint64_t>(param.anchor_min_run, 4 * anchorOverlap));
+    }
+    if (anchors.empty()) {
+        align_record(record, out);
+        return;
+    }
+
+    // pieces before, between and after the runs, reaching into them
+    const uint64_t query_length = record.qEndPos - record.qStartPos;
+    const uint64_t target_length = record.rEndPos - record.rStartPos;
+    std::vector<chunked::Chunk> pieces(anchors.size() + 1);
+    for (size_t i = 0; i < pieces.size(); ++i) {
+        pieces[i].queryBegin = i == 0 ? 0 : anchors[i - 1].queryEnd - anchorOverlap;
+        pieces[i].targetBegin = i == 0 ? 0 : anchors[i - 1].targetEnd - anchorOverlap;
+        pieces[i].queryEnd = i == anchors.size() ? query_length : anchors[i].queryBegin + anchorOverlap;
+        pieces[i].targetEnd = i == anchors.size() ? target_length : anchors[i].targetBegin + anchorOverlap;
+    }
+    std::vector<std::string> outputs(pieces.size());
+    {
+        tasks::TaskGroup group(executor);
+        for (size_t i = 0; i < pieces.size(); ++i) {
+            group.run([&, i]() {
+                align_record(chunkRecord(record, pieces[i]), outputs[i]);
+            });
+        }
+        group.wait();
+    }
+
+    chunked::Path path, next;
+    std::vector<std::string> fields;
+    bool stitched = chunked::parse(outputs[0], reverse, record.qStartPos, record.qEndPos, path, &fields);
+    for (size_t i = 0; stitched && i < anchors.size(); ++i) {
+        chunked::Path run;
+        run.queryBegin = anchors[i].queryBegin;
+        run.targetBegin = record.rStartPos + anchors[i].targetBegin;
+        run.push(anchors[i].queryEnd - anchors[i].queryBegin, '=');
+        stitched = chunked::stitch(path, run)
+            && chunked::parse(outputs[i + 1], reverse, record.qStartPos, record.qEndPos, next)
+            && chunked::stitch(path, next);
+    }
+    if (!stitched) {
+        align_record(record, out);
+        return;
+    }
+    out += chunked::format(path, fields, reverse, record.qStartPos, record.qEndPos, param.min_identity, float2phred);
+}
+
+/**
+ * @brief       align a long mapping as overlapping chunks, on as many threads, stitched into
+ *              one record
+ * @details     the mapping is aligned whole if it is not long enough, or if a chunk does not
+ *              give a single record stitching with its neighbours, as around inversions
+ * @param[in]   align_record    appends the alignment output of a mapping to its second argument
+ * @param[out]  out             the output of the mapping is appended to it
+ */
+template <typename AlignFn>
+void alignInChunks(const MappingBoundaryRow& record, tasks::Executor& executor, const AlignFn& align_record,
+                   std::string& out) {
+    const uint64_t query_length = record.qEndPos - record.qStartPos;
+    const uint64_t target_length = record.rEndPos - record.rStartPos;
+    const uint64_t overlap = std::max<uint64_t>(minChunkOverlap, param.align_chunk_length / 8);
+    const std::vector<chunked::Chunk> chunks = chunked::plan(query_length, target_length, param.align_chunk_length, overlap);
+    if (chunks.size() < 2) {
+        align_record(record, out);
+        return;
+    }
+
+    const bool reverse = record.strand != skch::strnd::FWD;
+    std::vector<std::string> outputs(chunks.size());
+    {
+        tasks::TaskGroup group(executor);
+        for (size_t i = 0; i < chunks.size(); ++i) {
+            group.run([&, i]() {
+                align_record(chunkRecord(record, chunks[i]), outputs[i]);
+            });
+        }
+        group.wait();
+    }
+
+    chunked::Path path, next;
+    std::vector<std::string> fields;
+    bool stitched = chunked::parse(outputs[0], reverse, record.qStartPos, record.qEndPos, path, &fields);
+    for (size_t i = 1; stitched && i < chunks.size(); ++i) {
+        stitched = chunked::parse(outputs[i], reverse, record.qStartPos, record.qEndPos, next)
+            && chunked::stitch(path, next);
+    }
+    if (!stitched) {
+        align_record(record, out);
+        return;
+    }
+    out += chunked::format(path, fields, reverse, record.qStartPos, record.qEndPos, param.min_identity, float2phred);
+}
+
+/**
+ * @brief       runs f(0) ... f(n-1) on the calling thread and on the executor
+ * @details     the calling thread is in the middle of an alignment, so it takes indices itself
+ *              rather than running other queued tasks, and only waits on those that started
+ *              elsewhere: tasks starting once all the indices are taken return at once
+ */
+static void parallelFor(tasks::Executor& executor, const uint64_t n, const std::function<void(const uint64_t)>& f) {
+    struct State {
+        std::atomic<uint64_t> next{0};
+        uint64_t done = 0;
+        std::mutex mutex;
+        std::condition_variable finished;
+    };
+    const auto state = std::make_shared<State>();
+    const auto take = [state, n, &f]() {
+        for (uint64_t i = state->next.fetch_add(1); i < n; i = state->next.fetch_add(1)) {
+            f(i);
+            std::lock_guard<std::mutex> lock(state->mutex);
+            if (++state->done == n) {
+                state->finished.notify_all();
+            }
+        }
+    };
+    const uint64_t helpers = std::min<uint64_t>(n, executor.size()) - 1;
+    for (uint64_t i = 0; i < helpers; ++i) {
+        // f outlives the tasks that reach it, the last index being done only after they took theirs
+        executor.submit(take);
+    }
+    take();
+    std::unique_lock<std::mutex> lock(state->mutex);
+    state->finished.wait(lock, [&]() { return state->done == n; });
+}
 
-    skch::CommonFunc::makeUpperCaseAndValidDNA(ref_seq.data(), ref_seq.length());
-    skch::CommonFunc::makeUpperCaseAndValidDNA(query_seq.data(), query_seq.length());
+/**
+ * @brief       align a record, appending its output to out
+ */
+void processAlignment(seq_record_t* rec, std::string& out) {
+    // Windows of the stores are already upper case and valid, and only read
+    char* ref_window = const_cast<char*>(rec->refView);
+    const char* query_window = rec->queryView;
+    if (ref_window == nullptr) {
+        std::string& ref_seq = rec->refSequence;
+        std::string& query_seq = rec->querySequence;
+        skch::CommonFunc::makeUpperCaseAndValidDNA(ref_seq.data() + rec->refFilledBegin,
+                                                   rec->refFilledEnd - rec->refFilledBegin);
+        skch::CommonFunc::makeUpperCaseAndValidDNA(query_seq.data(), query_seq.length());
+        ref_window = ref_seq.data();
+        query_window = query_seq.data();
+    }
 
     // Adjust the reference sequence to start from the original start position
-    char* ref_seq_ptr = &ref_seq[rec->currentRecord.rStartPos - rec->refStartPos];
+    char* ref_seq_ptr = ref_window + (rec->currentRecord.rStartPos - rec->refStartPos);
+
+    // The query window on the strand of the mapping: read in place on the forward strand, and
+    // complemented once for the records of a region on the reverse one
+    ReverseComplementCache::Strand query_reverse;
+    char* query_strand = const_cast<char*>(query_window);
+    if (rec->currentRecord.strand != skch::strnd::FWD) {
+        query_reverse = revcomp_cache.get(rec->currentRecord.qId, rec->queryStartPos, rec->queryLen, query_window);
+        query_strand = const_cast<char*>(query_reverse->data());
+    }
 
-    std::vector<char> queryRegionStrand(query_seq.size() + 1);
+    // a pair of windows aligned before is not aligned again
+    const uint64_t target_begin = rec->currentRecord.rStartPos - rec->refStartPos;
+    AlignmentCache::Key cache_key;
+    if (alignment_cache) {
+        std::string salt = alignment_cache_salt;
+        salt += rec->currentRecord.strand == skch::strnd::FWD ? '+' : '-';
+        salt.append(reinterpret_cast<const char*>(&rec->currentRecord.mashmap_estimated_identity),
+                    sizeof(rec->currentRecord.mashmap_estimated_identity));
+        cache_key = AlignmentCache::key(query_strand, rec->queryLen, ref_window, rec->refLen,
+                                        target_begin, target_begin + rec->currentRecord.rEndPos - rec->currentRecord.rStartPos,
+                                        salt);
+        std::string cached;
+        if (alignment_cache->get(cache_key, cached)) {
+            AlignmentCache::absolute(cached, rec->currentRecord.qId, rec->queryTotalLength, rec->queryStartPos,
+                                     rec->currentRecord.refId, rec->refTotalLength, rec->currentRecord.rStartPos, out);
+            return;
+        }
+    }
+    const size_t out_begin = out.size();
 
-    if(rec->currentRecord.strand == skch::strnd::FWD) {
-        std::copy(query_seq.begin(), query_seq.end(), queryRegionStrand.begin());
-    } else {
-        skch::CommonFunc::reverseComplement(query_seq.data(), queryRegionStrand.data(), query_seq.size());
+    uint16_t segment_length = param.wflambda_segment_length;
+    int min_wavefront_length = param.wflign_min_wavefront_length;
+    int max_distance_threshold = param.wflign_max_distance_threshold;
+    if (param.wflign_auto) {
+        autoWflignSettings(rec->currentRecord, segment_length, min_wavefront_length, max_distance_threshold);
     }
 
-    wflign::wavefront::WFlign wflign(
-        param.wflambda_segment_length,
+    wflign::wavefront::WFlign wflign = makeWflign(*rec, segment_length, min_wavefront_length, max_distance_threshold);
+
+    // wflambda looks for the path of the alignment only around the seeds of the mapping
+    std::vector<std::pair<uint64_t, uint64_t>> seed_anchors;
+    if (rec->currentRecord.anchors) {
+        windowAnchors(*rec, seed_anchors);
+        wflign.set_anchors(&seed_anchors);
+    }
+
+    // the WFA aligners, and the memory of their allocators, outlive the record on each thread
+    static thread_local wflign::wavefront::WFlignAligners aligners;
+    wflign.set_aligners(&aligners);
+    wflign.set_max_memory(param.wfa_max_memory);
+    wflign.set_biwfa_threads(param.biwfa_threads);
+    if (param.threads > 1) {
+        wflign.set_parallel_for([this](const uint64_t n, const std::function<void(const uint64_t)>& f) {
+            parallelFor(tasks::sharedExecutor(param.threads, tasks::Stage::Align), n, f);
+        });
+    }
+
+    // the diagnostics of a sampled record are gathered as it is aligned, unless only those of
+    // the slow ones are, which are then aligned again for them
+    std::unique_ptr<Diagnostics> diagnostics;
+    if (diagnosing() && param.diagnostics_slower_than <= 0 && sampleDiagnostics()) {
+        diagnostics.reset(new Diagnostics());
+    }
+    output::StringAppender output(out);
+    setWflignOutput(wflign, &output, diagnostics.get());
+    wflign.set_score_only(param.score_only);
+    wflign.set_screen_identity(param.screen_identity);
+    wflign::wavefront::wflign_target_fetch_t fetch_padding;
+    if (rec->refFaidx != nullptr) {
+        fetch_padding = [&](const uint64_t begin, const uint64_t end) { fetchPadding(*rec, begin, end); };
+        wflign.set_target_fetch(&fetch_padding);
+    }
+    std::unique_ptr<wflign::wavefront::wflign_stats_t> wfa_stats;
+    if (param.wfa_stats || !param.wfa_stats_tsv.empty()) {
+        wfa_stats.reset(new wflign::wavefront::wflign_stats_t());
+        wflign.set_stats(wfa_stats.get());
+    }
+
+    const auto align_begin = std::chrono::steady_clock::now();
+    wflign.wflign_affine_wavefront(
+        rec->currentRecord.qId,
+        query_strand,
+        rec->queryTotalLength,
+        rec->queryStartPos,
+        rec->queryLen,
+        rec->currentRecord.strand != skch::strnd::FWD,
+        rec->currentRecord.refId,
+        ref_seq_ptr,
+        rec->refTotalLength,
+        rec->currentRecord.rStartPos,
+        rec->currentRecord.rEndPos - rec->currentRecord.rStartPos);
+
+    static thread_local memory_accounting::ThreadShare aligners_memory(memory_accounting::wfa_aligners);
+    aligners_memory.set(aligners.memory_used());
+
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - align_begin).count();
+    if (diagnostics) {
+        writeDiagnostics(*rec, *diagnostics);
+    } else if (diagnosing() && param.diagnostics_slower_than > 0 && seconds > param.diagnostics_slower_than
+               && sampleDiagnostics()) {
+        diagnoseAlignment(*rec, query_strand, ref_seq_ptr, segment_length, min_wavefront_length, max_distance_threshold);
+    }
+
+    if (param.capture_slow_seconds > 0) {
+        if (seconds > param.capture_slow_seconds) {
+            if (rec->refFaidx != nullptr) {
+                fetchPadding(*rec, rec->refStartPos, rec->refStartPos + rec->refLen);
+            }
+            captureSlowAlignment(*rec, query_strand, ref_window, segment_length, min_wavefront_length,
+                                 max_distance_threshold, seconds);
+        }
+    }
+
+    if (wfa_stats) {
+        recordWfaStats(*rec, *wfa_stats);
+    }
+
+    if (alignment_cache) {
+        alignment_cache->put(cache_key, AlignmentCache::relative(out.substr(out_begin), rec->queryStartPos,
+                                                                 rec->currentRecord.rStartPos));
+    }
+}
+
+/**
+ * @brief       seed anchors of a record inside its query window, on the strand of the mapping,
+ *              and its target window, from the start of each and by query position
+ */
+static void windowAnchors(const seq_record_t& rec, std::vector<std::pair<uint64_t, uint64_t>>& out) {
+    const MappingBoundaryRow& record = rec.currentRecord;
+    const bool reverse = record.strand != skch::strnd::FWD;
+    const int64_t query_end = rec.queryStartPos + rec.queryLen;
+    const int64_t target_length = record.rEndPos - record.rStartPos;
+    for (const skch::SeedAnchor& a : *record.anchors) {
+        const int64_t q = reverse ? query_end - a.queryPos : a.queryPos - (int64_t) rec.queryStartPos;
+        const int64_t t = a.refPos - record.rStartPos;
+        if (q >= 0 && q < (int64_t) rec.queryLen && t >= 0 && t < target_length) {
+            out.emplace_back(q, t);
+        }
+    }
+    std::sort(out.begin(), out.end());
+}
+
+/**
+ * @brief       WFlign aligner of a record, with the settings of the run
+ */
+wflign::wavefront::WFlign makeWflign(const seq_record_t& rec, uint16_t segment_length,
+                                     int min_wavefront_length, int max_distance_threshold) const {
+    return wflign::wavefront::WFlign(
+        segment_length,
         param.min_identity,
         param.force_biwfa_alignment,
         param.wfa_mismatch_score,
@@ -254,203 +1273,228 @@ std::string processAlignment(seq_record_t* rec) {
         param.wfa_patching_gap_extension_score1,
         param.wfa_patching_gap_opening_score2,
         param.wfa_patching_gap_extension_score2,
-        rec->currentRecord.mashmap_estimated_identity,
+        rec.currentRecord.mashmap_estimated_identity,
         param.wflign_mismatch_score,
         param.wflign_gap_opening_score,
         param.wflign_gap_extension_score,
         param.wflign_max_mash_dist,
-        param.wflign_min_wavefront_length,
-        param.wflign_max_distance_threshold,
+        min_wavefront_length,
+        max_distance_threshold,
         param.wflign_max_len_major,
         param.wflign_max_len_minor,
         param.wflign_erode_k,
         param.chain_gap,
         param.wflign_min_inv_patch_len,
         param.wflign_max_patching_score);
+}
 
-    std::stringstream output;
+/**
+ * @brief       true if alignment diagnostics are written
+ */
+bool diagnosing() const {
+    return !param.tsvOutputPrefix.empty() || !param.prefix_wavefront_plot_in_png.empty()
+        || !param.path_patching_info_in_tsv.empty();
+}
+
+/**
+ * @brief       true for one of each diagnostics_every records that may be diagnosed
+ */
+bool sampleDiagnostics() {
+    return diagnostics_candidates.fetch_add(1, std::memory_order_relaxed) % param.diagnostics_every == 0;
+}
+
+/**
+ * @brief       has WFlign write its records to out, and the diagnostics of the run to
+ *              diagnostics unless null, its PNG plots going straight to their files
+ */
+void setWflignOutput(wflign::wavefront::WFlign& wflign, std::ostream* out, Diagnostics* diagnostics) const {
+    static const std::string no_plots;
     wflign.set_output(
-        &output,
-#ifdef WFA_PNG_TSV_TIMING
-        !param.tsvOutputPrefix.empty(),
-        nullptr,
-        param.prefix_wavefront_plot_in_png,
+        out,
+        diagnostics != nullptr && !param.tsvOutputPrefix.empty(),
+        diagnostics != nullptr ? &diagnostics->wavefronts : nullptr,
+        diagnostics != nullptr ? param.prefix_wavefront_plot_in_png : no_plots,
         param.wfplot_max_size,
-        !param.path_patching_info_in_tsv.empty(),
-        nullptr,
-#endif
+        diagnostics != nullptr && !param.path_patching_info_in_tsv.empty(),
+        diagnostics != nullptr ? &diagnostics->patching : nullptr,
         true, // merge alignments
         param.emit_md_tag,
         !param.sam_format,
         param.no_seq_in_sam);
-
-    wflign.wflign_affine_wavefront(
-        rec->currentRecord.qId,
-        queryRegionStrand.data(),
-        rec->queryTotalLength,
-        rec->queryStartPos,
-        rec->queryLen,
-        rec->currentRecord.strand != skch::strnd::FWD,
-        rec->currentRecord.refId,
-        ref_seq_ptr,
-        rec->refTotalLength,
-        rec->currentRecord.rStartPos,
-        rec->currentRecord.rEndPos - rec->currentRecord.rStartPos);
-
-    return output.str();
 }
 
-void single_reader_thread(const std::string& input_file,
-                          atomic_queue::AtomicQueue<std::string*, 1024>& line_queue,
-                          std::atomic<bool>& reader_done) {
-    std::ifstream mappingListStream(input_file);
-    if (!mappingListStream.is_open()) {
-        throw std::runtime_error("[wfmash::align::computeAlignments] Error! Failed to open input mapping file: " + input_file);
+/**
+ * @brief       writes the wavefront TSV of a record to a file of its own, named after its
+ *              mapping, and appends its patches to the patching TSV
+ */
+void writeDiagnostics(const seq_record_t& rec, const Diagnostics& diagnostics) {
+    if (!param.tsvOutputPrefix.empty()) {
+        const MappingBoundaryRow& r = rec.currentRecord;
+        const std::string path = param.tsvOutputPrefix + r.qId + "_" + std::to_string(r.qStartPos) + "_"
+            + std::to_string(r.qEndPos) + "_" + (r.strand == skch::strnd::FWD ? "+" : "-") + "_" + r.refId + "_"
+            + std::to_string(r.rStartPos) + "_" + std::to_string(r.rEndPos) + ".tsv";
+        std::ofstream tsv(path);
+        tsv << diagnostics.wavefronts.str();
+        if (!tsv) {
+            std::cerr << "[wfmash::align::computeAlignments] WARNING, failed to write the wavefronts to " << path << std::endl;
+        }
     }
-
-    std::string line;
-    while (std::getline(mappingListStream, line)) {
-        if (!line.empty()) {
-            std::string* line_ptr = new std::string(std::move(line));
-            line_queue.push(line_ptr);
-        }
-    }
-
-    mappingListStream.close();
-    reader_done.store(true);
-}
-
-void processor_thread(std::atomic<size_t>& total_alignments_queued,
-                      std::atomic<bool>& reader_done,
-                      atomic_queue::AtomicQueue<std::string*, 1024>& line_queue,
-                      seq_atomic_queue_t& seq_queue,
-                      std::atomic<bool>& thread_should_exit) {
-    faidx_t* local_ref_faidx = fai_load(param.refSequences.front().c_str());
-    faidx_t* local_query_faidx = fai_load(param.querySequences.front().c_str());
-
-    while (!thread_should_exit.load()) {
-        std::string* line_ptr = nullptr;
-        if (line_queue.try_pop(line_ptr)) {
-            MappingBoundaryRow currentRecord;
-            parseMashmapRow(*line_ptr, currentRecord);
-            
-            // Process the record and create seq_record_t
-            seq_record_t* rec = createSeqRecord(currentRecord, *line_ptr, local_ref_faidx, local_query_faidx);
-
-            while (!seq_queue.try_push(rec)) {
-                if (thread_should_exit.load()) {
-                    delete rec;
-                    delete line_ptr;
-                    goto cleanup;
-                }
-                std::this_thread::sleep_for(std::chrono::milliseconds(10));
-            }
-
-            ++total_alignments_queued;
-            delete line_ptr;
-        } else if (reader_done.load() && line_queue.was_empty()) {
-            break;
-        } else {
-            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    if (!param.path_patching_info_in_tsv.empty()) {
+        std::lock_guard<std::mutex> lock(diagnostics_mutex);
+        if (!patching_tsv.is_open()) {
+            patching_tsv.open(param.path_patching_info_in_tsv);
         }
+        patching_tsv << diagnostics.patching.str();
     }
-
-cleanup:
-    fai_destroy(local_ref_faidx);
-    fai_destroy(local_query_faidx);
 }
 
-void processor_manager(seq_atomic_queue_t& seq_queue,
-                       atomic_queue::AtomicQueue<std::string*, 1024>& line_queue,
-                       std::atomic<size_t>& total_alignments_queued,
-                       std::atomic<bool>& reader_done,
-                       std::atomic<bool>& processor_done,
-                       size_t max_processors) {
-    std::vector<std::thread> processor_threads;
-    std::vector<std::atomic<bool>> thread_should_exit(max_processors);
-
-    const size_t queue_capacity = seq_queue.capacity();
-    const size_t low_threshold = 1;
-    const size_t high_threshold = queue_capacity * 0.8;
+/**
+ * @brief       aligns a record again with the diagnostics on, its output dropped, as it was
+ *              slower than --diagnostics-slower-than
+ */
+void diagnoseAlignment(seq_record_t& rec, char* query_strand, char* ref_seq_ptr, uint16_t segment_length,
+                       int min_wavefront_length, int max_distance_threshold) {
+    if (rec.refFaidx != nullptr) {
+        fetchPadding(rec, rec.refStartPos, rec.refStartPos + rec.refLen);
+    }
+    wflign::wavefront::WFlign wflign = makeWflign(rec, segment_length, min_wavefront_length, max_distance_threshold);
+    wflign.set_max_memory(param.wfa_max_memory);
+    wflign.set_score_only(param.score_only);
+    wflign.set_screen_identity(param.screen_identity);
+    Diagnostics diagnostics;
+    std::ostringstream dropped;
+    setWflignOutput(wflign, &dropped, &diagnostics);
+    wflign.wflign_affine_wavefront(
+        rec.currentRecord.qId,
+        query_strand,
+        rec.queryTotalLength,
+        rec.queryStartPos,
+        rec.queryLen,
+        rec.currentRecord.strand != skch::strnd::FWD,
+        rec.currentRecord.refId,
+        ref_seq_ptr,
+        rec.refTotalLength,
+        rec.currentRecord.rStartPos,
+        rec.currentRecord.rEndPos - rec.currentRecord.rStartPos);
+    writeDiagnostics(rec, diagnostics);
+}
 
-    auto spawn_processor = [&](size_t id) {
-        thread_should_exit[id].store(false);
-        processor_threads.emplace_back([this, &total_alignments_queued, &reader_done, &line_queue, &seq_queue, &thread_should_exit, id]() {
-            this->processor_thread(total_alignments_queued, reader_done, line_queue, seq_queue, thread_should_exit[id]);
-        });
+/**
+ * @brief       fetches the bases [begin, end) of the target window of rec, in target coordinates,
+ *              that are not fetched yet, upper case, into its padding
+ */
+void fetchPadding(seq_record_t& rec, uint64_t begin, uint64_t end) {
+    begin = std::max(begin, rec.refStartPos) - rec.refStartPos;
+    end = std::min(end - rec.refStartPos, rec.refLen);
+    std::string bases;
+    const auto fill = [&](uint64_t from, uint64_t to) {
+        fetchSequence(ref_cache.get(), rec.refFaidx, rec.currentRecord.refId,
+                      rec.refStartPos + from, rec.refStartPos + to - 1, rec.fetchGate, bases);
+        skch::CommonFunc::makeUpperCaseAndValidDNA(bases.data(), bases.size());
+        std::copy(bases.begin(), bases.begin() + std::min<uint64_t>(bases.size(), to - from),
+                  rec.refSequence.begin() + from);
+        hot_counters::add(hot_counters::padding_bytes, to - from);
     };
-
-    // Start with one processor
-    spawn_processor(0);
-    size_t current_processors = 1;
-    uint64_t exhausted = 0;
-
-    while (!reader_done.load() || !line_queue.was_empty() || !seq_queue.was_empty()) {
-        size_t queue_size = seq_queue.was_size();
-
-        if (param.multithread_fasta_input) {
-            if (queue_size < low_threshold && current_processors < max_processors) {
-                ++exhausted;
-            } else if (queue_size > high_threshold && current_processors > 1) {
-                thread_should_exit[--current_processors].store(true);
-            }
-
-            if (exhausted > 20 && queue_size < low_threshold) {
-                spawn_processor(current_processors++);
-                exhausted = 0;
-            }
-        }
-
-        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    if (begin < rec.refFilledBegin) {
+        fill(begin, rec.refFilledBegin);
+        rec.refFilledBegin = begin;
+    }
+    if (end > rec.refFilledEnd) {
+        fill(rec.refFilledEnd, end);
+        rec.refFilledEnd = end;
     }
+}
 
-    // Signal all remaining threads to exit
-    for (size_t i = 0; i < current_processors; ++i) {
-        thread_should_exit[i].store(true);
+/**
+ * @brief       keeps the alignment of rec, which took seconds, as a bundle of --capture-slow,
+ *              with the settings it was aligned with and the query region (on the strand of
+ *              the mapping) and target window given to WFlign
+ */
+void captureSlowAlignment(const seq_record_t& rec, const char* query, const char* ref_window,
+                          uint16_t segment_length, int min_wavefront_length, int max_distance_threshold,
+                          double seconds) const {
+    ReplayRecord replay;
+    replay.param = param;
+    replay.param.wflambda_segment_length = segment_length;
+    replay.param.wflign_min_wavefront_length = min_wavefront_length;
+    replay.param.wflign_max_distance_threshold = max_distance_threshold;
+    replay.seconds = seconds;
+    replay.identity = rec.currentRecord.mashmap_estimated_identity;
+    replay.queryName = rec.currentRecord.qId;
+    replay.queryTotalLength = rec.queryTotalLength;
+    replay.queryStart = rec.queryStartPos;
+    replay.queryLength = rec.queryLen;
+    replay.reverse = rec.currentRecord.strand != skch::strnd::FWD;
+    replay.targetName = rec.currentRecord.refId;
+    replay.targetTotalLength = rec.refTotalLength;
+    replay.targetStart = rec.currentRecord.rStartPos;
+    replay.targetLength = rec.currentRecord.rEndPos - rec.currentRecord.rStartPos;
+    replay.targetOffset = rec.currentRecord.rStartPos - rec.refStartPos;
+    replay.query.assign(query, rec.queryLen);
+    replay.target.assign(ref_window, rec.refLen);
+    const std::string fileName = ReplayRecord::nextFile(param.capture_dir);
+    if (replay.save(fileName)) {
+        std::cerr << "[wfmash::align] alignment of " << replay.queryName << ":" << replay.queryStart << " on "
+                  << replay.targetName << ":" << replay.targetStart << " took " << seconds << " sec, kept in "
+                  << fileName << std::endl;
+    } else {
+        std::cerr << "[wfmash::align] WARNING, failed to keep the slow alignment of " << replay.queryName
+                  << " in " << fileName << std::endl;
     }
+}
 
-    // Wait for all processor threads to finish
-    for (auto& thread : processor_threads) {
-        thread.join();
+/**
+ * @brief       columns of WFA statistics, for the TSV of --wfa-stats-tsv
+ */
+static void writeWfaStats(std::ostream& out, const wavefront_stats_t& stats) {
+    out << '\t' << stats.num_alignments << '\t' << stats.num_steps << '\t' << stats.num_extend_calls
+        << '\t' << stats.max_wavefront_length << '\t' << stats.max_memory_used
+        << '\t' << stats.time_compute_ns / 1e6 << '\t' << stats.time_extend_ns / 1e6
+        << '\t' << stats.time_backtrace_ns / 1e6;
+}
+
+static void writeWfaStatsHeader(std::ostream& out, const std::string& prefix) {
+    for (const char* column : {"alignments", "steps", "extend_calls", "max_wavefront_length",
+                               "max_memory_bytes", "compute_ms", "extend_ms", "backtrace_ms"}) {
+        out << '\t' << prefix << column;
     }
-    processor_done.store(true);
 }
 
-void worker_thread(uint64_t tid,
-                   std::atomic<bool>& is_working,
-                   seq_atomic_queue_t& seq_queue,
-                   paf_atomic_queue_t& paf_queue,
-                   std::atomic<bool>& reader_done,
-                   std::atomic<bool>& processor_done,
-                   progress_meter::ProgressMeter& progress,
-                   std::atomic<uint64_t>& processed_alignment_length) {
-    is_working.store(true);
-    while (true) {
-        seq_record_t* rec = nullptr;
-        if (seq_queue.try_pop(rec)) {
-            is_working.store(true);
-            std::string alignment_output = processAlignment(rec);
-            
-            // Push the alignment output to the paf_queue
-            paf_queue.push(new std::string(std::move(alignment_output)));
-            
-            // Update progress meter and processed alignment length
-            uint64_t alignment_length = rec->currentRecord.qEndPos - rec->currentRecord.qStartPos;
-            progress.increment(alignment_length);
-            processed_alignment_length.fetch_add(alignment_length, std::memory_order_relaxed);
-            
-            delete rec;
-        } else if (reader_done.load() && processor_done.load() && seq_queue.was_empty()) {
-            break;
-        } else {
-            is_working.store(false);
-            std::this_thread::sleep_for(std::chrono::milliseconds(10));
-        }
+/**
+ * @brief       one line of WFA statistics, for the summary of --wfa-stats
+ */
+static std::string formatWfaStats(const wavefront_stats_t& stats) {
+    std::ostringstream out;
+    out << stats.num_alignments << " alignments, " << stats.num_steps << " steps, "
+        << stats.num_extend_calls << " extensions, max wavefront length = " << stats.max_wavefront_length
+        << ", max memory = " << stats.max_memory_used / (1024 * 1024) << " MB"
+        << ", time in compute / extend / backtrace = " << stats.time_compute_ns / 1e9
+        << " / " << stats.time_extend_ns / 1e9 << " / " << stats.time_backtrace_ns / 1e9 << " seconds";
+    return out.str();
+}
+
+/**
+ * @brief       add the WFA statistics of an aligned record to the totals and the TSV
+ */
+void recordWfaStats(const seq_record_t& rec, const wflign::wavefront::wflign_stats_t& stats) {
+    std::lock_guard<std::mutex> lock(wfa_stats_mutex);
+    wavefront_stats_add(&wfa_stats_wflambda, &stats.wflambda);
+    wavefront_stats_add(&wfa_stats_alignments, &stats.alignments);
+    if (wfa_stats_tsv.is_open()) {
+        wfa_stats_tsv << rec.currentRecord.qId << '\t' << rec.currentRecord.qStartPos << '\t' << rec.currentRecord.qEndPos
+                      << '\t' << (rec.currentRecord.strand == skch::strnd::FWD ? '+' : '-')
+                      << '\t' << rec.currentRecord.refId << '\t' << rec.currentRecord.rStartPos << '\t' << rec.currentRecord.rEndPos;
+        writeWfaStats(wfa_stats_tsv, stats.wflambda);
+        writeWfaStats(wfa_stats_tsv, stats.alignments);
+        wfa_stats_tsv << '\n';
     }
-    is_working.store(false);
 }
 
-void write_sam_header(std::ofstream& outstream) {
+/**
+ * @brief       the SAM header of the output, from the target sequences
+ */
+std::string samHeader() {
+    output::Writer outstream;
     for(const auto &fileName : param.refSequences) {
         // check if there is a .fai
         std::string fai_name = fileName + ".fai";
@@ -476,124 +1520,499 @@ void write_sam_header(std::ofstream& outstream) {
         }
     }
     outstream << "@PG\tID:wfmash\tPN:wfmash\tVN:0.1\tCL:wfmash\n";
+    return outstream.take();
 }
 
-void writer_thread(const std::string& output_file,
-                   paf_atomic_queue_t& paf_queue,
-                   std::atomic<bool>& reader_done,
-                   std::atomic<bool>& processor_done,
-                   const std::vector<std::atomic<bool>>& worker_working) {
-    std::ofstream outstream(output_file);
+/**
+ * @brief       align the mapping records given one by one by nextRecord, writing the
+ *              alignments in their order
+ * @param[in]   nextRecord  fills its argument with the next record, false once there are none
+ * @param[in]   progress    optional meter advanced by the aligned query bases
+ */
+void computeAlignments(const std::function<bool(mapping_input_t&)>& allRecords,
+                       progress_meter::ProgressMeter* progress) {
+    // With --chunk, the mappings of each window of the input go, the most costly first,
+    // to the chunk with the least estimated cost so far, the same way on every node, and
+    // those of our chunk are aligned in input order
+    std::function<bool(mapping_input_t&)> nextRecord = allRecords;
+    std::vector<double> chunk_costs(param.chunk_count, 0.0);
+    std::deque<mapping_input_t> chunk_records;
+    bool chunk_input_done = false;
+    if (param.chunk_count > 1) {
+        nextRecord = [&](mapping_input_t& mapping) {
+            while (chunk_records.empty() && !chunk_input_done) {
+                std::vector<mapping_input_t> window;
+                while (window.size() < defaultLongestFirstWindow) {
+                    window.emplace_back();
+                    if (!allRecords(window.back())) {
+                        window.pop_back();
+                        chunk_input_done = true;
+                        break;
+                    }
+                }
+                std::vector<double> costs(window.size());
+                for (size_t i = 0; i < window.size(); ++i) {
+                    costs[i] = estimatedCost(window[i]);
+                }
+                std::vector<uint32_t> order(window.size());
+                std::iota(order.begin(), order.end(), 0);
+                std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+                    return costs[a] > costs[b];
+                });
+                std::vector<bool> ours(window.size(), false);
+                for (uint32_t i : order) {
+                    const size_t chunk = std::min_element(chunk_costs.begin(), chunk_costs.end()) - chunk_costs.begin();
+                    chunk_costs[chunk] += costs[i];
+                    ours[i] = chunk == size_t(param.chunk_index);
+                }
+                for (size_t i = 0; i < window.size(); ++i) {
+                    if (ours[i]) {
+                        if (progress != nullptr) {
+                            progress->add_total(window[i].line.empty()
+                                                ? window[i].record.qEndPos - window[i].record.qStartPos
+                                                : querySpan(window[i].line));
+                        }
+                        chunk_records.push_back(std::move(window[i]));
+                    }
+                }
+            }
+            if (chunk_records.empty()) {
+                return false;
+            }
+            mapping = std::move(chunk_records.front());
+            chunk_records.pop_front();
+            return true;
+        };
+    }
+
+    // Create atomic counter for processed alignment length
+    std::atomic<uint64_t> processed_alignment_length(0);
+
+    // Start timing
+    auto start_time = std::chrono::high_resolution_clock::now();
+    run_report::StageTimer stage_timer("alignment", param.threads);
+    run_report::Accumulator write_timer("writing");
+    run_report::Samples tasks_in_flight;
+    run_report::Samples held_output_depth;
+
+    // With a checkpoint, the output is resumed after the records it has
+    Checkpoint checkpoint;
+    const bool checkpointing = !param.checkpoint_file.empty() && !param.mashmapPafFile.empty();
+    const bool resuming = checkpointing && checkpoint.load(param.checkpoint_file, param.mashmapPafFile);
+
+    // BAM and CRAM records go to bamstream instead, those split over shards through outstream to shards
+    output::ShardedWriter shards;
+    output::SortedWriter sorted;
+    output::Writer outstream;
+    output::BamWriter bamstream;
+    const bool bam = param.bam_output || param.cram_output;
+    if (param.output_shards > 0) {
+        output::ShardedWriter::Key key = output::ShardedWriter::Key::Query;
+        output::ShardedWriter::parseKey(param.shard_by, key);
+        if (!shards.open(param.pafOutputFile, param.output_shards, key, param.sam_format, param.bgzf_output, param.threads)) {
+            throw std::runtime_error("[wfmash::align::computeAlignments] Error! Failed to open the output shards of: " + param.pafOutputFile);
+        }
+        outstream.open(shards);
+    } else if (!param.sort_by.empty()) {
+        output::SortedWriter::Key key = output::SortedWriter::Key::Target;
+        output::SortedWriter::parseKey(param.sort_by, key);
+        if (!sorted.open(param.pafOutputFile, key, param.threads)) {
+            throw std::runtime_error("[wfmash::align::computeAlignments] Error! Failed to open output file: " + param.pafOutputFile);
+        }
+        outstream.open(sorted);
+    } else if (resuming) {
+        if (!outstream.openAt(param.pafOutputFile, checkpoint.outputBytes)) {
+            throw std::runtime_error("[wfmash::align::computeAlignments] Error! Failed to resume the output file: " + param.pafOutputFile
+                                     + ", which has to be the output of the checkpointed run, appended to");
+        }
+        std::cerr << "[wfmash::align::computeAlignments] resuming after the " << checkpoint.records
+                  << " records aligned in " << param.checkpoint_file << std::endl;
+    } else if (bam ? !bamstream.open(param.pafOutputFile, param.cram_output, param.refSequences.front(), param.threads)
+                   : !outstream.open(param.pafOutputFile, param.bgzf_output, param.threads)) {
+        throw std::runtime_error("[wfmash::align::computeAlignments] Error! Failed to open output file: " + param.pafOutputFile);
+    }
     // if the output file is SAM, we write the header
-    if (param.sam_format) {
-        write_sam_header(outstream);
+    if (param.sam_format && !resuming) {
+        if (!bam) {
+            outstream << samHeader();
+        } else if (!bamstream.writeHeader(samHeader())) {
+            throw std::runtime_error("[wfmash::align::computeAlignments] Error! Failed to write the header of the output file: " + param.pafOutputFile);
+        }
     }
 
-    if (!outstream.is_open()) {
-        throw std::runtime_error("[wfmash::align::computeAlignments] Error! Failed to open output file: " + output_file);
+    if (!param.wfa_stats_tsv.empty()) {
+        wfa_stats_tsv.open(param.wfa_stats_tsv);
+        if (!wfa_stats_tsv.is_open()) {
+            throw std::runtime_error("[wfmash::align::computeAlignments] Error! Failed to open the WFA statistics file: " + param.wfa_stats_tsv);
+        }
+        wfa_stats_tsv << "query_name\tquery_start\tquery_end\tstrand\ttarget_name\ttarget_start\ttarget_end";
+        writeWfaStatsHeader(wfa_stats_tsv, "wflambda_");
+        writeWfaStatsHeader(wfa_stats_tsv, "wfa_");
+        wfa_stats_tsv << '\n';
+    }
+
+    // records already in the output
+    for (uint64_t skipped = 0; resuming && skipped < checkpoint.records; ++skipped) {
+        mapping_input_t mapping;
+        if (!nextRecord(mapping)) {
+            throw std::runtime_error("[wfmash::align::computeAlignments] Error! The input has fewer records than the checkpoint "
+                                     + param.checkpoint_file);
+        }
+        if (progress != nullptr) {
+            progress->increment(mapping.line.empty() ? mapping.record.qEndPos - mapping.record.qStartPos : querySpan(mapping.line));
+        }
     }
 
-    auto all_workers_done = [&]() {
-        return std::all_of(worker_working.begin(), worker_working.end(),
-                           [](const std::atomic<bool>& w) { return !w.load(); });
+    // the checkpoint is only saved once the output it counts is on disk
+    auto last_checkpoint = std::chrono::steady_clock::now();
+    auto save_checkpoint = [&]() {
+        if (!outstream.sync()) {
+            throw std::runtime_error("[wfmash::align::computeAlignments] Error! Failed to write the output file: " + param.pafOutputFile);
+        }
+        checkpoint.outputBytes = outstream.bytesWritten();
+        if (!checkpoint.save(param.checkpoint_file, param.mashmapPafFile)) {
+            std::cerr << "[wfmash::align::computeAlignments] WARNING, failed to save the checkpoint " << param.checkpoint_file << std::endl;
+        }
+        last_checkpoint = std::chrono::steady_clock::now();
     };
 
-    while (true) {
-        std::string* paf_output = nullptr;
-        if (paf_queue.try_pop(paf_output)) {
-            outstream << *paf_output;
-            outstream.flush();
-            delete paf_output;
-        } else if (reader_done.load() && processor_done.load() && paf_queue.was_empty() && all_workers_done()) {
-            break;
-        } else {
-            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    // Each thread fetches sequences through indexes of its own, loaded on first use.
+    // Threads outside of the executor also run alignments while they wait on it, such
+    // as the one reading the mappings
+    tasks::Executor& executor = tasks::sharedExecutor(param.threads, tasks::Stage::Align);
+    std::vector<std::pair<faidx_t*, faidx_t*>> worker_faidx(executor.size(), {nullptr, nullptr});
+    std::unordered_map<std::thread::id, std::pair<faidx_t*, faidx_t*>> outside_faidx;
+    std::mutex outside_faidx_mutex;
+    outside_faidx[std::this_thread::get_id()] = {ref_faidx, query_faidx};
+    const auto thread_faidx = [&]() -> std::pair<faidx_t*, faidx_t*>& {
+        const int t = executor.workerIndex();
+        if (t < executor.size()) {
+            return worker_faidx[t];
         }
-    }
+        std::lock_guard<std::mutex> lock(outside_faidx_mutex);
+        return outside_faidx[std::this_thread::get_id()];
+    };
 
-    outstream.close();
-}
+    // Without multithreaded fasta input, the threads reading the sequences at once are
+    // bounded, from one up to all of them as fetching takes a larger share of the work of
+    // the records; those found in the fetch caches are not read again
+    FetchGate fetch_gate(executor.size(), true);
 
-void computeAlignments() {
-    std::atomic<size_t> total_alignments_queued(0);
-    std::atomic<bool> reader_done(false);
-    std::atomic<bool> processor_done(false);
+    // Records are formatted straight into buffers that the writing thread gives back once written
+    output::BufferPool output_buffers;
 
-    // Create queues
-    atomic_queue::AtomicQueue<std::string*, 1024> line_queue;
-    seq_atomic_queue_t seq_queue;
-    paf_atomic_queue_t paf_queue;  // Add this line
+    // Bytes of the sequences of the mappings dispatched and not aligned yet, and of the outputs
+    // not taken by this thread yet: a mapping is only dispatched while they fit param.in_flight_bytes
+    std::atomic<int64_t> in_flight_bytes{0};
 
-    // Calculate max_processors based on the number of worker threads
-    size_t max_processors = std::max(1UL, static_cast<unsigned long>(param.threads));
+    // Alignments are computed by the executor of the alignment stage, and written in input order
+    ThreadPool<mapping_input_t, std::string> threadPool([&](mapping_input_t* mapping) {
+        MappingBoundaryRow& currentRecord = mapping->record;
+        if (!mapping->line.empty()) {
+            parseMashmapRow(mapping->line, currentRecord);
+        }
 
-    // Calculate total alignment length
-    uint64_t total_alignment_length = 0;
-    {
-        std::ifstream mappingListStream(param.mashmapPafFile);
-        std::string mappingRecordLine;
-        MappingBoundaryRow currentRecord;
-
-        while(std::getline(mappingListStream, mappingRecordLine)) {
-            if (!mappingRecordLine.empty()) {
-                parseMashmapRow(mappingRecordLine, currentRecord);
-                total_alignment_length += currentRecord.qEndPos - currentRecord.qStartPos;
+        // chunks of a long mapping run on any thread, each with the handles of its thread
+        const auto fetch_record = [&](const MappingBoundaryRow& record) {
+            trace::Span span("fetch", record.qId);
+            std::pair<faidx_t*, faidx_t*>& faidx = thread_faidx();
+            if (faidx.first == nullptr && ref_store == nullptr) {
+                faidx.first = fai_load(param.refSequences.front().c_str());
+                faidx.second = fai_load(param.querySequences.front().c_str());
+            }
+            return createSeqRecord(record, mapping->line, faidx.first, faidx.second,
+                                   param.multithread_fasta_input ? nullptr : &fetch_gate,
+                                   mapping->refTotalLength, mapping->queryTotalLength);
+        };
+        const auto align_record = [&](const MappingBoundaryRow& record, std::string& out) {
+            seq_record_pool_t::ptr rec = fetch_record(record);
+            trace::Span span("align", record.qId);
+            WFMASH_PROBE(align_start, record.qId.c_str(), rec->queryLen, rec->refLen);
+            const auto align_start = std::chrono::steady_clock::now();
+            processAlignment(rec.get(), out);
+            fetch_gate.aligned(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - align_start).count());
+            WFMASH_PROBE(align_end, record.qId.c_str(), rec->queryLen, rec->refLen);
+        };
+
+        std::string* alignment_output = output_buffers.acquire();
+        // the mapping may have been aligned by the previous run already, with the same parameters
+        ReusedAlignments::Key reuse_key;
+        if (reused_alignments) {
+            reuse_key = ReusedAlignments::key(
+                currentRecord,
+                mapping->line.empty() ? mapping->queryTotalLength : columnValue(mapping->line, 1),
+                mapping->line.empty() ? mapping->refTotalLength : columnValue(mapping->line, 6),
+                reused_alignments_salt);
+        }
+        const bool reused = reused_alignments && reused_alignments->take(reuse_key, *alignment_output);
+        // the mapping the other way of an all-vs-all run may have been aligned already
+        const bool inverted = !reused && reciprocal_alignments
+            && reciprocal_alignments->take(currentRecord, *alignment_output);
+        if (!reused && !inverted) {
+            if (useAnchors()) {
+                alignAroundAnchors(currentRecord, executor, align_record, fetch_record, *alignment_output);
+            } else if (useChunks()) {
+                alignInChunks(currentRecord, executor, align_record, *alignment_output);
+            } else {
+                align_record(currentRecord, *alignment_output);
+            }
+            if (reciprocal_alignments) {
+                reciprocal_alignments->put(currentRecord, *alignment_output);
             }
         }
+        if (reused_alignments && !reused) {
+            ReusedAlignments::tag(reuse_key, *alignment_output, 0);
+        }
+
+        // Update progress meter and processed alignment length
+        uint64_t alignment_length = currentRecord.qEndPos - currentRecord.qStartPos;
+        if (progress != nullptr) {
+            progress->increment(alignment_length);
+            progress->add_records(1);
+        }
+        processed_alignment_length.fetch_add(alignment_length, std::memory_order_relaxed);
+
+        // BAM records are made by the thread that aligned them, for the writing thread to only copy out
+        if (bam && !alignment_output->empty()) {
+            std::string* packed = output_buffers.acquire();
+            if (!bamstream.pack(*alignment_output, *packed)) {
+                throw std::runtime_error("[wfmash::align::computeAlignments] Error! Failed to make BAM records of the alignments of "
+                                         + currentRecord.qId);
+            }
+            output_buffers.release(alignment_output);
+            alignment_output = packed;
+        }
+
+        // its sequences are done with, its output is held until taken
+        in_flight_bytes.fetch_add(int64_t(alignment_output->size()) - int64_t(mapping->bytes), std::memory_order_relaxed);
+        return alignment_output;
+    }, param.threads, !param.unordered_output && !param.deterministic_output, tasks::Stage::Align);
+
+    auto write_output = [&](std::string* alignment_output) {
+        trace::Span span("write");
+        write_timer.time([&]() {
+            if (bam) {
+                bamstream.write(*alignment_output);
+            } else {
+                outstream << *alignment_output;
+            }
+        });
+        output_buffers.release(alignment_output);
+        if (checkpointing) {
+            ++checkpoint.records;
+            if (std::chrono::steady_clock::now() - last_checkpoint >= std::chrono::seconds(checkpointSeconds)) {
+                save_checkpoint();
+            }
+        }
+    };
+
+    // With a reorder window, the mappings of each window are dispatched grouped by target,
+    // so that fetches of neighbouring regions follow each other, or the most costly first,
+    // so that they do not end up running alone at the end. Their alignments are written
+    // back in input order unless the output is unordered anyway
+    // Prefetching, or the readahead of local inputs, reads a window of mappings ahead, the
+    // regions of the window being queued in dispatch order when it is dispatched
+    std::unique_ptr<SequencePrefetcher> prefetcher;
+    if (prefetchThreads() > 0) {
+        prefetcher.reset(new SequencePrefetcher(param.refSequences.front(), param.querySequences.front(),
+                                                ref_cache.get(), query_cache.get(), prefetchThreads()));
+    }
+    std::unique_ptr<RegionReadahead> readahead;
+    if (param.readahead && ref_store == nullptr) {
+        readahead.reset(new RegionReadahead(param.refSequences.front(), param.querySequences.front()));
     }
+    const size_t window_size = param.reorder_window > 0 ? param.reorder_window
+        : param.longest_first ? defaultLongestFirstWindow
+        : prefetcher || readahead ? defaultPrefetchWindow : 0;
+    // Deterministic output takes the alignments as they are done and puts them back in input
+    // order in a reorder window, bounded in memory, so that a slow mapping holds back neither
+    // the threads nor the mappings dispatched after it
+    const bool deterministic = param.deterministic_output;
+    const bool restore_order = (window_size > 0 && !param.unordered_output) || deterministic;
+    std::deque<uint64_t> input_rank_of_dispatched;
+    std::unordered_map<uint64_t, uint64_t> input_rank_by_dispatch;
+    uint64_t dispatched = 0;
+    output::ReorderWindow reorder(output_buffers, deterministicWindowBytes);
+    std::map<uint64_t, std::string*> held_outputs;
+    uint64_t next_output_rank = 0;
+    auto collect_output = [&](std::string* alignment_output, uint64_t dispatch_rank) {
+        if (deterministic) {
+            auto input_rank = input_rank_by_dispatch.find(dispatch_rank);
+            const uint64_t rank = input_rank->second;
+            input_rank_by_dispatch.erase(input_rank);
+            reorder.add(rank, alignment_output, write_output);
+            return;
+        }
+        if (!restore_order) {
+            write_output(alignment_output);
+            return;
+        }
+        held_outputs.emplace(input_rank_of_dispatched.front(), alignment_output);
+        input_rank_of_dispatched.pop_front();
+        while (!held_outputs.empty() && held_outputs.begin()->first == next_output_rank) {
+            write_output(held_outputs.begin()->second);
+            held_outputs.erase(held_outputs.begin());
+            ++next_output_rank;
+        }
+    };
 
-    // Create progress meter
-    progress_meter::ProgressMeter progress(total_alignment_length, "[wfmash::align::computeAlignments] aligned");
+    auto pop_output = [&]() {
+        uint64_t dispatch_rank = 0;
+        std::string* alignment_output = threadPool.popOutputWhenAvailable(&dispatch_rank);
+        in_flight_bytes.fetch_sub(alignment_output->size(), std::memory_order_relaxed);
+        collect_output(alignment_output, dispatch_rank);
+    };
 
-    // Create atomic counter for processed alignment length
-    std::atomic<uint64_t> processed_alignment_length(0);
+    auto dispatch = [&](mapping_input_t* mapping, uint64_t input_rank) {
+        // a mapping larger than the budget is still aligned, alone
+        mapping->bytes = estimatedBytes(*mapping);
+        while (threadPool.running()
+               && in_flight_bytes.load(std::memory_order_relaxed) + int64_t(mapping->bytes) > int64_t(param.in_flight_bytes)) {
+            pop_output();
+        }
+        in_flight_bytes.fetch_add(mapping->bytes, std::memory_order_relaxed);
+        if (deterministic) {
+            input_rank_by_dispatch.emplace(dispatched++, input_rank);
+        } else if (restore_order) {
+            input_rank_of_dispatched.push_back(input_rank);
+        }
+        threadPool.runWhenThreadAvailable(mapping);
+        tasks_in_flight.add(threadPool.inFlight());
+        if (progress != nullptr) {
+            progress->set_queue_depth(threadPool.inFlight());
+        }
+        held_output_depth.add(deterministic ? reorder.held() : held_outputs.size());
 
-    // Start timing
-    auto start_time = std::chrono::high_resolution_clock::now();
+        // Collect output if available
+        while (threadPool.outputAvailable()) {
+            pop_output();
+        }
+    };
 
-    // Launch single reader thread
-    std::thread single_reader([this, &line_queue, &reader_done]() {
-        this->single_reader_thread(param.mashmapPafFile, line_queue, reader_done);
-    });
-
-    // Launch processor manager
-    std::thread processor_manager_thread([this, &seq_queue, &line_queue, &total_alignments_queued, &reader_done, &processor_done, max_processors]() {
-        this->processor_manager(seq_queue, line_queue, total_alignments_queued, reader_done, processor_done, max_processors);
-    });
-
-    // Launch worker threads
-    std::vector<std::thread> workers;
-    std::vector<std::atomic<bool>> worker_working(param.threads);
-    for (uint64_t t = 0; t < param.threads; ++t) {
-        workers.emplace_back([this, t, &worker_working, &seq_queue, &paf_queue, &reader_done, &processor_done, &progress, &processed_alignment_length]() {
-            this->worker_thread(t, worker_working[t], seq_queue, paf_queue, reader_done, processor_done, progress, processed_alignment_length);
-        });
+    std::vector<mapping_input_t*> window;
+    auto dispatch_window = [&](uint64_t first_rank) {
+        std::vector<uint32_t> order(window.size());
+        std::iota(order.begin(), order.end(), 0);
+        if (param.longest_first) {
+            std::vector<double> costs(window.size());
+            for (uint32_t i = 0; i < window.size(); ++i) {
+                costs[i] = estimatedCost(*window[i]);
+            }
+            std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+                return costs[a] > costs[b];
+            });
+        } else {
+            std::vector<std::pair<std::string, uint64_t>> keys(window.size());
+            for (uint32_t i = 0; i < window.size(); ++i) {
+                keys[i] = targetKey(*window[i]);
+            }
+            std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+                return keys[a] < keys[b];
+            });
+        }
+        if (prefetcher) {
+            for (uint32_t i : order) {
+                prefetchRecord(*prefetcher, *window[i]);
+            }
+        }
+        if (readahead) {
+            for (uint32_t i : order) {
+                prefetchRecord(*readahead, *window[i]);
+            }
+        }
+        for (uint32_t i : order) {
+            dispatch(window[i], first_rank + i);
+        }
+        window.clear();
+    };
+
+    size_t total_alignments_queued = 0;
+    while (true) {
+        mapping_input_t* mapping = new mapping_input_t();
+        if (!nextRecord(*mapping)) {
+            delete mapping;
+            break;
+        }
+        ++total_alignments_queued;
+        if (window_size == 0) {
+            dispatch(mapping, total_alignments_queued - 1);
+            continue;
+        }
+        window.push_back(mapping);
+        if (window.size() == window_size) {
+            dispatch_window(total_alignments_queued - window.size());
+        }
     }
+    dispatch_window(total_alignments_queued - window.size());
 
-    // Launch writer thread
-    std::thread writer([this, &paf_queue, &reader_done, &processor_done, &worker_working]() {
-        this->writer_thread(param.pafOutputFile, paf_queue, reader_done, processor_done, worker_working);
-    });
+    // Collect remaining output objects
+    while (threadPool.running()) {
+        pop_output();
+    }
+    prefetcher.reset();
+    if (!(bam ? bamstream.close() : outstream.close() && shards.close() && sorted.close())) {
+        throw std::runtime_error("[wfmash::align::computeAlignments] Error! Failed to write the output file: " + param.pafOutputFile);
+    }
+    if (checkpointing) {
+        std::remove(param.checkpoint_file.c_str());
+    }
+    if (alignment_cache && !param.alignment_cache_file.empty() && !alignment_cache->save(param.alignment_cache_file)) {
+        std::cerr << "[wfmash::align::computeAlignments] WARNING, failed to save the alignment cache " << param.alignment_cache_file << std::endl;
+    }
+    if (reused_alignments) {
+        std::cerr << "[wfmash::align::computeAlignments] reused " << reused_alignments->reusedRecords()
+                  << " records of the " << reused_alignments->indexed() << " of " << param.reuse_alignments_file << std::endl;
+    }
 
-    // Wait for all threads to complete
-    single_reader.join();
-    processor_manager_thread.join();
-    for (auto& worker : workers) {
-        worker.join();
+    // the handles of this thread are the Aligner's own
+    outside_faidx.erase(std::this_thread::get_id());
+    for (auto& faidx : worker_faidx) {
+        if (faidx.first != nullptr) {
+            fai_destroy(faidx.first);
+            fai_destroy(faidx.second);
+        }
+    }
+    for (auto& faidx : outside_faidx) {
+        if (faidx.second.first != nullptr) {
+            fai_destroy(faidx.second.first);
+            fai_destroy(faidx.second.second);
+        }
     }
-    writer.join();
 
     // Stop timing
     auto end_time = std::chrono::high_resolution_clock::now();
     auto duration = std::chrono::duration_cast<std::chrono::seconds>(end_time - start_time);
 
     // Finish progress meter
-    progress.finish();
+    if (progress != nullptr) {
+        progress->finish();
+    }
 
     std::cerr << "[wfmash::align::computeAlignments] "
-              << "total aligned records = " << total_alignments_queued.load() 
+              << "total aligned records = " << total_alignments_queued
               << ", total aligned bp = " << processed_alignment_length.load()
               << ", time taken = " << duration.count() << " seconds" << std::endl;
+    write_timer.finish();
+    const double seconds = std::max(1e-9, std::chrono::duration<double>(end_time - start_time).count());
+    stage_timer.count("records", total_alignments_queued);
+    stage_timer.count("bp", processed_alignment_length.load());
+    stage_timer.count("records_per_second", total_alignments_queued / seconds);
+    stage_timer.count("bp_per_second", processed_alignment_length.load() / seconds);
+    tasks_in_flight.report(stage_timer, "tasks_in_flight");
+    held_output_depth.report(stage_timer, "held_outputs");
+    if (param.wfa_stats) {
+        std::cerr << "[wfmash::align::computeAlignments] WFA of the wflambda layer: "
+                  << formatWfaStats(wfa_stats_wflambda) << std::endl;
+        std::cerr << "[wfmash::align::computeAlignments] WFA of the segments, patches and whole mappings: "
+                  << formatWfaStats(wfa_stats_alignments) << std::endl;
+    }
+    if (wfa_stats_tsv.is_open()) {
+        wfa_stats_tsv.close();
+        if (wfa_stats_tsv.fail()) {
+            std::cerr << "[wfmash::align::computeAlignments] WARNING, failed to write the WFA statistics file " << param.wfa_stats_tsv << std::endl;
+        }
+    }
 }
       
   };
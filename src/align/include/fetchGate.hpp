@@ -0,0 +1,142 @@
+/**
+ * @file    fetchGate.hpp
+ * @brief   bound on the alignment threads reading the input files at once, adapted to
+ *          the share of fetching in the work of the records
+ */
+
+#ifndef FETCH_GATE_HPP
+#define FETCH_GATE_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+
+namespace align
+{
+  /**
+   * @brief     lets at most limit threads read the input files at once, a lockable for
+   *            std::unique_lock and std::lock_guard
+   * @details   the alignment threads both fetch the sequences of a record and align them,
+   *            so the threads of the budget are split between reading and aligning by how
+   *            many may read at once. One reader keeps the reads of a disk sequential, but
+   *            leaves the other threads waiting on it when fetching is a large part of the
+   *            work, as with compressed or slow inputs. With adapt, the time the readers
+   *            hold the gate and the time spent aligning are summed over windows of
+   *            records: as fetching takes a fraction f of the work, the limit is raised to
+   *            the readers that keeps busy with some headroom, ceil(1.25 f budget), and
+   *            only lowered again once that falls under two thirds of the limit, so that
+   *            it does not swing between two values from window to window
+   */
+  class FetchGate
+  {
+    private:
+
+      using Clock = std::chrono::steady_clock;
+
+      //Headroom of the readers over those busy on average
+      static constexpr double headroom = 1.25;
+
+      //Limit lowered only once the readers needed fall under this fraction of it
+      static constexpr double lowerBelow = 2.0 / 3.0;
+
+      const int budget;
+      const bool adapt;
+      const uint64_t window;
+
+      std::mutex mutex;
+      std::condition_variable released;
+      int limit = 1;
+      int active = 0;
+
+      //Sums over the current window, in nanoseconds
+      uint64_t heldNs = 0;
+      uint64_t alignNs = 0;
+      uint64_t records = 0;
+
+      static Clock::time_point& heldSince()
+      {
+        static thread_local Clock::time_point since;
+        return since;
+      }
+
+      //with the lock held
+      void evaluate()
+      {
+        const double fetching = double(heldNs) / double(std::max<uint64_t>(1, heldNs + alignNs));
+        const int needed = std::min(budget, std::max(1, int(std::ceil(headroom * fetching * budget))));
+        heldNs = alignNs = records = 0;
+        if (needed > limit)
+        {
+          limit = needed;
+          released.notify_all();
+        }
+        else if (needed < lowerBelow * limit)
+        {
+          limit = needed;
+        }
+      }
+
+    public:
+
+      /**
+       * @param[in] budget    threads sharing the gate, the limit staying between 1 and budget
+       * @param[in] adapt     if false, the limit stays at 1, as a mutex
+       */
+      explicit FetchGate(int budget = 1, bool adapt = false)
+        : budget(std::max(1, budget)), adapt(adapt && budget > 1),
+          window(std::max<uint64_t>(16, 2 * uint64_t(std::max(1, budget)))) {}
+
+      FetchGate(const FetchGate&) = delete;
+      FetchGate& operator=(const FetchGate&) = delete;
+
+      void lock()
+      {
+        std::unique_lock<std::mutex> guard(mutex);
+        released.wait(guard, [&]() { return active < limit; });
+        ++active;
+        guard.unlock();
+        if (adapt)
+          heldSince() = Clock::now();
+      }
+
+      void unlock()
+      {
+        const uint64_t held = adapt
+          ? std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - heldSince()).count() : 0;
+        {
+          std::lock_guard<std::mutex> guard(mutex);
+          --active;
+          heldNs += held;
+        }
+        released.notify_one();
+      }
+
+      /**
+       * @brief     count a record whose sequences were fetched, aligned in alignNs nanoseconds,
+       *            the limit being adapted at the end of each window of records
+       */
+      void aligned(uint64_t ns)
+      {
+        if (!adapt)
+          return;
+        std::lock_guard<std::mutex> guard(mutex);
+        alignNs += ns;
+        if (++records >= window)
+          evaluate();
+      }
+
+      /**
+       * @brief     readers let in at once currently
+       */
+      int readers()
+      {
+        std::lock_guard<std::mutex> guard(mutex);
+        return limit;
+      }
+  };
+}
+
+#endif
@@ -67,7 +67,7 @@ $ mashmap-align -s ref.fa -q seq.fq --mappingFile mashmap.out --pi 80 [OPTIONS]"
   {
     std::cerr << "[wfmash::align] Reference = " << parameters.refSequences << std::endl;
     std::cerr << "[wfmash::align] Query = " << parameters.querySequences << std::endl;
-    std::cerr << "[wfmash::align] Mapping file = " << parameters.mashmapPafFile << std::endl;
+    std::cerr << "[wfmash::align] Mapping file = " << (parameters.mashmapPafFile.empty() ? "(streamed from mapping)" : parameters.mashmapPafFile) << std::endl;
     std::cerr << "[wfmash::align] Alignment identity cutoff = " << std::fixed << std::setprecision(2) << parameters.min_identity * 100.0 << "\%" << std::endl;
     std::cerr << "[wfmash::align] Alignment output file = " << parameters.pafOutputFile << std::endl;
   }
@@ -176,6 +176,42 @@ $ mashmap-align -s ref.fa -q seq.fq --mappingFile mashmap.out --pi 80 [OPTIONS]"
     }
     else
       parameters.pafOutputFile = "mashmap.out.paf";
+    parameters.bgzf_output = false;
+    parameters.bam_output = false;
+    parameters.cram_output = false;
+    parameters.score_only = false;
+    parameters.screen_identity = false;
+    parameters.seed_anchors = false;
+    parameters.unordered_output = false;
+    parameters.deterministic_output = false;
+    parameters.output_shards = 0;
+    parameters.shard_by = "query";
+    parameters.sort_by = "";
+    parameters.fetch_cache_bytes = 256000000;
+    parameters.prefetch_threads = -1;
+    parameters.readahead = false;
+    parameters.alignment_cache_bytes = 0;
+    parameters.reciprocal_dedup = false;
+    parameters.reuse_alignments_file = "";
+    parameters.in_memory_sequences = false;
+    parameters.reorder_window = 0;
+    parameters.in_flight_bytes = uint64_t(1) << 30;
+    parameters.longest_first = false;
+    parameters.chunk_index = 0;
+    parameters.chunk_count = 1;
+    parameters.align_chunk_length = 0;
+    parameters.anchor_min_run = 0;
+    parameters.wfa_max_memory = 0;
+    parameters.biwfa_threads = 1;
+    parameters.wfa_stats = false;
+    parameters.wfa_stats_tsv = "";
+    parameters.wflign_auto = false;
+    parameters.checkpoint_file = "";
+    parameters.capture_slow_seconds = 0;
+    parameters.capture_dir = "";
+    parameters.wfplot_max_size = 1500;
+    parameters.diagnostics_every = 1;
+    parameters.diagnostics_slower_than = 0;
 
     str.clear();
 
@@ -0,0 +1,252 @@
+/**
+ * @file    reciprocalAlignments.hpp
+ * @brief   alignments of all-vs-all runs kept for the mappings of the other direction
+ */
+
+#ifndef RECIPROCAL_ALIGNMENTS_HPP
+#define RECIPROCAL_ALIGNMENTS_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <list>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "map/include/base_types.hpp"
+#include "align/include/align_types.hpp"
+
+namespace align
+{
+  /**
+   * @brief     PAF alignments of mappings A to B, to output those of the mappings B to A
+   *            of the same region inverted rather than aligned again
+   * @details   all-vs-all runs map each homologous region both ways. The alignment of one
+   *            direction is kept, keyed by the names and strand of its mapping, until the
+   *            mapping of the other direction, with coordinates swapped up to a tolerance,
+   *            takes it: its query and target fields are swapped and its CIGAR inverted.
+   *            Alignments kept are dropped oldest first past maxBytes; a mapping whose
+   *            reciprocal is not aligned yet, or was dropped, is aligned as usual
+   */
+  class ReciprocalAlignments
+  {
+    private:
+
+      //Coordinates of the two mappings may differ by this fraction of the mapping length
+      static constexpr double tolerance = 0.01;
+
+      struct Entry
+      {
+        std::string pair;
+        skch::offset_t qStart, qEnd, rStart, rEnd;
+        std::string paf;
+      };
+
+      const uint64_t maxBytes;
+
+      std::mutex mutex;
+      std::list<Entry> kept;            //oldest first
+      //by query name, target name and strand, the entries by query start
+      std::unordered_map<std::string, std::multimap<skch::offset_t, std::list<Entry>::iterator>> entries;
+      uint64_t keptBytes = 0;
+
+      static std::string pairOf(const std::string& query, const std::string& target, skch::strand_t strand)
+      {
+        std::string pair;
+        pair.reserve(query.size() + target.size() + 2);
+        pair += query;
+        pair += '\t';
+        pair += target;
+        pair += strand == skch::strnd::FWD ? '+' : '-';
+        return pair;
+      }
+
+      static uint64_t entryBytes(const Entry& e)
+      {
+        return sizeof(Entry) + e.pair.size() + e.paf.size();
+      }
+
+      //drops it, with the lock held
+      void erase(std::list<Entry>::iterator entry)
+      {
+        auto byPair = entries.find(entry->pair);
+        auto range = byPair->second.equal_range(entry->qStart);
+        for (auto it = range.first; it != range.second; ++it)
+        {
+          if (it->second == entry)
+          {
+            byPair->second.erase(it);
+            break;
+          }
+        }
+        if (byPair->second.empty())
+          entries.erase(byPair);
+        keptBytes -= entryBytes(*entry);
+        kept.erase(entry);
+      }
+
+      static bool near(skch::offset_t a, skch::offset_t b, skch::offset_t slack)
+      {
+        return std::abs(a - b) <= slack;
+      }
+
+    public:
+
+      /**
+       * @param[in] maxBytes      bytes of alignments kept at most
+       */
+      explicit ReciprocalAlignments(uint64_t maxBytes) : maxBytes(maxBytes) {}
+
+      ReciprocalAlignments(const ReciprocalAlignments&) = delete;
+      ReciprocalAlignments& operator=(const ReciprocalAlignments&) = delete;
+
+      /**
+       * @brief             keep paf, the output of the alignment of record
+       */
+      void put(const MappingBoundaryRow& record, const std::string& paf)
+      {
+        if (paf.empty() || paf.size() > maxBytes / 4)
+          return;
+        std::lock_guard<std::mutex> lock(mutex);
+        kept.push_back(Entry {pairOf(record.qId, record.refId, record.strand),
+                              record.qStartPos, record.qEndPos, record.rStartPos, record.rEndPos, paf});
+        const auto entry = std::prev(kept.end());
+        entries[entry->pair].emplace(entry->qStart, entry);
+        keptBytes += entryBytes(*entry);
+        while (keptBytes > maxBytes)
+          erase(kept.begin());
+      }
+
+      /**
+       * @brief             append the output of record, from the alignment of its reciprocal
+       *                    mapping inverted, which is then dropped. False if there is none
+       */
+      bool take(const MappingBoundaryRow& record, std::string& out)
+      {
+        const skch::offset_t slack = (record.qEndPos - record.qStartPos) * tolerance;
+        std::string paf;
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          auto byPair = entries.find(pairOf(record.refId, record.qId, record.strand));
+          if (byPair == entries.end())
+            return false;
+          auto it = byPair->second.lower_bound(record.rStartPos - slack);
+          for (; it != byPair->second.end() && it->first <= record.rStartPos + slack; ++it)
+          {
+            const Entry& e = *it->second;
+            if (near(e.qEnd, record.rEndPos, slack) && near(e.rStart, record.qStartPos, slack)
+                && near(e.rEnd, record.qEndPos, slack))
+              break;
+          }
+          if (it == byPair->second.end() || it->first > record.rStartPos + slack)
+            return false;
+          paf = std::move(it->second->paf);
+          erase(it->second);
+        }
+        invert(paf, record.mashmap_estimated_identity, out);
+        return true;
+      }
+
+      /**
+       * @brief             append the PAF lines of paf with query and target swapped: the
+       *                    insertions of the CIGAR become deletions, and the other way round,
+       *                    its operations being reversed on the reverse strand, as the target
+       *                    is then the sequence reverse complemented
+       * @param[in] identity  mapping identity of the md:f tag
+       */
+      static void invert(const std::string& paf, float identity, std::string& out)
+      {
+        std::ostringstream mappingIdentity;
+        mappingIdentity << identity;
+        size_t pos = 0;
+        while (pos < paf.size())
+        {
+          size_t end = paf.find('\n', pos);
+          if (end == std::string::npos)
+            end = paf.size();
+          std::string fields[12];
+          size_t field = pos;
+          int f = 0;
+          for (; f < 12 && field <= end; ++f)
+          {
+            size_t next = paf.find('\t', field);
+            if (next == std::string::npos || next > end)
+              next = end;
+            fields[f].assign(paf, field, next - field);
+            field = next + 1;
+          }
+          const bool reverse = fields[4] == "-";
+          out += fields[5]; out += '\t';
+          out += fields[6]; out += '\t';
+          out += fields[7]; out += '\t';
+          out += fields[8]; out += '\t';
+          out += fields[4]; out += '\t';
+          out += fields[0]; out += '\t';
+          out += fields[1]; out += '\t';
+          out += fields[2]; out += '\t';
+          out += fields[3]; out += '\t';
+          out += fields[9]; out += '\t';
+          out += fields[10]; out += '\t';
+          out += fields[11];
+          while (field < end)
+          {
+            size_t next = paf.find('\t', field);
+            if (next == std::string::npos || next > end)
+              next = end;
+            out += '\t';
+            if (paf.compare(field, 5, "md:f:") == 0)
+            {
+              out += "md:f:";
+              out += mappingIdentity.str();
+            }
+            else if (paf.compare(field, 5, "cg:Z:") == 0)
+            {
+              out += "cg:Z:";
+              invertCigar(paf.data() + field + 5, paf.data() + next, reverse, out);
+            }
+            else
+            {
+              out.append(paf, field, next - field);
+            }
+            field = next + 1;
+          }
+          out += '\n';
+          pos = end + 1;
+        }
+      }
+
+      /**
+       * @brief             append the CIGAR [begin, end) with I and D swapped, its
+       *                    operations reversed if reverse
+       */
+      static void invertCigar(const char* begin, const char* end, bool reverse, std::string& out)
+      {
+        std::vector<std::pair<const char*, const char*>> ops;
+        for (const char* op = begin; op < end; )
+        {
+          const char* kind = op;
+          while (kind < end && *kind >= '0' && *kind <= '9')
+            ++kind;
+          if (kind == end)
+            break;
+          ops.emplace_back(op, kind);
+          op = kind + 1;
+        }
+        if (reverse)
+          std::reverse(ops.begin(), ops.end());
+        for (const auto& op : ops)
+        {
+          out.append(op.first, op.second);
+          const char kind = *op.second;
+          out += kind == 'I' ? 'D' : kind == 'D' ? 'I' : kind;
+        }
+      }
+  };
+}
+
+#endif
@@ -0,0 +1,151 @@
+/**
+ * @file    regionReadahead.hpp
+ * @brief   reads of the regions of the upcoming mappings started ahead by the kernel
+ */
+
+#ifndef REGION_READAHEAD_HPP
+#define REGION_READAHEAD_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+
+//Own includes
+#include "align/include/sequenceCache.hpp"
+
+namespace align
+{
+  /**
+   * @brief     asks the kernel to read the file ranges of queued regions of local inputs
+   * @details   a fetch blocks on the reads of its region, one at a time per alignment
+   *            thread. The bytes of the regions of the upcoming mappings are rather located
+   *            through the .fai index, and the .gzi index of a bgzipped file, and advised
+   *            with posix_fadvise: the kernel keeps all of their reads in flight at once,
+   *            with no thread waiting on them, and the fetches later find the pages in
+   *            memory, only decompressing them. Inputs that are remote or lack an index
+   *            are left alone
+   */
+  class RegionReadahead
+  {
+    private:
+
+      struct Contig
+      {
+        uint64_t offset;
+        uint64_t lineBases;
+        uint64_t lineBytes;
+      };
+
+      struct File
+      {
+        int fd = -1;
+        std::unordered_map<std::string, Contig> contigs;
+        //uncompressed and compressed offsets of the BGZF blocks, empty if uncompressed
+        std::vector<std::pair<uint64_t, uint64_t>> blocks;
+      };
+
+      File ref;
+      File query;
+
+      static void open(File& file, const std::string& fileName)
+      {
+        if (SequenceCache::isRemote(fileName))
+          return;
+        std::ifstream fai(fileName + ".fai");
+        std::string line;
+        while (std::getline(fai, line))
+        {
+          std::istringstream fields(line);
+          std::string name;
+          uint64_t length;
+          Contig contig;
+          if (std::getline(fields, name, '\t') && fields >> length >> contig.offset >> contig.lineBases >> contig.lineBytes
+              && contig.lineBases > 0)
+            file.contigs.emplace(name, contig);
+        }
+        if (file.contigs.empty())
+          return;
+        // .gzi: the count of blocks past the first, then their compressed and uncompressed offsets
+        std::ifstream gzi(fileName + ".gzi", std::ios::binary);
+        uint64_t count = 0;
+        if (gzi.read(reinterpret_cast<char*>(&count), sizeof(count)))
+        {
+          file.blocks.emplace_back(0, 0);
+          for (uint64_t i = 0; i < count; ++i)
+          {
+            uint64_t offsets[2];
+            if (!gzi.read(reinterpret_cast<char*>(offsets), sizeof(offsets)))
+              break;
+            file.blocks.emplace_back(offsets[1], offsets[0]);
+          }
+        }
+        file.fd = ::open(fileName.c_str(), O_RDONLY);
+      }
+
+      static void advise(const File& file, const std::string& name, int64_t begin, int64_t end)
+      {
+        if (file.fd < 0 || begin > end)
+          return;
+        auto it = file.contigs.find(name);
+        if (it == file.contigs.end())
+          return;
+        const Contig& c = it->second;
+        const auto byteOf = [&](uint64_t pos) {
+          return c.offset + pos / c.lineBases * c.lineBytes + pos % c.lineBases;
+        };
+        uint64_t from = byteOf(std::max<int64_t>(begin, 0));
+        uint64_t to = byteOf(end) + 1;
+        if (!file.blocks.empty())
+        {
+          // from the start of the block of from to the start of the block past that of to, 0 for the end of the file
+          auto first = std::upper_bound(file.blocks.begin(), file.blocks.end(), std::make_pair(from, UINT64_MAX));
+          auto last = std::upper_bound(first, file.blocks.end(), std::make_pair(to - 1, UINT64_MAX));
+          from = std::prev(first)->second;
+          if (last == file.blocks.end())
+          {
+            posix_fadvise(file.fd, from, 0, POSIX_FADV_WILLNEED);
+            return;
+          }
+          to = last->second;
+        }
+        posix_fadvise(file.fd, from, to - from, POSIX_FADV_WILLNEED);
+      }
+
+    public:
+
+      RegionReadahead(const std::string& refFile, const std::string& queryFile)
+      {
+        open(ref, refFile);
+        open(query, queryFile);
+      }
+
+      RegionReadahead(const RegionReadahead&) = delete;
+      RegionReadahead& operator=(const RegionReadahead&) = delete;
+
+      ~RegionReadahead()
+      {
+        if (ref.fd >= 0)
+          ::close(ref.fd);
+        if (query.fd >= 0)
+          ::close(query.fd);
+      }
+
+      /**
+       * @brief     starts reading bases [begin, end] of sequence name of the reference, or of the query
+       */
+      void enqueue(bool isRef, const std::string& name, int64_t begin, int64_t end)
+      {
+        advise(isRef ? ref : query, name, begin, end);
+      }
+  };
+}
+
+#endif
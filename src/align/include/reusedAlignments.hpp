@@ -0,0 +1,253 @@
+/**
+ * @file    reusedAlignments.hpp
+ * @brief   alignments of the PAF output of a previous run, reused for the mappings that
+ *          did not change
+ */
+
+#ifndef REUSED_ALIGNMENTS_HPP
+#define REUSED_ALIGNMENTS_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <string>
+#include <unistd.h>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "map/include/base_types.hpp"
+#include "align/include/align_types.hpp"
+
+//External includes
+#include "common/wflign/src/murmur3.hpp"
+
+namespace align
+{
+  /**
+   * @brief     PAF records of a previous run, output again for the mappings that come with
+   *            the same coordinates and alignment parameters rather than aligned again
+   * @details   re-running a pipeline after tuning the mapping or adding targets gives
+   *            mostly the same mappings. Each record is tagged with rk:Z, a 128-bit hash of
+   *            its mapping: the names, lengths, coordinates, strand and estimated identity,
+   *            and of the parameters its alignment depends on. The sequences are identified
+   *            by their names and lengths, not read. The tagged lines of the previous output
+   *            are indexed by their key at their offsets in the file, and read back when a
+   *            mapping of the same key comes; mappings whose alignment gave no record are
+   *            aligned again
+   */
+  class ReusedAlignments
+  {
+    public:
+
+      struct Key
+      {
+        uint64_t low;
+        uint64_t high;
+
+        bool operator==(const Key& other) const
+        {
+          return low == other.low && high == other.high;
+        }
+      };
+
+    private:
+
+      struct KeyHash
+      {
+        size_t operator()(const Key& k) const
+        {
+          return k.low;
+        }
+      };
+
+      //Lines of a record, consecutive ones merged
+      struct Range
+      {
+        uint64_t offset;
+        uint64_t length;
+      };
+
+      static constexpr const char* tagName = "\trk:Z:";
+
+      int fd = -1;
+      std::unordered_map<Key, std::vector<Range>, KeyHash> entries;
+      std::atomic<uint64_t> reused{0};
+
+      static int hexDigit(char c)
+      {
+        return c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+      }
+
+      //key of the rk:Z tag of line, false if it has none
+      static bool parseTag(const std::string& line, Key& key)
+      {
+        const size_t tag = line.find(tagName);
+        if (tag == std::string::npos || line.size() < tag + std::strlen(tagName) + 32)
+          return false;
+        const char* hex = line.data() + tag + std::strlen(tagName);
+        uint64_t words[2] = {0, 0};
+        for (int i = 0; i < 32; ++i)
+        {
+          const int digit = hexDigit(hex[i]);
+          if (digit < 0)
+            return false;
+          words[i / 16] = words[i / 16] << 4 | uint64_t(digit);
+        }
+        key.high = words[0];
+        key.low = words[1];
+        return true;
+      }
+
+    public:
+
+      /**
+       * @brief             index the tagged records of fileName, if it exists; there is then
+       *                    nothing to reuse, the records of this run being tagged for the next
+       */
+      explicit ReusedAlignments(const std::string& fileName)
+      {
+        FILE* in = std::fopen(fileName.c_str(), "rb");
+        if (in == nullptr)
+          return;
+        const int first = std::fgetc(in), second = std::fgetc(in);
+        if (first == 0x1f && second == 0x8b)
+        {
+          std::fclose(in);
+          throw std::runtime_error("[wfmash::align::computeAlignments] Error! The alignments to reuse have to be an uncompressed PAF file: " + fileName);
+        }
+        std::rewind(in);
+        std::string line;
+        uint64_t offset = 0;
+        char* buffer = nullptr;
+        size_t capacity = 0;
+        ssize_t read;
+        Key key;
+        while ((read = getline(&buffer, &capacity, in)) > 0)
+        {
+          line.assign(buffer, read);
+          if (parseTag(line, key))
+          {
+            std::vector<Range>& ranges = entries[key];
+            if (!ranges.empty() && ranges.back().offset + ranges.back().length == offset)
+              ranges.back().length += read;
+            else
+              ranges.push_back(Range {offset, uint64_t(read)});
+          }
+          offset += read;
+        }
+        std::free(buffer);
+        std::fclose(in);
+        if (!entries.empty())
+          fd = ::open(fileName.c_str(), O_RDONLY);
+      }
+
+      ~ReusedAlignments()
+      {
+        if (fd >= 0)
+          ::close(fd);
+      }
+
+      ReusedAlignments(const ReusedAlignments&) = delete;
+      ReusedAlignments& operator=(const ReusedAlignments&) = delete;
+
+      /**
+       * @brief             key of the mapping record, of sequences of queryLength and
+       *                    targetLength bases, aligned with the parameters of salt
+       */
+      static Key key(const MappingBoundaryRow& record, uint64_t queryLength, uint64_t targetLength,
+                     const std::string& salt)
+      {
+        std::string keyed;
+        keyed.reserve(record.qId.size() + record.refId.size() + salt.size() + 64);
+        keyed += record.qId;
+        keyed += '\t';
+        keyed += record.refId;
+        keyed += '\t';
+        const uint64_t fields[6] = {queryLength, uint64_t(record.qStartPos), uint64_t(record.qEndPos),
+                                    targetLength, uint64_t(record.rStartPos), uint64_t(record.rEndPos)};
+        keyed.append(reinterpret_cast<const char*>(fields), sizeof(fields));
+        keyed += record.strand == skch::strnd::FWD ? '+' : '-';
+        keyed.append(reinterpret_cast<const char*>(&record.mashmap_estimated_identity),
+                     sizeof(record.mashmap_estimated_identity));
+        keyed += salt;
+        uint64_t hash[2];
+        MurmurHash3_x64_128(keyed.data(), keyed.size(), 47, hash);
+        return Key {hash[0], hash[1]};
+      }
+
+      /**
+       * @brief             append the records of the previous run for key, false if there
+       *                    are none
+       */
+      bool take(const Key& key, std::string& out)
+      {
+        auto it = entries.find(key);
+        if (it == entries.end())
+          return false;
+        const size_t begin = out.size();
+        for (const Range& range : it->second)
+        {
+          out.resize(out.size() + range.length);
+          char* to = &out[out.size() - range.length];
+          uint64_t done = 0;
+          while (done < range.length)
+          {
+            const ssize_t n = ::pread(fd, to + done, range.length - done, range.offset + done);
+            if (n <= 0)
+            {
+              out.resize(begin);
+              return false;
+            }
+            done += n;
+          }
+        }
+        reused.fetch_add(1, std::memory_order_relaxed);
+        return true;
+      }
+
+      /**
+       * @brief             add the rk:Z tag of key to the PAF lines of out from begin
+       */
+      static void tag(const Key& key, std::string& out, size_t begin)
+      {
+        char hex[33];
+        std::snprintf(hex, sizeof(hex), "%016llx%016llx",
+                      (unsigned long long) key.high, (unsigned long long) key.low);
+        std::string tagged;
+        tagged.reserve(out.size() - begin + 64);
+        size_t pos = begin;
+        while (pos < out.size())
+        {
+          size_t end = out.find('\n', pos);
+          if (end == std::string::npos)
+            end = out.size();
+          tagged.append(out, pos, end - pos);
+          tagged += tagName;
+          tagged.append(hex, 32);
+          tagged += '\n';
+          pos = end + 1;
+        }
+        out.replace(begin, std::string::npos, tagged);
+      }
+
+      /**
+       * @brief             records of the previous run indexed, and reused so far
+       */
+      size_t indexed() const
+      {
+        return entries.size();
+      }
+
+      uint64_t reusedRecords() const
+      {
+        return reused.load();
+      }
+  };
+}
+
+#endif
@@ -0,0 +1,127 @@
+/**
+ * @file    reverseComplementCache.hpp
+ * @brief   reverse complements of query regions, shared by the alignment threads
+ */
+
+#ifndef REVERSE_COMPLEMENT_CACHE_HPP
+#define REVERSE_COMPLEMENT_CACHE_HPP
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+#include "common/memory_accounting.hpp"
+#include "map/include/commonFunc.hpp"
+
+namespace align
+{
+  /**
+   * @brief     least recently used cache of the reverse complements of query regions
+   * @details   in repetitive genomes a query region maps on the reverse strand of many
+   *            targets, each record of it complementing the same bases again. The regions
+   *            are keyed by query and coordinates, their bases being those of the query
+   *            there; complemented outside of the cache lock
+   */
+  class ReverseComplementCache
+  {
+    public:
+
+      using Strand = std::shared_ptr<const std::string>;
+
+    private:
+
+      struct Key
+      {
+        std::string name;
+        uint64_t begin;
+        uint64_t length;
+
+        bool operator==(const Key& other) const
+        {
+          return begin == other.begin && length == other.length && name == other.name;
+        }
+      };
+
+      struct KeyHash
+      {
+        size_t operator()(const Key& k) const
+        {
+          return std::hash<std::string>()(k.name)
+            ^ (std::hash<uint64_t>()(k.begin) * 0x9e3779b97f4a7c15ULL)
+            ^ (std::hash<uint64_t>()(k.length) * 0xc2b2ae3d27d4eb4fULL);
+        }
+      };
+
+      using Entry = std::pair<Key, Strand>;
+
+      const uint64_t maxBytes;
+
+      std::mutex mutex;
+      std::list<Entry> recent;          //most recently used first
+      std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> entries;
+      uint64_t cachedBytes = 0;
+
+    public:
+
+      /**
+       * @param[in] maxBytes      bases kept at most
+       */
+      explicit ReverseComplementCache(uint64_t maxBytes) : maxBytes(maxBytes) {}
+
+      ReverseComplementCache(const ReverseComplementCache&) = delete;
+      ReverseComplementCache& operator=(const ReverseComplementCache&) = delete;
+
+      ~ReverseComplementCache()
+      {
+        memory_accounting::add(memory_accounting::align_records, -(int64_t)cachedBytes);
+      }
+
+      /**
+       * @brief             reverse complement of the length bases at begin of query name
+       * @param[in] bases   the bases of the region, upper case, complemented if not cached
+       */
+      Strand get(const std::string& name, uint64_t begin, uint64_t length, const char* bases)
+      {
+        const Key key {name, begin, length};
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          auto it = entries.find(key);
+          if (it != entries.end())
+          {
+            recent.splice(recent.begin(), recent, it->second);
+            return it->second->second;
+          }
+        }
+
+        auto strand = std::make_shared<std::string>(length, '\0');
+        skch::CommonFunc::reverseComplement(bases, &(*strand)[0], length);
+        //Larger regions are rather complemented each time
+        if (length > maxBytes / 4)
+          return strand;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        // another thread may have complemented the same region meanwhile
+        if (entries.count(key))
+          return strand;
+        recent.emplace_front(key, strand);
+        entries.emplace(key, recent.begin());
+        cachedBytes += length;
+        int64_t added = length;
+        while (cachedBytes > maxBytes && recent.size() > 1)
+        {
+          cachedBytes -= recent.back().second->size();
+          added -= recent.back().second->size();
+          entries.erase(recent.back().first);
+          recent.pop_back();
+        }
+        memory_accounting::add(memory_accounting::align_records, added);
+        return strand;
+      }
+  };
+}
+
+#endif
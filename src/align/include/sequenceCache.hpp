@@ -0,0 +1,182 @@
+/**
+ * @file    sequenceCache.hpp
+ * @brief   cache of sequence regions fetched for alignment, shared by the alignment threads
+ */
+
+#ifndef SEQUENCE_CACHE_HPP
+#define SEQUENCE_CACHE_HPP
+
+#include <cstdint>
+#include <fstream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+namespace align
+{
+  /**
+   * @brief     least recently used cache of fixed size chunks of sequences
+   * @details   neighbouring mappings on a contig fetch overlapping windows, and from a
+   *            bgzipped fasta each fetch decompresses all the blocks it covers again.
+   *            Windows are rather assembled from chunks of chunkBases bases kept here,
+   *            only the chunks missing being fetched, outside of the cache lock
+   */
+  class SequenceCache
+  {
+    private:
+
+      struct Key
+      {
+        std::string name;
+        int64_t chunk;
+
+        bool operator==(const Key& other) const
+        {
+          return chunk == other.chunk && name == other.name;
+        }
+      };
+
+      struct KeyHash
+      {
+        size_t operator()(const Key& k) const
+        {
+          return std::hash<std::string>()(k.name) ^ (std::hash<int64_t>()(k.chunk) * 0x9e3779b97f4a7c15ULL);
+        }
+      };
+
+      using Chunk = std::shared_ptr<const std::string>;
+      using Entry = std::pair<Key, Chunk>;
+
+      const uint64_t maxBytes;
+      const int64_t chunkBases;
+
+      std::mutex mutex;
+      std::list<Entry> recent;          //most recently used first
+      std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> entries;
+      uint64_t cachedBytes = 0;
+
+      Chunk lookup(const Key& key)
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = entries.find(key);
+        if (it == entries.end())
+          return nullptr;
+        recent.splice(recent.begin(), recent, it->second);
+        return it->second->second;
+      }
+
+      void insert(const Key& key, const Chunk& chunk)
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        // another thread may have fetched the same chunk meanwhile
+        if (entries.count(key))
+          return;
+        recent.emplace_front(key, chunk);
+        entries.emplace(key, recent.begin());
+        cachedBytes += chunk->size();
+        while (cachedBytes > maxBytes && recent.size() > 1)
+        {
+          cachedBytes -= recent.back().second->size();
+          entries.erase(recent.back().first);
+          recent.pop_back();
+        }
+      }
+
+    public:
+
+      /**
+       * @param[in] maxBytes      bases kept at most
+       * @param[in] chunkBases    bases per chunk, about the content of a BGZF block
+       */
+      explicit SequenceCache(uint64_t maxBytes, int64_t chunkBases = 1 << 16)
+        : maxBytes(maxBytes), chunkBases(chunkBases) {}
+
+      SequenceCache(const SequenceCache&) = delete;
+      SequenceCache& operator=(const SequenceCache&) = delete;
+
+      /**
+       * @brief             bases [begin, end] of sequence name, clipped to its end as faidx does
+       * @param[in] fetch   fetch(begin, end) gives the bases [begin, end] of the sequence, used
+       *                    for the missing chunks
+       */
+      template <typename Fetch>
+      std::string get(const std::string& name, int64_t begin, int64_t end, const Fetch& fetch)
+      {
+        std::string out;
+        get(name, begin, end, fetch, out);
+        return out;
+      }
+
+      /**
+       * @brief             get() into out, which keeps its capacity
+       */
+      template <typename Fetch>
+      void get(const std::string& name, int64_t begin, int64_t end, const Fetch& fetch, std::string& out)
+      {
+        out.clear();
+        out.reserve(end - begin + 1);
+        for (int64_t c = begin / chunkBases; c <= end / chunkBases; ++c)
+        {
+          const Key key {name, c};
+          Chunk chunk = lookup(key);
+          if (chunk == nullptr)
+          {
+            chunk = std::make_shared<const std::string>(fetch(c * chunkBases, (c + 1) * chunkBases - 1));
+            insert(key, chunk);
+          }
+          const int64_t from = std::max<int64_t>(begin - c * chunkBases, 0);
+          const int64_t to = std::min<int64_t>(end - c * chunkBases + 1, chunk->size());
+          if (to > from)
+            out.append(*chunk, from, to - from);
+          // the sequence ends in this chunk
+          if (int64_t(chunk->size()) < chunkBases)
+            break;
+        }
+      }
+
+      /**
+       * @brief             fetches the chunks of bases [begin, end] of sequence name that are not
+       *                    cached yet, for a later get() to find them
+       */
+      template <typename Fetch>
+      void prefetch(const std::string& name, int64_t begin, int64_t end, const Fetch& fetch)
+      {
+        for (int64_t c = begin / chunkBases; c <= end / chunkBases; ++c)
+        {
+          const Key key {name, c};
+          Chunk chunk = lookup(key);
+          if (chunk == nullptr)
+          {
+            chunk = std::make_shared<const std::string>(fetch(c * chunkBases, (c + 1) * chunkBases - 1));
+            insert(key, chunk);
+          }
+          if (int64_t(chunk->size()) < chunkBases)
+            break;
+        }
+      }
+
+      /**
+       * @brief             true if the file is gzip compressed, where fetches pay for decompression
+       */
+      static bool isCompressed(const std::string& fileName)
+      {
+        std::ifstream in(fileName, std::ios::binary);
+        unsigned char magic[2];
+        return in.read(reinterpret_cast<char*>(magic), 2) && magic[0] == 0x1f && magic[1] == 0x8b;
+      }
+
+      /**
+       * @brief             true if htslib opens the file over the network (s3://, https://, ...),
+       *                    where each fetch is a round trip
+       */
+      static bool isRemote(const std::string& fileName)
+      {
+        return fileName.find("://") != std::string::npos;
+      }
+  };
+}
+
+#endif
@@ -0,0 +1,146 @@
+/**
+ * @file    sequencePrefetcher.hpp
+ * @brief   regions of the upcoming mappings fetched ahead into the sequence caches
+ */
+
+#ifndef SEQUENCE_PREFETCHER_HPP
+#define SEQUENCE_PREFETCHER_HPP
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <htslib/faidx.h>
+
+//Own includes
+#include "align/include/sequenceCache.hpp"
+#include "common/hot_counters.hpp"
+
+namespace align
+{
+  /**
+   * @brief     fetches queued regions into the SequenceCache of their file on helper threads
+   * @details   from a remote input each fetch is a network round trip, which the alignment
+   *            threads would otherwise wait on one at a time. The helpers issue the range
+   *            requests of the upcoming mappings in parallel, each through faidx handles of
+   *            its own, so that the alignments find their chunks cached. A region that fails
+   *            to be fetched is dropped, the alignment fetching it again reports the error
+   */
+  class SequencePrefetcher
+  {
+    private:
+
+      struct Region
+      {
+        bool ref;
+        std::string name;
+        int64_t begin;
+        int64_t end;
+      };
+
+      const std::string refFile;
+      const std::string queryFile;
+      SequenceCache* const refCache;
+      SequenceCache* const queryCache;
+
+      std::mutex mutex;
+      std::condition_variable queued;
+      std::deque<Region> regions;
+      bool stopping = false;
+      std::vector<std::thread> helpers;
+
+      void run()
+      {
+        faidx_t* ref_faidx = nullptr;
+        faidx_t* query_faidx = nullptr;
+        while (true)
+        {
+          Region region;
+          {
+            std::unique_lock<std::mutex> lock(mutex);
+            queued.wait(lock, [&]() { return stopping || !regions.empty(); });
+            if (stopping)
+              break;
+            region = std::move(regions.front());
+            regions.pop_front();
+          }
+          faidx_t*& faidx = region.ref ? ref_faidx : query_faidx;
+          if (faidx == nullptr)
+            faidx = fai_load((region.ref ? refFile : queryFile).c_str());
+          if (faidx == nullptr)
+            continue;
+          const auto fetch = [&](int64_t from, int64_t to) {
+            int64_t len;
+            char* seq = faidx_fetch_seq64(faidx, region.name.c_str(), from, to, &len);
+            if (seq == nullptr)
+              throw std::runtime_error("[wfmash::align::SequencePrefetcher] failed to fetch " + region.name);
+            hot_counters::add(hot_counters::faidx_bytes, len);
+            std::string out(seq, len);
+            free(seq);
+            return out;
+          };
+          try
+          {
+            (region.ref ? refCache : queryCache)->prefetch(region.name, region.begin, region.end, fetch);
+          }
+          catch (const std::runtime_error&) {}
+        }
+        if (ref_faidx != nullptr)
+          fai_destroy(ref_faidx);
+        if (query_faidx != nullptr)
+          fai_destroy(query_faidx);
+      }
+
+    public:
+
+      /**
+       * @param[in] refCache, queryCache    caches of the fetches of refFile and queryFile,
+       *                                    the regions of a file without one are not queued
+       * @param[in] threads                 helpers, fetching that many regions at a time
+       */
+      SequencePrefetcher(const std::string& refFile, const std::string& queryFile,
+                         SequenceCache* refCache, SequenceCache* queryCache, int threads)
+        : refFile(refFile), queryFile(queryFile), refCache(refCache), queryCache(queryCache)
+      {
+        for (int t = 0; t < threads; ++t)
+          helpers.emplace_back([this]() { run(); });
+      }
+
+      SequencePrefetcher(const SequencePrefetcher&) = delete;
+      SequencePrefetcher& operator=(const SequencePrefetcher&) = delete;
+
+      /**
+       * @brief     stops the helpers, the regions still queued are not fetched
+       */
+      ~SequencePrefetcher()
+      {
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          stopping = true;
+        }
+        queued.notify_all();
+        for (auto& helper : helpers)
+          helper.join();
+      }
+
+      /**
+       * @brief     queues bases [begin, end] of sequence name of the reference, or of the query
+       */
+      void enqueue(bool ref, const std::string& name, int64_t begin, int64_t end)
+      {
+        if ((ref ? refCache : queryCache) == nullptr)
+          return;
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          regions.push_back(Region {ref, name, begin, end});
+        }
+        queued.notify_one();
+      }
+  };
+}
+
+#endif
@@ -0,0 +1,177 @@
+/**
+ * @file    sequenceStore.hpp
+ * @brief   whole input sequences held in memory for the aligner
+ */
+
+#ifndef SEQUENCE_STORE_HPP
+#define SEQUENCE_STORE_HPP
+
+#include <cstdint>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <htslib/faidx.h>
+
+//Own includes
+#include "map/include/commonFunc.hpp"
+
+//External includes
+#include "common/seqiter.hpp"
+
+namespace align
+{
+  /**
+   * @brief     all the sequences of a fasta file in one contiguous buffer, indexed by id
+   * @details   loaded once, upper case and with non-ACGT bases as N as the aligner
+   *            wants them, so that alignments read windows of it in place instead of
+   *            fetching and copying each window from the file. In a run that maps and
+   *            aligns, the mapping stage may fill them with the sequences it reads, for the
+   *            aligner not to read the files again
+   */
+  class SequenceStore
+  {
+    private:
+
+      std::string bases;
+      std::vector<uint64_t> offsets;            //start of each sequence in bases
+      std::vector<uint64_t> lengths;
+      std::unordered_map<std::string, uint32_t> ids;
+
+      //Stores filled by the mapping stage, by file
+      static std::map<std::string, std::shared_ptr<SequenceStore>>& keptStores()
+      {
+        static std::map<std::string, std::shared_ptr<SequenceStore>> stores;
+        return stores;
+      }
+
+    public:
+
+      /**
+       * @param[in] fileName    fasta file, read by `threads` readers if it is indexed
+       */
+      SequenceStore(const std::string& fileName, int threads)
+      {
+        // size the buffer upfront from the index, so that it is never moved
+        if (faidx_t* fai = fai_load(fileName.c_str()))
+        {
+          uint64_t total = 0;
+          for (int i = 0; i < faidx_nseq(fai); i++)
+            total += faidx_seq_len(fai, faidx_iseq(fai, i));
+          bases.reserve(total);
+          fai_destroy(fai);
+        }
+
+        seqiter::for_each_seq_in_file_parallel(fileName, {}, "", threads,
+            [&](const std::string& name, const std::string& seq) {
+              add(name, seq);
+            });
+      }
+
+      /**
+       * @brief             empty, sized for the sequences of a fasta file if it is indexed
+       */
+      explicit SequenceStore(const std::string& fileName)
+      {
+        const uint64_t total = indexedBases(fileName);
+        if (total != std::numeric_limits<uint64_t>::max())
+          bases.reserve(total);
+      }
+
+      SequenceStore(const SequenceStore&) = delete;
+      SequenceStore& operator=(const SequenceStore&) = delete;
+
+      /**
+       * @brief             bases of the sequences of a fasta file, from its index, the
+       *                    largest uint64_t if it has none
+       */
+      static uint64_t indexedBases(const std::string& fileName)
+      {
+        if (!seqiter::fai_index_exists(fileName))
+          return std::numeric_limits<uint64_t>::max();
+        faidx_t* fai = fai_load(fileName.c_str());
+        if (fai == nullptr)
+          return std::numeric_limits<uint64_t>::max();
+        uint64_t total = 0;
+        for (int i = 0; i < faidx_nseq(fai); i++)
+          total += faidx_seq_len(fai, faidx_iseq(fai, i));
+        fai_destroy(fai);
+        return total;
+      }
+
+      /**
+       * @brief             keep a sequence of fileName read by the mapping stage, in the store
+       *                    of the file, unless it is there already
+       */
+      static void keep(const std::string& fileName, const std::string& name, const std::string& seq)
+      {
+        std::shared_ptr<SequenceStore>& store = keptStores()[fileName];
+        if (store == nullptr)
+          store = std::make_shared<SequenceStore>(fileName);
+        if (!store->contains(name))
+          store->add(name, seq);
+      }
+
+      /**
+       * @brief             the store of fileName filled by the mapping stage, which is no
+       *                    longer kept, nullptr if there is none
+       */
+      static std::shared_ptr<SequenceStore> takeKept(const std::string& fileName)
+      {
+        auto it = keptStores().find(fileName);
+        if (it == keptStores().end())
+          return nullptr;
+        std::shared_ptr<SequenceStore> store = std::move(it->second);
+        keptStores().erase(it);
+        return store;
+      }
+
+      void add(const std::string& name, const std::string& seq)
+      {
+        ids.emplace(name, offsets.size());
+        offsets.push_back(bases.size());
+        lengths.push_back(seq.size());
+        bases.append(seq);
+        skch::CommonFunc::makeUpperCaseAndValidDNA(&bases[offsets.back()], seq.size());
+      }
+
+      bool contains(const std::string& name) const
+      {
+        return ids.count(name) > 0;
+      }
+
+      /**
+       * @brief             id of a sequence, which has to be in the file
+       */
+      uint32_t id(const std::string& name) const
+      {
+        auto it = ids.find(name);
+        if (it == ids.end())
+        {
+          std::cerr << "[wfmash::align::SequenceStore] ERROR: sequence " << name << " is not in the input" << std::endl;
+          exit(1);
+        }
+        return it->second;
+      }
+
+      const char* data(uint32_t id) const
+      {
+        return bases.data() + offsets[id];
+      }
+
+      uint64_t length(uint32_t id) const
+      {
+        return lengths[id];
+      }
+
+      uint64_t totalBases() const
+      {
+        return bases.size();
+      }
+  };
+}
+
+#endif
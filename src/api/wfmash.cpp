@@ -0,0 +1,162 @@
+/**
+ * @file    wfmash.cpp
+ * @brief   libwfmash: the mapping and alignment stages behind the API of wfmash.hpp
+ */
+
+#include <cstdlib>
+#include <sstream>
+#include <stdexcept>
+
+#include "api/wfmash.hpp"
+
+#include "map/include/map_parameters.hpp"
+#include "map/include/base_types.hpp"
+#include "map/include/winSketch.hpp"
+#include "map/include/computeMap.hpp"
+#include "map/include/parseCmdArgs.hpp"
+
+#include "interface/parse_args.hpp"
+
+#include "align/include/align_parameters.hpp"
+#include "align/include/computeAlignments.hpp"
+#include "align/include/parseCmdArgs.hpp"
+
+//External includes
+#include "common/ALeS.hpp"
+
+namespace wfmash
+{
+  struct Index::Impl
+  {
+    //the stages keep references to their parameters, which live here
+    skch::Parameters mapParameters;
+    align::Parameters alignParameters;
+    std::unique_ptr<skch::Sketch> sketch;
+    std::unique_ptr<align::Aligner> aligner;
+  };
+
+  Index::Index(const std::vector<std::string>& args) : impl(new Impl())
+  {
+    std::vector<std::string> argStrings(1, "wfmash");
+    argStrings.insert(argStrings.end(), args.begin(), args.end());
+    std::vector<char*> argv;
+    for (auto& arg : argStrings)
+      argv.push_back(&arg[0]);
+    argv.push_back(nullptr);
+
+    yeet::Parameters yeetParameters;
+    yeet::parse_args(argStrings.size(), argv.data(), impl->mapParameters, impl->alignParameters, yeetParameters);
+
+    skch::Parameters& mapParams = impl->mapParameters;
+    if (mapParams.index_shards != 1)
+      throw std::runtime_error("[wfmash::Index] Error! The index can't be split in shards in memory");
+
+    //the queries come from map(), the mappings go to its callback
+    mapParams.querySequences.clear();
+    mapParams.query_prefix.clear();
+    mapParams.query_list.clear();
+    mapParams.outFileName = "/dev/null";
+    mapParams.binary_output = false;
+    mapParams.bgzf_output = false;
+    mapParams.output_shards = 0;
+    mapParams.create_index_only = false;
+    mapParams.map_checkpoint_file.clear();
+    mapParams.mapping_cache_file.clear();
+
+    if (mapParams.use_spaced_seeds)
+      skch::Sketch::loadSpacedSeeds(mapParams);
+    impl->sketch.reset(new skch::Sketch(mapParams));
+
+    //the alignments are parsed back from their PAF records
+    align::Parameters& alignParams = impl->alignParameters;
+    alignParams.querySequences = alignParams.refSequences;
+    alignParams.sam_format = false;
+    alignParams.score_only = false;
+    alignParams.emit_md_tag = false;
+    alignParams.reuse_alignments_file.clear();
+    impl->aligner.reset(new align::Aligner(alignParams));
+  }
+
+  Index::~Index() = default;
+
+  void Index::map(const std::vector<Sequence>& queries, const std::function<void(const Mapping&)>& callback)
+  {
+    const skch::Parameters& param = impl->mapParameters;
+    const skch::Sketch& sketch = *impl->sketch;
+
+    //queries the mapper drops unread are not handed to it, so that the query ids of the
+    //mappings are the positions of their queries in mapped
+    std::vector<size_t> mapped;
+    const auto querySource = [&](const std::function<void(const std::string&, std::string&&)>& mapQuerySeq) {
+      for (size_t i = 0; i < queries.size(); ++i)
+      {
+        const std::string& name = queries[i].name;
+        if (param.skip_self && param.target_prefix != ""
+            && name.compare(0, param.target_prefix.size(), param.target_prefix) == 0)
+          continue;
+        mapped.push_back(i);
+        mapQuerySeq(name, std::string(queries[i].seq));
+      }
+    };
+
+    const auto report = [&](const skch::MappingResult& e) {
+      const Sequence& query = queries[mapped[e.querySeqId]];
+      const skch::ContigInfo& target = sketch.metadata[e.refSeqId];
+      Mapping m;
+      m.queryName = query.name;
+      m.queryLength = e.queryLen;
+      m.queryStart = e.queryStartPos;
+      m.queryEnd = e.queryEndPos;
+      m.reverse = e.strand != skch::strnd::FWD;
+      m.targetName = std::string(target.name);
+      m.targetLength = target.len;
+      m.targetStart = e.refStartPos;
+      m.targetEnd = e.refEndPos;
+      m.blockLength = e.blockLength;
+      m.identity = e.nucIdentity;
+      callback(m);
+    };
+
+    skch::Map mapper(param, sketch, report, nullptr, nullptr, querySource);
+  }
+
+  std::vector<Alignment> Index::align(const Mapping& mapping, const Sequence& query)
+  {
+    align::MappingBoundaryRow record;
+    record.rankMapping = 0;
+    record.qId = mapping.queryName;
+    record.refId = mapping.targetName;
+    record.qStartPos = mapping.queryStart;
+    record.qEndPos = mapping.queryEnd;
+    record.rStartPos = mapping.targetStart;
+    record.rEndPos = mapping.targetEnd;
+    record.strand = mapping.reverse ? skch::strnd::REV : skch::strnd::FWD;
+    record.mashmap_estimated_identity = mapping.identity;
+
+    std::vector<Alignment> alignments;
+    std::istringstream records(impl->aligner->alignWithQuery(record, query.seq));
+    std::string line;
+    while (std::getline(records, line))
+    {
+      std::istringstream fields(line);
+      Alignment a;
+      std::string strand, mapq;
+      if (!(fields >> a.queryName >> a.queryLength >> a.queryStart >> a.queryEnd >> strand
+                   >> a.targetName >> a.targetLength >> a.targetStart >> a.targetEnd
+                   >> a.matches >> a.blockLength >> mapq))
+        throw std::runtime_error("[wfmash::Index::align] Error! Invalid alignment record: " + line);
+      a.reverse = strand == "-";
+      a.identity = 0;
+      std::string tag;
+      while (fields >> tag)
+      {
+        if (tag.compare(0, 5, "gi:f:") == 0)
+          a.identity = std::atof(tag.c_str() + 5);
+        else if (tag.compare(0, 5, "cg:Z:") == 0)
+          a.cigar = tag.substr(5);
+      }
+      alignments.push_back(std::move(a));
+    }
+    return alignments;
+  }
+}
@@ -0,0 +1,105 @@
+/**
+ * @file    wfmash.hpp
+ * @brief   in-process mapping and alignment against a resident target index,
+ *          the API of the libwfmash library
+ */
+
+#ifndef WFMASH_API_HPP
+#define WFMASH_API_HPP
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace wfmash
+{
+  /**
+   * @brief   a named sequence held in memory
+   */
+  struct Sequence
+  {
+    std::string name;
+    std::string seq;
+  };
+
+  /**
+   * @brief   an approximate mapping of a query on a target, coordinates 0-based, ends excluded
+   */
+  struct Mapping
+  {
+    std::string queryName;
+    uint64_t queryLength;
+    uint64_t queryStart;
+    uint64_t queryEnd;
+    bool reverse;                 //query reverse complemented on the target
+    std::string targetName;
+    uint64_t targetLength;
+    uint64_t targetStart;
+    uint64_t targetEnd;
+    uint64_t blockLength;
+    double identity;              //estimated from the shared k-mers
+  };
+
+  /**
+   * @brief   a base-level alignment of a mapping, coordinates 0-based, ends excluded
+   */
+  struct Alignment
+  {
+    std::string queryName;
+    uint64_t queryLength;
+    uint64_t queryStart;
+    uint64_t queryEnd;
+    bool reverse;
+    std::string targetName;
+    uint64_t targetLength;
+    uint64_t targetStart;
+    uint64_t targetEnd;
+    uint64_t matches;
+    uint64_t blockLength;
+    double identity;              //gap-compressed identity
+    std::string cigar;            //extended CIGAR (=, X, I, D)
+  };
+
+  /**
+   * @class   wfmash::Index
+   * @brief   target index built, or loaded with --mm-index, once, mapping and aligning
+   *          the queries given in memory with the parameters of a wfmash command line
+   * @details args are the arguments of a wfmash run, without the program name, e.g.
+   *          {"-p", "90", "-t", "8", "target.fa.gz"}; query files, output and run-mode
+   *          options are ignored. Errors of args end the process as the command line would,
+   *          later errors are thrown as std::runtime_error
+   */
+  class Index
+  {
+    public:
+
+      explicit Index(const std::vector<std::string>& args);
+      ~Index();
+
+      Index(const Index&) = delete;
+      Index& operator=(const Index&) = delete;
+
+      /**
+       * @brief   maps a batch of queries, handing each mapping kept by the filters to
+       *          callback, on the calling thread, in the order of the queries
+       */
+      void map(const std::vector<Sequence>& queries, const std::function<void(const Mapping&)>& callback);
+
+      /**
+       * @brief   aligns a mapping of query, the sequence of its queryName, in memory;
+       *          safe to call from several threads at once
+       * @return  the alignment(s) of the mapping, none if it aligns below the identity
+       *          threshold, several if it is split by inversions
+       */
+      std::vector<Alignment> align(const Mapping& mapping, const Sequence& query);
+
+    private:
+
+      struct Impl;
+      std::unique_ptr<Impl> impl;
+  };
+}
+
+#endif
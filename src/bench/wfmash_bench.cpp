@@ -0,0 +1,592 @@
+/**
+ * @file    wfmash_bench.cpp
+ * @brief   micro-benchmarks of the hot kernels of the mapping and alignment stages
+ * @details the sequences of a FASTA file, data/LPA.subset.fa.gz by default, are indexed as
+ *          wfmash would index them, and each kernel is run on them on one thread. For each,
+ *          the time per base it goes over and the heap allocations it makes are written as
+ *          JSON, of a schema kept stable so that runs can be compared:
+ *
+ *            {"schema": "wfmash-bench-1", "input": FILE, "repeats": N,
+ *             "benchmarks": [{"name", "iterations", "bases", "seconds", "ns_per_bp",
+ *                             "allocations", "allocated_bytes"}, ...]}
+ *
+ *          allocations and allocated_bytes count the calls to operator new per iteration,
+ *          not the malloc() calls of the C code of WFA2-lib.
+ *
+ *          usage: wfmash-bench [FASTA] [-r REPEATS] [-o JSON]
+ *
+ *          With --replay, the alignments kept by wfmash --capture-slow are aligned again
+ *          instead, each bundle (or those of each directory given) being a benchmark:
+ *
+ *          usage: wfmash-bench --replay BUNDLE|DIR... [-r REPEATS] [-o JSON]
+ */
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <dirent.h>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "map/include/map_parameters.hpp"
+#include "map/include/base_types.hpp"
+#include "map/include/winSketch.hpp"
+#include "map/include/computeMap.hpp"
+#include "map/include/parseCmdArgs.hpp"
+
+#include "interface/parse_args.hpp"
+
+#include "align/include/align_parameters.hpp"
+#include "align/include/computeAlignments.hpp"
+#include "align/include/parseCmdArgs.hpp"
+
+#include "common/seqiter.hpp"
+#include "common/wflign/src/rkmh.hpp"
+
+namespace
+{
+  std::atomic<uint64_t> allocationCount(0);
+  std::atomic<uint64_t> allocationBytes(0);
+}
+
+void* operator new(std::size_t n)
+{
+  allocationCount.fetch_add(1, std::memory_order_relaxed);
+  allocationBytes.fetch_add(n, std::memory_order_relaxed);
+  if (void* p = std::malloc(n == 0 ? 1 : n))
+    return p;
+  throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{
+  std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+  std::free(p);
+}
+
+namespace skch
+{
+  /**
+   * @brief   the kernels of Map, on fragments of queries as mapQueryFragments makes them
+   */
+  struct MapBench
+  {
+    typedef QueryMetaData<Map::MinVec_Type> Query;
+
+    Map& map;
+
+    explicit MapBench(Map& map) : map(map) {}
+
+    Query fragment(std::string& seq, offset_t start, seqno_t seqCounter, const std::string& name) const
+    {
+      Query Q;
+      Q.seq = &seq[0] + start;
+      Q.len = map.param.segLength;
+      Q.fullLen = seq.size();
+      Q.seqCounter = seqCounter;
+      Q.seqName = name;
+      Q.refGroup = map.getRefGroup(name);
+      return Q;
+    }
+
+    void seedHits(Query& Q) { map.getSeedHits(Q); }
+
+    void seedIntervalPoints(Query& Q, std::vector<IntervalPoint>& intervalPoints)
+    {
+      map.getSeedIntervalPoints(Q, intervalPoints);
+    }
+
+    void l1Mapping(Query& Q, std::vector<IntervalPoint>& intervalPoints, std::vector<Map::L1_candidateLocus_t>& l1Mappings)
+    {
+      map.doL1Mapping(Q, intervalPoints, l1Mappings);
+    }
+
+    void l2Mapping(Query& Q, std::vector<Map::L1_candidateLocus_t>& l1Mappings, MappingResultsVector_t& l2Mappings)
+    {
+      map.doL2Mapping(Q, l1Mappings.begin(), l1Mappings.end(), l2Mappings);
+    }
+
+    void mergeMappingsInRange(MappingResultsVector_t& mappings)
+    {
+      map.mergeMappingsInRange(mappings, map.param.chain_gap);
+    }
+
+    //What finishQueryMappings does to the merged mappings before filtering them
+    void finishMerge(MappingResultsVector_t& mappings)
+    {
+      map.filterWeakMappings(mappings, std::floor(map.param.block_length / map.param.segLength));
+      map.setBlockCoordsToMappingCoords(mappings);
+    }
+
+    void filterQuery(MappingResultsVector_t& mappings)
+    {
+      Filter::query::filterMappings(mappings, map.param.numMappingsForSegment - 1, map.param.dropRand,
+                                    map.param.overlap_threshold);
+    }
+  };
+}
+
+namespace
+{
+  struct Result
+  {
+    std::string name;
+    uint64_t iterations = 0;
+    uint64_t bases = 0;           //per iteration
+    double seconds = 0;           //over all iterations
+    uint64_t allocations = 0;     //over all iterations
+    uint64_t allocatedBytes = 0;
+  };
+
+  /**
+   * @brief   times run, and counts its allocations, over repeats iterations going over bases
+   *          each, setup being called before each call of run, untimed
+   */
+  template <typename Setup, typename Run>
+  Result measure(const std::string& name, int repeats, uint64_t bases, Setup&& setup, Run&& run)
+  {
+    Result r;
+    r.name = name;
+    r.iterations = repeats;
+    r.bases = bases;
+    for (int i = 0; i < repeats; ++i)
+    {
+      setup();
+      const uint64_t count = allocationCount.load(std::memory_order_relaxed);
+      const uint64_t bytes = allocationBytes.load(std::memory_order_relaxed);
+      const auto start = std::chrono::steady_clock::now();
+      run();
+      r.seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+      r.allocations += allocationCount.load(std::memory_order_relaxed) - count;
+      r.allocatedBytes += allocationBytes.load(std::memory_order_relaxed) - bytes;
+    }
+    std::cerr << "[wfmash-bench] " << name << ": " << r.seconds / repeats << " s per iteration" << std::endl;
+    return r;
+  }
+
+  void writeJson(std::ostream& out, const std::string& input, int repeats, const std::vector<Result>& results)
+  {
+    out << std::fixed << std::setprecision(3);
+    out << "{\n  \"schema\": \"wfmash-bench-1\",\n  \"input\": \"" << input << "\",\n  \"repeats\": " << repeats
+        << ",\n  \"benchmarks\": [";
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+      const Result& r = results[i];
+      const double iterations = std::max<uint64_t>(1, r.iterations);
+      out << (i == 0 ? "\n" : ",\n")
+          << "    {\"name\": \"" << r.name << "\""
+          << ", \"iterations\": " << r.iterations
+          << ", \"bases\": " << r.bases
+          << ", \"seconds\": " << r.seconds
+          << ", \"ns_per_bp\": " << (r.bases > 0 ? r.seconds * 1e9 / (iterations * r.bases) : 0.0)
+          << ", \"allocations\": " << r.allocations / iterations
+          << ", \"allocated_bytes\": " << r.allocatedBytes / iterations << "}";
+    }
+    out << "\n  ]\n}\n";
+  }
+}
+
+/**
+ * @brief   writes results as JSON to jsonFile, or to stdout if empty
+ */
+int writeResults(const std::string& jsonFile, const std::string& input, int repeats, const std::vector<Result>& results)
+{
+  if (jsonFile.empty())
+    writeJson(std::cout, input, repeats, results);
+  else
+  {
+    std::ofstream out(jsonFile);
+    writeJson(out, input, repeats, results);
+    if (!out)
+    {
+      std::cerr << "[wfmash-bench] ERROR, could not write " << jsonFile << std::endl;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/**
+ * @brief   the alignments of the bundles of wfmash --capture-slow, each as it was aligned in the
+ *          run it was captured from, on one thread
+ */
+Result replay(const std::string& bundle, int repeats)
+{
+  align::ReplayRecord r;
+  r.load(bundle);
+  const align::Parameters& p = r.param;
+  std::ostringstream out;
+  wflign::wavefront::WFlignAligners aligners;
+  Result result = measure("replay " + bundle, repeats, r.queryLength,
+      [&]() { out.str(""); },
+      [&]() {
+        wflign::wavefront::WFlign wflign(
+            p.wflambda_segment_length,
+            p.min_identity,
+            p.force_biwfa_alignment,
+            p.wfa_mismatch_score,
+            p.wfa_gap_opening_score,
+            p.wfa_gap_extension_score,
+            p.wfa_patching_mismatch_score,
+            p.wfa_patching_gap_opening_score1,
+            p.wfa_patching_gap_extension_score1,
+            p.wfa_patching_gap_opening_score2,
+            p.wfa_patching_gap_extension_score2,
+            r.identity,
+            p.wflign_mismatch_score,
+            p.wflign_gap_opening_score,
+            p.wflign_gap_extension_score,
+            p.wflign_max_mash_dist,
+            p.wflign_min_wavefront_length,
+            p.wflign_max_distance_threshold,
+            p.wflign_max_len_major,
+            p.wflign_max_len_minor,
+            p.wflign_erode_k,
+            p.chain_gap,
+            p.wflign_min_inv_patch_len,
+            p.wflign_max_patching_score);
+        wflign.set_aligners(&aligners);
+        wflign.set_max_memory(p.wfa_max_memory);
+        wflign.set_biwfa_threads(p.biwfa_threads);
+        wflign.set_output(
+            &out,
+            false, nullptr, "", 0, false, nullptr,
+            true, p.emit_md_tag, !p.sam_format, p.no_seq_in_sam);
+        wflign.set_score_only(p.score_only);
+        wflign.set_screen_identity(p.screen_identity);
+        wflign.wflign_affine_wavefront(
+            r.queryName, &r.query[0], r.queryTotalLength, r.queryStart, r.queryLength, r.reverse,
+            r.targetName, &r.target[r.targetOffset], r.targetTotalLength, r.targetStart, r.targetLength);
+      });
+  std::cerr << "[wfmash-bench] " << bundle << ": " << r.seconds << " s in the run it was captured from" << std::endl;
+  std::cerr << out.str();
+  return result;
+}
+
+int main(int argc, char** argv)
+{
+  std::string fasta = "data/LPA.subset.fa.gz";
+  std::string jsonFile;
+  int repeats = 3;
+  bool replaying = false;
+  std::vector<std::string> bundles;
+  for (int i = 1; i < argc; ++i)
+  {
+    const std::string arg = argv[i];
+    if (arg == "--replay")
+      replaying = true;
+    else if (arg == "-r" && i + 1 < argc)
+      repeats = std::max(1, std::atoi(argv[++i]));
+    else if (arg == "-o" && i + 1 < argc)
+      jsonFile = argv[++i];
+    else if (arg == "-h" || arg == "--help")
+    {
+      std::cerr << "usage: wfmash-bench [FASTA] [-r REPEATS] [-o JSON]" << std::endl
+                << "       wfmash-bench --replay BUNDLE|DIR... [-r REPEATS] [-o JSON]" << std::endl;
+      return 0;
+    }
+    else
+    {
+      fasta = arg;
+      bundles.push_back(arg);
+    }
+  }
+
+  if (replaying)
+  {
+    //the bundles of each directory, in name order
+    std::vector<std::string> files;
+    for (const auto& bundle : bundles)
+    {
+      DIR* dir = opendir(bundle.c_str());
+      if (dir == nullptr)
+      {
+        files.push_back(bundle);
+        continue;
+      }
+      std::vector<std::string> names;
+      while (dirent* entry = readdir(dir))
+      {
+        const std::string name = entry->d_name;
+        if (name.size() > 7 && name.compare(name.size() - 7, 7, ".replay") == 0)
+          names.push_back(bundle + "/" + name);
+      }
+      closedir(dir);
+      std::sort(names.begin(), names.end());
+      files.insert(files.end(), names.begin(), names.end());
+    }
+    if (files.empty())
+    {
+      std::cerr << "[wfmash-bench] ERROR, --replay needs the bundles of wfmash --capture-slow, or their directory" << std::endl;
+      return 1;
+    }
+    std::vector<Result> results;
+    for (const auto& file : files)
+      results.push_back(replay(file, repeats));
+    return writeResults(jsonFile, "replay", repeats, results);
+  }
+
+  //The parameters of a default run on fasta, on one thread
+  std::vector<std::string> argStrings = {"wfmash", fasta, "-t", "1"};
+  std::vector<char*> args;
+  for (auto& arg : argStrings)
+    args.push_back(&arg[0]);
+  args.push_back(nullptr);
+  skch::Parameters mapParams;
+  align::Parameters alignParams;
+  yeet::Parameters yeetParams;
+  yeet::parse_args(argStrings.size(), args.data(), mapParams, alignParams, yeetParams);
+  mapParams.outFileName = "/dev/null";
+  mapParams.binary_output = false;
+  mapParams.bgzf_output = false;
+  mapParams.output_shards = 0;
+
+  std::vector<std::string> names;
+  std::vector<std::string> seqs;
+  seqiter::for_each_seq_in_file(fasta, {}, "", [&](const std::string& name, const std::string& seq) {
+      names.push_back(name);
+      seqs.push_back(seq);
+    });
+  if (seqs.size() < 2)
+  {
+    std::cerr << "[wfmash-bench] ERROR, " << fasta << " needs at least two sequences" << std::endl;
+    return 1;
+  }
+  for (auto& seq : seqs)
+    skch::CommonFunc::makeUpperCaseAndValidDNA(&seq[0], seq.size());
+  uint64_t totalBases = 0;
+  for (const auto& seq : seqs)
+    totalBases += seq.size();
+
+  skch::Sketch sketch(mapParams);
+  //Built with no queries, for the benchmarks to run its kernels
+  skch::Map map(mapParams, sketch, nullptr, nullptr, nullptr,
+                [](const std::function<void(const std::string&, std::string&&)>&) {});
+  skch::MapBench bench(map);
+
+  std::vector<Result> results;
+
+  //Sketching the whole sequences
+  {
+    std::vector<std::string> copies;
+    std::vector<skch::MinmerInfo> minmers;
+    results.push_back(measure("sketch_sequence", repeats, totalBases,
+        [&]() { copies = seqs; },
+        [&]() {
+          for (size_t s = 0; s < copies.size(); ++s)
+          {
+            minmers.clear();
+            skch::CommonFunc::sketchSequence(minmers, &copies[s][0], copies[s].size(), mapParams.kmerSize,
+                mapParams.alphabetSize, mapParams.sketchSize, s, mapParams.rolling_hash,
+                sketch.spacedSeeds(), sketch.syncmerSize());
+          }
+        }));
+  }
+
+  //The fragments of each query, as the split mapping makes them
+  typedef skch::MapBench::Query Query;
+  std::vector<std::pair<size_t, skch::offset_t>> fragments;
+  for (size_t s = 0; s < seqs.size(); ++s)
+    for (skch::offset_t start = 0; start + mapParams.segLength <= (skch::offset_t)seqs[s].size(); start += mapParams.segLength)
+      fragments.emplace_back(s, start);
+  const uint64_t fragmentBases = fragments.size() * (uint64_t)mapParams.segLength;
+
+  //Seed lookups and the merge of their interval points (L1)
+  {
+    std::vector<Query> queries;
+    std::vector<std::vector<skch::IntervalPoint>> intervalPoints(fragments.size());
+    results.push_back(measure("map_get_seed_interval_points", repeats, fragmentBases,
+        [&]() {
+          queries.clear();
+          for (size_t f = 0; f < fragments.size(); ++f)
+          {
+            queries.push_back(bench.fragment(seqs[fragments[f].first], fragments[f].second, fragments[f].first,
+                                             names[fragments[f].first]));
+            bench.seedHits(queries.back());
+            intervalPoints[f].clear();
+          }
+        },
+        [&]() {
+          for (size_t f = 0; f < queries.size(); ++f)
+            bench.seedIntervalPoints(queries[f], intervalPoints[f]);
+        }));
+  }
+
+  //The sliding windows of the L2 stage over the L1 candidate regions
+  std::vector<skch::MappingResultsVector_t> queryMappings(seqs.size());
+  {
+    std::vector<Query> queries;
+    std::vector<std::vector<skch::Map::L1_candidateLocus_t>> l1Mappings(fragments.size());
+    std::vector<skch::MappingResultsVector_t> l2Mappings(fragments.size());
+    results.push_back(measure("map_slide_mapper_l2", repeats, fragmentBases,
+        [&]() {
+          queries.clear();
+          std::vector<skch::IntervalPoint> intervalPoints;
+          for (size_t f = 0; f < fragments.size(); ++f)
+          {
+            queries.push_back(bench.fragment(seqs[fragments[f].first], fragments[f].second, fragments[f].first,
+                                             names[fragments[f].first]));
+            intervalPoints.clear();
+            l1Mappings[f].clear();
+            l2Mappings[f].clear();
+            bench.l1Mapping(queries.back(), intervalPoints, l1Mappings[f]);
+          }
+        },
+        [&]() {
+          for (size_t f = 0; f < queries.size(); ++f)
+            if (!l1Mappings[f].empty())
+              bench.l2Mapping(queries[f], l1Mappings[f], l2Mappings[f]);
+        }));
+
+    //The mappings of the fragments of each query, as mapQueryFragments reports them
+    for (size_t f = 0; f < fragments.size(); ++f)
+    {
+      const size_t s = fragments[f].first;
+      for (auto& e : l2Mappings[f])
+      {
+        e.queryLen = seqs[s].size();
+        e.queryStartPos = fragments[f].second;
+        e.queryEndPos = fragments[f].second + mapParams.segLength;
+        queryMappings[s].push_back(e);
+      }
+    }
+  }
+
+  //Chaining the mappings of the fragments of each query
+  std::vector<skch::MappingResultsVector_t> merged;
+  results.push_back(measure("map_merge_mappings_in_range", repeats, fragmentBases,
+      [&]() { merged = queryMappings; },
+      [&]() {
+        for (auto& mappings : merged)
+          bench.mergeMappingsInRange(mappings);
+      }));
+  for (auto& mappings : merged)
+    bench.finishMerge(mappings);
+
+  //Filtering the chains of each query along it
+  {
+    std::vector<skch::MappingResultsVector_t> filtered;
+    results.push_back(measure("filter_query_filter_mappings", repeats, fragmentBases,
+        [&]() { filtered = merged; },
+        [&]() {
+          for (auto& mappings : filtered)
+            bench.filterQuery(mappings);
+        }));
+  }
+
+  //The best chain between two different sequences, aligned below
+  skch::MappingResult best;
+  best.blockLength = 0;
+  for (size_t s = 0; s < merged.size(); ++s)
+    for (const auto& e : merged[s])
+      if (sketch.metadata[e.refSeqId].name != names[s] && e.blockLength > best.blockLength)
+      {
+        best = e;
+        best.querySeqId = s;
+      }
+  if (best.blockLength == 0)
+  {
+    std::cerr << "[wfmash-bench] ERROR, no mapping between two sequences of " << fasta << std::endl;
+    return 1;
+  }
+  //Capped, for the alignment benchmarks to take seconds, not minutes
+  const skch::offset_t alignLength = std::min<skch::offset_t>(50000, std::min(best.queryEndPos - best.queryStartPos,
+                                                                   best.refEndPos - best.refStartPos));
+  std::string query = seqs[best.querySeqId].substr(best.queryStartPos, alignLength);
+  size_t targetIndex = 0;
+  while (names[targetIndex] != std::string(sketch.metadata[best.refSeqId].name))
+    ++targetIndex;
+  if (best.strand != skch::strnd::FWD)
+  {
+    const std::string forward = query;
+    skch::CommonFunc::reverseComplement(forward.data(), &query[0], query.size());
+  }
+  //The target with the padding the aligner fetches around it
+  const uint64_t headPadding = std::min<uint64_t>(best.refStartPos, alignParams.wflign_max_len_minor);
+  const uint64_t tailPadding = std::min<uint64_t>(seqs[targetIndex].size() - best.refStartPos - alignLength,
+                                                  alignParams.wflign_max_len_minor);
+  std::string targetWindow = seqs[targetIndex].substr(best.refStartPos - headPadding, headPadding + alignLength + tailPadding);
+  const std::string target = targetWindow.substr(headPadding, alignLength);
+
+  //Mash distances of the segments of the wflambda layer
+  {
+    const uint64_t segment = alignParams.wflambda_segment_length;
+    const uint64_t k = 17;
+    std::vector<std::vector<rkmh::hash_t>> querySketches, targetSketches;
+    for (uint64_t start = 0; start + segment <= query.size(); start += segment)
+    {
+      querySketches.push_back(rkmh::hash_sequence(query.data() + start, segment, k, segment / 10));
+      targetSketches.push_back(rkmh::hash_sequence(target.data() + start, segment, k, segment / 10));
+    }
+    float sum = 0;
+    results.push_back(measure("rkmh_compare", repeats, querySketches.size() * segment,
+        []() {},
+        [&]() {
+          //each segment against its neighbours on the target, as wflambda does
+          for (size_t i = 0; i < querySketches.size(); ++i)
+            for (size_t j = i > 0 ? i - 1 : 0; j < std::min(targetSketches.size(), i + 2); ++j)
+              sum += rkmh::compare(querySketches[i], targetSketches[j], k);
+        }));
+    if (sum < 0)
+      std::cerr << sum << std::endl;
+  }
+
+  //WFlign on the pair, with the score only, then with the PAF record and its CIGAR that
+  //write_merged_alignment makes of the alignments of the segments
+  for (const bool scoreOnly : {true, false})
+  {
+    std::ostringstream out;
+    wflign::wavefront::WFlignAligners aligners;
+    results.push_back(measure(scoreOnly ? "wflign_affine_wavefront" : "wflign_affine_wavefront_write_merged_alignment",
+        repeats, query.size(),
+        [&]() { out.str(""); },
+        [&]() {
+          wflign::wavefront::WFlign wflign(
+              alignParams.wflambda_segment_length,
+              alignParams.min_identity,
+              alignParams.force_biwfa_alignment,
+              alignParams.wfa_mismatch_score,
+              alignParams.wfa_gap_opening_score,
+              alignParams.wfa_gap_extension_score,
+              alignParams.wfa_patching_mismatch_score,
+              alignParams.wfa_patching_gap_opening_score1,
+              alignParams.wfa_patching_gap_extension_score1,
+              alignParams.wfa_patching_gap_opening_score2,
+              alignParams.wfa_patching_gap_extension_score2,
+              best.nucIdentity,
+              alignParams.wflign_mismatch_score,
+              alignParams.wflign_gap_opening_score,
+              alignParams.wflign_gap_extension_score,
+              alignParams.wflign_max_mash_dist,
+              alignParams.wflign_min_wavefront_length,
+              alignParams.wflign_max_distance_threshold,
+              alignParams.wflign_max_len_major,
+              alignParams.wflign_max_len_minor,
+              alignParams.wflign_erode_k,
+              alignParams.chain_gap,
+              alignParams.wflign_min_inv_patch_len,
+              alignParams.wflign_max_patching_score);
+          wflign.set_aligners(&aligners);
+          wflign.set_output(
+              &out,
+              false, nullptr, "", 0, false, nullptr,
+              true, false, true, false);
+          wflign.set_score_only(scoreOnly);
+          wflign.wflign_affine_wavefront(
+              names[best.querySeqId], &query[0], seqs[best.querySeqId].size(), best.queryStartPos, query.size(),
+              best.strand != skch::strnd::FWD,
+              names[targetIndex], &targetWindow[headPadding], seqs[targetIndex].size(), best.refStartPos, alignLength);
+        }));
+  }
+
+  return writeResults(jsonFile, fasta, repeats, results);
+}
@@ -12,6 +12,10 @@
 #include <iostream>
 #include <bitset>
 #include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "common/task_executor.hpp"
 #if defined(__APPLE__)
   #include <sys/types.h>
   #include <sys/sysctl.h>
@@ -24,20 +28,28 @@
 // using namespace std;
 
 namespace ales {
-  int* l;								// Seeds lengths
-  int k;                // Number of seeds
-  int N;								// Length of the random region R
-  double p;							// Similarity level
-  int w;								// Weight
-  bool mode;							// mode decides if sensitivity (0) or estimated sensitivity (1) will be used.
-  bool bestMode = 0;					// variable used to control print statement
-  int estCount = 0;					// variable used to control print statement
-  double optimized_best = 0.0;		// holds the best sensitivity obtained in the function findOptimal()
-  int original_m = 0;					// resets the m value in adaptive length algorithm
-  int original_M = 0;					// resets the M value in adaptive length algorithm
+  // the state of a search is kept by its thread, so that searches can run side by side
+  thread_local int* l;								// Seeds lengths
+  thread_local int k;                // Number of seeds
+  thread_local int N;								// Length of the random region R
+  thread_local double p;							// Similarity level
+  thread_local int w;								// Weight
+  thread_local bool mode;							// mode decides if sensitivity (0) or estimated sensitivity (1) will be used.
+  thread_local bool bestMode = 0;					// variable used to control print statement
+  thread_local int estCount = 0;					// variable used to control print statement
+  thread_local double optimized_best = 0.0;		// holds the best sensitivity obtained in the function findOptimal()
+  thread_local int original_m = 0;					// resets the m value in adaptive length algorithm
+  thread_local int original_M = 0;					// resets the M value in adaptive length algorithm
   bool isRegionCreated = false;		// makes sure homologous_array is created only once
+  std::mutex regionMutex;             // guards the creation of homologous_array, shared by the searches
   uint32_t iterations = 1;
-  double sens = 0.0;
+  int searches_at_once = 1;           // searches running side by side, which share the memory of the system
+  thread_local double sens = 0.0;
+  thread_local std::mt19937 generator;  // random seeds of a search, seeded by its restart for results that repeat
+
+  inline int random_int() {
+    return (int)(generator() >> 1);
+  }
 
   /*
    * Precomputed arrays:
@@ -296,8 +308,8 @@ namespace ales {
   uint128_t *homologous_array_128;			// can store upto 128 bit long random region
   uint64_t *homologous_array_64;				// can store upto 64 bit long random region
   uint32_t *homologous_array_32;				// can store upto 32 bit long random region
-  long double totalVirtualMem = 0.0;			// total memory of system - decides when to switch to estimated sensitivity
-  int homologous_array_size = 0;				// size of the homologous array to be created if necessary
+  thread_local long double totalVirtualMem = 0.0;			// total memory of system - decides when to switch to estimated sensitivity
+  thread_local int homologous_array_size = 0;				// size of the homologous array to be created if necessary
 
   // prints an array (used for printing seeds)
   void printArray2(char** array, int length)
@@ -512,11 +524,12 @@ namespace ales {
   // used to estimate the sensitivity
   void makeHomologousRegion(double p, int N){
 
+    std::lock_guard<std::mutex> lock(regionMutex);
     if(isRegionCreated)
       return;
+    isRegionCreated = true;
 
-    std::random_device rd{}; // use to seed the rng
-    std::mt19937 rng{rd()}; // rng
+    std::mt19937 rng(N); // rng, seeded the same every run
     std::bernoulli_distribution distribution(p);
 
     // std::cerr<<std::endl<<"Seeds found for which Real Sensitivity cannot be computed because of Insufficient Memory"<<std::endl;
@@ -724,7 +737,6 @@ namespace ales {
 
       if(((totalRam * 0.9) < arraySize) || ((totalRam * 0.9) < (arraySize * floor(totalRam)))){		// try to filter using less expensive operations
         makeHomologousRegion(P, N);
-        isRegionCreated = true;
         MAX_NO_BS = NO_BS = 0;
         delete[] seed_length; delete[] INT_REV_SEEDS;
         return ESTIMATE_SENSITIVITY(SEEDS, NO_SEEDS, N);
@@ -1008,8 +1020,8 @@ namespace ales {
       count++;
       if(count == 20)
         return -1;
-      seed_no = std::rand()%NO_SEEDS;
-      pos = std::rand()%(l[seed_no]);
+      seed_no = random_int()%NO_SEEDS;
+      pos = random_int()%(l[seed_no]);
       if(pos != 0 && pos != l[seed_no] - 1 && l[seed_no] < N)
         flag = false;
     }
@@ -1038,8 +1050,8 @@ namespace ales {
     while(flag){
       if(count == 20)
         return -1;
-      seed_no = std::rand()%NO_SEEDS;
-      pos = std::rand()%(l[seed_no]);
+      seed_no = random_int()%NO_SEEDS;
+      pos = random_int()%(l[seed_no]);
       if(S[seed_no][pos] == '0')
         if(pos != 0 && pos != l[seed_no] - 1){
           flag = false;
@@ -1085,7 +1097,7 @@ namespace ales {
 
     for(int i = 1; i <= trial; i++){
       mode = 0;
-      int  choice = std::rand()%2;
+      int  choice = random_int()%2;
       // copy values from SEED to tSEED
       if(i == 1){
         for(int j = 0; j < NO_SEEDS; j++){
@@ -1212,7 +1224,7 @@ namespace ales {
       badMove++;
       if(nSeeds == 1){
         for(i = 0;i < nSeeds;i++)
-          length[i] = rand()%(M-m+1) + m;
+          length[i] = random_int()%(M-m+1) + m;
       }
       // adaptive seed lengths - use the mean of the seed lengths obtained after indel optimization.
       // adapth the seed length after every 50 iterations.
@@ -1253,7 +1265,7 @@ namespace ales {
         seeds[i][length[i]-1] = '1';
         seeds[i][length[i]] = '\0';
         for (j=2; j<weight; j++) {
-          pos = rand()%(length[i]-j) + 1;
+          pos = random_int()%(length[i]-j) + 1;
           j1=0;
           while (pos>0) {
             if (seeds[i][j1] == '0')
@@ -1325,7 +1337,6 @@ namespace ales {
   // This set is called ALeS-initial seed. Then the program tries to improve the seeds by computing random seeds and applying OC on them.
   void ALeS(char** S){
 
-    srand((unsigned )(time(0)));
     double t[2];
     // calculating the total memory available in the system to prevent the code from crashing while computing sensitivity.
     // total virtual memory of the system is total memory available - (1.5 time the size of homologous array)
@@ -1351,6 +1362,7 @@ namespace ales {
     totalVirtualMem = memSize;
     totalVirtualMem-= 1.5 * homologous_array_size;
 #endif
+    totalVirtualMem /= searches_at_once;
 
     t[0] = clock()/ 1000000.0;
     int m = 0;// min
@@ -1477,20 +1489,38 @@ namespace ales {
     }
   }
 
-  spaced_seeds generate_spaced_seeds(int weight, int number_of_seeds, float similarity, int region_length) {
-    // set parameters
-    w=weight; k=number_of_seeds; p=similarity; N=region_length;
+  // restarts of the search, the seeds of the most sensitive one are kept; their count is fixed and
+  // each is seeded by its number, so that the seeds found don't depend on the thread count
+  const int searches = 8;
 
-    char** raw_spaced_seeds = ales_wrapper();
-    std::vector<spaced_seed> sp;
+  spaced_seeds generate_spaced_seeds(int weight, int number_of_seeds, float similarity, int region_length, int threads = 1) {
+    std::vector<spaced_seeds> found(searches);
+    searches_at_once = std::max(1, std::min(threads, searches));
+    {
+      tasks::TaskGroup group(tasks::sharedExecutor(threads));
+      for (int search = 0; search < searches; ++search) {
+        group.run([&found, search, weight, number_of_seeds, similarity, region_length]() {
+          // set parameters
+          w=weight; k=number_of_seeds; p=similarity; N=region_length;
+          bestMode = 0; estCount = 0; optimized_best = 0.0; sens = 0.0;
+          generator.seed(search);
 
-    for (uint32_t i=0; i<number_of_seeds; i++) {
-      char* s = raw_spaced_seeds[i];
-      sp.push_back(spaced_seed{s, strlen(s)});
+          char** raw_spaced_seeds = ales_wrapper();
+          for (int i=0; i<number_of_seeds; i++) {
+            char* s = raw_spaced_seeds[i];
+            found[search].seeds.push_back(spaced_seed{s, strlen(s)});
+          }
+          found[search].sensitivity = sens;
+        });
+      }
     }
 
-    spaced_seeds k = spaced_seeds{sp, sens};
-    return k;
+    size_t best = 0;
+    for (size_t i = 1; i < found.size(); i++) {
+      if (found[i].sensitivity > found[best].sensitivity)
+        best = i;
+    }
+    return found[best];
   }
 }
 #endif
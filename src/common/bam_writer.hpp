@@ -0,0 +1,155 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <htslib/hts.h>
+#include <htslib/sam.h>
+
+/**
+ * BAM/CRAM output of SAM records
+ *
+ * The threads formatting records as SAM text turn them into BAM records
+ * themselves, packed into their output buffers, so that the writing thread
+ * only copies them out and hands them to htslib, which compresses them on
+ * threads of its own. CRAM records are encoded against the reference given.
+ */
+
+namespace output {
+
+class BamWriter {
+public:
+
+    BamWriter() = default;
+
+    BamWriter(const BamWriter&) = delete;
+    BamWriter& operator=(const BamWriter&) = delete;
+
+    ~BamWriter() {
+        close();
+    }
+
+    /**
+     * Write BAM to path, or CRAM against the indexed FASTA reference if cram,
+     * with `threads` compression threads. False if the file could not be opened
+     */
+    bool open(const std::string& path, bool cram, const std::string& reference, int threads = 1) {
+        close();
+        file = sam_open(path.c_str(), cram ? "wc" : "wb");
+        if (file == nullptr) {
+            return false;
+        }
+        if (cram && hts_set_fai_filename(file, reference.c_str()) != 0) {
+            close();
+            failed = false;
+            return false;
+        }
+        if (threads > 1) {
+            hts_set_threads(file, threads);
+        }
+        return true;
+    }
+
+    /**
+     * Write the header given as SAM text, false if it could not be parsed or written
+     */
+    bool writeHeader(const std::string& text) {
+        header = sam_hdr_parse(text.size(), text.c_str());
+        if (header == nullptr) {
+            return false;
+        }
+        // the reference names are looked up once here, read only by the formatting threads
+        sam_hdr_name2tid(header, "");
+        failed |= sam_hdr_write(file, header) < 0;
+        return !failed;
+    }
+
+    /**
+     * The SAM text records of sam packed as BAM records into packed, false if one of
+     * them could not be parsed. Safe to call from several threads once the header is written
+     */
+    bool pack(const std::string& sam, std::string& packed) const {
+        bam1_t* record = bam_init1();
+        kstring_t line = KS_INITIALIZE;
+        bool ok = true;
+        for (size_t begin = 0; ok && begin < sam.size();) {
+            size_t end = sam.find('\n', begin);
+            if (end == std::string::npos) {
+                end = sam.size();
+            }
+            line.l = 0;
+            kputsn(sam.data() + begin, end - begin, &line);
+            begin = end + 1;
+            if (line.l == 0) {
+                continue;
+            }
+            ok = sam_parse1(&line, header, record) >= 0;
+            if (ok) {
+                const uint32_t l_data = record->l_data;
+                packed.append(reinterpret_cast<const char*>(&record->core), sizeof(bam1_core_t));
+                packed.append(reinterpret_cast<const char*>(&l_data), sizeof(l_data));
+                packed.append(reinterpret_cast<const char*>(record->data), l_data);
+            }
+        }
+        ks_free(&line);
+        bam_destroy1(record);
+        return ok;
+    }
+
+    /**
+     * Write the records packed by pack
+     */
+    void write(const std::string& packed) {
+        if (record == nullptr) {
+            record = bam_init1();
+        }
+        for (size_t at = 0; !failed && at < packed.size();) {
+            uint32_t l_data;
+            std::memcpy(&record->core, packed.data() + at, sizeof(bam1_core_t));
+            at += sizeof(bam1_core_t);
+            std::memcpy(&l_data, packed.data() + at, sizeof(l_data));
+            at += sizeof(l_data);
+            if (record->m_data < l_data) {
+                uint8_t* data = static_cast<uint8_t*>(realloc(record->data, l_data));
+                if (data == nullptr) {
+                    failed = true;
+                    break;
+                }
+                record->data = data;
+                record->m_data = l_data;
+            }
+            std::memcpy(record->data, packed.data() + at, l_data);
+            record->l_data = l_data;
+            at += l_data;
+            failed |= sam_write1(file, header, record) < 0;
+        }
+    }
+
+    /**
+     * Flush and close the file, false if any write failed
+     */
+    bool close() {
+        if (file != nullptr) {
+            failed |= sam_close(file) < 0;
+            file = nullptr;
+        }
+        if (header != nullptr) {
+            sam_hdr_destroy(header);
+            header = nullptr;
+        }
+        if (record != nullptr) {
+            bam_destroy1(record);
+            record = nullptr;
+        }
+        return !failed;
+    }
+
+private:
+
+    samFile* file = nullptr;
+    sam_hdr_t* header = nullptr;
+    bam1_t* record = nullptr;
+    bool failed = false;
+};
+
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+/**
+ * Blocked Bloom filter over 64-bit keys
+ *
+ * Each key sets a few bits of a single 64-bit word, so that a query costs
+ * one memory access, as in
+ *
+ * "Cache-, hash- and space-efficient bloom filters"
+ * by Felix Putze, Peter Sanders and Johannes Singler
+ *
+ * With 16 bits per key and 4 bits per key the false positive rate is
+ * around 0.3%, and a negative answer is always right.
+ */
+
+namespace bloom {
+
+class BlockedBloomFilter {
+public:
+
+    BlockedBloomFilter() = default;
+
+    /**
+     * Size the filter for n keys, dropping the ones it held
+     */
+    void reset(uint64_t n) {
+        words.assign(n == 0 ? 0 : roundUpToPowerOfTwo((n * bitsPerKey + 63) / 64), 0);
+    }
+
+    void insert(uint64_t key) {
+        const uint64_t h = mix(key);
+        words[h & (words.size() - 1)] |= pattern(h);
+    }
+
+    // bytes held by the filter
+    uint64_t bytes() const {
+        return words.capacity() * sizeof(uint64_t);
+    }
+
+    /**
+     * False if the key was never inserted, true if it likely was
+     */
+    bool mayContain(uint64_t key) const {
+        if (words.empty()) {
+            return false;
+        }
+        const uint64_t h = mix(key);
+        const uint64_t p = pattern(h);
+        return (words[h & (words.size() - 1)] & p) == p;
+    }
+
+private:
+
+    static constexpr uint64_t bitsPerKey = 16;
+
+    std::vector<uint64_t> words;
+
+    // murmur3 fmix64, keys may be hashes already but of the same low bits
+    static uint64_t mix(uint64_t h) {
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ULL;
+        h ^= h >> 33;
+        return h;
+    }
+
+    // 4 bits of the word, from the high bits of the hash
+    static uint64_t pattern(uint64_t h) {
+        return (uint64_t(1) << ((h >> 40) & 63)) | (uint64_t(1) << ((h >> 46) & 63))
+            | (uint64_t(1) << ((h >> 52) & 63)) | (uint64_t(1) << ((h >> 58) & 63));
+    }
+
+    static uint64_t roundUpToPowerOfTwo(uint64_t n) {
+        uint64_t p = 1;
+        while (p < n) {
+            p <<= 1;
+        }
+        return p;
+    }
+};
+
+}
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * Counts of the work done in the hot paths of mapping and alignment, written
+ * as TSV with --stats: they tell which stage to tune for a dataset.
+ *
+ * They are always on: each thread adds to a block of its own with relaxed
+ * stores, which costs about as much as a plain increment, and the blocks are
+ * summed once the process exits. Blocks are never freed, so that the counts
+ * of the threads that ended are kept.
+ */
+namespace hot_counters {
+
+enum Counter : int {
+    seeds_looked_up,
+    seeds_skipped_frequent,
+    interval_points,
+    l1_candidates,
+    l2_windows_scanned,
+    mappings_l2,
+    mappings_merged,
+    mappings_weak_filtered,
+    mappings_group_filtered,
+    mappings_reported,
+    wflambda_cells_evaluated,
+    wflambda_cells_aligned,
+    patches_small,
+    patches_medium,
+    patches_large,
+    inversion_attempts,
+    patches_bounded_out,
+    faidx_bytes,
+    padding_bytes,
+    num_counters
+};
+
+/**
+ * Class of a patch by its longest side: up to 128 bp, up to 1 kbp, or longer
+ */
+inline Counter patch_size_class(uint64_t length) {
+    return length <= 128 ? patches_small : length <= 1024 ? patches_medium : patches_large;
+}
+
+inline const char* name(Counter counter) {
+    static const char* const names[num_counters] = {
+        "seeds_looked_up",
+        "seeds_skipped_frequent",
+        "interval_points",
+        "l1_candidates",
+        "l2_windows_scanned",
+        "mappings_l2",
+        "mappings_merged",
+        "mappings_weak_filtered",
+        "mappings_group_filtered",
+        "mappings_reported",
+        "wflambda_cells_evaluated",
+        "wflambda_cells_aligned",
+        "patches_small",
+        "patches_medium",
+        "patches_large",
+        "inversion_attempts",
+        "patches_bounded_out",
+        "faidx_bytes",
+        "padding_bytes",
+    };
+    return names[counter];
+}
+
+struct Block {
+    std::atomic<uint64_t> values[num_counters] = {};
+};
+
+class Registry {
+public:
+
+    Block* make_block() {
+        std::lock_guard<std::mutex> lock(mutex);
+        blocks.push_back(new Block());
+        return blocks.back();
+    }
+
+    uint64_t total(Counter counter) const {
+        std::lock_guard<std::mutex> lock(mutex);
+        uint64_t sum = 0;
+        for (const Block* block : blocks) {
+            sum += block->values[counter].load(std::memory_order_relaxed);
+        }
+        return sum;
+    }
+
+    /**
+     * Writes the counts to path, once the process exits
+     */
+    void open(const std::string& file) {
+        path = file;
+        std::atexit([]() { get().write(); });
+    }
+
+    void write() const {
+        if (path.empty()) {
+            return;
+        }
+        std::ofstream out(path);
+        out << "counter\tvalue\n";
+        for (int c = 0; c < num_counters; ++c) {
+            out << name(Counter(c)) << "\t" << total(Counter(c)) << "\n";
+        }
+        if (!out) {
+            std::fprintf(stderr, "[wfmash] WARNING, failed to write the stats %s\n", path.c_str());
+        }
+    }
+
+    static Registry& get() {
+        static Registry registry;
+        return registry;
+    }
+
+private:
+
+    std::string path;
+    mutable std::mutex mutex;
+    std::vector<Block*> blocks;
+};
+
+inline Block& local() {
+    thread_local Block* block = Registry::get().make_block();
+    return *block;
+}
+
+inline void add(Counter counter, uint64_t n = 1) {
+    std::atomic<uint64_t>& value = local().values[counter];
+    value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+}
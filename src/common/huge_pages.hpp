@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/**
+ * Transparent huge page backing of large, randomly accessed arrays
+ *
+ * Seed lookups touch pages all over an index far larger than what the TLB
+ * covers with 4 KiB pages. Marked with MADV_HUGEPAGE, a range is backed by
+ * huge pages as it is faulted in, and khugepaged collapses the pages already
+ * there, so that one TLB entry maps 2 MiB. Best effort: the kernel may have
+ * transparent huge pages disabled, or not support them for file mappings.
+ */
+
+namespace huge_pages {
+
+/**
+ * Ask for huge pages over the whole pages of [addr, addr + bytes), false if
+ * the kernel refused
+ */
+inline bool advise(const void* addr, size_t bytes) {
+#ifdef MADV_HUGEPAGE
+    if (addr == nullptr || bytes == 0) {
+        return false;
+    }
+    const uintptr_t page = sysconf(_SC_PAGESIZE);
+    const uintptr_t begin = reinterpret_cast<uintptr_t>(addr) / page * page;
+    const uintptr_t end = reinterpret_cast<uintptr_t>(addr) + bytes;
+    return madvise(reinterpret_cast<void*>(begin), end - begin, MADV_HUGEPAGE) == 0;
+#else
+    (void)addr;
+    (void)bytes;
+    return false;
+#endif
+}
+
+template <typename T>
+inline bool advise(const std::vector<T>& v) {
+    return advise(v.data(), v.size() * sizeof(T));
+}
+
+}
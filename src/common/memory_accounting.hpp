@@ -0,0 +1,132 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+/**
+ * Memory held by each subsystem, with its peak over the run, for setting the
+ * memory budgets of jobs: the structures of the index, the queries and
+ * mappings of the mapping stage in flight and those collected for filtering,
+ * the sequences of the records being aligned, the alignments held for their
+ * turn in the output and the wavefronts kept by the WFA aligners of each
+ * thread. The sizes are estimates of the bytes reserved by each structure,
+ * counted where it grows and shrinks, not allocator statistics; they are
+ * reported at exit and in the --metrics
+ */
+namespace memory_accounting {
+
+enum Pool {
+    index_minmers,          // minmer windows of the targets, with those of the frequent seeds
+    index_lookup,           // seed lookup index, hashed or frozen
+    index_mapped,           // index file mapped read-only, backed by the page cache
+    index_frequent_seeds,   // frequent seeds and their filter
+    index_directory,        // per-sequence offsets and position directory of the minmers
+    index_names,            // target names and lengths
+    map_queries,            // queries of the batches being mapped
+    map_mappings,           // mappings of the batches mapped, until written or collected
+    map_collected,          // mappings collected for filtering at the end (one-to-one, sharded index)
+    align_records,          // sequences fetched for the records being aligned
+    align_reorder,          // alignments held for their turn in the output
+    wfa_aligners,           // wavefronts and backtrace buffers kept by the WFA aligners of the threads
+    num_pools
+};
+
+inline const char* name(Pool pool) {
+    static const char* const names[num_pools] = {
+        "index.minmers", "index.lookup", "index.mapped", "index.frequent_seeds", "index.directory", "index.names",
+        "map.queries", "map.mappings", "map.collected",
+        "align.records", "align.reorder", "align.wfa_aligners"};
+    return names[pool];
+}
+
+class Registry {
+public:
+
+    void add(Pool pool, int64_t bytes) {
+        const int64_t now = current[pool].fetch_add(bytes, std::memory_order_relaxed) + bytes;
+        raise_peak(pool, now);
+    }
+
+    void set(Pool pool, int64_t bytes) {
+        current[pool].store(bytes, std::memory_order_relaxed);
+        raise_peak(pool, bytes);
+    }
+
+    int64_t bytes(Pool pool) const {
+        return current[pool].load(std::memory_order_relaxed);
+    }
+
+    int64_t peak_bytes(Pool pool) const {
+        return peak[pool].load(std::memory_order_relaxed);
+    }
+
+    /**
+     * The peak of each pool that held memory, as a line of the log
+     */
+    void log() const {
+        std::string line;
+        char field[96];
+        for (int p = 0; p < num_pools; ++p) {
+            if (peak_bytes(Pool(p)) > 0) {
+                std::snprintf(field, sizeof(field), "%s %s=%.1f", line.empty() ? "" : ",", name(Pool(p)),
+                              peak_bytes(Pool(p)) / (1024.0 * 1024.0));
+                line += field;
+            }
+        }
+        if (!line.empty()) {
+            std::fprintf(stderr, "[wfmash] peak memory by subsystem, in MB:%s\n", line.c_str());
+        }
+    }
+
+    static Registry& get() {
+        static Registry registry;
+        return registry;
+    }
+
+private:
+
+    std::atomic<int64_t> current[num_pools] = {};
+    std::atomic<int64_t> peak[num_pools] = {};
+
+    void raise_peak(Pool pool, int64_t bytes) {
+        int64_t seen = peak[pool].load(std::memory_order_relaxed);
+        while (bytes > seen && !peak[pool].compare_exchange_weak(seen, bytes, std::memory_order_relaxed)) {
+        }
+    }
+};
+
+inline void add(Pool pool, int64_t bytes) {
+    Registry::get().add(pool, bytes);
+}
+
+inline void set(Pool pool, int64_t bytes) {
+    Registry::get().set(pool, bytes);
+}
+
+/**
+ * The share of a pool of what a thread keeps, such as its aligners: set to
+ * the bytes the thread now holds, and given back when the thread exits
+ */
+class ThreadShare {
+public:
+
+    explicit ThreadShare(Pool pool) : pool(pool) {}
+
+    ~ThreadShare() {
+        add(pool, -held);
+    }
+
+    void set(int64_t bytes) {
+        add(pool, bytes - held);
+        held = bytes;
+    }
+
+private:
+
+    Pool pool;
+    int64_t held = 0;
+};
+
+}
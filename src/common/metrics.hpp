@@ -0,0 +1,191 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+
+#include "common/hot_counters.hpp"
+#include "common/memory_accounting.hpp"
+#include "common/progress.hpp"
+#include "common/run_report.hpp"
+#include "common/task_executor.hpp"
+
+/**
+ * Live metrics of a run in the Prometheus text format, written with --metrics
+ * every few seconds to a file, for the textfile collector of node_exporter:
+ * the progress, throughput and queue depth of each stage running, the busy
+ * workers of the executors, the memory and CPU time of the process, and the
+ * counts of the hot paths. The file is replaced through a rename, so that it
+ * is never read half written; a stalled run shows as a throughput of 0 with
+ * an uptime still going up.
+ */
+namespace metrics {
+
+class Exporter {
+public:
+
+    /**
+     * Writes the metrics to path every interval seconds, and once the process exits
+     */
+    void open(const std::string& file, double interval_seconds) {
+        path = file;
+        interval = std::chrono::milliseconds((int64_t)(interval_seconds * 1000));
+        writer = std::thread([this]() {
+            std::unique_lock<std::mutex> lock(mutex);
+            while (!stopping) {
+                write();
+                stop_signal.wait_for(lock, interval, [this]() { return stopping; });
+            }
+        });
+        std::atexit([]() { get().stop(); });
+    }
+
+    static Exporter& get() {
+        static Exporter exporter;
+        return exporter;
+    }
+
+private:
+
+    std::string path;
+    std::chrono::milliseconds interval{0};
+    std::thread writer;
+    std::mutex mutex;
+    std::condition_variable stop_signal;
+    bool stopping = false;
+    const std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+    // bases done by stage at the last write, for the throughput since
+    std::map<std::string, std::pair<double, uint64_t>> last_done;
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        stop_signal.notify_all();
+        if (writer.joinable()) {
+            writer.join();
+        }
+        write();
+    }
+
+    static long resident_kb() {
+        long pages = 0, resident = 0;
+        std::ifstream statm("/proc/self/statm");
+        statm >> pages >> resident;
+        return resident * (sysconf(_SC_PAGESIZE) / 1024);
+    }
+
+    static void metric(std::ostringstream& out, const char* name, const char* type, const char* help) {
+        out << "# HELP " << name << " " << help << "\n# TYPE " << name << " " << type << "\n";
+    }
+
+    void write() {
+        const double now = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+        std::ostringstream out;
+        metric(out, "wfmash_uptime_seconds", "gauge", "Seconds since the start of the run.");
+        out << "wfmash_uptime_seconds " << now << "\n";
+        metric(out, "wfmash_cpu_seconds_total", "counter", "CPU seconds of the process.");
+        out << "wfmash_cpu_seconds_total " << run_report::cpu_seconds() << "\n";
+        metric(out, "wfmash_resident_memory_bytes", "gauge", "Resident memory of the process.");
+        out << "wfmash_resident_memory_bytes " << resident_kb() * 1024 << "\n";
+        metric(out, "wfmash_peak_resident_memory_bytes", "gauge", "Peak resident memory of the process.");
+        out << "wfmash_peak_resident_memory_bytes " << run_report::peak_rss_kb() * 1024 << "\n";
+
+        struct StageProgress {
+            std::string stage;
+            uint64_t done, total, records, queue_depth;
+        };
+        std::vector<StageProgress> stages;
+        {
+            std::lock_guard<std::mutex> lock(progress_meter::live_meters_mutex);
+            for (const progress_meter::ProgressMeter* meter : progress_meter::live_meters) {
+                stages.push_back({meter->stage.empty() ? meter->banner : meter->stage, meter->done(), meter->total.load(),
+                                  meter->records.sum(), meter->queue_depth.load(std::memory_order_relaxed)});
+            }
+        }
+        metric(out, "wfmash_stage_bases_done_total", "counter", "Bases mapped or aligned by the stage.");
+        for (const auto& s : stages) {
+            out << "wfmash_stage_bases_done_total{stage=\"" << s.stage << "\"} " << s.done << "\n";
+        }
+        metric(out, "wfmash_stage_bases", "gauge", "Bases the stage has to map or align.");
+        for (const auto& s : stages) {
+            out << "wfmash_stage_bases{stage=\"" << s.stage << "\"} " << s.total << "\n";
+        }
+        metric(out, "wfmash_stage_bases_per_second", "gauge", "Bases per second of the stage since the last write.");
+        for (const auto& s : stages) {
+            auto last = last_done.find(s.stage);
+            const double rate = last == last_done.end() || now <= last->second.first ? 0.0
+                : (s.done - last->second.second) / (now - last->second.first);
+            out << "wfmash_stage_bases_per_second{stage=\"" << s.stage << "\"} " << rate << "\n";
+            last_done[s.stage] = std::make_pair(now, s.done);
+        }
+        metric(out, "wfmash_stage_records_total", "counter", "Queries mapped or mappings aligned by the stage.");
+        for (const auto& s : stages) {
+            out << "wfmash_stage_records_total{stage=\"" << s.stage << "\"} " << s.records << "\n";
+        }
+        metric(out, "wfmash_stage_queue_depth", "gauge", "Tasks of the stage dispatched and not collected yet.");
+        for (const auto& s : stages) {
+            out << "wfmash_stage_queue_depth{stage=\"" << s.stage << "\"} " << s.queue_depth << "\n";
+        }
+
+        const std::pair<tasks::Stage, const char*> executors[] = {{tasks::Stage::Map, "map"}, {tasks::Stage::Align, "align"}};
+        const auto executor_metric = [&](const char* name, const char* help, int64_t (*value)(const tasks::Executor&)) {
+            metric(out, name, "gauge", help);
+            for (const auto& stage : executors) {
+                const tasks::Executor* executor = tasks::stageExecutor(stage.first).load();
+                if (executor != nullptr) {
+                    out << name << "{stage=\"" << stage.second << "\"} " << value(*executor) << "\n";
+                }
+            }
+        };
+        executor_metric("wfmash_workers", "Worker threads of the executor of the stage.",
+                        [](const tasks::Executor& e) -> int64_t { return e.size(); });
+        executor_metric("wfmash_workers_busy", "Worker threads of the stage running a task.",
+                        [](const tasks::Executor& e) -> int64_t { return e.busy(); });
+        executor_metric("wfmash_tasks_queued", "Tasks of the stage waiting for a worker.",
+                        [](const tasks::Executor& e) -> int64_t { return e.queuedTasks(); });
+
+        metric(out, "wfmash_hot_path_total", "counter", "Work done in the hot paths, as written by --stats.");
+        for (int c = 0; c < hot_counters::num_counters; ++c) {
+            const auto counter = hot_counters::Counter(c);
+            out << "wfmash_hot_path_total{counter=\"" << hot_counters::name(counter) << "\"} "
+                << hot_counters::Registry::get().total(counter) << "\n";
+        }
+
+        metric(out, "wfmash_memory_bytes", "gauge", "Memory held by the subsystem, as estimated by its structures.");
+        for (int p = 0; p < memory_accounting::num_pools; ++p) {
+            const auto pool = memory_accounting::Pool(p);
+            out << "wfmash_memory_bytes{pool=\"" << memory_accounting::name(pool) << "\"} "
+                << memory_accounting::Registry::get().bytes(pool) << "\n";
+        }
+        metric(out, "wfmash_memory_peak_bytes", "gauge", "Peak memory held by the subsystem.");
+        for (int p = 0; p < memory_accounting::num_pools; ++p) {
+            const auto pool = memory_accounting::Pool(p);
+            out << "wfmash_memory_peak_bytes{pool=\"" << memory_accounting::name(pool) << "\"} "
+                << memory_accounting::Registry::get().peak_bytes(pool) << "\n";
+        }
+
+        const std::string tmp = path + ".tmp";
+        {
+            std::ofstream file(tmp);
+            file << out.str();
+            if (!file.flush()) {
+                std::fprintf(stderr, "[wfmash] WARNING, failed to write the metrics %s\n", path.c_str());
+                return;
+            }
+        }
+        std::rename(tmp.c_str(), path.c_str());
+    }
+};
+
+}
@@ -0,0 +1,178 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <limits>
+#include <thread>
+#include <vector>
+
+#include "common/ankerl/unordered_dense.hpp"
+
+/**
+ * Minimal perfect hash function over a static set of 64-bit keys
+ *
+ * Follows the construction of BBHash, as described in the paper
+ *
+ * "Fast and scalable minimal perfect hashing for massive key sets"
+ * by Antoine Limasset, Guillaume Rizk, Rayan Chikhi and Pierre Peterlongo
+ *
+ * Each level is a bit array of gamma * (keys left) bits. A key whose slot
+ * is not shared with any other key of its level sets its bit there, the
+ * others go down to the next level. The hash of a key is the rank of its
+ * bit across all levels, in [0, n). Keys left after the last level are
+ * kept in a plain hash map.
+ *
+ * Keys outside of the set map to an arbitrary value or to notFound, so
+ * callers need to check the key they get back.
+ */
+
+namespace mphf {
+
+class MinimalPerfectHash {
+public:
+
+    static constexpr uint64_t notFound = std::numeric_limits<uint64_t>::max();
+
+    MinimalPerfectHash() = default;
+
+    /**
+     * Build over n distinct keys, using up to `threads` threads
+     */
+    void build(const uint64_t* keys, uint64_t n, int threads) {
+        levels.clear();
+        fallback.clear();
+        numKeys = n;
+
+        std::vector<uint64_t> current(keys, keys + n);
+        std::vector<uint64_t> next;
+        const size_t numThreads = std::max(1, threads);
+        uint64_t rankBase = 0;
+
+        for (int level = 0; level < maxLevels && !current.empty(); ++level) {
+            const uint64_t numWords = (uint64_t(gamma * current.size()) + 63) / 64;
+            std::vector<std::atomic<uint64_t>> seen(numWords);
+            std::vector<std::atomic<uint64_t>> collided(numWords);
+
+            const size_t chunkSize = (current.size() + numThreads - 1) / numThreads;
+            const auto for_each_chunk = [&](auto&& fn) {
+                std::vector<std::thread> workers;
+                for (size_t t = 0; t < numThreads; ++t) {
+                    workers.emplace_back([&, t]() {
+                        const size_t end = std::min(current.size(), (t + 1) * chunkSize);
+                        for (size_t i = t * chunkSize; i < end; ++i) {
+                            fn(current[i]);
+                        }
+                    });
+                }
+                for (auto& w : workers) {
+                    w.join();
+                }
+            };
+
+            for_each_chunk([&](uint64_t key) {
+                const uint64_t slot = slotOf(key, level, numWords * 64);
+                const uint64_t bit = uint64_t(1) << (slot % 64);
+                if (seen[slot / 64].fetch_or(bit, std::memory_order_relaxed) & bit) {
+                    collided[slot / 64].fetch_or(bit, std::memory_order_relaxed);
+                }
+            });
+
+            Level l;
+            l.numBits = numWords * 64;
+            l.bits.resize(numWords);
+            l.ranks.resize(numWords);
+            for (uint64_t w = 0; w < numWords; ++w) {
+                l.bits[w] = seen[w].load(std::memory_order_relaxed) & ~collided[w].load(std::memory_order_relaxed);
+                l.ranks[w] = rankBase;
+                rankBase += __builtin_popcountll(l.bits[w]);
+            }
+
+            next.clear();
+            for (uint64_t key : current) {
+                const uint64_t slot = slotOf(key, level, l.numBits);
+                if (!(l.bits[slot / 64] & (uint64_t(1) << (slot % 64)))) {
+                    next.push_back(key);
+                }
+            }
+            levels.push_back(std::move(l));
+            current.swap(next);
+        }
+
+        for (uint64_t key : current) {
+            fallback[key] = rankBase++;
+        }
+    }
+
+    /**
+     * Hash of a key of the set, in [0, n)
+     */
+    uint64_t lookup(uint64_t key) const {
+        for (size_t level = 0; level < levels.size(); ++level) {
+            const Level& l = levels[level];
+            const uint64_t slot = slotOf(key, level, l.numBits);
+            const uint64_t word = l.bits[slot / 64];
+            const uint64_t bit = uint64_t(1) << (slot % 64);
+            if (word & bit) {
+                return l.ranks[slot / 64] + __builtin_popcountll(word & (bit - 1));
+            }
+        }
+        if (fallback.empty()) {
+            return notFound;
+        }
+        auto f = fallback.find(key);
+        return f == fallback.end() ? notFound : f->second;
+    }
+
+    uint64_t size() const {
+        return numKeys;
+    }
+
+    // bytes held by the levels and the fallback
+    uint64_t bytes() const {
+        uint64_t total = fallback.values().capacity() * sizeof(std::pair<uint64_t, uint64_t>) + fallback.bucket_count() * 8;
+        for (const Level& l : levels) {
+            total += (l.bits.capacity() + l.ranks.capacity()) * sizeof(uint64_t);
+        }
+        return total;
+    }
+
+    /**
+     * Prefetch the first level word of a key, where most keys are found
+     */
+    void prefetch(uint64_t key) const {
+        if (!levels.empty()) {
+            const Level& l = levels[0];
+            const uint64_t word = slotOf(key, 0, l.numBits) / 64;
+            __builtin_prefetch(&l.bits[word]);
+            __builtin_prefetch(&l.ranks[word]);
+        }
+    }
+
+private:
+
+    static constexpr double gamma = 2.0;
+    static constexpr int maxLevels = 24;
+
+    struct Level {
+        uint64_t numBits;
+        std::vector<uint64_t> bits;
+        std::vector<uint64_t> ranks;   // rank of the first bit of each word
+    };
+
+    std::vector<Level> levels;
+    ankerl::unordered_dense::map<uint64_t, uint64_t> fallback;
+    uint64_t numKeys = 0;
+
+    // murmur3 fmix64 of the key salted by the level
+    static uint64_t slotOf(uint64_t key, uint64_t level, uint64_t numBits) {
+        uint64_t h = key ^ ((level + 1) * 0x9e3779b97f4a7c15ULL);
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ULL;
+        h ^= h >> 33;
+        return h % numBits;
+    }
+};
+
+}
@@ -0,0 +1,987 @@
+#pragma once
+
+#include <algorithm>
+#include <charconv>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <stdexcept>
+#include <streambuf>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <htslib/bgzf.h>
+#include <htslib/tbx.h>
+
+#include "common/probes.hpp"
+#include "common/memory_accounting.hpp"
+
+/**
+ * Buffered output of PAF/SAM text
+ *
+ * Records are formatted straight into a large buffer, numbers with
+ * std::to_chars rather than through std::ostream, and the buffer goes out
+ * in a single write once it is full. The output may be BGZF compressed,
+ * with htslib compressing blocks on threads of its own, so that it can be
+ * indexed. A writer without a file keeps all that is written in memory.
+ * PAF output may also be sorted by coordinate and indexed by tabix.
+ */
+
+namespace output {
+
+class ShardedWriter;
+class SortedWriter;
+
+class Writer {
+public:
+
+    Writer() = default;
+
+    /**
+     * Write to path, BGZF compressed with `threads` compression threads if bgzf
+     */
+    Writer(const std::string& path, bool bgzf = false, int threads = 1) {
+        open(path, bgzf, threads);
+    }
+
+    Writer(const Writer&) = delete;
+    Writer& operator=(const Writer&) = delete;
+
+    ~Writer() {
+        close();
+    }
+
+    /**
+     * False if the file could not be opened. level is the BGZF compression level, 0 to 9, -1 for the default
+     */
+    bool open(const std::string& path, bool bgzf = false, int threads = 1, int level = -1) {
+        close();
+        written = 0;
+        if (bgzf) {
+            const char mode[3] = {'w', level >= 0 ? char('0' + level) : '\0', '\0'};
+            bgzfFile = bgzf_open(path.c_str(), mode);
+            if (bgzfFile != nullptr && threads > 1) {
+                bgzf_mt(bgzfFile, threads, 256);
+            }
+            return bgzfFile != nullptr;
+        }
+        fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        return fd >= 0;
+    }
+
+    /**
+     * Write through shards, split over their files. They are left open by close
+     */
+    void open(ShardedWriter& shards) {
+        close();
+        written = 0;
+        sharded = &shards;
+    }
+
+    /**
+     * Write through sorted, which is left open by close
+     */
+    void open(SortedWriter& sorted) {
+        close();
+        written = 0;
+        sortedOut = &sorted;
+    }
+
+    /**
+     * Continue an uncompressed regular file after its first offset bytes,
+     * dropping the rest. False if the file could not be opened or is shorter
+     */
+    bool openAt(const std::string& path, uint64_t offset) {
+        close();
+        fd = ::open(path.c_str(), O_WRONLY);
+        written = 0;
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || uint64_t(st.st_size) < offset
+            || ftruncate(fd, offset) != 0 || lseek(fd, offset, SEEK_SET) < 0) {
+            close();
+            failed = false;
+            return false;
+        }
+        written = offset;
+        return true;
+    }
+
+    bool is_open() const {
+        return fd >= 0 || bgzfFile != nullptr || sharded != nullptr || sortedOut != nullptr;
+    }
+
+    /**
+     * Bytes already in an uncompressed file, not counting the buffered ones
+     */
+    uint64_t bytesWritten() const {
+        return written;
+    }
+
+    void write(const char* data, size_t n) {
+        buf.append(data, n);
+        flushIfFull();
+    }
+
+    void write(const std::string& s) {
+        write(s.data(), s.size());
+    }
+
+    Writer& operator<<(const std::string& s) {
+        write(s);
+        return *this;
+    }
+
+    Writer& operator<<(std::string_view s) {
+        write(s.data(), s.size());
+        return *this;
+    }
+
+    Writer& operator<<(const char* s) {
+        write(s, std::strlen(s));
+        return *this;
+    }
+
+    Writer& operator<<(char c) {
+        buf.push_back(c);
+        flushIfFull();
+        return *this;
+    }
+
+    /**
+     * Numbers are written as std::ostream does by default, floating point
+     * ones with 6 significant digits
+     */
+    template <typename T, typename = std::enable_if_t<std::is_arithmetic<T>::value>>
+    Writer& operator<<(T value) {
+        appendNumber(buf, value);
+        flushIfFull();
+        return *this;
+    }
+
+    /**
+     * What was written so far by a writer without a file, which starts over empty
+     */
+    std::string take() {
+        std::string out;
+        out.swap(buf);
+        return out;
+    }
+
+    void flush() {
+        if (buf.empty() || !is_open()) {
+            return;
+        }
+        if (sharded != nullptr) {
+            writeShards();
+        } else if (sortedOut != nullptr) {
+            writeSorted();
+        } else if (bgzfFile != nullptr) {
+            failed |= bgzf_write(bgzfFile, buf.data(), buf.size()) < 0;
+        } else {
+            size_t done = 0;
+            while (done < buf.size()) {
+                const ssize_t n = ::write(fd, buf.data() + done, buf.size() - done);
+                if (n < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    failed = true;
+                    break;
+                }
+                done += n;
+            }
+            written += done;
+        }
+        buf.clear();
+    }
+
+    /**
+     * Flush and have the data of an uncompressed file reach the disk, false
+     * if any write failed
+     */
+    bool sync() {
+        flush();
+        if (fd >= 0 && fdatasync(fd) != 0 && errno != EINVAL) {
+            failed = true;
+        }
+        return !failed;
+    }
+
+    /**
+     * Flush and close the file, false if any write failed
+     */
+    bool close() {
+        flush();
+        if (bgzfFile != nullptr) {
+            failed |= bgzf_close(bgzfFile) < 0;
+            bgzfFile = nullptr;
+        }
+        if (fd >= 0) {
+            failed |= ::close(fd) < 0;
+            fd = -1;
+        }
+        sharded = nullptr;
+        sortedOut = nullptr;
+        return !failed;
+    }
+
+    template <typename T>
+    static void appendNumber(std::string& out, T value) {
+        char tmp[64];
+        std::to_chars_result r;
+        if constexpr (std::is_floating_point<T>::value) {
+            r = std::to_chars(tmp, tmp + sizeof(tmp), value, std::chars_format::general, 6);
+        } else if constexpr (std::is_same<T, bool>::value) {
+            r = std::to_chars(tmp, tmp + sizeof(tmp), int(value));
+        } else {
+            r = std::to_chars(tmp, tmp + sizeof(tmp), value);
+        }
+        out.append(tmp, r.ptr - tmp);
+    }
+
+private:
+
+    static constexpr size_t bufferBytes = 1 << 22;
+
+    int fd = -1;
+    BGZF* bgzfFile = nullptr;
+    ShardedWriter* sharded = nullptr;
+    SortedWriter* sortedOut = nullptr;
+    bool failed = false;
+    uint64_t written = 0;
+    std::string buf;
+
+    void flushIfFull() {
+        if (buf.size() >= bufferBytes && is_open()) {
+            flush();
+        }
+    }
+
+    void writeShards();
+    void writeSorted();
+};
+
+/**
+ * PAF/SAM output split over a number of files, by a hash of the query or
+ * target name of each record or of its PanSN sample, the name up to its
+ * first '#', so that the records of a name all end up in the same file.
+ * Each file is written, and compressed if BGZF, by a thread of its own.
+ * Lines starting with '@', those of the SAM header, go to all of the files
+ */
+class ShardedWriter {
+public:
+
+    enum class Key { Query, Target, QuerySample, TargetSample };
+
+    /**
+     * The key named name: query, target, query-sample or target-sample. False if there is none
+     */
+    static bool parseKey(const std::string& name, Key& key) {
+        if (name == "query") {
+            key = Key::Query;
+        } else if (name == "target") {
+            key = Key::Target;
+        } else if (name == "query-sample") {
+            key = Key::QuerySample;
+        } else if (name == "target-sample") {
+            key = Key::TargetSample;
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * File of shard i: prefix.i.paf, or .sam, followed by .gz if BGZF compressed
+     */
+    static std::string shardPath(const std::string& prefix, int i, bool sam, bool bgzf) {
+        return prefix + "." + std::to_string(i) + (sam ? ".sam" : ".paf") + (bgzf ? ".gz" : "");
+    }
+
+    ShardedWriter() = default;
+
+    ShardedWriter(const ShardedWriter&) = delete;
+    ShardedWriter& operator=(const ShardedWriter&) = delete;
+
+    ~ShardedWriter() {
+        close();
+    }
+
+    /**
+     * Open the files of count shards, the `threads` compression threads being
+     * shared among them if bgzf. False if any could not be opened
+     */
+    bool open(const std::string& prefix, int count, Key key, bool sam,
+              bool bgzf = false, int threads = 1, int level = -1) {
+        close();
+        failed = false;
+        column = key == Key::Query || key == Key::QuerySample ? 0 : sam ? 2 : 5;
+        bySample = key == Key::QuerySample || key == Key::TargetSample;
+        for (int i = 0; i < count; ++i) {
+            shards.emplace_back(new Shard());
+            if (!shards.back()->out.open(shardPath(prefix, i, sam, bgzf), bgzf, std::max(1, threads / count), level)) {
+                shards.clear();
+                return false;
+            }
+        }
+        for (auto& shard : shards) {
+            Shard* s = shard.get();
+            s->thread = std::thread([s]() { s->run(); });
+        }
+        return true;
+    }
+
+    bool is_open() const {
+        return !shards.empty();
+    }
+
+    /**
+     * Lines of records, the last of which may be finished by the next write
+     */
+    void write(const char* data, size_t n) {
+        while (n > 0) {
+            const char* end = static_cast<const char*>(std::memchr(data, '\n', n));
+            if (end == nullptr) {
+                partial.append(data, n);
+                return;
+            }
+            const size_t len = end - data + 1;
+            if (partial.empty()) {
+                route(data, len);
+            } else {
+                partial.append(data, len);
+                route(partial.data(), partial.size());
+                partial.clear();
+            }
+            data += len;
+            n -= len;
+        }
+    }
+
+    /**
+     * Write out what is left and close the files, false if any write failed
+     */
+    bool close() {
+        if (shards.empty()) {
+            return !failed;
+        }
+        if (!partial.empty()) {
+            route(partial.data(), partial.size());
+            partial.clear();
+        }
+        for (auto& shard : shards) {
+            if (!shard->pending.empty()) {
+                shard->hand();
+            }
+            {
+                std::lock_guard<std::mutex> lock(shard->mutex);
+                shard->done = true;
+            }
+            shard->ready.notify_one();
+        }
+        for (auto& shard : shards) {
+            shard->thread.join();
+            failed |= !shard->out.close();
+        }
+        shards.clear();
+        return !failed;
+    }
+
+private:
+
+    // bytes of the lines of a shard handed to its thread at a time, and how many such buffers may wait for it
+    static constexpr size_t pendingBytes = 1 << 20;
+    static constexpr size_t maxQueued = 16;
+
+    struct Shard {
+        Writer out;
+        std::string pending;
+        std::deque<std::string> queue;
+        std::mutex mutex;
+        std::condition_variable ready;
+        std::condition_variable room;
+        bool done = false;
+        std::thread thread;
+
+        void hand() {
+            std::unique_lock<std::mutex> lock(mutex);
+            room.wait(lock, [this]() { return queue.size() < maxQueued; });
+            queue.push_back(std::move(pending));
+            lock.unlock();
+            ready.notify_one();
+            pending = std::string();
+        }
+
+        void run() {
+            for (;;) {
+                std::string buffer;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    ready.wait(lock, [this]() { return !queue.empty() || done; });
+                    if (queue.empty()) {
+                        return;
+                    }
+                    buffer = std::move(queue.front());
+                    queue.pop_front();
+                }
+                room.notify_one();
+                out.write(buffer);
+            }
+        }
+    };
+
+    std::vector<std::unique_ptr<Shard>> shards;
+    std::string partial;
+    size_t column = 0;
+    bool bySample = false;
+    bool failed = false;
+
+    void route(const char* line, size_t len) {
+        if (line[0] == '@') {
+            for (auto& shard : shards) {
+                append(*shard, line, len);
+            }
+            return;
+        }
+        const char* end = line + len;
+        const char* field = line;
+        for (size_t c = 0; c < column && field < end; ++c) {
+            const char* tab = static_cast<const char*>(std::memchr(field, '\t', end - field));
+            field = tab != nullptr ? tab + 1 : end;
+        }
+        size_t fieldLen = 0;
+        while (field + fieldLen < end && field[fieldLen] != '\t' && field[fieldLen] != '\n'
+               && !(bySample && field[fieldLen] == '#')) {
+            ++fieldLen;
+        }
+        const size_t h = std::hash<std::string_view>()(std::string_view(field, fieldLen));
+        append(*shards[h % shards.size()], line, len);
+    }
+
+    static void append(Shard& shard, const char* line, size_t len) {
+        shard.pending.append(line, len);
+        if (shard.pending.size() >= pendingBytes) {
+            shard.hand();
+        }
+    }
+};
+
+inline void Writer::writeShards() {
+    sharded->write(buf.data(), buf.size());
+}
+
+/**
+ * PAF output sorted by target, or query, name then start, BGZF compressed and
+ * indexed by tabix alongside, for region queries. Lines are gathered in runs
+ * of up to runBytes, each sorted then spilled to a temporary file, and the
+ * runs are merged into the output once closed, so that only a run is held in
+ * memory. Records of the same name and start keep their input order
+ */
+class SortedWriter {
+public:
+
+    enum class Key { Query, Target };
+
+    static constexpr size_t defaultRunBytes = size_t(1) << 28;
+
+    /**
+     * The key named name: query or target. False if there is none
+     */
+    static bool parseKey(const std::string& name, Key& key) {
+        if (name == "query") {
+            key = Key::Query;
+        } else if (name == "target") {
+            key = Key::Target;
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+    SortedWriter() = default;
+
+    SortedWriter(const SortedWriter&) = delete;
+    SortedWriter& operator=(const SortedWriter&) = delete;
+
+    ~SortedWriter() {
+        if (spill != nullptr) {
+            std::fclose(spill);
+        }
+    }
+
+    /**
+     * Sort the output into path, compressed with `threads` threads. False if it
+     * could not be created
+     */
+    bool open(const std::string& file, Key key, int threads = 1, int level = -1, size_t runLimit = defaultRunBytes) {
+        path = file;
+        column = key == Key::Query ? 0 : 5;
+        compressionThreads = threads;
+        compressionLevel = level;
+        runBytes = runLimit;
+        failed = false;
+        maxEnd = 0;
+        Writer created;
+        opened = created.open(path, true, 1, level) && created.close();
+        return opened;
+    }
+
+    bool is_open() const {
+        return opened;
+    }
+
+    /**
+     * Lines of records, the last of which may be finished by the next write
+     */
+    void write(const char* data, size_t n) {
+        while (n > 0) {
+            const char* end = static_cast<const char*>(std::memchr(data, '\n', n));
+            if (end == nullptr) {
+                partial.append(data, n);
+                return;
+            }
+            const size_t len = end - data + 1;
+            if (partial.empty()) {
+                add(data, len);
+            } else {
+                partial.append(data, len);
+                add(partial.data(), partial.size());
+                partial.clear();
+            }
+            data += len;
+            n -= len;
+        }
+    }
+
+    /**
+     * Merge the runs into the output and index it, false if any step failed
+     */
+    bool close() {
+        if (!opened) {
+            return !failed;
+        }
+        opened = false;
+        if (!partial.empty()) {
+            partial.push_back('\n');
+            add(partial.data(), partial.size());
+            partial.clear();
+        }
+        Writer out;
+        if (!out.open(path, true, compressionThreads, compressionLevel)) {
+            return false;
+        }
+        sortRun();
+        if (runs.empty()) {
+            for (const Line& line : lines) {
+                out.write(run.data() + line.offset, line.length);
+            }
+        } else {
+            failed |= !spillRun();
+            merge(out);
+        }
+        clearRun();
+        runs.clear();
+        failed |= !out.close();
+        if (!failed) {
+            // tabix columns are 1-based, the PAF coordinates 0-based half-open; a CSI index past the 2^29 of a TBI
+            const tbx_conf_t conf = {TBX_GENERIC | TBX_UCSC, int32_t(column + 1), int32_t(column + 3), int32_t(column + 4), '#', 0};
+            failed |= tbx_index_build(path.c_str(), maxEnd < (uint64_t(1) << 29) ? 0 : 14, &conf) != 0;
+        }
+        return !failed;
+    }
+
+private:
+
+    // bytes read back from each run at a time when merging
+    static constexpr size_t readBytes = 1 << 20;
+
+    struct Line {
+        uint64_t offset;
+        uint64_t start;
+        uint32_t length;
+        uint32_t nameOffset;
+        uint32_t nameLength;
+    };
+
+    // the key of a line, its name, start and end, false if it lacks the fields
+    bool parse(const char* line, size_t len, size_t& nameOffset, size_t& nameLength, uint64_t& start, uint64_t& end) const {
+        const char* stop = line + len;
+        const char* field = line;
+        const auto next = [&]() {
+            const char* tab = static_cast<const char*>(std::memchr(field, '\t', stop - field));
+            field = tab != nullptr ? tab + 1 : stop;
+        };
+        for (size_t c = 0; c < column; ++c) {
+            next();
+        }
+        const char* name = field;
+        next();
+        if (field == stop) {
+            return false;
+        }
+        nameOffset = name - line;
+        nameLength = field - 1 - name;
+        next();
+        const auto number = [&](uint64_t& value) {
+            const auto r = std::from_chars(field, stop, value);
+            next();
+            return r.ec == std::errc();
+        };
+        return number(start) && number(end);
+    }
+
+    void add(const char* line, size_t len) {
+        size_t nameOffset = 0, nameLength = 0;
+        uint64_t start = 0, end = 0;
+        if (!parse(line, len, nameOffset, nameLength, start, end)) {
+            failed = true;
+            return;
+        }
+        maxEnd = std::max(maxEnd, end);
+        if (run.size() + len > runBytes && !lines.empty()) {
+            sortRun();
+            failed |= !spillRun();
+            clearRun();
+        }
+        lines.push_back({run.size(), start, uint32_t(len), uint32_t(nameOffset), uint32_t(nameLength)});
+        run.append(line, len);
+    }
+
+    std::string_view nameOf(const Line& line) const {
+        return std::string_view(run.data() + line.offset + line.nameOffset, line.nameLength);
+    }
+
+    void sortRun() {
+        std::sort(lines.begin(), lines.end(), [this](const Line& a, const Line& b) {
+            const int c = nameOf(a).compare(nameOf(b));
+            return c != 0 ? c < 0 : a.start != b.start ? a.start < b.start : a.offset < b.offset;
+        });
+    }
+
+    void clearRun() {
+        run.clear();
+        lines.clear();
+    }
+
+    // the sorted lines of the run, appended to the spill file as a run of its own
+    bool spillRun() {
+        if (spill == nullptr && (spill = std::tmpfile()) == nullptr) {
+            return false;
+        }
+        std::string sorted;
+        sorted.reserve(run.size());
+        for (const Line& line : lines) {
+            sorted.append(run.data() + line.offset, line.length);
+        }
+        const uint64_t begin = runs.empty() ? 0 : runs.back().second;
+        size_t done = 0;
+        while (done < sorted.size()) {
+            const ssize_t n = pwrite(fileno(spill), sorted.data() + done, sorted.size() - done, begin + done);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return false;
+            }
+            done += n;
+        }
+        runs.emplace_back(begin, begin + sorted.size());
+        WFMASH_PROBE(reorder_spill, sorted.size());
+        return true;
+    }
+
+    struct RunCursor {
+        uint64_t next;
+        uint64_t end;
+        std::string buffer;
+        size_t at = 0;
+        std::string_view line;
+        std::string_view name;
+        uint64_t start = 0;
+    };
+
+    // the next line of a run, false at its end
+    bool advance(RunCursor& cursor) {
+        cursor.at += cursor.line.size();
+        const char* newline = nullptr;
+        while ((newline = static_cast<const char*>(std::memchr(cursor.buffer.data() + cursor.at, '\n', cursor.buffer.size() - cursor.at))) == nullptr) {
+            if (cursor.next == cursor.end) {
+                return false;
+            }
+            cursor.buffer.erase(0, cursor.at);
+            cursor.at = 0;
+            const size_t have = cursor.buffer.size();
+            const size_t want = std::min<uint64_t>(readBytes, cursor.end - cursor.next);
+            cursor.buffer.resize(have + want);
+            const ssize_t got = pread(fileno(spill), &cursor.buffer[have], want, cursor.next);
+            if (got <= 0) {
+                failed = true;
+                return false;
+            }
+            cursor.buffer.resize(have + got);
+            cursor.next += got;
+        }
+        const char* line = cursor.buffer.data() + cursor.at;
+        cursor.line = std::string_view(line, newline - line + 1);
+        size_t nameOffset = 0, nameLength = 0;
+        uint64_t end = 0;
+        parse(line, cursor.line.size(), nameOffset, nameLength, cursor.start, end);
+        cursor.name = std::string_view(line + nameOffset, nameLength);
+        return true;
+    }
+
+    void merge(Writer& out) {
+        std::vector<RunCursor> cursors(runs.size());
+        std::vector<size_t> heap;
+        const auto later = [&cursors](size_t a, size_t b) {
+            const int c = cursors[a].name.compare(cursors[b].name);
+            return c != 0 ? c > 0 : cursors[a].start != cursors[b].start ? cursors[a].start > cursors[b].start : a > b;
+        };
+        for (size_t r = 0; r < runs.size(); ++r) {
+            cursors[r].next = runs[r].first;
+            cursors[r].end = runs[r].second;
+            if (advance(cursors[r])) {
+                heap.push_back(r);
+            }
+        }
+        std::make_heap(heap.begin(), heap.end(), later);
+        while (!heap.empty()) {
+            std::pop_heap(heap.begin(), heap.end(), later);
+            RunCursor& cursor = cursors[heap.back()];
+            out.write(cursor.line.data(), cursor.line.size());
+            if (advance(cursor)) {
+                std::push_heap(heap.begin(), heap.end(), later);
+            } else {
+                heap.pop_back();
+            }
+        }
+    }
+
+    std::string path;
+    size_t column = 5;
+    int compressionThreads = 1;
+    int compressionLevel = -1;
+    size_t runBytes = defaultRunBytes;
+    bool opened = false;
+    bool failed = false;
+    uint64_t maxEnd = 0;
+    std::string partial;
+    std::string run;
+    std::vector<Line> lines;
+    std::FILE* spill = nullptr;
+    std::vector<std::pair<uint64_t, uint64_t>> runs;
+};
+
+inline void Writer::writeSorted() {
+    sortedOut->write(buf.data(), buf.size());
+}
+
+/**
+ * std::ostream appending to a string, for code formatting records through
+ * streams: unlike a std::stringstream, nothing has to be copied out of it
+ */
+class StringAppender : public std::ostream {
+public:
+
+    explicit StringAppender(std::string& out) : std::ostream(nullptr), sink(out) {
+        rdbuf(&sink);
+    }
+
+private:
+
+    class Sink : public std::streambuf {
+    public:
+        explicit Sink(std::string& out) : out(out) {}
+
+    protected:
+        int_type overflow(int_type c) override {
+            if (!traits_type::eq_int_type(c, traits_type::eof())) {
+                out.push_back(traits_type::to_char_type(c));
+            }
+            return traits_type::not_eof(c);
+        }
+
+        std::streamsize xsputn(const char* s, std::streamsize n) override {
+            out.append(s, n);
+            return n;
+        }
+
+    private:
+        std::string& out;
+    };
+
+    Sink sink;
+};
+
+/**
+ * Output buffers passed from the threads formatting records to the one
+ * writing them, and given back once written. Buffers keep their capacity
+ * when reused, except the few grown past maxKeptBytes by a huge record
+ */
+class BufferPool {
+public:
+
+    BufferPool() = default;
+
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+
+    ~BufferPool() {
+        for (std::string* buffer : free) {
+            delete buffer;
+        }
+    }
+
+    /**
+     * An empty buffer, to give back with release
+     */
+    std::string* acquire() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!free.empty()) {
+                std::string* buffer = free.back();
+                free.pop_back();
+                return buffer;
+            }
+        }
+        WFMASH_PROBE(buffer_alloc, maxKeptBytes);
+        return new std::string();
+    }
+
+    void release(std::string* buffer) {
+        if (buffer->capacity() > maxKeptBytes) {
+            delete buffer;
+            return;
+        }
+        buffer->clear();
+        std::lock_guard<std::mutex> lock(mutex);
+        free.push_back(buffer);
+    }
+
+private:
+
+    static constexpr size_t maxKeptBytes = 1 << 20;
+
+    std::mutex mutex;
+    std::vector<std::string*> free;
+};
+
+/**
+ * Outputs of numbered inputs, done in any order, handed back in input order.
+ * Those that come ahead of their turn are held in memory up to a budget of
+ * bytes, past which they are spilled to a temporary file and read back in
+ * their turn, so that a slow input holds back neither the inputs after it
+ * nor the memory of the run
+ */
+class ReorderWindow {
+public:
+
+    ReorderWindow(BufferPool& buffers, size_t memoryBytes)
+        : buffers(buffers), memoryBytes(memoryBytes) {}
+
+    ReorderWindow(const ReorderWindow&) = delete;
+    ReorderWindow& operator=(const ReorderWindow&) = delete;
+
+    ~ReorderWindow() {
+        for (auto& held : inMemory) {
+            buffers.release(held.second);
+        }
+        memory_accounting::add(memory_accounting::align_reorder, -(int64_t)heldBytes);
+        if (spill != nullptr) {
+            std::fclose(spill);
+        }
+    }
+
+    /**
+     * Takes the output of input rank, a buffer of buffers, calling write with
+     * each of the outputs now due in input order, which write is to release
+     */
+    template <typename Write>
+    void add(uint64_t rank, std::string* output, Write&& write) {
+        if (rank == next) {
+            ++next;
+            write(output);
+        } else if (heldBytes + output->size() <= memoryBytes || !spillOut(rank, output)) {
+            heldBytes += output->size();
+            memory_accounting::add(memory_accounting::align_reorder, output->size());
+            inMemory.emplace(rank, output);
+        }
+        while (true) {
+            if (!inMemory.empty() && inMemory.begin()->first == next) {
+                std::string* due = inMemory.begin()->second;
+                heldBytes -= due->size();
+                memory_accounting::add(memory_accounting::align_reorder, -(int64_t)due->size());
+                inMemory.erase(inMemory.begin());
+                ++next;
+                write(due);
+            } else if (!spilled.empty() && spilled.begin()->first == next) {
+                std::string* due = buffers.acquire();
+                readBack(spilled.begin()->second, *due);
+                spilled.erase(spilled.begin());
+                ++next;
+                write(due);
+            } else {
+                break;
+            }
+        }
+    }
+
+    /**
+     * Outputs held, in memory or spilled
+     */
+    size_t held() const {
+        return inMemory.size() + spilled.size();
+    }
+
+private:
+
+    bool spillOut(uint64_t rank, std::string* output) {
+        if (spill == nullptr && (spill = std::tmpfile()) == nullptr) {
+            return false;
+        }
+        if (pwrite(fileno(spill), output->data(), output->size(), spillEnd) != (ssize_t)output->size()) {
+            return false;
+        }
+        spilled.emplace(rank, std::make_pair(spillEnd, (uint64_t)output->size()));
+        WFMASH_PROBE(reorder_spill, output->size());
+        spillEnd += output->size();
+        buffers.release(output);
+        return true;
+    }
+
+    void readBack(const std::pair<uint64_t, uint64_t>& extent, std::string& out) {
+        out.resize(extent.second);
+        uint64_t done = 0;
+        while (done < extent.second) {
+            const ssize_t got = pread(fileno(spill), &out[done], extent.second - done, extent.first + done);
+            if (got <= 0) {
+                throw std::runtime_error("[output::ReorderWindow] Error! Failed to read back spilled output");
+            }
+            done += got;
+        }
+    }
+
+    BufferPool& buffers;
+    const size_t memoryBytes;
+    uint64_t next = 0;
+    size_t heldBytes = 0;
+    std::map<uint64_t, std::string*> inMemory;
+    std::map<uint64_t, std::pair<uint64_t, uint64_t>> spilled;
+    std::FILE* spill = nullptr;
+    uint64_t spillEnd = 0;
+};
+
+}
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * Residency of files in the page cache of the node
+ *
+ * The index file is read, and its seed positions mapped, through the page
+ * cache, which all the processes of a node share. Warmed once, by a process
+ * that reads it in and locks its pages in memory, an index is loaded by the
+ * jobs started after it at the speed of memory rather than of the disk.
+ */
+
+namespace page_cache {
+
+/**
+ * Fraction of the pages of the file at path in the page cache, -1 if it
+ * can't be told
+ */
+inline double resident_fraction(const std::string& path) {
+    const int fd = open(path.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) == -1) {
+        if (fd != -1) {
+            close(fd);
+        }
+        return -1;
+    }
+    if (st.st_size == 0) {
+        close(fd);
+        return 1;
+    }
+    void* mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        return -1;
+    }
+    const size_t page = sysconf(_SC_PAGESIZE);
+    std::vector<unsigned char> resident((st.st_size + page - 1) / page);
+    double fraction = -1;
+    if (mincore(mapping, st.st_size, resident.data()) == 0) {
+        uint64_t pages = 0;
+        for (unsigned char r : resident) {
+            pages += r & 1;
+        }
+        fraction = double(pages) / resident.size();
+    }
+    munmap(mapping, st.st_size);
+    return fraction;
+}
+
+/**
+ * A file read into the page cache, its pages locked in memory if asked and
+ * allowed (RLIMIT_MEMLOCK), for as long as the object lives
+ */
+class Warm {
+public:
+
+    explicit Warm(const std::string& path, bool lock = true) {
+        const int fd = open(path.c_str(), O_RDONLY);
+        struct stat st;
+        if (fd == -1 || fstat(fd, &st) == -1) {
+            if (fd != -1) {
+                close(fd);
+            }
+            return;
+        }
+        size = st.st_size;
+        mapping = size > 0 ? mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0) : nullptr;
+        close(fd);
+        if (mapping == MAP_FAILED) {
+            mapping = nullptr;
+            return;
+        }
+        if (mapping != nullptr) {
+            madvise(mapping, size, MADV_WILLNEED);
+            // fault every page in, so that the file is resident even if it can't be locked
+            const size_t page = sysconf(_SC_PAGESIZE);
+            volatile unsigned char sum = 0;
+            for (size_t offset = 0; offset < size; offset += page) {
+                sum += static_cast<const unsigned char*>(mapping)[offset];
+            }
+            locked = lock && mlock(mapping, size) == 0;
+        }
+        loaded = true;
+    }
+
+    Warm(const Warm&) = delete;
+    Warm& operator=(const Warm&) = delete;
+
+    ~Warm() {
+        if (mapping != nullptr) {
+            if (locked) {
+                munlock(mapping, size);
+            }
+            munmap(mapping, size);
+        }
+    }
+
+    // whether the file could be read in
+    bool ok() const {
+        return loaded;
+    }
+
+    // whether its pages are locked in memory
+    bool is_locked() const {
+        return locked;
+    }
+
+    size_t bytes() const {
+        return size;
+    }
+
+private:
+
+    void* mapping = nullptr;
+    size_t size = 0;
+    bool loaded = false;
+    bool locked = false;
+};
+
+}
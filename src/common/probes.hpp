@@ -0,0 +1,40 @@
+#pragma once
+
+/**
+ * USDT probes at the boundaries of the stages, for perf and bpftrace to trace
+ * running jobs: compiled in when sys/sdt.h is found (the USDT_PROBES option),
+ * each probe is a nop until a tracer attaches to it. List them with
+ *
+ *   bpftrace -l 'usdt:/path/to/wfmash:*'
+ *
+ * and trace, say, the mapping time of each query with
+ *
+ *   bpftrace -e 'usdt:./wfmash:wfmash:map_query_start { @s[tid] = nsecs; }
+ *                usdt:./wfmash:wfmash:map_query_end { @ns = hist(nsecs - @s[tid]); }'
+ *
+ * Probes and their arguments:
+ *   index_build_start (shard)             index_build_end (shard, minmer windows)
+ *   index_load_start (shard)              index_load_end (shard, minmer windows)
+ *   map_query_start (name, length)        map_query_end (name, length, L2 mappings, mappings kept)
+ *   align_start (query, query length, target length)
+ *   align_end (query, query length, target length)
+ *   alignment (query, query length, target length, gap-compressed identity in ppm, patches)
+ *   queue_push (rank, in flight)          queue_pop (rank, in flight)
+ *   buffer_alloc (bytes kept)             reorder_spill (bytes)
+ *   aligner_alloc (kind: 0 wflambda, 1 segment, 2 patch, 3 biwfa)
+ */
+
+#ifdef WFMASH_USDT
+#include <sys/sdt.h>
+#define WFMASH_PROBE(name, ...) STAP_PROBEV(wfmash, name, __VA_ARGS__)
+#else
+#define WFMASH_PROBE(name, ...) probes::ignore(__VA_ARGS__)
+#endif
+
+namespace probes {
+
+// arguments of probes compiled out, so that those computed for them count as used
+template <typename... Args>
+inline void ignore(const Args&...) {}
+
+}
@@ -5,57 +5,181 @@
 #include <atomic>
 #include <thread>
 #include <chrono>
+#include <condition_variable>
+#include <mutex>
 #include <iomanip>
+#include <sstream>
+#include <cmath>
+#include <algorithm>
+#include <vector>
 
 namespace progress_meter {
 
+// with --progress-log, the progress is logged as a line of fields every that many seconds instead
+inline double log_interval_seconds = 0;
+
+/**
+ * A count summed over per-thread slots, each on a cache line of its own, so that
+ * the threads that add to it don't bounce a shared line between their cores.
+ * Threads beyond the count of slots share them
+ */
+class SlottedCounter {
+public:
+    void add(uint64_t n) {
+        std::atomic<uint64_t>& value = slots[slot()].value;
+        value.fetch_add(n, std::memory_order_relaxed);
+    }
+    uint64_t sum() const {
+        uint64_t total = 0;
+        for (const Slot& s : slots) {
+            total += s.value.load(std::memory_order_relaxed);
+        }
+        return total;
+    }
+private:
+    static constexpr size_t slot_count = 128;
+    struct alignas(64) Slot {
+        std::atomic<uint64_t> value{0};
+    };
+    Slot slots[slot_count];
+    static size_t slot() {
+        static std::atomic<size_t> next_slot{0};
+        thread_local const size_t s = next_slot.fetch_add(1, std::memory_order_relaxed) % slot_count;
+        return s;
+    }
+};
+
+class ProgressMeter;
+
+/**
+ * Meters of the stages running, for the metrics of --metrics
+ */
+inline std::mutex live_meters_mutex;
+inline std::vector<ProgressMeter*> live_meters;
+
 class ProgressMeter {
 public:
     std::string banner;
+    std::string stage;
     std::atomic<uint64_t> total;
-    std::atomic<uint64_t> completed;
+    SlottedCounter completed;
+    SlottedCounter records;
+    std::atomic<uint64_t> queue_depth;
+    std::atomic<bool> finished;
+    std::mutex finish_mutex;
+    std::condition_variable finish_signal;
     std::chrono::time_point<std::chrono::steady_clock> start_time;
     std::thread logger;
-    ProgressMeter(uint64_t _total, const std::string& _banner)
-        : total(_total), banner(_banner) {
+    // counts at the last line logged, for the throughput since
+    double last_seconds = 0;
+    uint64_t last_completed = 0;
+    uint64_t last_records = 0;
+    ProgressMeter(uint64_t _total, const std::string& _banner, const std::string& _stage = "")
+        : banner(_banner), stage(_stage), total(_total) {
         start_time = std::chrono::steady_clock::now();
-        completed = 0;
+        queue_depth = 0;
+        finished = false;
+        {
+            std::lock_guard<std::mutex> lock(live_meters_mutex);
+            live_meters.push_back(this);
+        }
+        const bool structured = log_interval_seconds > 0;
         logger = std::thread(
-            [&](void) {
-                do_print();
-                auto last = 0;
-                while (completed < total) {
-                    auto curr = completed - last;
-                    if (curr > 0) {
+            [this, structured](void) {
+                if (!structured) {
+                    do_print();
+                }
+                uint64_t last = 0;
+                std::unique_lock<std::mutex> lock(finish_mutex);
+                const auto interval = structured
+                    ? std::chrono::milliseconds((int64_t)(log_interval_seconds * 1000))
+                    : std::chrono::milliseconds(500);
+                while (!finished) {
+                    // finish() wakes the logger, rather than waiting out the interval
+                    finish_signal.wait_for(lock, interval, [&]() { return finished.load(); });
+                    if (finished) {
+                        break;
+                    }
+                    if (structured) {
+                        do_log();
+                    } else if (completed.sum() != last) {
                         do_print();
-                        last = completed;
+                        last = completed.sum();
                     }
-                    std::this_thread::sleep_for(std::chrono::milliseconds(500));
                 }
             });
     };
+    ~ProgressMeter() {
+        std::lock_guard<std::mutex> lock(live_meters_mutex);
+        live_meters.erase(std::find(live_meters.begin(), live_meters.end(), this));
+    }
+    uint64_t done() const {
+        return finished ? total.load() : std::min(completed.sum(), total.load());
+    }
+    double elapsed() const {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+    }
     void do_print(void) {
-        auto curr = std::chrono::steady_clock::now();
-        std::chrono::duration<double> elapsed_seconds = curr-start_time;
-        double rate = completed / elapsed_seconds.count();
-        double seconds_to_completion = (completed > 0 ? (total - completed) / rate : 0);
+        const double elapsed_seconds = elapsed();
+        const uint64_t current = done();
+        double rate = current / elapsed_seconds;
+        double seconds_to_completion = (current > 0 ? (total - current) / rate : 0);
         std::cerr << "\r" << banner << " "
                   << std::defaultfloat
                   << std::setfill(' ')
                   << std::setw(5)
                   << std::fixed
                   << std::setprecision(2)
-                  << 100.0 * ((double)completed / (double)total) << "%"
+                  << (total > 0 ? 100.0 * ((double)current / (double)total) : 0.0) << "%"
                   << " @ "
                   << std::setw(4) << std::scientific << rate << " bp/s "
-                  << "elapsed: " << print_time(elapsed_seconds.count()) << " "
+                  << "elapsed: " << print_time(elapsed_seconds) << " "
                   << "remain: " << print_time(seconds_to_completion);
     }
+    /**
+     * A whole line of fields, with the throughput since the last one, for logs that
+     * aren't a terminal
+     */
+    void do_log(void) {
+        const double elapsed_seconds = elapsed();
+        const uint64_t current = done();
+        const uint64_t current_records = records.sum();
+        const double interval = std::max(elapsed_seconds - last_seconds, 1e-9);
+        const double rate = current / std::max(elapsed_seconds, 1e-9);
+        std::ostringstream line;
+        line << std::fixed << std::setprecision(1)
+             << "[wfmash::progress] stage=" << (stage.empty() ? banner : stage)
+             << " elapsed_s=" << elapsed_seconds
+             << " done_bp=" << current
+             << " total_bp=" << total
+             << " percent=" << std::setprecision(2) << (total > 0 ? 100.0 * current / total : 0.0)
+             << std::setprecision(0)
+             << " bp_per_s=" << (current - last_completed) / interval
+             << " records=" << current_records
+             << std::setprecision(1)
+             << " records_per_s=" << (current_records - last_records) / interval
+             << " queue_depth=" << queue_depth.load(std::memory_order_relaxed)
+             << std::setprecision(0)
+             << " remain_s=" << (current > 0 ? (total - current) / rate : 0.0)
+             << "\n";
+        std::cerr << line.str();
+        last_seconds = elapsed_seconds;
+        last_completed = current;
+        last_records = current_records;
+    }
     void finish(void) {
-        completed.store(total);
+        {
+            std::lock_guard<std::mutex> lock(finish_mutex);
+            finished = true;
+        }
+        finish_signal.notify_all();
         logger.join();
-        do_print();
-        std::cerr << std::endl;
+        if (log_interval_seconds > 0) {
+            do_log();
+        } else {
+            do_print();
+            std::cerr << std::endl;
+        }
     }
     std::string print_time(const double& _seconds) {
         int days = 0, hours = 0, minutes = 0, seconds = 0;
@@ -79,7 +203,19 @@ public:
         //std::cerr << input_seconds << " seconds is " << days << " days, " << hours << " hours, " << minutes << " minutes, and " << seconds << " seconds." << std::endl;
     }
     void increment(const uint64_t& incr) {
-        completed += incr;
+        completed.add(incr);
+    }
+    // records (queries mapped, mappings aligned) done, for the throughput of the log
+    void add_records(const uint64_t& incr) {
+        records.add(incr);
+    }
+    // tasks dispatched and not collected yet, for the log
+    void set_queue_depth(const uint64_t& depth) {
+        queue_depth.store(depth, std::memory_order_relaxed);
+    }
+    // for a total only known as the input is read, which has to keep ahead of completed
+    void add_total(const uint64_t& incr) {
+        total += incr;
     }
 };
 
@@ -0,0 +1,251 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <sys/resource.h>
+
+#include "common/memory_accounting.hpp"
+
+/**
+ * Machine-readable report of a run, written as JSON with --report-json: the
+ * wall and CPU times of each stage, the peak resident memory of the process
+ * once it is done, the use of its threads, and counters such as records and
+ * bases per second or the depths of queues.
+ *
+ * CPU times are those of the whole process, so stages that overlap (with
+ * --stream-mappings) share theirs; nested stages are also counted in the
+ * stages around them.
+ */
+namespace run_report {
+
+struct Stage {
+    std::string name;
+    int threads = 1;
+    double start = 0;           // seconds since the start of the run
+    double wall = 0;
+    double cpu = 0;
+    long peak_rss_kb = 0;
+    std::map<std::string, double> counters;
+};
+
+/**
+ * CPU seconds of the process, or of the calling thread
+ */
+inline double cpu_seconds(bool thread = false) {
+    rusage usage;
+    getrusage(thread ? RUSAGE_THREAD : RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec
+        + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+inline long peak_rss_kb() {
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+class Report {
+public:
+
+    bool enabled() const {
+        return !path.empty();
+    }
+
+    /**
+     * Reports the run to path, once the process exits
+     */
+    void open(const std::string& file) {
+        path = file;
+        std::atexit([]() { get().write(); });
+    }
+
+    double elapsed() const {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    }
+
+    void add(Stage&& stage) {
+        std::lock_guard<std::mutex> lock(mutex);
+        stages.push_back(std::move(stage));
+    }
+
+    void write() const {
+        if (path.empty()) {
+            return;
+        }
+        std::ostringstream json;
+        json << std::setprecision(6) << std::fixed;
+        json << "{\n  \"wall_seconds\": " << elapsed()
+             << ",\n  \"cpu_seconds\": " << cpu_seconds()
+             << ",\n  \"peak_rss_kb\": " << peak_rss_kb()
+             << ",\n  \"stages\": [";
+        std::lock_guard<std::mutex> lock(mutex);
+        for (size_t i = 0; i < stages.size(); ++i) {
+            const Stage& s = stages[i];
+            json << (i == 0 ? "\n" : ",\n")
+                 << "    {\"name\": \"" << s.name << "\""
+                 << ", \"threads\": " << s.threads
+                 << ", \"start_seconds\": " << s.start
+                 << ", \"wall_seconds\": " << s.wall
+                 << ", \"cpu_seconds\": " << s.cpu
+                 << ", \"thread_utilization\": " << (s.wall > 0 ? s.cpu / (s.wall * std::max(1, s.threads)) : 0.0)
+                 << ", \"peak_rss_kb\": " << s.peak_rss_kb;
+            for (const auto& counter : s.counters) {
+                json << ", \"" << counter.first << "\": " << counter.second;
+            }
+            json << "}";
+        }
+        json << "\n  ],\n  \"memory\": {";
+        for (int p = 0; p < memory_accounting::num_pools; ++p) {
+            const auto pool = memory_accounting::Pool(p);
+            json << (p == 0 ? "\n" : ",\n")
+                 << "    \"" << memory_accounting::name(pool) << "\": {\"bytes\": "
+                 << memory_accounting::Registry::get().bytes(pool)
+                 << ", \"peak_bytes\": " << memory_accounting::Registry::get().peak_bytes(pool) << "}";
+        }
+        json << "\n  }\n}\n";
+        std::ofstream out(path);
+        out << json.str();
+        if (!out) {
+            std::fprintf(stderr, "[wfmash] WARNING, failed to write the run report %s\n", path.c_str());
+        }
+    }
+
+    static Report& get() {
+        static Report report;
+        return report;
+    }
+
+private:
+
+    std::string path;
+    const std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+    mutable std::mutex mutex;
+    std::vector<Stage> stages;
+};
+
+/**
+ * Times a stage from its construction to stop(), or its destruction, if the
+ * run is reported. thread_cpu counts the CPU time of the calling thread only,
+ * for stages made of the work of one thread
+ */
+class StageTimer {
+public:
+
+    StageTimer(const std::string& name, int threads, bool thread_cpu = false)
+        : active(Report::get().enabled()), thread_cpu(thread_cpu) {
+        if (active) {
+            stage.name = name;
+            stage.threads = threads;
+            stage.start = Report::get().elapsed();
+            cpu_start = cpu_seconds(thread_cpu);
+        }
+    }
+
+    StageTimer(const StageTimer&) = delete;
+    StageTimer& operator=(const StageTimer&) = delete;
+
+    ~StageTimer() {
+        stop();
+    }
+
+    void count(const std::string& name, double value) {
+        if (active) {
+            stage.counters[name] = value;
+        }
+    }
+
+    void stop() {
+        if (!active) {
+            return;
+        }
+        active = false;
+        stage.wall = Report::get().elapsed() - stage.start;
+        stage.cpu = cpu_seconds(thread_cpu) - cpu_start;
+        stage.peak_rss_kb = peak_rss_kb();
+        Report::get().add(std::move(stage));
+    }
+
+private:
+
+    bool active;
+    bool thread_cpu;
+    double cpu_start = 0;
+    Stage stage;
+};
+
+/**
+ * Time spent in a recurring step, such as writing, summed over its calls and
+ * reported as a stage of its own
+ */
+class Accumulator {
+public:
+
+    explicit Accumulator(const std::string& name)
+        : active(Report::get().enabled()) {
+        stage.name = name;
+    }
+
+    template <typename Fn>
+    void time(Fn&& fn) {
+        if (!active) {
+            fn();
+            return;
+        }
+        const double wall_start = Report::get().elapsed();
+        const double cpu_start = cpu_seconds(true);
+        if (calls++ == 0) {
+            stage.start = wall_start;
+        }
+        fn();
+        stage.wall += Report::get().elapsed() - wall_start;
+        stage.cpu += cpu_seconds(true) - cpu_start;
+    }
+
+    void finish() {
+        if (!active) {
+            return;
+        }
+        active = false;
+        stage.counters["calls"] = calls;
+        stage.peak_rss_kb = peak_rss_kb();
+        Report::get().add(std::move(stage));
+    }
+
+private:
+
+    bool active;
+    uint64_t calls = 0;
+    Stage stage;
+};
+
+/**
+ * Count, mean and maximum of a sampled value, such as the depth of a queue
+ */
+struct Samples {
+    uint64_t count = 0;
+    double sum = 0;
+    double max = 0;
+
+    void add(double value) {
+        ++count;
+        sum += value;
+        max = std::max(max, value);
+    }
+
+    void report(StageTimer& timer, const std::string& name) const {
+        timer.count(name + "_mean", count > 0 ? sum / count : 0.0);
+        timer.count(name + "_max", max);
+    }
+};
+
+}
@@ -1,10 +1,23 @@
 #pragma once
 
+#include <fstream>
+#include <iostream>
 #include <string>
 #include <functional>
 #include <cassert>
 #include <unordered_set>
-#include "gzstream.h"
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+#include <htslib/bgzf.h>
 #include <htslib/faidx.h>
 
 namespace seqiter {
@@ -15,11 +28,155 @@ bool fai_index_exists(const std::string& filename) {
   return f.good();
 }
 
-void for_each_seq_in_file(
+// Whether filename is read as it comes, without an index: stdin (even redirected from a file), a pipe or a socket
+bool is_stream(const std::string& filename) {
+  struct stat st;
+  return filename == "/dev/stdin" || (stat(filename.c_str(), &st) == 0 && !S_ISREG(st.st_mode));
+}
+
+/**
+ * Lines of a FASTA/FASTQ file, read by large blocks instead of through
+ * igzstream: an uncompressed file is mapped whole, a compressed one (or a
+ * pipe) is inflated 4 MiB at a time. Lines are split with memchr.
+ * With threads > 1 the input is read through htslib, so that BGZF blocks are
+ * inflated ahead by that many threads; plain gzip is a single deflate stream
+ * and is still inflated on the calling thread.
+ */
+class line_reader {
+public:
+    explicit line_reader(const std::string& filename, int threads = 1) {
+        const int fd = open(filename.c_str(), O_RDONLY);
+        struct stat st;
+        unsigned char magic[2] = {0, 0};
+        if (fd >= 0 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0
+            && pread(fd, magic, 2, 0) == 2 && !(magic[0] == 0x1f && magic[1] == 0x8b)) {
+            void* mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapping != MAP_FAILED) {
+                // Read once front to back
+                madvise(mapping, st.st_size, MADV_SEQUENTIAL);
+                mapped = static_cast<const char*>(mapping);
+                mapped_size = st.st_size;
+                begin = mapped;
+                end = mapped + mapped_size;
+                at_eof = true;
+            }
+        }
+        if (fd >= 0) {
+            close(fd);
+        }
+        if (mapped == nullptr) {
+            if (threads > 1) {
+                bgzf = bgzf_open(filename.c_str(), "r");
+                if (bgzf != nullptr && bgzf_compression(bgzf) == 2) { // BGZF
+                    bgzf_mt(bgzf, threads, 256);
+                }
+            } else {
+                gz = gzopen(filename.c_str(), "rb");
+                if (gz != nullptr) {
+                    gzbuffer(gz, 128 << 10);
+                }
+            }
+            if (gz == nullptr && bgzf == nullptr) {
+                std::cerr << "[wfmash::for_each_seq_in_file] could not open " << filename << std::endl;
+                exit(1);
+            }
+            buffer.resize(block_size);
+            begin = end = buffer.data();
+        }
+    }
+
+    ~line_reader() {
+        if (mapped != nullptr) {
+            munmap(const_cast<char*>(mapped), mapped_size);
+        }
+        if (gz != nullptr) {
+            gzclose(gz);
+        }
+        if (bgzf != nullptr) {
+            bgzf_close(bgzf);
+        }
+    }
+
+    line_reader(const line_reader&) = delete;
+    line_reader& operator=(const line_reader&) = delete;
+
+    /**
+     * The next line, without its newline, in line and length; valid until the
+     * following call. False once the file is over
+     */
+    bool next(const char*& line, size_t& length) {
+        const char* newline;
+        while ((newline = static_cast<const char*>(memchr(begin, '\n', end - begin))) == nullptr) {
+            if (at_eof) {
+                if (begin == end) {
+                    return false;
+                }
+                // Last line, without a newline
+                line = begin;
+                length = end - begin;
+                begin = end;
+                return true;
+            }
+            fill();
+        }
+        line = begin;
+        length = newline - begin;
+        begin = newline + 1;
+        return true;
+    }
+
+private:
+    static const size_t block_size = 4 << 20;
+
+    // Moves the partial line to the front of buffer, growing it if the line fills half of it, and inflates behind it
+    void fill() {
+        const size_t pending = end - begin;
+        if (pending > 0 && begin != buffer.data()) {
+            memmove(buffer.data(), begin, pending);
+        }
+        if (2 * pending > buffer.size()) {
+            buffer.resize(2 * buffer.size());
+        }
+        const int64_t read = (bgzf != nullptr)
+            ? bgzf_read(bgzf, buffer.data() + pending, buffer.size() - pending)
+            : gzread(gz, buffer.data() + pending, buffer.size() - pending);
+        if (read < 0) {
+            std::cerr << "[wfmash::for_each_seq_in_file] could not read the input" << std::endl;
+            exit(1);
+        }
+        at_eof = read == 0;
+        begin = buffer.data();
+        end = buffer.data() + pending + read;
+    }
+
+    const char* mapped = nullptr;
+    size_t mapped_size = 0;
+    gzFile gz = nullptr;
+    BGZF* bgzf = nullptr;
+    std::vector<char> buffer;
+    const char* begin = nullptr;
+    const char* end = nullptr;
+    bool at_eof = false;
+};
+
+// The name of a FASTA/FASTQ record of header line: up to its first space, without the '>' or '@'
+inline std::string record_name(const char* line, size_t length) {
+    const char* space = static_cast<const char*>(memchr(line, ' ', length));
+    return std::string(line + 1, (space != nullptr ? space : line + length) - (line + 1));
+}
+
+/**
+ * Calls func with the name and sequence of each record of filename, in file
+ * order, the sequence being empty for the records not kept by keep_seq and
+ * keep_prefix. Without an index, a BGZF file is inflated by threads threads.
+ * func may take the sequence over, so that it is not copied again
+ */
+void for_each_owned_seq_in_file(
     const std::string& filename,
     const std::unordered_set<std::string>& keep_seq,
     const std::string& keep_prefix,
-    const std::function<void(const std::string&, const std::string&)>& func) {
+    const std::function<void(const std::string&, std::string&&)>& func,
+    int threads = 1) {
 
     if ((!keep_seq.empty() || !keep_prefix.empty())
           && fai_index_exists(filename)) {
@@ -58,68 +215,227 @@ void for_each_seq_in_file(
     } else {
         // no index available
         // detect file type
-        bool input_is_fasta = false;
-        bool input_is_fastq = false;
-        std::string line;
-        igzstream in(filename.c_str());
-        std::getline(in, line);
-        if (line[0] == '>') {
-            input_is_fasta = true;
-        } else if (line[0] == '@') {
-            input_is_fastq = true;
-        } else {
+        line_reader in(filename, threads);
+        const char* line;
+        size_t length;
+        if (!in.next(line, length) || length == 0 || (line[0] != '>' && line[0] != '@')) {
             std::cerr << "[wfmash::for_each_seq_in_file] unknown file format given to seqiter" << std::endl;
             assert(false);
             exit(1);
         }
-        if (input_is_fasta) {
-            while (in.good()) {
-                std::string name = line.substr(1, line.find(" ")-1);
-                std::string seq;
-                bool keep = (keep_prefix.empty() || name.substr(0, keep_prefix.length()) == keep_prefix)
-                    && (keep_seq.empty() || keep_seq.find(name) != keep_seq.end());
-                while (std::getline(in, line)) {
-                    if (line[0] == '>') {
-                        // this is the header of the next sequence
-                        break;
-                    } else {
-                        if (keep) {
-                            seq.append(line);
-                        }
+        const bool input_is_fasta = line[0] == '>';
+        // Reused from a sequence to the next unless func takes it, so that it is only grown for the longest one
+        std::string seq;
+        bool more = true;
+        while (more) {
+            const std::string name = record_name(line, length);
+            const bool keep = (keep_prefix.empty() || name.substr(0, keep_prefix.length()) == keep_prefix)
+                && (keep_seq.empty() || keep_seq.find(name) != keep_seq.end());
+            seq.clear();
+            if (input_is_fasta) {
+                while ((more = in.next(line, length)) && (length == 0 || line[0] != '>')) {
+                    if (keep) {
+                        seq.append(line, length);
                     }
                 }
-                func(name, seq);
+            } else {
+                if (in.next(line, length) && keep) {
+                    seq.assign(line, length); // sequence
+                }
+                in.next(line, length); // delimiter
+                in.next(line, length); // quality
+                more = in.next(line, length); // next header
             }
-        } else if (input_is_fastq) {
-            while (in.good()) {
-                std::string name = line.substr(1, line.find(" ")-1);
+            func(name, std::move(seq));
+        }
+    }
+}
+
+void for_each_seq_in_file(
+    const std::string& filename,
+    const std::unordered_set<std::string>& keep_seq,
+    const std::string& keep_prefix,
+    const std::function<void(const std::string&, const std::string&)>& func,
+    int threads = 1) {
+    for_each_owned_seq_in_file(filename, keep_seq, keep_prefix,
+        [&](const std::string& name, std::string&& seq) { func(name, seq); }, threads);
+}
+
+/**
+ * Same as for_each_seq_in_file, but when a .fai (and for bgzipped input a .gzi)
+ * index exists, sequences are fetched independently by `threads` readers, each
+ * decompressing its own BGZF blocks. func is still called on the calling thread,
+ * in file order, with at most 2 * threads fetched sequences held ahead of it.
+ * Without an index, the threads inflate the BGZF blocks of the file instead.
+ * func may take the sequence over.
+ */
+void for_each_owned_seq_in_file_parallel(
+    const std::string& filename,
+    const std::unordered_set<std::string>& keep_seq,
+    const std::string& keep_prefix,
+    int threads,
+    const std::function<void(const std::string&, std::string&&)>& func) {
+
+    if (threads <= 1 || !fai_index_exists(filename)) {
+        for_each_owned_seq_in_file(filename, keep_seq, keep_prefix, func, threads);
+        return;
+    }
+
+    std::vector<std::string> names;
+    std::vector<char> keep;
+    {
+        std::string line;
+        std::ifstream in(filename + ".fai");
+        while (std::getline(in, line)) {
+            std::string name = line.substr(0, line.find("\t"));
+            keep.push_back((keep_prefix.empty() && keep_seq.empty())
+                || (!keep_prefix.empty() && strncmp(name.c_str(), keep_prefix.c_str(), keep_prefix.size()) == 0)
+                || keep_seq.find(name) != keep_seq.end());
+            names.push_back(std::move(name));
+        }
+    }
+
+    const size_t window = 2 * threads;
+    std::vector<std::string> seqs(names.size());
+    std::vector<char> ready(names.size(), 0);
+    std::atomic<size_t> next_seq(0);
+    size_t consumed = 0;
+    std::mutex mutex;
+    std::condition_variable cv;
+
+    std::vector<std::thread> readers;
+    for (int t = 0; t < threads; ++t) {
+        readers.emplace_back([&]() {
+            faidx_t* faid = fai_load(filename.c_str());
+            if (faid == nullptr) {
+                std::cerr << "[wfmash::for_each_seq_in_file_parallel] could not load the index of " << filename << std::endl;
+                exit(1);
+            }
+            for (size_t i = next_seq++; i < names.size(); i = next_seq++) {
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    cv.wait(lock, [&]() { return i < consumed + window; });
+                }
                 std::string seq;
-                bool keep = (keep_prefix.empty() || name.substr(0, keep_prefix.length()) == keep_prefix)
-                    && (keep_seq.empty() || keep_seq.find(name) != keep_seq.end());
-                std::getline(in, seq); // sequence
-                std::getline(in, line); // delimiter
-                std::getline(in, line); // quality
-                std::getline(in, line); // next header
-                func(name, keep ? seq : "");
+                if (keep[i]) {
+                    int64_t len = 0;
+                    char* fetched = faidx_fetch_seq64(faid, names[i].c_str(), 0, INT_MAX, &len);
+                    if (fetched == nullptr || len < 0) {
+                        std::cerr << "[wfmash::for_each_seq_in_file_parallel] could not fetch " << names[i] << " from index" << std::endl;
+                        exit(1);
+                    }
+                    seq.assign(fetched, len);
+                    free(fetched);
+                }
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    seqs[i] = std::move(seq);
+                    ready[i] = 1;
+                }
+                cv.notify_all();
             }
+            fai_destroy(faid);
+        });
+    }
+
+    for (size_t i = 0; i < names.size(); ++i) {
+        std::string seq;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cv.wait(lock, [&]() { return ready[i] != 0; });
+            seq = std::move(seqs[i]);
+            consumed = i + 1;
+        }
+        cv.notify_all();
+        func(names[i], std::move(seq));
+    }
+
+    for (auto& reader : readers) {
+        reader.join();
+    }
+
+    const std::unordered_set<std::string> found_seq(names.begin(), names.end());
+    for (const auto& name : keep_seq) {
+        if (found_seq.find(name) == found_seq.end()) {
+            std::cerr << "[wfmash::for_each_seq_in_file] could not fetch " << name << " from index" << std::endl;
         }
     }
 }
 
-void for_each_seq_in_file(
+void for_each_seq_in_file_parallel(
+    const std::string& filename,
+    const std::unordered_set<std::string>& keep_seq,
+    const std::string& keep_prefix,
+    int threads,
+    const std::function<void(const std::string&, const std::string&)>& func) {
+    for_each_owned_seq_in_file_parallel(filename, keep_seq, keep_prefix, threads,
+        [&](const std::string& name, std::string&& seq) { func(name, seq); });
+}
+
+// The sequences of seq_names fetched from fai, in that order; func may take them over
+void for_each_owned_seq_in_file(
     faidx_t* fai,
     const std::vector<std::string>& seq_names,
-    const std::function<void(const std::string&, const std::string&)>& func) {
+    const std::function<void(const std::string&, std::string&&)>& func) {
     for (const auto& seq_name : seq_names) {
         int len;
         char* seq = fai_fetch(fai, seq_name.c_str(), &len);
         if (seq != nullptr) {
-            func(seq_name, std::string(seq));
+            std::string owned(seq, len);
             free(seq);
+            func(seq_name, std::move(owned));
         }
     }
 }
+
+void for_each_seq_in_file(
+    faidx_t* fai,
+    const std::vector<std::string>& seq_names,
+    const std::function<void(const std::string&, const std::string&)>& func) {
+    for_each_owned_seq_in_file(fai, seq_names,
+        [&](const std::string& name, std::string&& seq) { func(name, seq); });
+}
 	
+/**
+ * Whether seq_name starts with one of query_prefix and is in query_list, each
+ * filter applying only if not empty
+ */
+bool keep_seq_name(
+    const char* seq_name,
+    const std::vector<std::string>& query_prefix,
+    const std::unordered_set<std::string>& query_list) {
+    bool prefix_skip = true;
+    for (const auto& prefix : query_prefix) {
+        if (strncmp(seq_name, prefix.c_str(), prefix.size()) == 0) {
+            prefix_skip = false;
+            break;
+        }
+    }
+    if (!query_prefix.empty() && prefix_skip) {
+        return false;
+    }
+    return query_list.empty() || query_list.count(seq_name) != 0;
+}
+
+/**
+ * Names of the sequences of the index, in file order, that start with one of
+ * query_prefix and are in query_list, each filter applying only if not empty
+ */
+std::vector<std::string> filtered_seq_names(
+    faidx_t* fai,
+    const std::vector<std::string>& query_prefix,
+    const std::unordered_set<std::string>& query_list) {
+    std::vector<std::string> query_seq_names;
+    int num_seqs = faidx_nseq(fai);
+    for (int i = 0; i < num_seqs; i++) {
+        const char* seq_name = faidx_iseq(fai, i);
+        if (keep_seq_name(seq_name, query_prefix, query_list)) {
+            query_seq_names.push_back(seq_name);
+        }
+    }
+    return query_seq_names;
+}
+
 void for_each_seq_in_file_filtered(
     const std::string& filename,
     const std::vector<std::string>& query_prefix,
@@ -131,25 +447,7 @@ void for_each_seq_in_file_filtered(
         return;
     }
 
-    std::vector<std::string> query_seq_names;
-    int num_seqs = faidx_nseq(fai);
-    for (int i = 0; i < num_seqs; i++) {
-        const char* seq_name = faidx_iseq(fai, i);
-		bool prefix_skip = true;
-		for (const auto& prefix : query_prefix) {
-			if (strncmp(seq_name, prefix.c_str(), prefix.size()) == 0) {
-				prefix_skip = false;
-				break;
-			}
-		}
-		if (!query_prefix.empty() && prefix_skip) {
-            continue;
-        }
-        if (!query_list.empty() && query_list.count(seq_name) == 0) {
-            continue;
-        }
-        query_seq_names.push_back(seq_name);
-    }
+    const std::vector<std::string> query_seq_names = filtered_seq_names(fai, query_prefix, query_list);
 
     for_each_seq_in_file(
         fai,
@@ -0,0 +1,319 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <pthread.h>
+#include <sched.h>
+
+/**
+ * Work-stealing task executor
+ *
+ * Each worker thread keeps a deque of tasks. A worker runs its own tasks
+ * newest first and, once it has none left, steals the oldest task of
+ * another worker, so that nested tasks stay on the thread that made them
+ * while the load is still balanced. Tasks submitted from outside of the
+ * workers go to a shared queue, and idle workers sleep until a task is
+ * submitted.
+ *
+ * A thread waiting on a TaskGroup runs queued tasks meanwhile, so that
+ * tasks can wait on tasks of their own.
+ *
+ * The mapping and the alignment stage each have an executor of their own,
+ * so that each keeps to its thread count when they overlap.
+ */
+
+namespace tasks {
+
+class Executor {
+public:
+
+    using Task = std::function<void()>;
+
+    /**
+     * Worker i is pinned to cpus[i % cpus.size()], unless cpus is empty
+     */
+    explicit Executor(int threads, const std::vector<int>& cpus = {})
+        : numWorkers(std::max(1, threads))
+        , queues(new Queue[numWorkers]) {
+        for (int i = 0; i < numWorkers; ++i) {
+            workers.emplace_back([this, i]() { work(i); });
+            if (!cpus.empty()) {
+                cpu_set_t set;
+                CPU_ZERO(&set);
+                CPU_SET(cpus[i % cpus.size()], &set);
+                pthread_setaffinity_np(workers.back().native_handle(), sizeof(set), &set);
+            }
+        }
+    }
+
+    Executor(const Executor&) = delete;
+    Executor& operator=(const Executor&) = delete;
+
+    ~Executor() {
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& w : workers) {
+            w.join();
+        }
+    }
+
+    int size() const {
+        return numWorkers;
+    }
+
+    /**
+     * Workers running a task rather than waiting for one, and tasks waiting for a worker
+     */
+    int busy() const {
+        return numWorkers - sleeping.load(std::memory_order_relaxed);
+    }
+
+    int64_t queuedTasks() const {
+        return std::max<int64_t>(0, queued.load(std::memory_order_relaxed));
+    }
+
+    /**
+     * Index of the calling thread among the workers, or size() if it's not one of them
+     */
+    int workerIndex() const {
+        return current == this ? currentIndex : numWorkers;
+    }
+
+    void submit(Task task) {
+        const int self = current == this ? currentIndex : -1;
+        Queue& q = self >= 0 ? queues[self] : injected;
+        {
+            std::lock_guard<std::mutex> lock(q.mutex);
+            q.tasks.push_back(std::move(task));
+        }
+        queued.fetch_add(1);
+        if (sleeping.load() > 0) {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            wake.notify_one();
+        }
+    }
+
+    /**
+     * Run one queued task on the calling thread, false if there was none
+     */
+    bool tryRun() {
+        Task task;
+        if (!take(task)) {
+            return false;
+        }
+        task();
+        return true;
+    }
+
+private:
+
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    const int numWorkers;
+    std::unique_ptr<Queue[]> queues;
+    Queue injected;
+    std::vector<std::thread> workers;
+
+    std::atomic<int64_t> queued{0};     // tasks in all the queues
+    std::atomic<int> sleeping{0};
+    std::mutex sleepMutex;
+    std::condition_variable wake;
+    bool stopping = false;
+
+    static inline thread_local const Executor* current = nullptr;
+    static inline thread_local int currentIndex = -1;
+
+    static bool popBack(Queue& q, Task& task) {
+        std::lock_guard<std::mutex> lock(q.mutex);
+        if (q.tasks.empty()) {
+            return false;
+        }
+        task = std::move(q.tasks.back());
+        q.tasks.pop_back();
+        return true;
+    }
+
+    static bool popFront(Queue& q, Task& task) {
+        std::lock_guard<std::mutex> lock(q.mutex);
+        if (q.tasks.empty()) {
+            return false;
+        }
+        task = std::move(q.tasks.front());
+        q.tasks.pop_front();
+        return true;
+    }
+
+    bool take(Task& task) {
+        if (queued.load(std::memory_order_relaxed) <= 0) {
+            return false;
+        }
+        const int self = current == this ? currentIndex : -1;
+        bool found = (self >= 0 && popBack(queues[self], task)) || popFront(injected, task);
+        for (int i = 1; !found && i <= numWorkers; ++i) {
+            const int victim = (self + i + numWorkers) % numWorkers;
+            found = victim != self && popFront(queues[victim], task);
+        }
+        if (found) {
+            queued.fetch_sub(1);
+        }
+        return found;
+    }
+
+    void work(int index) {
+        current = this;
+        currentIndex = index;
+        while (true) {
+            if (tryRun()) {
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(sleepMutex);
+            sleeping.fetch_add(1);
+            wake.wait(lock, [this]() { return stopping || queued.load() > 0; });
+            sleeping.fetch_sub(1);
+            if (stopping) {
+                return;
+            }
+        }
+    }
+};
+
+enum class Stage { Map, Align };
+
+/**
+ * CPUs the workers of the executor of a stage are pinned to, none to not pin
+ * them, to set before its first use
+ */
+inline std::vector<int>& stageCpus(Stage stage) {
+    static std::vector<int> cpus[2];
+    return cpus[static_cast<int>(stage)];
+}
+
+/**
+ * CPUs the process may run on, in order
+ */
+inline std::vector<int> allowedCpus() {
+    std::vector<int> cpus;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+            if (CPU_ISSET(cpu, &set)) {
+                cpus.push_back(cpu);
+            }
+        }
+    }
+    return cpus;
+}
+
+/**
+ * Executor of a stage, null until its first use
+ */
+inline std::atomic<Executor*>& stageExecutor(Stage stage) {
+    // never destroyed, as a worker may be the thread that exits the process
+    static std::atomic<Executor*> executors[2] = {{nullptr}, {nullptr}};
+    return executors[static_cast<int>(stage)];
+}
+
+/**
+ * Executor shared by all the tasks of a stage, made by the first call with
+ * the thread count of the stage
+ */
+inline Executor& sharedExecutor(int threads, Stage stage = Stage::Map) {
+    static std::mutex mutex;
+    std::lock_guard<std::mutex> lock(mutex);
+    std::atomic<Executor*>& executor = stageExecutor(stage);
+    if (executor.load() == nullptr) {
+        executor.store(new Executor(threads, stageCpus(stage)));
+    }
+    return *executor.load();
+}
+
+/**
+ * Tasks that can be waited on together
+ */
+class TaskGroup {
+public:
+
+    explicit TaskGroup(Executor& executor)
+        : executor(executor) {}
+
+    TaskGroup(const TaskGroup&) = delete;
+    TaskGroup& operator=(const TaskGroup&) = delete;
+
+    ~TaskGroup() {
+        wait();
+    }
+
+    void run(Executor::Task task) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            ++pending;
+        }
+        executor.submit([this, task = std::move(task)]() {
+            task();
+            std::lock_guard<std::mutex> lock(mutex);
+            --pending;
+            ++completed;
+            finished.notify_all();
+        });
+    }
+
+    void wait() {
+        waitUntil([this]() { return pending == 0; });
+    }
+
+    /**
+     * Run queued tasks until the predicate holds, it is checked with the group
+     * locked each time a task of the group finishes
+     */
+    template <typename Pred>
+    void waitUntil(Pred ready) {
+        while (true) {
+            uint64_t seen;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (ready()) {
+                    return;
+                }
+                seen = completed;
+            }
+            if (executor.tryRun()) {
+                continue;
+            }
+            // nothing left to run here, the tasks of the group are running elsewhere
+            std::unique_lock<std::mutex> lock(mutex);
+            finished.wait(lock, [&]() { return completed != seen || pending == 0; });
+        }
+    }
+
+    /**
+     * Tasks of the group not done yet, only to be read from a predicate of waitUntil
+     */
+    size_t unfinished() const {
+        return pending;
+    }
+
+private:
+
+    Executor& executor;
+    std::mutex mutex;
+    std::condition_variable finished;
+    size_t pending = 0;
+    uint64_t completed = 0;
+};
+
+}
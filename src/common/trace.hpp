@@ -0,0 +1,174 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * Timeline of the work of each thread, written with --trace as Chrome trace
+ * events in JSON, which Perfetto and chrome://tracing load: a span for each
+ * query mapped, and for the fetch, alignment (with its wflambda, patching and
+ * output steps) and writing of each record. Gaps in the rows of the workers
+ * show queue starvation, long spans the stragglers that hold a stage up.
+ *
+ * Spans are kept by each thread in a buffer of its own, and only written once
+ * the process exits; when no trace is asked for, a span is a load and a test.
+ */
+namespace trace {
+
+struct Event {
+    const char* name;
+    std::string detail;
+    int64_t begin_ns;
+    int64_t duration_ns;
+};
+
+struct ThreadEvents {
+    int tid;
+    std::mutex mutex;   // only contended by the final write
+    std::vector<Event> events;
+};
+
+class Trace {
+public:
+
+    bool enabled() const {
+        return on.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Traces the run to path, once the process exits
+     */
+    void open(const std::string& file) {
+        path = file;
+        on.store(true, std::memory_order_relaxed);
+        std::atexit([]() { get().write(); });
+    }
+
+    int64_t now_ns() const {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count();
+    }
+
+    ThreadEvents& local() {
+        thread_local ThreadEvents* events = make_thread();
+        return *events;
+    }
+
+    void write() {
+        if (path.empty()) {
+            return;
+        }
+        on.store(false, std::memory_order_relaxed);
+        std::ofstream out(path);
+        out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+        bool first = true;
+        char times[64];
+        std::lock_guard<std::mutex> lock(mutex);
+        for (ThreadEvents* thread : threads) {
+            std::lock_guard<std::mutex> thread_lock(thread->mutex);
+            for (const Event& e : thread->events) {
+                std::snprintf(times, sizeof(times), "%.3f, \"dur\": %.3f", e.begin_ns / 1e3, e.duration_ns / 1e3);
+                out << (first ? "\n" : ",\n")
+                    << "{\"name\": \"" << e.name << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << thread->tid
+                    << ", \"ts\": " << times;
+                if (!e.detail.empty()) {
+                    out << ", \"args\": {\"detail\": \"" << escape(e.detail) << "\"}";
+                }
+                out << "}";
+                first = false;
+            }
+        }
+        out << "\n]}\n";
+        if (!out) {
+            std::fprintf(stderr, "[wfmash] WARNING, failed to write the trace %s\n", path.c_str());
+        }
+    }
+
+    static Trace& get() {
+        static Trace trace;
+        return trace;
+    }
+
+private:
+
+    ThreadEvents* make_thread() {
+        std::lock_guard<std::mutex> lock(mutex);
+        threads.push_back(new ThreadEvents());
+        threads.back()->tid = threads.size();
+        return threads.back();
+    }
+
+    static std::string escape(const std::string& s) {
+        std::string escaped;
+        for (char c : s) {
+            if (c == '"' || c == '\\') {
+                escaped += '\\';
+            }
+            if (static_cast<unsigned char>(c) >= 0x20) {
+                escaped += c;
+            }
+        }
+        return escaped;
+    }
+
+    std::string path;
+    std::atomic<bool> on{false};
+    const std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+    std::mutex mutex;
+    std::vector<ThreadEvents*> threads;
+};
+
+/**
+ * A span of the calling thread, from its construction to end(), or its
+ * destruction. name must outlive the process, as literals do
+ */
+class Span {
+public:
+
+    explicit Span(const char* name)
+        : active(Trace::get().enabled()), name(name) {
+        if (active) {
+            begin_ns = Trace::get().now_ns();
+        }
+    }
+
+    Span(const char* name, const std::string& detail)
+        : Span(name) {
+        if (active) {
+            this->detail = detail;
+        }
+    }
+
+    Span(const Span&) = delete;
+    Span& operator=(const Span&) = delete;
+
+    ~Span() {
+        end();
+    }
+
+    void end() {
+        if (!active) {
+            return;
+        }
+        active = false;
+        const int64_t end_ns = Trace::get().now_ns();
+        ThreadEvents& thread = Trace::get().local();
+        std::lock_guard<std::mutex> lock(thread.mutex);
+        thread.events.push_back(Event{name, std::move(detail), begin_ns, end_ns - begin_ns});
+    }
+
+private:
+
+    bool active;
+    const char* name;
+    std::string detail;
+    int64_t begin_ns = 0;
+};
+
+}
@@ -104,6 +104,18 @@ WFAligner::AlignmentStatus WFAligner::alignEnd2End(
   return (WFAligner::AlignmentStatus) wavefront_align_lambda(
       wfAligner,matchFunct,matchFunctArguments,patternLength,textLength);
 }
+WFAligner::AlignmentStatus WFAligner::alignEnd2End(
+    int (*matchFunct)(int,int,void*),
+    void (*matchBatchFunct)(int,const int*,const int*,int*,void*),
+    void* matchFunctArguments,
+    const int patternLength,
+    const int textLength) {
+  // Configure
+  wavefront_aligner_set_alignment_end_to_end(wfAligner);
+  // Align (using custom matching functions)
+  return (WFAligner::AlignmentStatus) wavefront_align_lambda_batch(
+      wfAligner,matchFunct,matchBatchFunct,matchFunctArguments,patternLength,textLength);
+}
 /*
  * Align Ends-free
  */
@@ -276,6 +288,22 @@ void WFAligner::setMaxNumThreads(
     const int maxNumThreads) {
   wavefront_aligner_set_max_num_threads(wfAligner, maxNumThreads);
 }
+/*
+ * Statistics
+ */
+void WFAligner::setCollectStats(
+    const bool collectStats) {
+  wavefront_aligner_set_collect_stats(wfAligner,collectStats);
+}
+const wavefront_stats_t& WFAligner::getStats() {
+  return wfAligner->stats;
+}
+void WFAligner::clearStats() {
+  wavefront_aligner_clear_stats(wfAligner);
+}
+uint64_t WFAligner::getMemoryUsed() {
+  return wavefront_aligner_get_size(wfAligner);
+}
 /*
  * Accessors
  */
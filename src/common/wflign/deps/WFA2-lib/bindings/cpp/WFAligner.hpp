@@ -85,6 +85,12 @@ public:
       void* matchFunctArguments,
       const int patternLength,
       const int textLength);
+  AlignmentStatus alignEnd2End( // Lambda Sequence (extended over batches of cells)
+      int (*matchFunct)(int,int,void*),
+      void (*matchBatchFunct)(int,const int*,const int*,int*,void*),
+      void* matchFunctArguments,
+      const int patternLength,
+      const int textLength);
   // Align Ends-free
   AlignmentStatus alignEndsFree( // Regular ASCII Sequences
       const char* const pattern,
@@ -171,6 +177,13 @@ public:
   // Parallelization
   void setMaxNumThreads(
       const int maxNumThreads);
+  // Statistics (gathered over the alignments until cleared)
+  void setCollectStats(
+      const bool collectStats);
+  const wavefront_stats_t& getStats();
+  void clearStats();
+  // Memory kept by the aligner (wavefront slab and backtrace buffer)
+  uint64_t getMemoryUsed();
   // Accessors
   int getAlignmentStatus();
   int getAlignmentScore();
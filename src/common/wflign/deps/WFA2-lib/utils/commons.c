@@ -48,6 +48,38 @@ uint64_t rand_iid(
     return rand_iid(min,max);
   }
 }
+/*
+ * CPU features
+ */
+#if CPU_AVX512_DISPATCH
+bool cpu_supports_avx512(void) {
+  static int supported = -1;
+  if (supported < 0) {
+    __builtin_cpu_init();
+    supported = getenv("WFA_NO_AVX512") == NULL &&
+                __builtin_cpu_supports("avx512f") &&
+                __builtin_cpu_supports("avx512bw") &&
+                __builtin_cpu_supports("avx512cd") &&
+                __builtin_cpu_supports("avx512dq") &&
+                __builtin_cpu_supports("avx512vl");
+  }
+  return supported;
+}
+#endif
+#if CPU_AVX2_DISPATCH
+bool cpu_supports_avx2(void) {
+  static int supported = -1;
+  if (supported < 0) {
+    __builtin_cpu_init();
+    supported = getenv("WFA_NO_AVX2") == NULL &&
+                __builtin_cpu_supports("avx2") &&
+                __builtin_cpu_supports("bmi") &&
+                __builtin_cpu_supports("bmi2") &&
+                __builtin_cpu_supports("popcnt");
+  }
+  return supported;
+}
+#endif
 /*
  * Math
  */
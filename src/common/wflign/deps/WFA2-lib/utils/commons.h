@@ -259,6 +259,39 @@ uint64_t nominal_prop_u64(const uint64_t base,const double factor);
   #define PRAGMA_LOOP_VECTORIZE _Pragma("ivdep")
 #endif
 
+/*
+ * AVX512 (16 x 32-bit lanes) versions of kernels, built on any x86-64
+ * target and only to be called where the CPU supports them. Setting
+ * WFA_NO_AVX512 in the environment keeps to the others (e.g. to compare
+ * both with align_benchmark)
+ */
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+  #define CPU_AVX512_DISPATCH 1
+  #if defined(__clang__)
+    #define CPU_AVX512_TARGET __attribute__((target("avx512f,avx512bw,avx512cd,avx512dq,avx512vl")))
+  #else
+    #define CPU_AVX512_TARGET __attribute__((target("avx512f,avx512bw,avx512cd,avx512dq,avx512vl,prefer-vector-width=512")))
+  #endif
+bool cpu_supports_avx512(void);
+#else
+  #define CPU_AVX512_DISPATCH 0
+#endif
+
+/*
+ * AVX2 versions of kernels, for builds below x86-64-v3 (e.g. the Generic
+ * build type) that may still run on CPUs with AVX2. Builds for AVX2 and up
+ * call them directly. Setting WFA_NO_AVX2 in the environment keeps to the
+ * scalar ones
+ */
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__)) && !__AVX2__
+  #define CPU_AVX2_DISPATCH 1
+  #define CPU_AVX2_TARGET __attribute__((target("avx2,bmi,bmi2,lzcnt,popcnt")))
+bool cpu_supports_avx2(void);
+#else
+  #define CPU_AVX2_DISPATCH 0
+  #define CPU_AVX2_TARGET
+#endif
+
 /*
  * Popcount macros
  */
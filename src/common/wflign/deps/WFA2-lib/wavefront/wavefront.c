@@ -101,6 +101,8 @@ void wavefront_init(
     wavefront->bt_pcigar = wavefront->bt_pcigar_mem - min_lo; // Center at k=0
     wavefront->bt_prev = wavefront->bt_prev_mem - min_lo; // Center at k=0
   }
+  // Heuristic
+  wavefront->heuristic_min_distance = -1;
   // Internals
   wavefront->wf_elements_allocated_min = min_lo;
   wavefront->wf_elements_allocated_max = max_hi;
@@ -132,6 +134,8 @@ void wavefront_init_null(
     memset(wavefront->bt_pcigar_mem,0,wf_elements*sizeof(pcigar_t));
     memset(wavefront->bt_prev_mem,0,wf_elements*sizeof(bt_block_idx_t));
   }
+  // Heuristic
+  wavefront->heuristic_min_distance = -1;
   // Internals
   wavefront->wf_elements_allocated_min = min_lo;
   wavefront->wf_elements_allocated_max = max_hi;
@@ -67,6 +67,8 @@ typedef struct {
   bt_block_idx_t* bt_prev;             // Backtrace-block previous-index (k-centered)
   pcigar_t* bt_pcigar_mem;             // Backtrace-block (base memory - Internal)
   bt_block_idx_t* bt_prev_mem;         // Backtrace-block previous-index (base memory - Internal)
+  // Heuristic
+  int heuristic_min_distance;          // Min. WFmash-distance tracked at extension (-1 if not tracked)
   // Slab internals
   wavefront_status_type status;        // Wavefront status (memory state)
   int wf_elements_allocated;           // Total wf-elements allocated (max. wf. size)
@@ -109,6 +109,7 @@ void wavefront_align_unidirectional_cleanup(
   // Compute memory used
   uint64_t memory_used = wavefront_aligner_get_size(wf_aligner);
   wf_aligner->align_status.memory_used = memory_used;
+  wavefront_stats_end_alignment(wf_aligner,memory_used);
   // Reap memory (controlled reaping)
   if (memory_used > wf_aligner->system.max_memory_resident) {
     // Wavefront components
@@ -143,6 +144,7 @@ void wavefront_align_bidirectional(
   wavefront_bialign(wf_aligner); // Align
   // Finish
   wf_aligner->align_status.memory_used = wavefront_aligner_get_size(wf_aligner);
+  wavefront_stats_end_alignment(wf_aligner,wf_aligner->align_status.memory_used);
 }
 /*
  * Wavefront Alignment Dispatcher
@@ -153,6 +155,17 @@ int wavefront_align_lambda(
     void* match_funct_arguments,
     const int pattern_length,
     const int text_length) {
+  return wavefront_align_lambda_batch(wf_aligner,
+      match_funct,NULL,match_funct_arguments,
+      pattern_length,text_length);
+}
+int wavefront_align_lambda_batch(
+    wavefront_aligner_t* const wf_aligner,
+    alignment_match_funct_t match_funct,
+    alignment_match_batch_funct_t match_batch_funct,
+    void* match_funct_arguments,
+    const int pattern_length,
+    const int text_length) {
   // Checks
   wavefront_align_presets__checks(wf_aligner,pattern_length,text_length);
   wavefront_debug_begin(wf_aligner);
@@ -164,12 +177,16 @@ int wavefront_align_lambda(
     wavefront_sequences_init_lambda(&wf_aligner->sequences,
         match_funct,match_funct_arguments,
         pattern_length,text_length,false);
+    wavefront_sequences_set_match_batch(&wf_aligner->sequences,match_batch_funct);
     wavefront_align_unidirectional(wf_aligner);
   } else {
     // Prepare Sequences
     wavefront_bialigner_set_sequences_lambda(wf_aligner->bialigner,
         match_funct,match_funct_arguments,
         pattern_length,text_length);
+    wavefront_sequences_set_match_batch(&wf_aligner->bialigner->wf_forward->sequences,match_batch_funct);
+    wavefront_sequences_set_match_batch(&wf_aligner->bialigner->wf_reverse->sequences,match_batch_funct);
+    wavefront_sequences_set_match_batch(&wf_aligner->bialigner->wf_base->sequences,match_batch_funct);
     // Align
     wavefront_align_bidirectional(wf_aligner);
   }
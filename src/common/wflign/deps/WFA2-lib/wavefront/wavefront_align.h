@@ -48,6 +48,13 @@ int wavefront_align_lambda(
     void* match_funct_arguments,
     const int pattern_length,
     const int text_length);
+int wavefront_align_lambda_batch(
+    wavefront_aligner_t* const wf_aligner,
+    alignment_match_funct_t const match_funct,
+    alignment_match_batch_funct_t const match_batch_funct,
+    void* match_funct_arguments,
+    const int pattern_length,
+    const int text_length);
 int wavefront_align_packed2bits(
     wavefront_aligner_t* const wf_aligner,
     const uint8_t* const pattern,
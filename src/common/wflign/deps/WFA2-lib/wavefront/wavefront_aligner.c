@@ -458,6 +458,7 @@ wavefront_aligner_t* wavefront_aligner_new(
   wf_aligner->cigar = cigar_new(cigar_length);
   // System
   wf_aligner->system = attributes->system;
+  wavefront_stats_clear(&wf_aligner->stats);
   // Return
   return wf_aligner;
 }
@@ -640,6 +641,22 @@ void wavefront_aligner_set_min_offsets_per_thread(
         wf_aligner->bialigner,min_offsets_per_thread);
   }
 }
+/*
+ * Statistics
+ */
+void wavefront_aligner_set_collect_stats(
+    wavefront_aligner_t* const wf_aligner,
+    const bool collect_stats) {
+  wf_aligner->system.collect_stats = collect_stats;
+  if (wf_aligner->bialigner != NULL) {
+    wavefront_bialigner_set_collect_stats(
+        wf_aligner->bialigner,collect_stats);
+  }
+}
+void wavefront_aligner_clear_stats(
+    wavefront_aligner_t* const wf_aligner) {
+  wavefront_stats_clear(&wf_aligner->stats);
+}
 /*
  * Utils
  */
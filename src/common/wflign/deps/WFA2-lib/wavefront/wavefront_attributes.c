@@ -94,6 +94,7 @@ wavefront_aligner_attr_t wavefront_aligner_attr_default = {
         .max_memory_abort = UINT64_MAX, // Unlimited
         .verbose = 0, // Quiet
         .check_alignment_correct = false,
+        .collect_stats = false,
         .max_num_threads = 1,           // Single thread by default
         .min_offsets_per_thread = 500   // Minimum WF-length to spawn a thread
     },
@@ -93,6 +93,7 @@ typedef struct {
   bool check_alignment_correct;  // Verify that the alignment CIGAR output is correct
   // Profile
   profiler_timer_t timer;        // Time alignment
+  bool collect_stats;            // Gather the statistics of the alignments (wavefront_stats_t)
   // OS
   int max_num_threads;           // Maximum number of threads to use to compute/extend WFs
   int min_offsets_per_thread;    // Minimum amount of offsets to spawn a thread
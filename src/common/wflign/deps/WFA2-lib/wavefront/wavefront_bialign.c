@@ -42,12 +42,15 @@
 #include "wavefront_plot.h"
 #include "wavefront_debug.h"
 
+#include <pthread.h>
+
 /*
  * Config
  */
 #define WF_BIALIGN_FALLBACK_MIN_SCORE  250
 #define WF_BIALIGN_FALLBACK_MIN_LENGTH 100
 #define WF_BIALIGN_RECOVERY_MIN_SCORE  500
+#define WF_BIALIGN_PARALLEL_MIN_LENGTH 10000
 
 /*
  * Debug
@@ -426,11 +429,16 @@ int wavefront_bialign_find_breakpoint(
   const int max_antidiagonal = DPMATRIX_ANTIDIAGONAL(pattern_length,text_length) - 1; // Note: Even removing -1
   int score_forward = 0, score_reverse = 0, forward_max_ak = 0, reverse_max_ak = 0;
   bool reachability_quit;
+  uint64_t stats_begin_ns;
   // Prepare and perform first bialignment step
   breakpoint->score = INT_MAX;
+  stats_begin_ns = wavefront_stats_begin(wf_forward);
   reachability_quit = wavefront_extend_end2end_max(wf_forward,score_forward,&forward_max_ak);
+  wavefront_stats_end_extend(wf_forward,stats_begin_ns);
   if (reachability_quit) return wf_forward->align_status.status;
+  stats_begin_ns = wavefront_stats_begin(wf_reverse);
   reachability_quit = wavefront_extend_end2end_max(wf_reverse,score_reverse,&reverse_max_ak);
+  wavefront_stats_end_extend(wf_reverse,stats_begin_ns);
   if (reachability_quit) return wf_reverse->align_status.status;
   // Compute wavefronts of increasing score until both wavefronts overlap
   int max_ak = 0;
@@ -442,10 +450,14 @@ int wavefront_bialign_find_breakpoint(
      * Compute next wavefront (Forward)
      */
     ++score_forward;
+    stats_begin_ns = wavefront_stats_begin(wf_forward);
     (*wf_align_compute)(wf_forward,score_forward);
+    wavefront_stats_end_compute(wf_forward,score_forward,stats_begin_ns);
     if (plot_enabled) wavefront_plot(wf_forward,score_forward,align_level); // Plot
     // Extend
+    stats_begin_ns = wavefront_stats_begin(wf_forward);
     reachability_quit = wavefront_extend_end2end_max(wf_forward,score_forward,&max_ak);
+    wavefront_stats_end_extend(wf_forward,stats_begin_ns);
     if (forward_max_ak < max_ak) forward_max_ak = max_ak;
     last_wf_forward = true;
     // Check end-reached and close-to-collision
@@ -455,10 +467,14 @@ int wavefront_bialign_find_breakpoint(
      * Compute next wavefront (Reverse)
      */
     ++score_reverse;
+    stats_begin_ns = wavefront_stats_begin(wf_reverse);
     (*wf_align_compute)(wf_reverse,score_reverse);
+    wavefront_stats_end_compute(wf_reverse,score_reverse,stats_begin_ns);
     if (plot_enabled) wavefront_plot(wf_reverse,score_reverse,align_level); // Plot
     // Extend
+    stats_begin_ns = wavefront_stats_begin(wf_reverse);
     reachability_quit = wavefront_extend_end2end_max(wf_reverse,score_reverse,&max_ak);
+    wavefront_stats_end_extend(wf_reverse,stats_begin_ns);
     if (reverse_max_ak < max_ak) reverse_max_ak = max_ak;
     last_wf_forward = false;
     // Check end-reached and max-steps-reached
@@ -482,10 +498,14 @@ int wavefront_bialign_find_breakpoint(
        * Compute next wavefront (Reverse)
        */
       ++score_reverse;
+      stats_begin_ns = wavefront_stats_begin(wf_reverse);
       (*wf_align_compute)(wf_reverse,score_reverse);
+      wavefront_stats_end_compute(wf_reverse,score_reverse,stats_begin_ns);
       if (plot_enabled) wavefront_plot(wf_reverse,score_reverse,align_level); // Plot
       // Extend & check end-reached
+      stats_begin_ns = wavefront_stats_begin(wf_reverse);
       reachability_quit = wavefront_extend_end2end(wf_reverse,score_reverse);
+      wavefront_stats_end_extend(wf_reverse,stats_begin_ns);
       if (reachability_quit) return wf_reverse->align_status.status;
     }
     // Check overlapping wavefronts
@@ -496,10 +516,14 @@ int wavefront_bialign_find_breakpoint(
      * Compute next wavefront (Forward)
      */
     ++score_forward;
+    stats_begin_ns = wavefront_stats_begin(wf_forward);
     (*wf_align_compute)(wf_forward,score_forward);
+    wavefront_stats_end_compute(wf_forward,score_forward,stats_begin_ns);
     if (plot_enabled) wavefront_plot(wf_forward,score_forward,align_level); // Plot
     // Extend & check end-reached/max-steps-reached
+    stats_begin_ns = wavefront_stats_begin(wf_forward);
     reachability_quit = wavefront_extend_end2end(wf_forward,score_forward);
+    wavefront_stats_end_extend(wf_forward,stats_begin_ns);
     if (reachability_quit) return wf_forward->align_status.status;
     if (score_reverse + score_forward >= max_alignment_steps) return WF_STATUS_MAX_STEPS_REACHED;
     // Enable always
@@ -569,6 +593,56 @@ void wavefront_bialign_init_half_1(
   half_form->text_begin_free = 0;
   half_form->text_end_free = global_form->text_end_free;
 }
+/*
+ * Bidirectional Alignment (halves on other threads)
+ */
+int wavefront_bialign_alignment(
+    wavefront_aligner_t* const wf_aligner,
+    alignment_form_t* const form,
+    const affine2p_matrix_type component_begin,
+    const affine2p_matrix_type component_end,
+    const int score_remaining,
+    const int align_level);
+typedef struct {
+  wavefront_aligner_t* wf_aligner;
+  alignment_form_t form;
+  affine2p_matrix_type component_begin;
+  affine2p_matrix_type component_end;
+  int score_remaining;
+  int align_level;
+  int align_status;
+} wf_bialign_half_t;
+void* wavefront_bialign_half_thread(
+    void* const arg) {
+  wf_bialign_half_t* const half = (wf_bialign_half_t*)arg;
+  half->align_status = wavefront_bialign_alignment(half->wf_aligner,
+      &half->form,half->component_begin,half->component_end,
+      half->score_remaining,half->align_level);
+  return NULL;
+}
+wavefront_aligner_t* wavefront_bialign_helper(
+    wavefront_aligner_t* const wf_aligner,
+    const int align_level,
+    const int max_num_threads) {
+  wavefront_bialigner_t* const bialigner = wf_aligner->bialigner;
+  // Allocate (its own MM, not shared with this thread)
+  if (bialigner->wf_helpers[align_level] == NULL) {
+    wavefront_aligner_attr_t attributes = bialigner->attributes;
+    attributes.mm_allocator = NULL;
+    attributes.plot.enabled = false;
+    bialigner->wf_helpers[align_level] = wavefront_aligner_new(&attributes);
+  }
+  // Configure as the master aligner is now
+  wavefront_aligner_t* const wf_helper = bialigner->wf_helpers[align_level];
+  wf_helper->heuristic = wf_aligner->heuristic;
+  wavefront_bialigner_set_heuristic(wf_helper->bialigner,&wf_aligner->heuristic);
+  wavefront_aligner_set_max_alignment_steps(wf_helper,wf_aligner->system.max_alignment_steps);
+  wavefront_aligner_set_max_memory(wf_helper,
+      wf_aligner->system.max_memory_resident,wf_aligner->system.max_memory_abort);
+  wavefront_aligner_set_max_num_threads(wf_helper,max_num_threads);
+  wavefront_aligner_set_collect_stats(wf_helper,wf_aligner->system.collect_stats);
+  return wf_helper;
+}
 int wavefront_bialign_alignment(
     wavefront_aligner_t* const wf_aligner,
     alignment_form_t* const form,
@@ -618,26 +692,61 @@ int wavefront_bialign_alignment(
   const int breakpoint_v = WAVEFRONT_V(breakpoint.k_forward,breakpoint.offset_forward);
   // DEBUG
   if (wf_aligner->system.verbose >= 3) wavefront_bialign_debug(&breakpoint,align_level);
-  // Align half_0
+  // Align half_1 on another thread, if this aligner may use one more and both halves are long
+  const int max_num_threads = wf_aligner->system.max_num_threads;
+  const int pattern_length_1 = pattern_length - breakpoint_v;
+  const int text_length_1 = text_length - breakpoint_h;
+  bool parallel_halves =
+      max_num_threads > 1 &&
+      align_level < WF_BIALIGNER_MAX_HELPERS &&
+      sequences->mode == wf_sequences_ascii &&
+      wf_aligner->bialigner->wf_forward->plot == NULL &&
+      MAX(breakpoint_v,breakpoint_h) >= WF_BIALIGN_PARALLEL_MIN_LENGTH &&
+      MAX(pattern_length_1,text_length_1) >= WF_BIALIGN_PARALLEL_MIN_LENGTH;
+  wf_bialign_half_t half_1;
+  pthread_t half_1_thread;
+  if (parallel_halves) {
+    half_1.wf_aligner = wavefront_bialign_helper(wf_aligner,align_level,max_num_threads/2);
+    wavefront_bialigner_set_sequences_ascii(half_1.wf_aligner->bialigner,
+        sequences->pattern_buffer+pattern_begin+breakpoint_v,pattern_length_1,
+        sequences->text_buffer+text_begin+breakpoint_h,text_length_1);
+    cigar_resize(half_1.wf_aligner->cigar,2*(pattern_length_1+text_length_1));
+    wavefront_bialign_init_half_1(form,&half_1.form);
+    half_1.component_begin = breakpoint.component;
+    half_1.component_end = component_end;
+    half_1.score_remaining = breakpoint.score_reverse;
+    half_1.align_level = align_level+1;
+    parallel_halves = (pthread_create(&half_1_thread,NULL,wavefront_bialign_half_thread,&half_1) == 0);
+  }
+  // Align half_0 (with the threads left)
   alignment_form_t form_0;
   wavefront_bialigner_set_sequences_bounds(wf_aligner->bialigner,
       pattern_begin,pattern_begin+breakpoint_v,
       text_begin,text_begin+breakpoint_h);
   wavefront_bialign_init_half_0(form,&form_0);
+  if (parallel_halves) wf_aligner->system.max_num_threads = max_num_threads - max_num_threads/2;
   align_status = wavefront_bialign_alignment(wf_aligner,
       &form_0,component_begin,breakpoint.component,
       breakpoint.score_forward,align_level+1);
-  if (align_status != WF_STATUS_OK) return align_status;
-  // Align half_1
-  alignment_form_t form_1;
-  wavefront_bialigner_set_sequences_bounds(wf_aligner->bialigner,
-      pattern_begin+breakpoint_v,pattern_end,
-      text_begin+breakpoint_h,text_end);
-  wavefront_bialign_init_half_1(form,&form_1);
-  align_status = wavefront_bialign_alignment(wf_aligner,
-      &form_1,breakpoint.component,component_end,
-      breakpoint.score_reverse,align_level+1);
-  if (align_status != WF_STATUS_OK) return align_status;
+  if (parallel_halves) {
+    wf_aligner->system.max_num_threads = max_num_threads;
+    pthread_join(half_1_thread,NULL);
+    if (align_status != WF_STATUS_OK) return align_status;
+    if (half_1.align_status != WF_STATUS_OK) return half_1.align_status;
+    cigar_append_forward(wf_aligner->cigar,half_1.wf_aligner->cigar);
+  } else {
+    if (align_status != WF_STATUS_OK) return align_status;
+    // Align half_1
+    alignment_form_t form_1;
+    wavefront_bialigner_set_sequences_bounds(wf_aligner->bialigner,
+        pattern_begin+breakpoint_v,pattern_end,
+        text_begin+breakpoint_h,text_end);
+    wavefront_bialign_init_half_1(form,&form_1);
+    align_status = wavefront_bialign_alignment(wf_aligner,
+        &form_1,breakpoint.component,component_end,
+        breakpoint.score_reverse,align_level+1);
+    if (align_status != WF_STATUS_OK) return align_status;
+  }
   // Set score (Strictly speaking, only needed at level-0)
   if (align_level == 0) {
     cigar_t* const cigar = wf_aligner->cigar;
@@ -69,6 +69,10 @@ wavefront_bialigner_t* wavefront_bialigner_new(
   wf_bialigner->wf_base = wavefront_aligner_new(&subsidiary_attr);
   wf_bialigner->wf_base->align_mode = wf_align_biwfa_subsidiary;
   wf_bialigner->wf_base->plot = plot;
+  // Helper aligner (allocated once needed)
+  wf_bialigner->attributes = *attributes;
+  int i;
+  for (i=0;i<WF_BIALIGNER_MAX_HELPERS;++i) wf_bialigner->wf_helpers[i] = NULL;
   // Return
   return wf_bialigner;
 }
@@ -77,12 +81,20 @@ void wavefront_bialigner_reap(
   wavefront_aligner_reap(wf_bialigner->wf_forward);
   wavefront_aligner_reap(wf_bialigner->wf_reverse);
   wavefront_aligner_reap(wf_bialigner->wf_base);
+  int i;
+  for (i=0;i<WF_BIALIGNER_MAX_HELPERS;++i) {
+    if (wf_bialigner->wf_helpers[i] != NULL) wavefront_aligner_reap(wf_bialigner->wf_helpers[i]);
+  }
 }
 void wavefront_bialigner_delete(
     wavefront_bialigner_t* const wf_bialigner) {
   wavefront_aligner_delete(wf_bialigner->wf_forward);
   wavefront_aligner_delete(wf_bialigner->wf_reverse);
   wavefront_aligner_delete(wf_bialigner->wf_base);
+  int i;
+  for (i=0;i<WF_BIALIGNER_MAX_HELPERS;++i) {
+    if (wf_bialigner->wf_helpers[i] != NULL) wavefront_aligner_delete(wf_bialigner->wf_helpers[i]);
+  }
   free(wf_bialigner);
 }
 /*
@@ -197,3 +209,32 @@ void wavefront_bialigner_set_min_offsets_per_thread(
   wf_bialigner->wf_reverse->system.min_offsets_per_thread = min_offsets_per_thread;
   wf_bialigner->wf_base->system.min_offsets_per_thread = min_offsets_per_thread;
 }
+/*
+ * Statistics
+ */
+void wavefront_bialigner_set_collect_stats(
+    wavefront_bialigner_t* const wf_bialigner,
+    const bool collect_stats) {
+  wf_bialigner->wf_forward->system.collect_stats = collect_stats;
+  wf_bialigner->wf_reverse->system.collect_stats = collect_stats;
+  wf_bialigner->wf_base->system.collect_stats = collect_stats;
+}
+void wavefront_bialigner_gather_stats(
+    wavefront_bialigner_t* const wf_bialigner,
+    wavefront_stats_t* const stats) {
+  // Moves the statistics of the breakpoint, base and helper aligners into stats
+  wavefront_aligner_t* const wf_aligners[3] = {
+      wf_bialigner->wf_forward, wf_bialigner->wf_reverse, wf_bialigner->wf_base };
+  int i;
+  for (i=0;i<3;++i) {
+    wavefront_stats_add(stats,&wf_aligners[i]->stats);
+    wavefront_stats_clear(&wf_aligners[i]->stats);
+  }
+  for (i=0;i<WF_BIALIGNER_MAX_HELPERS;++i) {
+    wavefront_aligner_t* const wf_helper = wf_bialigner->wf_helpers[i];
+    if (wf_helper == NULL) continue;
+    wavefront_bialigner_gather_stats(wf_helper->bialigner,stats);
+    wavefront_stats_add(stats,&wf_helper->stats);
+    wavefront_stats_clear(&wf_helper->stats);
+  }
+}
@@ -36,10 +36,14 @@
 #include "wavefront_heuristic.h"
 #include "wavefront_offset.h"
 #include "wavefront_sequences.h"
+#include "wavefront_stats.h"
 
 // Wavefront ahead definition
 typedef struct _wavefront_aligner_t wavefront_aligner_t;
 
+// Maximum recursion level whose halves may be solved on another thread
+#define WF_BIALIGNER_MAX_HELPERS 16
+
 typedef struct {
   // Scores
   int score;                      // Score total
@@ -60,6 +64,9 @@ typedef struct {
   wavefront_aligner_t* wf_base;     // Base/Subsidiary aligner
   // Operators
   void (*wf_align_compute)(wavefront_aligner_t* const,const int);
+  // Halves on other threads
+  wavefront_aligner_attr_t attributes; // Attributes of the master aligner
+  wavefront_aligner_t* wf_helpers[WF_BIALIGNER_MAX_HELPERS]; // Aligner of the half solved on another thread at each level (lazily allocated)
 } wavefront_bialigner_t;
 
 /*
@@ -122,4 +129,14 @@ void wavefront_bialigner_set_max_num_threads(
 void wavefront_bialigner_set_min_offsets_per_thread(
     wavefront_bialigner_t* const wf_bialigner,
     const int min_offsets_per_thread);
+
+/*
+ * Statistics
+ */
+void wavefront_bialigner_set_collect_stats(
+    wavefront_bialigner_t* const wf_bialigner,
+    const bool collect_stats);
+void wavefront_bialigner_gather_stats(
+    wavefront_bialigner_t* const wf_bialigner,
+    wavefront_stats_t* const stats);
 #endif /* WAVEFRONT_BIALIGNER_H_ */
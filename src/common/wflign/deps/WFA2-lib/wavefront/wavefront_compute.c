@@ -295,6 +295,17 @@ wavefront_t* wavefront_compute_get_d2wavefront(
           wf_components->d2wavefronts[score_mod]->null) ?
       wf_components->wavefront_null : wf_components->d2wavefronts[score_mod];
 }
+/*
+ * Modular wavefronts: (score-penalty) % max_score_scope, from score % max_score_scope
+ *   (every penalty offset is below max_score_scope, so one modulo per score gives all inputs)
+ */
+FORCE_INLINE int wavefront_compute_score_mod(
+    const int score_mod,
+    const int penalty,
+    const int max_score_scope) {
+  const int input_mod = score_mod - penalty;
+  return (input_mod < 0) ? input_mod + max_score_scope : input_mod;
+}
 void wavefront_compute_fetch_input(
     wavefront_aligner_t* const wf_aligner,
     wavefront_set_t* const wavefront_set,
@@ -310,8 +321,9 @@ void wavefront_compute_fetch_input(
     // Modular wavefront
     if (wf_components->memory_modular) {
       const int max_score_scope = wf_components->max_score_scope;
-      if (mismatch > 0) mismatch =  mismatch % max_score_scope;
-      if (gap_open1 > 0) gap_open1 = gap_open1 % max_score_scope;
+      const int score_mod = score % max_score_scope;
+      if (mismatch > 0) mismatch = wavefront_compute_score_mod(score_mod,penalties->mismatch,max_score_scope);
+      if (gap_open1 > 0) gap_open1 = wavefront_compute_score_mod(score_mod,penalties->gap_opening1,max_score_scope);
     }
     // Fetch wavefronts
     wavefront_set->in_mwavefront_misms = wavefront_compute_get_mwavefront(wf_components,mismatch);
@@ -325,11 +337,14 @@ void wavefront_compute_fetch_input(
     // Modular wavefront
     if (wf_components->memory_modular) {
       const int max_score_scope = wf_components->max_score_scope;
-      if (mismatch > 0) mismatch =  mismatch % max_score_scope;
-      if (gap_open1 > 0) gap_open1 = gap_open1 % max_score_scope;
-      if (gap_extend1 > 0) gap_extend1 = gap_extend1 % max_score_scope;
-      if (gap_open2 > 0) gap_open2 = gap_open2 % max_score_scope;
-      if (gap_extend2 > 0) gap_extend2 = gap_extend2 % max_score_scope;
+      const int score_mod = score % max_score_scope;
+      if (mismatch > 0) mismatch = wavefront_compute_score_mod(score_mod,penalties->mismatch,max_score_scope);
+      if (gap_open1 > 0) gap_open1 = wavefront_compute_score_mod(score_mod,
+          penalties->gap_opening1+penalties->gap_extension1,max_score_scope);
+      if (gap_extend1 > 0) gap_extend1 = wavefront_compute_score_mod(score_mod,penalties->gap_extension1,max_score_scope);
+      if (gap_open2 > 0) gap_open2 = wavefront_compute_score_mod(score_mod,
+          penalties->gap_opening2+penalties->gap_extension2,max_score_scope);
+      if (gap_extend2 > 0) gap_extend2 = wavefront_compute_score_mod(score_mod,penalties->gap_extension2,max_score_scope);
     }
     // Fetch wavefronts
     wavefront_set->in_mwavefront_misms = wavefront_compute_get_mwavefront(wf_components,mismatch);
@@ -41,7 +41,7 @@
 /*
  * Compute Kernels
  */
-void wavefront_compute_affine_idm(
+FORCE_INLINE void wavefront_compute_affine_idm_kernel(
     wavefront_aligner_t* const wf_aligner,
     const wavefront_set_t* const wavefront_set,
     const int lo,
@@ -84,6 +84,44 @@ void wavefront_compute_affine_idm(
     out_m[k] = max;
   }
 }
+#if CPU_AVX512_DISPATCH
+CPU_AVX512_TARGET FORCE_NO_INLINE static void wavefront_compute_affine_idm_avx512(
+    wavefront_aligner_t* const wf_aligner,
+    const wavefront_set_t* const wavefront_set,
+    const int lo,
+    const int hi) {
+  wavefront_compute_affine_idm_kernel(wf_aligner,wavefront_set,lo,hi);
+}
+#endif
+#if CPU_AVX2_DISPATCH
+CPU_AVX2_TARGET FORCE_NO_INLINE static void wavefront_compute_affine_idm_avx2(
+    wavefront_aligner_t* const wf_aligner,
+    const wavefront_set_t* const wavefront_set,
+    const int lo,
+    const int hi) {
+  wavefront_compute_affine_idm_kernel(wf_aligner,wavefront_set,lo,hi);
+}
+#endif
+void wavefront_compute_affine_idm(
+    wavefront_aligner_t* const wf_aligner,
+    const wavefront_set_t* const wavefront_set,
+    const int lo,
+    const int hi) {
+  // Widest vectors the host runs
+#if CPU_AVX512_DISPATCH
+  if (cpu_supports_avx512()) {
+    wavefront_compute_affine_idm_avx512(wf_aligner,wavefront_set,lo,hi);
+    return;
+  }
+#endif
+#if CPU_AVX2_DISPATCH
+  if (cpu_supports_avx2()) {
+    wavefront_compute_affine_idm_avx2(wf_aligner,wavefront_set,lo,hi);
+    return;
+  }
+#endif
+  wavefront_compute_affine_idm_kernel(wf_aligner,wavefront_set,lo,hi);
+}
 /*
  * Compute Kernel (Piggyback)
  */
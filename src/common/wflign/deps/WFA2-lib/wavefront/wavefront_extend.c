@@ -34,6 +34,7 @@
 #include "wavefront_extend.h"
 #include "wavefront_extend_kernels.h"
 #include "wavefront_extend_kernels_avx.h"
+#include "wavefront_extend_kernels_neon.h"
 #include "wavefront_compute.h"
 #include "wavefront_termination.h"
 
@@ -54,11 +55,26 @@ void wavefront_extend_end2end_dispatcher_seq(
   wavefront_sequences_t* const seqs = &wf_aligner->sequences;
   // Check the sequence mode
   if (seqs->mode == wf_sequences_ascii) {
-//#if __AVX2__ // TODO
-//    wavefront_extend_matches_packed_end2end_avx2(wf_aligner,mwavefront,lo,hi);
-//#else
+    // Widest kernel the host runs
+#if CPU_AVX512_DISPATCH
+    if (cpu_supports_avx512()) {
+      wavefront_extend_matches_packed_end2end_avx512(wf_aligner,mwavefront,lo,hi);
+      return;
+    }
+#endif
+#if CPU_AVX2_DISPATCH
+    if (cpu_supports_avx2()) {
+      wavefront_extend_matches_packed_end2end_avx2(wf_aligner,mwavefront,lo,hi);
+      return;
+    }
+#endif
+#if __AVX2__
+    wavefront_extend_matches_packed_end2end_avx2(wf_aligner,mwavefront,lo,hi);
+#elif __ARM_NEON
+    wavefront_extend_matches_packed_end2end_neon(wf_aligner,mwavefront,lo,hi);
+#else
     wavefront_extend_matches_packed_end2end(wf_aligner,mwavefront,lo,hi);
-//#endif
+#endif
   } else {
     wf_offset_t dummy;
     wavefront_extend_matches_custom(wf_aligner,mwavefront,score,lo,hi,false,&dummy);
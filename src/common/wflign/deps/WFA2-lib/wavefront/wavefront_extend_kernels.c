@@ -31,6 +31,7 @@
 
 #include "wavefront_extend_kernels.h"
 #include "wavefront_termination.h"
+#include "wavefront_heuristic.h"
 
 /*
  * Inner-most extend kernel (blockwise comparisons)
@@ -135,6 +136,78 @@ FORCE_NO_INLINE bool wavefront_extend_matches_packed_endsfree(
   // Alignment not finished
   return false;
 }
+/*
+ * Wavefront-Extend Inner Kernel (Custom match function over batches)
+ */
+void wavefront_extend_matches_custom_batch(
+    wavefront_aligner_t* const wf_aligner,
+    wavefront_t* const mwavefront,
+    const int lo,
+    const int hi,
+    wf_offset_t* const max_antidiag) {
+  // Parameters
+  wavefront_sequences_t* const seqs = &wf_aligner->sequences;
+  const int pattern_length = seqs->pattern_length;
+  const int text_length = seqs->text_length;
+  wf_offset_t* const offsets = mwavefront->offsets;
+  mm_allocator_t* const mm_allocator = wf_aligner->mm_allocator;
+  // Diagonals still extending, and their next cells
+  const int num_diagonals = hi - lo + 1;
+  int* const buffer = mm_allocator_calloc(mm_allocator,4*num_diagonals,int,false);
+  int* const diagonals = buffer;
+  int* const pattern_positions = buffer + num_diagonals;
+  int* const text_positions = buffer + 2*num_diagonals;
+  int* const matches = buffer + 3*num_diagonals;
+  int num_active = 0, k, i;
+  for (k=lo;k<=hi;++k) {
+    if (offsets[k] != WAVEFRONT_OFFSET_NULL) diagonals[num_active++] = k;
+  }
+  // Extend all of them one step at a time
+  while (num_active > 0) {
+    // Next cells (EOS ends the diagonal)
+    int num_cells = 0;
+    for (i=0;i<num_active;++i) {
+      k = diagonals[i];
+      const int v = WAVEFRONT_V(k,offsets[k]);
+      const int h = WAVEFRONT_H(k,offsets[k]);
+      if (v >= pattern_length || h >= text_length) continue;
+      diagonals[num_cells] = k;
+      pattern_positions[num_cells] = v;
+      text_positions[num_cells] = h;
+      ++num_cells;
+    }
+    if (num_cells == 0) break;
+    // Compare and keep those matching
+    wavefront_sequences_cmp_batch(seqs,num_cells,pattern_positions,text_positions,matches);
+    num_active = 0;
+    for (i=0;i<num_cells;++i) {
+      if (matches[i]) {
+        k = diagonals[i];
+        ++offsets[k];
+        diagonals[num_active++] = k;
+      }
+    }
+  }
+  mm_allocator_free(mm_allocator,buffer);
+  // Compute max (and the min-distance of the WFmash cut-off, if pending)
+  const bool track_distance = (lo == mwavefront->lo && hi == mwavefront->hi) &&
+      wavefront_heuristic_wfmash_pending(wf_aligner,lo,hi);
+  const int mfactor = ((float)(pattern_length + text_length) / 2); // Mean sequence length
+  int min_distance = MAX(pattern_length,text_length);
+  *max_antidiag = 0;
+  for (k=lo;k<=hi;++k) {
+    const wf_offset_t offset = offsets[k];
+    if (track_distance) {
+      const int distance = wf_distance_end2end_weighted(
+          offset,k,pattern_length,text_length,mfactor);
+      min_distance = MIN(min_distance,distance);
+    }
+    if (offset == WAVEFRONT_OFFSET_NULL) continue;
+    const wf_offset_t antidiag = WAVEFRONT_ANTIDIAGONAL(k,offset);
+    if (*max_antidiag < antidiag) *max_antidiag = antidiag;
+  }
+  mwavefront->heuristic_min_distance = (track_distance) ? min_distance : -1;
+}
 /*
  * Wavefront-Extend Inner Kernel (Custom match function)
  */
@@ -148,14 +221,28 @@ bool wavefront_extend_matches_custom(
     wf_offset_t* const max_antidiag) {
   // Parameters
   wavefront_sequences_t* const seqs = &wf_aligner->sequences;
-  // Extend diagonally each wavefront point
+  // Batches of cells, if the matching function takes them
+  if (!endsfree && seqs->match_batch_funct != NULL) {
+    wavefront_extend_matches_custom_batch(wf_aligner,mwavefront,lo,hi,max_antidiag);
+    return false;
+  }
+  // Extend diagonally each wavefront point (tracking the min-distance of the WFmash cut-off, if pending)
+  const int pattern_length = seqs->pattern_length;
+  const int text_length = seqs->text_length;
+  const bool track_distance = !endsfree && (lo == mwavefront->lo && hi == mwavefront->hi) &&
+      wavefront_heuristic_wfmash_pending(wf_aligner,lo,hi);
+  const int mfactor = ((float)(pattern_length + text_length) / 2); // Mean sequence length
+  int min_distance = MAX(pattern_length,text_length);
   wf_offset_t* const offsets = mwavefront->offsets;
   *max_antidiag = 0;
   int k;
   for (k=lo;k<=hi;++k) {
     // Check offset
     wf_offset_t offset = offsets[k];
-    if (offset == WAVEFRONT_OFFSET_NULL) continue;
+    if (offset == WAVEFRONT_OFFSET_NULL) {
+      if (track_distance) min_distance = MIN(min_distance,-WAVEFRONT_OFFSET_NULL);
+      continue;
+    }
     // Count equal characters
     int v = WAVEFRONT_V(k,offset);
     int h = WAVEFRONT_H(k,offset);
@@ -167,11 +254,17 @@ bool wavefront_extend_matches_custom(
     // Compute max
     const wf_offset_t antidiag = WAVEFRONT_ANTIDIAGONAL(k,offset);
     if (*max_antidiag < antidiag) *max_antidiag = antidiag;
+    if (track_distance) {
+      const int distance = wf_distance_end2end_weighted(
+          offset,k,pattern_length,text_length,mfactor);
+      min_distance = MIN(min_distance,distance);
+    }
     // Check ends-free reaching boundaries
     if (endsfree && wavefront_termination_endsfree(wf_aligner,mwavefront,score,k,offset)) {
       return true; // Quit (we are done)
     }
   }
+  mwavefront->heuristic_min_distance = (track_distance) ? min_distance : -1;
   // Alignment not finished
   return false;
 }
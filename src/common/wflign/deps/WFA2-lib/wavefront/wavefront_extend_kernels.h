@@ -57,6 +57,12 @@ bool wavefront_extend_matches_packed_endsfree(
 /*
  * Wavefront-Extend Inner Kernel (Custom match function)
  */
+void wavefront_extend_matches_custom_batch(
+    wavefront_aligner_t* const wf_aligner,
+    wavefront_t* const mwavefront,
+    const int lo,
+    const int hi,
+    wf_offset_t* const max_antidiag);
 bool wavefront_extend_matches_custom(
     wavefront_aligner_t* const wf_aligner,
     wavefront_t* const mwavefront,
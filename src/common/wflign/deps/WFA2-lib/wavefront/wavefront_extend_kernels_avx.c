@@ -36,12 +36,12 @@
 #include "wavefront_extend_kernels.h"
 #include "wavefront_extend_kernels_avx.h"
 
-#if __AVX2__
+#if __AVX2__ || CPU_AVX2_DISPATCH
 #include <immintrin.h>
 /*
  * Wavefront-Extend Inner Kernel (Scalar)
  */
-FORCE_INLINE wf_offset_t wavefront_extend_matches_packed_kernel(
+CPU_AVX2_TARGET FORCE_INLINE wf_offset_t wavefront_extend_matches_packed_kernel(
     wavefront_aligner_t* const wf_aligner,
     const int k,
     wf_offset_t offset) {
@@ -70,7 +70,7 @@ FORCE_INLINE wf_offset_t wavefront_extend_matches_packed_kernel(
  * SIMD clz, use a native instruction when available (AVX512 CD or VL
  * extensions), or emulate the clz behavior.
  */
-FORCE_INLINE  __m256i avx2_lzcnt_epi32(__m256i v) {
+CPU_AVX2_TARGET FORCE_INLINE __m256i avx2_lzcnt_epi32(__m256i v) {
 #if __AVX512CD__ && __AVX512VL__
   return _mm256_lzcnt_epi32(v);
 #else
@@ -86,7 +86,7 @@ FORCE_INLINE  __m256i avx2_lzcnt_epi32(__m256i v) {
 /*
  * Wavefront-Extend Inner Kernel (SIMD AVX2/AVX512)
  */
-FORCE_NO_INLINE void wavefront_extend_matches_packed_end2end_avx2(
+CPU_AVX2_TARGET FORCE_NO_INLINE void wavefront_extend_matches_packed_end2end_avx2(
     wavefront_aligner_t* const wf_aligner,
     wavefront_t* const mwavefront,
     const int lo,
@@ -139,7 +139,8 @@ FORCE_NO_INLINE void wavefront_extend_matches_packed_end2end_avx2(
     // Divide clz by 8 to get the number of equal characters
     // Assume there are sentinels on sequences so we won't count characters
     // outside the sequences
-    __m256i equal_chars =  _mm256_srli_epi32(clz_vector,3);
+    // NULL offsets are left as they are
+    __m256i equal_chars =  _mm256_and_si256(null_mask,_mm256_srli_epi32(clz_vector,3));
     offsets_vector =  _mm256_add_epi32 (offsets_vector,equal_chars);
     v_vector = _mm256_add_epi32 (v_vector,fours);
     h_vector = _mm256_add_epi32 (h_vector,fours);
@@ -152,16 +153,90 @@ FORCE_NO_INLINE void wavefront_extend_matches_packed_end2end_avx2(
     while (mask != 0) {
       int tz = __builtin_ctz(mask);
       int curr_k = k + (tz/4);
-      const wf_offset_t offset = offsets[curr_k];
       // Extend offset
-      if (offset >= 0) {
-        offsets[curr_k] = wavefront_extend_matches_packed_kernel(wf_aligner,curr_k,offset);
-      } else {
-        offsets[curr_k] = WAVEFRONT_OFFSET_NULL;
-      }
+      offsets[curr_k] = wavefront_extend_matches_packed_kernel(wf_aligner,curr_k,offsets[curr_k]);
       mask &= (0xfffffff0 << tz);
     }
   }
 }
 
 #endif // AVX2
+
+#if CPU_AVX512_DISPATCH
+#include <immintrin.h>
+/*
+ * Wavefront-Extend Inner Kernel (SIMD AVX512, 16 diagonals per register)
+ */
+CPU_AVX512_TARGET static wf_offset_t wavefront_extend_matches_packed_kernel_avx512(
+    wavefront_aligner_t* const wf_aligner,
+    const int k,
+    wf_offset_t offset) {
+  // Fetch pattern/text blocks
+  const uint64_t* pattern_blocks = (uint64_t*)(wf_aligner->sequences.pattern+WAVEFRONT_V(k,offset));
+  const uint64_t* text_blocks = (uint64_t*)(wf_aligner->sequences.text+WAVEFRONT_H(k,offset));
+  // Compare 64-bits blocks
+  uint64_t cmp = *pattern_blocks ^ *text_blocks;
+  while (__builtin_expect(cmp==0,0)) {
+    offset += 8;
+    cmp = *(++pattern_blocks) ^ *(++text_blocks);
+  }
+  // Count equal characters
+  return offset + DIV_FLOOR(__builtin_ctzl(cmp),8);
+}
+CPU_AVX512_TARGET FORCE_NO_INLINE void wavefront_extend_matches_packed_end2end_avx512(
+    wavefront_aligner_t* const wf_aligner,
+    wavefront_t* const mwavefront,
+    const int lo,
+    const int hi) {
+  // Parameters
+  wf_offset_t* const offsets = mwavefront->offsets;
+  const char* pattern = wf_aligner->sequences.pattern;
+  const char* text = wf_aligner->sequences.text;
+  const __m512i zeros = _mm512_setzero_si512();
+  const __m512i fours = _mm512_set1_epi32(4);
+  const __m512i sixteens = _mm512_set1_epi32(16);
+  // Change endianess of each 32-bit lane
+  const __m512i vecShuffle = _mm512_set_epi8(
+      60,61,62,63,56,57,58,59,52,53,54,55,48,49,50,51,
+      44,45,46,47,40,41,42,43,36,37,38,39,32,33,34,35,
+      28,29,30,31,24,25,26,27,20,21,22,23,16,17,18,19,
+      12,13,14,15, 8, 9,10,11, 4, 5, 6, 7, 0, 1, 2, 3);
+  const int elems_per_register = 16;
+  const int num_of_diagonals = hi - lo + 1;
+  const int loop_peeling_iters = num_of_diagonals % elems_per_register;
+  int k;
+  for (k=lo;k<lo+loop_peeling_iters;k++) {
+    const wf_offset_t offset = offsets[k];
+    if (offset < 0) continue;
+    offsets[k] = wavefront_extend_matches_packed_kernel_avx512(wf_aligner,k,offset);
+  }
+  const int k_min = lo + loop_peeling_iters;
+  __m512i ks = _mm512_add_epi32(_mm512_set1_epi32(k_min),
+      _mm512_set_epi32(15,14,13,12,11,10,9,8,7,6,5,4,3,2,1,0));
+  // Main SIMD extension loop
+  for (k=k_min;k<=hi;k+=elems_per_register) {
+    __m512i offsets_vector = _mm512_loadu_si512((void*)&offsets[k]);
+    // Only the lanes of non-NULL offsets are read and extended
+    const __mmask16 valid = _mm512_cmpge_epi32_mask(offsets_vector,zeros);
+    const __m512i v_vector = _mm512_sub_epi32(offsets_vector,ks);
+    ks = _mm512_add_epi32(ks,sixteens);
+    if (valid == 0) continue;
+    __m512i pattern_vector = _mm512_mask_i32gather_epi32(zeros,valid,v_vector,pattern,1);
+    __m512i text_vector = _mm512_mask_i32gather_epi32(zeros,valid,offsets_vector,text,1);
+    pattern_vector = _mm512_shuffle_epi8(pattern_vector,vecShuffle);
+    text_vector = _mm512_shuffle_epi8(text_vector,vecShuffle);
+    // Divide clz by 8 to get the number of equal characters (sentinels stop it at the end)
+    const __m512i equal_chars = _mm512_srli_epi32(
+        _mm512_lzcnt_epi32(_mm512_xor_si512(pattern_vector,text_vector)),3);
+    offsets_vector = _mm512_mask_add_epi32(offsets_vector,valid,offsets_vector,equal_chars);
+    _mm512_storeu_si512((void*)&offsets[k],offsets_vector);
+    // Lanes matching all 4 characters keep extending one at a time
+    uint32_t mask = _mm512_mask_cmpeq_epi32_mask(valid,equal_chars,fours);
+    while (mask != 0) {
+      const int curr_k = k + __builtin_ctz(mask);
+      offsets[curr_k] = wavefront_extend_matches_packed_kernel_avx512(wf_aligner,curr_k,offsets[curr_k]);
+      mask &= mask - 1;
+    }
+  }
+}
+#endif // AVX512
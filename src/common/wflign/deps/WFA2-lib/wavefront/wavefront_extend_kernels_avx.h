@@ -32,10 +32,10 @@
 #ifndef WAVEFRONT_EXTEND_AVX_H_
 #define WAVEFRONT_EXTEND_AVX_H_
 
-#if __AVX2__
-
 #include "wavefront_aligner.h"
 
+#if __AVX2__ || CPU_AVX2_DISPATCH
+
 void wavefront_extend_matches_packed_end2end_avx2(
     wavefront_aligner_t* const wf_aligner,
     wavefront_t* const mwavefront,
@@ -44,4 +44,14 @@ void wavefront_extend_matches_packed_end2end_avx2(
 
 #endif // AVX2
 
+#if CPU_AVX512_DISPATCH
+
+void wavefront_extend_matches_packed_end2end_avx512(
+    wavefront_aligner_t* const wf_aligner,
+    wavefront_t* const mwavefront,
+    const int lo,
+    const int hi);
+
+#endif // AVX512
+
 #endif /* WAVEFRONT_EXTEND_AVX_H_ */
@@ -0,0 +1,79 @@
+/*
+ *                             The MIT License
+ *
+ * Wavefront Alignment Algorithms
+ * Copyright (c) 2017 by Santiago Marco-Sola  <santiagomsola@gmail.com>
+ *
+ * This file is part of Wavefront Alignment Algorithms.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * PROJECT: Wavefront Alignment Algorithms
+ * AUTHOR(S): Santiago Marco-Sola <santiagomsola@gmail.com>
+ * DESCRIPTION: WaveFront-Alignment module for the "extension" of exact matches
+ */
+
+#include "wavefront_extend_kernels_neon.h"
+
+#if __ARM_NEON
+#include <arm_neon.h>
+/*
+ * Wavefront-Extend Inner Kernel (SIMD NEON)
+ *   No gathers on NEON: each diagonal compares 16 characters per step
+ */
+FORCE_INLINE wf_offset_t wavefront_extend_matches_packed_kernel_neon(
+    wavefront_aligner_t* const wf_aligner,
+    const int k,
+    wf_offset_t offset) {
+  // Fetch pattern/text blocks
+  const uint8_t* pattern_blocks = (const uint8_t*)(wf_aligner->sequences.pattern+WAVEFRONT_V(k,offset));
+  const uint8_t* text_blocks = (const uint8_t*)(wf_aligner->sequences.text+WAVEFRONT_H(k,offset));
+  while (true) {
+    // Compare 128-bits blocks
+    const uint8x16_t equal = vceqq_u8(vld1q_u8(pattern_blocks),vld1q_u8(text_blocks));
+    // Narrow to 4 bits per character, all set when equal
+    const uint64_t equal_nibbles = vget_lane_u64(vreinterpret_u64_u8(
+        vshrn_n_u16(vreinterpretq_u16_u8(equal),4)),0);
+    if (__builtin_expect(equal_nibbles!=UINT64_MAX,1)) {
+      // Count equal characters
+      return offset + DIV_FLOOR(__builtin_ctzll(~equal_nibbles),4);
+    }
+    // Increment offset (full block)
+    offset += 16;
+    pattern_blocks += 16;
+    text_blocks += 16;
+  }
+}
+FORCE_NO_INLINE void wavefront_extend_matches_packed_end2end_neon(
+    wavefront_aligner_t* const wf_aligner,
+    wavefront_t* const mwavefront,
+    const int lo,
+    const int hi) {
+  wf_offset_t* const offsets = mwavefront->offsets;
+  int k;
+  for (k=lo;k<=hi;++k) {
+    // Fetch offset
+    const wf_offset_t offset = offsets[k];
+    if (offset == WAVEFRONT_OFFSET_NULL) continue;
+    // Extend offset
+    offsets[k] = wavefront_extend_matches_packed_kernel_neon(wf_aligner,k,offset);
+  }
+}
+
+#endif // NEON
@@ -254,6 +254,39 @@ void wf_heuristic_wfadaptive_reduce(
   }
   wavefront->hi = hi_reduced;
 }
+void wf_heuristic_wfmash_reduce_tracked(
+    wavefront_t* const wavefront,
+    const int pattern_length,
+    const int text_length,
+    const int min_distance,
+    const int max_distance_threshold,
+    const int min_k,
+    const int max_k) {
+  // Parameters
+  const wf_offset_t* const offsets = wavefront->offsets;
+  const int mfactor = ((float)(pattern_length + text_length) / 2); // Mean sequence length
+  int k;
+  // Reduce from bottom (distances computed only for the diagonals visited)
+  const int top_limit = MIN(max_k,wavefront->hi); // Preserve target-diagonals
+  int lo_reduced = wavefront->lo;
+  for (k=wavefront->lo;k<top_limit;++k) {
+    const int distance = wf_distance_end2end_weighted(
+        offsets[k],k,pattern_length,text_length,mfactor);
+    if (distance - min_distance <= max_distance_threshold) break;
+    ++lo_reduced;
+  }
+  wavefront->lo = lo_reduced;
+  // Reduce from top
+  const int botton_limit = MAX(min_k,wavefront->lo); // Preserve target-diagonals
+  int hi_reduced = wavefront->hi;
+  for (k=wavefront->hi;k>botton_limit;--k) {
+    const int distance = wf_distance_end2end_weighted(
+        offsets[k],k,pattern_length,text_length,mfactor);
+    if (distance - min_distance <= max_distance_threshold) break;
+    --hi_reduced;
+  }
+  wavefront->hi = hi_reduced;
+}
 void wavefront_heuristic_wfadaptive(
     wavefront_aligner_t* const wf_aligner,
     wavefront_t* const wavefront,
@@ -271,6 +304,16 @@ void wavefront_heuristic_wfadaptive(
   const int base_hi = wavefront->hi;
   const int base_lo = wavefront->lo;
   if ((base_hi - base_lo + 1) < min_wavefront_length) return;
+  // Cut-off with the min-distance tracked at extension (no full pass)
+  const int alignment_k = DPMATRIX_DIAGONAL(text_length,pattern_length);
+  if (wfmash_mode && wavefront->heuristic_min_distance >= 0) {
+    wf_heuristic_wfmash_reduce_tracked(
+        wavefront,pattern_length,text_length,wavefront->heuristic_min_distance,
+        max_distance_threshold,alignment_k,alignment_k);
+    wavefront->heuristic_min_distance = -1;
+    wf_heuristic->steps_wait = wf_heuristic->steps_between_cutoffs;
+    return;
+  }
   // Use victim as temporal buffer
   wavefront_components_resize_null__victim(&wf_aligner->wf_components,base_lo-1,base_hi+1);
   wf_offset_t* const distances = wf_aligner->wf_components.wavefront_victim->offsets;
@@ -284,7 +327,6 @@ void wavefront_heuristic_wfadaptive(
         wavefront,pattern_length,text_length,distances);
   }
   // Cut-off wavefront
-  const int alignment_k = DPMATRIX_DIAGONAL(text_length,pattern_length);
   wf_heuristic_wfadaptive_reduce(
       wavefront,distances,min_distance,max_distance_threshold,
       alignment_k,alignment_k);
@@ -506,6 +548,17 @@ void wavefront_heuristic_banded_adaptive(
 /*
  * Heuristic Cut-offs dispatcher
  */
+bool wavefront_heuristic_wfmash_pending(
+    wavefront_aligner_t* const wf_aligner,
+    const int lo,
+    const int hi) {
+  // Whether the cut-off after this extension scans the wavefront (see wavefront_heuristic_cufoff)
+  const wavefront_heuristic_t* const wf_heuristic = &wf_aligner->heuristic;
+  if (!(wf_heuristic->strategy & wf_heuristic_wfmash)) return false;
+  if (wf_heuristic->strategy & wf_heuristic_wfadaptive) return false;
+  if (wf_heuristic->steps_wait > 1) return false;
+  return (hi - lo + 1) >= wf_heuristic->min_wavefront_length;
+}
 bool wavefront_heuristic_cufoff(
     wavefront_aligner_t* const wf_aligner,
     const int score,
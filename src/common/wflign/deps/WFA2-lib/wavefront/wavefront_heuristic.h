@@ -32,6 +32,8 @@
 #ifndef WAVEFRONT_HEURISTIC_H_
 #define WAVEFRONT_HEURISTIC_H_
 
+#include "wavefront_offset.h"
+
 // Wavefront ahead definition
 typedef struct _wavefront_aligner_t wavefront_aligner_t;
 
@@ -110,6 +112,16 @@ void wavefront_heuristic_clear(
 /*
  * Wavefront heuristic cut-off
  */
+bool wavefront_heuristic_wfmash_pending(
+    wavefront_aligner_t* const wf_aligner,
+    const int lo,
+    const int hi);
+int wf_distance_end2end_weighted(
+    const wf_offset_t offset,
+    const int k,
+    const int pattern_length,
+    const int text_length,
+    const int mfactor);
 bool wavefront_heuristic_cufoff(
     wavefront_aligner_t* const wf_aligner,
     const int score,
@@ -187,8 +187,14 @@ void wavefront_sequences_init_lambda(
   wf_sequences->text_length = text_length;
   // Internals
   wf_sequences->match_funct = match_funct;
+  wf_sequences->match_batch_funct = NULL;
   wf_sequences->match_funct_arguments = match_funct_arguments;
 }
+void wavefront_sequences_set_match_batch(
+    wavefront_sequences_t* const wf_sequences,
+    alignment_match_batch_funct_t match_batch_funct) {
+  wf_sequences->match_batch_funct = match_batch_funct;
+}
 void wavefront_sequences_init_packed2bits(
     wavefront_sequences_t* const wf_sequences,
     const uint8_t* const pattern,
@@ -250,6 +256,33 @@ bool wavefront_sequences_cmp(
     return wf_sequences->pattern[pattern_pos] == wf_sequences->text[text_pos];
   }
 }
+void wavefront_sequences_cmp_batch(
+    wavefront_sequences_t* const wf_sequences,
+    const int num_cells,
+    int* const pattern_positions,
+    int* const text_positions,
+    int* const matches) {
+  // Cells within the sequences (lambda mode, given a batch function); positions are overwritten
+  const int pattern_begin = wf_sequences->pattern_begin;
+  const int text_begin = wf_sequences->text_begin;
+  int i;
+  if (wf_sequences->reverse) {
+    const int pattern_end = pattern_begin + wf_sequences->pattern_length - 1;
+    const int text_end = text_begin + wf_sequences->text_length - 1;
+    for (i=0;i<num_cells;++i) {
+      pattern_positions[i] = pattern_end - pattern_positions[i];
+      text_positions[i] = text_end - text_positions[i];
+    }
+  } else {
+    for (i=0;i<num_cells;++i) {
+      pattern_positions[i] += pattern_begin;
+      text_positions[i] += text_begin;
+    }
+  }
+  // Compare using lambda (given coordinates)
+  wf_sequences->match_batch_funct(num_cells,pattern_positions,text_positions,
+      matches,wf_sequences->match_funct_arguments);
+}
 char wavefront_sequences_get_pattern(
     wavefront_sequences_t* const wf_sequences,
     const int position) {
@@ -53,6 +53,18 @@
  *   }
  */
 typedef int (*alignment_match_funct_t)(int,int,void*);
+/*
+ * Custom extend-match function over a batch of cells (optional), e.g.:
+ *
+ *   void match_batch_function(int num_cells,const int* v,const int* h,int* matches,void* arguments) {
+ *     int i;
+ *     for (i=0;i<num_cells;++i) matches[i] = match_function(v[i],h[i],arguments);
+ *   }
+ *
+ * Given one, the extension takes one step on all the diagonals still matching at once,
+ * asking for the next cell of each of them in a single call
+ */
+typedef void (*alignment_match_batch_funct_t)(int,const int*,const int*,int*,void*);
 
 /*
  * Wavefront Sequences
@@ -75,6 +87,7 @@ typedef struct {
   int text_length;                       // Text length
   // Lambda Sequence
   alignment_match_funct_t match_funct;   // Custom matching function (match(v,h,args))
+  alignment_match_batch_funct_t match_batch_funct; // Custom matching function over a batch of cells (optional)
   void* match_funct_arguments;           // Generic arguments passed to matching function (args)
   // Internal buffers (ASCII encoded)
   char* seq_buffer;                      // Internal buffer
@@ -112,6 +125,9 @@ void wavefront_sequences_init_lambda(
     const int pattern_length,
     const int text_length,
     const bool reverse);
+void wavefront_sequences_set_match_batch(
+    wavefront_sequences_t* const wf_sequences,
+    alignment_match_batch_funct_t match_batch_funct);
 void wavefront_sequences_init_packed2bits(
     wavefront_sequences_t* const wf_sequences,
     const uint8_t* const pattern,
@@ -128,6 +144,12 @@ bool wavefront_sequences_cmp(
     wavefront_sequences_t* const wf_sequences,
     const int pattern_pos,
     const int text_pos);
+void wavefront_sequences_cmp_batch(
+    wavefront_sequences_t* const wf_sequences,
+    const int num_cells,
+    int* const pattern_positions,
+    int* const text_positions,
+    int* const matches);
 char wavefront_sequences_get_pattern(
     wavefront_sequences_t* const wf_sequences,
     const int position);
@@ -0,0 +1,109 @@
+/*
+ *                             The MIT License
+ *
+ * Wavefront Alignment Algorithms
+ * Copyright (c) 2017 by Santiago Marco-Sola  <santiagomsola@gmail.com>
+ *
+ * This file is part of Wavefront Alignment Algorithms.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * PROJECT: Wavefront Alignment Algorithms
+ * AUTHOR(S): Santiago Marco-Sola <santiagomsola@gmail.com>
+ * DESCRIPTION: WFA module to gather statistics of the alignments
+ */
+
+#include "wavefront_stats.h"
+#include "wavefront_aligner.h"
+
+#include <time.h>
+
+/*
+ * Setup
+ */
+void wavefront_stats_clear(
+    wavefront_stats_t* const stats) {
+  memset(stats,0,sizeof(wavefront_stats_t));
+}
+void wavefront_stats_add(
+    wavefront_stats_t* const stats,
+    const wavefront_stats_t* const stats_src) {
+  stats->num_alignments += stats_src->num_alignments;
+  stats->num_steps += stats_src->num_steps;
+  stats->num_extend_calls += stats_src->num_extend_calls;
+  stats->max_wavefront_length = MAX(stats->max_wavefront_length,stats_src->max_wavefront_length);
+  stats->max_memory_used = MAX(stats->max_memory_used,stats_src->max_memory_used);
+  stats->time_compute_ns += stats_src->time_compute_ns;
+  stats->time_extend_ns += stats_src->time_extend_ns;
+  stats->time_backtrace_ns += stats_src->time_backtrace_ns;
+}
+/*
+ * Gathering
+ */
+uint64_t wavefront_stats_time_ns(void) {
+  // The monotonic clock, as timer_get_system_time() is a no-op off OS X
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC,&ts);
+  return (uint64_t)ts.tv_sec*1000000000ul + (uint64_t)ts.tv_nsec;
+}
+uint64_t wavefront_stats_begin(
+    wavefront_aligner_t* const wf_aligner) {
+  return (wf_aligner->system.collect_stats) ? wavefront_stats_time_ns() : 0;
+}
+void wavefront_stats_end_compute(
+    wavefront_aligner_t* const wf_aligner,
+    const int score,
+    const uint64_t begin_ns) {
+  if (!wf_aligner->system.collect_stats) return;
+  wavefront_stats_t* const stats = &wf_aligner->stats;
+  stats->time_compute_ns += wavefront_stats_time_ns() - begin_ns;
+  ++(stats->num_steps);
+  // Wavefront length
+  wavefront_components_t* const wf_components = &wf_aligner->wf_components;
+  const int score_mod = (wf_components->memory_modular) ? score % wf_components->max_score_scope : score;
+  const wavefront_t* const mwavefront = wf_components->mwavefronts[score_mod];
+  if (mwavefront != NULL && mwavefront->lo <= mwavefront->hi) {
+    stats->max_wavefront_length = MAX(stats->max_wavefront_length,mwavefront->hi-mwavefront->lo+1);
+  }
+}
+void wavefront_stats_end_extend(
+    wavefront_aligner_t* const wf_aligner,
+    const uint64_t begin_ns) {
+  if (!wf_aligner->system.collect_stats) return;
+  wf_aligner->stats.time_extend_ns += wavefront_stats_time_ns() - begin_ns;
+  ++(wf_aligner->stats.num_extend_calls);
+}
+void wavefront_stats_end_backtrace(
+    wavefront_aligner_t* const wf_aligner,
+    const uint64_t begin_ns) {
+  if (!wf_aligner->system.collect_stats) return;
+  wf_aligner->stats.time_backtrace_ns += wavefront_stats_time_ns() - begin_ns;
+}
+void wavefront_stats_end_alignment(
+    wavefront_aligner_t* const wf_aligner,
+    const uint64_t memory_used) {
+  if (!wf_aligner->system.collect_stats) return;
+  wavefront_stats_t* const stats = &wf_aligner->stats;
+  // Gather those of the aligners of the bidirectional alignment
+  if (wf_aligner->bialigner != NULL) {
+    wavefront_bialigner_gather_stats(wf_aligner->bialigner,stats);
+  }
+  ++(stats->num_alignments);
+  stats->max_memory_used = MAX(stats->max_memory_used,memory_used);
+}
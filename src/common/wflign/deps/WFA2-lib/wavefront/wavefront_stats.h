@@ -0,0 +1,84 @@
+/*
+ *                             The MIT License
+ *
+ * Wavefront Alignment Algorithms
+ * Copyright (c) 2017 by Santiago Marco-Sola  <santiagomsola@gmail.com>
+ *
+ * This file is part of Wavefront Alignment Algorithms.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * PROJECT: Wavefront Alignment Algorithms
+ * AUTHOR(S): Santiago Marco-Sola <santiagomsola@gmail.com>
+ * DESCRIPTION: WFA module to gather statistics of the alignments
+ */
+
+#ifndef WAVEFRONT_STATS_H_
+#define WAVEFRONT_STATS_H_
+
+#include "utils/commons.h"
+
+// Wavefront ahead definition
+typedef struct _wavefront_aligner_t wavefront_aligner_t;
+
+/*
+ * Alignment statistics (gathered if system.collect_stats is set)
+ */
+typedef struct {
+  // Counters
+  uint64_t num_alignments;        // Alignments performed
+  uint64_t num_steps;             // WFA-steps (wavefronts computed)
+  uint64_t num_extend_calls;      // Wavefronts extended
+  int max_wavefront_length;       // Longest wavefront computed (diagonals)
+  uint64_t max_memory_used;       // Maximum memory used at the end of an alignment (Bytes)
+  // Times
+  uint64_t time_compute_ns;       // Time computing wavefronts
+  uint64_t time_extend_ns;        // Time extending wavefronts
+  uint64_t time_backtrace_ns;     // Time tracing back alignments
+} wavefront_stats_t;
+
+/*
+ * Setup
+ */
+void wavefront_stats_clear(
+    wavefront_stats_t* const stats);
+void wavefront_stats_add(
+    wavefront_stats_t* const stats,
+    const wavefront_stats_t* const stats_src);
+
+/*
+ * Gathering (no-ops unless the aligner collects statistics)
+ */
+uint64_t wavefront_stats_begin(
+    wavefront_aligner_t* const wf_aligner);
+void wavefront_stats_end_compute(
+    wavefront_aligner_t* const wf_aligner,
+    const int score,
+    const uint64_t begin_ns);
+void wavefront_stats_end_extend(
+    wavefront_aligner_t* const wf_aligner,
+    const uint64_t begin_ns);
+void wavefront_stats_end_backtrace(
+    wavefront_aligner_t* const wf_aligner,
+    const uint64_t begin_ns);
+void wavefront_stats_end_alignment(
+    wavefront_aligner_t* const wf_aligner,
+    const uint64_t memory_used);
+
+#endif /* WAVEFRONT_STATS_H_ */
@@ -248,19 +248,25 @@ int wavefront_unialign(
   int score = align_status->score;
   while (true) {
     // Exact extend s-wavefront
+    uint64_t stats_begin_ns = wavefront_stats_begin(wf_aligner);
     const int finished = (*wf_align_extend)(wf_aligner,score);
+    wavefront_stats_end_extend(wf_aligner,stats_begin_ns);
     if (finished) {
       // DEBUG
       // wavefront_aligner_print(stderr,wf_aligner,0,score,7,0);
       if (align_status->status == WF_STATUS_END_REACHED ||
           align_status->status == WF_STATUS_END_UNREACHABLE) {
+        stats_begin_ns = wavefront_stats_begin(wf_aligner);
         wavefront_unialign_terminate(wf_aligner,score);
+        wavefront_stats_end_backtrace(wf_aligner,stats_begin_ns);
       }
       return align_status->status;
     }
     // Compute (s+1)-wavefront
     ++score;
+    stats_begin_ns = wavefront_stats_begin(wf_aligner);
     (*wf_align_compute)(wf_aligner,score);
+    wavefront_stats_end_compute(wf_aligner,score,stats_begin_ns);
     // Probe limits
     if (wavefront_unialign_reached_limits(wf_aligner,score)) return align_status->status;
     // Plot
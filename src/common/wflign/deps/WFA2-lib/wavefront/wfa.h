@@ -38,6 +38,7 @@
 #include "wavefront_components.h"
 #include "wavefront_sequences.h"
 #include "wavefront_bialigner.h"
+#include "wavefront_stats.h"
 
 /*
  * Error codes & messages
@@ -117,6 +118,7 @@ typedef struct _wavefront_aligner_t {
   wavefront_plot_t* plot;                     // Wavefront plot
   // System
   alignment_system_t system;                  // System related parameters
+  wavefront_stats_t stats;                    // Statistics of the alignments (if system.collect_stats)
 } wavefront_aligner_t;
 
 /*
@@ -193,6 +195,15 @@ void wavefront_aligner_set_min_offsets_per_thread(
     wavefront_aligner_t* const wf_aligner,
     const int min_offsets_per_thread);
 
+/*
+ * Statistics
+ */
+void wavefront_aligner_set_collect_stats(
+    wavefront_aligner_t* const wf_aligner,
+    const bool collect_stats);
+void wavefront_aligner_clear_stats(
+    wavefront_aligner_t* const wf_aligner);
+
 /*
  * Wavefront Align
  */
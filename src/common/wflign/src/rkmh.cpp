@@ -1,5 +1,10 @@
 #include "rkmh.hpp"
 
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define RKMH_X86 1
+#include <immintrin.h>
+#endif
+
 namespace rkmh {
 
 // Check a string (as a char*) for non-canonical DNA bases
@@ -97,13 +102,15 @@ std::vector<hash_t> hash_sequence(const char* seq,
 }
 
 float compare(const std::vector<hash_t>& alpha, const std::vector<hash_t>& beta, const uint64_t& k) {
-    int i = 0;
-    int j = 0;
+    return compare(alpha.data(), alpha.size(), beta.data(), beta.size(), k);
+}
 
+/* Merge of the sketches from alpha[i] and beta[j] on */
+inline uint64_t merge_intersection_size(const hash_t* alpha, const uint64_t& alpha_size,
+                                        const hash_t* beta, const uint64_t& beta_size,
+                                        uint64_t i, uint64_t j) {
     uint64_t common = 0;
-    uint64_t denom = 0;
-
-    while (i < alpha.size() && j < beta.size()) {
+    while (i < alpha_size && j < beta_size) {
         if (alpha[i] == beta[j]) {
             i++;
             j++;
@@ -113,13 +120,120 @@ float compare(const std::vector<hash_t>& alpha, const std::vector<hash_t>& beta,
         } else {
             i++;
         }
+    }
+    return common;
+}
+
+#ifdef RKMH_X86
+
+/* Blocks of both sketches are compared all against all, the block with the smallest last
+ * hash being replaced by the next one. This only counts repeated hashes right if there are
+ * none, so the merge takes over at the first block holding a hash equal to its next one:
+ * every hash before is then distinct from the ones left, and the count so far is exact.
+ * A block is only taken with a hash after it, to compare the last one with it */
 
-        denom++;
+__attribute__((target("avx2")))
+uint64_t intersection_size_avx2(const hash_t* alpha, const uint64_t& alpha_size,
+                                const hash_t* beta, const uint64_t& beta_size) {
+    uint64_t i = 0;
+    uint64_t j = 0;
+    uint64_t common = 0;
+    while (i + 8 < alpha_size && j + 8 < beta_size) {
+        const __m256i a = _mm256_loadu_si256((const __m256i*)(alpha + i));
+        const __m256i b = _mm256_loadu_si256((const __m256i*)(beta + j));
+        const __m256i repeats = _mm256_or_si256(
+            _mm256_cmpeq_epi32(a, _mm256_loadu_si256((const __m256i*)(alpha + i + 1))),
+            _mm256_cmpeq_epi32(b, _mm256_loadu_si256((const __m256i*)(beta + j + 1))));
+        if (!_mm256_testz_si256(repeats, repeats)) {
+            break;
+        }
+        // the 8 rotations of b, as 4 rotations within its 128-bit lanes, with and without the lanes swapped
+        const __m256i s = _mm256_permute2x128_si256(b, b, 1);
+        __m256i m = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi32(a, b),
+                            _mm256_cmpeq_epi32(a, _mm256_shuffle_epi32(b, _MM_SHUFFLE(0, 3, 2, 1)))),
+            _mm256_or_si256(_mm256_cmpeq_epi32(a, _mm256_shuffle_epi32(b, _MM_SHUFFLE(1, 0, 3, 2))),
+                            _mm256_cmpeq_epi32(a, _mm256_shuffle_epi32(b, _MM_SHUFFLE(2, 1, 0, 3)))));
+        m = _mm256_or_si256(m, _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi32(a, s),
+                            _mm256_cmpeq_epi32(a, _mm256_shuffle_epi32(s, _MM_SHUFFLE(0, 3, 2, 1)))),
+            _mm256_or_si256(_mm256_cmpeq_epi32(a, _mm256_shuffle_epi32(s, _MM_SHUFFLE(1, 0, 3, 2))),
+                            _mm256_cmpeq_epi32(a, _mm256_shuffle_epi32(s, _MM_SHUFFLE(2, 1, 0, 3))))));
+        common += __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(m)));
+        const hash_t a_last = alpha[i + 7];
+        const hash_t b_last = beta[j + 7];
+        i += a_last <= b_last ? 8 : 0;
+        j += b_last <= a_last ? 8 : 0;
     }
+    return common + merge_intersection_size(alpha, alpha_size, beta, beta_size, i, j);
+}
 
-    // complete the union operation
-    denom += alpha.size() - i;
-    denom += beta.size() - j;
+__attribute__((target("avx512f")))
+uint64_t intersection_size_avx512(const hash_t* alpha, const uint64_t& alpha_size,
+                                  const hash_t* beta, const uint64_t& beta_size) {
+    uint64_t i = 0;
+    uint64_t j = 0;
+    uint64_t common = 0;
+    while (i + 16 < alpha_size && j + 16 < beta_size) {
+        const __m512i a = _mm512_loadu_si512(alpha + i);
+        const __m512i b = _mm512_loadu_si512(beta + j);
+        if (_mm512_cmpeq_epi32_mask(a, _mm512_loadu_si512(alpha + i + 1))
+            | _mm512_cmpeq_epi32_mask(b, _mm512_loadu_si512(beta + j + 1))) {
+            break;
+        }
+        // each hash of the block of beta against the whole block of alpha
+        __mmask16 m = 0;
+        for (int l = 0; l < 16; ++l) {
+            m |= _mm512_cmpeq_epi32_mask(a, _mm512_set1_epi32(beta[j + l]));
+        }
+        common += __builtin_popcount(m);
+        const hash_t a_last = alpha[i + 15];
+        const hash_t b_last = beta[j + 15];
+        i += a_last <= b_last ? 16 : 0;
+        j += b_last <= a_last ? 16 : 0;
+    }
+    return common + merge_intersection_size(alpha, alpha_size, beta, beta_size, i, j);
+}
+
+#endif
+
+typedef uint64_t (*intersection_kernel_t)(const hash_t*, const uint64_t&, const hash_t*, const uint64_t&);
+
+inline uint64_t intersection_size_scalar(const hash_t* alpha, const uint64_t& alpha_size,
+                                         const hash_t* beta, const uint64_t& beta_size) {
+    return merge_intersection_size(alpha, alpha_size, beta, beta_size, 0, 0);
+}
+
+/* The blocks of 16 only pay off on sketches longer than those of the default wflambda
+ * segments, the AVX-512 kernel is only taken from that length on */
+const uint64_t min_avx512_sketch = 256;
+
+inline intersection_kernel_t select_intersection_kernel(const bool& long_sketches) {
+#ifdef RKMH_X86
+    __builtin_cpu_init();
+    if (long_sketches && __builtin_cpu_supports("avx512f")) {
+        return intersection_size_avx512;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        return intersection_size_avx2;
+    }
+#endif
+    return intersection_size_scalar;
+}
+
+uint64_t intersection_size(const hash_t* alpha, const uint64_t& alpha_size,
+                           const hash_t* beta, const uint64_t& beta_size) {
+    static const intersection_kernel_t kernel = select_intersection_kernel(false);
+    static const intersection_kernel_t long_kernel = select_intersection_kernel(true);
+    return (alpha_size < min_avx512_sketch || beta_size < min_avx512_sketch ? kernel : long_kernel)(
+        alpha, alpha_size, beta, beta_size);
+}
+
+float compare(const hash_t* alpha, const uint64_t& alpha_size,
+              const hash_t* beta, const uint64_t& beta_size, const uint64_t& k) {
+    // the merge steps once per hash of the union, repeated hashes included
+    const uint64_t common = intersection_size(alpha, alpha_size, beta, beta_size);
+    const uint64_t denom = alpha_size + beta_size - common;
 
     float distance = 0.0;
 
@@ -139,4 +253,97 @@ float compare(const std::vector<hash_t>& alpha, const std::vector<hash_t>& beta,
     return distance;
 }
 
+void hash_kmers(const char* seq, const uint64_t& from, const uint64_t& to, const uint64_t& k, hash_t* out) {
+    if (from >= to) {
+        return;
+    }
+    // first position after the last non-canonical base
+    uint64_t valid_from = from;
+    for (uint64_t e = from; e + 1 < to + k; ++e) {
+        if (valid_dna[seq[e]]) {
+            valid_from = e + 1;
+        }
+        // the k-mer at p ends at e
+        if (e + 1 >= from + k) {
+            const uint64_t p = e + 1 - k;
+            if (valid_from <= p) {
+                char fhash[16];
+                MurmurHash3_x64_128(seq + p, k, 42, &fhash);
+                out[p - from] = *((hash_t*)fhash);
+            } else {
+                out[p - from] = std::numeric_limits<hash_t>::max();
+            }
+        }
+    }
+}
+
+segment_sketches_t::segment_sketches_t(const char* seq,
+                                       const uint64_t& len,
+                                       const uint64_t& k,
+                                       const int& segments,
+                                       const uint64_t& step,
+                                       const uint64_t& segment_length,
+                                       const float& sketch_rate)
+    : len(len), k(k), segments(segments), step(step), segment_length(segment_length), sketch_rate(sketch_rate),
+      offsets(segments + 1, 0), sizes(segments, not_built) {
+    // as calc_hashes does, the last k-mer of the sequence is not hashed
+    if (len > k) {
+        owned_hashes.resize(len - k);
+        hash_kmers(seq, 0, len - k, k, owned_hashes.data());
+    }
+    hashes = owned_hashes.data();
+    allocate();
+}
+
+segment_sketches_t::segment_sketches_t(const hash_t* hashes,
+                                       const uint64_t& len,
+                                       const uint64_t& k,
+                                       const int& segments,
+                                       const uint64_t& step,
+                                       const uint64_t& segment_length,
+                                       const float& sketch_rate)
+    : len(len), k(k), segments(segments), step(step), segment_length(segment_length), sketch_rate(sketch_rate),
+      hashes(hashes), offsets(segments + 1, 0), sizes(segments, not_built) {
+    allocate();
+}
+
+void segment_sketches_t::allocate() {
+    for (int v = 0; v < segments; ++v) {
+        offsets[v + 1] = offsets[v] + (uint64_t)((float)length_of(v) * sketch_rate);
+    }
+    sketches.reset(new hash_t[offsets.back()]);
+}
+
+uint64_t segment_sketches_t::bytes(const uint64_t& len,
+                                   const int& segments,
+                                   const uint64_t& segment_length,
+                                   const float& sketch_rate) {
+    return len * sizeof(hash_t)
+        + (uint64_t)((float)(segments + 1) * segment_length * sketch_rate) * sizeof(hash_t)
+        + (uint64_t)segments * (sizeof(uint64_t) + sizeof(uint32_t));
+}
+
+uint64_t segment_sketches_t::length_of(const int& v) const {
+    return v == segments - 1 ? len - v * step : segment_length;
+}
+
+const hash_t* segment_sketches_t::sketch(const int& v, uint64_t& size) {
+    hash_t* out = sketches.get() + offsets[v];
+    if (sizes[v] == not_built) {
+        const uint64_t begin = v * step;
+        const uint64_t length = length_of(v);
+        const uint64_t slots = offsets[v + 1] - offsets[v];
+        uint64_t n = 0;
+        if (length > k && slots > 0) {
+            const hash_t* from = hashes + begin;
+            n = std::partial_sort_copy(from, from + (length - k), out, out + slots) - out;
+            // we remove non-canonical hashes which sort last
+            n = std::lower_bound(out, out + n, std::numeric_limits<hash_t>::max()) - out;
+        }
+        sizes[v] = n;
+    }
+    size = sizes[v];
+    return out;
+}
+
 }
@@ -7,6 +7,7 @@
 #include <unordered_set>
 #include <math.h>
 #include <algorithm>
+#include <memory>
 #include "murmur3.hpp"
 
 // From Eric's https://github.com/edawson/rkmh
@@ -49,4 +50,67 @@ std::vector<hash_t> hash_sequence(const char* seq,
 
 float compare(const std::vector<hash_t>& alpha, const std::vector<hash_t>& beta, const uint64_t& k);
 
+float compare(const hash_t* alpha, const uint64_t& alpha_size,
+              const hash_t* beta, const uint64_t& beta_size, const uint64_t& k);
+
+/* Hashes two sorted sketches have in common, as many times as the one holding fewest copies has them */
+uint64_t intersection_size(const hash_t* alpha, const uint64_t& alpha_size,
+                           const hash_t* beta, const uint64_t& beta_size);
+
+// Hashes of the k-mers of seq starting at [from, to) into out, the maximum hash for those
+// with a non-canonical base, as calc_hashes gives them; seq is read up to to + k - 1
+void hash_kmers(const char* seq, const uint64_t& from, const uint64_t& to, const uint64_t& k, hash_t* out);
+
+// Sketches of the overlapping segments of a sequence, segment v starting at
+// v * step, the last one running to the end of the sequence. Each k-mer is
+// hashed once for all the segments it is in, and each sketch, the same as
+// hash_sequence gives for its segment, is kept in one flat buffer once built.
+class segment_sketches_t {
+public:
+    segment_sketches_t(const char* seq,
+                       const uint64_t& len,
+                       const uint64_t& k,
+                       const int& segments,
+                       const uint64_t& step,
+                       const uint64_t& segment_length,
+                       const float& sketch_rate);
+
+    // The same over the hashes of the k-mers of the sequence hashed before, those of
+    // the len - k first positions, which have to outlive the sketches
+    segment_sketches_t(const hash_t* hashes,
+                       const uint64_t& len,
+                       const uint64_t& k,
+                       const int& segments,
+                       const uint64_t& step,
+                       const uint64_t& segment_length,
+                       const float& sketch_rate);
+
+    // Bytes used for a sequence of length len
+    static uint64_t bytes(const uint64_t& len,
+                          const int& segments,
+                          const uint64_t& segment_length,
+                          const float& sketch_rate);
+
+    // Sketch of segment v, of size hashes
+    const hash_t* sketch(const int& v, uint64_t& size);
+
+private:
+    uint64_t len;
+    uint64_t k;
+    int segments;
+    uint64_t step;
+    uint64_t segment_length;
+    float sketch_rate;
+    std::vector<hash_t> owned_hashes;           // of the k-mer at each position, unless given
+    const hash_t* hashes;
+    std::unique_ptr<hash_t[]> sketches;         // room for the sketch of each segment
+    std::vector<uint64_t> offsets;
+    std::vector<uint32_t> sizes;                // unbuilt sketches are not_built
+
+    static constexpr uint32_t not_built = std::numeric_limits<uint32_t>::max();
+
+    uint64_t length_of(const int& v) const;
+    void allocate();
+};
+
 }
@@ -4,6 +4,9 @@
 
 #include "wflign.hpp"
 #include "wflign_patch.hpp"
+#include "../../hot_counters.hpp"
+#include "../../trace.hpp"
+#include "../../probes.hpp"
 
 
 // Namespaces
@@ -14,7 +17,352 @@ namespace wavefront {
 * Configuration
 */
 #define MAX_LEN_FOR_STANDARD_WFA 1000
+#define MAX_LEN_FOR_HIGH_MEMORY_PATCH 512
+#define IDENTITY_SCREEN_KMER       15
+#define IDENTITY_SCREEN_MARGIN     0.05 // below min_identity by more than this to be dropped unaligned
 #define MIN_WF_LENGTH            256
+#define MAX_MEMORY_RESIDENT      (512ul * 1024 * 1024) // WFA default for the memory kept between alignments
+
+/*
+* Reused aligners
+*/
+inline bool same_affine_penalties(const wflign_penalties_t& a, const wflign_penalties_t& b) {
+    return a.mismatch == b.mismatch && a.gap_opening1 == b.gap_opening1 && a.gap_extension1 == b.gap_extension1;
+}
+/*
+* Memory ceiling (0 for none), the memory kept between alignments being within it too
+*/
+inline void limit_memory(wfa::WFAligner& aligner, const uint64_t max_memory) {
+    if (max_memory > 0) {
+        aligner.setMaxMemory(std::min<uint64_t>(max_memory, MAX_MEMORY_RESIDENT), max_memory);
+    } else {
+        aligner.setMaxMemory(MAX_MEMORY_RESIDENT, UINT64_MAX);
+    }
+}
+/*
+* Bytes the wavefronts of MemoryHigh may take to align a pair of segments up to max_score
+*/
+inline uint64_t segment_high_memory(const uint64_t segment_length, const int max_score) {
+    // the M, I and D wavefronts of every score, each with up to an offset per diagonal
+    return (uint64_t)max_score * (2 * segment_length + 1) * 3 * sizeof(int32_t);
+}
+/*
+* The segment aligner of aligners, and the linear memory one taking over when it runs out of
+* memory under a ceiling (else nullptr)
+*/
+inline void segment_aligners(
+        WFlignAligners& aligners,
+        const wflign_penalties_t& penalties,
+        const uint64_t max_memory,
+        const uint16_t segment_length,
+        const float inception_score_max_ratio,
+        wfa::WFAlignerGapAffine*& wf_aligner,
+        wfa::WFAlignerGapAffine*& wf_aligner_low_memory) {
+    wf_aligner = nullptr;
+    wf_aligner_low_memory = nullptr;
+    // under a memory ceiling, segments fitting it in MemoryHigh only in the best cases start
+    // in linear memory, and the others go on in it if they run out of memory
+    if (max_memory > 0) {
+        wf_aligner_low_memory = &aligners.segment_low_memory(penalties);
+        limit_memory(*wf_aligner_low_memory, max_memory);
+        const int max_segment_score = (int)((float)segment_length * inception_score_max_ratio);
+        if (segment_high_memory(segment_length, max_segment_score) > max_memory) {
+            wf_aligner = wf_aligner_low_memory;
+            wf_aligner_low_memory = nullptr;
+        }
+    }
+    if (wf_aligner == nullptr) {
+        wf_aligner = &aligners.segment(penalties);
+        limit_memory(*wf_aligner, max_memory);
+    }
+}
+/*
+* Bytes the wavefronts of MemoryHigh may take to align a patch of the given longest side
+* up to the default patching score bound
+*/
+inline uint64_t patch_high_memory(const uint64_t length, const wflign_penalties_t& penalties) {
+    const uint64_t max_score = penalties.gap_opening2 + penalties.gap_extension1 * length + 64;
+    // the M, I1, I2, D1 and D2 wavefronts of every score, each with up to an offset per diagonal
+    return max_score * (2 * length + 1) * 5 * sizeof(int32_t);
+}
+/*
+* Patch solvers, on parallel_for if any with patching aligners kept by each thread for them,
+* apart from the aligners of the alignments the thread may be running, else with aligners
+*/
+inline wflign_patch_tasks_t patch_tasks(
+        const wflign_parallel_for_t& parallel_for,
+        const wflign_penalties_t& penalties,
+        const uint64_t max_memory,
+        WFlignAligners* const aligners,
+        wflign_stats_t* const stats) {
+    wflign_patch_tasks_t tasks;
+    tasks.parallel_for = parallel_for;
+    tasks.stats = stats;
+    if (parallel_for) {
+        tasks.aligner = [penalties, max_memory, stats](const uint64_t query_length, const uint64_t target_length)
+                -> wfa::WFAlignerGapAffine2Pieces& {
+            static thread_local WFlignAligners patch_aligners;
+            wfa::WFAlignerGapAffine2Pieces& aligner =
+                patch_aligners.patch(penalties, query_length, target_length, max_memory);
+            limit_memory(aligner, max_memory);
+            if (stats) wflign_stats_t::collect(aligner);
+            return aligner;
+        };
+    } else {
+        tasks.aligner = [penalties, max_memory, aligners, stats](const uint64_t query_length, const uint64_t target_length)
+                -> wfa::WFAlignerGapAffine2Pieces& {
+            wfa::WFAlignerGapAffine2Pieces& aligner =
+                aligners->patch(penalties, query_length, target_length, max_memory);
+            limit_memory(aligner, max_memory);
+            if (stats) wflign_stats_t::collect(aligner);
+            return aligner;
+        };
+    }
+    return tasks;
+}
+wfa::WFAlignerGapAffine2Pieces& WFlignAligners::biwfa(const wflign_penalties_t& penalties) {
+    if (!biwfa_aligner || !same_affine_penalties(penalties, biwfa_penalties)
+        || penalties.gap_opening2 != biwfa_penalties.gap_opening2
+        || penalties.gap_extension2 != biwfa_penalties.gap_extension2) {
+        biwfa_aligner.reset(new wfa::WFAlignerGapAffine2Pieces(
+                0,
+                penalties.mismatch,
+                penalties.gap_opening1,
+                penalties.gap_extension1,
+                penalties.gap_opening2,
+                penalties.gap_extension2,
+                wfa::WFAligner::Alignment,
+                wfa::WFAligner::MemoryUltralow));
+        biwfa_penalties = penalties;
+        WFMASH_PROBE(aligner_alloc, 3);
+    }
+    biwfa_aligner->setHeuristicNone();
+    biwfa_aligner->setMaxAlignmentSteps(INT_MAX);
+    biwfa_aligner->setMaxNumThreads(1);
+    return *biwfa_aligner;
+}
+wfa::WFAlignerGapAffine2Pieces& WFlignAligners::patch(
+        const wflign_penalties_t& penalties,
+        const uint64_t query_length,
+        const uint64_t target_length,
+        const uint64_t max_memory) {
+    const uint64_t length = std::max(query_length, target_length);
+    if (length > MAX_LEN_FOR_HIGH_MEMORY_PATCH
+        || (max_memory > 0 && patch_high_memory(length, penalties) > max_memory)) {
+        return biwfa(penalties);
+    }
+    if (!small_patch_aligner || !same_affine_penalties(penalties, small_patch_penalties)
+        || penalties.gap_opening2 != small_patch_penalties.gap_opening2
+        || penalties.gap_extension2 != small_patch_penalties.gap_extension2) {
+        small_patch_aligner.reset(new wfa::WFAlignerGapAffine2Pieces(
+                0,
+                penalties.mismatch,
+                penalties.gap_opening1,
+                penalties.gap_extension1,
+                penalties.gap_opening2,
+                penalties.gap_extension2,
+                wfa::WFAligner::Alignment,
+                wfa::WFAligner::MemoryHigh));
+        small_patch_penalties = penalties;
+        WFMASH_PROBE(aligner_alloc, 2);
+    }
+    small_patch_aligner->setHeuristicNone();
+    small_patch_aligner->setMaxAlignmentSteps(INT_MAX);
+    return *small_patch_aligner;
+}
+wfa::WFAlignerGapAffine& WFlignAligners::wflambda(const wflign_penalties_t& penalties) {
+    if (!wflambda_aligner || !same_affine_penalties(penalties, wflambda_penalties)) {
+        wflambda_aligner.reset(new wfa::WFAlignerGapAffine(
+                penalties.mismatch,
+                penalties.gap_opening1,
+                penalties.gap_extension1,
+                wfa::WFAligner::Alignment,
+                wfa::WFAligner::MemoryUltralow));
+        wflambda_penalties = penalties;
+        WFMASH_PROBE(aligner_alloc, 0);
+    }
+    wflambda_aligner->setHeuristicNone();
+    wflambda_aligner->setMaxAlignmentSteps(INT_MAX);
+    return *wflambda_aligner;
+}
+wfa::WFAlignerGapAffine& WFlignAligners::segment(const wflign_penalties_t& penalties) {
+    if (!segment_aligner || !same_affine_penalties(penalties, segment_penalties)) {
+        segment_aligner.reset(new wfa::WFAlignerGapAffine(
+                penalties.mismatch,
+                penalties.gap_opening1,
+                penalties.gap_extension1,
+                wfa::WFAligner::Alignment,
+                wfa::WFAligner::MemoryHigh));
+        segment_penalties = penalties;
+        WFMASH_PROBE(aligner_alloc, 1);
+    }
+    segment_aligner->setHeuristicNone();
+    segment_aligner->setMaxAlignmentSteps(INT_MAX);
+    return *segment_aligner;
+}
+const rkmh::hash_t* WFlignAligners::query_hashes(
+        const std::string& query_name,
+        const uint64_t query_total_length,
+        const bool query_is_rev,
+        const uint64_t window_begin,
+        const char* window,
+        const uint64_t window_length,
+        const uint64_t k) {
+    if (window_length <= k || window_length > max_kept_query_bases) {
+        return nullptr;
+    }
+    const uint64_t window_end = window_begin + window_length;
+    ++query_uses;
+    size_t at = kept_queries.size();
+    for (size_t i = 0; i < kept_queries.size(); ++i) {
+        const kept_query_t& kept = kept_queries[i];
+        if (kept.name == query_name && kept.total_length == query_total_length
+            && kept.is_rev == query_is_rev && kept.k == k) {
+            at = i;
+            break;
+        }
+    }
+    // bases of the stretch kept, and of the others
+    uint64_t others = 0;
+    for (size_t i = 0; i < kept_queries.size(); ++i) {
+        if (i != at) {
+            others += kept_queries[i].bases.size();
+        }
+    }
+    if (at < kept_queries.size()) {
+        kept_query_t& kept = kept_queries[at];
+        const uint64_t kept_end = kept.begin + kept.bases.size();
+        const uint64_t overlap_begin = std::max(window_begin, kept.begin);
+        const uint64_t overlap_end = std::min(window_end, kept_end);
+        // the stretch is extended by a window touching it with the same bases where they overlap
+        if (window_begin <= kept_end && window_end >= kept.begin
+            && (overlap_begin >= overlap_end
+                || std::memcmp(window + (overlap_begin - window_begin),
+                               kept.bases.data() + (overlap_begin - kept.begin),
+                               overlap_end - overlap_begin) == 0)) {
+            kept.last_used = query_uses;
+            if (window_begin >= kept.begin && window_end <= kept_end) {
+                return kept.hashes.data() + (window_begin - kept.begin);
+            }
+            const uint64_t begin = std::min(window_begin, kept.begin);
+            const uint64_t end = std::max(window_end, kept_end);
+            if (end - begin <= max_kept_query_bases) {
+                std::string bases(end - begin, '\0');
+                std::memcpy(&bases[window_begin - begin], window, window_length);
+                std::memcpy(&bases[kept.begin - begin], kept.bases.data(), kept.bases.size());
+                std::vector<rkmh::hash_t> hashes(end - begin - k + 1);
+                std::copy(kept.hashes.begin(), kept.hashes.end(), hashes.begin() + (kept.begin - begin));
+                // the k-mers not wholly in the stretch kept
+                rkmh::hash_kmers(bases.data(), 0, kept.begin - begin, k, hashes.data());
+                rkmh::hash_kmers(bases.data(), kept_end - k + 1 - begin, end - k + 1 - begin, k,
+                                 hashes.data() + (kept_end - k + 1 - begin));
+                kept.begin = begin;
+                kept.bases.swap(bases);
+                kept.hashes.swap(hashes);
+                // the least recently used of the others make room for it
+                while (others + (end - begin) > max_kept_query_bases) {
+                    size_t oldest = at == 0 ? 1 : 0;
+                    for (size_t i = 0; i < kept_queries.size(); ++i) {
+                        if (i != at && kept_queries[i].last_used < kept_queries[oldest].last_used) {
+                            oldest = i;
+                        }
+                    }
+                    others -= kept_queries[oldest].bases.size();
+                    kept_queries.erase(kept_queries.begin() + oldest);
+                    if (oldest < at) {
+                        --at;
+                    }
+                }
+                kept_query_t& extended = kept_queries[at];
+                return extended.hashes.data() + (window_begin - extended.begin);
+            }
+        }
+    } else {
+        if (kept_queries.size() == max_kept_queries) {
+            at = 0;
+            for (size_t i = 1; i < kept_queries.size(); ++i) {
+                if (kept_queries[i].last_used < kept_queries[at].last_used) {
+                    at = i;
+                }
+            }
+            others -= kept_queries[at].bases.size();
+        } else {
+            kept_queries.emplace_back();
+        }
+    }
+    // the window alone, in place of the stretch of the query or of the least recently used
+    while (others + window_length > max_kept_query_bases) {
+        size_t oldest = at == 0 ? 1 : 0;
+        for (size_t i = 0; i < kept_queries.size(); ++i) {
+            if (i != at && kept_queries[i].last_used < kept_queries[oldest].last_used) {
+                oldest = i;
+            }
+        }
+        others -= kept_queries[oldest].bases.size();
+        kept_queries.erase(kept_queries.begin() + oldest);
+        if (oldest < at) {
+            --at;
+        }
+    }
+    kept_query_t& kept = kept_queries[at];
+    kept.name = query_name;
+    kept.total_length = query_total_length;
+    kept.is_rev = query_is_rev;
+    kept.k = k;
+    kept.begin = window_begin;
+    kept.bases.assign(window, window_length);
+    kept.hashes.resize(window_length - k + 1);
+    rkmh::hash_kmers(window, 0, window_length - k + 1, k, kept.hashes.data());
+    kept.last_used = query_uses;
+    return kept.hashes.data();
+}
+uint64_t WFlignAligners::memory_used() const {
+    uint64_t bytes = 0;
+    for (wfa::WFAligner* aligner : std::initializer_list<wfa::WFAligner*>{
+             biwfa_aligner.get(), small_patch_aligner.get(), wflambda_aligner.get(),
+             segment_aligner.get(), segment_low_memory_aligner.get()}) {
+        if (aligner != nullptr) {
+            bytes += aligner->getMemoryUsed();
+        }
+    }
+    for (const kept_query_t& kept : kept_queries) {
+        bytes += kept.bases.capacity() + kept.hashes.capacity() * sizeof(rkmh::hash_t);
+    }
+    return bytes;
+}
+wfa::WFAlignerGapAffine& WFlignAligners::segment_low_memory(const wflign_penalties_t& penalties) {
+    if (!segment_low_memory_aligner || !same_affine_penalties(penalties, segment_low_memory_penalties)) {
+        segment_low_memory_aligner.reset(new wfa::WFAlignerGapAffine(
+                penalties.mismatch,
+                penalties.gap_opening1,
+                penalties.gap_extension1,
+                wfa::WFAligner::Alignment,
+                wfa::WFAligner::MemoryUltralow));
+        segment_low_memory_penalties = penalties;
+        WFMASH_PROBE(aligner_alloc, 1);
+    }
+    segment_low_memory_aligner->setHeuristicNone();
+    segment_low_memory_aligner->setMaxAlignmentSteps(INT_MAX);
+    return *segment_low_memory_aligner;
+}
+
+/*
+* Statistics
+*/
+wflign_stats_t::wflign_stats_t() {
+    wavefront_stats_clear(&wflambda);
+    wavefront_stats_clear(&alignments);
+}
+void wflign_stats_t::collect(wfa::WFAligner& aligner) {
+    aligner.setCollectStats(true);
+}
+void wflign_stats_t::take(wfa::WFAligner& aligner, const bool wflambda_layer) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        wavefront_stats_add(wflambda_layer ? &wflambda : &alignments, &aligner.getStats());
+    }
+    aligner.clearStats();
+}
 
 /*
 * Utils
@@ -28,6 +376,59 @@ inline void decode_pair(uint64_t pair, int *v, int *h) {
     *v = (int)(pair >> 32);
     *h = (int)(pair & 0x00000000FFFFFFFF);
 }
+/*
+* Cells of the wflambda layer
+*/
+wflambda_cells_t::wflambda_cells_t(const int pattern_length, const int text_length)
+    : pattern_length(pattern_length), text_length(text_length),
+      band((uint32_t*)calloc(std::max(pattern_length, 0) * band_width, sizeof(uint32_t)), &free) {
+    if (band == nullptr && pattern_length > 0) {
+        throw std::bad_alloc();
+    }
+}
+uint32_t& wflambda_cells_t::state(const int v, const int h) {
+    const int64_t offset = h - (int64_t)v * text_length / pattern_length + band_radius;
+    if (offset >= 0 && offset < band_width) {
+        return band[v * band_width + offset];
+    }
+    return outside[encode_pair(v, h)];
+}
+uint32_t wflambda_cells_t::add(alignment_t&& aln) {
+    arena.push_back(std::move(aln));
+    return first_alignment + (arena.size() - 1);
+}
+alignment_t* wflambda_cells_t::alignment(const uint32_t state) {
+    return state >= first_alignment ? &arena[state - first_alignment] : nullptr;
+}
+alignment_t* wflambda_cells_t::alignment(const int v, const int h) {
+    return alignment(state(v, h));
+}
+void wflambda_cells_t::release_unkept() {
+    for (auto& aln : arena) {
+        if (!aln.keep) {
+            aln = alignment_t();
+        }
+    }
+}
+void wflambda_cells_t::for_each(const std::function<void(int, int, uint32_t)>& f) const {
+    for (int v = 0; v < pattern_length; ++v) {
+        const int64_t center = (int64_t)v * text_length / pattern_length;
+        for (int64_t offset = 0; offset < band_width; ++offset) {
+            const uint32_t s = band[v * band_width + offset];
+            if (s != unknown) {
+                f(v, (int)(center + offset - band_radius), s);
+            }
+        }
+    }
+    for (const auto& p : outside) {
+        if (p.second != unknown) {
+            int v, h;
+            decode_pair(p.first, &v, &h);
+            f(v, h, p.second);
+        }
+    }
+}
+
 void clean_up_sketches(std::vector<std::vector<rkmh::hash_t>*> &sketches) {
     // The C++ language guarantees that `delete p` will do nothing if p is equal to NULL
     for (auto &s : sketches) {
@@ -108,45 +509,75 @@ WFlign::WFlign(
     this->target_length = 0;
     // Output
     this->out = nullptr;
-#ifdef WFA_PNG_TSV_TIMING
     this->emit_tsv = false;
     this->out_tsv = nullptr;
     this->prefix_wavefront_plot_in_png = nullptr;
     this->wfplot_max_size = 0;
     this->emit_patching_tsv = false;
     this->out_patching_tsv = nullptr;
-#endif
     this->merge_alignments = false;
     this->emit_md_tag = false;
     this->paf_format_else_sam = false;
     this->no_seq_in_sam = false;
+    this->score_only = false;
+    this->screen_identity = false;
+    this->aligners = nullptr;
+    this->max_memory = 0;
+    this->biwfa_threads = 1;
+    this->stats = nullptr;
+    this->fetch_target = nullptr;
+    this->anchors = nullptr;
+}
+void WFlign::set_aligners(WFlignAligners* const aligners) {
+    this->aligners = aligners;
+}
+void WFlign::set_max_memory(const uint64_t max_memory) {
+    this->max_memory = max_memory;
+}
+void WFlign::set_parallel_for(const wflign_parallel_for_t& parallel_for) {
+    this->parallel_for = parallel_for;
+}
+void WFlign::set_biwfa_threads(const int biwfa_threads) {
+    this->biwfa_threads = biwfa_threads;
+}
+void WFlign::set_stats(wflign_stats_t* const stats) {
+    this->stats = stats;
+}
+void WFlign::set_target_fetch(const wflign_target_fetch_t* const fetch_target) {
+    this->fetch_target = fetch_target;
+}
+void WFlign::set_score_only(const bool score_only) {
+    this->score_only = score_only;
+}
+void WFlign::set_screen_identity(const bool screen_identity) {
+    this->screen_identity = screen_identity;
+}
+void WFlign::set_anchors(const std::vector<std::pair<uint64_t, uint64_t>>* const anchors) {
+    this->anchors = anchors;
 }
 /*
 * Output configuration
 */
 void WFlign::set_output(
     std::ostream* const out,
-#ifdef WFA_PNG_TSV_TIMING
     const bool emit_tsv,
     std::ostream* const out_tsv,
     const std::string &wfplot_filepath,
     const uint64_t wfplot_max_size,
     const bool emit_patching_tsv,
     std::ostream* const out_patching_tsv,
-#endif
     const bool merge_alignments,
     const bool emit_md_tag,
     const bool paf_format_else_sam,
     const bool no_seq_in_sam) {
     this->out = out;
-#ifdef WFA_PNG_TSV_TIMING
     this->emit_tsv = emit_tsv;
     this->out_tsv = out_tsv;
-    this->prefix_wavefront_plot_in_png = &wfplot_filepath;
+    // kept only if set, as it may be a temporary otherwise
+    this->prefix_wavefront_plot_in_png = wfplot_filepath.empty() ? nullptr : &wfplot_filepath;
     this->wfplot_max_size = wfplot_max_size;
     this->emit_patching_tsv = emit_patching_tsv;
     this->out_patching_tsv = out_patching_tsv;
-#endif
     this->merge_alignments = merge_alignments;
     this->emit_md_tag = emit_md_tag;
     this->paf_format_else_sam = paf_format_else_sam;
@@ -155,6 +586,76 @@ void WFlign::set_output(
 /*
 * WFlambda
 */
+/*
+* Segments of the cell (v,h) of the wflambda layer
+*/
+inline void wflambda_segments(
+    const wflign_extend_data_t* const extend_data,
+    const int v,
+    const int h,
+    int64_t& query_begin,
+    int64_t& target_begin,
+    uint16_t& segment_length_to_use_q,
+    uint16_t& segment_length_to_use_t) {
+    const WFlign& wflign = *(extend_data->wflign);
+    const int step_size = extend_data->step_size;
+    const int segment_length_to_use = extend_data->segment_length_to_use;
+    query_begin = v * step_size;
+    target_begin = h * step_size;
+    // The last fragment can be longer than segment_length_to_use (max 2*segment_length_to_use - 1)
+    segment_length_to_use_q =
+            (v == extend_data->pattern_length - 1) ? wflign.query_length - query_begin : segment_length_to_use;
+    segment_length_to_use_t =
+            (h == extend_data->text_length - 1) ? wflign.target_length - target_begin : segment_length_to_use;
+}
+/*
+* Records the evaluation of the cell (v,h), aln holding the alignment of its segments if
+* they were aligned, and returns whether they match
+*/
+bool wflambda_cell_evaluated(
+    wflign_extend_data_t* const extend_data,
+    uint32_t& cell,
+    const int v,
+    const int h,
+    const bool alignment_performed,
+    alignment_t& aln) {
+    const WFlign& wflign = *(extend_data->wflign);
+    wflambda_cells_t& cells = *(extend_data->cells);
+    bool is_a_match = false;
+    hot_counters::add(hot_counters::wflambda_cells_evaluated);
+    hot_counters::add(hot_counters::wflambda_cells_aligned, alignment_performed);
+    if (wflign.emit_tsv) {
+        // 0) Mis-match, alignment skipped
+        // 1) Mis-match, alignment performed
+        // 2) Match, alignment performed
+        *(wflign.out_tsv) << v << "\t" << h << "\t"
+                          << (alignment_performed ? (aln.ok ? 2 : 1) : 0)
+                          << std::endl;
+    }
+    ++(extend_data->num_alignments);
+    if (alignment_performed) {
+        ++(extend_data->num_alignments_performed);
+        if (aln.ok){
+            is_a_match = true;
+            cell = cells.add(std::move(aln));
+        } else {
+            cell = wflambda_cells_t::failed;
+        }
+    } else {
+        // the same sketches would give the same distance again
+        cell = wflambda_cells_t::no_alignment;
+        if (extend_data->emit_png) {
+            extend_data->high_order_dp_matrix_mismatch->insert(encode_pair(v, h));
+        }
+    }
+
+    if (extend_data->num_sketches_allocated > extend_data->max_num_sketches_in_memory) {
+        clean_up_sketches(*(extend_data->query_sketches));
+        clean_up_sketches(*(extend_data->target_sketches));
+        extend_data->num_sketches_allocated = 0;
+    }
+    return is_a_match;
+}
 int wflambda_extend_match(
     const int v,
     const int h,
@@ -163,38 +664,24 @@ int wflambda_extend_match(
     wflign_extend_data_t* extend_data = (wflign_extend_data_t*)arguments;
     // Expand arguments
     const WFlign& wflign = *(extend_data->wflign);
-    const uint64_t query_length = wflign.query_length;
-    const uint64_t target_length = wflign.target_length;
-    const int step_size = extend_data->step_size;
-    const int segment_length_to_use = extend_data->segment_length_to_use;
     const int pattern_length = extend_data->pattern_length;
     const int text_length = extend_data->text_length;
-    robin_hood::unordered_flat_map<uint64_t,alignment_t*>& alignments = *(extend_data->alignments);
+    wflambda_cells_t& cells = *(extend_data->cells);
     std::vector<std::vector<rkmh::hash_t>*>& query_sketches = *(extend_data->query_sketches);
     std::vector<std::vector<rkmh::hash_t>*>& target_sketches = *(extend_data->target_sketches);
-#ifdef WFA_PNG_TSV_TIMING
-    // wfplots
-    const bool emit_png = extend_data->emit_png;
-    robin_hood::unordered_set<uint64_t>& high_order_dp_matrix_mismatch = *(extend_data->high_order_dp_matrix_mismatch);
-#endif
     // Check match
     bool is_a_match = false;
     if (v >= 0 && h >= 0 && v < pattern_length && h < text_length) {
-        const uint64_t k = encode_pair(v, h);
-        const auto f = alignments.find(k); // high-level of WF-inception
-        if (f != alignments.end()) {
-            is_a_match = (alignments[k] != nullptr);
+        uint32_t& cell = cells.state(v, h); // high-level of WF-inception
+        if (cell != wflambda_cells_t::unknown) {
+            is_a_match = (cell >= wflambda_cells_t::first_alignment);
         } else {
-            const int64_t query_begin = v * step_size;
-            const int64_t target_begin = h * step_size;
-
-            // The last fragment can be longer than segment_length_to_use (max 2*segment_length_to_use - 1)
-            const uint16_t segment_length_to_use_q =
-                    (v == pattern_length - 1) ? query_length - query_begin : segment_length_to_use;
-            const uint16_t segment_length_to_use_t =
-                    (h == text_length - 1) ? target_length - target_begin : segment_length_to_use;
+            int64_t query_begin, target_begin;
+            uint16_t segment_length_to_use_q, segment_length_to_use_t;
+            wflambda_segments(extend_data, v, h, query_begin, target_begin,
+                              segment_length_to_use_q, segment_length_to_use_t);
 
-            auto *aln = new alignment_t();
+            alignment_t aln;
             const bool alignment_performed =
                     do_wfa_segment_alignment(
                             *wflign.query_name,
@@ -209,51 +696,10 @@ int wflambda_extend_match(
                             target_begin,
                             segment_length_to_use_q,
                             segment_length_to_use_t,
-                            step_size,
+                            extend_data->step_size,
                             extend_data,
-                            *aln);
-#ifdef WFA_PNG_TSV_TIMING
-            if (wflign.emit_tsv) {
-                // 0) Mis-match, alignment skipped
-                // 1) Mis-match, alignment performed
-                // 2) Match, alignment performed
-                *(wflign.out_tsv) << v << "\t" << h << "\t"
-                                  << (alignment_performed ? (aln->ok ? 2 : 1) : 0)
-                                  << std::endl;
-            }
-#endif
-#ifdef WFA_PNG_TSV_TIMING
-            ++(extend_data->num_alignments);
-#endif
-            if (alignment_performed) {
-#ifdef WFA_PNG_TSV_TIMING
-                ++(extend_data->num_alignments_performed);
-#endif
-                if (aln->ok){
-                    is_a_match = true;
-                    alignments[k] = aln;
-                } else {
-                    alignments[k] = nullptr;
-                }
-            }
-#ifdef WFA_PNG_TSV_TIMING
-            else {
-                if (emit_png) {
-                    // Save only the mismatches, as they are not cached
-                    high_order_dp_matrix_mismatch.insert(encode_pair(v, h));
-                }
-            }
-#endif
-            if (!is_a_match) {
-                delete aln;
-            }
-
-            if (extend_data->num_sketches_allocated > extend_data->max_num_sketches_in_memory) {
-                clean_up_sketches(query_sketches);
-                clean_up_sketches(target_sketches);
-                extend_data->num_sketches_allocated = 0;
-            }
-
+                            aln);
+            is_a_match = wflambda_cell_evaluated(extend_data, cell, v, h, alignment_performed, aln);
         }
     } else if (h < 0 || v < 0) { // It can be removed using an edit-distance
         // mode as high-level of WF-inception
@@ -261,9 +707,74 @@ int wflambda_extend_match(
     }
     return is_a_match;
 }
+/*
+* The cells of a step of the wflambda extension at once: those within the mash distance
+* are aligned on parallel_for, each task with segment aligners of its thread, then all
+* are recorded in order. Sketches are only read here, so this is for the segment sketches
+*/
+void wflambda_extend_match_batch(
+    const int num_cells,
+    const int* const v,
+    const int* const h,
+    int* const matches,
+    void* arguments) {
+    wflign_extend_data_t* extend_data = (wflign_extend_data_t*)arguments;
+    const WFlign& wflign = *(extend_data->wflign);
+    wflambda_cells_t& cells = *(extend_data->cells);
+    // Cells to align
+    std::vector<int> pending;
+    for (int c = 0; c < num_cells; ++c) {
+        const bool in_matrix = v[c] >= 0 && h[c] >= 0 && v[c] < extend_data->pattern_length && h[c] < extend_data->text_length;
+        if (!in_matrix || cells.state(v[c], h[c]) != wflambda_cells_t::unknown) {
+            matches[c] = wflambda_extend_match(v[c], h[c], arguments);
+            continue;
+        }
+        int64_t query_begin, target_begin;
+        uint16_t segment_length_to_use_q, segment_length_to_use_t;
+        wflambda_segments(extend_data, v[c], h[c], query_begin, target_begin,
+                          segment_length_to_use_q, segment_length_to_use_t);
+        std::vector<rkmh::hash_t>* no_sketch = nullptr;
+        if (wfa_segment_within_mash_distance(wflign.query, no_sketch, query_begin,
+                                             wflign.target, no_sketch, target_begin,
+                                             segment_length_to_use_q, segment_length_to_use_t,
+                                             extend_data->step_size, extend_data)) {
+            pending.push_back(c);
+        } else {
+            alignment_t aln;
+            matches[c] = wflambda_cell_evaluated(extend_data, cells.state(v[c], h[c]), v[c], h[c], false, aln);
+        }
+    }
+    // Aligned in parallel
+    std::vector<alignment_t> alignments(pending.size());
+    const auto align = [&](const uint64_t p) {
+        const int c = pending[p];
+        int64_t query_begin, target_begin;
+        uint16_t segment_length_to_use_q, segment_length_to_use_t;
+        wflambda_segments(extend_data, v[c], h[c], query_begin, target_begin,
+                          segment_length_to_use_q, segment_length_to_use_t);
+        static thread_local WFlignAligners task_aligners;
+        wflign_extend_data_t task_data = *extend_data;
+        segment_aligners(task_aligners, extend_data->wfa_affine_penalties, wflign.max_memory,
+                         extend_data->segment_length_to_use, extend_data->inception_score_max_ratio,
+                         task_data.wf_aligner, task_data.wf_aligner_low_memory);
+        do_wfa_segment_pair_alignment(wflign.query, query_begin, wflign.target, target_begin,
+                                      segment_length_to_use_q, segment_length_to_use_t,
+                                      &task_data, alignments[p]);
+    };
+    if (pending.size() > 1) {
+        wflign.parallel_for(pending.size(), align);
+    } else if (pending.size() == 1) {
+        align(0);
+    }
+    // Recorded in order
+    for (uint64_t p = 0; p < pending.size(); ++p) {
+        const int c = pending[p];
+        matches[c] = wflambda_cell_evaluated(extend_data, cells.state(v[c], h[c]), v[c], h[c], true, alignments[p]);
+    }
+}
 
 int wflambda_trace_match(
-    robin_hood::unordered_flat_map<uint64_t,alignment_t*>& alignments,
+    wflambda_cells_t& cells,
     wfa::WFAlignerGapAffine& wflambda_aligner,
     std::vector<alignment_t*>& trace,
     const int pattern_length,
@@ -283,8 +794,7 @@ int wflambda_trace_match(
             case 'X': --v; --h; break;
             case 'M': {
                 // Add alignment to trace
-                uint64_t k = encode_pair(v,h);
-                alignment_t* aln = alignments[k];
+                alignment_t* aln = cells.alignment(v,h);
                 trace.push_back(aln);
                 aln->keep = true;
                 ++num_alignments;
@@ -298,6 +808,98 @@ int wflambda_trace_match(
     return num_alignments;
 }
 /*
+* Identity of query against target estimated from the share of the k-mers of query found
+* in target, as the mash containment does: each differing base or gap event breaks up to
+* k of them, so the share is about identity^k. Cheap next to aligning the pair
+*/
+double kmer_identity_estimate(
+    const char* query,
+    const uint64_t query_length,
+    const char* target,
+    const uint64_t target_length) {
+    constexpr uint64_t k = IDENTITY_SCREEN_KMER;
+    constexpr uint32_t mask = (1u << (2 * k)) - 1;
+    auto code = [](const char c) -> int {
+        switch (c) {
+            case 'A': case 'a': return 0;
+            case 'C': case 'c': return 1;
+            case 'G': case 'g': return 2;
+            case 'T': case 't': return 3;
+            default: return -1;
+        }
+    };
+    auto kmers = [&](const char* seq, const uint64_t length, auto&& f) {
+        uint32_t kmer = 0;
+        uint64_t valid = 0;
+        for (uint64_t p = 0; p < length; ++p) {
+            const int c = code(seq[p]);
+            if (c < 0) {
+                valid = 0;
+                continue;
+            }
+            kmer = ((kmer << 2) | c) & mask;
+            if (++valid >= k) {
+                f(kmer);
+            }
+        }
+    };
+
+    std::vector<uint32_t> target_kmers;
+    target_kmers.reserve(target_length);
+    kmers(target, target_length, [&](const uint32_t kmer) { target_kmers.push_back(kmer); });
+    std::sort(target_kmers.begin(), target_kmers.end());
+    target_kmers.erase(std::unique(target_kmers.begin(), target_kmers.end()), target_kmers.end());
+
+    uint64_t total = 0;
+    uint64_t shared = 0;
+    kmers(query, query_length, [&](const uint32_t kmer) {
+        ++total;
+        shared += std::binary_search(target_kmers.begin(), target_kmers.end(), kmer);
+    });
+    // too little sequence to tell, taken as matching
+    if (total == 0) {
+        return 1.0;
+    }
+    return std::pow((double)shared / (double)total, 1.0 / (double)k);
+}
+/*
+* Target steps of the cells of each query step near the chain of the seed anchors: around
+* the target position interpolated between the anchors on each side of the middle of the
+* query segment, or on the diagonal of the nearest one past the ends of the chain, by two
+* segments plus a quarter of the distance to the nearest anchor, for the indels between them
+*/
+void anchor_band(
+    const std::vector<std::pair<uint64_t, uint64_t>>& anchors,
+    const int pattern_length,
+    const uint16_t step_size,
+    const uint16_t segment_length,
+    std::vector<std::pair<int64_t, int64_t>>& band) {
+    band.resize(pattern_length);
+    size_t next = 0;
+    for (int v = 0; v < pattern_length; ++v) {
+        const int64_t middle = (int64_t)v * step_size + step_size;
+        while (next < anchors.size() && (int64_t)anchors[next].first <= middle) {
+            ++next;
+        }
+        int64_t target, distance;
+        if (next == 0 || next == anchors.size()) {
+            const std::pair<uint64_t, uint64_t>& nearest = anchors[next == 0 ? 0 : next - 1];
+            target = (int64_t)nearest.second + middle - (int64_t)nearest.first;
+            distance = std::abs(middle - (int64_t)nearest.first);
+        } else {
+            const std::pair<uint64_t, uint64_t>& before = anchors[next - 1];
+            const std::pair<uint64_t, uint64_t>& after = anchors[next];
+            const int64_t span = after.first - before.first;
+            target = (int64_t)before.second
+                + ((int64_t)after.second - (int64_t)before.second) * (middle - (int64_t)before.first) / span;
+            distance = std::min<int64_t>(middle - before.first, after.first - middle);
+        }
+        const int64_t radius = 2 * segment_length + distance / 4;
+        band[v].first = (target - radius - step_size) / step_size - 1;
+        band[v].second = (target + radius - step_size) / step_size + 1;
+    }
+}
+/*
 * WFling align
 */
 void WFlign::wflign_affine_wavefront(
@@ -331,6 +933,20 @@ void WFlign::wflign_affine_wavefront(
         return;
     }
 
+    // mappings whose k-mers put them clearly below min_identity are not aligned
+    if (screen_identity && min_identity > 0
+        && kmer_identity_estimate(query, query_length, target, target_length) < min_identity - IDENTITY_SCREEN_MARGIN) {
+#ifdef WFLIGN_DEBUG
+        std::cerr << "[wflign::wflign_affine_wavefront] screening out "
+                  << query_name << " " << query_offset << " - " << target_name << " " << target_offset
+                  << ", below the minimum identity" << std::endl;
+#endif
+        return;
+    }
+
+    // All the cigars of this alignment, freed at once when it is written
+    wflign_cigar_arena_t cigar_arena;
+
     // Check if mashmap_estimated_identity == 1 to avoid division by zero, leading to a minhash_kmer_size of 8.
     // Such low value was leading to confusion in HORs alignments in the human centromeres (high runtime and memory usage, and wrong alignments)
     const int minhash_kmer_size = mashmap_estimated_identity == 1 ? 17 : std::max(8, std::min(17, (int)std::floor(1.0 / (1.0 - mashmap_estimated_identity))));
@@ -388,6 +1004,11 @@ void WFlign::wflign_affine_wavefront(
     // identity the goal here is to sparsify the set of alignments in the
     // wflambda layer we then patch up the gaps between them
 
+    // the aligners set, else those kept by the thread for the alignments without any,
+    // so that no alignment makes its own WFA memory again
+    static thread_local WFlignAligners thread_aligners;
+    WFlignAligners& kept_aligners = aligners != nullptr ? *aligners : thread_aligners;
+
     float inception_score_max_ratio = 1.0 + 0.5 / mashmap_estimated_identity;
     float max_mash_dist_to_evaluate = std::min(0.55, 0.05 / std::pow(mashmap_estimated_identity,13));
     float mash_sketch_rate = 1.0;
@@ -423,29 +1044,24 @@ void WFlign::wflign_affine_wavefront(
     // accumulate runs of matches in reverse order
     // then trim the cigars of successive mappings
     std::vector<alignment_t*> trace;
-#ifdef WFA_PNG_TSV_TIMING
     const auto start_time = std::chrono::steady_clock::now();
-#endif
     if (force_biwfa_alignment ||
             (query_length <= segment_length * 8 || target_length <= segment_length * 8) ||
             (mashmap_estimated_identity >= 0.99
              && query_length <= MAX_LEN_FOR_STANDARD_WFA && target_length <= MAX_LEN_FOR_STANDARD_WFA)
             ) {
-        wfa::WFAlignerGapAffine2Pieces* wf_aligner =
-                new wfa::WFAlignerGapAffine2Pieces(
-                        0,
-                        wfa_convex_penalties.mismatch,
-                        wfa_convex_penalties.gap_opening1,
-                        wfa_convex_penalties.gap_extension1,
-                        wfa_convex_penalties.gap_opening2,
-                        wfa_convex_penalties.gap_extension2,
-                        wfa::WFAligner::Alignment,
-                        wfa::WFAligner::MemoryUltralow);
-        wf_aligner->setHeuristicNone();
-        
+        wfa::WFAlignerGapAffine2Pieces* const wf_aligner = &kept_aligners.biwfa(wfa_convex_penalties);
+        limit_memory(*wf_aligner, max_memory);
+        wf_aligner->setMaxNumThreads(biwfa_threads);
+        if (stats) wflign_stats_t::collect(*wf_aligner);
+
+        ::trace::Span wflambda_span("wflambda");
         const int status = wf_aligner->alignEnd2End(target,(int)target_length,query,(int)query_length);
+        wflambda_span.end();
+        if (stats) stats->take(*wf_aligner, false);
 
-        auto *aln = new alignment_t();
+        alignment_t whole_aln;
+        alignment_t* aln = &whole_aln;
         aln->j = 0;
         aln->i = 0;
 
@@ -485,39 +1101,54 @@ void WFlign::wflign_affine_wavefront(
     #endif
         }
 
+        // an alignment that erosion and patching would leave as it is is written
+        // straight away, unless the diagnostics of the patching are wanted
+        if (!emit_tsv && !emit_patching_tsv && prefix_wavefront_plot_in_png == nullptr
+            && is_final_global_alignment(*aln, erode_k)) {
+            write_global_alignment(
+                    *out,
+                    *aln,
+                    wfa_convex_penalties,
+                    emit_md_tag,
+                    paf_format_else_sam,
+                    no_seq_in_sam,
+                    score_only,
+                    query,
+                    query_name,
+                    query_total_length,
+                    query_offset,
+                    query_length,
+                    query_is_rev,
+                    target,
+                    target_name,
+                    target_total_length,
+                    target_offset,
+                    target_length,
+                    min_identity,
+                    mashmap_estimated_identity);
+            return;
+        }
+
         trace.push_back(aln);
 
-#ifdef WFA_PNG_TSV_TIMING
         const long elapsed_time_wflambda_ms =
                 std::chrono::duration_cast<std::chrono::milliseconds>(
                         std::chrono::steady_clock::now() - start_time).count();
-#endif
 
-        // Free old aligner
-        delete wf_aligner;
-
-        // use biWFA for all patching
-        wf_aligner =
-                new wfa::WFAlignerGapAffine2Pieces(
-                        0,
-                        wfa_convex_penalties.mismatch,
-                        wfa_convex_penalties.gap_opening1,
-                        wfa_convex_penalties.gap_extension1,
-                        wfa_convex_penalties.gap_opening2,
-                        wfa_convex_penalties.gap_extension2,
-                        wfa::WFAligner::Alignment,
-                        wfa::WFAligner::MemoryUltralow);
-        wf_aligner->setHeuristicNone();
+        // patch with the kept aligners
+        const wflign_patch_tasks_t tasks = patch_tasks(parallel_for, wfa_convex_penalties, max_memory,
+                                                       &kept_aligners, stats);
 
         // write a merged alignment
         write_merged_alignment(
                 *out,
                 trace,
-                *wf_aligner,
+                tasks,
                 wfa_convex_penalties,
                 emit_md_tag,
                 paf_format_else_sam,
                 no_seq_in_sam,
+                score_only,
                 query,
                 query_name,
                 query_total_length,
@@ -530,11 +1161,10 @@ void WFlign::wflign_affine_wavefront(
                 target_offset,
                 target_length,
                 min_identity,
-#ifdef WFA_PNG_TSV_TIMING
                 elapsed_time_wflambda_ms,
                 1,
                 1,
-#endif
+                emit_tsv || emit_patching_tsv || prefix_wavefront_plot_in_png != nullptr,
                 mashmap_estimated_identity,
                 wflign_max_len_major,
                 wflign_max_len_minor,
@@ -543,20 +1173,15 @@ void WFlign::wflign_affine_wavefront(
                 max_patching_score,
                 min_inversion_length,
                 MIN_WF_LENGTH,
-                wf_max_dist_threshold
-#ifdef WFA_PNG_TSV_TIMING
+                wf_max_dist_threshold,
+                fetch_target
                 ,
                 prefix_wavefront_plot_in_png,
                 wfplot_max_size,
                 emit_patching_tsv,
                 out_patching_tsv
-#endif
                 );
-
-        // Free biWFA aligner
-        delete wf_aligner;
     } else {
-#ifdef WFA_PNG_TSV_TIMING
         if (emit_tsv) {
             *out_tsv << "# query_name=" << query_name << std::endl;
             *out_tsv << "# query_start=" << query_offset << std::endl;
@@ -567,7 +1192,6 @@ void WFlign::wflign_affine_wavefront(
             *out_tsv << "# info: 0) mismatch, mash-distance > threshold; 1) mismatch, WFA-score >= max_score; 2) match, WFA-score < max_score" << std::endl;
             *out_tsv << "v" << "\t" << "h" << "\t" << "info" << std::endl;
         }
-#endif
 
         const uint16_t segment_length_to_use =
                 (query_length < segment_length || target_length < segment_length)
@@ -605,35 +1229,25 @@ void WFlign::wflign_affine_wavefront(
         //std::cerr << "max_mash_dist_to_evaluate " << max_mash_dist_to_evaluate << std::endl;
 
         // Configure the attributes of the wflambda-aligner
-        wfa::WFAlignerGapAffine* wflambda_aligner =
-                new wfa::WFAlignerGapAffine(
-                        wflambda_affine_penalties.mismatch,
-                        wflambda_affine_penalties.gap_opening1,
-                        wflambda_affine_penalties.gap_extension1,
-                        wfa::WFAligner::Alignment,
-                        wfa::WFAligner::MemoryUltralow);
-        wflambda_aligner->setHeuristicNone(); // It should help
+        wfa::WFAlignerGapAffine* const wflambda_aligner = &kept_aligners.wflambda(wflambda_affine_penalties);
+        limit_memory(*wflambda_aligner, max_memory);
         if (wflign_max_distance_threshold <= 0) {
             wflambda_aligner->setHeuristicWFmash(wflign_min_wavefront_length, (int) (2048.0 / (mashmap_estimated_identity*mashmap_estimated_identity)));
         } else {
             wflambda_aligner->setHeuristicWFmash(wflign_min_wavefront_length, wflign_max_distance_threshold);
         }
 
-        // Save computed alignments in a pair-indexed map
-        robin_hood::unordered_flat_map<uint64_t,alignment_t*> alignments;
+        // Save computed alignments by cell
+        wflambda_cells_t cells(pattern_length, text_length);
         // Allocate vectors to store our sketches
         std::vector<std::vector<rkmh::hash_t>*> query_sketches(pattern_length,nullptr);
         std::vector<std::vector<rkmh::hash_t>*> target_sketches(text_length,nullptr);
 
         // Allocate subsidiary WFAligner
-        wfa::WFAlignerGapAffine* wf_aligner =
-                new wfa::WFAlignerGapAffine(
-                        wfa_affine_penalties.mismatch,
-                        wfa_affine_penalties.gap_opening1,
-                        wfa_affine_penalties.gap_extension1,
-                        wfa::WFAligner::Alignment,
-                        wfa::WFAligner::MemoryHigh);
-        wf_aligner->setHeuristicNone();
+        wfa::WFAlignerGapAffine* wf_aligner;
+        wfa::WFAlignerGapAffine* wf_aligner_low_memory;
+        segment_aligners(kept_aligners, wfa_affine_penalties, max_memory, segment_length_to_use,
+                         inception_score_max_ratio, wf_aligner, wf_aligner_low_memory);
 
         // Save mismatches if wfplots are requested
         robin_hood::unordered_set<uint64_t> high_order_dp_matrix_mismatch;
@@ -649,47 +1263,79 @@ void WFlign::wflign_affine_wavefront(
         extend_data.max_mash_dist_to_evaluate = max_mash_dist_to_evaluate;
         extend_data.mash_sketch_rate = mash_sketch_rate;
         extend_data.inception_score_max_ratio = inception_score_max_ratio;
-        extend_data.alignments = &alignments;
+        extend_data.max_gapless_mismatches =
+            (2 * (wfa_affine_penalties.gap_opening1 + wfa_affine_penalties.gap_extension1) - 1) / wfa_affine_penalties.mismatch;
+        extend_data.cells = &cells;
         extend_data.query_sketches = &query_sketches;
         extend_data.target_sketches = &target_sketches;
+        // the whole sequences are hashed once for all their segments when that fits the memory for sketches,
+        // the query from the hashes the thread kept of its windows aligned before if it has them
+        std::unique_ptr<rkmh::segment_sketches_t> query_segment_sketches;
+        std::unique_ptr<rkmh::segment_sketches_t> target_segment_sketches;
+        if (rkmh::segment_sketches_t::bytes(query_length, pattern_length, segment_length_to_use, mash_sketch_rate)
+            + rkmh::segment_sketches_t::bytes(target_length, text_length, segment_length_to_use, mash_sketch_rate)
+            <= 128 * 1024 * 1024) {
+            const rkmh::hash_t* kept_query_hashes = kept_aligners.query_hashes(
+                    query_name, query_total_length, query_is_rev,
+                    query_is_rev ? query_total_length - query_offset - query_length : query_offset,
+                    query, query_length, minhash_kmer_size);
+            if (kept_query_hashes != nullptr) {
+                query_segment_sketches.reset(new rkmh::segment_sketches_t(
+                        kept_query_hashes, query_length, minhash_kmer_size, pattern_length, step_size, segment_length_to_use, mash_sketch_rate));
+            } else {
+                query_segment_sketches.reset(new rkmh::segment_sketches_t(
+                        query, query_length, minhash_kmer_size, pattern_length, step_size, segment_length_to_use, mash_sketch_rate));
+            }
+            target_segment_sketches.reset(new rkmh::segment_sketches_t(
+                    target, target_length, minhash_kmer_size, text_length, step_size, segment_length_to_use, mash_sketch_rate));
+        }
+        extend_data.query_segment_sketches = query_segment_sketches.get();
+        extend_data.target_segment_sketches = target_segment_sketches.get();
+        // with at least two seed anchors, only the cells near their chain are aligned
+        std::vector<std::pair<int64_t, int64_t>> cells_near_anchors;
+        if (anchors != nullptr && anchors->size() >= 2) {
+            anchor_band(*anchors, pattern_length, step_size, segment_length_to_use, cells_near_anchors);
+            extend_data.anchor_band = &cells_near_anchors;
+        } else {
+            extend_data.anchor_band = nullptr;
+        }
         extend_data.wf_aligner = wf_aligner;
+        extend_data.wf_aligner_low_memory = wf_aligner_low_memory;
+        extend_data.wfa_affine_penalties = wfa_affine_penalties;
 //        extend_data.wflambda_aligner = wflambda_aligner;
 //        extend_data.last_breakpoint_v = 0;
 //        extend_data.last_breakpoint_h = 0;
 //        extend_data.wfa_affine_penalties = &wfa_affine_penalties;
-#ifdef WFA_PNG_TSV_TIMING
         extend_data.num_alignments = 0;
         extend_data.num_alignments_performed = 0;
-#endif
         extend_data.num_sketches_allocated = 0;
         // 128 MB of memory for sketches
         extend_data.max_num_sketches_in_memory = 128 * 1024 * 1024
             / (sizeof(std::vector<rkmh::hash_t>) + mash_sketch_rate * segment_length_to_use * sizeof(rkmh::hash_t));
-#ifdef WFA_PNG_TSV_TIMING
-        extend_data.emit_png = !prefix_wavefront_plot_in_png->empty() && wfplot_max_size > 0;
+        extend_data.emit_png = prefix_wavefront_plot_in_png != nullptr && wfplot_max_size > 0;
         extend_data.high_order_dp_matrix_mismatch = &high_order_dp_matrix_mismatch;
-#endif
 
-        // Align
-        wflambda_aligner->alignEnd2End(
-                wflambda_extend_match, (void*)&extend_data,
-                pattern_length,text_length);
+        // Align, the segments of each step on parallel threads if the sketches allow it
+        if (stats) wflign_stats_t::collect(*wflambda_aligner);
+        ::trace::Span wflambda_span("wflambda");
+        if (parallel_for && query_segment_sketches) {
+            wflambda_aligner->alignEnd2End(
+                    wflambda_extend_match, wflambda_extend_match_batch, (void*)&extend_data,
+                    pattern_length,text_length);
+        } else {
+            wflambda_aligner->alignEnd2End(
+                    wflambda_extend_match, (void*)&extend_data,
+                    pattern_length,text_length);
+        }
+        wflambda_span.end();
+        if (stats) stats->take(*wflambda_aligner, true);
 
         // Extract the trace
         if (wflambda_aligner->getAlignmentStatus() == WF_STATUS_ALG_COMPLETED) {
-#ifdef WFA_PNG_TSV_TIMING
             extend_data.num_alignments += wflambda_trace_match(
-                    alignments,*wflambda_aligner,trace,pattern_length,text_length);
-#else
-            wflambda_trace_match(alignments,*wflambda_aligner,trace,pattern_length,text_length);
-#endif
+                    cells,*wflambda_aligner,trace,pattern_length,text_length);
         }
 
-        // Free
-        delete wflambda_aligner;
-        delete wf_aligner;
-
-#ifdef WFA_PNG_TSV_TIMING
         if (extend_data.emit_png) {
             const int wfplot_vmin = 0, wfplot_vmax = pattern_length; //v_max;
             const int wfplot_hmin = 0, wfplot_hmax = text_length; //h_max
@@ -727,11 +1373,9 @@ void WFlign::wflign_affine_wavefront(
                                                      source_width, source_height,
                                                      source_min_x, source_min_y);
 
-                for (const auto &p : alignments) {
-                    if (p.second != nullptr && p.second->keep) {
-                        int v, h;
-                        decode_pair(p.first, &v, &h);
-
+                cells.for_each([&](int v, int h, uint32_t state) {
+                    const alignment_t* aln = cells.alignment(state);
+                    if (aln != nullptr && aln->keep) {
                         if (v >= wfplot_vmin & v <= wfplot_vmax && h >= wfplot_hmin && h <= wfplot_hmax) {
                             algorithms::xy_d_t xy0 = {
                                     (v * scale) - x_off,
@@ -745,7 +1389,7 @@ void WFlign::wflign_affine_wavefront(
                             plot_point(xy0, image, COLOR_WFA_MATCH);
                         }
                     }
-                }
+                });
 
                 auto bytes = image.to_bytes();
                 const std::string filename = *prefix_wavefront_plot_in_png +
@@ -759,10 +1403,11 @@ void WFlign::wflign_affine_wavefront(
                                                  source_width, source_height,
                                                  source_min_x, source_min_y);
 
-            for (const auto &p : alignments) {
-                int v, h;
-                decode_pair(p.first, &v, &h);
-
+            cells.for_each([&](int v, int h, uint32_t state) {
+                // mismatches are plotted below
+                if (state == wflambda_cells_t::no_alignment) {
+                    return;
+                }
                 if (v >= wfplot_vmin & v <= wfplot_vmax && h >= wfplot_hmin && h <= wfplot_hmax) {
                     algorithms::xy_d_t xy0 = {
                             (v * scale) - x_off,
@@ -773,9 +1418,9 @@ void WFlign::wflign_affine_wavefront(
                              0, 0,
                              width, height);
 
-                    plot_point(xy0, image, p.second != nullptr ? COLOR_WFA_MATCH : COLOR_WFA_MISMATCH);
+                    plot_point(xy0, image, state >= wflambda_cells_t::first_alignment ? COLOR_WFA_MATCH : COLOR_WFA_MISMATCH);
                 }
-            }
+            });
 
             for (auto high_order_DP_cell: high_order_dp_matrix_mismatch) {
                 int v, h;
@@ -801,20 +1446,12 @@ void WFlign::wflign_affine_wavefront(
                                          "_" + target_name + "_" + std::to_string(target_offset) + "_" + std::to_string(target_offset+target_length) + ".0.wflign.png";
             encodeOneStep(filename.c_str(), bytes, width, height);
         }
-#endif
 
         // Clean alignments not to be kept (do not belong to the optimal alignment)
-        for (const auto &p : alignments) {
-            if (p.second != nullptr && !p.second->keep) {
-                delete p.second;
-                //p.second = nullptr;
-            }
-        }
-#ifdef WFA_PNG_TSV_TIMING
+        cells.release_unkept();
         const long elapsed_time_wflambda_ms =
                 std::chrono::duration_cast<std::chrono::milliseconds>(
                         std::chrono::steady_clock::now()-start_time).count();
-#endif
         //#define WFLIGN_DEBUG
     #ifdef WFLIGN_DEBUG
         // get alignment score
@@ -965,28 +1602,20 @@ void WFlign::wflign_affine_wavefront(
             }
 
             if (merge_alignments) {
-                // use biWFA for all patching
-                wfa::WFAlignerGapAffine2Pieces* wf_aligner =
-                        new wfa::WFAlignerGapAffine2Pieces(
-                                0,
-                                wfa_convex_penalties.mismatch,
-                                wfa_convex_penalties.gap_opening1,
-                                wfa_convex_penalties.gap_extension1,
-                                wfa_convex_penalties.gap_opening2,
-                                wfa_convex_penalties.gap_extension2,
-                                wfa::WFAligner::Alignment,
-                                wfa::WFAligner::MemoryUltralow);
-                wf_aligner->setHeuristicNone();
+                // patch with the kept aligners
+                const wflign_patch_tasks_t tasks = patch_tasks(parallel_for, wfa_convex_penalties, max_memory,
+                                                               &kept_aligners, stats);
 
                 // write a merged alignment
                 write_merged_alignment(
                         *out,
                         trace,
-                        *wf_aligner,
+                        tasks,
                         wfa_convex_penalties,
                         emit_md_tag,
                         paf_format_else_sam,
                         no_seq_in_sam,
+                        score_only,
                         query,
                         query_name,
                         query_total_length,
@@ -999,11 +1628,10 @@ void WFlign::wflign_affine_wavefront(
                         target_offset,
                         target_length,
                         min_identity,
-#ifdef WFA_PNG_TSV_TIMING
                         elapsed_time_wflambda_ms,
                         extend_data.num_alignments,
                         extend_data.num_alignments_performed,
-#endif
+                        emit_tsv || emit_patching_tsv || prefix_wavefront_plot_in_png != nullptr,
                         mashmap_estimated_identity,
                         wflign_max_len_major,
                         wflign_max_len_minor,
@@ -1012,17 +1640,14 @@ void WFlign::wflign_affine_wavefront(
                         max_patching_score,
                         min_inversion_length,
                         MIN_WF_LENGTH,
-                        wf_max_dist_threshold
-#ifdef WFA_PNG_TSV_TIMING
+                        wf_max_dist_threshold,
+                        fetch_target
                         ,
                         prefix_wavefront_plot_in_png,
                         wfplot_max_size,
                         emit_patching_tsv,
                         out_patching_tsv
-#endif
                 );
-
-                delete wf_aligner;
             } else {
                 // todo old implementation (and SAM format is not supported)
                 for (auto x = trace.rbegin(); x != trace.rend(); ++x) {
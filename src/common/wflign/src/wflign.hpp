@@ -8,9 +8,13 @@
 #include <cstring>
 #include <iostream>
 #include <vector>
+#include <deque>
 #include <sstream>
 #include <functional>
 #include <fstream>
+#include <memory>
+#include <mutex>
+#include <climits>
 
 #include "wflign_alignment.hpp"
 
@@ -34,6 +38,114 @@
 namespace wflign {
     namespace wavefront {
 
+        /*
+         * WFA aligners kept from one alignment to the next by the thread running them,
+         * so that their memory is reused rather than allocated again for each mapping.
+         * Each comes back with the state of a new aligner: no heuristic, no bound on
+         * the alignment steps, and a single thread. An aligner is only made again if the penalties change
+         */
+        class WFlignAligners {
+        public:
+            // end-to-end biWFA of short mappings, and the patching
+            wfa::WFAlignerGapAffine2Pieces& biwfa(const wflign_penalties_t& penalties);
+            // the patching aligner of a patch of these lengths: small patches fitting in
+            // max_memory (0 for none) in high memory, the others with biwfa
+            wfa::WFAlignerGapAffine2Pieces& patch(
+                    const wflign_penalties_t& penalties,
+                    const uint64_t query_length,
+                    const uint64_t target_length,
+                    const uint64_t max_memory);
+            // the wflambda layer over segments
+            wfa::WFAlignerGapAffine& wflambda(const wflign_penalties_t& penalties);
+            // the alignment of a pair of segments
+            wfa::WFAlignerGapAffine& segment(const wflign_penalties_t& penalties);
+            // the same in linear memory, for the pairs that would not fit the memory ceiling
+            wfa::WFAlignerGapAffine& segment_low_memory(const wflign_penalties_t& penalties);
+            // hashes of the k-mers of the query window of a record, at window_begin on the strand
+            // aligned, taken from those of the windows of the same query aligned before, which
+            // a query mapped on many targets repeats; query_length - k hashes, valid until the next call
+            const rkmh::hash_t* query_hashes(
+                    const std::string& query_name,
+                    const uint64_t query_total_length,
+                    const bool query_is_rev,
+                    const uint64_t window_begin,
+                    const char* window,
+                    const uint64_t window_length,
+                    const uint64_t k);
+            // bytes kept by the aligners made so far and the query hashes, for the memory accounting
+            uint64_t memory_used() const;
+        private:
+            // the bases of a stretch of a query strand and the hashes of its k-mers, those
+            // running past its end left out
+            struct kept_query_t {
+                std::string name;
+                uint64_t total_length;
+                bool is_rev;
+                uint64_t k;
+                uint64_t begin;
+                std::string bases;
+                std::vector<rkmh::hash_t> hashes;
+                uint64_t last_used;
+            };
+            // the queries kept, and the bases they may hold in all
+            static constexpr size_t max_kept_queries = 4;
+            static constexpr uint64_t max_kept_query_bases = 1024 * 1024;
+            std::vector<kept_query_t> kept_queries;
+            uint64_t query_uses = 0;
+
+            std::unique_ptr<wfa::WFAlignerGapAffine2Pieces> biwfa_aligner;
+            std::unique_ptr<wfa::WFAlignerGapAffine2Pieces> small_patch_aligner;
+            std::unique_ptr<wfa::WFAlignerGapAffine> wflambda_aligner;
+            std::unique_ptr<wfa::WFAlignerGapAffine> segment_aligner;
+            std::unique_ptr<wfa::WFAlignerGapAffine> segment_low_memory_aligner;
+            wflign_penalties_t biwfa_penalties;
+            wflign_penalties_t small_patch_penalties;
+            wflign_penalties_t wflambda_penalties;
+            wflign_penalties_t segment_penalties;
+            wflign_penalties_t segment_low_memory_penalties;
+        };
+
+        /*
+         * Statistics of the WFA alignments of a mapping, gathered if set on WFlign. Those of
+         * the wflambda layer are kept apart, its extension time including the alignments of
+         * the segments it runs, which go with the patches and whole mappings in alignments
+         */
+        class wflign_stats_t {
+        public:
+            wavefront_stats_t wflambda;
+            wavefront_stats_t alignments;
+            wflign_stats_t();
+            // Have the aligner gather the statistics of its next alignments
+            static void collect(wfa::WFAligner& aligner);
+            // Move the statistics the aligner gathered into wflambda or alignments, from any thread
+            void take(wfa::WFAligner& aligner, const bool wflambda_layer);
+        private:
+            std::mutex mutex;
+        };
+
+        /*
+         * Runs f(0) ... f(n-1), possibly at the same time, and returns once all are done
+         */
+        typedef std::function<void(const uint64_t n, const std::function<void(const uint64_t)>& f)> wflign_parallel_for_t;
+
+        /*
+         * Makes the bases [begin, end) of the target readable, in target coordinates, before
+         * patching reads them outside of the window aligned
+         */
+        typedef std::function<void(const uint64_t begin, const uint64_t end)> wflign_target_fetch_t;
+
+        /*
+         * Patch solving of a merged alignment: each patch is aligned with the patching
+         * aligner(query_length, target_length) of the thread solving it, chosen by its
+         * size. With parallel_for, the patches are solved ahead of the patching on it
+         */
+        typedef struct {
+            wflign_parallel_for_t parallel_for;
+            std::function<wfa::WFAlignerGapAffine2Pieces&(const uint64_t query_length, const uint64_t target_length)> aligner;
+            // Statistics of the patch alignments, if gathered
+            wflign_stats_t* stats;
+        } wflign_patch_tasks_t;
+
         class WFlign {
         public:
             // WFlambda parameters
@@ -80,19 +192,37 @@ namespace wflign {
             uint64_t target_length;
             // Output
             std::ostream* out;
-#ifdef WFA_PNG_TSV_TIMING
+            // Diagnostics: the wflambda cells in TSV, PNG plots of the wavefronts (null for
+            // none) and the patches in TSV, all off unless set, as for sampled records
             bool emit_tsv;
             std::ostream* out_tsv;
             const std::string* prefix_wavefront_plot_in_png;
             uint64_t wfplot_max_size;
             bool emit_patching_tsv;
             std::ostream* out_patching_tsv;
-#endif
             bool merge_alignments;
             bool emit_md_tag;
             bool paf_format_else_sam;
             bool no_seq_in_sam;
+            // PAF records with the alignment score instead of the CIGAR
+            bool score_only;
+            // Drop the mappings whose k-mers put them clearly below min_identity unaligned
+            bool screen_identity;
             bool force_biwfa_alignment;
+            // Aligners to reuse, if any, else they are made for each alignment
+            WFlignAligners* aligners;
+            // Bytes each WFA aligner may use (0 for no ceiling), past which its alignment fails
+            uint64_t max_memory;
+            // Runs the patches of merged alignments in parallel, if set
+            wflign_parallel_for_t parallel_for;
+            // Threads of the biWFA alignment of whole mappings, solving its halves in parallel
+            int biwfa_threads;
+            // Statistics of the WFA alignments, gathered if set
+            wflign_stats_t* stats;
+            // Fetches the target bases around the window patching reaches into, if set
+            const wflign_target_fetch_t* fetch_target;
+            // Seeds of the query and target on the chain of the mapping, if set
+            const std::vector<std::pair<uint64_t, uint64_t>>* anchors;
             // Setup
             WFlign(
                     const uint16_t segment_length,
@@ -122,18 +252,41 @@ namespace wflign {
             // Set output configuration
             void set_output(
                     std::ostream* const out,
-#ifdef WFA_PNG_TSV_TIMING
                     const bool emit_tsv,
                     std::ostream* const out_tsv,
                     const std::string &wfplot_filepath,
                     const uint64_t wfplot_max_size,
                     const bool emit_patching_tsv,
                     std::ostream* const out_patching_tsv,
-#endif
                     const bool merge_alignments,
                     const bool emit_md_tag,
                     const bool paf_format_else_sam,
                     const bool no_seq_in_sam);
+            // Reuse these aligners, else those the running thread keeps for WFlign
+            void set_aligners(WFlignAligners* const aligners);
+            // Ceiling on the memory of each WFA aligner, segments being aligned in linear
+            // memory when they would not fit it otherwise
+            void set_max_memory(const uint64_t max_memory);
+            // Solve the patches of merged alignments on parallel_for
+            void set_parallel_for(const wflign_parallel_for_t& parallel_for);
+            // Align whole mappings with biWFA on up to this many threads, which take the
+            // two halves of the longest ones each
+            void set_biwfa_threads(const int biwfa_threads);
+            // Gather the statistics of the WFA alignments into stats
+            void set_stats(wflign_stats_t* const stats);
+            // Have the bases of the target around the window, up to wflign_max_len_minor on
+            // each side, fetched by fetch_target once the patching of the head or the tail
+            // of an alignment reaches into them, rather than readable upfront
+            void set_target_fetch(const wflign_target_fetch_t* const fetch_target);
+            // Write the score of the PAF records rather than their CIGAR, which is not made
+            void set_score_only(const bool score_only);
+            // Estimate the identity of each mapping from its k-mers first, not aligning the
+            // ones clearly below min_identity
+            void set_screen_identity(const bool screen_identity);
+            // Align only the wflambda segment pairs within a band around the chain of these
+            // seeds, as positions in the query and the target from their start, by query
+            // position
+            void set_anchors(const std::vector<std::pair<uint64_t, uint64_t>>* const anchors);
             // WFling affine
             void wflign_affine_wavefront(
                     const std::string& query_name,
@@ -149,6 +302,47 @@ namespace wflign {
                     const uint64_t target_length);
         };
 
+        /*
+         * Cells of the wflambda layer
+         *
+         * wflambda evaluates the cells (v,h) of a band around the diagonal of the
+         * segment matrix: their state sits in a dense array over that band, and the
+         * cells it strays to outside of it in a hash map. The alignments found are
+         * kept side by side in an arena, freed along with it.
+         */
+        class wflambda_cells_t {
+        public:
+            // States of a cell; from first_alignment on, the alignment of index state - first_alignment
+            static constexpr uint32_t unknown = 0;
+            static constexpr uint32_t no_alignment = 1;     // too distant to be aligned
+            static constexpr uint32_t failed = 2;           // aligned without success
+            static constexpr uint32_t first_alignment = 3;
+
+            wflambda_cells_t(const int pattern_length, const int text_length);
+            wflambda_cells_t(const wflambda_cells_t&) = delete;
+            wflambda_cells_t& operator=(const wflambda_cells_t&) = delete;
+
+            // State of the cell, to update once it is evaluated
+            uint32_t& state(const int v, const int h);
+            // State of the cell of a new alignment
+            uint32_t add(alignment_t&& aln);
+            alignment_t* alignment(const uint32_t state);
+            alignment_t* alignment(const int v, const int h);
+            // Free the CIGARs of the alignments not to be kept
+            void release_unkept();
+            // f(v, h, state) for each evaluated cell
+            void for_each(const std::function<void(int, int, uint32_t)>& f) const;
+        private:
+            static constexpr int64_t band_radius = 64;
+            static constexpr int64_t band_width = 2 * band_radius + 1;
+            int pattern_length;
+            int text_length;
+            // calloc'ed, so that only the pages of the band that wflambda reaches are touched
+            std::unique_ptr<uint32_t[], decltype(&free)> band;
+            robin_hood::unordered_flat_map<uint64_t,uint32_t> outside;
+            std::deque<alignment_t> arena;
+        };
+
     } /* namespace wavefront */
 
 } /* namespace wflign */
@@ -168,30 +362,38 @@ typedef struct {
     float max_mash_dist_to_evaluate;
     float mash_sketch_rate;
     float inception_score_max_ratio;
+    // Mismatches of a gapless segment pair costing less than an insertion and a deletion
+    int max_gapless_mismatches;
     // Alignments and sketches
-    robin_hood::unordered_flat_map<uint64_t,alignment_t*>* alignments;
+    wflign::wavefront::wflambda_cells_t* cells;
     std::vector<std::vector<rkmh::hash_t>*>* query_sketches;
     std::vector<std::vector<rkmh::hash_t>*>* target_sketches;
+    // Sketches from hashes computed once, if they fit in memory, else those built per segment above
+    rkmh::segment_sketches_t* query_segment_sketches;
+    rkmh::segment_sketches_t* target_segment_sketches;
+    // Target steps [first, second] of the cells of each query step near the seed anchors, if
+    // any: the cells outside of them are not aligned
+    const std::vector<std::pair<int64_t, int64_t>>* anchor_band;
     // Subsidiary WFAligner
     wfa::WFAlignerGapAffine* wf_aligner;
+    // Linear memory one taking over when wf_aligner runs out of memory, if there is a ceiling
+    wfa::WFAlignerGapAffine* wf_aligner_low_memory;
+    // Their penalties, for the aligners of the threads aligning the segments of a step at once
+    wflign_penalties_t wfa_affine_penalties;
 //    // Bidirectional
 //    wfa::WFAlignerGapAffine* wflambda_aligner;
 //    int last_breakpoint_v;
 //    int last_breakpoint_h;
 //    wflign_penalties_t* wfa_affine_penalties;
     // Stats
-#ifdef WFA_PNG_TSV_TIMING
     uint64_t num_alignments;
     uint64_t num_alignments_performed;
-#endif
     // For performance improvements
     uint64_t max_num_sketches_in_memory;
     uint64_t num_sketches_allocated;
-#ifdef WFA_PNG_TSV_TIMING
     // wfplot
     bool emit_png;
     robin_hood::unordered_set<uint64_t>* high_order_dp_matrix_mismatch;
-#endif
 } wflign_extend_data_t;
 
 #endif /* WFLIGN_HPP_ */
@@ -3,10 +3,110 @@
 #include <stdlib.h>
 #include <algorithm>
 #include <cstring>
+#include <string>
 #include <iostream>
 #include <iterator>
 #include <cassert>
 #include <vector>
+#include <charconv>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define WFLIGN_X86 1
+#include <immintrin.h>
+#endif
+
+/*
+ * Cigar arena
+ */
+static thread_local wflign_cigar_arena_t* current_cigar_arena = nullptr;
+
+wflign_cigar_arena_t::wflign_cigar_arena_t() : next(nullptr), left(0), previous(current_cigar_arena) {
+    current_cigar_arena = this;
+}
+wflign_cigar_arena_t::~wflign_cigar_arena_t() {
+    current_cigar_arena = previous;
+}
+char* wflign_cigar_arena_t::allocate(const size_t bytes) {
+    if (bytes > left) {
+        // cigars longer than a block get their own
+        if (bytes > block_size / 4) {
+            blocks.emplace_back(new char[bytes]);
+            return blocks.back().get();
+        }
+        blocks.emplace_back(new char[block_size]);
+        next = blocks.back().get();
+        left = block_size;
+    }
+    char* const ptr = next;
+    next += bytes;
+    left -= bytes;
+    return ptr;
+}
+wflign_cigar_arena_t* wflign_cigar_arena_t::current() {
+    return current_cigar_arena;
+}
+void wflign_cigar_allocate(wflign_cigar_t* const cigar, const size_t length) {
+    wflign_cigar_arena_t* const arena = wflign_cigar_arena_t::current();
+    cigar->in_arena = arena != nullptr;
+    cigar->cigar_ops = arena != nullptr ? arena->allocate(length) : (char*)malloc(length);
+}
+void wflign_cigar_free(wflign_cigar_t* const cigar) {
+    if (!cigar->in_arena) {
+        free(cigar->cigar_ops);
+    }
+    cigar->cigar_ops = nullptr;
+    cigar->in_arena = false;
+}
+
+/*
+ * Run-length encoded cigar
+ */
+void wflign_rle_cigar_t::push_back(const char op, uint64_t length) {
+    columns += length;
+    if (!runs_.empty() && this->op(runs_.back()) == op) {
+        const uint32_t room = max_run_length - this->length(runs_.back());
+        const uint32_t extension = (uint32_t)std::min<uint64_t>(length, room);
+        runs_.back() += extension << 8;
+        length -= extension;
+    }
+    while (length > 0) {
+        const uint32_t run_length = (uint32_t)std::min<uint64_t>(length, max_run_length);
+        runs_.push_back(make_run(op, run_length));
+        length -= run_length;
+    }
+}
+void wflign_rle_cigar_t::pop_back() {
+    --columns;
+    if (length(runs_.back()) == 1) {
+        runs_.pop_back();
+    } else {
+        runs_.back() -= 1u << 8;
+    }
+}
+void wflign_rle_cigar_t::clear() {
+    runs_.clear();
+    columns = 0;
+}
+void wflign_rle_cigar_t::erase_front(const const_iterator& it) {
+    for (size_t r = 0; r < it.run; ++r) {
+        columns -= length(runs_[r]);
+    }
+    runs_.erase(runs_.begin(), runs_.begin() + it.run);
+    if (it.offset > 0) {
+        columns -= it.offset;
+        runs_.front() -= it.offset << 8;
+    }
+}
+void wflign_rle_cigar_t::append(const wflign_cigar_t& cigar) {
+    int i = cigar.begin_offset;
+    while (i < cigar.end_offset) {
+        const char op = cigar.cigar_ops[i];
+        const int run_begin = i;
+        while (++i < cigar.end_offset && cigar.cigar_ops[i] == op) {
+        }
+        push_back(op, i - run_begin);
+    }
+}
 
 /*
  * Wflign Alignment
@@ -15,60 +115,20 @@
 // Default constructor
 alignment_t::alignment_t()
     : j(0), i(0), query_length(0), target_length(0), score(std::numeric_limits<int>::max()), ok(false), keep(false), is_rev(false) {
-    edit_cigar = {nullptr, 0, 0};
+    edit_cigar = {nullptr, 0, 0, false};
 }
 
 // Destructor
 alignment_t::~alignment_t() {
-        free(edit_cigar.cigar_ops);
-    }
-
-// Copy constructor
-alignment_t::alignment_t(const alignment_t& other)
-    : j(other.j), i(other.i), query_length(other.query_length), is_rev(other.is_rev),
-      target_length(other.target_length), ok(other.ok), keep(other.keep) {
-    if (other.edit_cigar.cigar_ops) {
-        edit_cigar.cigar_ops = (char*)malloc((other.edit_cigar.end_offset - other.edit_cigar.begin_offset) * sizeof(char));
-        memcpy(edit_cigar.cigar_ops, other.edit_cigar.cigar_ops + other.edit_cigar.begin_offset, 
-               (other.edit_cigar.end_offset - other.edit_cigar.begin_offset) * sizeof(char));
-    } else {
-        edit_cigar.cigar_ops = nullptr;
-    }
-    edit_cigar.begin_offset = 0;
-    edit_cigar.end_offset = other.edit_cigar.end_offset - other.edit_cigar.begin_offset;
+    wflign_cigar_free(&edit_cigar);
 }
 
 // Move constructor
 alignment_t::alignment_t(alignment_t&& other) noexcept
-    : j(other.j), i(other.i), query_length(other.query_length), is_rev(other.is_rev),
-      target_length(other.target_length), ok(other.ok), keep(other.keep),
+    : j(other.j), i(other.i), query_length(other.query_length), target_length(other.target_length),
+      score(other.score), ok(other.ok), keep(other.keep), is_rev(other.is_rev),
       edit_cigar(other.edit_cigar) {
-    other.edit_cigar = {nullptr, 0, 0};
-}
-
-// Copy assignment operator
-alignment_t& alignment_t::operator=(const alignment_t& other) {
-    if (this != &other) {
-        j = other.j;
-        i = other.i;
-        query_length = other.query_length;
-        target_length = other.target_length;
-        ok = other.ok;
-        keep = other.keep;
-        is_rev = other.is_rev;
-
-        free(edit_cigar.cigar_ops);
-        if (other.edit_cigar.cigar_ops) {
-            edit_cigar.cigar_ops = (char*)malloc((other.edit_cigar.end_offset - other.edit_cigar.begin_offset) * sizeof(char));
-            memcpy(edit_cigar.cigar_ops, other.edit_cigar.cigar_ops + other.edit_cigar.begin_offset, 
-                   (other.edit_cigar.end_offset - other.edit_cigar.begin_offset) * sizeof(char));
-        } else {
-            edit_cigar.cigar_ops = nullptr;
-        }
-        edit_cigar.begin_offset = 0;
-        edit_cigar.end_offset = other.edit_cigar.end_offset - other.edit_cigar.begin_offset;
-    }
-    return *this;
+    other.edit_cigar = {nullptr, 0, 0, false};
 }
 
 // Move assignment operator
@@ -78,13 +138,14 @@ alignment_t& alignment_t::operator=(alignment_t&& other) noexcept {
         i = other.i;
         query_length = other.query_length;
         target_length = other.target_length;
+        score = other.score;
         ok = other.ok;
         keep = other.keep;
         is_rev = other.is_rev;
 
-        free(edit_cigar.cigar_ops);
+        wflign_cigar_free(&edit_cigar);
         edit_cigar = other.edit_cigar;
-        other.edit_cigar = {nullptr, 0, 0};
+        other.edit_cigar = {nullptr, 0, 0, false};
     }
     return *this;
 }
@@ -341,7 +402,7 @@ bool validate_cigar(
     return ok;
 }
 bool validate_trace(
-        std::vector<char>& tracev,
+        const wflign_rle_cigar_t& tracev,
         const char* query,
         const char* target,
         const uint64_t& query_aln_len,
@@ -349,21 +410,19 @@ bool validate_trace(
         uint64_t j,
         uint64_t i) {
     // check that our cigar matches where it claims it does
-    const int start_idx = 0;
-    const int end_idx = tracev.size();
     const uint64_t j_max = j + query_aln_len;
     const uint64_t i_max = i + target_aln_len;
     bool ok = true;
     //std::cerr << "start to end " << start_idx << " " << end_idx << std::endl;
     //std::cerr << "j_max " << j_max << " - i_max " << i_max << std::endl;
-    for (int c = start_idx; c < end_idx; c++) {
+    for (auto c = tracev.begin(); c != tracev.end(); ++c) {
         // if new sequence of same moves started
-        switch (tracev[c]) {
+        switch (*c) {
             case 'M':
                 if (j < j_max && i < i_max) {
                     // check that we match
                     if (query[j] != target[i]) {
-                        std::cerr << "mismatch @ " << tracev[c] << " " << j << " " << i
+                        std::cerr << "mismatch @ " << *c << " " << j << " " << i
                                   << " " << query[j] << " " << target[i] << std::endl;
                         ok = false;
                     }
@@ -388,7 +447,7 @@ bool validate_trace(
                 if (j < j_max && i < i_max) {
                     // check that we don't match
                     if (query[j] == target[i]) {
-                        std::cerr << "match @ " << tracev[c] << " " << j << " " << i
+                        std::cerr << "match @ " << *c << " " << j << " " << i
                                   << " " << query[j] << " " << target[i] << std::endl;
                         ok = false;
                     }
@@ -421,13 +480,147 @@ bool validate_trace(
     }
     return ok;
 }
+/*
+ * Output formatting
+ */
+#ifdef WFLIGN_X86
+// 32 ops compared with the op of the run at a time
+__attribute__((target("avx2")))
+static uint64_t cigar_op_run_end_avx2(const char* ops, const uint64_t begin, const uint64_t end) {
+    const char op = ops[begin];
+    const __m256i run_op = _mm256_set1_epi8(op);
+    uint64_t i = begin + 1;
+    for (; i + 32 <= end; i += 32) {
+        const uint32_t same = (uint32_t)_mm256_movemask_epi8(
+            _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(ops + i)), run_op));
+        if (same != 0xffffffff) {
+            return i + __builtin_ctz(~same);
+        }
+    }
+    while (i < end && ops[i] == op) {
+        ++i;
+    }
+    return i;
+}
+#endif
+static uint64_t cigar_op_run_end_scalar(const char* ops, const uint64_t begin, const uint64_t end) {
+    uint64_t i = begin + 1;
+    while (i < end && ops[i] == ops[begin]) {
+        ++i;
+    }
+    return i;
+}
+typedef uint64_t (*cigar_op_run_kernel_t)(const char*, const uint64_t, const uint64_t);
+static cigar_op_run_kernel_t select_cigar_op_run_kernel() {
+#ifdef WFLIGN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return cigar_op_run_end_avx2;
+    }
+#endif
+    return cigar_op_run_end_scalar;
+}
+uint64_t cigar_op_run_end(const char* ops, const uint64_t begin, const uint64_t end) {
+    static const cigar_op_run_kernel_t kernel = select_cigar_op_run_kernel();
+    return kernel(ops, begin, end);
+}
+void append_decimal(std::string& out, const uint64_t n) {
+    char digits[20];
+    const std::to_chars_result r = std::to_chars(digits, digits + sizeof(digits), n);
+    out.append(digits, r.ptr);
+}
+void append_md_tag(std::string& out, const wflign_rle_cigar_t& trace, const char* target) {
+    out += "MD:Z:";
+    // matches not written yet
+    uint64_t matched = 0;
+    const std::vector<wflign_rle_cigar_t::run_t>& runs = trace.runs();
+    for (size_t r = 0; r < runs.size();) {
+        const char op = wflign_rle_cigar_t::op(runs[r]);
+        uint64_t length = 0;
+        for (; r < runs.size() && wflign_rle_cigar_t::op(runs[r]) == op; ++r) {
+            length += wflign_rle_cigar_t::length(runs[r]);
+        }
+        const bool last = r == runs.size();
+        switch (op) {
+            case 'M':
+                matched += length;
+                target += length;
+                if (last) {
+                    append_decimal(out, matched);
+                }
+                break;
+            case 'X':
+                for (uint64_t i = 0; i < length; ++i) {
+                    append_decimal(out, matched);
+                    out += *target++;
+                    matched = 0;
+                }
+                if (last) {
+                    out += '0';
+                }
+                break;
+            case 'D':
+                append_decimal(out, matched);
+                out += '^';
+                out.append(target, length);
+                target += length;
+                matched = 0;
+                if (last) {
+                    out += '0';
+                }
+                break;
+            case 'I':
+                if (last) {
+                    append_decimal(out, matched);
+                }
+                break;
+            default:
+                break;
+        }
+    }
+}
 /*
  * Alignment-CIGAR Adaptors
  */
+// Counts of a run of length moves added to those of its alignment
+static inline void count_run(
+        const char move,
+        const uint64_t length,
+        uint64_t& target_aligned_length,
+        uint64_t& query_aligned_length,
+        uint64_t& matches,
+        uint64_t& mismatches,
+        uint64_t& insertions,
+        uint64_t& inserted_bp,
+        uint64_t& deletions,
+        uint64_t& deleted_bp) {
+    switch (move) {
+        case 'M':
+            matches += length;
+            query_aligned_length += length;
+            target_aligned_length += length;
+            break;
+        case 'X':
+            mismatches += length;
+            query_aligned_length += length;
+            target_aligned_length += length;
+            break;
+        case 'I':
+            ++insertions;
+            inserted_bp += length;
+            query_aligned_length += length;
+            break;
+        case 'D':
+            ++deletions;
+            deleted_bp += length;
+            target_aligned_length += length;
+            break;
+        default:
+            break;
+    }
+}
 char* alignment_to_cigar(
-        const std::vector<char>& edit_cigar,
-        const uint64_t& start_idx,
-        const uint64_t& end_idx,
+        const wflign_rle_cigar_t& edit_cigar,
         uint64_t& target_aligned_length,
         uint64_t& query_aligned_length,
         uint64_t& matches,
@@ -436,69 +629,30 @@ char* alignment_to_cigar(
         uint64_t& inserted_bp,
         uint64_t& deletions,
         uint64_t& deleted_bp) {
-    // the edit cigar contains a character string of ops
-    // here we compress them into the standard cigar representation
-
-    auto *cigar = new std::vector<char>();
-    char lastMove = 0; // Char of last move. 0 if there was no previous move.
-    int numOfSameMoves = 0;
-
-    // std::cerr << "start to end " << start_idx << " " << end_idx << std::endl;
-    for (int i = start_idx; i <= end_idx; i++) {
-        // if new sequence of same moves started
-        if (i == end_idx || (edit_cigar[i] != lastMove && lastMove != 0)) {
-            // calculate matches, mismatches, insertions, deletions
-            switch (lastMove) {
-                case 'M':
-                    matches += numOfSameMoves;
-                    query_aligned_length += numOfSameMoves;
-                    target_aligned_length += numOfSameMoves;
-                    break;
-                case 'X':
-                    mismatches += numOfSameMoves;
-                    query_aligned_length += numOfSameMoves;
-                    target_aligned_length += numOfSameMoves;
-                    break;
-                case 'I':
-                    ++insertions;
-                    inserted_bp += numOfSameMoves;
-                    query_aligned_length += numOfSameMoves;
-                    break;
-                case 'D':
-                    ++deletions;
-                    deleted_bp += numOfSameMoves;
-                    target_aligned_length += numOfSameMoves;
-                    break;
-                default:
-                    break;
-            }
-
-            // Write number of moves to cigar string.
-            int numDigits = 0;
-            for (; numOfSameMoves; numOfSameMoves /= 10) {
-                cigar->push_back('0' + numOfSameMoves % 10);
-                numDigits++;
-            }
-            std::reverse(cigar->end() - numDigits, cigar->end());
-            // Write code of move to cigar string.
-            // reassign 'M' to '=' for convenience
-            lastMove = lastMove == 'M' ? '=' : lastMove;
-            cigar->push_back(lastMove);
-            // If not at the end, start new sequence of moves.
-            if (i < end_idx) {
-                numOfSameMoves = 0;
-            }
-        }
-        if (i < end_idx) {
-            lastMove = edit_cigar[i];
-            numOfSameMoves++;
+    // the edit cigar is already run-length encoded, only the runs of an op
+    // longer than a packed run are split, and merged back here
+
+    std::string cigar;
+    const std::vector<wflign_rle_cigar_t::run_t>& runs = edit_cigar.runs();
+    for (size_t r = 0; r < runs.size();) {
+        const char move = wflign_rle_cigar_t::op(runs[r]);
+        uint64_t numOfSameMoves = 0;
+        for (; r < runs.size() && wflign_rle_cigar_t::op(runs[r]) == move; ++r) {
+            numOfSameMoves += wflign_rle_cigar_t::length(runs[r]);
         }
+        // calculate matches, mismatches, insertions, deletions
+        count_run(move, numOfSameMoves, target_aligned_length, query_aligned_length, matches,
+                  mismatches, insertions, inserted_bp, deletions, deleted_bp);
+
+        // Write number of moves to cigar string.
+        append_decimal(cigar, numOfSameMoves);
+        // Write code of move to cigar string.
+        // reassign 'M' to '=' for convenience
+        cigar += move == 'M' ? '=' : move;
     }
-    cigar->push_back(0); // Null character termination.
 
-    char *cigar_ = (char *)malloc(cigar->size() * sizeof(char));
-    std::memcpy(cigar_, &(*cigar)[0], cigar->size() * sizeof(char));
-    delete cigar;
+    char *cigar_ = (char *)malloc(cigar.size() + 1);
+    std::memcpy(cigar_, cigar.c_str(), cigar.size() + 1);
 
     return cigar_;
 }
@@ -515,72 +669,68 @@ char* wfa_alignment_to_cigar(
     // the edit cigar contains a character string of ops
     // here we compress them into the standard cigar representation
 
-    auto *cigar = new std::vector<char>();
-    char lastMove = 0; // Char of last move. 0 if there was no previous move.
-    int numOfSameMoves = 0;
-    const int start_idx = edit_cigar->begin_offset;
-    const int end_idx = edit_cigar->end_offset;
-
-    // std::cerr << "start to end " << start_idx << " " << end_idx << std::endl;
-    for (int i = start_idx; i <= end_idx; i++) {
-        // if new sequence of same moves started
-        if (i == end_idx ||
-            (edit_cigar->cigar_ops[i] != lastMove && lastMove != 0)) {
-            // calculate matches, mismatches, insertions, deletions
-            switch (lastMove) {
-                case 'M':
-                    matches += numOfSameMoves;
-                    query_aligned_length += numOfSameMoves;
-                    target_aligned_length += numOfSameMoves;
-                    break;
-                case 'X':
-                    mismatches += numOfSameMoves;
-                    query_aligned_length += numOfSameMoves;
-                    target_aligned_length += numOfSameMoves;
-                    break;
-                case 'I':
-                    ++insertions;
-                    inserted_bp += numOfSameMoves;
-                    query_aligned_length += numOfSameMoves;
-                    break;
-                case 'D':
-                    ++deletions;
-                    deleted_bp += numOfSameMoves;
-                    target_aligned_length += numOfSameMoves;
-                    break;
-                default:
-                    break;
-            }
-
-            // Write number of moves to cigar string.
-            int numDigits = 0;
-            for (; numOfSameMoves; numOfSameMoves /= 10) {
-                cigar->push_back('0' + numOfSameMoves % 10);
-                numDigits++;
-            }
-            std::reverse(cigar->end() - numDigits, cigar->end());
-            // Write code of move to cigar string.
-            // reassign 'M' to '=' for convenience
-            lastMove = lastMove == 'M' ? '=' : lastMove;
-            cigar->push_back(lastMove);
-            // If not at the end, start new sequence of moves.
-            if (i < end_idx) {
-                numOfSameMoves = 0;
-            }
-        }
-        if (i < end_idx) {
-            lastMove = edit_cigar->cigar_ops[i];
-            numOfSameMoves++;
-        }
+    std::string cigar;
+    const uint64_t end_idx = edit_cigar->end_offset;
+    for (uint64_t i = edit_cigar->begin_offset; i < end_idx;) {
+        const char move = edit_cigar->cigar_ops[i];
+        const uint64_t run_end = cigar_op_run_end(edit_cigar->cigar_ops, i, end_idx);
+        const uint64_t numOfSameMoves = run_end - i;
+        i = run_end;
+        // calculate matches, mismatches, insertions, deletions
+        count_run(move, numOfSameMoves, target_aligned_length, query_aligned_length, matches,
+                  mismatches, insertions, inserted_bp, deletions, deleted_bp);
+
+        // Write number of moves to cigar string.
+        append_decimal(cigar, numOfSameMoves);
+        // Write code of move to cigar string.
+        // reassign 'M' to '=' for convenience
+        cigar += move == 'M' ? '=' : move;
     }
-    cigar->push_back(0); // Null character termination.
 
-    char *cigar_ = (char *)malloc(cigar->size() * sizeof(char));
-    std::memcpy(cigar_, &(*cigar)[0], cigar->size() * sizeof(char));
-    delete cigar;
+    char *cigar_ = (char *)malloc(cigar.size() + 1);
+    std::memcpy(cigar_, cigar.c_str(), cigar.size() + 1);
 
     return cigar_;
 }
+void alignment_stats(
+        const wflign_rle_cigar_t& edit_cigar,
+        uint64_t& target_aligned_length,
+        uint64_t& query_aligned_length,
+        uint64_t& matches,
+        uint64_t& mismatches,
+        uint64_t& insertions,
+        uint64_t& inserted_bp,
+        uint64_t& deletions,
+        uint64_t& deleted_bp) {
+    const std::vector<wflign_rle_cigar_t::run_t>& runs = edit_cigar.runs();
+    for (size_t r = 0; r < runs.size();) {
+        const char move = wflign_rle_cigar_t::op(runs[r]);
+        uint64_t numOfSameMoves = 0;
+        for (; r < runs.size() && wflign_rle_cigar_t::op(runs[r]) == move; ++r) {
+            numOfSameMoves += wflign_rle_cigar_t::length(runs[r]);
+        }
+        count_run(move, numOfSameMoves, target_aligned_length, query_aligned_length, matches,
+                  mismatches, insertions, inserted_bp, deletions, deleted_bp);
+    }
+}
+void wfa_alignment_stats(
+        const wflign_cigar_t* const edit_cigar,
+        uint64_t& target_aligned_length,
+        uint64_t& query_aligned_length,
+        uint64_t& matches,
+        uint64_t& mismatches,
+        uint64_t& insertions,
+        uint64_t& inserted_bp,
+        uint64_t& deletions,
+        uint64_t& deleted_bp) {
+    const uint64_t end_idx = edit_cigar->end_offset;
+    for (uint64_t i = edit_cigar->begin_offset; i < end_idx;) {
+        const uint64_t run_end = cigar_op_run_end(edit_cigar->cigar_ops, i, end_idx);
+        count_run(edit_cigar->cigar_ops[i], run_end - i, target_aligned_length, query_aligned_length, matches,
+                  mismatches, insertions, inserted_bp, deletions, deleted_bp);
+        i = run_end;
+    }
+}
 /*
  * Utils
  */
@@ -658,37 +808,43 @@ void wflign_edit_cigar_copy(
     int cigar_length;
     wf_aligner.getAlignment(&cigar_ops,&cigar_length);
     // Allocate
-    cigar_dst->cigar_ops = (char*)malloc(cigar_length);
+    wflign_cigar_allocate(cigar_dst,cigar_length);
     // Copy
     cigar_dst->begin_offset = 0;
     cigar_dst->end_offset = cigar_length;
     memcpy(cigar_dst->cigar_ops,cigar_ops,cigar_length);
 }
 
+// Score of a run of length ops
+static inline int run_score(const char op, const int length, const wflign_penalties_t& penalties) {
+    switch (op) {
+        case 'M':
+            // Match is free (best case)
+            return 0;
+        case 'X':
+            return length * penalties.mismatch;
+        case 'I':
+        case 'D': {
+            int score = penalties.gap_opening1 + penalties.gap_extension1;
+            if (length > 1) {
+                score += std::min(
+                    penalties.gap_extension1 * (length - 1),
+                    penalties.gap_opening2 + penalties.gap_extension2 * (length - 1)
+                );
+            }
+            return score;
+        }
+        default:
+            return 0;
+    }
+}
 int calculate_alignment_score(const wflign_cigar_t& cigar, const wflign_penalties_t& penalties) {
     int score = 0;
     char prev_op = '\0';
     int gap_length = 0;
 
     auto process_gap = [&](char op, int length) {
-        switch (op) {
-            case 'M':
-                // Match is free (best case)
-                break;
-            case 'X':
-                score += length * penalties.mismatch;
-                break;
-            case 'I':
-            case 'D':
-                score += penalties.gap_opening1 + penalties.gap_extension1;
-                if (length > 1) {
-                    score += std::min(
-                        penalties.gap_extension1 * (length - 1),
-                        penalties.gap_opening2 + penalties.gap_extension2 * (length - 1)
-                    );
-                }
-                break;
-        }
+        score += run_score(op, length, penalties);
     };
 
     for (int i = cigar.begin_offset; i <= cigar.end_offset; ++i) {
@@ -708,6 +864,19 @@ int calculate_alignment_score(const wflign_cigar_t& cigar, const wflign_penaltie
 
     return score;
 }
+int calculate_alignment_score(const wflign_rle_cigar_t& cigar, const wflign_penalties_t& penalties) {
+    int score = 0;
+    const std::vector<wflign_rle_cigar_t::run_t>& runs = cigar.runs();
+    for (size_t r = 0; r < runs.size();) {
+        const char op = wflign_rle_cigar_t::op(runs[r]);
+        int length = 0;
+        for (; r < runs.size() && wflign_rle_cigar_t::op(runs[r]) == op; ++r) {
+            length += wflign_rle_cigar_t::length(runs[r]);
+        }
+        score += run_score(op, length, penalties);
+    }
+    return score;
+}
 
 std::string cigar_to_string(const wflign_cigar_t& cigar) {
     std::stringstream ss;
@@ -3,7 +3,9 @@
 
 #include <vector>
 #include <cstdint>
+#include <memory>
 #include <sstream>
+#include <string>
 #include "WFA2-lib/bindings/cpp/WFAligner.hpp"
 
 /*
@@ -13,8 +15,132 @@ typedef struct {
     char* cigar_ops;
     int begin_offset;
     int end_offset;
+    bool in_arena; // cigar_ops belongs to an arena, else it is malloc'd
 } wflign_cigar_t;
 
+/*
+ * Cigar arena: owns the cigars allocated on its thread while it is the current
+ * arena there, freeing them all at once with it. Arenas nest, the previous one
+ * being current again once the last one is gone
+ */
+class wflign_cigar_arena_t {
+public:
+    wflign_cigar_arena_t();
+    ~wflign_cigar_arena_t();
+    wflign_cigar_arena_t(const wflign_cigar_arena_t&) = delete;
+    wflign_cigar_arena_t& operator=(const wflign_cigar_arena_t&) = delete;
+    char* allocate(const size_t bytes);
+    // Arena of the thread, if any
+    static wflign_cigar_arena_t* current();
+private:
+    static const size_t block_size = 1 << 20;
+    std::vector<std::unique_ptr<char[]>> blocks;
+    char* next;
+    size_t left;
+    wflign_cigar_arena_t* previous;
+};
+// Room for length ops in cigar, from the current arena if any
+void wflign_cigar_allocate(wflign_cigar_t* const cigar, const size_t length);
+// Release the ops of cigar, unless an arena owns them
+void wflign_cigar_free(wflign_cigar_t* const cigar);
+
+/*
+ * Run-length encoded cigar: runs of one op, each packed with its length into 32 bits.
+ * Ops are added and removed at the back in constant time, and read one column at a
+ * time through a cursor
+ */
+class wflign_rle_cigar_t {
+public:
+    typedef uint32_t run_t;
+    // Longer runs of an op take several runs
+    static constexpr uint32_t max_run_length = (1u << 24) - 1;
+    static char op(const run_t run) {
+        return (char)(run & 0xff);
+    }
+    static uint32_t length(const run_t run) {
+        return run >> 8;
+    }
+    static run_t make_run(const char op, const uint32_t length) {
+        return (length << 8) | (uint8_t)op;
+    }
+    // Cursor over the columns of the cigar
+    class const_iterator {
+    public:
+        const_iterator() : runs(nullptr), run(0), offset(0) {}
+        const_iterator(const std::vector<run_t>* const runs, const size_t run, const uint32_t offset)
+            : runs(runs), run(run), offset(offset) {}
+        char operator*() const {
+            return op((*runs)[run]);
+        }
+        const_iterator& operator++() {
+            if (++offset == length((*runs)[run])) {
+                ++run;
+                offset = 0;
+            }
+            return *this;
+        }
+        const_iterator operator++(int) {
+            const_iterator it = *this;
+            ++*this;
+            return it;
+        }
+        bool operator==(const const_iterator& other) const {
+            return run == other.run && offset == other.offset;
+        }
+        bool operator!=(const const_iterator& other) const {
+            return !(*this == other);
+        }
+        // Ops left in the current run, this one included
+        uint32_t run_left() const {
+            return length((*runs)[run]) - offset;
+        }
+        // Skip n ops, at most run_left()
+        void skip(const uint32_t n) {
+            offset += n;
+            if (offset == length((*runs)[run])) {
+                ++run;
+                offset = 0;
+            }
+        }
+    private:
+        friend class wflign_rle_cigar_t;
+        const std::vector<run_t>* runs;
+        size_t run;
+        uint32_t offset;
+    };
+
+    const_iterator begin() const {
+        return const_iterator(&runs_, 0, 0);
+    }
+    const_iterator end() const {
+        return const_iterator(&runs_, runs_.size(), 0);
+    }
+    bool empty() const {
+        return runs_.empty();
+    }
+    // Columns of the cigar
+    uint64_t size() const {
+        return columns;
+    }
+    const std::vector<run_t>& runs() const {
+        return runs_;
+    }
+    char back() const {
+        return op(runs_.back());
+    }
+    void push_back(const char op, uint64_t length = 1);
+    void pop_back();
+    void clear();
+    // Ops before it removed
+    void erase_front(const const_iterator& it);
+    // Ops of the cigar of an alignment appended
+    void append(const wflign_cigar_t& cigar);
+
+private:
+    std::vector<run_t> runs_;
+    uint64_t columns = 0;
+};
+
 /*
  * Penalties
  */
@@ -28,7 +154,7 @@ typedef struct {
 } wflign_penalties_t;
 
 /*
- * Wflign Alignment
+ * Wflign Alignment: move-only, as its cigar ops belong to it or to an arena
  */
 class alignment_t {
 public:
@@ -45,12 +171,10 @@ public:
     alignment_t();
     // Destructor
     ~alignment_t();
-    // Copy constructor
-    alignment_t(const alignment_t& other);
+    alignment_t(const alignment_t& other) = delete;
+    alignment_t& operator=(const alignment_t& other) = delete;
     // Move constructor
     alignment_t(alignment_t&& other) noexcept;
-    // Copy assignment operator
-    alignment_t& operator=(const alignment_t& other);
     // Move assignment operator
     alignment_t& operator=(alignment_t&& other) noexcept;
     // Trim functions
@@ -105,20 +229,49 @@ bool validate_cigar(
         uint64_t j,
         uint64_t i);
 bool validate_trace(
-        std::vector<char>& tracev,
+        const wflign_rle_cigar_t& tracev,
         const char* query,
         const char* target,
         const uint64_t& query_aln_len,
         const uint64_t& target_aln_len,
         uint64_t j,
         uint64_t i);
+/*
+ * Output formatting
+ */
+// End of the run of ops[begin] in ops[begin, end)
+uint64_t cigar_op_run_end(const char* ops, const uint64_t begin, const uint64_t end);
+// n in decimal appended to out
+void append_decimal(std::string& out, const uint64_t n);
+// MD tag of trace appended to out, target pointing to its first aligned base
+void append_md_tag(std::string& out, const wflign_rle_cigar_t& trace, const char* target);
 /*
  * Alignment-CIGAR Adaptors
  */
+// The counts of alignment_to_cigar, without the cigar
+void alignment_stats(
+        const wflign_rle_cigar_t& edit_cigar,
+        uint64_t& target_aligned_length,
+        uint64_t& query_aligned_length,
+        uint64_t& matches,
+        uint64_t& mismatches,
+        uint64_t& insertions,
+        uint64_t& inserted_bp,
+        uint64_t& deletions,
+        uint64_t& deleted_bp);
+// The counts of wfa_alignment_to_cigar, without the cigar
+void wfa_alignment_stats(
+        const wflign_cigar_t* const edit_cigar,
+        uint64_t& target_aligned_length,
+        uint64_t& query_aligned_length,
+        uint64_t& matches,
+        uint64_t& mismatches,
+        uint64_t& insertions,
+        uint64_t& inserted_bp,
+        uint64_t& deletions,
+        uint64_t& deleted_bp);
 char* alignment_to_cigar(
-        const std::vector<char>& edit_cigar,
-        const uint64_t& start_idx,
-        const uint64_t& end_idx,
+        const wflign_rle_cigar_t& edit_cigar,
         uint64_t& target_aligned_length,
         uint64_t& query_aligned_length,
         uint64_t& matches,
@@ -153,5 +306,6 @@ void wflign_edit_cigar_copy(
         wflign_cigar_t* const cigar_dst);
 
 int calculate_alignment_score(const wflign_cigar_t& cigar, const wflign_penalties_t& penalties);
+int calculate_alignment_score(const wflign_rle_cigar_t& cigar, const wflign_penalties_t& penalties);
 
 #endif /* WFLIGN_ALIGNMENT_HPP_ */
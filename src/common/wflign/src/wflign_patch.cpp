@@ -1,10 +1,20 @@
+#include <algorithm>
 #include <cstddef>
 #include <chrono>
+#include <cstdint>
 #include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <map>
 #include <string>
+#include <tuple>
+#include <vector>
 #include <atomic_image.hpp>
 #include "rkmh.hpp"
 #include "wflign_patch.hpp"
+#include "../../hot_counters.hpp"
+#include "../../trace.hpp"
+#include "../../probes.hpp"
 
 namespace wflign {
 
@@ -18,6 +28,236 @@ namespace wflign {
 
     namespace wavefront {
 
+/*
+ * Gapless alignment of two segments of the same length, if they differ by at
+ * most max_mismatches bases. Compared 8 bases at a time, stopping as soon as
+ * there are too many mismatches
+ */
+bool gapless_alignment(
+        const char* query,
+        const char* target,
+        const uint64_t& length,
+        const int& max_mismatches,
+        wflign_cigar_t& cigar) {
+    constexpr uint64_t low7 = 0x7f7f7f7f7f7f7f7fULL;
+    int mismatches = 0;
+    uint64_t p = 0;
+    for (; p + 8 <= length; p += 8) {
+        uint64_t q, t;
+        memcpy(&q, query + p, 8);
+        memcpy(&t, target + p, 8);
+        const uint64_t x = q ^ t;
+        if (x != 0) {
+            // high bit of each byte set if the byte differs
+            const uint64_t differs = (((x & low7) + low7) | x) & ~low7;
+            mismatches += __builtin_popcountll(differs);
+            if (mismatches > max_mismatches) {
+                return false;
+            }
+        }
+    }
+    for (; p < length; ++p) {
+        mismatches += query[p] != target[p];
+    }
+    if (mismatches > max_mismatches) {
+        return false;
+    }
+
+    wflign_cigar_allocate(&cigar, length);
+    cigar.begin_offset = 0;
+    cigar.end_offset = length;
+    for (uint64_t k = 0; k < length; ++k) {
+        cigar.cigar_ops[k] = query[k] == target[k] ? 'M' : 'X';
+    }
+    return true;
+}
+
+/*
+ * Edit distance of a and b, by the bit-parallel algorithm of Myers over blocks of 64
+ * rows of the shorter, as Hyyrö lays it out for sequences longer than a word
+ */
+uint64_t edit_distance(
+        const char* a,
+        const uint64_t& a_length,
+        const char* b,
+        const uint64_t& b_length) {
+    const char* pattern = a_length <= b_length ? a : b;
+    const char* text = a_length <= b_length ? b : a;
+    const uint64_t m = std::min(a_length, b_length);
+    const uint64_t n = std::max(a_length, b_length);
+    if (m == 0) {
+        return n;
+    }
+    const uint64_t blocks = (m + 63) / 64;
+    const uint64_t last_bit = uint64_t(1) << ((m - 1) % 64);
+
+    // the rows matching each character of pattern, the characters it lacks matching none
+    int16_t slot_of[256];
+    std::fill(slot_of, slot_of + 256, -1);
+    std::vector<uint64_t> peq;
+    for (uint64_t r = 0; r < m; ++r) {
+        const uint8_t c = pattern[r];
+        if (slot_of[c] < 0) {
+            slot_of[c] = peq.size() / blocks;
+            peq.resize(peq.size() + blocks, 0);
+        }
+        peq[slot_of[c] * blocks + r / 64] |= uint64_t(1) << (r % 64);
+    }
+    const std::vector<uint64_t> none(blocks, 0);
+
+    std::vector<uint64_t> pv(blocks, ~uint64_t(0));
+    std::vector<uint64_t> mv(blocks, 0);
+    uint64_t score = m;
+    for (uint64_t col = 0; col < n; ++col) {
+        const int16_t slot = slot_of[(uint8_t)text[col]];
+        const uint64_t* eq_of = slot < 0 ? none.data() : peq.data() + slot * blocks;
+        // the top row grows by one per column in a global alignment
+        int carry = 1;
+        for (uint64_t k = 0; k < blocks; ++k) {
+            uint64_t eq = eq_of[k];
+            const uint64_t p = pv[k];
+            const uint64_t x_v = eq | mv[k];
+            if (carry < 0) {
+                eq |= 1;
+            }
+            const uint64_t x_h = (((eq & p) + p) ^ p) | eq;
+            uint64_t p_h = mv[k] | ~(x_h | p);
+            uint64_t m_h = p & x_h;
+            const uint64_t out_bit = k + 1 < blocks ? uint64_t(1) << 63 : last_bit;
+            const int carry_out = (p_h & out_bit ? 1 : 0) - (m_h & out_bit ? 1 : 0);
+            p_h <<= 1;
+            m_h <<= 1;
+            if (carry < 0) {
+                m_h |= 1;
+            } else if (carry > 0) {
+                p_h |= 1;
+            }
+            pv[k] = m_h | ~(x_v | p_h);
+            mv[k] = p_h & x_v;
+            carry = carry_out;
+        }
+        score += carry;
+    }
+    return score;
+}
+
+/*
+ * Least score under penalties of an alignment of sequences of these lengths and edit
+ * distance: its mismatches and gap bases add up to at least distance, its gap bases to
+ * at least the length difference, and the bases of several gaps cost at least as much
+ * as one gap of them all, the cost of a gap being concave in its length
+ */
+int patch_score_lower_bound(
+        const uint64_t& distance,
+        const uint64_t& query_length,
+        const uint64_t& target_length,
+        const wflign_penalties_t& penalties) {
+    const auto gap = [&](const uint64_t length) -> int64_t {
+        return length == 0 ? 0 : std::min(
+                penalties.gap_opening1 + (int64_t)length * penalties.gap_extension1,
+                penalties.gap_opening2 + (int64_t)length * penalties.gap_extension2);
+    };
+    const uint64_t difference = query_length > target_length
+        ? query_length - target_length : target_length - query_length;
+    const int64_t bound = std::min(
+            (int64_t)(distance - difference) * penalties.mismatch + gap(difference),
+            gap(distance));
+    return (int)std::min<int64_t>(bound, std::numeric_limits<int>::max());
+}
+
+/*
+ * Whether no alignment of the patch scores within max_score, as its edit distance
+ * shows. The distance costs about as much as 1/16 of the pairs of bases in cells of
+ * the WFA, which gives up on a patch this far out after about max_score^2 of them:
+ * it is only worked out for the patches where that is cheaper
+ */
+bool patch_out_of_reach(
+        const char* query,
+        const uint64_t& query_length,
+        const char* target,
+        const uint64_t& target_length,
+        const wflign_penalties_t& penalties,
+        const int& max_score) {
+    const uint64_t difference = query_length > target_length
+        ? query_length - target_length : target_length - query_length;
+    if (patch_score_lower_bound(difference, query_length, target_length, penalties) > max_score) {
+        return true;
+    }
+    if (query_length < 64 || target_length < 64
+        || query_length * target_length / 16 > (uint64_t)max_score * max_score) {
+        return false;
+    }
+    const uint64_t distance = edit_distance(query, query_length, target, target_length);
+    return patch_score_lower_bound(distance, query_length, target_length, penalties) > max_score;
+}
+
+/*
+ * Whether query looks more like the reverse complement of target than like
+ * target itself: more of the 2-bit packed k-mers of its reverse complement
+ * than of its own are found among those of target. A k-mer containment check
+ * costing a sort of target, so that the reverse complement alignment of a
+ * patch, as costly as its forward one, is only tried when it can win
+ */
+bool likely_inversion(
+        const char* query,
+        const uint64_t& query_length,
+        const char* target,
+        const uint64_t& target_length) {
+    constexpr uint64_t k = 11;
+    constexpr uint32_t mask = (1u << (2 * k)) - 1;
+    if (query_length < k || target_length < k) {
+        return false;
+    }
+    auto code = [](const char c) -> int {
+        switch (c) {
+            case 'A': case 'a': return 0;
+            case 'C': case 'c': return 1;
+            case 'G': case 'g': return 2;
+            case 'T': case 't': return 3;
+            default: return -1;
+        }
+    };
+
+    std::vector<uint32_t> target_kmers;
+    target_kmers.reserve(target_length - k + 1);
+    uint32_t kmer = 0;
+    uint64_t valid = 0;
+    for (uint64_t p = 0; p < target_length; ++p) {
+        const int c = code(target[p]);
+        if (c < 0) {
+            valid = 0;
+            continue;
+        }
+        kmer = ((kmer << 2) | c) & mask;
+        if (++valid >= k) {
+            target_kmers.push_back(kmer);
+        }
+    }
+    std::sort(target_kmers.begin(), target_kmers.end());
+    target_kmers.erase(std::unique(target_kmers.begin(), target_kmers.end()), target_kmers.end());
+
+    // both strands of query at once, the reverse complement k-mer built from its end
+    uint64_t fwd_shared = 0;
+    uint64_t rev_shared = 0;
+    uint32_t rev_kmer = 0;
+    kmer = 0;
+    valid = 0;
+    for (uint64_t p = 0; p < query_length; ++p) {
+        const int c = code(query[p]);
+        if (c < 0) {
+            valid = 0;
+            continue;
+        }
+        kmer = ((kmer << 2) | c) & mask;
+        rev_kmer = (rev_kmer >> 2) | ((uint32_t)(3 - c) << (2 * (k - 1)));
+        if (++valid >= k) {
+            fwd_shared += std::binary_search(target_kmers.begin(), target_kmers.end(), kmer);
+            rev_shared += std::binary_search(target_kmers.begin(), target_kmers.end(), rev_kmer);
+        }
+    }
+    return rev_shared > fwd_shared;
+}
+
 // accumulate alignment objects
 // run the traceback determine which are part of the main chain
 // order them and write them out
@@ -46,85 +286,152 @@ bool do_wfa_segment_alignment(
         std::cerr << "query_name: " << query_name << " query_length: " << query_length << " target_name: " << target_name << " target_length: " << target_length << std::endl;
         std::cerr << "i: " << i << " j: " << j << " segment_length_t: " << segment_length_t << " segment_length_q: " << segment_length_q << std::endl;
     }
-    
-    // first make the sketches if we haven't yet
-    if (query_sketch == nullptr) {
-        query_sketch = new std::vector<rkmh::hash_t>();
-        *query_sketch = rkmh::hash_sequence(
-                query + j, segment_length_q, extend_data->minhash_kmer_size, (uint64_t)((float)segment_length_q * extend_data->mash_sketch_rate));
-        ++extend_data->num_sketches_allocated;
-    }
-    if (target_sketch == nullptr) {
-        target_sketch = new std::vector<rkmh::hash_t>();        
-        *target_sketch = rkmh::hash_sequence(
-                target + i, segment_length_t, extend_data->minhash_kmer_size, (uint64_t)((float)segment_length_t * extend_data->mash_sketch_rate));
-        ++extend_data->num_sketches_allocated;
-    }
-
-    // first check if our mash dist is inbounds
-    const float mash_dist =
-            rkmh::compare(*query_sketch, *target_sketch, extend_data->minhash_kmer_size);
-    //std::cerr << "mash_dist is " << mash_dist << std::endl;
 
     // this threshold is set low enough that we tend to randomly sample wflambda
     // matrix cells for alignment the threshold is adaptive, based on the mash
     // distance of the mapping we are aligning we should obtain enough
     // alignments that we can still patch between them
-    if (mash_dist > extend_data->max_mash_dist_to_evaluate) {
+    if (!wfa_segment_within_mash_distance(query, query_sketch, j, target, target_sketch, i,
+                                          segment_length_q, segment_length_t, step_size, extend_data)) {
         // if it isn't, return false
         return false;
+    }
+    // if it is, we'll align
+    do_wfa_segment_pair_alignment(query, j, target, i, segment_length_q, segment_length_t, extend_data, aln);
+    return true;
+}
+
+bool wfa_segment_within_mash_distance(
+        const char* query,
+        std::vector<rkmh::hash_t>*& query_sketch,
+        const int64_t& j,
+        const char* target,
+        std::vector<rkmh::hash_t>*& target_sketch,
+        const int64_t& i,
+        const uint16_t& segment_length_q,
+        const uint16_t& segment_length_t,
+        const uint16_t& step_size,
+        wflign_extend_data_t* extend_data) {
+    // cells far from the seed anchors are not worth sketching
+    if (extend_data->anchor_band != nullptr) {
+        const std::pair<int64_t, int64_t>& band = (*extend_data->anchor_band)[j / step_size];
+        const int64_t h = i / step_size;
+        if (h < band.first || h > band.second) {
+            return false;
+        }
+    }
+    // check if our mash dist is inbounds, making the sketches if we haven't yet
+    float mash_dist;
+    if (extend_data->query_segment_sketches != nullptr) {
+        uint64_t query_sketch_size, target_sketch_size;
+        const rkmh::hash_t* query_hashes = extend_data->query_segment_sketches->sketch(j / step_size, query_sketch_size);
+        const rkmh::hash_t* target_hashes = extend_data->target_segment_sketches->sketch(i / step_size, target_sketch_size);
+        mash_dist = rkmh::compare(query_hashes, query_sketch_size, target_hashes, target_sketch_size,
+                                  extend_data->minhash_kmer_size);
     } else {
-        // if it is, we'll align
-        const int max_score = (int)((float)std::max(segment_length_q, segment_length_t) * extend_data->inception_score_max_ratio);
+        if (query_sketch == nullptr) {
+            query_sketch = new std::vector<rkmh::hash_t>();
+            *query_sketch = rkmh::hash_sequence(
+                    query + j, segment_length_q, extend_data->minhash_kmer_size, (uint64_t)((float)segment_length_q * extend_data->mash_sketch_rate));
+            ++extend_data->num_sketches_allocated;
+        }
+        if (target_sketch == nullptr) {
+            target_sketch = new std::vector<rkmh::hash_t>();        
+            *target_sketch = rkmh::hash_sequence(
+                    target + i, segment_length_t, extend_data->minhash_kmer_size, (uint64_t)((float)segment_length_t * extend_data->mash_sketch_rate));
+            ++extend_data->num_sketches_allocated;
+        }
+
+        mash_dist = rkmh::compare(*query_sketch, *target_sketch, extend_data->minhash_kmer_size);
+    }
+    //std::cerr << "mash_dist is " << mash_dist << std::endl;
+    return !(mash_dist > extend_data->max_mash_dist_to_evaluate);
+}
 
-        extend_data->wf_aligner->setMaxAlignmentSteps(max_score);
-        const int status = extend_data->wf_aligner->alignEnd2End(
+void do_wfa_segment_pair_alignment(
+        const char* query,
+        const int64_t& j,
+        const char* target,
+        const int64_t& i,
+        const uint16_t& segment_length_q,
+        const uint16_t& segment_length_t,
+        wflign_extend_data_t* extend_data,
+        alignment_t& aln) {
+    aln.j = j;
+    aln.i = i;
+
+    // with fewer mismatches than an insertion and a deletion would cost, the alignment
+    // of WFA can only be the gapless one
+    if (segment_length_q == segment_length_t
+        && gapless_alignment(query + j, target + i, segment_length_q,
+                             extend_data->max_gapless_mismatches, aln.edit_cigar)) {
+        aln.ok = true;
+        aln.query_length = segment_length_q;
+        aln.target_length = segment_length_t;
+        return;
+    }
+
+    const int max_score = (int)((float)std::max(segment_length_q, segment_length_t) * extend_data->inception_score_max_ratio);
+
+    wflign_stats_t* const stats = extend_data->wflign->stats;
+    wfa::WFAlignerGapAffine* wf_aligner = extend_data->wf_aligner;
+    wf_aligner->setMaxAlignmentSteps(max_score);
+    if (stats) wflign_stats_t::collect(*wf_aligner);
+    int status = wf_aligner->alignEnd2End(
+            target + i,segment_length_t,
+            query + j,segment_length_q);
+    if (stats) stats->take(*wf_aligner, false);
+    // over the memory ceiling, in linear memory
+    if (status == WF_STATUS_OOM && extend_data->wf_aligner_low_memory != nullptr) {
+        wf_aligner = extend_data->wf_aligner_low_memory;
+        wf_aligner->setMaxAlignmentSteps(max_score);
+        if (stats) wflign_stats_t::collect(*wf_aligner);
+        status = wf_aligner->alignEnd2End(
                 target + i,segment_length_t,
                 query + j,segment_length_q);
+        if (stats) stats->take(*wf_aligner, false);
+    }
 
-        aln.j = j;
-        aln.i = i;
+    aln.j = j;
+    aln.i = i;
 
-        aln.ok = (status == WF_STATUS_ALG_COMPLETED);
+    aln.ok = (status == WF_STATUS_ALG_COMPLETED);
 
-        // fill the alignment info if we aligned
-        if (aln.ok) {
-            aln.query_length = segment_length_q;
-            aln.target_length = segment_length_t;
+    // fill the alignment info if we aligned
+    if (aln.ok) {
+        aln.query_length = segment_length_q;
+        aln.target_length = segment_length_t;
 
-            /*
+        /*
 #ifdef VALIDATE_WFA_WFLIGN
-            if (!validate_cigar(wf_aligner->cigar, query, target,
-                        segment_length_q, segment_length_t, aln.j, aln.i)) {
-                std::cerr << "cigar failure at alignment " << aln.j << " "
-                          << aln.i << std::endl;
-                unpack_display_cigar(wf_aligner->cigar, query,
-                                     target, segment_length_q, segment_length_t,
-                                     aln.j, aln.i);
-                std::cerr << ">query" << std::endl
-                          << std::string(query + j, segment_length_q)
-                          << std::endl;
-                std::cerr << ">target" << std::endl
-                          << std::string(target + i, segment_length_t)
-                          << std::endl;
-                assert(false);
-            }
+        if (!validate_cigar(wf_aligner->cigar, query, target,
+                    segment_length_q, segment_length_t, aln.j, aln.i)) {
+            std::cerr << "cigar failure at alignment " << aln.j << " "
+                      << aln.i << std::endl;
+            unpack_display_cigar(wf_aligner->cigar, query,
+                                 target, segment_length_q, segment_length_t,
+                                 aln.j, aln.i);
+            std::cerr << ">query" << std::endl
+                      << std::string(query + j, segment_length_q)
+                      << std::endl;
+            std::cerr << ">target" << std::endl
+                      << std::string(target + i, segment_length_t)
+                      << std::endl;
+            assert(false);
+        }
 #endif
-             */
+         */
 
-            wflign_edit_cigar_copy(*extend_data->wf_aligner,&aln.edit_cigar);
+        wflign_edit_cigar_copy(*wf_aligner,&aln.edit_cigar);
 
 #ifdef VALIDATE_WFA_WFLIGN
-            if (!validate_cigar(aln.edit_cigar, query, target, segment_length_q,
-                        segment_length_t, aln.j, aln.i)) {
-                std::cerr << "cigar failure after cigar copy in alignment "
-                          << aln.j << " " << aln.i << std::endl;
-                assert(false);
-            }
-#endif
+        if (!validate_cigar(aln.edit_cigar, query, target, segment_length_q,
+                    segment_length_t, aln.j, aln.i)) {
+            std::cerr << "cigar failure after cigar copy in alignment "
+                      << aln.j << " " << aln.i << std::endl;
+            assert(false);
         }
-
-        return true;
+#endif
     }
 }
 
@@ -164,13 +471,21 @@ void do_wfa_patch_alignment(
               << std::endl;
     */
 
+    hot_counters::add(hot_counters::patch_size_class(std::max(query_length, target_length)));
     wf_aligner.setMaxAlignmentSteps(max_score);
 
     //int fwd_score = std::numeric_limits<int>::max();
     //int rev_score = std::numeric_limits<int>::max();
     
-    const int status = wf_aligner.alignEnd2End(target + i, target_length, query + j, query_length);
-    aln.ok = (status == WF_STATUS_ALG_COMPLETED);
+    // a patch no alignment of which scores within max_score is left to the indels the WFA
+    // would have given up to, without running it
+    if (patch_out_of_reach(query + j, query_length, target + i, target_length, convex_penalties, max_score)) {
+        hot_counters::add(hot_counters::patches_bounded_out);
+        aln.ok = false;
+    } else {
+        const int status = wf_aligner.alignEnd2End(target + i, target_length, query + j, query_length);
+        aln.ok = (status == WF_STATUS_ALG_COMPLETED);
+    }
     aln.is_rev = false;
 
     //std::cerr << "score is " << wf_aligner.getAlignmentScore() << std::endl;
@@ -195,17 +510,24 @@ void do_wfa_patch_alignment(
         //std::cerr << "forward score is " << fwd_score << std::endl;
     }
 
-    if (query_length >= min_inversion_length && target_length >= min_inversion_length) {
-        if (aln.ok) {
-            wf_aligner.setMaxAlignmentSteps(std::ceil((double)aln.score * 0.9));
-        }
+    // the reverse complement alignment is only tried when the k-mers of the patch say it could win
+    if (query_length >= min_inversion_length && target_length >= min_inversion_length
+        && likely_inversion(query + j, query_length, target + i, target_length)) {
+        hot_counters::add(hot_counters::inversion_attempts);
+        const int rev_max_score = aln.ok ? (int)std::ceil((double)aln.score * 0.9) : max_score;
+        wf_aligner.setMaxAlignmentSteps(rev_max_score);
         // Try reverse complement alignment
         std::string rev_comp_query = reverse_complement(std::string(query + j, query_length));
-        const int rev_status = wf_aligner.alignEnd2End(target + i, target_length, rev_comp_query.c_str(), query_length);
+        if (patch_out_of_reach(rev_comp_query.c_str(), query_length, target + i, target_length, convex_penalties, rev_max_score)) {
+            hot_counters::add(hot_counters::patches_bounded_out);
+            rev_aln.ok = false;
+        } else {
+            const int rev_status = wf_aligner.alignEnd2End(target + i, target_length, rev_comp_query.c_str(), query_length);
 
-        //auto rev_score = wf_aligner.getAlignmentScore();
-        //rev_aln.ok = (rev_score > fwd_score && rev_status == WF_STATUS_ALG_COMPLETED);
-        rev_aln.ok = (rev_status == WF_STATUS_ALG_COMPLETED);
+            //auto rev_score = wf_aligner.getAlignmentScore();
+            //rev_aln.ok = (rev_score > fwd_score && rev_status == WF_STATUS_ALG_COMPLETED);
+            rev_aln.ok = (rev_status == WF_STATUS_ALG_COMPLETED);
+        }
         rev_aln.is_rev = true;
 
         if (rev_aln.ok) {
@@ -263,76 +585,6 @@ void do_wfa_patch_alignment(
     aln.target_length = target_length;
 }
 
-void erode_alignment(alignment_t& aln, int erode_k) {
-    if (!aln.ok) return;
-
-    std::vector<char> eroded_cigar;
-    int match_count = 0;
-    int non_match_count = 0;
-
-    auto flush_matches = [&]() {
-        if (match_count >= erode_k) {
-            for (int i = 0; i < match_count; ++i) {
-                eroded_cigar.push_back('M');
-            }
-        } else {
-            for (int i = 0; i < match_count; ++i) {
-                if (non_match_count > 0) {
-                    eroded_cigar.push_back('D');
-                    non_match_count--;
-                } else {
-                    eroded_cigar.push_back('I');
-                }
-            }
-        }
-        match_count = 0;
-    };
-
-    for (int i = aln.edit_cigar.begin_offset; i < aln.edit_cigar.end_offset; ++i) {
-        char op = aln.edit_cigar.cigar_ops[i];
-        if (op == 'M' || op == 'X') {
-            if (non_match_count > 0) {
-                flush_matches();
-            }
-            match_count++;
-        } else {
-            flush_matches();
-            if (op == 'I') {
-                eroded_cigar.push_back('I');
-            } else if (op == 'D') {
-                non_match_count++;
-            }
-        }
-    }
-    flush_matches();
-
-    // Update the alignment
-    free(aln.edit_cigar.cigar_ops);
-    aln.edit_cigar.cigar_ops = (char*)malloc(eroded_cigar.size() * sizeof(char));
-    memcpy(aln.edit_cigar.cigar_ops, eroded_cigar.data(), eroded_cigar.size() * sizeof(char));
-    aln.edit_cigar.begin_offset = 0;
-    aln.edit_cigar.end_offset = eroded_cigar.size();
-
-    // Adjust query and target lengths
-    int query_adjust = 0, target_adjust = 0;
-    for (char op : eroded_cigar) {
-        switch (op) {
-            case 'M':
-                query_adjust++;
-                target_adjust++;
-                break;
-            case 'I':
-                query_adjust++;
-                break;
-            case 'D':
-                target_adjust++;
-                break;
-        }
-    }
-    aln.query_length = query_adjust;
-    aln.target_length = target_adjust;
-}
-
 struct AlignmentBounds {
     int64_t query_start_offset;
     int64_t query_end_offset;
@@ -340,92 +592,11 @@ struct AlignmentBounds {
     int64_t target_end_offset;
 };
 
-AlignmentBounds ok_find_alignment_bounds(const alignment_t& aln, const int& erode_k) {
-    AlignmentBounds bounds;
-    bounds.query_start_offset = 0;
-    bounds.query_end_offset = 0;
-    bounds.target_start_offset = 0;
-    bounds.target_end_offset = 0;
-
-    int64_t query_pos = 0;
-    int64_t target_pos = 0;
-    int match_count = 0;
-    int reverse_match_count = 0;
-    bool found_start = false;
-
-    // Forward pass to find start bounds
-    for (int i = aln.edit_cigar.begin_offset; i < aln.edit_cigar.end_offset; ++i) {
-        char op = aln.edit_cigar.cigar_ops[i];
-        switch (op) {
-            case 'M':
-            case '=':
-                ++match_count;
-                if (match_count >= erode_k && !found_start) {
-                    bounds.query_start_offset = query_pos;
-                    bounds.target_start_offset = target_pos;
-                    found_start = true;
-                }
-                ++query_pos;
-                ++target_pos;
-                break;
-            case 'X':
-                match_count = 0;
-                ++query_pos;
-                ++target_pos;
-                break;
-            case 'I':
-                match_count = 0;
-                ++query_pos;
-                break;
-            case 'D':
-                match_count = 0;
-                ++target_pos;
-                break;
-        }
-    }
-
-    // Reverse pass to find end bounds
-    query_pos = aln.query_length - 1;
-    target_pos = aln.target_length - 1;
-    for (int i = aln.edit_cigar.end_offset - 1; i >= aln.edit_cigar.begin_offset; --i) {
-        char op = aln.edit_cigar.cigar_ops[i];
-        switch (op) {
-            case 'M':
-            case '=':
-                ++reverse_match_count;
-                if (reverse_match_count >= erode_k) {
-                    bounds.query_end_offset = query_pos + 1;
-                    bounds.target_end_offset = target_pos + 1;
-                    return bounds;
-                }
-                --query_pos;
-                --target_pos;
-                break;
-            case 'X':
-                reverse_match_count = 0;
-                --query_pos;
-                --target_pos;
-                break;
-            case 'I':
-                reverse_match_count = 0;
-                --query_pos;
-                break;
-            case 'D':
-                reverse_match_count = 0;
-                --target_pos;
-                break;
-        }
-    }
-
-    // If we didn't find end bounds, set them to the end of the alignment
-    if (bounds.query_end_offset == 0) {
-        bounds.query_end_offset = aln.query_length;
-        bounds.target_end_offset = aln.target_length;
-    }
-
-    return bounds;
-}
-
+/*
+ * Bounds of an alignment without its ends up to the erode_k-th match from each
+ * side, found by a forward and a backward pass over the runs of its cigar, each
+ * stopping there
+ */
 AlignmentBounds find_alignment_bounds(const alignment_t& aln, const int& erode_k) {
     AlignmentBounds bounds;
     bounds.query_start_offset = 0;
@@ -433,75 +604,87 @@ AlignmentBounds find_alignment_bounds(const alignment_t& aln, const int& erode_k
     bounds.target_start_offset = 0;
     bounds.target_end_offset = 0;
 
-    int64_t query_pos = 0;
-    int64_t target_pos = 0;
-    int match_count = 0;
+    const char* ops = aln.edit_cigar.cigar_ops;
+    const int begin = aln.edit_cigar.begin_offset;
+    const int end = aln.edit_cigar.end_offset;
     bool found_start = false;
     bool found_end = false;
 
     // Forward pass
-    for (int i = aln.edit_cigar.begin_offset; i < aln.edit_cigar.end_offset; ++i) {
-        char op = aln.edit_cigar.cigar_ops[i];
-        switch (op) {
-            case 'M':
-            case '=':
-                ++match_count;
-                if (match_count >= erode_k && !found_start) {
-                    bounds.query_start_offset = query_pos;
-                    bounds.target_start_offset = target_pos;
-                    found_start = true;
-                }
-                ++query_pos;
-                ++target_pos;
-                break;
-            case 'X':
-                //match_count = 0;
-                ++query_pos;
-                ++target_pos;
-                break;
-            case 'I':
-                //match_count = 0;
-                ++query_pos;
-                break;
-            case 'D':
-                //match_count = 0;
-                ++target_pos;
-                break;
+    {
+        int64_t query_pos = 0;
+        int64_t target_pos = 0;
+        int64_t match_count = 0;
+        for (int i = begin; i < end && !found_start;) {
+            const char op = ops[i];
+            const int run_end = (int)cigar_op_run_end(ops, i, end);
+            const int64_t length = run_end - i;
+            switch (op) {
+                case 'M':
+                case '=':
+                    if (match_count + length >= erode_k) {
+                        // at the erode_k-th match
+                        const int64_t before = std::max((int64_t)0, erode_k - match_count - 1);
+                        bounds.query_start_offset = query_pos + before;
+                        bounds.target_start_offset = target_pos + before;
+                        found_start = true;
+                    }
+                    match_count += length;
+                    query_pos += length;
+                    target_pos += length;
+                    break;
+                case 'X':
+                    query_pos += length;
+                    target_pos += length;
+                    break;
+                case 'I':
+                    query_pos += length;
+                    break;
+                case 'D':
+                    target_pos += length;
+                    break;
+            }
+            i = run_end;
         }
     }
 
-    // Reverse pass
-    query_pos = aln.query_length - 1;
-    target_pos = aln.target_length - 1;
-    match_count = 0;
-
-    for (int i = aln.edit_cigar.end_offset - 1; i >= aln.edit_cigar.begin_offset; --i) {
-        char op = aln.edit_cigar.cigar_ops[i];
-        switch (op) {
-            case 'M':
-            case '=':
-                ++match_count;
-                if (match_count >= erode_k && !found_end) {
-                    bounds.query_end_offset = query_pos + 1;
-                    bounds.target_end_offset = target_pos + 1;
-                    found_end = true;
-                }
-                --query_pos;
-                --target_pos;
-                break;
-            case 'X':
-                //match_count = 0;
-                --query_pos;
-                --target_pos;
-                break;
-            case 'I':
-                //match_count = 0;
-                --query_pos;
-                break;
-            case 'D':
-                //match_count = 0;
-                --target_pos;
-                break;
+    // Reverse pass, from the last column of the alignment
+    {
+        int64_t query_pos = aln.query_length - 1;
+        int64_t target_pos = aln.target_length - 1;
+        int64_t match_count = 0;
+        for (int i = end; i > begin && !found_end;) {
+            const char op = ops[i - 1];
+            int run_begin = i - 1;
+            while (run_begin > begin && ops[run_begin - 1] == op) {
+                --run_begin;
+            }
+            const int64_t length = i - run_begin;
+            switch (op) {
+                case 'M':
+                case '=':
+                    if (match_count + length >= erode_k) {
+                        const int64_t after = std::max((int64_t)0, erode_k - match_count - 1);
+                        bounds.query_end_offset = query_pos - after + 1;
+                        bounds.target_end_offset = target_pos - after + 1;
+                        found_end = true;
+                    }
+                    match_count += length;
+                    query_pos -= length;
+                    target_pos -= length;
+                    break;
+                case 'X':
+                    query_pos -= length;
+                    target_pos -= length;
+                    break;
+                case 'I':
+                    query_pos -= length;
+                    break;
+                case 'D':
+                    target_pos -= length;
+                    break;
+            }
+            i = run_begin;
         }
     }
 
@@ -615,9 +798,9 @@ std::vector<alignment_t> do_progressive_wfa_patch_alignment(
         //std::cerr << "WFA rev alignment: " << rev_aln << std::endl;
 
         if (rev_aln.ok && (!aln.ok || rev_aln.score < aln.score)) {
-            alignments.push_back(rev_aln);
+            alignments.push_back(std::move(rev_aln));
         } else if (aln.ok) {
-            alignments.push_back(aln);
+            alignments.push_back(std::move(aln));
             if (alignments.size() == 1) {
                 break;
             }
@@ -721,7 +904,7 @@ std::vector<alignment_t> do_progressive_wfa_patch_alignment(
     return alignments;
 }
 
-void erode_head(std::vector<char>& unpatched, uint64_t& query_pos, uint64_t& target_pos, int erode_k) {
+void erode_head(wflign_rle_cigar_t& unpatched, uint64_t& query_pos, uint64_t& target_pos, int erode_k) {
     int match_count = 0;
     auto it = unpatched.begin();
     uint64_t query_erased = 0, target_erased = 0;
@@ -752,16 +935,17 @@ void erode_head(std::vector<char>& unpatched, uint64_t& query_pos, uint64_t& tar
 
     //std::cerr << "erode_head: eroded " << query_erased << " query and " << target_erased << " target" << std::endl;
     // Erase the eroded part
-    unpatched.erase(unpatched.begin(), it);
+    unpatched.erase_front(it);
 }
 
-void erode_tail(std::vector<char>& unpatched, uint64_t& query_end, uint64_t& target_end, int erode_k) {
+void erode_tail(wflign_rle_cigar_t& unpatched, uint64_t& query_end, uint64_t& target_end, int erode_k) {
     int match_count = 0;
-    auto it = unpatched.rbegin();
     uint64_t q_offset = 0, t_offset = 0;
 
-    while (it != unpatched.rend()) {
-        if (*it == 'M' || *it == 'X') {
+    // Erase the eroded part as it is walked
+    while (!unpatched.empty()) {
+        const char c = unpatched.back();
+        if (c == 'M' || c == 'X') {
             match_count++;
             if (match_count >= erode_k) {
                 break;
@@ -770,27 +954,364 @@ void erode_tail(std::vector<char>& unpatched, uint64_t& query_end, uint64_t& tar
             t_offset++;
         } else {
             //match_count = 0;
-            if (*it == 'I') q_offset++;
-            if (*it == 'D') t_offset++;
+            if (c == 'I') q_offset++;
+            if (c == 'D') t_offset++;
         }
-        it++;
+        unpatched.pop_back();
     }
 
-    // Erase the eroded part
     //std::cerr << "erode_tail: eroded " << q_offset << " query and " << t_offset << " target" << std::endl;
-    unpatched.erase(it.base(), unpatched.end());
     query_end -= q_offset;
     target_end -= t_offset;
 }
 
+/*
+ * Upper bound of the gap-compressed identity of the alignment patched from an eroded
+ * cigar over query_length bases. Patching only rewrites the matches and mismatches up to
+ * nibble_length of them around a run of indels, and up to long_indel_reach of them after
+ * a run of more than long_indel_length insertions or deletions: the mismatches further
+ * from the indels, and from the ends, are kept, and the query bases they take cannot be
+ * matches
+ */
+double eroded_identity_bound(
+        const wflign_rle_cigar_t& eroded,
+        const uint64_t query_length,
+        const uint64_t nibble_length,
+        const uint64_t long_indel_length,
+        const uint64_t long_indel_reach) {
+    const std::vector<wflign_rle_cigar_t::run_t>& runs = eroded.runs();
+    uint64_t kept_mismatches = 0;
+    // matches and mismatches since the last long run of indels, none at the start
+    uint64_t since_long_indel = long_indel_reach;
+    for (size_t r = 0; r < runs.size();) {
+        if (wflign_rle_cigar_t::op(runs[r]) != 'M' && wflign_rle_cigar_t::op(runs[r]) != 'X') {
+            uint64_t insertions = 0;
+            uint64_t deletions = 0;
+            for (; r < runs.size() && wflign_rle_cigar_t::op(runs[r]) != 'M'
+                                   && wflign_rle_cigar_t::op(runs[r]) != 'X'; ++r) {
+                (wflign_rle_cigar_t::op(runs[r]) == 'I' ? insertions : deletions) += wflign_rle_cigar_t::length(runs[r]);
+            }
+            if (insertions > long_indel_length || deletions > long_indel_length) {
+                since_long_indel = 0;
+            }
+            continue;
+        }
+        size_t end = r;
+        uint64_t stretch_length = 0;
+        for (; end < runs.size() && (wflign_rle_cigar_t::op(runs[end]) == 'M'
+                                     || wflign_rle_cigar_t::op(runs[end]) == 'X'); ++end) {
+            stretch_length += wflign_rle_cigar_t::length(runs[end]);
+        }
+        const uint64_t kept_begin = std::max(nibble_length,
+                                             long_indel_reach > since_long_indel ? long_indel_reach - since_long_indel : 0);
+        const uint64_t kept_end = stretch_length > nibble_length ? stretch_length - nibble_length : 0;
+        uint64_t pos = 0;
+        for (; r < end; ++r) {
+            const uint64_t length = wflign_rle_cigar_t::length(runs[r]);
+            if (wflign_rle_cigar_t::op(runs[r]) == 'X') {
+                const uint64_t begin = std::max(pos, kept_begin);
+                const uint64_t until = std::min(pos + length, kept_end);
+                kept_mismatches += until > begin ? until - begin : 0;
+            }
+            pos += length;
+        }
+        since_long_indel = std::min(since_long_indel + stretch_length, long_indel_reach);
+    }
+    return kept_mismatches >= query_length ? 0.0 : (double)(query_length - kept_mismatches) / (double)query_length;
+}
+
+/*
+ * A patch of a merged alignment: query[query_begin, +query_length) against
+ * target[target_begin, +target_length), aligned progressively in the middle of
+ * the alignment and once at its head and tail
+ */
+struct patch_region_t {
+    bool progressive;
+    uint64_t query_begin;
+    uint64_t query_length;
+    const char* target;
+    uint64_t target_begin;
+    uint64_t target_length;
+
+    bool operator<(const patch_region_t& other) const {
+        return std::tie(query_begin, target_begin, target, query_length, target_length, progressive)
+            < std::tie(other.query_begin, other.target_begin, other.target, other.query_length, other.target_length, other.progressive);
+    }
+};
+
+std::vector<alignment_t> solve_patch(
+        const patch_region_t& region,
+        const char* query,
+        wfa::WFAlignerGapAffine2Pieces& wf_aligner,
+        const wflign_penalties_t& convex_penalties,
+        const int64_t& chain_gap,
+        const int& max_patching_score,
+        const uint64_t& min_inversion_length,
+        const int& erode_k) {
+    if (region.progressive) {
+        return do_progressive_wfa_patch_alignment(
+                query, region.query_begin, region.query_length,
+                region.target, region.target_begin, region.target_length,
+                wf_aligner, convex_penalties, chain_gap, max_patching_score,
+                min_inversion_length, erode_k);
+    }
+    std::vector<alignment_t> alignments(1);
+    alignment_t rev_aln;
+    do_wfa_patch_alignment(
+            query, region.query_begin, region.query_length,
+            region.target, region.target_begin, region.target_length,
+            wf_aligner, convex_penalties, alignments.front(), rev_aln,
+            chain_gap, max_patching_score, min_inversion_length);
+    return alignments;
+}
+
+/*
+ * What patching is planned with: the patch aligned end to end, its excess of
+ * query or target first, as the following patches nibble back into it
+ */
+std::vector<alignment_t> planned_patch(const patch_region_t& region) {
+    std::vector<alignment_t> alignments(1);
+    alignment_t& aln = alignments.front();
+    aln.ok = true;
+    aln.j = region.query_begin;
+    aln.i = region.target_begin;
+    aln.query_length = region.query_length;
+    aln.target_length = region.target_length;
+    const uint64_t aligned = std::min(region.query_length, region.target_length);
+    const uint64_t length = std::max(region.query_length, region.target_length);
+    wflign_cigar_allocate(&aln.edit_cigar, length);
+    aln.edit_cigar.begin_offset = 0;
+    aln.edit_cigar.end_offset = length;
+    std::memset(aln.edit_cigar.cigar_ops, region.query_length > aligned ? 'I' : 'D', length - aligned);
+    std::memset(aln.edit_cigar.cigar_ops + length - aligned, 'M', aligned);
+    return alignments;
+}
+
+/*
+ * The PAF or SAM record of the trace of a merged alignment, tracev starting at
+ * query_start and target_start and ending at query_end and target_end
+ */
+static void write_merged_record(
+        std::ostream &out,
+        const wflign_rle_cigar_t& tracev,
+        const wflign_penalties_t& convex_penalties,
+        const bool& emit_md_tag,
+        const bool& paf_format_else_sam,
+        const bool& no_seq_in_sam,
+        const bool& score_only,
+        const char* query,
+        const std::string& query_name,
+        const uint64_t& query_total_length,
+        const uint64_t& query_offset,
+        const uint64_t& query_length,
+        const bool& query_is_rev,
+        const char* target,
+        const std::string& target_name,
+        const uint64_t& target_total_length,
+        const uint64_t& target_offset,
+        const uint64_t& target_length,
+        const int64_t& target_pointer_shift,
+        const uint64_t& query_start,
+        const uint64_t& query_end,
+        const uint64_t& target_start,
+        const uint64_t& target_end,
+        const float& min_identity,
+        const float& mashmap_estimated_identity,
+        const bool& emit_timings,
+        const long& elapsed_time_wflambda_ms,
+        const std::chrono::steady_clock::time_point& start_time,
+        const uint64_t& num_alignments,
+        const uint64_t& num_alignments_performed,
+        const uint64_t& num_patches) {
+    uint64_t matches = 0;
+    uint64_t mismatches = 0;
+    uint64_t insertions = 0;
+    uint64_t inserted_bp = 0;
+    uint64_t deletions = 0;
+    uint64_t deleted_bp = 0;
+    uint64_t total_query_aligned_length = 0;
+    uint64_t total_target_aligned_length = 0;
+
+
+    // convert trace to cigar, get correct start and end coordinates, only counting its ops if scoring it
+    char *cigarv = nullptr;
+    if (score_only && paf_format_else_sam) {
+        alignment_stats(
+                tracev, total_target_aligned_length, total_query_aligned_length, matches,
+                mismatches, insertions, inserted_bp, deletions, deleted_bp);
+    } else {
+        cigarv = alignment_to_cigar(
+                tracev, total_target_aligned_length, total_query_aligned_length, matches,
+                mismatches, insertions, inserted_bp, deletions, deleted_bp);
+    }
+
+    const double gap_compressed_identity =
+            (double)matches /
+            (double)(matches + mismatches + insertions + deletions);
+
+    WFMASH_PROBE(alignment, query_name.c_str(), query_length, target_length,
+                 (uint64_t)(gap_compressed_identity * 1e6), num_patches);
+
+    if (gap_compressed_identity >= min_identity) {
+        const uint64_t edit_distance = mismatches + inserted_bp + deleted_bp;
+
+        // identity over the full block
+        const double block_identity =
+                (double)matches / (double)(matches + edit_distance);
+
+        // the MD tag, straight from the trace
+        auto write_md_tag = [&](std::ostream &out) {
+            std::string md;
+            append_md_tag(md, tracev, target + target_start - target_pointer_shift);
+            out << md;
+        };
+
+        std::string timings_and_num_alignements;
+        if (emit_timings) {
+            const long elapsed_time_patching_ms =
+                    std::chrono::duration_cast<std::chrono::milliseconds>(
+                            std::chrono::steady_clock::now() - start_time)
+                            .count();
+            timings_and_num_alignements =
+                    "wt:i:" + std::to_string(elapsed_time_wflambda_ms) +
+                    "\tpt:i:" + std::to_string(elapsed_time_patching_ms) +
+                    "\taa:i:" + std::to_string(num_alignments) +
+                    "\tap:i:" + std::to_string(num_alignments_performed);
+        }
+
+        if (paf_format_else_sam) {
+            out << query_name << "\t" << query_total_length << "\t"
+                << query_offset +
+                   (query_is_rev ? query_length - query_end : query_start)
+                << "\t"
+                << query_offset +
+                   (query_is_rev ? query_length - query_start : query_end)
+                << "\t" << (query_is_rev ? "-" : "+") << "\t" << target_name
+                << "\t" << target_total_length << "\t"
+                << target_offset - target_pointer_shift + target_start << "\t"
+                << target_offset + target_end << "\t" << matches << "\t"
+                << matches + mismatches + inserted_bp + deleted_bp
+                << "\t"
+                << std::round(float2phred(1.0 - block_identity));
+            if (score_only) {
+                out << "\t" << "as:i:" << calculate_alignment_score(tracev, convex_penalties);
+            }
+            out << "\t"
+                << "gi:f:" << gap_compressed_identity << "\t"
+                << "bi:f:"
+                << block_identity
+                //<< "\t" << "md:f:" << mash_dist_sum / trace.size()
+                //<< "\t" << "ma:i:" << matches
+                //<< "\t" << "mm:i:" << mismatches
+                //<< "\t" << "ni:i:" << insertions
+                //<< "\t" << "ii:i:" << inserted_bp
+                //<< "\t" << "nd:i:" << deletions
+                //<< "\t" << "dd:i:" << deleted_bp
+                << "\t"
+                << "md:f:" << mashmap_estimated_identity;
+
+            if (emit_md_tag) {
+                out << "\t";
+
+                write_md_tag(out);
+            }
+
+            if (emit_timings) {
+                out << "\t" << timings_and_num_alignements;
+            }
+            if (!score_only) {
+                out << "\t" << "cg:Z:" << cigarv;
+            }
+            out << "\n";
+        } else {
+            out << query_name                          // Query template NAME
+                << "\t" << (query_is_rev ? "16" : "0") // bitwise FLAG
+                << "\t" << target_name // Reference sequence NAME
+                << "\t"
+                << target_offset - target_pointer_shift + target_start +
+                   1 // 1-based leftmost mapping POSition
+                << "\t"
+                << std::round(
+                        float2phred(1.0 - block_identity)) // MAPping Quality
+                << "\t";
+
+            // CIGAR
+            const uint64_t query_start_pos =
+                    query_offset +
+                    (query_is_rev ? query_length - query_end : query_start);
+            const uint64_t query_end_pos =
+                    query_offset +
+                    (query_is_rev ? query_length - query_start : query_end);
+
+            if (query_start_pos > 0) {
+                out << query_start_pos << "H";
+            }
+            out << cigarv;
+            if (query_total_length > query_end_pos) {
+                out << (query_total_length - query_end_pos) << "H";
+            }
+
+            out << "\t"
+                << "*" // Reference name of the mate/next read
+                << "\t"
+                << "0" // Position of the mate/next read
+                << "\t"
+                << "0" // observed Template LENgth
+                << "\t";
+
+            // segment SEQuence
+            if (no_seq_in_sam) {
+                out << "*";
+            } else {
+                for (uint64_t p = query_start; p < query_end; ++p) {
+                    out << query[p];
+                }
+            }
+
+            out << "\t"
+                << "*" // ASCII of Phred-scaled base QUALity+33
+                << "\t"
+                << "NM:i:"
+                << edit_distance
+                //<< "\t" << "AS:i:" << total_score
+                << "\t"
+                << "gi:f:" << gap_compressed_identity << "\t"
+                << "bi:f:"
+                << block_identity
+                //<< "\t" << "md:f:" << mash_dist_sum / trace.size()
+                //<< "\t" << "ma:i:" << matches
+                //<< "\t" << "mm:i:" << mismatches
+                //<< "\t" << "ni:i:" << insertions
+                //<< "\t" << "ii:i:" << inserted_bp
+                //<< "\t" << "nd:i:" << deletions
+                //<< "\t" << "dd:i:" << deleted_bp
+                << "";
+
+            if (emit_md_tag) {
+                out << "\t";
+
+                write_md_tag(out);
+            }
+            if (emit_timings) {
+                out << "\t" << timings_and_num_alignements;
+            }
+            out << "\n";
+        }
+    }
+
+    // always clean up
+    free(cigarv);
+}
+
 void write_merged_alignment(
         std::ostream &out,
         const std::vector<alignment_t *> &trace,
-        wfa::WFAlignerGapAffine2Pieces& wf_aligner,
+        const wflign_patch_tasks_t& patch_tasks,
         const wflign_penalties_t& convex_penalties,
         const bool& emit_md_tag,
         const bool& paf_format_else_sam,
         const bool& no_seq_in_sam,
+        const bool& score_only,
         const char* query,
         const std::string& query_name,
         const uint64_t& query_total_length,
@@ -803,11 +1324,10 @@ void write_merged_alignment(
         const uint64_t& _target_offset,
         const uint64_t& _target_length,
         const float& min_identity,
-#ifdef WFA_PNG_TSV_TIMING
         const long& elapsed_time_wflambda_ms,
         const uint64_t& num_alignments,
         const uint64_t& num_alignments_performed,
-#endif
+        const bool& emit_timings,
         const float& mashmap_estimated_identity,
         const uint64_t& wflign_max_len_major,
         const uint64_t& wflign_max_len_minor,
@@ -817,12 +1337,11 @@ void write_merged_alignment(
         const uint64_t& min_inversion_length,
         const int& min_wf_length,
         const int& max_dist_threshold,
-#ifdef WFA_PNG_TSV_TIMING
+        const wflign_target_fetch_t* fetch_target,
         const std::string* prefix_wavefront_plot_in_png,
         const uint64_t& wfplot_max_size,
         const bool& emit_patching_tsv,
         std::ostream* out_patching_tsv,
-#endif
         const bool& with_endline) {
 
     int64_t target_pointer_shift = 0;
@@ -830,19 +1349,8 @@ void write_merged_alignment(
     // we need to get the start position in the query and target
     // then run through the whole alignment building up the cigar
     // finally emitting it
-    // our final cigar
-    //
-    // std::string cigarstr;
-    uint64_t matches = 0;
-    uint64_t mismatches = 0;
-    uint64_t insertions = 0;
-    uint64_t inserted_bp = 0;
-    uint64_t deletions = 0;
-    uint64_t deleted_bp = 0;
     uint64_t query_start = 0;
     uint64_t target_start = 0;
-    uint64_t total_query_aligned_length = 0;
-    uint64_t total_target_aligned_length = 0;
     uint64_t query_end = 0;
     uint64_t target_end = 0;
     //uint64_t total_score = 0;
@@ -853,8 +1361,10 @@ void write_merged_alignment(
 
     // double mash_dist_sum = 0;
     uint64_t ok_alns = 0;
+    uint64_t num_patches = 0;
 
     auto start_time = std::chrono::steady_clock::now();
+    ::trace::Span patch_span("patch");
 
     //std::cerr << "target_offset: " << target_offset << " query_offset: " << query_offset << std::endl;
     //std::cerr << "target_length: " << target_length << " query_length: " << query_length << std::endl;
@@ -865,7 +1375,7 @@ void write_merged_alignment(
       << std::endl;
 #endif
     // write trace into single cigar vector
-    std::vector<char> tracev;
+    wflign_rle_cigar_t tracev;
     std::vector<alignment_t> multi_patch_alns;
     {
         // patch: walk the cigar, patching directly when we have simultaneous
@@ -873,9 +1383,13 @@ void write_merged_alignment(
         // go
 
 #define MAX_NUM_INDELS_TO_LOOK_AT 2
+#define MIN_WFA_HEAD_TAIL_PATCH_LENGTH 4096
+#define MIN_WFA_PATCH_LENGTH 8
+#define MAX_DIST_TO_LOOK_AT 512
+#define MIN_CLOSE_INDELS_LENGTH 10
         auto distance_close_big_enough_indels =	
                 [](const uint32_t indel_len, auto iterator,	
-                   const std::vector<char> &trace,
+                   const wflign_rle_cigar_t &trace,
                    const uint16_t&max_dist_to_look_at) {	
                     const uint32_t min_indel_len_to_find = indel_len / 3;	
 
@@ -936,36 +1450,31 @@ void write_merged_alignment(
                          &wflign_max_len_major,
                          &wflign_max_len_minor,
                          &distance_close_big_enough_indels, &min_wf_length,
-                         &max_dist_threshold, &wf_aligner,
+                         &max_dist_threshold,
                          &multi_patch_alns,
                          &convex_penalties,
-                         &chain_gap, &max_patching_score, &min_inversion_length, &erode_k
-#ifdef WFA_PNG_TSV_TIMING
+                         &chain_gap, &max_patching_score, &min_inversion_length, &erode_k,
+                         &fetch_target
                          ,&emit_patching_tsv,
                          &out_patching_tsv
-#endif
-            ](std::vector<char> &unpatched,
-              std::vector<char> &patched,
+            ](wflign_rle_cigar_t &unpatched,
+              wflign_rle_cigar_t &patched,
               const uint16_t &min_wfa_head_tail_patch_length,
               const uint16_t &min_wfa_patch_length,
               const uint16_t &max_dist_to_look_at,
-              bool save_multi_patch_alns) {
-
-            auto q = unpatched.begin();
+              bool save_multi_patch_alns,
+              const std::function<std::vector<alignment_t>(const patch_region_t&)>& patch,
+              const bool planning) {
 
             uint64_t query_delta = 0;
             uint64_t target_delta = 0;
 
             bool got_alignment = false;
 
-            // trim back small matches at the start
-            erode_head(unpatched, query_start, target_start, 7);
-
             uint64_t query_pos = query_start;
             uint64_t target_pos = target_start;
 
-            // Trim spurious matches off the tail of the alignment
-            erode_tail(unpatched, query_end, target_end, 7);
+            auto q = unpatched.begin();
 
             // Head patching
             if (query_start > 0 || target_start > 0) {
@@ -978,6 +1487,9 @@ void write_merged_alignment(
     
                 // Take the minimum of what we need and what's safe
                 int64_t actual_shift = std::min(needed_shift, max_safe_shift);
+                if (actual_shift > 0 && fetch_target != nullptr) {
+                    (*fetch_target)(target_offset - actual_shift, target_offset);
+                }
 
                 // Adjust the target pointer, offset, and length
                 target -= actual_shift;
@@ -987,39 +1499,17 @@ void write_merged_alignment(
                 target_pos += actual_shift;
                 target_start += actual_shift;
 
-                alignment_t head_aln;
-                alignment_t head_rev_aln;
-                do_wfa_patch_alignment(
-                    query,
-                    0,
-                    query_start,
-                    target,
-                    0,  // Start from the beginning of the adjusted target
-                    target_start,
-                    wf_aligner,
-                    convex_penalties,
-                    head_aln,
-                    head_rev_aln,
-                    chain_gap,
-                    max_patching_score,
-                    min_inversion_length);
+                // from the beginning of the adjusted target
+                alignment_t head_aln = std::move(patch({false, 0, query_start, target, 0, target_start}).front());
                 
                 if (head_aln.ok) {
                     //std::cerr << "head_aln: " << head_aln.score << std::endl;
                     // Prepend the head alignment to the main alignment
-                    for (int i = head_aln.edit_cigar.begin_offset; i < head_aln.edit_cigar.end_offset; ++i) {
-                        //std::cerr << head_aln.edit_cigar.cigar_ops[i];
-                        patched.push_back(head_aln.edit_cigar.cigar_ops[i]);
-                    }
-                    //std::cerr << std::endl;
+                    patched.append(head_aln.edit_cigar);
                 } else {
                     // push back I and D to fill the gap
-                    for (uint64_t i = 0; i < query_start; ++i) {
-                        patched.push_back('I');
-                    }
-                    for (uint64_t i = 0; i < target_start; ++i) {
-                        patched.push_back('D');
-                    }
+                    patched.push_back('I', query_start);
+                    patched.push_back('D', target_start);
                 }
                 query_start = 0;
                 target_start = 0;
@@ -1101,7 +1591,7 @@ void write_merged_alignment(
                                   target_delta < wflign_max_len_minor))) {
 
                         int32_t distance_close_indels = 
-                            (query_delta > 10 || target_delta > 10) ?	
+                            (query_delta > MIN_CLOSE_INDELS_LENGTH || target_delta > MIN_CLOSE_INDELS_LENGTH) ?	
                             distance_close_big_enough_indels(std::max(query_delta, target_delta), q, unpatched, max_dist_to_look_at) :	
                             -1;
 
@@ -1280,40 +1770,21 @@ void write_merged_alignment(
                             size_region_to_repatch = 0;
                             {
                                 // WFA is only global
-                                auto patch_alignments = do_progressive_wfa_patch_alignment(
-                                        query,
-                                        query_pos,
-                                        query_delta,
-                                        target - target_pointer_shift,
-                                        target_pos,
-                                        target_delta,
-                                        wf_aligner,
-                                        convex_penalties,
-                                        chain_gap,
-                                        max_patching_score,
-                                        min_inversion_length,
-                                        erode_k);
+                                auto patch_alignments = patch({true, query_pos, query_delta,
+                                                               target - target_pointer_shift, target_pos, target_delta});
                                 if (patch_alignments.size() == 1
                                     && patch_alignments.front().ok
                                     && !patch_alignments.front().is_rev) {
                                     got_alignment = true;
-                                    auto& patch_aln = patch_alignments.front();
-                                    const int start_idx =
-                                        patch_aln.edit_cigar.begin_offset;
-                                    const int end_idx =
-                                        patch_aln.edit_cigar.end_offset;
-                                    for (int i = start_idx; i < end_idx; i++) {
-                                        patched.push_back(patch_aln.edit_cigar.cigar_ops[i]);
-                                    }
+                                    patched.append(patch_alignments.front().edit_cigar);
                                 } else if (save_multi_patch_alns) {
                                     for (auto& aln : patch_alignments) {
                                         trim_alignment(aln);
-                                        multi_patch_alns.push_back(aln);
+                                        multi_patch_alns.push_back(std::move(aln));
                                     }
                                 }
 
-#ifdef WFA_PNG_TSV_TIMING
-                                if (emit_patching_tsv) {
+                                if (emit_patching_tsv && !planning) {
                                     for (auto& aln : patch_alignments) {
                                         *out_patching_tsv
                                             << query_name << "\t" << query_pos << "\t" << query_pos + query_delta << "\t"
@@ -1321,19 +1792,14 @@ void write_merged_alignment(
                                             << aln.ok << std::endl;
                                     }
                                 }
-#endif
                             }
                         }
                     }
 
                     // add in stuff if we didn't align
                     if (!got_alignment) {
-                        for (uint64_t i = 0; i < query_delta; ++i) {
-                            patched.push_back('I');
-                        }
-                        for (uint64_t i = 0; i < target_delta; ++i) {
-                            patched.push_back('D');
-                        }
+                        patched.push_back('I', query_delta);
+                        patched.push_back('D', target_delta);
                     }
 
                     // std::cerr << "query_delta " << query_delta << std::endl;
@@ -1370,31 +1836,19 @@ void write_merged_alignment(
 
                 // Take the minimum of what we need and what's safe
                 int64_t actual_extension = std::min(needed_extension, max_safe_extension);
+                if (actual_extension > 0 && fetch_target != nullptr) {
+                    (*fetch_target)(target_offset + target_length, target_offset + target_length + actual_extension);
+                }
 
-                alignment_t tail_aln;
-                alignment_t tail_rev_aln;
-                do_wfa_patch_alignment(
-                    query,
-                    query_pos,
-                    query_length - query_pos,
-                    target,
-                    target_pos,
-                    (target_length - target_pos) + actual_extension,
-                    wf_aligner,
-                    convex_penalties,
-                    tail_aln,
-                    tail_rev_aln,
-                    chain_gap,
-                    max_patching_score,
-                    min_inversion_length);
+                alignment_t tail_aln = std::move(patch({false, query_pos, query_length - query_pos,
+                                                         target, target_pos, (target_length - target_pos) + actual_extension}).front());
 
                 if (tail_aln.ok) {
                     // Append the tail alignment to the main alignment
-                    for (int i = tail_aln.edit_cigar.begin_offset; i < tail_aln.edit_cigar.end_offset; ++i) {
-                        patched.push_back(tail_aln.edit_cigar.cigar_ops[i]);
-                    }
+                    patched.append(tail_aln.edit_cigar);
                     query_pos = query_length;
                     target_pos = target_length;
+                    query_end = query_length;
 
                     // Adjust target_length if we used additional sequence
                     target_end += tail_aln.target_length;
@@ -1412,16 +1866,46 @@ void write_merged_alignment(
         };
 
         {
-            std::vector<char> erodev;
+            wflign_rle_cigar_t erodev;
             {
-                std::vector<char> rawv;
-
-                // copy
+                // copy and erode at once, by removing matches < k as they come, as
+                // many deletions and insertions, which sort_indels puts in order:
+                // the runs of matches of an island are held until it reaches k
 #ifdef WFLIGN_DEBUG
                 std::cerr
-                    << "[wflign::wflign_affine_wavefront] copying traceback"
-                    << std::endl;
+                    << "[wflign::wflign_affine_wavefront] copying and eroding "
+                       "traceback at k="
+                    << erode_k << std::endl;
 #endif
+                std::vector<wflign_rle_cigar_t::run_t> island;
+                uint64_t island_length = 0;
+                auto end_island = [&]() {
+                    if (island_length > 0 && island_length < erode_k) {
+                        erodev.push_back('D', island_length);
+                        erodev.push_back('I', island_length);
+                    }
+                    island.clear();
+                    island_length = 0;
+                };
+                auto erode = [&](const char op, const uint64_t length) {
+                    if (op != 'M' && op != 'X') {
+                        end_island();
+                        erodev.push_back(op, length);
+                    } else if (island_length >= erode_k) {
+                        erodev.push_back(op, length);
+                        island_length += length;
+                    } else {
+                        island.push_back(wflign_rle_cigar_t::make_run(op, length));
+                        island_length += length;
+                        if (island_length >= erode_k) {
+                            for (const auto run : island) {
+                                erodev.push_back(wflign_rle_cigar_t::op(run), wflign_rle_cigar_t::length(run));
+                            }
+                            island.clear();
+                        }
+                    }
+                };
+
                 for (auto x = trace.rbegin(); x != trace.rend(); ++x) {
                     auto &aln = **x;
                     if (aln.ok) {
@@ -1431,98 +1915,43 @@ void write_merged_alignment(
                         }
                         ++ok_alns;
                         if (query_end && aln.j > query_end) {
-                            const int len = aln.j - query_end;
-                            for (uint64_t i = 0; i < len; ++i) {
-                                rawv.push_back('I');
-                            }
+                            erode('I', aln.j - query_end);
                         }
                         if (target_end && aln.i > target_end) {
-                            const int len = aln.i - target_end;
-                            for (uint64_t i = 0; i < len; ++i) {
-                                rawv.push_back('D');
-                            }
+                            erode('D', aln.i - target_end);
                         }
                         uint64_t target_aligned_length = 0;
                         uint64_t query_aligned_length = 0;
-                        const int start_idx = aln.edit_cigar.begin_offset;
-                        const int end_idx = aln.edit_cigar.end_offset;
-                        for (int i = start_idx; i < end_idx; i++) {
-                            const auto &c = aln.edit_cigar.cigar_ops[i];
+                        const char* ops = aln.edit_cigar.cigar_ops;
+                        const uint64_t end_idx = aln.edit_cigar.end_offset;
+                        for (uint64_t i = aln.edit_cigar.begin_offset; i < end_idx;) {
+                            const char c = ops[i];
+                            const uint64_t run_end = cigar_op_run_end(ops, i, end_idx);
+                            const uint64_t length = run_end - i;
                             switch (c) {
                                 case 'M':
                                 case 'X':
-                                    ++query_aligned_length;
-                                    ++target_aligned_length;
+                                    query_aligned_length += length;
+                                    target_aligned_length += length;
                                     break;
                                 case 'I':
-                                    ++query_aligned_length;
+                                    query_aligned_length += length;
                                     break;
                                 case 'D':
-                                    ++target_aligned_length;
+                                    target_aligned_length += length;
                                     break;
                                 default:
                                     break;
                             }
-                            rawv.push_back(c);
+                            erode(c, length);
+                            i = run_end;
                         }
                         query_end = aln.j + query_aligned_length;
                         target_end = aln.i + target_aligned_length;
                     }
-                    // clean up
-                    delete *x;
-                }
-
-#ifdef VALIDATE_WFA_WFLIGN
-                if (!validate_trace(rawv, query, target - target_pointer_shift,
-                            query_length, target_length,
-                            query_start, target_start)) {
-                    std::cerr
-                        << "cigar failure in rawv (at end) "
-                        << "\t" << query_name << "\t" << query_total_length
-                        << "\t"
-                        << query_offset + (query_is_rev
-                                               ? query_length - query_end
-                                               : query_start)
-                        << "\t"
-                        << query_offset + (query_is_rev
-                                               ? query_length - query_start
-                                               : query_end)
-                        << "\t" << (query_is_rev ? "-" : "+") << "\t"
-                        << target_name << "\t" << target_total_length << "\t"
-                        << target_offset - target_pointer_shift + target_start
-                        << "\t" << target_offset + target_end << std::endl;
-                    exit(1);
-                }
-#endif
-
-#ifdef WFLIGN_DEBUG
-                std::cerr << "[wflign::wflign_affine_wavefront] eroding "
-                             "traceback at k="
-                          << erode_k << std::endl;
-#endif
-
-                // erode by removing matches < k
-                for (uint64_t i = 0; i < rawv.size();) {
-                    if (rawv[i] == 'M' || rawv[i] == 'X') {
-                        uint64_t j = i;
-                        while (++j < rawv.size() &&
-                               (rawv[j] == 'M' || rawv[j] == 'X')) {
-                        }
-                        if (j - i < erode_k) {
-                            while (i < j) {
-                                erodev.push_back('D');
-                                erodev.push_back('I');
-                                ++i;
-                            }
-                        } else {
-                            while (i < j) {
-                                erodev.push_back(rawv[i++]);
-                            }
-                        }
-                    } else {
-                        erodev.push_back(rawv[i++]);
-                    }
+                    // the alignments of the trace belong to the caller
                 }
+                end_island();
             }
 
 #ifdef VALIDATE_WFA_WFLIGN
@@ -1556,6 +1985,25 @@ void write_merged_alignment(
             // normalize: sort so that I<D and otherwise leave it as-is
             sort_indels(erodev);
 
+            // trim back small matches at the start, and spurious ones off the tail
+            erode_head(erodev, query_start, target_start, 7);
+            erode_tail(erodev, query_end, target_end, 7);
+
+            // alignments that cannot reach min_identity are neither patched nor written: a patch
+            // nibbles half of MIN_WFA_PATCH_LENGTH back from its indels, as much again through the
+            // patch before it, and MIN_WFA_PATCH_LENGTH forward, or up to MAX_DIST_TO_LOOK_AT
+            // more to the next indels after a run of more than MIN_CLOSE_INDELS_LENGTH
+            if (min_identity > 0
+                && eroded_identity_bound(erodev, query_length, MIN_WFA_PATCH_LENGTH, MIN_CLOSE_INDELS_LENGTH,
+                                         MIN_WFA_PATCH_LENGTH + MAX_DIST_TO_LOOK_AT) < min_identity) {
+#ifdef WFLIGN_DEBUG
+                std::cerr << "[wflign::wflign_affine_wavefront] abandoning "
+                          << query_name << " " << query_offset << " - " << target_name << " " << target_offset
+                          << ", below the minimum identity" << std::endl;
+#endif
+                return;
+            }
+
 #ifdef WFLIGN_DEBUG
             std::cerr << "[wflign::wflign_affine_wavefront] got normalized "
                  "eroded traceback: ";
@@ -1567,7 +2015,64 @@ void write_merged_alignment(
 
             //std::cerr << "FIRST PATCH ROUND" << std::endl;
             // +++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++\n";
-            patching(erodev, tracev, 4096, 8, 512, true);
+            // Patches between anchors of the trace are independent: with tasks to run them, they
+            // are planned by a first walk, taking each one as aligned, and solved in parallel
+            // for the patching walk to pick up. Those the plan missed are solved as they come
+            std::map<patch_region_t, std::vector<alignment_t>> solved;
+            if (patch_tasks.parallel_for) {
+                std::vector<patch_region_t> planned;
+                {
+                    // the walk moves the bounds and the head of the target
+                    const uint64_t saved_bounds[] = {query_start, target_start, query_end, target_end, target_offset, target_length};
+                    char* const saved_target = target;
+                    wflign_rle_cigar_t unpatched = erodev;
+                    wflign_rle_cigar_t patched;
+                    patching(unpatched, patched, MIN_WFA_HEAD_TAIL_PATCH_LENGTH, MIN_WFA_PATCH_LENGTH, MAX_DIST_TO_LOOK_AT, false,
+                             [&planned](const patch_region_t& region) {
+                                 planned.push_back(region);
+                                 return planned_patch(region);
+                             }, true);
+                    query_start = saved_bounds[0];
+                    target_start = saved_bounds[1];
+                    query_end = saved_bounds[2];
+                    target_end = saved_bounds[3];
+                    target_offset = saved_bounds[4];
+                    target_length = saved_bounds[5];
+                    target = saved_target;
+                }
+                if (planned.size() > 1) {
+                    // the largest first, for the last ones to end together
+                    std::sort(planned.begin(), planned.end(), [](const patch_region_t& a, const patch_region_t& b) {
+                        return a.query_length + a.target_length > b.query_length + b.target_length;
+                    });
+                    std::vector<std::vector<alignment_t>> alignments(planned.size());
+                    patch_tasks.parallel_for(planned.size(), [&](const uint64_t i) {
+                        const patch_region_t& region = planned[i];
+                        wfa::WFAlignerGapAffine2Pieces& aligner = patch_tasks.aligner(region.query_length, region.target_length);
+                        alignments[i] = solve_patch(region, query, aligner,
+                                                    convex_penalties, chain_gap, max_patching_score, min_inversion_length, erode_k);
+                        if (patch_tasks.stats) patch_tasks.stats->take(aligner, false);
+                    });
+                    for (uint64_t i = 0; i < planned.size(); ++i) {
+                        solved.emplace(planned[i], std::move(alignments[i]));
+                    }
+                }
+            }
+            patching(erodev, tracev, MIN_WFA_HEAD_TAIL_PATCH_LENGTH, MIN_WFA_PATCH_LENGTH, MAX_DIST_TO_LOOK_AT, true,
+                     [&](const patch_region_t& region) {
+                         ++num_patches;
+                         auto it = solved.find(region);
+                         if (it == solved.end()) {
+                             wfa::WFAlignerGapAffine2Pieces& aligner = patch_tasks.aligner(region.query_length, region.target_length);
+                             std::vector<alignment_t> alignments = solve_patch(region, query, aligner,
+                                                convex_penalties, chain_gap, max_patching_score, min_inversion_length, erode_k);
+                             if (patch_tasks.stats) patch_tasks.stats->take(aligner, false);
+                             return alignments;
+                         }
+                         std::vector<alignment_t> alignments = std::move(it->second);
+                         solved.erase(it);
+                         return alignments;
+                     }, false);
 
 #ifdef VALIDATE_WFA_WFLIGN
             if (!validate_trace(tracev, query,
@@ -1594,8 +2099,14 @@ void write_merged_alignment(
         }
     }
 
-    // normalize the indels
-    sort_indels(tracev);
+    // normalize the indels, trimming the deletions at the start and end of tracev in the same pass
+    {
+        uint64_t head_deletions = 0;
+        uint64_t tail_deletions = 0;
+        normalize_indels(tracev, head_deletions, tail_deletions);
+        target_start += head_deletions;
+        target_end -= tail_deletions;
+    }
 
 #ifdef WFLIGN_DEBUG
     std::cerr << "[wflign::wflign_affine_wavefront] got full patched traceback: ";
@@ -1616,7 +2127,7 @@ void write_merged_alignment(
                     query_length, target_length + 2 * wflign_max_len_minor, query_start,
                     target_start)) {
         std::cerr
-            << "cigar failure at alignment (before head/tail del trimming) "
+            << "cigar failure at alignment (after head/tail del trimming) "
             << "\t" << query_name << "\t" << query_total_length << "\t"
             << query_offset +
                    (query_is_rev ? query_length - query_end : query_start)
@@ -1631,43 +2142,6 @@ void write_merged_alignment(
     }
 #endif
 
-    // trim deletions at start and end of tracev
-    uint64_t begin_offset;
-    uint64_t end_offset;
-    {
-        uint64_t trim_del_first;
-        uint64_t trim_del_last;
-
-        // 1.) sort initial ins/del to put del < ins
-        auto first_non_indel = tracev.begin();
-        while (first_non_indel != tracev.end() &&
-               (*first_non_indel == 'D' || *first_non_indel == 'I')) {
-            ++first_non_indel;
-        }
-        std::sort(tracev.begin(), first_non_indel,
-                  [](char a, char b) { return a < b; });
-        // 2.) find first non-D in tracev --> tracev_begin
-        //   a.) add to target_start this count
-        auto first_non_del = tracev.begin();
-        while (first_non_del != tracev.end() && *first_non_del == 'D') {
-            ++first_non_del;
-        }
-        trim_del_first = std::distance(tracev.begin(), first_non_del);
-        target_start += trim_del_first;
-
-        // 3.) count D's at end of tracev --> tracev_end
-        //   b.) subtract from target_end this count
-        auto last_non_del = tracev.rbegin();
-        while (last_non_del != tracev.rend() && *last_non_del == 'D') {
-            ++last_non_del;
-        }
-        trim_del_last = std::distance(tracev.rbegin(), last_non_del);
-        target_end -= trim_del_last;
-
-        begin_offset = trim_del_first;
-        end_offset = tracev.size() - trim_del_last;
-    }
-
     /*
 #ifdef VALIDATE_WFA_WFLIGN
     if (!validate_trace(tracev, query, target - target_pointer_shift,
@@ -1689,8 +2163,7 @@ query_start : query_end)
 #endif
     */
 
-#ifdef WFA_PNG_TSV_TIMING
-    bool emit_png = !prefix_wavefront_plot_in_png->empty() && wfplot_max_size > 0;
+    bool emit_png = prefix_wavefront_plot_in_png != nullptr && wfplot_max_size > 0;
     if (emit_png) {
         const int pattern_length = (int)query_length;
         const int text_length = (int)target_length;
@@ -1783,230 +2256,16 @@ query_start : query_end)
             encodeOneStep(filename.c_str(), bytes, width, height);
         }
     }
-#endif
-
-    // convert trace to cigar, get correct start and end coordinates
-    char *cigarv = alignment_to_cigar(
-            tracev, begin_offset, end_offset,
-            total_target_aligned_length, total_query_aligned_length, matches,
-            mismatches, insertions, inserted_bp, deletions, deleted_bp);
-
-    const double gap_compressed_identity =
-            (double)matches /
-            (double)(matches + mismatches + insertions + deletions);
-
-    if (gap_compressed_identity >= min_identity) {
-        const uint64_t edit_distance = mismatches + inserted_bp + deleted_bp;
-
-        // identity over the full block
-        const double block_identity =
-                (double)matches / (double)(matches + edit_distance);
-
-        auto write_tag_and_md_string = [&](std::ostream &out, const char *c,
-                                           const int target_start) {
-            out << "MD:Z:";
-
-            char last_op = '\0';
-            int last_len = 0;
-            int t_off = target_start, l_MD = 0;
-            int l = 0;
-            int x = 0;
-            while (c[x] != '\0') {
-                while (isdigit(c[x]))
-                    ++x;
-                char op = c[x];
-                int len = 0;
-                std::from_chars(c + l, c + x, len);
-                l = ++x;
-                if (last_len) {
-                    if (last_op == op) {
-                        len += last_len;
-                    } else {
-                        // std::cerr << t_off << "   " << last_len << last_op <<
-                        // std::endl;
-
-                        if (last_op == '=') {
-                            l_MD += last_len;
-                            t_off += last_len;
-                        } else if (last_op == 'X') {
-                            for (uint64_t ii = 0; ii < last_len; ++ii) {
-                                out << l_MD
-                                    << target[t_off + ii - target_pointer_shift];
-                                l_MD = 0;
-                            }
-
-                            t_off += last_len;
-                        } else if (last_op == 'D') {
-                            out << l_MD << "^";
-                            for (uint64_t ii = 0; ii < last_len; ++ii) {
-                                out << target[t_off + ii - target_pointer_shift];
-                            }
-
-                            l_MD = 0;
-                            t_off += last_len;
-                        }
-                    }
-                }
-                last_op = op;
-                last_len = len;
-            }
-
-            if (last_len) {
-                // std::cerr << t_off << "   " << last_len << last_op << std::endl;
-
-                if (last_op == '=') {
-                    out << last_len + l_MD;
-                } else if (last_op == 'X') {
-                    for (uint64_t ii = 0; ii < last_len; ++ii) {
-                        out << l_MD << target[t_off + ii - target_pointer_shift];
-                        l_MD = 0;
-                    }
-                    out << "0";
-                } else if (last_op == 'I') {
-                    out << l_MD;
-                } else if (last_op == 'D') {
-                    out << l_MD << "^";
-                    for (uint64_t ii = 0; ii < last_len; ++ii) {
-                        out << target[t_off + ii - target_pointer_shift];
-                    }
-                    out << "0";
-                }
-            }
-        };
-
-#ifdef WFA_PNG_TSV_TIMING
-        const long elapsed_time_patching_ms =
-                std::chrono::duration_cast<std::chrono::milliseconds>(
-                        std::chrono::steady_clock::now() - start_time)
-                        .count();
-
-        const std::string timings_and_num_alignements =
-                "wt:i:" + std::to_string(elapsed_time_wflambda_ms) +
-                "\tpt:i:" + std::to_string(elapsed_time_patching_ms) +
-                "\taa:i:" + std::to_string(num_alignments) +
-                "\tap:i:" + std::to_string(num_alignments_performed);
-#endif
-
-        if (paf_format_else_sam) {
-            out << query_name << "\t" << query_total_length << "\t"
-                << query_offset +
-                   (query_is_rev ? query_length - query_end : query_start)
-                << "\t"
-                << query_offset +
-                   (query_is_rev ? query_length - query_start : query_end)
-                << "\t" << (query_is_rev ? "-" : "+") << "\t" << target_name
-                << "\t" << target_total_length << "\t"
-                << target_offset - target_pointer_shift + target_start << "\t"
-                << target_offset + target_end << "\t" << matches << "\t"
-                << matches + mismatches + inserted_bp + deleted_bp
-                << "\t"
-                << std::round(float2phred(1.0 - block_identity))
-                //<< "\t" << "as:i:" << total_score
-                << "\t"
-                << "gi:f:" << gap_compressed_identity << "\t"
-                << "bi:f:"
-                << block_identity
-                //<< "\t" << "md:f:" << mash_dist_sum / trace.size()
-                //<< "\t" << "ma:i:" << matches
-                //<< "\t" << "mm:i:" << mismatches
-                //<< "\t" << "ni:i:" << insertions
-                //<< "\t" << "ii:i:" << inserted_bp
-                //<< "\t" << "nd:i:" << deletions
-                //<< "\t" << "dd:i:" << deleted_bp
-                << "\t"
-                << "md:f:" << mashmap_estimated_identity;
-
-            if (emit_md_tag) {
-                out << "\t";
-
-                write_tag_and_md_string(out, cigarv, target_start);
-            }
-
-#ifdef WFA_PNG_TSV_TIMING
-            out << "\t" << timings_and_num_alignements << "\t"
-                << "cg:Z:" << cigarv << "\n";
-#else
-            out << "\t" << "cg:Z:" << cigarv << "\n";
-#endif
-        } else {
-            out << query_name                          // Query template NAME
-                << "\t" << (query_is_rev ? "16" : "0") // bitwise FLAG
-                << "\t" << target_name // Reference sequence NAME
-                << "\t"
-                << target_offset - target_pointer_shift + target_start +
-                   1 // 1-based leftmost mapping POSition
-                << "\t"
-                << std::round(
-                        float2phred(1.0 - block_identity)) // MAPping Quality
-                << "\t";
-
-            // CIGAR
-            const uint64_t query_start_pos =
-                    query_offset +
-                    (query_is_rev ? query_length - query_end : query_start);
-            const uint64_t query_end_pos =
-                    query_offset +
-                    (query_is_rev ? query_length - query_start : query_end);
-
-            if (query_start_pos > 0) {
-                out << query_start_pos << "H";
-            }
-            out << cigarv;
-            if (query_total_length > query_end_pos) {
-                out << (query_total_length - query_end_pos) << "H";
-            }
-
-            out << "\t"
-                << "*" // Reference name of the mate/next read
-                << "\t"
-                << "0" // Position of the mate/next read
-                << "\t"
-                << "0" // observed Template LENgth
-                << "\t";
-
-            // segment SEQuence
-            if (no_seq_in_sam) {
-                out << "*";
-            } else {
-                for (uint64_t p = query_start; p < query_end; ++p) {
-                    out << query[p];
-                }
-            }
-
-            out << "\t"
-                << "*" // ASCII of Phred-scaled base QUALity+33
-                << "\t"
-                << "NM:i:"
-                << edit_distance
-                //<< "\t" << "AS:i:" << total_score
-                << "\t"
-                << "gi:f:" << gap_compressed_identity << "\t"
-                << "bi:f:"
-                << block_identity
-                //<< "\t" << "md:f:" << mash_dist_sum / trace.size()
-                //<< "\t" << "ma:i:" << matches
-                //<< "\t" << "mm:i:" << mismatches
-                //<< "\t" << "ni:i:" << insertions
-                //<< "\t" << "ii:i:" << inserted_bp
-                //<< "\t" << "nd:i:" << deletions
-                //<< "\t" << "dd:i:" << deleted_bp
-                << "";
-
-            if (emit_md_tag) {
-                out << "\t";
 
-                write_tag_and_md_string(out, cigarv, target_start);
-            }
-#ifdef WFA_PNG_TSV_TIMING
-            out << "\t" << timings_and_num_alignements << "\n";
-#else
-            out << "\n";
-#endif
-        }
-    }
+    patch_span.end();
+    ::trace::Span output_span("output");
 
-    // always clean up
-    free(cigarv);
+    write_merged_record(out, tracev, convex_penalties, emit_md_tag, paf_format_else_sam, no_seq_in_sam,
+                        score_only, query, query_name, query_total_length, query_offset, query_length,
+                        query_is_rev, target, target_name, target_total_length, target_offset,
+                        target_length, target_pointer_shift, query_start, query_end, target_start, target_end,
+                        min_identity, mashmap_estimated_identity, emit_timings, elapsed_time_wflambda_ms,
+                        start_time, num_alignments, num_alignments_performed, num_patches);
 
 
     if (!paf_format_else_sam) {
@@ -2022,6 +2281,10 @@ query_start : query_end)
         // write how many reverse complement alignments were found
         //std::cerr << "got " << rev_patch_alns.size() << " rev patch alns" << std::endl;
         for (auto& patch_aln : multi_patch_alns) {
+            if (score_only) {
+                // the patch may have been trimmed since it was scored
+                patch_aln.score = calculate_alignment_score(patch_aln.edit_cigar, convex_penalties);
+            }
             write_alignment_paf(
                 out,
                 patch_aln,
@@ -2037,7 +2300,8 @@ query_start : query_end)
                 min_identity,
                 mashmap_estimated_identity,
                 false,  // Don't add an endline after each alignment
-                true);  // This is a reverse complement alignment
+                true,   // This is a reverse complement alignment
+                score_only);
             // write tag indicating that this is a multipatch alignment
             out << "\t" << "pt:Z:true" << "\t"
                 // and if the patch is inverted as well
@@ -2047,6 +2311,81 @@ query_start : query_end)
     out << std::flush;
 }
 
+/*
+ * Erosion and patching leave an end-to-end alignment as it is when its islands
+ * of matches and mismatches are all erode_k long or more, its runs of indels
+ * are of a single op and at most 2 long, and it starts and ends with islands
+ * of 7 or more whose first and last 6 ops are matches: these are trimmed by
+ * erode_head and erode_tail, and patched back as they were
+ */
+bool is_final_global_alignment(const alignment_t& aln, const int& erode_k) {
+    const uint64_t end_matches = 6;
+    if (!aln.ok || aln.j != 0 || aln.i != 0) {
+        return false;
+    }
+    const char* ops = aln.edit_cigar.cigar_ops;
+    const uint64_t begin = aln.edit_cigar.begin_offset;
+    const uint64_t end = aln.edit_cigar.end_offset;
+    if (end - begin < 2 * end_matches + 1) {
+        return false;
+    }
+    for (uint64_t i = 0; i < end_matches; ++i) {
+        if (ops[begin + i] != 'M' || ops[end - 1 - i] != 'M') {
+            return false;
+        }
+    }
+    const uint64_t min_island = std::max<uint64_t>(std::max(erode_k, 0), end_matches + 1);
+    uint64_t island = 0;
+    for (uint64_t i = begin; i < end;) {
+        const char op = ops[i];
+        const uint64_t run_end = cigar_op_run_end(ops, i, end);
+        if (op == 'M' || op == 'X') {
+            island += run_end - i;
+        } else {
+            if (island < min_island || run_end - i > 2 || run_end == end
+                || ops[run_end] == 'I' || ops[run_end] == 'D') {
+                return false;
+            }
+            island = 0;
+        }
+        i = run_end;
+    }
+    return island >= min_island;
+}
+
+void write_global_alignment(
+        std::ostream &out,
+        const alignment_t& aln,
+        const wflign_penalties_t& convex_penalties,
+        const bool& emit_md_tag,
+        const bool& paf_format_else_sam,
+        const bool& no_seq_in_sam,
+        const bool& score_only,
+        const char* query,
+        const std::string& query_name,
+        const uint64_t& query_total_length,
+        const uint64_t& query_offset,
+        const uint64_t& query_length,
+        const bool& query_is_rev,
+        const char* target,
+        const std::string& target_name,
+        const uint64_t& target_total_length,
+        const uint64_t& target_offset,
+        const uint64_t& target_length,
+        const float& min_identity,
+        const float& mashmap_estimated_identity) {
+    ::trace::Span output_span("output");
+    wflign_rle_cigar_t tracev;
+    tracev.append(aln.edit_cigar);
+    write_merged_record(out, tracev, convex_penalties, emit_md_tag, paf_format_else_sam, no_seq_in_sam,
+                        score_only, query, query_name, query_total_length, query_offset, query_length,
+                        query_is_rev, target, target_name, target_total_length, target_offset,
+                        target_length, 0, 0, query_length, 0, target_length,
+                        min_identity, mashmap_estimated_identity, false, 0,
+                        std::chrono::steady_clock::now(), 1, 1, 0);
+    out << std::flush;
+}
+
 void write_tag_and_md_string(
     std::ostream &out,
     const char *cigar_ops,
@@ -2057,67 +2396,23 @@ void write_tag_and_md_string(
     const int64_t target_offset,
     const int64_t target_pointer_shift) {
 
-    out << "MD:Z:";
-
-    char last_op = '\0';
-    int last_len = 0;
-    int t_off = target_start, l_MD = 0;
+    // the cigar back into runs, = and M being matches alike
+    wflign_rle_cigar_t trace;
     int l = cigar_start;
     int x = cigar_start;
-
     while (x < cigar_end) {
         while (x < cigar_end && isdigit(cigar_ops[x]))
             ++x;
-        char op = cigar_ops[x];
+        const char op = cigar_ops[x];
         int len = 0;
         std::from_chars(cigar_ops + l, cigar_ops + x, len);
         l = ++x;
-        if (last_len) {
-            if (last_op == op) {
-                len += last_len;
-            } else {
-                if (last_op == '=' || last_op == 'M') {
-                    l_MD += last_len;
-                    t_off += last_len;
-                } else if (last_op == 'X') {
-                    for (uint64_t ii = 0; ii < last_len; ++ii) {
-                        out << l_MD << target[t_off + ii - target_pointer_shift];
-                        l_MD = 0;
-                    }
-                    t_off += last_len;
-                } else if (last_op == 'D') {
-                    out << l_MD << "^";
-                    for (uint64_t ii = 0; ii < last_len; ++ii) {
-                        out << target[t_off + ii - target_pointer_shift];
-                    }
-                    l_MD = 0;
-                    t_off += last_len;
-                }
-            }
-        }
-        last_op = op;
-        last_len = len;
+        trace.push_back(op == '=' ? 'M' : op, len);
     }
 
-    if (last_len) {
-        if (last_op == '=' || last_op == 'M') {
-            out << last_len + l_MD;
-        } else if (last_op == 'X') {
-            for (uint64_t ii = 0; ii < last_len; ++ii) {
-                out << l_MD << target[t_off + ii - target_pointer_shift];
-                l_MD = 0;
-            }
-            out << "0";
-        } else if (last_op == 'I') {
-            out << l_MD;
-        } else if (last_op == 'D') {
-            out << l_MD << "^";
-            for (uint64_t ii = 0; ii < last_len; ++ii) {
-                out << target[t_off + ii - target_pointer_shift];
-            }
-            out << "0";
-        }
-    }
+    std::string md;
+    append_md_tag(md, trace, target + target_start - target_pointer_shift);
+    out << md;
 }
 
 void write_alignment_sam(
@@ -2226,7 +2521,8 @@ void write_alignment_paf(
         const float& min_identity,
         const float& mashmap_estimated_identity,
         const bool& with_endline,
-        const bool& is_rev_patch) {
+        const bool& is_rev_patch,
+        const bool& score_only) {
 
     if (aln.ok) {
         uint64_t matches = 0;
@@ -2238,9 +2534,16 @@ void write_alignment_paf(
         uint64_t refAlignedLength = 0;
         uint64_t qAlignedLength = 0;
 
-        char *cigar = wfa_alignment_to_cigar(
-                &aln.edit_cigar, refAlignedLength, qAlignedLength, matches,
-                mismatches, insertions, inserted_bp, deletions, deleted_bp);
+        char *cigar = nullptr;
+        if (score_only) {
+            wfa_alignment_stats(
+                    &aln.edit_cigar, refAlignedLength, qAlignedLength, matches,
+                    mismatches, insertions, inserted_bp, deletions, deleted_bp);
+        } else {
+            cigar = wfa_alignment_to_cigar(
+                    &aln.edit_cigar, refAlignedLength, qAlignedLength, matches,
+                    mismatches, insertions, inserted_bp, deletions, deleted_bp);
+        }
 
         size_t alignmentRefPos = aln.i;
         double gap_compressed_identity =
@@ -2266,18 +2569,22 @@ void write_alignment_paf(
                 << target_offset + alignmentRefPos << "\t"
                 << target_offset + alignmentRefPos + refAlignedLength << "\t"
                 << matches << "\t" << std::max(refAlignedLength, qAlignedLength)
-                << "\t" << std::round(float2phred(1.0 - block_identity)) << "\t"
-                //<< "as:i:" << aln.score << "\t"
-                << "gi:f:" << gap_compressed_identity << "\t"
+                << "\t" << std::round(float2phred(1.0 - block_identity)) << "\t";
+            if (score_only) {
+                out << "as:i:" << aln.score << "\t";
+            }
+            out << "gi:f:" << gap_compressed_identity << "\t"
                 << "bi:f:" << block_identity << "\t"
-                << "md:f:" << mashmap_estimated_identity << "\t"
                 //<< "\t" << "ma:i:" << matches
                 //<< "\t" << "mm:i:" << mismatches
                 //<< "\t" << "ni:i:" << insertions
                 //<< "\t" << "bi:i:" << inserted_bp
                 //<< "\t" << "nd:i:" << deletions
                 //<< "\t" << "bd:i:" << deleted_bp
-                << "cg:Z:" << cigar << "\t";
+                << "md:f:" << mashmap_estimated_identity << "\t";
+            if (!score_only) {
+                out << "cg:Z:" << cigar << "\t";
+            }
             if (with_endline) {
                 out << std::endl;
             }
@@ -2296,20 +2603,58 @@ double float2phred(const double& prob) {
         return p;
 }
 
-void sort_indels(std::vector<char>& v) {
-    auto f = v.begin();
-    while (f != v.end()) {
-        auto j = f;
-        while (j != v.end() && (*j == 'D' || *j == 'I')) {
-            ++j;
+void normalize_indels(wflign_rle_cigar_t& v, uint64_t& head_deletions, uint64_t& tail_deletions) {
+    wflign_rle_cigar_t normalized;
+    head_deletions = 0;
+    tail_deletions = 0;
+    const std::vector<wflign_rle_cigar_t::run_t>& runs = v.runs();
+    for (size_t r = 0; r < runs.size();) {
+        const char op = wflign_rle_cigar_t::op(runs[r]);
+        if (op == 'I' || op == 'D') {
+            const bool head = r == 0;
+            uint64_t insertions = 0;
+            uint64_t deletions = 0;
+            for (; r < runs.size() && (wflign_rle_cigar_t::op(runs[r]) == 'I'
+                                       || wflign_rle_cigar_t::op(runs[r]) == 'D'); ++r) {
+                (wflign_rle_cigar_t::op(runs[r]) == 'I' ? insertions : deletions) += wflign_rle_cigar_t::length(runs[r]);
+            }
+            normalized.push_back('I', insertions);
+            if (head) {
+                head_deletions = deletions;
+            } else if (r == runs.size()) {
+                tail_deletions = deletions;
+            } else {
+                normalized.push_back('D', deletions);
+            }
+        } else {
+            normalized.push_back(op, wflign_rle_cigar_t::length(runs[r]));
+            ++r;
         }
-        if (j != f) {
-            std::sort(f, j, [](char a, char b) { return b < a; });
-            f = j;
+    }
+    v = std::move(normalized);
+}
+
+void sort_indels(wflign_rle_cigar_t& v) {
+    wflign_rle_cigar_t sorted;
+    const std::vector<wflign_rle_cigar_t::run_t>& runs = v.runs();
+    for (size_t r = 0; r < runs.size();) {
+        const char op = wflign_rle_cigar_t::op(runs[r]);
+        if (op == 'I' || op == 'D') {
+            // Is before Ds in each run of indels
+            uint64_t insertions = 0;
+            uint64_t deletions = 0;
+            for (; r < runs.size() && (wflign_rle_cigar_t::op(runs[r]) == 'I'
+                                       || wflign_rle_cigar_t::op(runs[r]) == 'D'); ++r) {
+                (wflign_rle_cigar_t::op(runs[r]) == 'I' ? insertions : deletions) += wflign_rle_cigar_t::length(runs[r]);
+            }
+            sorted.push_back('I', insertions);
+            sorted.push_back('D', deletions);
         } else {
-            ++f;
+            sorted.push_back(op, wflign_rle_cigar_t::length(runs[r]));
+            ++r;
         }
     }
+    v = std::move(sorted);
 }
 
     } /* namespace wavefront */
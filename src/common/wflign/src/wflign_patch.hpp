@@ -46,6 +46,28 @@ namespace wflign {
                 const uint16_t& step_size,
                 wflign_extend_data_t* extend_data,
                 alignment_t& aln);
+        // The mash distance check of do_wfa_segment_alignment: whether the segments are to be aligned
+        bool wfa_segment_within_mash_distance(
+                const char* query,
+                std::vector<rkmh::hash_t>*& query_sketch,
+                const int64_t& j,
+                const char* target,
+                std::vector<rkmh::hash_t>*& target_sketch,
+                const int64_t& i,
+                const uint16_t& segment_length_q,
+                const uint16_t& segment_length_t,
+                const uint16_t& step_size,
+                wflign_extend_data_t* extend_data);
+        // The alignment of do_wfa_segment_alignment, with the aligners of extend_data
+        void do_wfa_segment_pair_alignment(
+                const char* query,
+                const int64_t& j,
+                const char* target,
+                const int64_t& i,
+                const uint16_t& segment_length_q,
+                const uint16_t& segment_length_t,
+                wflign_extend_data_t* extend_data,
+                alignment_t& aln);
         void do_wfa_patch_alignment(
             const char* query,
             const uint64_t& j,
@@ -78,11 +100,12 @@ namespace wflign {
         void write_merged_alignment(
                 std::ostream &out,
                 const std::vector<alignment_t *> &trace,
-                wfa::WFAlignerGapAffine2Pieces& wf_aligner,
+                const wflign_patch_tasks_t& patch_tasks,
                 const wflign_penalties_t& convex_penalties,
                 const bool& emit_md_tag,
                 const bool& paf_format_else_sam,
                 const bool& no_seq_in_sam,
+                const bool& score_only,
                 const char* query,
                 const std::string& query_name,
                 const uint64_t& query_total_length,
@@ -95,11 +118,11 @@ namespace wflign {
                 const uint64_t& target_offset,
                 const uint64_t& target_length,
                 const float& min_identity,
-#ifdef WFA_PNG_TSV_TIMING
                 const long& elapsed_time_wflambda_ms,
                 const uint64_t& num_alignments,
                 const uint64_t& num_alignments_performed,
-#endif
+                // the times and counts above are written as tags of the record
+                const bool& emit_timings,
                 const float& mashmap_estimated_identity,
                 const uint64_t& wflign_max_len_major,
                 const uint64_t& wflign_max_len_minor,
@@ -109,13 +132,37 @@ namespace wflign {
                 const uint64_t& min_inversion_length,
                 const int& min_wf_length,
                 const int& max_dist_threshold,
-#ifdef WFA_PNG_TSV_TIMING
+                const wflign_target_fetch_t* fetch_target,
                 const std::string* prefix_wavefront_plot_in_png,
                 const uint64_t& wfplot_max_size,
                 const bool& emit_patching_tsv,
                 std::ostream* out_patching_tsv,
-#endif
                 const bool& with_endline = true);
+        // Whether the merged alignment of aln, aligned end to end, would be aln itself
+        bool is_final_global_alignment(const alignment_t& aln, const int& erode_k);
+        // The record of an alignment of query against target end to end, as the merged
+        // alignment writes it, for those is_final_global_alignment holds for
+        void write_global_alignment(
+                std::ostream &out,
+                const alignment_t& aln,
+                const wflign_penalties_t& convex_penalties,
+                const bool& emit_md_tag,
+                const bool& paf_format_else_sam,
+                const bool& no_seq_in_sam,
+                const bool& score_only,
+                const char* query,
+                const std::string& query_name,
+                const uint64_t& query_total_length,
+                const uint64_t& query_offset,
+                const uint64_t& query_length,
+                const bool& query_is_rev,
+                const char* target,
+                const std::string& target_name,
+                const uint64_t& target_total_length,
+                const uint64_t& target_offset,
+                const uint64_t& target_length,
+                const float& min_identity,
+                const float& mashmap_estimated_identity);
         void write_tag_and_md_string(
             std::ostream &out,
             const char *cigar_ops,
@@ -159,9 +206,13 @@ namespace wflign {
                 const float& min_identity,
                 const float& mashmap_estimated_identity,
                 const bool& with_endline = true,
-                const bool& is_rev_patch = false);
+                const bool& is_rev_patch = false,
+                const bool& score_only = false);
         double float2phred(const double& prob);
-        void sort_indels(std::vector<char>& v);
+        void sort_indels(wflign_rle_cigar_t& v);
+        // sort_indels, dropping in the same pass the deletions v begins and ends with, counted
+        // in head_deletions and tail_deletions
+        void normalize_indels(wflign_rle_cigar_t& v, uint64_t& head_deletions, uint64_t& tail_deletions);
 
     } /* namespace wavefront */
 
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "map/include/map_parameters.hpp"
+#include "map/include/winSketch.hpp"
+#include "map/include/computeMap.hpp"
+#include "map/include/parseCmdArgs.hpp"
+#include "align/include/align_parameters.hpp"
+#include "align/include/computeAlignments.hpp"
+#include "interface/temp_file.hpp"
+
+namespace yeet {
+
+/**
+ * Batch mode: the query sets of a manifest, e.g. the haplotypes of a
+ * pangenome, are mapped, and aligned, against one target index built or
+ * loaded once, one set after the other with all of the threads, instead of
+ * paying for the index and the setup of a process for each set.
+ *
+ * The manifest has a line per query set, its FASTA (or FASTQ) file and the
+ * file its PAF or SAM output goes to, separated by a tab; empty lines and
+ * those starting with '#' are skipped. The options of the run apply to each.
+ */
+namespace batch {
+
+/**
+ * The query and output files of each line of the manifest at path, false if
+ * it can't be read or a line isn't a pair of files
+ */
+inline bool read_manifest(const std::string& path, std::vector<std::pair<std::string, std::string>>& entries) {
+    std::ifstream in(path);
+    if (!in) {
+        std::cerr << "[wfmash::batch] ERROR, could not read the manifest " << path << std::endl;
+        return false;
+    }
+    std::string line;
+    for (size_t number = 1; std::getline(in, line); ++number) {
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        std::istringstream fields(line);
+        std::string query, output, extra;
+        if (!std::getline(fields, query, '\t') || !std::getline(fields, output, '\t')
+            || query.empty() || output.empty() || std::getline(fields, extra, '\t')) {
+            std::cerr << "[wfmash::batch] ERROR, line " << number << " of the manifest " << path
+                      << " is not a query file and an output file separated by a tab" << std::endl;
+            return false;
+        }
+        entries.emplace_back(query, output);
+    }
+    return true;
+}
+
+/**
+ * Maps the query sets of the manifest with the resident index sketch, and aligns
+ * them unless approx_mapping, the parameters of the run being those given but
+ * for the query and output files of each set
+ */
+inline int run(const std::string& manifest,
+               const skch::Parameters& map_parameters,
+               const align::Parameters& align_parameters,
+               bool approx_mapping,
+               const skch::Sketch& sketch) {
+    std::vector<std::pair<std::string, std::string>> entries;
+    if (!read_manifest(manifest, entries)) {
+        return 1;
+    }
+    for (auto& entry : entries) {
+        skch::validateInputFile(entry.first);
+    }
+
+    for (size_t e = 0; e < entries.size(); ++e) {
+        const std::string& query = entries[e].first;
+        const std::string& output = entries[e].second;
+        auto t0 = skch::Time::now();
+        std::cerr << "[wfmash::batch] query set " << e + 1 << "/" << entries.size() << ": " << query << std::endl;
+
+        skch::Parameters map = map_parameters;
+        map.querySequences.assign(1, query);
+        map.map_checkpoint_file.clear();
+        const std::string mappings = approx_mapping ? output : temp_file::create("wfmash-batch-", ".paf");
+        map.outFileName = mappings;
+        if (!approx_mapping) {
+            map.binary_output = true;
+            map.bgzf_output = false;
+            map.output_shards = 0;
+        }
+        {
+            skch::Map mapper(map, sketch);
+        }
+
+        if (!approx_mapping) {
+            align::Parameters align = align_parameters;
+            align.querySequences.assign(1, query);
+            align.mashmapPafFile = mappings;
+            align.pafOutputFile = output;
+            align.checkpoint_file.clear();
+            align.chunk_count = 1;
+            align.chunk_index = 0;
+            align::Aligner aligner(align);
+            aligner.compute();
+            temp_file::remove(mappings);
+        }
+
+        std::chrono::duration<double> time = skch::Time::now() - t0;
+        std::cerr << "[wfmash::batch] query set " << e + 1 << "/" << entries.size() << " saved in " << output
+                  << " in " << time.count() << " sec" << std::endl;
+    }
+    return 0;
+}
+
+}
+
+}
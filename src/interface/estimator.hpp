@@ -0,0 +1,345 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <numeric>
+#include <random>
+#include <sstream>
+#include <string>
+#include <unordered_set>
+#include <vector>
+#include <htslib/faidx.h>
+
+#include "map/include/map_parameters.hpp"
+#include "map/include/winSketch.hpp"
+#include "map/include/computeMap.hpp"
+#include "align/include/align_parameters.hpp"
+#include "align/include/computeAlignments.hpp"
+#include "common/run_report.hpp"
+#include "common/seqiter.hpp"
+#include "interface/temp_file.hpp"
+
+namespace yeet {
+
+/**
+ * Dry run of --estimate: with the target index built or loaded, fragments
+ * drawn at random from the queries are mapped in a few batches, a sample of
+ * the mappings of each batch aligned, and the CPU time of each batch
+ * extrapolated to the whole of the queries. Each batch gives a rate per query
+ * base, so that the 95% interval of an estimate is that of the mean of the
+ * rates of the batches. The estimates are written as TSV to stdout, for
+ * --plan-estimate to weigh the alignment in the cost of the jobs of --plan
+ *
+ * The fragments keep the names of their sequences, for -X and -Y to skip
+ * the same mappings as the run would, so that a batch holds a single
+ * fragment of each sequence
+ */
+namespace estimator {
+
+// batches the sample is mapped in, whose spread gives the intervals
+const int sampleBatches = 8;
+
+// mappings aligned at most by batch, the others only counted
+const uint64_t alignedPerBatch = 200;
+
+// row of the estimates, with the alignment cost of the job planner
+const char* const planCostRow = "plan_align_cost_per_base";
+
+struct Fragment {
+    size_t seq;
+    int64_t begin;
+    int64_t end;
+};
+
+struct Batch {
+    uint64_t bases = 0;
+    double map_cpu = 0;
+    uint64_t mappings = 0;
+    uint64_t mapped_bases = 0;
+    uint64_t aligned_bases = 0;
+    double align_cpu = 0;
+};
+
+struct Interval {
+    double estimate;
+    double low;
+    double high;
+};
+
+/**
+ * Mean of values, with its 95% interval, each times scale
+ */
+inline Interval mean_interval(const std::vector<double>& values, double scale) {
+    double sum = 0;
+    for (double v : values) {
+        sum += v;
+    }
+    const double mean = sum / values.size();
+    double squares = 0;
+    for (double v : values) {
+        squares += (v - mean) * (v - mean);
+    }
+    const double sd = values.size() > 1 ? std::sqrt(squares / (values.size() - 1)) : 0.0;
+    const double half = 1.96 * sd / std::sqrt((double)values.size());
+    return Interval{mean * scale, std::max(0.0, mean - half) * scale, (mean + half) * scale};
+}
+
+/**
+ * The alignment cost per base of --plan-estimate FILE, written by --estimate
+ */
+inline double read_plan_cost(const std::string& fileName) {
+    std::ifstream in(fileName);
+    std::string line;
+    while (std::getline(in, line)) {
+        std::istringstream fields(line);
+        std::string name;
+        double value = 0;
+        if (std::getline(fields, name, '\t') && name == planCostRow && fields >> value) {
+            return value;
+        }
+    }
+    std::cerr << "[wfmash] ERROR, job_planner, no " << planCostRow << " in " << fileName << ", write it with --estimate." << std::endl;
+    exit(1);
+}
+
+/**
+ * Estimates the cost of the run of map_parameters and align_parameters on
+ * sketch, built or loaded in index_seconds, from fragments making up about
+ * fraction of the bases of the queries
+ */
+inline int estimate(const skch::Parameters& map_parameters,
+                    const align::Parameters& align_parameters,
+                    bool approx_mapping,
+                    const skch::Sketch& sketch,
+                    double index_seconds,
+                    double fraction) {
+    const long index_rss_kb = run_report::peak_rss_kb();
+    std::unordered_set<std::string> allowed_query_names;
+    if (!map_parameters.query_list.empty()) {
+        std::ifstream filter_list(map_parameters.query_list);
+        std::string name;
+        while (getline(filter_list, name)) {
+            allowed_query_names.insert(name);
+        }
+    }
+
+    // the queries, one after the other, of the first query file
+    const std::string& query_file = map_parameters.querySequences.front();
+    faidx_t* fai = fai_load(query_file.c_str());
+    if (fai == nullptr) {
+        std::cerr << "[wfmash::estimate] ERROR, failed to load the FASTA index of " << query_file << std::endl;
+        return 1;
+    }
+    const std::vector<std::string> names = seqiter::filtered_seq_names(fai, map_parameters.query_prefix, allowed_query_names);
+    std::vector<int64_t> ends;
+    int64_t query_bases = 0;
+    for (const auto& name : names) {
+        query_bases += faidx_seq_len(fai, name.c_str());
+        ends.push_back(query_bases);
+    }
+    uint64_t target_bases = 0;
+    for (const auto& contig : sketch.metadata) {
+        target_bases += contig.len;
+    }
+    if (query_bases == 0) {
+        std::cerr << "[wfmash::estimate] ERROR, no query sequence to sample" << std::endl;
+        return 1;
+    }
+
+    // fragments long enough for the mappings of several segments, drawn at
+    // random without overlaps, a sequence giving at most one to each batch
+    const int64_t fragment_length = std::max<int64_t>(10 * map_parameters.segLength, 50000);
+    const int64_t wanted = std::min<int64_t>(query_bases, std::max<int64_t>(fraction * query_bases, sampleBatches * fragment_length));
+    std::mt19937_64 random(7);
+    std::uniform_int_distribution<int64_t> position(0, query_bases - 1);
+    std::map<size_t, std::vector<Fragment>> by_seq;
+    int64_t sampled = 0;
+    // until drawing keeps failing, once the sequences are taken
+    for (int misses = 0; sampled < wanted && misses < 1000; ++misses) {
+        const int64_t at = position(random);
+        const size_t seq = std::upper_bound(ends.begin(), ends.end(), at) - ends.begin();
+        const int64_t seq_begin = seq == 0 ? 0 : ends[seq - 1];
+        const int64_t seq_length = ends[seq] - seq_begin;
+        const int64_t length = std::min(fragment_length, seq_length);
+        const int64_t begin = std::min(at - seq_begin, seq_length - length);
+        std::vector<Fragment>& taken = by_seq[seq];
+        const bool overlaps = std::any_of(taken.begin(), taken.end(), [&](const Fragment& f) {
+            return begin < f.end && f.begin < begin + length;
+        });
+        if (overlaps || taken.size() >= (size_t)sampleBatches) {
+            continue;
+        }
+        taken.push_back(Fragment{seq, begin, begin + length});
+        sampled += length;
+        misses = -1;
+    }
+
+    // the fragments of each sequence over distinct batches, the smallest first
+    std::vector<std::vector<Fragment>> batch_fragments(sampleBatches);
+    std::vector<uint64_t> batch_bases(sampleBatches, 0);
+    for (const auto& seq : by_seq) {
+        std::vector<int> order(sampleBatches);
+        std::iota(order.begin(), order.end(), 0);
+        std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return batch_bases[a] < batch_bases[b]; });
+        for (size_t i = 0; i < seq.second.size(); ++i) {
+            batch_fragments[order[i]].push_back(seq.second[i]);
+            batch_bases[order[i]] += seq.second[i].end - seq.second[i].begin;
+        }
+    }
+    std::cerr << "[wfmash::estimate] sampled " << sampled << " of " << query_bases << " query bases, in "
+              << sampleBatches << " batches of fragments of " << fragment_length << " bp" << std::endl;
+
+    std::vector<Batch> batches;
+    for (const auto& fragments : batch_fragments) {
+        if (fragments.empty()) {
+            continue;
+        }
+        const std::string fasta = temp_file::create("wfmash-estimate-", ".fa");
+        const std::string mappings = temp_file::create("wfmash-estimate-", ".paf");
+        const std::string aligned = temp_file::create("wfmash-estimate-", ".paf");
+        const std::string output = temp_file::create("wfmash-estimate-", ".out");
+        Batch batch;
+        {
+            std::ofstream out(fasta);
+            for (const Fragment& f : fragments) {
+                hts_pos_t len = 0;
+                char* seq = faidx_fetch_seq64(fai, names[f.seq].c_str(), f.begin, f.end - 1, &len);
+                if (seq == nullptr || len <= 0) {
+                    std::cerr << "[wfmash::estimate] ERROR, failed to read " << names[f.seq] << " from " << query_file << std::endl;
+                    return 1;
+                }
+                out << '>' << names[f.seq] << '\n' << seq << '\n';
+                batch.bases += len;
+                free(seq);
+            }
+        }
+
+        skch::Parameters map = map_parameters;
+        map.querySequences.assign(1, fasta);
+        map.query_prefix.clear();
+        map.query_list.clear();
+        map.outFileName = mappings;
+        map.binary_output = false;
+        map.bgzf_output = false;
+        map.output_shards = 0;
+        map.sort_by.clear();
+        map.map_checkpoint_file.clear();
+        map.mapping_cache_file.clear();
+        double cpu = run_report::cpu_seconds();
+        {
+            skch::Map mapper(map, sketch);
+        }
+        batch.map_cpu = run_report::cpu_seconds() - cpu;
+
+        // every k-th mapping aligned, for at most alignedPerBatch of them
+        std::vector<std::string> lines;
+        {
+            std::ifstream in(mappings);
+            std::string line;
+            while (std::getline(in, line)) {
+                if (!line.empty()) {
+                    lines.push_back(line);
+                }
+            }
+        }
+        const size_t step = std::max<size_t>(1, (lines.size() + alignedPerBatch - 1) / alignedPerBatch);
+        {
+            std::ofstream out(aligned);
+            for (size_t i = 0; i < lines.size(); ++i) {
+                std::istringstream fields(lines[i]);
+                std::string name;
+                uint64_t length = 0, begin = 0, end = 0;
+                fields >> name >> length >> begin >> end;
+                batch.mapped_bases += end - begin;
+                if (i % step == 0) {
+                    out << lines[i] << '\n';
+                    batch.aligned_bases += end - begin;
+                }
+            }
+        }
+        batch.mappings = lines.size();
+
+        if (!approx_mapping && batch.aligned_bases > 0) {
+            align::Parameters align = align_parameters;
+            align.querySequences.assign(1, fasta);
+            align.mashmapPafFile = aligned;
+            align.pafOutputFile = output;
+            align.output_shards = 0;
+            align.sort_by.clear();
+            align.checkpoint_file.clear();
+            align.reuse_alignments_file.clear();
+            align.chunk_count = 1;
+            align.chunk_index = 0;
+            cpu = run_report::cpu_seconds();
+            {
+                align::Aligner aligner(align);
+                aligner.compute();
+            }
+            batch.align_cpu = run_report::cpu_seconds() - cpu;
+        }
+        batches.push_back(batch);
+
+        for (const std::string& file : {fasta, mappings, aligned, output}) {
+            temp_file::remove(file);
+        }
+        std::remove((fasta + ".fai").c_str());
+    }
+    fai_destroy(fai);
+
+    // rates per query base of each batch, times the query bases
+    std::vector<double> map_rate, mapping_rate, mapped_rate, align_rate;
+    for (const Batch& b : batches) {
+        map_rate.push_back(b.map_cpu / b.bases);
+        mapping_rate.push_back((double)b.mappings / b.bases);
+        mapped_rate.push_back((double)b.mapped_bases / b.bases);
+        // the alignment seconds of the mapped bases of the batch, from those of its sample
+        align_rate.push_back(b.aligned_bases > 0 ? b.align_cpu / b.aligned_bases * b.mapped_bases / b.bases : 0.0);
+    }
+    const Interval map_cpu = mean_interval(map_rate, query_bases);
+    const Interval align_cpu = mean_interval(align_rate, query_bases);
+    const auto wall = [](const Interval& cpu, int threads) {
+        return Interval{cpu.estimate / threads, cpu.low / threads, cpu.high / threads};
+    };
+    // the jobs of --plan cost their query bases, plus the bases of the smaller of their groups times this
+    const double smaller = std::min<double>(target_bases, query_bases);
+    const double plan_cost = map_cpu.estimate > 0 ? align_cpu.estimate / (map_cpu.estimate / query_bases) / smaller : 0.0;
+
+    std::cout << "#quantity\testimate\tlow_95\thigh_95\tunit" << std::endl;
+    const auto row = [](const char* name, const Interval& value, const char* unit) {
+        std::cout << name << '\t' << value.estimate << '\t' << value.low << '\t' << value.high << '\t' << unit << std::endl;
+    };
+    const auto exact = [&](const char* name, double value, const char* unit) {
+        row(name, Interval{value, value, value}, unit);
+    };
+    std::cout << std::fixed << std::setprecision(3);
+    exact("query_bases", query_bases, "bp");
+    exact("target_bases", target_bases, "bp");
+    exact("sampled_bases", sampled, "bp");
+    exact("index_minmers", sketch.minmerCount(), "minmers");
+    exact("index_seconds", index_seconds, "s");
+    exact("index_memory", index_rss_kb / 1024.0, "MB");
+    row("mappings", mean_interval(mapping_rate, query_bases), "mappings");
+    row("mapped_bases", mean_interval(mapped_rate, query_bases), "bp");
+    row("map_cpu_seconds", map_cpu, "s");
+    row("map_wall_seconds", wall(map_cpu, map_parameters.threads), "s");
+    if (!approx_mapping) {
+        row("align_cpu_seconds", align_cpu, "s");
+        row("align_wall_seconds", wall(align_cpu, align_parameters.threads), "s");
+        exact(planCostRow, plan_cost, "bp/bp");
+    }
+    std::cerr << "[wfmash::estimate] estimates from " << batches.size() << " batches, the wall times scaled from the CPU times by the threads"
+              << ", index_memory being the peak memory once the index is resident, the sample peaking at "
+              << run_report::peak_rss_kb() / 1024 << " MB" << std::endl;
+    return 0;
+}
+
+}
+
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+#include "map/include/map_parameters.hpp"
+#include "common/page_cache.hpp"
+
+namespace yeet {
+
+/**
+ * Warm-up mode: the index files of the run, those of each of its shards, are
+ * read into the page cache and their pages locked in memory, where they stay
+ * for as long as this process runs. The mapping jobs started on the node
+ * meanwhile read, and mmap, the index from memory; with
+ * --require-resident-index they fail at once rather than reading it cold.
+ *
+ * Locking needs a large enough RLIMIT_MEMLOCK (ulimit -l), or CAP_IPC_LOCK;
+ * without, the index is only read in, and may be evicted under memory pressure.
+ */
+namespace index_warmer {
+
+inline int warm(const skch::Parameters& map_parameters) {
+    std::vector<std::string> files;
+    if (map_parameters.index_shards == 1) {
+        files.push_back(map_parameters.indexFilename.string());
+    } else {
+        for (int shard = 0; shard < map_parameters.index_shards; ++shard) {
+            files.push_back(map_parameters.indexFilename.string() + "." + std::to_string(shard));
+        }
+    }
+
+    std::vector<std::unique_ptr<page_cache::Warm>> warmed;
+    bool all_locked = true;
+    for (const auto& file : files) {
+        warmed.emplace_back(new page_cache::Warm(file));
+        if (!warmed.back()->ok()) {
+            std::cerr << "[wfmash::warm-index] ERROR, could not read the index " << file
+                      << ", build it first with --create-index-only" << std::endl;
+            return 1;
+        }
+        all_locked = all_locked && warmed.back()->is_locked();
+        std::cerr << "[wfmash::warm-index] " << file << ": " << warmed.back()->bytes() << " bytes "
+                  << (warmed.back()->is_locked() ? "locked in memory" : "read into the page cache") << std::endl;
+    }
+    if (!all_locked) {
+        std::cerr << "[wfmash::warm-index] WARNING, the index could not be locked in memory, raise ulimit -l to keep it from being evicted" << std::endl;
+    }
+    std::cerr << "[wfmash::warm-index] index resident, holding it until killed" << std::endl;
+
+    // the pages stay locked until the process ends, on any signal
+    while (true) {
+        pause();
+    }
+    return 0;
+}
+
+}
+
+}
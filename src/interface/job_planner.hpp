@@ -0,0 +1,237 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <numeric>
+#include <queue>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace yeet {
+
+/**
+ * Plan of an all-vs-all run over PanSN groups of sequences as jobs for a
+ * cluster. The cost of mapping and aligning each query group on each target
+ * group is estimated from the sizes of their sequences in the .fai indexes,
+ * the pairs of each target group are packed into commands sharing the
+ * index of that target group, and the commands are spread over the jobs so
+ * that their estimated costs are balanced
+ */
+namespace job_planner {
+
+// Estimated cost of a target/query group pair, in bases: every query base
+// is mapped, and about the bases of the smaller group are aligned, a
+// base-level alignment costing many times the mapping of a base, unless
+// measured by --estimate
+const double alignCostPerBase = 16.0;
+
+// Commands a job is split in at least, the finer they are the better balanced the jobs
+const int commandsPerJob = 4;
+
+struct Group {
+    std::string prefix;     // -T/-Q prefix of the sequences of the group
+    uint64_t bases = 0;
+};
+
+struct Command {
+    size_t target;
+    std::vector<size_t> queries;
+    double cost = 0;
+};
+
+/**
+ * The groups of the sequences of the .fai of fileName: by PanSN genome (g),
+ * haplotype (h) or contig (c), sequences not in PanSN being groups of their own
+ */
+inline std::vector<Group> read_groups(const std::string& fileName, char grouping) {
+    std::ifstream fai(fileName + ".fai");
+    if (!fai) {
+        std::cerr << "[wfmash] ERROR, job_planner, no .fai index found for " << fileName << ", index it with samtools faidx." << std::endl;
+        exit(1);
+    }
+    std::vector<Group> groups;
+    std::map<std::string, size_t> index;
+    std::string line;
+    while (std::getline(fai, line)) {
+        std::istringstream fields(line);
+        std::string name;
+        uint64_t length = 0;
+        if (!std::getline(fields, name, '\t') || !(fields >> length)) {
+            continue;
+        }
+        std::string prefix = name;
+        if (grouping != 'c') {
+            const size_t genome_end = name.find('#');
+            const size_t haplotype_end = genome_end == std::string::npos ? std::string::npos : name.find('#', genome_end + 1);
+            const size_t end = grouping == 'g' ? genome_end : haplotype_end;
+            if (end != std::string::npos) {
+                prefix = name.substr(0, end + 1);
+            }
+        }
+        auto it = index.emplace(prefix, groups.size()).first;
+        if (it->second == groups.size()) {
+            groups.push_back(Group{prefix, 0});
+        }
+        groups[it->second].bases += length;
+    }
+    return groups;
+}
+
+inline std::string shell_quote(const std::string& arg) {
+    if (!arg.empty() && arg.find_first_not_of("abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_-+=.,:/@%#") == std::string::npos) {
+        return arg;
+    }
+    std::string quoted = "'";
+    for (char c : arg) {
+        quoted += c == '\'' ? std::string("'\\''") : std::string(1, c);
+    }
+    return quoted + "'";
+}
+
+/**
+ * Writes the plan of `jobs` jobs of the run of args, the command line
+ * without the plan options, to prefix.indexes.sh, the commands building the
+ * index of each target group, to run first, prefix.jobs.sh, one line per job
+ * running its commands one after the other, and prefix.manifest.tsv, the
+ * commands with their groups, estimated cost and output, whose outputs
+ * together make up those of the run. An existing index (mm_index) is shared
+ * by all of the commands, which then only split the queries. An aligned
+ * base costs alignCost mapped bases
+ */
+inline int plan(const std::vector<std::string>& args,
+                const std::string& target_file,
+                const std::string& query_file,
+                char grouping,
+                int jobs,
+                const std::string& prefix,
+                const std::string& mm_index,
+                bool approx_mapping,
+                bool sam_format,
+                double alignCost = alignCostPerBase) {
+    std::vector<Group> targets = read_groups(target_file, grouping);
+    const bool all_vs_all = query_file == target_file;
+    const std::vector<Group> queries = all_vs_all ? targets : read_groups(query_file, grouping);
+    const bool shared_index = !mm_index.empty();
+    if (shared_index) {
+        uint64_t bases = 0;
+        for (const auto& t : targets) {
+            bases += t.bases;
+        }
+        targets.assign(1, Group{"", bases});
+    }
+
+    // the pairs of each target group, packed in commands of at most a fraction of a job's share of the total cost
+    const double align_cost = approx_mapping ? 0.0 : alignCost;
+    std::vector<std::vector<std::pair<double, size_t>>> pairs(targets.size());
+    double total = 0;
+    for (size_t t = 0; t < targets.size(); ++t) {
+        for (size_t q = 0; q < queries.size(); ++q) {
+            if (!shared_index && all_vs_all && targets[t].prefix == queries[q].prefix) {
+                continue;
+            }
+            const double cost = queries[q].bases + align_cost * std::min(targets[t].bases, queries[q].bases);
+            pairs[t].emplace_back(cost, q);
+            total += cost;
+        }
+    }
+    const double share = total / (jobs * commandsPerJob);
+    std::vector<Command> commands;
+    for (size_t t = 0; t < targets.size(); ++t) {
+        std::sort(pairs[t].rbegin(), pairs[t].rend());
+        const size_t first = commands.size();
+        for (const auto& pair : pairs[t]) {
+            // first fit, decreasing
+            size_t c = first;
+            while (c < commands.size() && commands[c].cost + pair.first > share) {
+                ++c;
+            }
+            if (c == commands.size()) {
+                commands.push_back(Command{t, {}, 0});
+            }
+            commands[c].queries.push_back(pair.second);
+            commands[c].cost += pair.first;
+        }
+    }
+
+    // the longest commands first, each to the job with the least cost so far
+    std::vector<size_t> order(commands.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return commands[a].cost > commands[b].cost;
+    });
+    using Load = std::pair<double, int>;
+    std::priority_queue<Load, std::vector<Load>, std::greater<Load>> loads;
+    for (int j = 0; j < jobs; ++j) {
+        loads.emplace(0.0, j);
+    }
+    std::vector<std::vector<size_t>> job_commands(jobs);
+    std::vector<double> job_costs(jobs, 0.0);
+    for (size_t c : order) {
+        const Load load = loads.top();
+        loads.pop();
+        job_commands[load.second].push_back(c);
+        job_costs[load.second] += commands[c].cost;
+        loads.emplace(job_costs[load.second], load.second);
+    }
+
+    std::string base;
+    for (const auto& arg : args) {
+        base += shell_quote(arg) + " ";
+    }
+    const auto index_file = [&](size_t t) {
+        return prefix + ".target" + std::to_string(t) + ".idx";
+    };
+    const std::string extension = approx_mapping || !sam_format ? ".paf" : ".sam";
+
+    std::ofstream indexes(prefix + ".indexes.sh");
+    std::ofstream job_lines(prefix + ".jobs.sh");
+    std::ofstream manifest(prefix + ".manifest.tsv");
+    if (!indexes || !job_lines || !manifest) {
+        std::cerr << "[wfmash] ERROR, job_planner, could not write the plan files of " << prefix << std::endl;
+        exit(1);
+    }
+    if (shared_index && !std::ifstream(mm_index)) {
+        indexes << base << "--create-index-only\n";
+    }
+    for (size_t t = 0; !shared_index && t < targets.size(); ++t) {
+        indexes << base << "-T " << shell_quote(targets[t].prefix) << " --mm-index " << shell_quote(index_file(t))
+                << " --create-index-only\n";
+    }
+    manifest << "#job\tcommand\ttarget_group\tquery_groups\testimated_cost\toutput\n";
+    int command_id = 0;
+    for (int j = 0; j < jobs; ++j) {
+        std::string line;
+        for (size_t c : job_commands[j]) {
+            const Command& command = commands[c];
+            std::string query_prefixes;
+            for (size_t q : command.queries) {
+                query_prefixes += (query_prefixes.empty() ? "" : ",") + queries[q].prefix;
+            }
+            const std::string output = prefix + "." + std::to_string(command_id) + extension;
+            line += (line.empty() ? "" : " && ") + base
+                + (shared_index ? std::string() : "-T " + shell_quote(targets[command.target].prefix) + " ")
+                + "-Q " + shell_quote(query_prefixes)
+                + (shared_index ? std::string() : " --mm-index " + shell_quote(index_file(command.target)))
+                + " > " + shell_quote(output);
+            manifest << j << '\t' << command_id << '\t' << (shared_index ? "*" : targets[command.target].prefix)
+                     << '\t' << query_prefixes << '\t' << uint64_t(command.cost) << '\t' << output << '\n';
+            ++command_id;
+        }
+        job_lines << (line.empty() ? "true" : line) << '\n';
+    }
+
+    const auto extremes = std::minmax_element(job_costs.begin(), job_costs.end());
+    std::cerr << "[wfmash] planned " << commands.size() << " commands over " << jobs << " jobs in " << prefix
+              << ".jobs.sh, estimated job costs from " << uint64_t(*extremes.first) << " to " << uint64_t(*extremes.second)
+              << ", after building the indexes of " << prefix << ".indexes.sh, if any"
+              << "; the outputs listed in " << prefix << ".manifest.tsv together make up those of the run" << std::endl;
+    return 0;
+}
+
+}
+
+}
@@ -11,14 +11,21 @@
 #include <chrono>
 #include <functional>
 #include <cstdio>
+#include <memory>
+#include <thread>
 
 #include "map/include/map_parameters.hpp"
 #include "map/include/base_types.hpp"
 #include "map/include/winSketch.hpp"
 #include "map/include/computeMap.hpp"
 #include "map/include/parseCmdArgs.hpp"
+#include "map/include/mappingQueue.hpp"
 
 #include "interface/parse_args.hpp"
+#include "interface/server.hpp"
+#include "interface/batch.hpp"
+#include "interface/index_warmer.hpp"
+#include "interface/estimator.hpp"
 
 #include "align/include/align_parameters.hpp"
 #include "align/include/computeAlignments.hpp"
@@ -29,6 +36,11 @@
 //External includes
 #include "common/args.hxx"
 #include "common/ALeS.hpp"
+#include "common/run_report.hpp"
+#include "common/hot_counters.hpp"
+#include "common/trace.hpp"
+#include "common/metrics.hpp"
+#include "common/memory_accounting.hpp"
 
 int main(int argc, char** argv) {
     /*
@@ -43,6 +55,68 @@ int main(int argc, char** argv) {
     yeet::Parameters yeet_parameters;
     yeet::parse_args(argc, argv, map_parameters, align_parameters, yeet_parameters);
 
+    if (yeet_parameters.plan_jobs > 0) {
+        return yeet::job_planner::plan(yeet_parameters.plan_args,
+                                       map_parameters.refSequences.front(), map_parameters.querySequences.front(),
+                                       yeet_parameters.plan_grouping, yeet_parameters.plan_jobs, yeet_parameters.plan_prefix,
+                                       map_parameters.indexFilename, yeet_parameters.approx_mapping, align_parameters.sam_format,
+                                       yeet_parameters.plan_estimate.empty() ? yeet::job_planner::alignCostPerBase
+                                           : yeet::estimator::read_plan_cost(yeet_parameters.plan_estimate));
+    }
+
+    if (yeet_parameters.warm_index) {
+        return yeet::index_warmer::warm(map_parameters);
+    }
+
+    if (!yeet_parameters.report_json.empty()) {
+        run_report::Report::get().open(yeet_parameters.report_json);
+    }
+    if (!yeet_parameters.stats_file.empty()) {
+        hot_counters::Registry::get().open(yeet_parameters.stats_file);
+    }
+    if (!yeet_parameters.trace_file.empty()) {
+        trace::Trace::get().open(yeet_parameters.trace_file);
+    }
+    progress_meter::log_interval_seconds = yeet_parameters.progress_log;
+    // made before the handler is registered, so that it outlives it
+    memory_accounting::Registry::get();
+    std::atexit([]() { memory_accounting::Registry::get().log(); });
+    if (!yeet_parameters.metrics_file.empty()) {
+        metrics::Exporter::get().open(yeet_parameters.metrics_file, yeet_parameters.metrics_interval);
+    }
+
+    // the workers of the stages on CPUs of their own when they overlap, else both from the first one
+    if (yeet_parameters.pin_threads) {
+        const std::vector<int> cpus = tasks::allowedCpus();
+        if (!cpus.empty()) {
+            const size_t align_first = yeet_parameters.stream_mappings ? map_parameters.threads % cpus.size() : 0;
+            tasks::stageCpus(tasks::Stage::Map).assign(cpus.begin(), cpus.end());
+            tasks::stageCpus(tasks::Stage::Align).assign(cpus.begin() + align_first, cpus.end());
+            tasks::stageCpus(tasks::Stage::Align).insert(tasks::stageCpus(tasks::Stage::Align).end(),
+                                                         cpus.begin(), cpus.begin() + align_first);
+        }
+    }
+
+    // mappings given by the queue, if any, else read from align_parameters.mashmapPafFile
+    const auto align_mappings = [&](skch::MappingQueue* mappings) {
+        auto t0 = skch::Time::now();
+        align::Aligner alignObj(align_parameters);
+        std::chrono::duration<double> timeRefRead = skch::Time::now() - t0;
+        std::cerr << "[wfmash::align] time spent loading the reference index: " << timeRefRead.count() << " sec" << std::endl;
+
+        //Compute the alignments
+        if (mappings != nullptr) {
+            alignObj.compute(*mappings);
+        } else {
+            alignObj.compute();
+        }
+
+        std::chrono::duration<double> timeAlign = skch::Time::now() - t0;
+        std::cerr << "[wfmash::align] time spent computing the alignment: " << timeAlign.count() << " sec" << std::endl;
+
+        std::cerr << "[wfmash::align] alignment results saved in: " << align_parameters.pafOutputFile << std::endl;
+    };
+
     //parameters.refSequences.push_back(ref);
 
     //skch::parseandSave(argc, argv, cmd, parameters);
@@ -52,40 +126,124 @@ int main(int argc, char** argv) {
         auto t0 = skch::Time::now();
 
         if (map_parameters.use_spaced_seeds) {
-          std::cerr << "[wfmash::map] Generating spaced seeds" << std::endl;
-          uint32_t seed_weight = map_parameters.spaced_seed_params.weight;
-          uint32_t seed_count = map_parameters.spaced_seed_params.seed_count;
-          float similarity = map_parameters.spaced_seed_params.similarity;
-          uint32_t region_length = map_parameters.spaced_seed_params.region_length;
-
-          ales::spaced_seeds sps = ales::generate_spaced_seeds(seed_weight, seed_count, similarity, region_length);
-          std::chrono::duration<double> time_spaced_seeds = skch::Time::now() - t0;
-          std::cerr << "[wfmash::map] Time spent generating spaced seeds " << time_spaced_seeds.count()  << " seconds" << std::endl;
-          map_parameters.spaced_seed_sensitivity = sps.sensitivity;
-          map_parameters.spaced_seeds =  sps.seeds;
-          ales::printSpacedSeeds(map_parameters.spaced_seeds);
-          std::cerr << "[wfmash::map] Spaced seed sensitivity " << sps.sensitivity << std::endl;
+          skch::Sketch::loadSpacedSeeds(map_parameters);
         }
 
-        //Build the sketch for reference
-        skch::Sketch referSketch(map_parameters);
+        //The sequences read by the mapping stage are kept for the alignment, rather than read
+        //again, with --in-memory-seqs or when they fit in the --max-memory budget
+        const bool align_after = !yeet_parameters.approx_mapping && !yeet_parameters.stream_mappings
+            && yeet_parameters.serve_address.empty() && yeet_parameters.batch_manifest.empty() && yeet_parameters.estimate == 0;
+        if (align_after && !align_parameters.in_memory_sequences && map_parameters.max_memory > 0) {
+            const std::string& target = align_parameters.refSequences.front();
+            const std::string& query = align_parameters.querySequences.front();
+            const uint64_t target_bases = align::SequenceStore::indexedBases(target);
+            const uint64_t query_bases = query == target ? 0 : align::SequenceStore::indexedBases(query);
+            align_parameters.in_memory_sequences = target_bases <= (uint64_t)map_parameters.max_memory
+                && query_bases <= (uint64_t)map_parameters.max_memory - target_bases;
+        }
+        if (align_after && align_parameters.in_memory_sequences) {
+            map_parameters.keep_sequence = [](const std::string& file, const std::string& name, const std::string& seq) {
+                align::SequenceStore::keep(file, name, seq);
+            };
+        }
 
-        std::chrono::duration<double> timeRefSketch = skch::Time::now() - t0;
-        std::cerr << "[wfmash::map] time spent computing the reference index: " << timeRefSketch.count() << " sec" << std::endl;
+        //With index shards, they ignore the seeds frequent over all of them, as a single index would
+        ankerl::unordered_dense::set<skch::hash_t> shardedFrequentSeeds;
+        const bool countsShardedSeeds = map_parameters.index_shards > 1 && skch::Sketch::sketchesAnyShard(map_parameters);
+        if (countsShardedSeeds) {
+            shardedFrequentSeeds = skch::Sketch::frequentSeedsOfShards(map_parameters);
+        }
 
-        if (referSketch.minmerIndex.size() == 0)
-        {
-            std::cerr << "[wfmash::map] ERROR, reference sketch is empty. Reference sequences shorter than the segment length are not indexed" << std::endl;
-            return 1;
+        //The shards in the order they are mapped against. With the hypergeometric filter, once for
+        //the best L1 hits of each query, then for its candidates in reverse order, the last shard
+        //being kept in memory, see skch::ShardedMapping
+        std::vector<std::pair<skch::ShardedMapping::Pass, int>> shardSteps;
+        const bool bestsPass = map_parameters.index_shards > 1 && map_parameters.stage1_topANI_filter
+            && !map_parameters.create_index_only;
+        for (int shard = 0; bestsPass && shard < map_parameters.index_shards; ++shard) {
+            shardSteps.emplace_back(skch::ShardedMapping::Pass::Bests, shard);
         }
+        for (int i = 0; i < map_parameters.index_shards; ++i) {
+            shardSteps.emplace_back(skch::ShardedMapping::Pass::Candidates, bestsPass ? map_parameters.index_shards - 1 - i : i);
+        }
+        skch::ShardedMapping sharded;
+
+        //When streaming, alignment runs alongside mapping on the mappings reported so far
+        std::unique_ptr<skch::MappingQueue> mappingQueue;
+        std::thread streamingAligner;
 
-        //Map the sequences in query file
-        t0 = skch::Time::now();
+        std::unique_ptr<skch::Sketch> referSketch;
+        std::chrono::duration<double> timeRefSketch(0);
+        for (size_t step = 0; step < shardSteps.size(); ++step) {
+            const int shard = shardSteps[step].second;
+            if (referSketch == nullptr || referSketch->getShard() != shard) {
+                //Build the sketch for reference
+                referSketch.reset();
+                t0 = skch::Time::now();
+                run_report::StageTimer indexTimer("index", map_parameters.threads);
+                referSketch.reset(new skch::Sketch(map_parameters, shard, countsShardedSeeds ? &shardedFrequentSeeds : nullptr));
+                indexTimer.count("shard", shard);
+                indexTimer.count("targets", referSketch->metadata.size());
+                indexTimer.count("minmers", referSketch->minmerCount());
+                indexTimer.stop();
 
-        skch::Map mapper = skch::Map(map_parameters, referSketch);
+                timeRefSketch = skch::Time::now() - t0;
+                std::cerr << "[wfmash::map] time spent computing the reference index";
+                if (map_parameters.index_shards > 1) {
+                    std::cerr << " shard " << shard + 1 << "/" << map_parameters.index_shards;
+                }
+                std::cerr << ": " << timeRefSketch.count() << " sec" << std::endl;
+            }
 
-        std::chrono::duration<double> timeMapQuery = skch::Time::now() - t0;
-        std::cerr << "[wfmash::map] time spent mapping the query: " << timeMapQuery.count() << " sec" << std::endl;
+            if (map_parameters.create_index_only) {
+                // only reached for the shards before the last one
+                continue;
+            }
+
+            // a single shard may legitimately hold no sequence long enough to be indexed
+            if (referSketch->minmerCount() == 0 && map_parameters.index_shards == 1)
+            {
+                std::cerr << "[wfmash::map] ERROR, reference sketch is empty. Reference sequences shorter than the segment length are not indexed" << std::endl;
+                return 1;
+            }
+
+            if (!yeet_parameters.serve_address.empty()) {
+                return yeet::server::serve(yeet_parameters.serve_address, map_parameters, align_parameters,
+                                           yeet_parameters.approx_mapping, *referSketch);
+            }
+
+            if (!yeet_parameters.batch_manifest.empty()) {
+                return yeet::batch::run(yeet_parameters.batch_manifest, map_parameters, align_parameters,
+                                        yeet_parameters.approx_mapping, *referSketch);
+            }
+
+            if (yeet_parameters.estimate > 0) {
+                return yeet::estimator::estimate(map_parameters, align_parameters, yeet_parameters.approx_mapping,
+                                                 *referSketch, timeRefSketch.count(), yeet_parameters.estimate);
+            }
+
+            //Map the sequences in query file
+            t0 = skch::Time::now();
+
+            if (yeet_parameters.stream_mappings) {
+                mappingQueue.reset(new skch::MappingQueue());
+                align::printCmdOptions(align_parameters);
+                streamingAligner = std::thread([&]() { align_mappings(mappingQueue.get()); });
+            }
+
+            sharded.start(shardSteps[step].first, step + 1 == shardSteps.size());
+            skch::Map mapper = skch::Map(map_parameters, *referSketch, nullptr,
+                                         map_parameters.index_shards > 1 ? &sharded : nullptr, mappingQueue.get());
+
+            std::chrono::duration<double> timeMapQuery = skch::Time::now() - t0;
+            std::cerr << "[wfmash::map] time spent mapping the query: " << timeMapQuery.count() << " sec" << std::endl;
+        }
+
+        if (mappingQueue) {
+            mappingQueue->close();
+            streamingAligner.join();
+            return 0;
+        }
         std::cerr << "[wfmash::map] mapping results saved in: " << map_parameters.outFileName << std::endl;
 
         if (yeet_parameters.approx_mapping) {
@@ -94,18 +252,6 @@ int main(int argc, char** argv) {
      }
 
     align::printCmdOptions(align_parameters);
-
-    auto t0 = skch::Time::now();
-    align::Aligner alignObj(align_parameters);
-    std::chrono::duration<double> timeRefRead = skch::Time::now() - t0;
-    std::cerr << "[wfmash::align] time spent loading the reference index: " << timeRefRead.count() << " sec" << std::endl;
-
-    //Compute the alignments
-    alignObj.compute();
-
-    std::chrono::duration<double> timeAlign = skch::Time::now() - t0;
-    std::cerr << "[wfmash::align] time spent computing the alignment: " << timeAlign.count() << " sec" << std::endl;
-
-    std::cerr << "[wfmash::align] alignment results saved in: " << align_parameters.pafOutputFile << std::endl;
+    align_mappings(nullptr);
 
 }
@@ -12,7 +12,10 @@
 #include "align/include/align_parameters.hpp"
 
 #include "interface/temp_file.hpp"
+#include "interface/job_planner.hpp"
 #include "common/utils.hpp"
+#include "common/seqiter.hpp"
+#include "common/output_writer.hpp"
 
 #include "wfmash_git_version.hpp"
 
@@ -26,6 +29,23 @@ namespace yeet {
 struct Parameters {
     bool approx_mapping = false;
     bool remapping = false;
+    bool stream_mappings = false;   // align mappings as the mapping stage reports them
+    int plan_jobs = 0;              // jobs to plan the run as instead of running it, 0 to run it
+    char plan_grouping = 'h';       // PanSN level of the groups of sequences of the plan: g, h or c
+    std::string plan_prefix;        // prefix of the files of the plan
+    std::vector<std::string> plan_args;   // command line of the run, without the plan options
+    std::string serve_address;      // socket the query batches are served on, with the index resident, empty to run once
+    std::string batch_manifest;     // query sets mapped one after the other with the index resident, empty to run once
+    bool pin_threads = false;       // pin the worker threads of each stage to CPUs of their own
+    std::string report_json;        // JSON report of the times and resources of each stage, empty for none
+    std::string stats_file;         // TSV of the counts of work done in the hot paths, empty for none
+    std::string trace_file;         // Chrome trace events of the spans of each thread, empty for none
+    double progress_log = 0;        // seconds between the lines of the progress log, 0 to redraw the progress in place
+    std::string metrics_file;       // Prometheus text file of the live metrics of the run, empty for none
+    double metrics_interval = 15;   // seconds between the writes of the metrics
+    bool warm_index = false;        // read the index into the page cache and keep it locked there instead of running
+    double estimate = 0;            // fraction of the query bases sampled to estimate the cost of the run instead of running, 0 to run
+    std::string plan_estimate;      // estimates of --estimate weighing the alignment in the costs of --plan, empty for the default
     //bool align_input_paf = false;
 };
 
@@ -48,7 +68,7 @@ int64_t handy_parameter(const std::string& value) {
     }
 
     const std::string tmp = value.substr(0, str_len);
-    return is_a_float(tmp) ? (int)(stof(tmp) * pow(10, exp)) : -1;
+    return is_a_float(tmp) ? (int64_t)(stof(tmp) * pow(10, exp)) : -1;
 }
 
 void parse_args(int argc,
@@ -65,7 +85,7 @@ void parse_args(int argc,
     args::Positional<std::string> target_sequence_file(mandatory_opts, "target", "alignment target/reference sequence file");
 
     args::Group io_opts(parser, "[ Files IO Options ]");
-    args::Positional<std::string> query_sequence_file(io_opts, "query", "query sequence file (optional)");
+    args::Positional<std::string> query_sequence_file(io_opts, "query", "query sequence file (optional), - or a pipe to stream the queries in with -m");
 
     args::Group mapping_opts(parser, "[ Mapping Options ]");
     args::ValueFlag<float> map_pct_identity(mapping_opts, "%", "percent identity in the mashmap step [default: 70]", {'p', "map-pct-id"});
@@ -75,9 +95,15 @@ void parse_args(int argc,
     args::ValueFlag<uint32_t> num_mappings_for_short_seq(mapping_opts, "N", "number of mappings to retain for each query/reference pair where the query sequence is shorter than segment length [default: 1]", {'S', "num-mappings-for-short-seq"});
     args::ValueFlag<int> kmer_size(mapping_opts, "N", "kmer size [default: 15]", {'k', "kmer"});
     args::ValueFlag<float> kmer_pct_threshold(mapping_opts, "%", "ignore the top % most-frequent kmers [default: 0.001]", {'H', "kmer-threshold"});
+    args::Flag kmer_freq_sketch(mapping_opts, "", "spot the most-frequent kmers with a count-min sketch while indexing, to avoid holding their positions in memory", {"kmer-freq-sketch"});
+    args::Flag rolling_kmer_hash(mapping_opts, "", "hash kmers with a rolling 2-bit encoding, faster than murmur3 but incompatible with indexes built without it (k <= 32)", {"rolling-kmer-hash"});
+    args::Flag pack_queries(mapping_opts, "", "hold query sequences at 2 bits per base while mapping, best with --rolling-kmer-hash which hashes the packed bases directly", {"pack-queries"});
+    args::ValueFlag<int> open_syncmers(mapping_opts, "S", "sample only open syncmers with s-mers of this size, 1/(k-s+1) of kmers spread along the sequence, to shrink the index", {"open-syncmers"});
     args::Flag lower_triangular(mapping_opts, "", "only map shorter sequences against longer", {'L', "lower-triangular"});
     args::Flag skip_self(mapping_opts, "", "skip self mappings when the query and target name is the same (for all-vs-all mode)", {'X', "skip-self"});
     args::Flag one_to_one(mapping_opts, "", "Perform one-to-one filtering", {'4', "one-to-one"});
+    args::ValueFlag<std::string> one_to_one_mem(mapping_opts, "N", "with -4, hold up to N bytes of mappings in memory, spilling sorted runs of them to temporary files past it [default: no limit]", {"one-to-one-mem"});
+    args::ValueFlag<std::string> max_memory(mapping_opts, "N", "read in queries to map only while their estimated memory and the mappings held back fit in N bytes, not counting the reference index; with -4, half of it goes to the held mappings unless --one-to-one-mem is set [default: no limit]", {"max-memory"});
     args::ValueFlag<char> skip_prefix(mapping_opts, "C", "skip mappings when the query and target have the same prefix before the last occurrence of the given character C", {'Y', "skip-prefix"});
     args::ValueFlag<std::string> target_prefix(mapping_opts, "pfx", "use only targets whose names start with this prefix", {'T', "target-prefix"});
     args::ValueFlag<std::string> target_list(mapping_opts, "FILE", "file containing list of target sequence names to use", {'R', "target-list"});
@@ -86,29 +112,49 @@ void parse_args(int argc,
     args::Flag approx_mapping(mapping_opts, "approx-map", "skip base-level alignment, producing an approximate mapping in PAF", {'m',"approx-map"});
     args::Flag no_split(mapping_opts, "no-split", "disable splitting of input sequences during mapping [default: enabled]", {'N',"no-split"});
     args::ValueFlag<std::string> chain_gap(mapping_opts, "N", "chain mappings closer than this distance in query and target, sets approximate maximum variant length detectable in alignment [default: 30k]", {'c', "chain-gap"});
+    args::Flag sparse_chain(mapping_opts, "", "chain mappings by co-linear sparse dynamic programming, in O(n log n), rather than each to its closest successor", {"sparse-chain"});
     args::ValueFlag<std::string> max_mapping_length(mapping_opts, "N", "maximum length of a single mapping before breaking (inf to unset) [default: 50k]", {'P', "max-mapping-length"});
     args::Flag drop_low_map_pct_identity(mapping_opts, "K", "drop mappings with estimated identity below --map-pct-id=%", {'K', "drop-low-map-id"});
     args::ValueFlag<double> overlap_threshold(mapping_opts, "F", "drop mappings overlapping more than fraction F with a higher scoring mapping [default: 0.5]", {'O', "overlap-threshold"});
     args::Flag no_filter(mapping_opts, "MODE", "disable mapping filtering", {'f', "no-filter"});
     args::ValueFlag<double> map_sparsification(mapping_opts, "FACTOR", "keep this fraction of mappings", {'x', "sparsify-mappings"});
+    args::Flag sparsify_pairs(mapping_opts, "", "with -x, keep this fraction of the pairs of query (or query prefix with -Y) and target sequence, decided before mapping so that the others are never mapped", {"sparsify-pairs"});
     //ToFix: args::Flag keep_ties(mapping_opts, "", "keep all mappings with equal score even if it results in more than n mappings", {'D', "keep-ties"});
     args::ValueFlag<int64_t> sketch_size(mapping_opts, "N", "sketch size for sketching.", {'w', "sketch-size"});
     args::ValueFlag<double> kmer_complexity(mapping_opts, "F", "Drop segments w/ predicted kmer complexity below this cutoff. Kmer complexity defined as #kmers / (s - k + 1)", {'J', "kmer-complexity"});
+    args::ValueFlag<std::string> max_seed_points(mapping_opts, "N", "Drop the most frequent seeds of a query fragment until the reference hits of the others are at most N, bounding the cost of repeats [default: no cap]", {"max-seed-hits"});
     args::Flag no_hg_filter(mapping_opts, "", "Don't use the hypergeometric filtering and instead use the MashMap2 first pass filtering.", {'1', "no-hg-filter"});
     args::ValueFlag<double> hg_filter_ani_diff(mapping_opts, "%", "Filter out mappings unlikely to be this ANI less than the best mapping [default: 0.0]", {'2', "hg-filter-ani-diff"});
     args::ValueFlag<double> hg_filter_conf(mapping_opts, "%", "Confidence value for the hypergeometric filtering [default: 99.9%]", {'3', "hg-filter-conf"});
+    args::ValueFlag<std::string> hg_cache_dir(mapping_opts, "DIR", "cache the hypergeometric filter cutoffs and the spaced seeds of each setting in DIR, for later runs to reuse [default: only within the run]", {"cache-dir", "hg-cache-dir"});
     //args::Flag window_minimizers(mapping_opts, "", "Use window minimizers rather than world minimizers", {'U', "window-minimizers"});
     //args::ValueFlag<std::string> path_high_frequency_kmers(mapping_opts, "FILE", " input file containing list of high frequency kmers", {'H', "high-freq-kmers"});
-    //args::ValueFlag<std::string> spaced_seed_params(mapping_opts, "spaced-seeds", "Params to generate spaced seeds <weight_of_seed> <number_of_seeds> <similarity> <region_length> e.g \"10 5 0.75 20\"", {'e', "spaced-seeds"});
+    args::ValueFlag<std::string> spaced_seed_params(mapping_opts, "spaced-seeds", "Params to generate spaced seeds <weight_of_seed> <number_of_seeds> <similarity> <region_length> e.g \"10 5 0.75 20\"", {'e', "spaced-seeds"});
     args::Flag no_merge(mapping_opts, "no-merge", "don't merge consecutive segment-level mappings", {'M', "no-merge"});
     args::ValueFlag<std::string> mashmap_index(mapping_opts, "FILE", "Use MashMap index in FILE, create if it doesn't exist", {"mm-index"});
     args::Flag create_mashmap_index_only(mapping_opts, "create-index-only", "Create only the index file without performing mapping", {"create-index-only"});
     args::Flag overwrite_mashmap_index(mapping_opts, "overwrite-mm-index", "Overwrite MashMap index if it exists", {"overwrite-mm-index"});
+    args::Flag freeze_mashmap_index(mapping_opts, "frozen-index", "Freeze the index once built or loaded, looking seeds up through a minimal perfect hash", {"frozen-index"});
+    args::Flag compress_mashmap_index(mapping_opts, "compressed-index", "Keep the seed positions of the index delta and varint encoded, for lower memory at some lookup cost", {"compressed-index"});
+    args::Flag numa_interleave(mapping_opts, "numa-interleave", "Interleave the pages of the index over the NUMA nodes, for multi-socket servers", {"numa-interleave"});
+    args::Flag huge_pages(mapping_opts, "huge-pages", "Back the index with transparent huge pages, for large indexes where seed lookups are TLB-bound", {"huge-pages"});
+    args::Flag require_resident_index(mapping_opts, "require-resident-index", "Fail at once unless the --mm-index FILE is already wholly in the page cache, as left by --warm-index", {"require-resident-index"});
+    args::ValueFlag<std::string> map_checkpoint_file(mapping_opts, "FILE", "with -m, keep the progress of the mapping in FILE every few minutes, resuming from it if it exists; the output has to be a file, appended to (>>) when resuming", {"map-checkpoint"});
+    args::ValueFlag<int> target_prefilter(mapping_opts, "N", "map each query only on the targets sharing at least N seeds with it in contig-level sketches, which the index keeps, skipping the lookups of its fragments against the others (for all-vs-all runs over many diverse contigs) [default: all targets]", {"target-prefilter"});
+    args::ValueFlag<int> coarse_level(mapping_opts, "N", "look the seeds of each fragment of a query at least 4*N segments long up only in the target regions its window of N segments hits in a coarse level of the index, of N times sparser seeds (for chromosome-to-chromosome mapping) [default: off]", {"coarse-level"});
+    args::ValueFlag<std::string> mapping_cache_file(mapping_opts, "FILE", "keep the mappings of each query on each target group (-Y) in FILE across runs, replaying those of the queries and targets that did not change instead of mapping them again", {"mapping-cache"});
+    args::Flag dedup_queries(mapping_opts, "", "map each byte-identical query sequence once, outputting its mappings under the names of its copies, in input order (for collections with duplicated contigs)", {"dedup-queries"});
+    args::Flag append_mashmap_index(mapping_opts, "append-mm-index", "Add the target sequences missing from an existing MashMap index to it; the indexed targets must come first, in the same order", {"append-mm-index"});
+    args::ValueFlag<int> index_shards(mapping_opts, "N", "split the target index into N shards held in memory one at a time, with the mappings of a single index; the queries are mapped against each shard twice, or once with -1; with --mm-index, shards are saved as FILE.0 ... FILE.N-1 [default: 1]", {"index-shards"});
 
     args::Group alignment_opts(parser, "[ Alignment Options ]");
-    args::ValueFlag<std::string> align_input_paf(alignment_opts, "FILE", "derive precise alignments for this input PAF", {'i', "input-paf"});
+    args::ValueFlag<std::string> align_input_paf(alignment_opts, "FILE", "derive precise alignments for this input PAF, or binary mapping file as kept with -Z", {'i', "input-paf"});
+    args::Flag stream_mappings(alignment_opts, "", "align the mappings of each query as soon as they are made, overlapping mapping and alignment (not with -4 or --index-shards > 1, which need all the mappings first)", {"stream-mappings"});
     args::Flag force_biwfa_alignment(alignment_opts, "force-biwfa", "force alignment with biWFA for all sequence pairs", {'I', "force-biwfa"});
-    args::ValueFlag<uint16_t> wflambda_segment_length(alignment_opts, "N", "wflambda segment length: size (in bp) of segment mapped in hierarchical WFA problem [default: 256]", {'W', "wflamda-segment"});
+    args::ValueFlag<float> align_min_identity(alignment_opts, "%", "drop the alignments with a gap-compressed identity below this percentage [default: 0, keep all]", {"min-identity"});
+    args::Flag screen_identity(alignment_opts, "", "estimate the identity of each mapping from its k-mers before aligning it, dropping those clearly below --min-identity without aligning them", {"screen-identity"});
+    args::Flag seed_anchors(alignment_opts, "", "carry the seeds each mapping shares with its target from the mapping stage to the aligner, which skips the wflambda segment pairs far from their chain (not with --stream-mappings)", {"seed-anchors"});
+    args::ValueFlag<std::string> wflambda_segment_length(alignment_opts, "N", "wflambda segment length: size (in bp) of segment mapped in hierarchical WFA problem, or 'auto' to pick it and the WFlign heuristic thresholds of each mapping from its estimated identity and length [default: 256]", {'W', "wflamda-segment"});
     args::ValueFlag<std::string> wfa_score_params(alignment_opts, "mismatch,gap1,ext1",
 												  "score parameters for the wfa alignment (affine); match score is fixed at 0 [default: 2,3,1]",
 												  {"wfa-params"});
@@ -129,6 +175,27 @@ void parse_args(int argc,
     args::ValueFlag<int> wflign_erode_k(alignment_opts, "N", "maximum length of match/mismatch islands to erode before patching [default: adaptive]", {'E', "erode-match-mismatch"});
     args::ValueFlag<int> wflign_min_inv_patch_len(alignment_opts, "N", "minimum length of inverted patch for output [default: 23]", {'V', "min-inv-len"});
     args::ValueFlag<int> wflign_max_patching_score(alignment_opts, "N", "maximum score allowed when patching [default: adaptive with respect to gap penalties and sequence length]", {"max-patching-score"});
+    args::ValueFlag<std::string> fetch_cache(alignment_opts, "N", "keep up to N bases of bgzipped or remote inputs for the sequence fetches of neighbouring mappings, 0 to disable [default: 256M]", {"fetch-cache"});
+    args::ValueFlag<int> prefetch_threads(alignment_opts, "N", "fetch the sequence regions of the upcoming mappings into the fetch cache on N threads ahead of their alignment, for inputs with slow fetches such as s3:// or https:// ones [default: 8 for remote inputs, 0 otherwise]", {"prefetch-threads"});
+    args::Flag readahead(alignment_opts, "", "have the kernel read the regions of the upcoming mappings of indexed local inputs ahead, all at once, for inputs on high-latency storage such as network filesystems", {"readahead"});
+    args::ValueFlag<std::string> alignment_cache(alignment_opts, "N", "keep up to N bytes of alignments to reuse them for byte-identical pairs of query and target windows, as with duplicated contigs (PAF output only) [default: 0, disabled; 1G with --align-cache-file]", {"align-cache"});
+    args::ValueFlag<std::string> alignment_cache_file(alignment_opts, "FILE", "read the alignment cache from FILE if it exists, and write it back to it at the end, to reuse it across runs", {"align-cache-file"});
+    args::Flag reciprocal_dedup(alignment_opts, "", "in all-vs-all runs, output the mapping B to A of a region whose mapping A to B is aligned already as that alignment inverted, instead of aligning it again (PAF output without --md-tag only); which direction is aligned depends on timing", {"reciprocal-dedup"});
+    args::ValueFlag<std::string> reuse_alignments(alignment_opts, "FILE", "output the records of FILE, the PAF output of a previous run with this option, for the mappings with the same coordinates and alignment parameters instead of aligning them again, and align only the others; the records are tagged with the key of their mapping (rk:Z) for the next run (PAF output only)", {"reuse-alignments"});
+    args::Flag in_memory_sequences(alignment_opts, "", "load the target and query sequences in memory once, aligning windows in place rather than fetching each of them (for all-vs-all jobs, which touch every sequence many times)", {"in-memory-seqs"});
+    args::ValueFlag<std::string> reorder_window(alignment_opts, "N", "align each N mappings grouped by target and position, for locality of the sequence fetches, writing them back in input order [default: input order]", {"reorder-window"});
+    args::ValueFlag<std::string> in_flight_bytes(alignment_opts, "N", "dispatch mappings to align only while the sequences of those being aligned and the alignments not written yet fit in N bytes, a larger mapping being aligned alone [default: 1G]", {"in-flight-bytes"});
+    args::Flag longest_first(alignment_opts, "", "align the mappings with the highest estimated cost, from their length and identity, first within each reorder window [default window: 4096]", {"longest-first"});
+    args::ValueFlag<std::string> align_chunk(alignment_opts, "i/N", "align only chunk i, from 0 to N-1, of N chunks of the mappings of similar estimated cost, the same on every node, to split the alignment of a shared mapping file over nodes", {"chunk"});
+    args::ValueFlag<std::string> align_chunk_length(alignment_opts, "N", "align mappings longer than 2*N as chunks of about N query bases on parallel threads, stitched back at a shared match (PAF output without --md-tag or --score-only only) [default: align each mapping whole]", {"align-chunk"});
+    args::ValueFlag<std::string> anchor_min_run(alignment_opts, "N", "take the co-linear exact matches of at least N bases (N >= 1k) of each mapping as they are, aligning only the pieces between them (PAF output without --md-tag or --score-only only) [default: align each mapping whole]", {"anchor-runs"});
+    args::ValueFlag<std::string> wfa_max_memory(alignment_opts, "N", "cap the memory of each WFA aligner of a thread at N bytes, aligning the wflambda segments in linear memory when they would not fit it; alignments still over it fail [default: no limit]", {"wfa-max-memory"});
+    args::ValueFlag<int> biwfa_threads(alignment_opts, "N", "align each mapping run through biWFA on up to N threads, solving the two halves of the longest ones on threads of their own (for single huge alignments) [default: 1]", {"biwfa-threads"});
+    args::Flag wfa_stats(alignment_opts, "", "report the WFA steps, extensions, longest wavefront, peak memory and time in compute, extend and backtrace of the alignments at the end", {"wfa-stats"});
+    args::ValueFlag<std::string> wfa_stats_tsv(alignment_opts, "FILE", "write the WFA statistics of each aligned record to FILE in TSV format", {"wfa-stats-tsv"});
+    args::ValueFlag<double> capture_slow(alignment_opts, "N", "keep each alignment taking over N seconds as a self-contained replay bundle (its sequences and settings) in --capture-dir, for wfmash-bench --replay to align it again", {"capture-slow"});
+    args::ValueFlag<std::string> capture_dir(alignment_opts, "DIR", "directory of the bundles of --capture-slow [default: wfmash-slow]", {"capture-dir"});
+    args::ValueFlag<std::string> checkpoint_file(alignment_opts, "FILE", "keep the progress of the alignment of -i in FILE every few minutes, resuming from it if it exists; the output has to be a file, appended to (>>) when resuming", {"checkpoint"});
 
     args::Group output_opts(parser, "[ Output Format Options ]");
     // format parameters
@@ -136,21 +203,52 @@ void parse_args(int argc,
     // sam format
     args::Flag sam_format(output_opts, "N", "output in the SAM format (PAF by default)", {'a', "sam-format"});
     args::Flag no_seq_in_sam(output_opts, "N", "do not fill the sequence field in the SAM format", {'q', "no-seq-in-sam"});
+    args::Flag score_only(output_opts, "", "output PAF records with the alignment score (as:i) and identities but without their CIGAR, which is not made", {"score-only"});
+    args::Flag bgzf_output(output_opts, "", "compress the output in the BGZF format, so that it can be indexed, with -t compression threads", {"bgzf"});
+    args::Flag bam_output(output_opts, "", "output the SAM records as BAM, compressed with -t threads (implies -a)", {"bam"});
+    args::Flag cram_output(output_opts, "", "output the SAM records as CRAM against the target sequences, which need a .fai index, compressed with -t threads (implies -a)", {"cram"});
+    args::Flag unordered_output(output_opts, "", "write the mappings and alignments of each query as soon as they are done, instead of in input order, so that slow queries don't hold back the others", {"unordered-output"});
+    args::Flag deterministic_output(output_opts, "", "write the mappings and alignments in input order, the same whatever the number of threads, reordering those done ahead of a slow query in a window rather than waiting on it [alignments past 256 MB held are spilled to a temporary file]", {"deterministic-output"});
+    args::ValueFlag<int> output_shards(output_opts, "N", "split the output over N files, PREFIX.i.paf (or .sam, .gz with --bgzf), each written by a thread of its own", {"output-shards"});
+    args::ValueFlag<std::string> shard_prefix(output_opts, "PREFIX", "prefix of the files of --output-shards [default: wfmash]", {"shard-prefix"});
+    args::ValueFlag<std::string> report_json(output_opts, "FILE", "write the wall and CPU times, peak memory, thread use and throughput of each stage of the run to FILE in JSON", {"report-json"});
+    args::ValueFlag<std::string> stats_file(output_opts, "FILE", "write the counts of seeds, interval points, candidates, mappings through each filter, wflambda cells, patches, inversion attempts and bytes fetched to FILE in TSV format", {"stats"});
+    args::ValueFlag<std::string> trace_file(output_opts, "FILE", "write a timeline of the queries mapped and of the fetch, alignment and writing of each record, by thread, to FILE as Chrome trace events in JSON, for Perfetto", {"trace"});
+    args::ValueFlag<std::string> metrics_file(output_opts, "FILE", "write live metrics of the run (progress, throughput and queue depth of each stage, busy workers, memory, hot path counts) to FILE in the Prometheus text format, for the textfile collector of node_exporter", {"metrics"});
+    args::ValueFlag<double> metrics_interval(output_opts, "N", "write the --metrics every N seconds [default: 15]", {"metrics-interval"});
+    args::ValueFlag<std::string> shard_by(output_opts, "KEY", "records in the same file of --output-shards: those of a query, target, query-sample or target-sample, the PanSN sample being the name up to its first '#' [default: query]", {"shard-by"});
+    args::ValueFlag<std::string> sorted_output(output_opts, "FILE", "write the PAF output to FILE sorted by --sort-by name and start, BGZF compressed, with a tabix index alongside (FILE.tbi, or FILE.csi past 512 Mbp)", {"sorted-output"});
+    args::ValueFlag<std::string> sort_by(output_opts, "KEY", "records of --sorted-output sorted by target or query coordinates [default: target]", {"sort-by"});
 
     args::Group general_opts(parser, "[ General Options ]");
     args::ValueFlag<std::string> tmp_base(general_opts, "PATH", "base name for temporary files [default: `pwd`]", {'B', "tmp-base"});
     args::Flag keep_temp_files(general_opts, "", "keep intermediate files", {'Z', "keep-temp"});
+    args::ValueFlag<std::string> tmp_memory(general_opts, "N", "put the intermediate mapping file in memory-backed storage (a tmpfs such as /dev/shm) if it has N bytes free, else under -B", {"tmp-in-memory"});
+    args::Flag tmp_compress(general_opts, "", "compress the intermediate mapping file with fast BGZF compression, for large mapping sets on slow storage", {"tmp-compress"});
+    args::ValueFlag<std::string> serve(general_opts, "SOCKET", "keep the target index resident and map, and align, the batches of queries sent to the Unix socket SOCKET, or to the TCP port SOCKET of localhost if a number, sending back the output of each", {"serve"});
+    args::ValueFlag<std::string> batch(general_opts, "FILE", "map, and align, each query set of the manifest FILE against the target index, built or loaded once, one set after the other; a line of FILE is a query file and its output file separated by a tab", {"batch"});
+    args::Flag warm_index(general_opts, "warm-index", "instead of running, read the --mm-index FILE (all of its shards) into the page cache and lock it in memory, holding it there until killed, for the jobs of the node to load it at once, e.g. with --require-resident-index", {"warm-index"});
+    args::ValueFlag<double> progress_log(general_opts, "N", "log the progress every N seconds as a line of fields (stage, bp and records per second since the last line, tasks in flight) rather than redrawing it in place, for logs that aren't a terminal", {"progress-log"});
+    args::ValueFlag<int> plan_jobs(general_opts, "N", "instead of running, plan the run as N cluster jobs of balanced cost estimated from the .fai indexes, written to PREFIX.indexes.sh, PREFIX.jobs.sh and PREFIX.manifest.tsv", {"plan"});
+    args::ValueFlag<std::string> plan_group(general_opts, "L", "group the sequences of --plan by PanSN genome (g), haplotype (h) or contig (c) [default: h]", {"plan-group"});
+    args::ValueFlag<std::string> plan_estimate(general_opts, "FILE", "weigh the alignment in the costs of --plan as measured by --estimate, whose output is FILE", {"plan-estimate"});
+    args::Flag estimate(general_opts, "", "instead of running, build or load the index, map and align a random sample of query fragments, and write the estimated index size, mapping time, mapping count and alignment time of the run, with 95% intervals, to stdout in TSV", {"estimate"});
+    args::ValueFlag<double> estimate_fraction(general_opts, "F", "fraction of the query bases sampled by --estimate [default: 0.01]", {"estimate-fraction"});
+    args::ValueFlag<std::string> plan_prefix(general_opts, "PREFIX", "prefix of the files of --plan and of the outputs of its jobs [default: wfmash-plan]", {"plan-prefix"});
 
-#ifdef WFA_PNG_TSV_TIMING
     args::Group debugging_opts(parser, "[ Debugging Options ]");
-    args::ValueFlag<std::string> prefix_wavefront_info_in_tsv(parser, "PREFIX", " write wavefronts' information for each alignment in TSV format files with this PREFIX", {'G', "tsv"});
-    args::ValueFlag<std::string> prefix_wavefront_plot_in_png(parser, "PREFIX", " write wavefronts' plot for each alignment in PNG format files with this PREFIX", {'u', "prefix-png"});
-    args::ValueFlag<uint64_t> wfplot_max_size(parser, "N", "max size of the wfplot [default: 1500]", {'z', "wfplot-max-size"});
-    args::ValueFlag<std::string> path_patching_info_in_tsv(parser, "FILE", " write patching information for each alignment in TSV format in FILE", {"path-patching-tsv"});
-#endif
+    args::ValueFlag<std::string> prefix_wavefront_info_in_tsv(debugging_opts, "PREFIX", "write the wflambda cells of each diagnosed alignment in TSV format to a file of its own with this PREFIX", {'G', "tsv"});
+    args::ValueFlag<std::string> prefix_wavefront_plot_in_png(debugging_opts, "PREFIX", "write plots of the wavefronts of each diagnosed alignment in PNG format to files with this PREFIX", {'u', "prefix-png"});
+    args::ValueFlag<uint64_t> wfplot_max_size(debugging_opts, "N", "max size of the wfplot [default: 1500]", {'z', "wfplot-max-size"});
+    args::ValueFlag<std::string> path_patching_info_in_tsv(debugging_opts, "FILE", "write the patches of each diagnosed alignment in TSV format to FILE", {"path-patching-tsv"});
+    args::ValueFlag<uint64_t> diagnostics_every(debugging_opts, "N", "diagnose one of each N alignments (or of each N slow ones with --diagnostics-slower-than) with --tsv, --prefix-png and --path-patching-tsv [default: 1]", {"diagnostics-every"});
+    args::ValueFlag<double> diagnostics_slower_than(debugging_opts, "S", "diagnose only the alignments taking over S seconds, aligning them again with the diagnostics on [default: all]", {"diagnostics-slower-than"});
 
     args::Group threading_opts(parser, "[ Threading ]");
-    args::ValueFlag<int> thread_count(threading_opts, "N", "use this many threads during parallel steps", {'t', "threads"});
+    args::ValueFlag<int> thread_count(threading_opts, "N", "use this many threads during parallel steps; with --stream-mappings, the mapping and alignment threads together", {'t', "threads"});
+    args::ValueFlag<int> map_threads(threading_opts, "N", "threads of the mapping stage [default: -t, or a quarter of -t with --stream-mappings]", {"map-threads"});
+    args::ValueFlag<int> align_threads(threading_opts, "N", "threads of the alignment stage [default: -t, or what --map-threads leaves of -t with --stream-mappings]", {"align-threads"});
+    args::Flag pin_threads(threading_opts, "", "pin each thread of the mapping and alignment stages to a CPU, on CPUs of their own with --stream-mappings, for reproducible timings", {"pin-threads"});
 
     args::Group program_info_opts(parser, "[ Program Information ]");
     args::Flag version(program_info_opts, "version", "show version number and github commit hash", {'v', "version"});
@@ -222,8 +320,14 @@ void parse_args(int argc,
     map_parameters.referenceSize = skch::CommonFunc::getReferenceSize(map_parameters.refSequences);
 
     if (query_sequence_file) {
-        map_parameters.querySequences.push_back(args::get(query_sequence_file));
-        align_parameters.querySequences.push_back(args::get(query_sequence_file));
+        const std::string query_file = args::get(query_sequence_file) == "-" ? "/dev/stdin" : args::get(query_sequence_file);
+        map_parameters.querySequences.push_back(query_file);
+        align_parameters.querySequences.push_back(query_file);
+        // Mapped in one pass, but the alignment fetches the queries again through their index
+        if (seqiter::is_stream(query_file) && !args::get(approx_mapping)) {
+            std::cerr << "[wfmash] ERROR, skch::parseandSave, queries from stdin or a pipe can only be mapped (-m), their alignment needs an indexed file." << std::endl;
+            exit(1);
+        }
     }
 
 	if (target_sequence_file && map_parameters.querySequences.empty()
@@ -255,6 +359,31 @@ void parse_args(int argc,
         }
     }
 
+    if (one_to_one_mem) {
+        const int64_t m = wfmash::handy_parameter(args::get(one_to_one_mem));
+        if (m <= 0) {
+            std::cerr << "[wfmash] ERROR, skch::parseandSave, --one-to-one-mem has to be a float value greater than 0." << std::endl;
+            exit(1);
+        }
+        map_parameters.onetoone_mem_budget = m;
+    } else {
+        map_parameters.onetoone_mem_budget = 0;
+    }
+
+    if (max_memory) {
+        const int64_t m = wfmash::handy_parameter(args::get(max_memory));
+        if (m <= 0) {
+            std::cerr << "[wfmash] ERROR, skch::parseandSave, --max-memory has to be a float value greater than 0." << std::endl;
+            exit(1);
+        }
+        map_parameters.max_memory = m;
+        if (map_parameters.filterMode == skch::filter::ONETOONE && !one_to_one_mem) {
+            map_parameters.onetoone_mem_budget = m / 2;
+        }
+    } else {
+        map_parameters.max_memory = 0;
+    }
+
     if (map_sparsification) {
         if (args::get(map_sparsification) == 1) {
             // overflows
@@ -267,6 +396,7 @@ void parse_args(int argc,
         map_parameters.sparsity_hash_threshold
             = std::numeric_limits<uint64_t>::max();
     }
+    map_parameters.sparsify_pairs = args::get(sparsify_pairs);
 
     if (!args::get(wfa_score_params).empty()) {
         const std::vector<std::string> params_str = skch::CommonFunc::split(args::get(wfa_score_params), ',');
@@ -366,8 +496,29 @@ void parse_args(int argc,
     }
 
     align_parameters.emit_md_tag = args::get(emit_md_tag);
-    align_parameters.sam_format = args::get(sam_format);
+    align_parameters.sam_format = args::get(sam_format) || args::get(bam_output) || args::get(cram_output);
+    align_parameters.bgzf_output = args::get(bgzf_output);
+    align_parameters.bam_output = args::get(bam_output);
+    align_parameters.cram_output = args::get(cram_output);
+    if ((args::get(bam_output) || args::get(cram_output))
+        && (args::get(bgzf_output) || args::get(approx_mapping) || (args::get(bam_output) && args::get(cram_output)))) {
+        std::cerr << "[wfmash] ERROR, skch::parseandSave, --bam and --cram are alignment outputs of their own, not to be combined with each other, --bgzf or -m." << std::endl;
+        exit(1);
+    }
+    align_parameters.unordered_output = args::get(unordered_output);
+    map_parameters.unordered_output = args::get(unordered_output);
+    if (args::get(deterministic_output) && args::get(unordered_output)) {
+        std::cerr << "[wfmash] ERROR, skch::parseandSave, --deterministic-output and --unordered-output are exclusive." << std::endl;
+        exit(1);
+    }
+    align_parameters.deterministic_output = args::get(deterministic_output);
+    map_parameters.deterministic_output = args::get(deterministic_output);
     align_parameters.no_seq_in_sam = args::get(no_seq_in_sam);
+    align_parameters.score_only = args::get(score_only);
+    if (args::get(score_only) && (align_parameters.sam_format || args::get(emit_md_tag))) {
+        std::cerr << "[wfmash] ERROR, skch::parseandSave, --score-only writes PAF records without CIGAR, not to be combined with -a, --bam, --cram or -d." << std::endl;
+        exit(1);
+    }
     align_parameters.force_biwfa_alignment = args::get(force_biwfa_alignment);
     map_parameters.split = !args::get(no_split);
     map_parameters.dropRand = false;//ToFix: !args::get(keep_ties);
@@ -429,6 +580,8 @@ void parse_args(int argc,
         align_parameters.chain_gap = 30000;
     }
 
+    map_parameters.sparse_chaining = sparse_chain;
+
     if (max_mapping_length) {
         const int64_t l = args::get(max_mapping_length) == "inf" ? std::numeric_limits<int64_t>::max()
             : wfmash::handy_parameter(args::get(max_mapping_length));
@@ -476,43 +629,69 @@ void parse_args(int argc,
     } else {
         map_parameters.kmer_pct_threshold = 0.001; // in percent! so we keep 99.999% of kmers
     }
+    map_parameters.kmer_freq_sketch = kmer_freq_sketch;
+    map_parameters.rolling_hash = rolling_kmer_hash;
+    map_parameters.pack_queries = pack_queries;
+    if (map_parameters.rolling_hash && map_parameters.kmerSize > 32) {
+        std::cerr << "[wfmash] ERROR, skch::parseandSave, --rolling-kmer-hash supports kmer sizes up to 32." << std::endl;
+        exit(1);
+    }
 
-    //if (spaced_seed_params) {
-        //const std::string foobar = args::get(spaced_seed_params);
-
-        //// delimeters can be full colon (:) or a space
-        //char delimeter;
-        //if (foobar.find(' ') !=  std::string::npos) {
-            //delimeter = ' ';
-        //} else if (foobar.find(':') !=  std::string::npos) {
-            //delimeter = ':';
-        //} else {
-            //std::cerr << "[wfmash] ERROR, skch::parseandSave, wfmash expects either space or : for to seperate spaced seed params." << std::endl;
-            //exit(1);
-        //}
-
-        //const std::vector<std::string> p = skch::CommonFunc::split(foobar, delimeter);
-        //if (p.size() != 4) {
-            //std::cerr << "[wfmash] ERROR, skch::parseandSave, there should be four arguments for spaced seeds." << std::endl;
-            //exit(1);
-        //}
-
-        //const uint32_t seed_weight   = stoi(p[0]);
-        //const uint32_t seed_count    = stoi(p[1]);
-        //const float similarity       = stof(p[2]);
-        //const uint32_t region_length = stoi(p[3]);
-
-        //// Generate an ALeS params struct
-        //map_parameters.use_spaced_seeds = true;
-        //map_parameters.spaced_seed_params = skch::ales_params{seed_weight, seed_count, similarity, region_length};
-        //map_parameters.kmerSize = (int) seed_weight;
-    //} else {
-        //map_parameters.use_spaced_seeds = false;
-    //}
-    map_parameters.use_spaced_seeds = false;
+    if (open_syncmers) {
+        map_parameters.sampling_scheme = skch::sampling::OPEN_SYNCMER;
+        map_parameters.syncmer_size = args::get(open_syncmers);
+    } else {
+        map_parameters.sampling_scheme = skch::sampling::BOTTOM_SKETCH;
+        map_parameters.syncmer_size = 0;
+    }
+
+    if (spaced_seed_params) {
+        const std::string seed_params = args::get(spaced_seed_params);
+
+        // delimiters can be full colon (:) or a space
+        char delimiter;
+        if (seed_params.find(' ') !=  std::string::npos) {
+            delimiter = ' ';
+        } else if (seed_params.find(':') !=  std::string::npos) {
+            delimiter = ':';
+        } else {
+            std::cerr << "[wfmash] ERROR, skch::parseandSave, wfmash expects either space or : for to separate spaced seed params." << std::endl;
+            exit(1);
+        }
+
+        const std::vector<std::string> p = skch::CommonFunc::split(seed_params, delimiter);
+        if (p.size() != 4) {
+            std::cerr << "[wfmash] ERROR, skch::parseandSave, there should be four arguments for spaced seeds." << std::endl;
+            exit(1);
+        }
+
+        const uint32_t seed_weight   = stoi(p[0]);
+        const uint32_t seed_count    = stoi(p[1]);
+        const float similarity       = stof(p[2]);
+        const uint32_t region_length = stoi(p[3]);
+        if (region_length > 32) {
+            std::cerr << "[wfmash] ERROR, skch::parseandSave, spaced seeds support region lengths up to 32." << std::endl;
+            exit(1);
+        }
+
+        // Generate an ALeS params struct
+        map_parameters.use_spaced_seeds = true;
+        map_parameters.spaced_seed_params = skch::ales_params{seed_weight, seed_count, similarity, region_length};
+        map_parameters.kmerSize = (int) seed_weight;
+    } else {
+        map_parameters.use_spaced_seeds = false;
+    }
 
     align_parameters.kmerSize = map_parameters.kmerSize;
 
+    if (map_parameters.sampling_scheme == skch::sampling::OPEN_SYNCMER) {
+        const int span = map_parameters.use_spaced_seeds ? (int) map_parameters.spaced_seed_params.region_length : map_parameters.kmerSize;
+        if (map_parameters.syncmer_size <= 0 || map_parameters.syncmer_size >= span || map_parameters.syncmer_size > 32) {
+            std::cerr << "[wfmash] ERROR, skch::parseandSave, --open-syncmers needs an s-mer size between 1 and min(k - 1, 32)." << std::endl;
+            exit(1);
+        }
+    }
+
 
 //    if (path_high_frequency_kmers && !args::get(path_high_frequency_kmers).empty()) {
 //        std::ifstream high_freq_kmers (args::get(path_high_frequency_kmers));
@@ -531,11 +710,38 @@ void parse_args(int argc,
 //    }
 
     align_parameters.min_identity = 0; // disabled
+    if (align_min_identity) {
+        if (args::get(align_min_identity) < 0 || args::get(align_min_identity) > 100) {
+            std::cerr << "[wfmash] ERROR, skch::parseandSave, --min-identity is a percentage, between 0 and 100." << std::endl;
+            exit(1);
+        }
+        align_parameters.min_identity = args::get(align_min_identity) / 100.0; // scale to [0,1]
+    }
+    align_parameters.screen_identity = args::get(screen_identity);
+    if (align_parameters.screen_identity && align_parameters.min_identity == 0) {
+        std::cerr << "[wfmash] ERROR, skch::parseandSave, --screen-identity needs a --min-identity to screen against." << std::endl;
+        exit(1);
+    }
+    align_parameters.seed_anchors = args::get(seed_anchors);
 
+    align_parameters.wflambda_segment_length = 256;
+    align_parameters.wflign_auto = false;
     if (wflambda_segment_length) {
-        align_parameters.wflambda_segment_length = args::get(wflambda_segment_length);
-    } else {
-        align_parameters.wflambda_segment_length = 256;
+        if (args::get(wflambda_segment_length) == "auto") {
+            align_parameters.wflign_auto = true;
+            // thresholds not given are picked with the segment length
+            if (!wflign_min_wavefront_length) {
+                align_parameters.wflign_min_wavefront_length = 0;
+            }
+        } else {
+            const int64_t segment_length = std::atoll(args::get(wflambda_segment_length).c_str());
+            if (segment_length <= 0 || segment_length > std::numeric_limits<uint16_t>::max()) {
+                std::cerr << "[wfmash] ERROR, skch::parseandSave, wflambda segment length must be 'auto' or between 1 and "
+                          << std::numeric_limits<uint16_t>::max() << "." << std::endl;
+                exit(1);
+            }
+            align_parameters.wflambda_segment_length = segment_length;
+        }
     }
 
     if (wflign_max_len_major) {
@@ -594,6 +800,147 @@ void parse_args(int argc,
     // if aligner exhaustion is a problem, we could enable this
     align_parameters.multithread_fasta_input = false;
 
+    if (fetch_cache) {
+        const int64_t n = wfmash::handy_parameter(args::get(fetch_cache));
+        if (n < 0) {
+            std::cerr << "[wfmash] ERROR, skch::parseandSave, --fetch-cache has to be a value of at least 0." << std::endl;
+            exit(1);
+        }
+        align_parameters.fetch_cache_bytes = n;
+    } else {
+        align_parameters.fetch_cache_bytes = 256000000;
+    }
+
+    if (prefetch_threads) {
+        if (args::get(prefetch_threads) < 0) {
+            std::cerr << "[wfmash] ERROR, skch::parseandSave, --prefetch-threads has to be a value of at least 0." << std::endl;
+            exit(1);
+        }
+        align_parameters.prefetch_threads = args::get(prefetch_threads);
+    } else {
+        align_parameters.prefetch_threads = -1;
+    }
+    align_parameters.readahead = args::get(readahead);
+
+    if (alignment_cache) {
+        const int64_t n = wfmash::handy_parameter(args::get(alignment_cache));
+        if (n < 0) {
+            std::cerr << "[wfmash] ERROR, skch::parseandSave, --align-cache has to be a value of at least 0." << std::endl;
+            exit(1);
+        }
+        align_parameters.alignment_cache_bytes = n;
+    } else {
+        align_parameters.alignment_cache_bytes = alignment_cache_file ? 1000000000 : 0;
+    }
+    align_parameters.alignment_cache_file = alignment_cache_file ? args::get(alignment_cache_file) : "";
+    align_parameters.reciprocal_dedup = args::get(reciprocal_dedup);
+    align_parameters.in_memory_sequences = args::get(in_memory_sequences);
+
+    if (reorder_window) {
+        const int64_t n = wfmash::handy_parameter(args::get(reorder_window));
+        if (n <= 0) {
+            std::cerr << "[wfmash] ERROR, skch::parseandSave, --reorder-window has to be a value greater than 0." << std::endl;
+            exit(1);
+        }
+        align_parameters.reorder_window = n;
+    } else {
+        align_parameters.reorder_window = 0;
+    }
+    if (in_flight_bytes) {
+        const int64_t n = wfmash::handy_parameter(args::get(in_flight_bytes));
+        if (n <= 0) {
+            std::cerr << "[wfmash] ERROR, skch::parseandSave, --in-flight-bytes has to be a value greater than 0." << std::endl;
+            exit(1);
+        }
+        align_parameters.in_flight_bytes = n;
+    } else {
+        align_parameters.in_flight_bytes = uint64_t(1) << 30;
+    }
+    align_parameters.longest_first = args::get(longest_first);
+    align_parameters.chunk_index = 0;
+    align_parameters.chunk_count = 1;
+    if (align_chunk) {
+        const std::string chunk = args::get(align_chunk);
+        const size_t slash = chunk.find('/');
+        char* end = nullptr;
+        const long index = slash != std::string::npos ? std::strtol(chunk.c_str(), &end, 10) : -1;
+        const long count = end == chunk.c_str() + slash ? std::strtol(chunk.c_str() + slash + 1, &end, 10) : 0;
+        if (count < 1 || *end != '\0' || index < 0 || index >= count) {
+            std::cerr << "[wfmash] ERROR, skch::parseandSave, --chunk has to be i/N, with i from 0 to N-1." << std::endl;
+            exit(1);
+        }
+        align_parameters.chunk_index = index;
+        align_parameters.chunk_count = count;
+    }
+
+    if (align_chunk_length) {
+        const int64_t n = wfmash::handy_parameter(args::get(align_chunk_length));
+        if (n <= 0) {
+            std::cerr << "[wfmash] ERROR, skch::parseandSave, --align-chunk has to be a value greater than 0." << std::endl;
+            exit(1);
+        }
+        align_parameters.align_chunk_length = n;
+    } else {
+        align_parameters.align_chunk_length = 0;
+    }
+
+    if (anchor_min_run) {
+        const int64_t n = wfmash::handy_parameter(args::get(anchor_min_run));
+        if (n < 1000) {
+            std::cerr << "[wfmash] ERROR, skch::parseandSave, --anchor-runs has to be a value of at least 1k." << std::endl;
+            exit(1);
+        }
+        align_parameters.anchor_min_run = n;
+    } else {
+        align_parameters.anchor_min_run = 0;
+    }
+
+    if (wfa_max_memory) {
+        const int64_t m = wfmash::handy_parameter(args::get(wfa_max_memory));
+        if (m <= 0) {
+            std::cerr << "[wfmash] ERROR, skch::parseandSave, --wfa-max-memory has to be a float value greater than 0." << std::endl;
+            exit(1);
+        }
+        align_parameters.wfa_max_memory = m;
+    } else {
+        align_parameters.wfa_max_memory = 0;
+    }
+
+    if (biwfa_threads) {
+        if (args::get(biwfa_threads) < 1) {
+            std::cerr << "[wfmash] ERROR, skch::parseandSave, --biwfa-threads has to be an integer value of at least 1." << std::endl;
+            exit(1);
+        }
+        align_parameters.biwfa_threads = args::get(biwfa_threads);
+    } else {
+        align_parameters.biwfa_threads = 1;
+    }
+
+    if (capture_slow) {
+        if (args::get(capture_slow) <= 0) {
+            std::cerr << "[wfmash] ERROR, skch::parseandSave, --capture-slow needs a positive number of seconds." << std::endl;
+            exit(1);
+        }
+        align_parameters.capture_slow_seconds = args::get(capture_slow);
+    } else {
+        align_parameters.capture_slow_seconds = 0;
+    }
+    align_parameters.capture_dir = capture_dir ? args::get(capture_dir) : "wfmash-slow";
+
+    align_parameters.wfa_stats = args::get(wfa_stats);
+    align_parameters.wfa_stats_tsv = wfa_stats_tsv ? args::get(wfa_stats_tsv) : "";
+
+    if (checkpoint_file) {
+        if (!align_input_paf || args::get(bgzf_output) || args::get(bam_output) || args::get(cram_output)
+            || args::get(unordered_output)) {
+            std::cerr << "[wfmash] ERROR, skch::parseandSave, --checkpoint needs -i and an uncompressed output in input order, without --bgzf, --bam, --cram or --unordered-output." << std::endl;
+            exit(1);
+        }
+        align_parameters.checkpoint_file = args::get(checkpoint_file);
+    } else {
+        align_parameters.checkpoint_file = "";
+    }
+
     // Compute optimal window size for sketching
     {
         const int64_t ss = sketch_size && args::get(sketch_size) >= 0 ? args::get(sketch_size) : -1;
@@ -613,6 +960,38 @@ void parse_args(int argc,
         map_parameters.kmerComplexityThreshold = 0;
     }
 
+    if (max_seed_points) {
+        const int64_t n = wfmash::handy_parameter(args::get(max_seed_points));
+        if (n <= 0) {
+            std::cerr << "[wfmash] ERROR, skch::parseandSave, --max-seed-hits has to be a value greater than 0." << std::endl;
+            exit(1);
+        }
+        // each hit opens and closes a window in the interval points
+        map_parameters.max_seed_points = 2 * n;
+    } else {
+        map_parameters.max_seed_points = 0;
+    }
+
+    if (target_prefilter) {
+        if (args::get(target_prefilter) <= 0) {
+            std::cerr << "[wfmash] ERROR, skch::parseandSave, --target-prefilter has to be a value greater than 0." << std::endl;
+            exit(1);
+        }
+        map_parameters.target_prefilter = args::get(target_prefilter);
+    } else {
+        map_parameters.target_prefilter = 0;
+    }
+
+    if (coarse_level) {
+        if (args::get(coarse_level) < 2) {
+            std::cerr << "[wfmash] ERROR, skch::parseandSave, --coarse-level has to be a value of at least 2." << std::endl;
+            exit(1);
+        }
+        map_parameters.coarse_level = args::get(coarse_level);
+    } else {
+        map_parameters.coarse_level = 0;
+    }
+
     map_parameters.filterLengthMismatches = true;
 
     map_parameters.stage1_topANI_filter = !bool(no_hg_filter); 
@@ -634,6 +1013,13 @@ void parse_args(int argc,
         map_parameters.ANIDiffConf = skch::fixed::ANIDiffConf;
     }
 
+    if (hg_cache_dir)
+    {
+        map_parameters.cache_dir = args::get(hg_cache_dir);
+    } else {
+        map_parameters.cache_dir = "";
+    }
+
     //if (window_minimizers) {
         //map_parameters.world_minimizers = false;
     //} else {
@@ -649,9 +1035,33 @@ void parse_args(int argc,
 
     map_parameters.overwrite_index = overwrite_mashmap_index;
     map_parameters.create_index_only = create_mashmap_index_only;
+    map_parameters.append_index = append_mashmap_index;
+    map_parameters.freeze_index = freeze_mashmap_index;
+    map_parameters.compress_index = compress_mashmap_index;
+    map_parameters.numa_interleave = numa_interleave;
+    map_parameters.huge_pages = huge_pages;
+    map_parameters.require_resident_index = require_resident_index;
+    if (require_resident_index && (!mashmap_index || overwrite_mashmap_index || append_mashmap_index || create_mashmap_index_only)) {
+        std::cerr << "[wfmash] ERROR, skch::parseandSave, --require-resident-index needs an existing --mm-index to load, without --overwrite-mm-index, --append-mm-index or --create-index-only." << std::endl;
+        exit(1);
+    }
+
+    if (index_shards) {
+        if (args::get(index_shards) < 1) {
+            std::cerr << "[wfmash] ERROR, skch::parseandSave, the number of index shards must be at least 1." << std::endl;
+            exit(1);
+        }
+        map_parameters.index_shards = args::get(index_shards);
+    } else {
+        map_parameters.index_shards = 1;
+    }
 
+    map_parameters.binary_output = false;
+    map_parameters.seed_anchors = false;
+    map_parameters.bgzf_output = false;
     if (approx_mapping) {
         map_parameters.outFileName = "/dev/stdout";
+        map_parameters.bgzf_output = args::get(bgzf_output);
         yeet_parameters.approx_mapping = true;
     } else {
         yeet_parameters.approx_mapping = false;
@@ -674,15 +1084,123 @@ void parse_args(int argc,
             yeet_parameters.remapping = true;
             map_parameters.outFileName = args::get(align_input_paf);
             align_parameters.mashmapPafFile = args::get(align_input_paf);
+        } else if (stream_mappings && map_parameters.filterMode != skch::filter::ONETOONE
+                   && map_parameters.index_shards == 1 && !map_parameters.create_index_only) {
+            // mappings go straight to the aligner, through memory
+            yeet_parameters.stream_mappings = true;
+            map_parameters.outFileName = "";
+            align_parameters.mashmapPafFile = "";
         } else {
-            // make a temporary mapping file
-            map_parameters.outFileName = temp_file::create();
+            if (stream_mappings) {
+                std::cerr << "[wfmash] WARNING, skch::parseandSave, --stream-mappings is ignored with -4, --index-shards or --create-index-only, mappings are aligned after mapping ends." << std::endl;
+            }
+            map_parameters.seed_anchors = align_parameters.seed_anchors;
+            // make a temporary mapping file, in the binary format as only we read it, in memory if asked and there is room
+            std::string memory_dir;
+            if (tmp_memory) {
+                const int64_t n = wfmash::handy_parameter(args::get(tmp_memory));
+                if (n < 0) {
+                    std::cerr << "[wfmash] ERROR, skch::parseandSave, --tmp-in-memory has to be a value of at least 0." << std::endl;
+                    exit(1);
+                }
+                memory_dir = temp_file::memory_dir(n);
+                if (memory_dir.empty()) {
+                    std::cerr << "[wfmash] WARNING, skch::parseandSave, no memory-backed storage with " << args::get(tmp_memory)
+                              << " bytes free, the mapping file goes under " << temp_file::get_dir() << std::endl;
+                }
+            }
+            map_parameters.outFileName = temp_file::create("wfmash-", ".paf", memory_dir);
+            map_parameters.binary_output = true;
+            if (tmp_compress) {
+                map_parameters.bgzf_output = true;
+                map_parameters.bgzf_level = 1;
+            }
             align_parameters.mashmapPafFile = map_parameters.outFileName;
         }
         align_parameters.pafOutputFile = "/dev/stdout";
     }
 
-#ifdef WFA_PNG_TSV_TIMING
+    map_parameters.output_shards = 0;
+    align_parameters.output_shards = 0;
+    map_parameters.shard_by = align_parameters.shard_by = shard_by ? args::get(shard_by) : "query";
+    if (output_shards) {
+        output::ShardedWriter::Key key;
+        if (args::get(output_shards) < 1 || !output::ShardedWriter::parseKey(map_parameters.shard_by, key)) {
+            std::cerr << "[wfmash] ERROR, skch::parseandSave, --output-shards has to be at least 1, and --shard-by one of query, target, query-sample or target-sample." << std::endl;
+            exit(1);
+        }
+        if (args::get(bam_output) || args::get(cram_output) || checkpoint_file) {
+            std::cerr << "[wfmash] ERROR, skch::parseandSave, --output-shards is not to be combined with --bam, --cram or --checkpoint." << std::endl;
+            exit(1);
+        }
+        const std::string prefix = shard_prefix ? args::get(shard_prefix) : "wfmash";
+        if (approx_mapping) {
+            map_parameters.output_shards = args::get(output_shards);
+            map_parameters.outFileName = prefix;
+        } else {
+            align_parameters.output_shards = args::get(output_shards);
+            align_parameters.pafOutputFile = prefix;
+        }
+    }
+
+    map_parameters.sort_by = align_parameters.sort_by = "";
+    if (sorted_output) {
+        const std::string key_name = sort_by ? args::get(sort_by) : "target";
+        output::SortedWriter::Key key;
+        if (!output::SortedWriter::parseKey(key_name, key)) {
+            std::cerr << "[wfmash] ERROR, skch::parseandSave, --sort-by has to be target or query." << std::endl;
+            exit(1);
+        }
+        if (align_parameters.sam_format || output_shards || checkpoint_file || map_checkpoint_file || serve || batch) {
+            std::cerr << "[wfmash] ERROR, skch::parseandSave, --sorted-output is a PAF output of its own, not to be combined with --sam, --bam, --cram, --output-shards, --checkpoint, --map-checkpoint, --serve or --batch." << std::endl;
+            exit(1);
+        }
+        if (approx_mapping) {
+            map_parameters.sort_by = key_name;
+            map_parameters.outFileName = args::get(sorted_output);
+        } else {
+            align_parameters.sort_by = key_name;
+            align_parameters.pafOutputFile = args::get(sorted_output);
+        }
+    }
+
+    if (reuse_alignments) {
+        if (align_parameters.sam_format || args::get(reuse_alignments) == align_parameters.pafOutputFile) {
+            std::cerr << "[wfmash] ERROR, skch::parseandSave, --reuse-alignments needs a PAF output, to another file than the one reused." << std::endl;
+            exit(1);
+        }
+        align_parameters.reuse_alignments_file = args::get(reuse_alignments);
+    } else {
+        align_parameters.reuse_alignments_file = "";
+    }
+
+    if (map_checkpoint_file) {
+        if (!approx_mapping || args::get(bgzf_output) || output_shards || map_parameters.index_shards > 1
+            || args::get(unordered_output) || (map_parameters.filterMode == skch::filter::ONETOONE && one_to_one_mem)) {
+            std::cerr << "[wfmash] ERROR, skch::parseandSave, --map-checkpoint needs -m and an uncompressed output in input order, without --bgzf, --output-shards, --index-shards, --unordered-output or --one-to-one-mem." << std::endl;
+            exit(1);
+        }
+        // the one-to-one mappings held back are kept in the checkpoint, not spilled
+        map_parameters.onetoone_mem_budget = 0;
+        map_parameters.map_checkpoint_file = args::get(map_checkpoint_file);
+    } else {
+        map_parameters.map_checkpoint_file = "";
+    }
+
+    if (mapping_cache_file) {
+        if (map_parameters.filterMode == skch::filter::ONETOONE || map_parameters.index_shards > 1
+            || map_parameters.lower_triangular
+            || (map_parameters.sparsity_hash_threshold < std::numeric_limits<uint64_t>::max() && !map_parameters.sparsify_pairs)) {
+            std::cerr << "[wfmash] ERROR, skch::parseandSave, --mapping-cache needs the mappings of a query to depend on nothing but the query and the targets, without -4, --index-shards, -L or -x without --sparsify-pairs." << std::endl;
+            exit(1);
+        }
+        map_parameters.mapping_cache_file = args::get(mapping_cache_file);
+    } else {
+        map_parameters.mapping_cache_file = "";
+    }
+
+    map_parameters.dedup_queries = args::get(dedup_queries);
+
     align_parameters.tsvOutputPrefix = (prefix_wavefront_info_in_tsv && !args::get(prefix_wavefront_info_in_tsv).empty())
             ? args::get(prefix_wavefront_info_in_tsv)
             : "";
@@ -700,7 +1218,24 @@ void parse_args(int argc,
     } else {
         align_parameters.wfplot_max_size = 1500;
     }
-#endif
+    if (diagnostics_every) {
+        if (args::get(diagnostics_every) == 0) {
+            std::cerr << "[wfmash] ERROR, skch::parseandSave, --diagnostics-every has to be a value greater than 0." << std::endl;
+            exit(1);
+        }
+        align_parameters.diagnostics_every = args::get(diagnostics_every);
+    } else {
+        align_parameters.diagnostics_every = 1;
+    }
+    if (diagnostics_slower_than) {
+        if (args::get(diagnostics_slower_than) <= 0) {
+            std::cerr << "[wfmash] ERROR, skch::parseandSave, --diagnostics-slower-than has to be a value greater than 0." << std::endl;
+            exit(1);
+        }
+        align_parameters.diagnostics_slower_than = args::get(diagnostics_slower_than);
+    } else {
+        align_parameters.diagnostics_slower_than = 0;
+    }
 
     if (num_mappings_for_segments) {
         if (args::get(num_mappings_for_segments) > 0) {
@@ -731,6 +1266,130 @@ void parse_args(int argc,
 
     temp_file::set_keep_temp(args::get(keep_temp_files));
 
+    if (serve) {
+        if (map_parameters.index_shards > 1 || map_parameters.create_index_only || align_input_paf || output_shards || plan_jobs) {
+            std::cerr << "[wfmash] ERROR, skch::parseandSave, --serve keeps a single index resident, it is not to be combined with --index-shards, --create-index-only, -i, --output-shards or --plan." << std::endl;
+            exit(1);
+        }
+        yeet_parameters.serve_address = args::get(serve);
+        yeet_parameters.stream_mappings = false;
+    }
+
+    if (batch) {
+        if (map_parameters.index_shards > 1 || map_parameters.create_index_only || align_input_paf || output_shards || plan_jobs || serve) {
+            std::cerr << "[wfmash] ERROR, skch::parseandSave, --batch keeps a single index resident, it is not to be combined with --index-shards, --create-index-only, -i, --output-shards, --plan or --serve." << std::endl;
+            exit(1);
+        }
+        yeet_parameters.batch_manifest = args::get(batch);
+        yeet_parameters.stream_mappings = false;
+    }
+
+    if (warm_index) {
+        if (!mashmap_index || serve || batch || plan_jobs || create_mashmap_index_only) {
+            std::cerr << "[wfmash] ERROR, skch::parseandSave, --warm-index needs an --mm-index to warm, and is not to be combined with --serve, --batch, --plan or --create-index-only." << std::endl;
+            exit(1);
+        }
+        yeet_parameters.warm_index = true;
+    }
+
+    if (plan_jobs) {
+        const std::string grouping = plan_group ? args::get(plan_group) : "h";
+        if (args::get(plan_jobs) < 1 || (grouping != "g" && grouping != "h" && grouping != "c")) {
+            std::cerr << "[wfmash] ERROR, skch::parseandSave, --plan has to be at least 1, and --plan-group one of g, h or c." << std::endl;
+            exit(1);
+        }
+        if (target_prefix || query_prefix || target_list || query_list || output_shards || align_input_paf) {
+            std::cerr << "[wfmash] ERROR, skch::parseandSave, --plan picks the targets and queries of its jobs, it is not to be combined with -T, -Q, -R, -A, -i or --output-shards." << std::endl;
+            exit(1);
+        }
+        yeet_parameters.plan_jobs = args::get(plan_jobs);
+        yeet_parameters.plan_grouping = grouping[0];
+        yeet_parameters.plan_prefix = plan_prefix ? args::get(plan_prefix) : "wfmash-plan";
+        yeet_parameters.plan_estimate = plan_estimate ? args::get(plan_estimate) : "";
+        // the command line of the jobs, without the plan options
+        for (int i = 0; i < argc; ++i) {
+            const std::string arg = argv[i];
+            if (arg == "--plan" || arg == "--plan-group" || arg == "--plan-prefix" || arg == "--plan-estimate") {
+                ++i;
+            } else if (arg.rfind("--plan=", 0) != 0 && arg.rfind("--plan-group=", 0) != 0 && arg.rfind("--plan-prefix=", 0) != 0
+                       && arg.rfind("--plan-estimate=", 0) != 0) {
+                yeet_parameters.plan_args.push_back(arg);
+            }
+        }
+    }
+
+    // the thread budgets of the stages, which share -t when they overlap
+    if ((map_threads && args::get(map_threads) < 1) || (align_threads && args::get(align_threads) < 1)) {
+        std::cerr << "[wfmash] ERROR, skch::parseandSave, --map-threads and --align-threads have to be at least 1." << std::endl;
+        exit(1);
+    }
+    if (yeet_parameters.stream_mappings) {
+        const int budget = thread_count ? args::get(thread_count) : 1;
+        if (map_threads && align_threads) {
+            if (thread_count && args::get(map_threads) + args::get(align_threads) > budget) {
+                std::cerr << "[wfmash] ERROR, skch::parseandSave, with --stream-mappings, --map-threads and --align-threads add up to at most -t." << std::endl;
+                exit(1);
+            }
+            map_parameters.threads = args::get(map_threads);
+            align_parameters.threads = args::get(align_threads);
+        } else if (map_threads) {
+            map_parameters.threads = args::get(map_threads);
+            align_parameters.threads = std::max(1, budget - map_parameters.threads);
+        } else if (align_threads) {
+            align_parameters.threads = args::get(align_threads);
+            map_parameters.threads = std::max(1, budget - align_parameters.threads);
+        } else {
+            map_parameters.threads = std::max(1, budget / 4);
+            align_parameters.threads = std::max(1, budget - map_parameters.threads);
+        }
+    } else {
+        if (map_threads) {
+            map_parameters.threads = args::get(map_threads);
+        }
+        if (align_threads) {
+            align_parameters.threads = args::get(align_threads);
+        }
+    }
+    yeet_parameters.pin_threads = args::get(pin_threads);
+    if (report_json) {
+        yeet_parameters.report_json = args::get(report_json);
+    }
+    if (stats_file) {
+        yeet_parameters.stats_file = args::get(stats_file);
+    }
+    if (trace_file) {
+        yeet_parameters.trace_file = args::get(trace_file);
+    }
+    if (metrics_file) {
+        yeet_parameters.metrics_file = args::get(metrics_file);
+    }
+    if (metrics_interval) {
+        yeet_parameters.metrics_interval = args::get(metrics_interval);
+        if (yeet_parameters.metrics_interval <= 0) {
+            std::cerr << "[wfmash] ERROR, skch::parseandSave, --metrics-interval needs a positive interval in seconds." << std::endl;
+            exit(1);
+        }
+    }
+    if (estimate) {
+        yeet_parameters.estimate = estimate_fraction ? args::get(estimate_fraction) : 0.01;
+        if (yeet_parameters.estimate <= 0 || yeet_parameters.estimate > 1) {
+            std::cerr << "[wfmash] ERROR, skch::parseandSave, --estimate-fraction has to be in (0, 1]." << std::endl;
+            exit(1);
+        }
+        if (map_parameters.index_shards > 1 || map_parameters.create_index_only || align_input_paf || serve || batch || plan_jobs || warm_index
+            || seqiter::is_stream(map_parameters.querySequences.front())) {
+            std::cerr << "[wfmash] ERROR, skch::parseandSave, --estimate samples an indexed query file on a single index, it is not to be combined with --index-shards, --create-index-only, -i, --serve, --batch, --plan or --warm-index." << std::endl;
+            exit(1);
+        }
+    }
+
+    if (progress_log) {
+        yeet_parameters.progress_log = args::get(progress_log);
+        if (yeet_parameters.progress_log <= 0) {
+            std::cerr << "[wfmash] ERROR, skch::parseandSave, --progress-log needs a positive interval in seconds." << std::endl;
+            exit(1);
+        }
+    }
 }
 
 }
@@ -0,0 +1,284 @@
+#pragma once
+
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "map/include/map_parameters.hpp"
+#include "map/include/winSketch.hpp"
+#include "map/include/computeMap.hpp"
+#include "align/include/align_parameters.hpp"
+#include "align/include/computeAlignments.hpp"
+#include "interface/temp_file.hpp"
+
+namespace yeet {
+
+/**
+ * Server mode: the target index is built or loaded once and kept resident,
+ * and the batches of queries sent to a socket are mapped, and aligned, one
+ * request after the other, each with all of the threads.
+ *
+ * A request is a few option lines, an empty line, then the FASTA (or FASTQ)
+ * records of its queries, up to the end of what the client sends, after
+ * which the PAF or SAM output is sent back and the connection closed.
+ * Without options, the records may come first. The options override those
+ * the server was started with for this request only:
+ *
+ *   map-pct-id N     percent identity of the mapping
+ *   num-mappings N   mappings kept for each segment
+ *   one-to-one       one-to-one filtering of the mappings
+ *   no-filter        no filtering of the mappings
+ *   approx-map       the mappings only, without alignment
+ *   sam-format       SAM output
+ *
+ * e.g. ( printf 'approx-map\n\n'; cat contigs.fa ) | nc -N -U wfmash.sock
+ * A request that fails gets a single line starting with ERROR
+ */
+namespace server {
+
+/**
+ * A socket listening on the TCP port of localhost, if address is a
+ * number, else at the Unix socket path address, replacing any there
+ */
+inline int listen_on(const std::string& address) {
+    const bool tcp = !address.empty() && address.find_first_not_of("0123456789") == std::string::npos;
+    int fd = socket(tcp ? AF_INET : AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    int bound;
+    if (tcp) {
+        const int yes = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+        sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(std::stoi(address));
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        bound = bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+    } else {
+        sockaddr_un addr = {};
+        addr.sun_family = AF_UNIX;
+        if (address.size() >= sizeof(addr.sun_path)) {
+            close(fd);
+            return -1;
+        }
+        std::strcpy(addr.sun_path, address.c_str());
+        unlink(address.c_str());
+        bound = bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+    }
+    if (bound != 0 || listen(fd, 16) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+inline bool send_all(int fd, const char* data, size_t n) {
+    while (n > 0) {
+        const ssize_t sent = send(fd, data, n, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += sent;
+        n -= sent;
+    }
+    return true;
+}
+
+inline bool send_file(int fd, const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    std::vector<char> buffer(1 << 20);
+    while (in.read(buffer.data(), buffer.size()) || in.gcount() > 0) {
+        if (!send_all(fd, buffer.data(), in.gcount())) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Applies the option line of a request, false with error set if it is not one
+ */
+inline bool apply_option(const std::string& line, skch::Parameters& map, align::Parameters& align,
+                         bool& approx, std::string& error) {
+    std::istringstream fields(line);
+    std::string name;
+    double value = 0;
+    fields >> name;
+    const bool has_value = static_cast<bool>(fields >> value);
+    if (name == "map-pct-id" && has_value && value > 0 && value <= 100) {
+        map.percentageIdentity = value / 100.0;
+    } else if (name == "num-mappings" && has_value && value >= 1) {
+        map.numMappingsForSegment = value;
+    } else if (name == "one-to-one" && !has_value) {
+        map.filterMode = skch::filter::ONETOONE;
+    } else if (name == "no-filter" && !has_value) {
+        map.filterMode = skch::filter::NONE;
+    } else if (name == "approx-map" && !has_value) {
+        approx = true;
+    } else if (name == "sam-format" && !has_value) {
+        align.sam_format = true;
+    } else {
+        error = "unknown option or value: " + line;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Reads the options of the request of fd, and its queries into the file fasta
+ */
+inline bool read_request(int fd, const std::string& fasta, skch::Parameters& map, align::Parameters& align,
+                         bool& approx, std::string& error) {
+    std::ofstream out(fasta, std::ios::binary);
+    std::string pending;
+    bool in_header = true;
+    std::vector<char> buffer(1 << 20);
+    while (true) {
+        const ssize_t got = recv(fd, buffer.data(), buffer.size(), 0);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got < 0) {
+            error = "failed to read the request";
+            return false;
+        }
+        if (!in_header) {
+            out.write(buffer.data(), got);
+        } else {
+            pending.append(buffer.data(), got);
+            size_t pos = 0;
+            size_t end;
+            while (in_header && (end = pending.find('\n', pos)) != std::string::npos) {
+                const std::string line = pending.substr(pos, end - pos);
+                if (!line.empty() && (line[0] == '>' || line[0] == '@')) {
+                    in_header = false;
+                    break;
+                }
+                pos = end + 1;
+                if (line.empty()) {
+                    in_header = false;
+                } else if (!apply_option(line, map, align, approx, error)) {
+                    return false;
+                }
+            }
+            pending.erase(0, pos);
+            if (!in_header || got == 0) {
+                out.write(pending.data(), pending.size());
+                pending.clear();
+                in_header = false;
+            }
+        }
+        if (got == 0) {
+            break;
+        }
+    }
+    out.close();
+    if (!out) {
+        error = "failed to store the queries";
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Serves the requests sent to address with the resident index sketch,
+ * the parameters of the run being those of each request but for its options,
+ * the requests being only mapped if approx_mapping
+ */
+inline int serve(const std::string& address,
+                 const skch::Parameters& map_parameters,
+                 const align::Parameters& align_parameters,
+                 bool approx_mapping,
+                 const skch::Sketch& sketch) {
+    const int listener = listen_on(address);
+    if (listener < 0) {
+        std::cerr << "[wfmash::serve] ERROR, could not listen on " << address << ": " << std::strerror(errno) << std::endl;
+        return 1;
+    }
+    std::signal(SIGPIPE, SIG_IGN);
+    std::cerr << "[wfmash::serve] index resident, listening on " << address << std::endl;
+
+    while (true) {
+        const int client = accept(listener, nullptr, nullptr);
+        if (client < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            std::cerr << "[wfmash::serve] ERROR, could not accept a connection: " << std::strerror(errno) << std::endl;
+            break;
+        }
+        auto t0 = skch::Time::now();
+        skch::Parameters map = map_parameters;
+        align::Parameters align = align_parameters;
+        bool approx = approx_mapping;
+        std::string error;
+        const std::string fasta = temp_file::create("wfmash-serve-", ".fa");
+        const std::string mappings = temp_file::create("wfmash-serve-", ".paf");
+        const std::string output = temp_file::create("wfmash-serve-", ".out");
+        if (read_request(client, fasta, map, align, approx, error)) {
+            map.querySequences.assign(1, fasta);
+            map.query_prefix.clear();
+            map.query_list.clear();
+            map.outFileName = approx ? output : mappings;
+            map.binary_output = !approx;
+            map.bgzf_output = false;
+            map.output_shards = 0;
+            map.map_checkpoint_file.clear();
+            map.mapping_cache_file.clear();
+            {
+                skch::Map mapper(map, sketch);
+            }
+            if (!approx) {
+                align.querySequences.assign(1, fasta);
+                align.mashmapPafFile = mappings;
+                align.pafOutputFile = output;
+                align.output_shards = 0;
+                align.checkpoint_file.clear();
+                align.reuse_alignments_file.clear();
+                align.chunk_count = 1;
+                align.chunk_index = 0;
+                try {
+                    align::Aligner aligner(align);
+                    aligner.compute();
+                } catch (const std::exception& e) {
+                    error = e.what();
+                }
+            }
+        }
+        if (error.empty()) {
+            send_file(client, output);
+        } else {
+            const std::string line = "ERROR " + error + "\n";
+            send_all(client, line.data(), line.size());
+        }
+        close(client);
+        for (const std::string& file : {fasta, mappings, output}) {
+            temp_file::remove(file);
+        }
+        std::remove((fasta + ".fai").c_str());
+        std::chrono::duration<double> time = skch::Time::now() - t0;
+        std::cerr << "[wfmash::serve] request " << (error.empty() ? "served" : "failed: " + error)
+                  << " in " << time.count() << " sec" << std::endl;
+    }
+    close(listener);
+    return 1;
+}
+
+}
+
+}
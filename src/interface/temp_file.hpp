@@ -2,8 +2,16 @@
 
 #include <string>
 #include <mutex>
+#include <set>
 #include <cstdio>
+#include <cstdlib>
+#include <iostream>
 #include <dirent.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/vfs.h>
+#include <linux/magic.h>
+#endif
 
 namespace yeet {
 
@@ -17,7 +25,7 @@ std::string temp_dir;
 bool keep_temp = false;
 
 std::string get_dir() {
-    std::lock_guard<recursive_mutex> lock(monitor);
+    std::lock_guard<std::recursive_mutex> lock(monitor);
 
     // Get the default temp dir from environment variables.
     if (temp_dir.empty()) {
@@ -63,9 +71,26 @@ struct Handler {
     }
 } handler;
 
+/// A writable directory in memory-backed storage (a tmpfs) with at least
+/// min_free bytes available, empty if there is none
+std::string memory_dir(uint64_t min_free) {
+#ifdef __linux__
+    for (const char* dir : {"/dev/shm", "/run/shm"}) {
+        struct statfs fs;
+        if (statfs(dir, &fs) == 0 && fs.f_type == TMPFS_MAGIC && access(dir, W_OK) == 0
+            && (uint64_t)fs.f_bavail * fs.f_bsize >= min_free) {
+            return dir;
+        }
+    }
+#endif
+    return "";
+}
+
+/// A new temp file in dir, or in get_dir() if dir is empty
 std::string create(const std::string& base,
-                   const std::string& suffix) {
-    std::lock_guard<recursive_mutex> lock(monitor);
+                   const std::string& suffix,
+                   const std::string& dir = "") {
+    std::lock_guard<std::recursive_mutex> lock(monitor);
 
     /*
     if (handler.parent_directory.empty()) {
@@ -85,15 +110,15 @@ std::string create(const std::string& base,
     }
     */
 
-    std::string tmpname = get_dir() + "/" + base + "XXXXXX"; // + suffix;
+    std::string tmpname = (dir.empty() ? get_dir() : dir) + "/" + base + "XXXXXX"; // + suffix;
     // hack to use mkstemp to get us a safe temporary file name
     int fd = mkstemp(&tmpname[0]);
     if(fd != -1) {
         // we don't leave it open; we are assumed to open it again externally
         close(fd);
     } else {
-        cerr << "[wfmash]: couldn't create temp file on base "
-             << base << " : " << tmpname << endl;
+        std::cerr << "[wfmash]: couldn't create temp file on base "
+             << base << " : " << tmpname << std::endl;
         exit(1);
     }
     handler.filenames.insert(tmpname);
@@ -106,14 +131,14 @@ std::string create() {
 }
 
 void remove(const std::string& filename) {
-    std::lock_guard<recursive_mutex> lock(monitor);
+    std::lock_guard<std::recursive_mutex> lock(monitor);
     
     std::remove(filename.c_str());
     handler.filenames.erase(filename);
 }
 
 void set_dir(const std::string& new_temp_dir) {
-    std::lock_guard<recursive_mutex> lock(monitor);
+    std::lock_guard<std::recursive_mutex> lock(monitor);
     
     temp_dir = new_temp_dir;
 }
@@ -8,262 +8,202 @@
 #ifndef ThreadPool_h
 #define ThreadPool_h
 
-#include <pthread.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <vector>
+
+#include "common/task_executor.hpp"
+#include "common/probes.hpp"
 
 /**
- * @brief     generic thread pooling library using C++ pthreads
- * @details   dispatches input tasks to threads after any of them is available.
- *            maintains a thread safe output queue that guarantees that order of 
- *            output is same as input order
+ * @brief     generic thread pooling library
+ * @details   dispatches input tasks to the threads of the shared work-stealing
+ *            executor, so that tasks may submit nested tasks of their own.
+ *            maintains an output queue that guarantees that order of
+ *            output is same as input order, unless made unordered, when
+ *            outputs come as soon as they are done, tagged with their input order.
+ *            Workers hand their outputs over without locks: to the slot of their input,
+ *            which the master polls in input order, or, unordered, onto a stack the master
+ *            takes whole. Slots are only touched by the master otherwise, and recycled
  */
 template <class TypeInput, class TypeOutput>
 class ThreadPool
 {
   private:
 
-    struct OutputQueueNode
+    struct OutputSlot
     {
-        // used to preserve input order when outputting
-        
-        OutputQueueNode * prev;
-        OutputQueueNode * next;
-        
-        TypeOutput * output;
-        bool ready;
+        TypeOutput * output = nullptr;
+        uint64_t order = 0;
+        std::atomic<bool> ready{false};
+        OutputSlot * next = nullptr;       // in doneStack
     };
 
-    unsigned int threadCount;
-
-    pthread_t* threads;
-
     std::function<TypeOutput* (TypeInput*)> function;
-    TypeInput* inputCurrent;
-    OutputQueueNode * outputQueueNodeCurrent;
 
-    pthread_mutex_t* mutexInput;
-    pthread_mutex_t* mutexOutput;
+    tasks::Executor& executor;
+    tasks::TaskGroup group;
+
+    // slots of the inputs in flight, at stable addresses, and those popped to reuse
+    std::deque<OutputSlot> slots;
+    std::vector<OutputSlot*> freeSlots;
 
-    pthread_cond_t* condInput;
-    pthread_cond_t* condOutput;
+    // used to preserve input order when outputting
+    std::deque<OutputSlot*> outputQueue;
 
-    OutputQueueNode* outputQueueHead;
-    OutputQueueNode* outputQueueTail;
+    // unordered outputs pushed by the workers once done, and those taken by the master
+    const bool ordered;
+    std::atomic<OutputSlot*> doneStack{nullptr};
+    std::deque<OutputSlot*> doneOutputs;
+    uint64_t inputsDispatched = 0;
+    uint64_t outputsPopped = 0;
 
-    bool finished;
+    // dispatching waits once this many tasks aren't done
+    size_t maxUnfinished;
 
   public:
-    
+
     /* Constructor */
-    ThreadPool(std::function<TypeOutput* (TypeInput*)> functionNew, unsigned int threadCountNew)
+    ThreadPool(std::function<TypeOutput* (TypeInput*)> functionNew, unsigned int threadCountNew, bool orderedNew = true,
+               tasks::Stage stage = tasks::Stage::Map)
       :
-        threadCount(threadCountNew),
-        function(functionNew)
+        function(functionNew),
+        executor(tasks::sharedExecutor(threadCountNew, stage)),
+        group(executor),
+        ordered(orderedNew),
+        maxUnfinished(2 * executor.size())
   {
-    mutexInput = new pthread_mutex_t();
-    mutexOutput = new pthread_mutex_t();
-
-    condInput = new pthread_cond_t();
-    condOutput = new pthread_cond_t();
-
-    pthread_mutex_init(mutexInput, NULL);
-    pthread_mutex_init(mutexOutput, NULL);
-
-    pthread_cond_init(condInput, NULL);
-    pthread_cond_init(condOutput, NULL);
-
-    inputCurrent = 0;
-
-    outputQueueHead = 0;
-    outputQueueTail = 0;
-
-    finished = false;
-
-    threads = new pthread_t[threadCount];
-
-    for ( int i = 0; i < threadCount; i++ )
-    {
-      pthread_create(&threads[i], NULL, &ThreadPool::thread, this);
-    }
   }
 
     /* Destructor */
     ~ThreadPool()
     {
-      pthread_mutex_lock(mutexInput);
-      finished = true;
-      pthread_cond_broadcast(condInput);
-      pthread_mutex_unlock(mutexInput);
-
-      for ( int i = 0; i < threadCount; i++ )
-      {
-        pthread_join(threads[i], NULL);
-      }
-
-      delete [] threads;
-
-      while ( outputQueueHead != 0 )
-      {
-        OutputQueueNode * next = outputQueueHead->next;
-        delete outputQueueHead;
-        outputQueueHead = next;
-      }
-
-      delete mutexInput;
-      delete mutexOutput;
-
-      delete condInput;
-      delete condOutput;
+      group.wait();
     }
 
     /* Check if any thread has placed it's output in the queue */
     bool outputAvailable() const
     {
-      bool available;
-
-      pthread_mutex_lock(mutexOutput);
-      available = outputQueueHead != 0 && outputQueueHead->ready;
-      pthread_mutex_unlock(mutexOutput);
-
-      return available;
+      if (!ordered)
+        return !doneOutputs.empty() || doneStack.load(std::memory_order_acquire) != nullptr;
+      return !outputQueue.empty() && outputQueue.front()->ready.load(std::memory_order_acquire);
     }
 
-    /* Pop the output if available; Calling function is responsible for destructing output object later */
-    TypeOutput* popOutputWhenAvailable()
+    /* Pop the output if available; Calling function is responsible for destructing output object later.
+     * order, if given, is set to the rank of the input the output is of */
+    TypeOutput* popOutputWhenAvailable(uint64_t * order = nullptr)
     {
-      pthread_mutex_lock(mutexOutput);
-
-      if ( outputQueueHead == 0 )
+      if ( !running() )
       {
         std::cerr << "ERROR: waiting for output when no output queued\n";
-        pthread_mutex_unlock(mutexOutput);
         return 0;
       }
 
-      while ( ! outputQueueHead->ready )
+      if (!ordered)
       {
-        pthread_cond_wait(condOutput, mutexOutput);
-      }
+        if (doneOutputs.empty())
+        {
+          // run queued tasks meanwhile
+          group.waitUntil([this]() { return doneStack.load(std::memory_order_acquire) != nullptr; });
+          // the stack is newest first, taken oldest first
+          const size_t taken = doneOutputs.size();
+          for (OutputSlot * slot = doneStack.exchange(nullptr, std::memory_order_acquire); slot != nullptr; slot = slot->next)
+            doneOutputs.push_back(slot);
+          std::reverse(doneOutputs.begin() + taken, doneOutputs.end());
+        }
 
-      TypeOutput * output = outputQueueHead->output;
+        OutputSlot * done = doneOutputs.front();
+        doneOutputs.pop_front();
+        ++outputsPopped;
+        if (order != nullptr)
+          *order = done->order;
+        WFMASH_PROBE(queue_pop, done->order, inFlight());
+        return recycle(done);
+      }
 
-      OutputQueueNode * next = outputQueueHead->next;
+      // run queued tasks meanwhile
+      OutputSlot * head = outputQueue.front();
+      group.waitUntil([head]() { return head->ready.load(std::memory_order_acquire); });
 
-      if ( outputQueueTail == outputQueueHead )
-      {
-        outputQueueTail = 0;
-      }
+      outputQueue.pop_front();
+      if (order != nullptr)
+        *order = outputsPopped;
+      WFMASH_PROBE(queue_pop, outputsPopped, inFlight() - 1);
+      ++outputsPopped;
 
-      delete outputQueueHead;
-      outputQueueHead = next;
-      pthread_mutex_unlock(mutexOutput);
+      return recycle(head);
+    }
 
-      return output;
+    /* Inputs dispatched whose output is not popped yet */
+    size_t inFlight() const
+    {
+      return inputsDispatched - outputsPopped;
     }
 
     /* Check if any of the threads is still running */
     bool running() const
     {
-      bool running;
-
-      pthread_mutex_lock(mutexOutput);
-      running = outputQueueHead != 0;
-      pthread_mutex_unlock(mutexOutput);
-
-      return running;
+      return outputsPopped < inputsDispatched;
     }
 
-    /* Assign job to next available thread (wait if unavailable), thread will destruct the input */
+    /* Assign job to the threads (wait if too many are queued), thread will destruct the input */
     void runWhenThreadAvailable(TypeInput * input)
     {
-      pthread_mutex_lock(mutexInput);
-
-      while ( inputCurrent != 0 )
-      {
-        pthread_cond_wait(condInput, mutexInput);
-      }
+      group.waitUntil([this]() { return group.unfinished() < maxUnfinished; });
 
-      inputCurrent = input;
+      const uint64_t order = inputsDispatched++;
+      WFMASH_PROBE(queue_push, order, inFlight());
 
-      // enqueue output while input locked (to preserve order)
-      //
-      OutputQueueNode * outputQueueNode = new OutputQueueNode();
-      outputQueueNode->next = 0;
-      outputQueueNode->ready = false;
-      //
-      pthread_mutex_lock(mutexOutput);
-      //
-      if ( outputQueueHead == 0 )
+      OutputSlot * slot;
+      if (freeSlots.empty())
       {
-        outputQueueHead = outputQueueNode;
+        slots.emplace_back();
+        slot = &slots.back();
       }
-      //
-      outputQueueNode->prev = outputQueueTail;
-      //
-      if ( outputQueueTail != 0 )
+      else
       {
-        outputQueueTail->next = outputQueueNode;
+        slot = freeSlots.back();
+        freeSlots.pop_back();
       }
-      //
-      outputQueueTail = outputQueueNode;
-      //
-      pthread_mutex_unlock(mutexOutput);
-
-      outputQueueNodeCurrent = outputQueueNode;
-
-      pthread_mutex_unlock(mutexInput);
-      pthread_cond_broadcast(condInput);
-    }
-
-  private:
+      slot->order = order;
 
-    /* Main function that each thread executes */
-    static void * thread(void * arg)
-    {
-      ThreadPool * threadPool = (ThreadPool *)arg;
-      TypeInput * input;
-      OutputQueueNode * outputQueueNode;
-
-      while ( ! threadPool->finished )
+      if (!ordered)
       {
-        // wait for input
-        //
-        pthread_mutex_lock(threadPool->mutexInput);
-        //
-        while ( ! threadPool->finished && threadPool->inputCurrent == 0 )
-        {
-          pthread_cond_wait(threadPool->condInput, threadPool->mutexInput);
-        }
-
-        if ( threadPool->finished )
+        group.run([this, input, slot]()
         {
-          pthread_mutex_unlock(threadPool->mutexInput);
-          return 0;
-        }
-        //
-        input = threadPool->inputCurrent;
-        outputQueueNode = threadPool->outputQueueNodeCurrent;
-        threadPool->inputCurrent = 0;
-
-        pthread_mutex_unlock(threadPool->mutexInput);
-
-        pthread_cond_broadcast(threadPool->condInput);
-
-        // run function
-        //
-        outputQueueNode->output = threadPool->function(input);
+          slot->output = function(input);
+          delete input;
+          slot->next = doneStack.load(std::memory_order_relaxed);
+          while (!doneStack.compare_exchange_weak(slot->next, slot, std::memory_order_release, std::memory_order_relaxed))
+            ;
+        });
+        return;
+      }
 
+      outputQueue.push_back(slot);
+      group.run([this, input, slot]()
+      {
+        slot->output = function(input);
         delete input;
+        slot->ready.store(true, std::memory_order_release);
+      });
+    }
 
-        // signal output
-        //
-        outputQueueNode->ready = true;
-        //
-        pthread_mutex_lock(threadPool->mutexOutput);
-        pthread_cond_broadcast(threadPool->condOutput);
-        pthread_mutex_unlock(threadPool->mutexOutput);
-      }
+  private:
 
-      return NULL;
+    /* Output of a popped slot, which is then free for another input */
+    TypeOutput * recycle(OutputSlot * slot)
+    {
+      TypeOutput * output = slot->output;
+      slot->output = nullptr;
+      slot->ready.store(false, std::memory_order_relaxed);
+      slot->next = nullptr;
+      freeSlots.push_back(slot);
+      return output;
     }
 };
 
@@ -7,10 +7,17 @@
 #ifndef BASE_TYPES_MAP_HPP
 #define BASE_TYPES_MAP_HPP
 
+#include <algorithm>
 #include <tuple>
+#include <limits>
+#include <utility>
+#include <memory>
+#include <string_view>
 #include <vector>
 #include <chrono>
 #include "common/progress.hpp"
+#include "common/memory_accounting.hpp"
+#include "map/include/packedSequence.hpp"
 
 namespace skch
 {
@@ -58,6 +65,13 @@ namespace skch
     }
   };
 
+  // Enum for tracking which side of an interval a point represents
+  enum side : side_t
+  {
+    OPEN = 1,  
+    CLOSE = -1
+  };  
+
   // Endpoints for minmer intervals
   struct IntervalPoint
   {
@@ -74,10 +88,44 @@ namespace skch
     }
   };
 
+  // Interval point as stored in the seed lookup index, where the hash is already the key.
+  // seqId, pos and side are packed into 64 bits (seqId high, CLOSE before OPEN in the
+  // lowest bit) so that plain integer order matches the IntervalPoint order
+  struct PackedIntervalPoint
+  {
+    static constexpr int posBits = 36;
+    static constexpr int seqIdBits = 27;
+    static constexpr uint64_t posMask = (uint64_t(1) << posBits) - 1;
+
+    uint64_t bits;
+
+    PackedIntervalPoint() = default;
+
+    PackedIntervalPoint(offset_t pos, seqno_t seqId, side_t s)
+      : bits((uint64_t(seqId) << (posBits + 1)) | (uint64_t(pos) << 1) | (s == side::OPEN ? 1 : 0)) {}
+
+    offset_t pos() const { return (bits >> 1) & posMask; }
+    seqno_t seqId() const { return bits >> (posBits + 1); }
+    side_t side() const { return (bits & 1) ? side::OPEN : side::CLOSE; }
+
+    void setPos(offset_t pos) {
+      bits = (bits & ~(posMask << 1)) | (uint64_t(pos) << 1);
+    }
+
+    IntervalPoint unpack(hash_t hash) const {
+      return IntervalPoint {pos(), hash, seqId(), side()};
+    }
+
+    bool operator <(const PackedIntervalPoint& x) const {
+      return bits < x.bits;
+    }
+  };
+
   template <class It>
   struct boundPtr {
     It it;
     It end;
+    hash_t hash;    // shared by all points in [it, end)
 
     bool operator<(const boundPtr& other) const {
       return *it < *(other.it);
@@ -86,12 +134,12 @@ namespace skch
 
 
   typedef hash_t MinmerMapKeyType;
-  typedef std::vector<IntervalPoint> MinmerMapValueType;
+  typedef std::vector<PackedIntervalPoint> MinmerMapValueType;
 
   //Metadata recording for contigs in the reference DB
   struct ContigInfo
   {
-    std::string name;       //Name of the sequence
+    std::string_view name;  //Name of the sequence, in the NameArena of the owner of the ContigInfo
     offset_t len;           //Length of the sequence
   };
 
@@ -103,6 +151,40 @@ namespace skch
     REV = -1
   };
 
+  // Minmer window as stored in the L2 index, in 16 bytes rather than 32: the sequence is
+  // implied by the per sequence offsets of the index, and the window start, length and
+  // strand are packed into 64 bits (start high, reverse strand in the lowest bit)
+  struct PackedMinmer
+  {
+    static constexpr int lengthBits = 27;
+    static constexpr int posBits = 63 - lengthBits;
+    static constexpr uint64_t lengthMask = (uint64_t(1) << lengthBits) - 1;
+
+    hash_t hash;
+    uint64_t bits;
+
+    PackedMinmer() = default;
+
+    explicit PackedMinmer(const MinmerInfo& mi)
+      : hash(mi.hash),
+        bits((uint64_t(mi.wpos) << (lengthBits + 1)) | (uint64_t(mi.wpos_end - mi.wpos) << 1) | (mi.strand == strnd::REV ? 1 : 0)) {}
+
+    // Windows of the index are short and on either strand, those of longer sequences may not pack
+    static bool packs(const MinmerInfo& mi) {
+      return mi.wpos >= 0 && mi.wpos < (offset_t(1) << posBits)
+        && mi.wpos_end >= mi.wpos && mi.wpos_end - mi.wpos <= offset_t(lengthMask)
+        && (mi.strand == strnd::FWD || mi.strand == strnd::REV);
+    }
+
+    offset_t wpos() const { return bits >> (lengthBits + 1); }
+    offset_t wpos_end() const { return wpos() + offset_t((bits >> 1) & lengthMask); }
+    strand_t strand() const { return (bits & 1) ? strnd::REV : strnd::FWD; }
+
+    MinmerInfo unpack(seqno_t seqId) const {
+      return MinmerInfo {hash, wpos(), wpos_end(), seqId, strand()};
+    }
+  };
+
   enum event : int
   {
     BEGIN = 1,
@@ -117,12 +199,13 @@ namespace skch
     NONE = 3                              //no filtering
   };
 
-  // Enum for tracking which side of an interval a point represents
-  enum side : side_t
+  //kmer sampling scheme, stored in the index
+  enum sampling : int
   {
-    OPEN = 1,  
-    CLOSE = -1
-  };  
+    BOTTOM_SKETCH = 0,                    //bottom s kmers of each window
+    OPEN_SYNCMER = 1                      //bottom s open syncmers of each window
+  };
+
 
   struct SeqCoord
   {
@@ -147,6 +230,7 @@ namespace skch
 
   //Fragment mapping result
   //Do not save variable sized objects in this struct
+  //Fields are ordered by size, so that the sorting and filtering passes move no padding
   struct MappingResult
   {
     offset_t queryLen;                                  //length of the query sequence
@@ -154,27 +238,27 @@ namespace skch
     offset_t refEndPos;                                 //end pos
     offset_t queryStartPos;                             //start position of the query for this mapping
     offset_t queryEndPos;                               //end position of the query for this mapping
-    seqno_t refSeqId;                                   //internal sequence id of the reference contig
-    seqno_t querySeqId;                                 //internal sequence id of the query sequence
     offset_t blockLength;                                    //the block length of the mapping
     offset_t blockRefStartPos;
     offset_t blockRefEndPos;
     offset_t blockQueryStartPos;
     offset_t blockQueryEndPos;
+    offset_t splitMappingId;                            // To identify split mappings that are chained
+    seqno_t refSeqId;                                   //internal sequence id of the reference contig
+    seqno_t querySeqId;                                 //internal sequence id of the query sequence
     float blockNucIdentity;
           
     float nucIdentity;                                  //calculated identity
     float nucIdentityUpperBound;                        //upper bound on identity (90% C.I.)
     int sketchSize;                                     //sketch size
     int conservedSketches;                              //count of conserved sketches
-    strand_t strand;                                    //strand
     int approxMatches;                                  //the approximate number of matches in the alignment
 
                                                         //--for split read mapping
 
-    long double kmerComplexity;                               // Estimated sequence complexity
+    float kmerComplexity;                               // Estimated sequence complexity, as computed for the query
     int n_merged;                                       // how many mappings we've merged into this one
-    offset_t splitMappingId;                            // To identify split mappings that are chained
+    strand_t strand;                                    //strand
     uint8_t discard;                                    // set to 1 for deletion
     bool overlapped;                                    // set to true if this mapping is overlapped with another mapping
     bool selfMapFilter;                                 // set to true if a long-to-short mapping in all-vs-all mode (we report short as the query)
@@ -215,8 +299,10 @@ namespace skch
   {
     seqno_t seqCounter;                         //sequence counter
     offset_t len;                               //sequence length
-    std::string seq;                            //sequence string
+    std::string seq;                            //sequence string, empty if packed
     std::string seqName;                        //sequence id
+    PackedSequence packedSeq;                   //sequence at 2 bits per base, if packed
+    bool packed;
 
 
     /*
@@ -224,18 +310,76 @@ namespace skch
      * @param[in] kseq_seq  complete read or reference sequence
      * @param[in] kseq_id   sequence id name
      * @param[in] len       length of sequence
+     * @param[in] pack      keep the sequence as a PackedSequence
      */
-      InputSeqContainer(const std::string& s, const std::string& id, seqno_t seqcount)
+      InputSeqContainer(const std::string& s, const std::string& id, seqno_t seqcount, bool pack = false)
+          : seqCounter(seqcount)
+          , len(s.length())
+          , seq(pack ? std::string() : s)
+          , seqName(id)
+          , packedSeq(pack ? PackedSequence(s) : PackedSequence())
+          , packed(pack) { }
+      // Takes s over instead of copying it, unless packed
+      InputSeqContainer(std::string&& s, const std::string& id, seqno_t seqcount, bool pack = false)
           : seqCounter(seqcount)
           , len(s.length())
-          , seq(s)
-          , seqName(id) { }
+          , seq(pack ? std::string() : std::move(s))
+          , seqName(id)
+          , packedSeq(pack ? PackedSequence(s) : PackedSequence())
+          , packed(pack) { }
+  };
+
+  //Seed of a query matching its target at the same place in a mapping: the start of the kmer
+  //on both sequences, or its end on the query for a mapping on the reverse strand
+  struct SeedAnchor
+  {
+    offset_t queryPos;
+    offset_t refPos;
+  };
+
+  //Target region the fragments of a coarse window are looked up in
+  struct CandidateRegion
+  {
+    seqno_t seqId;
+    offset_t begin;
+    offset_t end;
+  };
+
+  //Candidate regions of each coarse window of a query, sorted by target and position and disjoint within a window
+  struct CoarseCandidates
+  {
+    offset_t windowLength = 0;
+    std::vector<uint64_t> windowOffsets;          //regions of window w are [windowOffsets[w], windowOffsets[w + 1])
+    std::vector<CandidateRegion> regions;
+
+    //regions of the window of a query position, as [begin, end)
+    std::pair<const CandidateRegion*, const CandidateRegion*> regionsAt(offset_t pos) const
+    {
+      const uint64_t w = std::min<uint64_t>(pos / windowLength, windowOffsets.size() - 2);
+      return {regions.data() + windowOffsets[w], regions.data() + windowOffsets[w + 1]};
+    }
+  };
+
+  //Mappings of a query replayed from a MappingCache, and the targets it is still to be mapped on
+  struct CachedQueryMappings
+  {
+    uint64_t key[2];                            //MappingCache::queryKey of the query
+    std::vector<MappingResultsVector_t> mappings; //per target group, relative to it as kept in the cache
+    std::vector<offset_t> l2Mappings;           //per target group, L2 mappings before merging, -1 if not cached
+    std::vector<uint64_t> uncached;             //bit per target id of the groups not cached, empty if none is
+    bool complete = false;                      //all the target groups cached, nothing left to map
   };
 
   struct InputSeqProgContainer : InputSeqContainer
   {
     using InputSeqContainer::InputSeqContainer;
     progress_meter::ProgressMeter& progress;    //progress meter (shared)
+    std::unique_ptr<CachedQueryMappings> cached; //with a mapping cache
+    std::vector<uint64_t> prefiltered;          //bit per target sharing enough contig-level seeds, with a target prefilter
+    seqno_t prefilteredBegin = 0;               //first and past the last target of prefiltered
+    seqno_t prefilteredEnd = std::numeric_limits<seqno_t>::max();
+    std::unique_ptr<CoarseCandidates> coarse;   //target regions of its coarse windows, with a coarse level, if long enough
+    seqno_t firstCopy = -1;                     //with dedup_queries, the first query of its sequence, itself if none before, -1 if not deduplicated
                                                 
 
     /*
@@ -244,11 +388,81 @@ namespace skch
      * @param[in] kseq_id   sequence id name
      * @param[in] len       length of sequence
      */
-      InputSeqProgContainer(const std::string& s, const std::string& id, seqno_t seqcount, progress_meter::ProgressMeter& pm)
-          : InputSeqContainer(s, id, seqcount)
+      InputSeqProgContainer(const std::string& s, const std::string& id, seqno_t seqcount, progress_meter::ProgressMeter& pm, bool pack = false)
+          : InputSeqContainer(s, id, seqcount, pack)
+          , progress(pm) { }
+      InputSeqProgContainer(std::string&& s, const std::string& id, seqno_t seqcount, progress_meter::ProgressMeter& pm, bool pack = false)
+          : InputSeqContainer(std::move(s), id, seqcount, pack)
           , progress(pm) { }
   };
 
+  //Queries handed to one mapping task together, in input order
+  struct InputSeqProgBatch
+  {
+    std::vector<InputSeqProgContainer*> queries;
+    offset_t totalLen = 0;                      //bases over all queries
+    uint64_t reservedBytes = 0;                 //memory budget held by the queries, see MemoryBudget
+
+    InputSeqProgBatch() = default;
+    InputSeqProgBatch(const InputSeqProgBatch&) = delete;
+    InputSeqProgBatch& operator=(const InputSeqProgBatch&) = delete;
+
+    ~InputSeqProgBatch()
+    {
+      for (auto q : queries)
+        delete q;
+      memory_accounting::add(memory_accounting::map_queries, -(int64_t)totalLen);
+    }
+
+    void add(InputSeqProgContainer* q)
+    {
+      totalLen += q->len;
+      queries.push_back(q);
+      memory_accounting::add(memory_accounting::map_queries, q->len);
+    }
+  };
+
+
+  //With index shards, the best L1 intersection size of a query fragment on a group of
+  //targets, over those of a shard, see ShardedMapping
+  struct ShardFragmentBest
+  {
+    offset_t fragStart;                   //offset of the fragment in the query
+    int group;                            //prefix group of the targets, 0 without skip_prefix
+    int best;
+  };
+
+  //With index shards, an L1 candidate of a query fragment on a target of a shard, and the
+  //count of its L2 mappings, which come in candidate order after those of the previous ones
+  struct ShardCandidate
+  {
+    offset_t fragStart;                   //offset of the fragment in the query
+    seqno_t seqId;
+    offset_t rangeStartPos;
+    offset_t rangeEndPos;
+    int intersectionSize;
+    uint64_t mappingsBegin;               //first of its L2 mappings, once held by ShardedMapping
+    uint32_t mappingCount;
+  };
+
+  //With index shards, what a shard finds for a query besides its L2 mappings, see ShardedMapping
+  struct ShardQueryOutput
+  {
+    std::vector<ShardFragmentBest> bests;
+    std::vector<ShardCandidate> candidates;
+
+    void clear()
+    {
+      bests.clear();
+      candidates.clear();
+    }
+
+    void append(const ShardQueryOutput& other)
+    {
+      bests.insert(bests.end(), other.bests.begin(), other.bests.end());
+      candidates.insert(candidates.end(), other.candidates.begin(), other.candidates.end());
+    }
+  };
 
   //Output type of map function
   struct MapModuleOutput
@@ -256,14 +470,37 @@ namespace skch
     MappingResultsVector_t readMappings;  //read mapping coordinates
     std::string qseqName;                 //query sequence id
     offset_t qseqLen;                     //query sequence length
+    std::string records;                  //final records of readMappings, when formatted by the worker
+    std::vector<offset_t> l2Mappings;     //with a mapping cache, per target group, L2 mappings before merging
+    std::vector<SeedAnchor> anchors;      //with seed anchors, those of each mapping in turn
+    std::vector<uint64_t> anchorEnds;     //end of those of each mapping in anchors
+    seqno_t seqCounter = 0;               //query sequence counter
+    seqno_t firstCopy = -1;               //as in InputSeqProgContainer
+    ShardQueryOutput shard;               //with index shards, held for the last one instead of readMappings being final
 
     //Function to erase all output mappings
     void reset()
     {
       this->readMappings.clear();
+      this->anchors.clear();
+      this->anchorEnds.clear();
+      this->shard.clear();
     }
   };
 
+  //Output of a mapping task over a batch of queries, one entry per query in input order
+  struct MapModuleBatchOutput
+  {
+    std::vector<MapModuleOutput*> outputs;
+    uint64_t reservedBytes = 0;           //memory budget held by the batch, released once handled
+    uint64_t mappingBytes = 0;            //of the mappings of its outputs, for memory_accounting
+  };
+
+  namespace CommonFunc
+  {
+    class KmerHashStream;
+  }
+
   //Information about fragment sequence during L1/L2 mapping
   template <typename MinmerVec>
     struct QueryMetaData
@@ -278,6 +515,15 @@ namespace skch
       MinmerVec seedHits;                 //Vector of minmers in the reference
       int refGroup;                       //Prefix group of sequence
       float kmerComplexity;                //Estimated sequence complexity
+      CommonFunc::KmerHashStream* hashStream = nullptr;  //kmer hashes of the full sequence, if shared by its fragments
+      offset_t streamOffset = 0;          //offset of this fragment in the full sequence
+      seqno_t selfSeqId = -1;             //target this fragment is a window of, if sketched by the index
+      const uint64_t* admissibleTargets = nullptr;  //bit per target id it may map on, null for all of them
+      seqno_t admittedBegin = 0;          //targets it may map on are within [admittedBegin, admittedEnd)
+      seqno_t admittedEnd = std::numeric_limits<seqno_t>::max();
+      const CandidateRegion* regionsBegin = nullptr;  //target regions its seeds are looked up in, all if null
+      const CandidateRegion* regionsEnd = nullptr;
+      ShardQueryOutput* shardOutput = nullptr;  //with index shards, where a shard that isn't the last one puts what it finds
     };
 }
 
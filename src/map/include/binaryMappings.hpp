@@ -0,0 +1,265 @@
+/**
+ * @file    binaryMappings.hpp
+ * @brief   compact binary format for the mappings handed from the mapping to the alignment stage
+ * @details a file starts with a magic string, followed by tagged entries: sequence entries name
+ *          a query or reference id the first time a mapping uses it, with its length, and
+ *          mapping entries are fixed size records of those ids, the positions, the strand and
+ *          the estimated identity. Readers so never parse text or look names up per mapping.
+ *          A mapping entry may come after an anchor entry, the seeds it shares with its target.
+ *          A complete file ends with a trailer giving the total query span of its mappings.
+ *          The file may be gzip (BGZF) compressed as a whole; its trailer is then not read upfront.
+ */
+
+#ifndef BINARY_MAPPINGS_HPP
+#define BINARY_MAPPINGS_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+//Own includes
+#include "map/include/base_types.hpp"
+#include "map/include/nameArena.hpp"
+#include "common/output_writer.hpp"
+#include "common/gzstream.h"
+
+namespace skch
+{
+  namespace binmap
+  {
+    //"WFMB", then the format version
+    static constexpr char magic[8] = {'W', 'F', 'M', 'B', 0, 0, 0, 3};
+
+    enum Tag : char
+    {
+      QUERY = 'Q',          //query name entry
+      REF = 'R',            //reference name entry
+      MAPPING = 'M',        //mapping record
+      ANCHORS = 'A',        //seed anchors of the next mapping record
+      TRAILER = 'T'         //total query span, last in the file
+    };
+
+    struct Record
+    {
+      offset_t queryStartPos;
+      offset_t queryEndPos;
+      offset_t refStartPos;
+      offset_t refEndPos;
+      uint32_t queryId;
+      uint32_t refId;
+      float nucIdentity;
+      uint8_t strand;       //1 on the forward strand, 0 on the reverse
+      uint8_t padding[3];
+    };
+
+    static_assert(sizeof(Record) == 48, "binary mapping records have a fixed layout");
+
+    //Seed anchor of a mapping, from the start of the mapping on the query and the reference
+    struct Anchor
+    {
+      uint32_t queryOffset;
+      uint32_t refOffset;
+    };
+
+    /**
+     * @brief     true if the file, once inflated if compressed, starts like a binary mapping file
+     */
+    inline bool isBinaryFile(const std::string& fileName)
+    {
+      igzstream in(fileName.c_str());
+      char head[sizeof(magic)];
+      return in.read(head, sizeof(magic)) && std::memcmp(head, magic, sizeof(magic)) == 0;
+    }
+
+    /**
+     * @brief     total query span of the mappings of a complete file, read from its trailer
+     * @return    false if the file has no trailer
+     */
+    inline bool readTotalQuerySpan(const std::string& fileName, uint64_t& total)
+    {
+      std::ifstream in(fileName, std::ios::binary);
+      char tag;
+      return in.seekg(-std::streamoff(sizeof(char) + sizeof(total)), std::ios::end)
+        && in.get(tag) && tag == TRAILER
+        && in.read(reinterpret_cast<char*>(&total), sizeof(total));
+    }
+
+    /**
+     * @brief     writes mappings, naming each sequence once
+     */
+    class Writer
+    {
+      private:
+
+        output::Writer& out;
+        std::vector<bool> queryNamed;
+        std::vector<bool> refNamed;
+        uint64_t totalQuerySpan = 0;
+
+        void writeName(Tag tag, uint32_t id, std::string_view name, offset_t len)
+        {
+          const uint32_t nameLen = name.size();
+          out << char(tag);
+          out.write(reinterpret_cast<const char*>(&id), sizeof(id));
+          out.write(reinterpret_cast<const char*>(&len), sizeof(len));
+          out.write(reinterpret_cast<const char*>(&nameLen), sizeof(nameLen));
+          out.write(name.data(), nameLen);
+        }
+
+        static bool firstUse(std::vector<bool>& named, uint32_t id)
+        {
+          if (id >= named.size())
+            named.resize(id + 1, false);
+          if (named[id])
+            return false;
+          named[id] = true;
+          return true;
+        }
+
+      public:
+
+        explicit Writer(output::Writer& out) : out(out)
+        {
+          out.write(magic, sizeof(magic));
+        }
+
+        /**
+         * @brief             write mapping e, of the query and reference of the given names
+         * @param[in] anchors its seed anchors, anchorCount of them
+         */
+        void write(const MappingResult& e, std::string_view queryName, std::string_view refName, offset_t refLen,
+                   const SeedAnchor* anchors = nullptr, uint32_t anchorCount = 0)
+        {
+          if (firstUse(queryNamed, e.querySeqId))
+            writeName(QUERY, e.querySeqId, queryName, e.queryLen);
+          if (firstUse(refNamed, e.refSeqId))
+            writeName(REF, e.refSeqId, refName, refLen);
+          if (anchorCount > 0)
+          {
+            std::vector<Anchor> packed(anchorCount);
+            for (uint32_t i = 0; i < anchorCount; i++)
+              packed[i] = Anchor {uint32_t(anchors[i].queryPos - e.queryStartPos), uint32_t(anchors[i].refPos - e.refStartPos)};
+            out << char(ANCHORS);
+            out.write(reinterpret_cast<const char*>(&anchorCount), sizeof(anchorCount));
+            out.write(reinterpret_cast<const char*>(packed.data()), anchorCount * sizeof(Anchor));
+          }
+
+          Record r = {};
+          r.queryStartPos = e.queryStartPos;
+          r.queryEndPos = e.queryEndPos;
+          r.refStartPos = e.refStartPos;
+          r.refEndPos = e.refEndPos;
+          r.queryId = e.querySeqId;
+          r.refId = e.refSeqId;
+          r.nucIdentity = e.nucIdentity;
+          r.strand = e.strand == strnd::FWD;
+          out << char(MAPPING);
+          out.write(reinterpret_cast<const char*>(&r), sizeof(r));
+          totalQuerySpan += e.queryEndPos - e.queryStartPos;
+        }
+
+        /**
+         * @brief             write the trailer, after the last mapping
+         */
+        void finish()
+        {
+          out << char(TRAILER);
+          out.write(reinterpret_cast<const char*>(&totalQuerySpan), sizeof(totalQuerySpan));
+        }
+    };
+
+    /**
+     * @brief     reads back the mappings of a Writer, with the names they refer to
+     */
+    class Reader
+    {
+      private:
+
+        std::istream& in;
+        NameArena names;
+        std::string name;
+
+        bool readName(std::vector<ContigInfo>& contigs)
+        {
+          uint32_t id, nameLen;
+          offset_t len;
+          if (!in.read(reinterpret_cast<char*>(&id), sizeof(id))
+              || !in.read(reinterpret_cast<char*>(&len), sizeof(len))
+              || !in.read(reinterpret_cast<char*>(&nameLen), sizeof(nameLen)))
+            return false;
+          name.resize(nameLen);
+          if (!in.read(&name[0], nameLen))
+            return false;
+          if (id >= contigs.size())
+            contigs.resize(id + 1);
+          contigs[id].name = names.store(name);
+          contigs[id].len = len;
+          return true;
+        }
+
+        bool readAnchors()
+        {
+          uint32_t count;
+          if (!in.read(reinterpret_cast<char*>(&count), sizeof(count)))
+            return false;
+          anchors.resize(count);
+          return bool(in.read(reinterpret_cast<char*>(anchors.data()), count * sizeof(Anchor)));
+        }
+
+      public:
+
+        //Names and lengths by id, of the sequences named so far
+        std::vector<ContigInfo> queries;
+        std::vector<ContigInfo> refs;
+
+        //Seed anchors of the last mapping read, empty if it has none
+        std::vector<Anchor> anchors;
+
+        explicit Reader(std::istream& in) : in(in)
+        {
+          char head[sizeof(magic)];
+          if (!in.read(head, sizeof(magic)) || std::memcmp(head, magic, sizeof(magic)) != 0)
+          {
+            std::cerr << "[mashmap::skch::binmap::Reader] ERROR: not a binary mapping file" << std::endl;
+            exit(1);
+          }
+        }
+
+        /**
+         * @brief             read the next mapping
+         * @return            false at the end of the input
+         */
+        bool next(Record& r)
+        {
+          char tag;
+          anchors.clear();
+          while (in.get(tag))
+          {
+            bool ok;
+            switch (tag)
+            {
+              case QUERY: ok = readName(queries); break;
+              case REF: ok = readName(refs); break;
+              case ANCHORS: ok = readAnchors(); break;
+              case MAPPING: ok = bool(in.read(reinterpret_cast<char*>(&r), sizeof(r))); break;
+              case TRAILER: return false;
+              default: ok = false;
+            }
+            if (!ok || (tag == MAPPING && (r.queryId >= queries.size() || r.refId >= refs.size())))
+            {
+              std::cerr << "[mashmap::skch::binmap::Reader] ERROR: truncated or corrupt binary mapping file" << std::endl;
+              exit(1);
+            }
+            if (tag == MAPPING)
+              return true;
+          }
+          return false;
+        }
+    };
+  }
+}
+
+#endif
@@ -0,0 +1,245 @@
+/**
+ * @file    coarseLevel.hpp
+ * @brief   coarse level of the index, confining the seed lookups of the fragments of long
+ *          queries to the target regions their coarse windows hit
+ */
+
+#ifndef COARSE_LEVEL_HPP
+#define COARSE_LEVEL_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "map/include/base_types.hpp"
+
+//External includes
+#include "common/ankerl/unordered_dense.hpp"
+
+namespace skch
+{
+  /**
+   * @brief     the minmers of the index whose hashes fall below a share of the hash space
+   *            factor times smaller than that of the sketch, with their positions, making an
+   *            index of windows factor times longer than the segments
+   * @details   L1 candidates of a long query are found by each of its fragments against
+   *            all of the targets, most of which are far from where the query goes. The
+   *            hashes of the query below the same threshold are looked up here instead, and
+   *            the hits of each coarse window binned by target, strand and diagonal: the
+   *            diagonal bands hit minHits times around a window, padded by a band, are the
+   *            only target regions the seeds of its fragments are looked up in. A window
+   *            without such a band looks its fragments up everywhere, so that diverged
+   *            regions the coarse level misses are still mapped
+   */
+  class CoarseLevel
+  {
+    public:
+
+      //Hits of a diagonal band, with those of the neighbouring bands and windows, for a region
+      static constexpr uint32_t minHits = 2;
+
+      //Coarse windows of the shortest query confined
+      static constexpr offset_t minWindows = 4;
+
+    private:
+
+      struct Hit
+      {
+        seqno_t seqId;
+        offset_t pos;
+        strand_t strand;
+      };
+
+      hash_t below = 0;
+      offset_t windowLength = 0;
+
+      //Hits of each hash, as their offset and count in hits
+      ankerl::unordered_dense::map<hash_t, std::pair<uint64_t, uint32_t>> byHash;
+      std::vector<Hit> hits;
+
+      struct BandKey
+      {
+        seqno_t seqId;
+        strand_t strand;
+        int64_t band;
+        int64_t window;
+
+        bool operator==(const BandKey& other) const
+        {
+          return seqId == other.seqId && strand == other.strand && band == other.band && window == other.window;
+        }
+      };
+
+      struct BandKeyHash
+      {
+        size_t operator()(const BandKey& k) const
+        {
+          uint64_t h = (uint64_t(k.seqId) << 32) ^ (uint64_t(k.band) * 0x9E3779B97F4A7C15ULL)
+            ^ (uint64_t(k.window) * 0xBF58476D1CE4E5B9ULL) ^ uint64_t(k.strand > 0);
+          return h ^ (h >> 29);
+        }
+      };
+
+    public:
+
+      /**
+       * @brief               threshold of the hashes kept, for sketchSize minmers per segLength
+       *                      bases and windows factor times longer
+       */
+      static hash_t thresholdFor(int sketchSize, offset_t segLength, int factor)
+      {
+        const double share = sketchSize / (double(std::max<offset_t>(1, segLength)) * std::max(1, factor));
+        return share >= 1 ? std::numeric_limits<hash_t>::max() : hash_t(std::ldexp(share, 64));
+      }
+
+      /**
+       * @brief               index the minmers below sampleBelow
+       * @param[in] forEach   calls its argument with the hash, target id, position and
+       *                      strand of each minmer
+       */
+      template <typename ForEachMinmer>
+      void build(hash_t sampleBelow, offset_t coarseWindow, ForEachMinmer&& forEach)
+      {
+        below = sampleBelow;
+        windowLength = coarseWindow;
+        std::vector<std::pair<hash_t, Hit>> kept;
+        forEach([&](hash_t hash, seqno_t seqId, offset_t pos, strand_t strand) {
+          if (hash < below && strand != strnd::AMBIG)
+            kept.emplace_back(hash, Hit {seqId, pos, strand});
+        });
+        std::sort(kept.begin(), kept.end(), [](const auto& a, const auto& b) {
+          return a.first != b.first ? a.first < b.first
+            : a.second.seqId != b.second.seqId ? a.second.seqId < b.second.seqId : a.second.pos < b.second.pos;
+        });
+        hits.clear();
+        hits.reserve(kept.size());
+        byHash.clear();
+        for (size_t i = 0; i < kept.size(); )
+        {
+          size_t j = i;
+          while (j < kept.size() && kept[j].first == kept[i].first)
+            hits.push_back(kept[j++].second);
+          byHash.emplace(kept[i].first, std::make_pair(uint64_t(i), uint32_t(j - i)));
+          i = j;
+        }
+      }
+
+      hash_t sampleBelow() const
+      {
+        return below;
+      }
+
+      offset_t window() const
+      {
+        return windowLength;
+      }
+
+      /**
+       * @brief               candidate regions of each coarse window of a query
+       * @param[in] samples   position, hash and strand of the kmers of the query below
+       *                      sampleBelow()
+       * @param[in] targetLength  length of a target, by id
+       */
+      template <typename TargetLength>
+      void candidates(const std::vector<std::tuple<offset_t, hash_t, strand_t>>& samples, offset_t queryLen,
+                      TargetLength&& targetLength, CoarseCandidates& out) const
+      {
+        const offset_t band = windowLength;
+        const int64_t windows = std::max<int64_t>(1, (queryLen + windowLength - 1) / windowLength);
+        ankerl::unordered_dense::map<BandKey, uint32_t, BandKeyHash> counts;
+        for (const auto& sample : samples)
+        {
+          const auto it = byHash.find(std::get<1>(sample));
+          if (it == byHash.end())
+            continue;
+          const offset_t qpos = std::get<0>(sample);
+          for (uint64_t h = it->second.first; h < it->second.first + it->second.second; h++)
+          {
+            const Hit& hit = hits[h];
+            const strand_t strand = hit.strand == std::get<2>(sample) ? strnd::FWD : strnd::REV;
+            const offset_t diagonal = strand == strnd::FWD ? hit.pos - qpos : hit.pos + qpos;
+            const int64_t b = diagonal >= 0 ? diagonal / band : -((-diagonal + band - 1) / band);
+            counts[BandKey {hit.seqId, strand, b, qpos / windowLength}]++;
+          }
+        }
+
+        //Bands hit enough around each window, as regions of the window
+        std::vector<std::pair<int64_t, CandidateRegion>> byWindow;
+        const auto around = [&](const BandKey& k) {
+          uint32_t sum = 0;
+          for (int64_t db = -1; db <= 1; db++)
+            for (int64_t dw = -1; dw <= 1; dw++)
+            {
+              const auto it = counts.find(BandKey {k.seqId, k.strand, k.band + db, k.window + dw});
+              if (it != counts.end())
+                sum += it->second;
+            }
+          return sum;
+        };
+        for (const auto& c : counts)
+        {
+          const BandKey& k = c.first;
+          if (around(k) < minHits)
+            continue;
+          const offset_t length = targetLength(k.seqId);
+          for (int64_t w = std::max<int64_t>(0, k.window - 1); w <= std::min<int64_t>(windows - 1, k.window + 1); w++)
+          {
+            const offset_t qBegin = w * windowLength;
+            const offset_t qEnd = qBegin + windowLength;
+            offset_t begin, end;
+            if (k.strand == strnd::FWD)
+            {
+              begin = qBegin + k.band * band - band;
+              end = qEnd + (k.band + 1) * band + band;
+            }
+            else
+            {
+              begin = k.band * band - qEnd - band;
+              end = (k.band + 1) * band - qBegin + band;
+            }
+            begin = std::max<offset_t>(0, begin);
+            end = std::min<offset_t>(length, end);
+            if (begin < end)
+              byWindow.emplace_back(w, CandidateRegion {k.seqId, begin, end});
+          }
+        }
+
+        //Merged within each window
+        std::sort(byWindow.begin(), byWindow.end(), [](const auto& a, const auto& b) {
+          return a.first != b.first ? a.first < b.first
+            : a.second.seqId != b.second.seqId ? a.second.seqId < b.second.seqId : a.second.begin < b.second.begin;
+        });
+        out.windowLength = windowLength;
+        out.windowOffsets.assign(windows + 1, 0);
+        out.regions.clear();
+        for (size_t i = 0; i < byWindow.size(); i++)
+        {
+          const int64_t w = byWindow[i].first;
+          const CandidateRegion& r = byWindow[i].second;
+          if (i > 0 && byWindow[i - 1].first == w && out.regions.back().seqId == r.seqId && r.begin <= out.regions.back().end)
+          {
+            out.regions.back().end = std::max(out.regions.back().end, r.end);
+            continue;
+          }
+          out.regions.push_back(r);
+          out.windowOffsets[w + 1]++;
+        }
+        for (int64_t w = 0; w < windows; w++)
+          out.windowOffsets[w + 1] += out.windowOffsets[w];
+      }
+
+      /**
+       * @brief               bytes held, for the memory accounting
+       */
+      uint64_t bytes() const
+      {
+        return byHash.size() * (sizeof(hash_t) + sizeof(std::pair<uint64_t, uint32_t>)) + hits.size() * sizeof(Hit);
+      }
+  };
+}
+
+#endif
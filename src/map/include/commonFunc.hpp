@@ -16,9 +16,16 @@
 #include <numeric>
 #include <queue>
 #include <sstream>
+#include <cstring>
+#include <utility>
+#if defined(__BMI2__)
+#include <immintrin.h>
+#endif
 
 //Own includes
 #include "map/include/map_parameters.hpp"
+#include "map/include/dnaKernels.hpp"
+#include "map/include/packedSequence.hpp"
 
 //External includes
 #include "common/murmur3.h"
@@ -48,46 +55,8 @@ namespace skch {
          * @note    assumes dest is pre-allocated
          */
         inline void reverseComplement(const char *src, char *dest, int length) {
-            for (int i = 0; i < length; i++) {
-                char base = src[i];
-
-                switch (base) {
-                    case 'A':
-                        base = 'T';
-                        break;
-                    case 'C':
-                        base = 'G';
-                        break;
-                    case 'G':
-                        base = 'C';
-                        break;
-                    case 'T':
-                        base = 'A';
-                        break;
-                    default:
-                        break;
-                }
-
-                dest[length - i - 1] = base;
-            }
+            DnaKernels::reverseComplement(src, dest, length);
         }
-        // Crazy hack char table to test for canonical bases
-    constexpr int valid_dna[127] = {
-        1,
-        1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
-        1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
-        1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
-        1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
-        1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
-        1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
-        1, 1, 1, 1, 0, 1, 0, 1, 1, 1,
-        0, 1, 1, 1, 1, 1, 1, 1, 1, 1,
-        1, 1, 1, 0, 1, 1, 1, 1, 1, 1,
-        1, 1, 1, 1, 1, 1, 0, 1, 0, 1,
-        1, 1, 0, 1, 1, 1, 1, 1, 1, 1,
-        1, 1, 1, 1, 1, 0, 1, 1, 1, 1,
-        1, 1, 1, 1, 1, 1
-    };
 
     /**
      * @brief               convert DNA or AA alphabets to upper case, converting non-canonical DNA bases to N
@@ -95,15 +64,7 @@ namespace skch {
      * @param[in]   len     length of input sequence
      */
         inline void makeUpperCaseAndValidDNA(char *seq, offset_t len) {
-            for (int i = 0; i < len; i++) {
-                if (seq[i] > 96 && seq[i] < 123) {
-                    seq[i] -= 32;
-                }
-
-                if (valid_dna[seq[i]]) {
-                    seq[i] = 'N';
-                }
-            }
+            DnaKernels::upperValid(seq, len);
         }
 
 //        /**
@@ -146,6 +107,332 @@ namespace skch {
             return hash;
         }
 
+        /**
+         * @brief   getHash() of a kmer of K bytes, K known at compile time so that the
+         *          blocks and tail of murmur3 unroll
+         */
+        template <int K>
+        inline hash_t getHash(const char *seq) {
+            static_assert(K > 0, "kmers are not empty");
+            constexpr uint64_t c1 = BIG_CONSTANT(0x87c37b91114253d5);
+            constexpr uint64_t c2 = BIG_CONSTANT(0x4cf5ad432745937f);
+            constexpr int nblocks = K / 16;
+            constexpr int tailLen = K & 15;
+            const uint8_t* data = (const uint8_t*)seq;
+
+            uint64_t h1 = seed;
+            uint64_t h2 = seed;
+            for (int i = 0; i < nblocks; i++) {
+                uint64_t k1, k2;
+                std::memcpy(&k1, data + 16 * i, 8);
+                std::memcpy(&k2, data + 16 * i + 8, 8);
+                k1 *= c1; k1 = ROTL64(k1, 31); k1 *= c2; h1 ^= k1;
+                h1 = ROTL64(h1, 27); h1 += h2; h1 = h1 * 5 + 0x52dce729;
+                k2 *= c2; k2 = ROTL64(k2, 33); k2 *= c1; h2 ^= k2;
+                h2 = ROTL64(h2, 31); h2 += h1; h2 = h2 * 5 + 0x38495ab5;
+            }
+
+            //The n tail bytes before end make a little-endian word, as murmur3 assembles them.
+            //From 8 bytes of kmer on, the 8 bytes before end are loaded and shifted instead
+            const uint8_t* tail = data + nblocks * 16;
+            const auto tailWord = [](const uint8_t* end, auto n) {
+                constexpr int bytes = decltype(n)::value;
+                uint64_t word = 0;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+                if constexpr (K >= 8) {
+                    std::memcpy(&word, end - 8, 8);
+                    return word >> (8 * (8 - bytes));
+                }
+#endif
+                for (int j = 0; j < bytes; j++)
+                    word ^= (uint64_t)(end[j - bytes]) << (8 * j);
+                return word;
+            };
+            if constexpr (tailLen > 8) {
+                uint64_t k2 = tailWord(tail + tailLen, std::integral_constant<int, tailLen - 8>());
+                k2 *= c2; k2 = ROTL64(k2, 33); k2 *= c1; h2 ^= k2;
+            }
+            if constexpr (tailLen > 0) {
+                uint64_t k1 = tailWord(tail + std::min(tailLen, 8), std::integral_constant<int, std::min(tailLen, 8)>());
+                k1 *= c1; k1 = ROTL64(k1, 31); k1 *= c2; h1 ^= k1;
+            }
+
+            h1 ^= K; h2 ^= K;
+            h1 += h2;
+            h2 += h1;
+            h1 = fmix64(h1);
+            h2 = fmix64(h2);
+            return h1 + h2;
+        }
+
+        /**
+         * @brief   hashing of the kmers of a sequence, when not rolling, picked once per sequence
+         *          for its kmer size and alphabet: specialized on both for kmers of up to 32
+         *          bases, so that neither is looked at for each kmer, generic beyond
+         * @details for proteins hashBwd is the highest hash, so that it is ignored
+         */
+        class KmerHashKernel {
+          public:
+
+            KmerHashKernel(int kmerSize, int alphabetSize)
+              : kmerSize(kmerSize)
+            {
+              pick(alphabetSize == 4, std::make_integer_sequence<int, maxSpecializedKmerSize + 1>());
+            }
+
+            //hashes of the kmer at fwd and, for DNA, of its reverse complement at rev
+            inline void operator()(const char* fwd, const char* rev, hash_t& hashFwd, hash_t& hashBwd) const {
+              withReverse(fwd, rev, kmerSize, hashFwd, hashBwd);
+            }
+
+            //the same, reverse complementing the kmer itself
+            inline void operator()(const char* fwd, hash_t& hashFwd, hash_t& hashBwd) const {
+              alone(fwd, kmerSize, hashFwd, hashBwd);
+            }
+
+          private:
+
+            static constexpr int maxSpecializedKmerSize = 32;
+
+            using WithReverseFn = void (*)(const char*, const char*, int, hash_t&, hash_t&);
+            using AloneFn = void (*)(const char*, int, hash_t&, hash_t&);
+
+            int kmerSize;
+            WithReverseFn withReverse;
+            AloneFn alone;
+
+            //K of 0 for the generic kernel
+            template <int K>
+            static inline hash_t hash(const char* seq, int kmerSize) {
+              if constexpr (K > 0)
+                return getHash<K>(seq);
+              else
+                return getHash(seq, kmerSize);
+            }
+
+            template <int K, bool DNA>
+            static void hashWithReverse(const char* fwd, const char* rev, int kmerSize, hash_t& hashFwd, hash_t& hashBwd) {
+              hashFwd = hash<K>(fwd, kmerSize);
+              if constexpr (DNA)
+                hashBwd = hash<K>(rev, kmerSize);
+              else
+                hashBwd = std::numeric_limits<hash_t>::max();
+            }
+
+            template <int K, bool DNA>
+            static void hashAlone(const char* fwd, int kmerSize, hash_t& hashFwd, hash_t& hashBwd) {
+              hashFwd = hash<K>(fwd, kmerSize);
+              if constexpr (DNA && K > 0) {
+                char rev[K];
+                DnaKernels::reverseComplement(fwd, rev, K);
+                hashBwd = getHash<K>(rev);
+              } else if constexpr (DNA) {
+                thread_local std::vector<char> rev;
+                rev.resize(kmerSize);
+                DnaKernels::reverseComplement(fwd, rev.data(), kmerSize);
+                hashBwd = getHash(rev.data(), kmerSize);
+              } else {
+                hashBwd = std::numeric_limits<hash_t>::max();
+              }
+            }
+
+            template <bool DNA, int... K>
+            void pickFor(std::integer_sequence<int, K...>) {
+              static constexpr WithReverseFn withReverseOf[] = {hashWithReverse<K, DNA>...};
+              static constexpr AloneFn aloneOf[] = {hashAlone<K, DNA>...};
+              const int k = kmerSize > 0 && kmerSize <= maxSpecializedKmerSize ? kmerSize : 0;
+              withReverse = withReverseOf[k];
+              alone = aloneOf[k];
+            }
+
+            template <int... K>
+            void pick(bool dna, std::integer_sequence<int, K...> ks) {
+              if (dna)
+                pickFor<true>(ks);
+              else
+                pickFor<false>(ks);
+            }
+        };
+
+        /**
+         * @brief   spaced seeds as masks over a 2-bit encoded window
+         * @details seeds are '1'/'0' patterns anchored at the start of a window as wide
+         *          as the widest seed; the bases under the '1's make up the kmer
+         */
+        struct SpacedSeedMasks {
+          int span = 0;
+          std::vector<uint64_t> masks;
+
+          SpacedSeedMasks() = default;
+
+          explicit SpacedSeedMasks(const std::vector<ales::spaced_seed>& seeds) {
+            for (const auto& sp : seeds)
+              span = std::max<int>(span, sp.length);
+            if (span > 32) {
+              std::cerr << "[mashmap::skch::CommonFunc] ERROR: spaced seeds longer than 32 bases are not supported" << std::endl;
+              exit(1);
+            }
+            for (const auto& sp : seeds) {
+              uint64_t mask = 0;
+              for (size_t p = 0; p < sp.length; p++)
+                if (sp.seed[p] == '1')
+                  mask |= uint64_t(3) << (2 * (span - 1 - p));
+              masks.push_back(mask);
+            }
+          }
+
+          //this, or nullptr if there are no seeds
+          const SpacedSeedMasks* ifUsed() const {
+            return masks.empty() ? nullptr : this;
+          }
+        };
+
+        //Gather the bits of x under mask into the low bits
+        inline uint64_t extractBits(uint64_t x, uint64_t mask) {
+#if defined(__BMI2__)
+          return _pext_u64(x, mask);
+#else
+          uint64_t res = 0;
+          for (uint64_t bit = 1; mask != 0; bit <<= 1) {
+            if (x & mask & -mask)
+              res |= bit;
+            mask &= mask - 1;
+          }
+          return res;
+#endif
+        }
+
+        /**
+         * @brief   canonical kmer hashing over a rolling 2-bit encoding of both strands
+         * @details each base updates the forward and reverse complement codes in O(1),
+         *          which are then finalized with murmur3's fmix64, instead of hashing
+         *          the k bytes of each strand with getHash(). Only for DNA and k <= 32
+         *
+         *          With spaced seeds, the window spans the widest seed and the kmer of
+         *          each seed is extracted from both strands by its mask (PEXT with BMI2).
+         *          The seed giving the smallest canonical hash is kept, each seed
+         *          salting its hashes differently
+         */
+        class RollingKmerHasher {
+          public:
+            explicit RollingKmerHasher(int kmerSize, const SpacedSeedMasks* spacedSeeds = nullptr)
+              : mask(kmerSize == 32 ? ~uint64_t(0) : (uint64_t(1) << (2 * kmerSize)) - 1),
+                revShift(2 * (kmerSize - 1)),
+                spacedSeeds(spacedSeeds) {}
+
+            //Append a base to the forward kmer, 'N' is encoded as 'A' and left to the caller to skip
+            inline void push(char base) {
+              pushCode(baseCode(base));
+            }
+
+            //Same, with the 2-bit code of the base as in PackedSequence
+            inline void pushCode(uint64_t code) {
+              fwd = ((fwd << 2) | code) & mask;
+              rev = (rev >> 2) | ((3 - code) << revShift);
+            }
+
+            //Hashes of the current kmer on both strands
+            inline void hashes(hash_t& fwdHash, hash_t& revHash) const {
+              if (spacedSeeds == nullptr) {
+                fwdHash = fmix64(fwd);
+                revHash = fmix64(rev);
+                return;
+              }
+              hash_t best = std::numeric_limits<hash_t>::max();
+              fwdHash = revHash = best;
+              for (size_t j = 0; j < spacedSeeds->masks.size(); j++) {
+                const uint64_t salt = (j + 1) * 0x9e3779b97f4a7c15ULL;
+                const hash_t f = fmix64(extractBits(fwd, spacedSeeds->masks[j]) ^ salt);
+                const hash_t r = fmix64(extractBits(rev, spacedSeeds->masks[j]) ^ salt);
+                if (std::min(f, r) < best) {
+                  best = std::min(f, r);
+                  fwdHash = f;
+                  revHash = r;
+                }
+              }
+            }
+
+            static bool supports(int kmerSize, int alphabetSize) {
+              return alphabetSize == 4 && kmerSize <= 32;
+            }
+
+          private:
+            uint64_t fwd = 0;
+            uint64_t rev = 0;
+            const uint64_t mask;
+            const int revShift;
+            const SpacedSeedMasks* spacedSeeds;
+
+            static inline uint64_t baseCode(char base) {
+              switch (base) {
+                case 'C': return 1;
+                case 'G': return 2;
+                case 'T': return 3;
+                default: return 0;
+              }
+            }
+        };
+
+        /**
+         * @brief   open syncmer test of the kmers of a sequence, fed one base at a time
+         * @details a kmer is kept if its smallest canonical s-mer starts at offset
+         *          t = (k - s) / 2 or k - s - t, which is the same test on both strands.
+         *          That is a fixed 1 / (k - s + 1) of kmers, 2 / (k - s + 1) if k - s is
+         *          odd, and unlike a hash threshold the kept kmers are spread out by
+         *          construction. With a syncmer size of 0 every kmer is kept
+         */
+        class SyncmerFilter {
+          public:
+            SyncmerFilter(int kmerSize, int syncmerSize)
+              : smers(syncmerSize > 0 ? syncmerSize : 1),
+                smerSize(syncmerSize),
+                window(syncmerSize > 0 ? kmerSize - syncmerSize + 1 : 1, 0),
+                offsetA((kmerSize - syncmerSize) / 2),
+                offsetB(kmerSize - syncmerSize - offsetA) {}
+
+            inline bool enabled() const { return smerSize > 0; }
+
+            inline void push(char base) {
+              if (!enabled())
+                return;
+              smers.push(base);
+              addSmer();
+            }
+
+            inline void pushCode(uint64_t code) {
+              if (!enabled())
+                return;
+              smers.pushCode(code);
+              addSmer();
+            }
+
+            //Whether the kmer ending at the last base fed is kept, k bases or more being fed
+            inline bool keep() const {
+              if (!enabled())
+                return true;
+              const uint64_t first = pushed - smerSize - (window.size() - 1);
+              const hash_t smallest = *std::min_element(window.begin(), window.end());
+              return window[(first + offsetA) % window.size()] == smallest
+                || window[(first + offsetB) % window.size()] == smallest;
+            }
+
+          private:
+            RollingKmerHasher smers;
+            const int smerSize;
+            std::vector<hash_t> window;   //canonical hashes of the last k - s + 1 s-mers
+            const uint64_t offsetA;
+            const uint64_t offsetB;
+            uint64_t pushed = 0;
+
+            inline void addSmer() {
+              if (++pushed < (uint64_t) smerSize)
+                return;
+              hash_t hashFwd, hashBwd;
+              smers.hashes(hashFwd, hashBwd);
+              window[(pushed - smerSize) % window.size()] = std::min(hashFwd, hashBwd);
+            }
+        };
+
         /**
          * @brief		takes hash value of kmer and adjusts it based on kmer's weight
          *					this value will determine its order for minimizer selection
@@ -170,6 +457,73 @@ namespace skch {
 //        }
 
 
+        /**
+         * @brief   the s smallest distinct hashes seen so far, with the info of their kmers
+         * @details kept as an array sorted by hash rather than a heap and a hash map:
+         *          most kmers are rejected by one compare against the largest hash, and
+         *          for the sketch sizes in use, shifting on the rare insertions is cheaper
+         *          than hash map updates. T needs a `hash` member
+         */
+        template <typename T>
+        class BottomSketch {
+          public:
+            void reset(size_t sketchSize) {
+              items.clear();
+              items.reserve(sketchSize + 1);
+              capacity = sketchSize;
+            }
+
+            /**
+             * @brief   offer a hash, calling update(T&) if it is already kept, or
+             *          keeping make() if it is among the s smallest
+             */
+            template <typename Make, typename Update>
+            inline void offer(hash_t hash, Make&& make, Update&& update) {
+              if (items.size() == capacity && (capacity == 0 || hash > items.back().hash))
+                return;
+              const size_t idx = std::lower_bound(items.begin(), items.end(), hash,
+                  [](const T& item, hash_t h) { return item.hash < h; }) - items.begin();
+              if (idx < items.size() && items[idx].hash == hash) {
+                update(items[idx]);
+                return;
+              }
+              if (items.size() == capacity)
+                items.pop_back();
+              items.insert(items.begin() + idx, make());
+            }
+
+            //kept items, by increasing hash
+            std::vector<T>& sorted() { return items; }
+
+          private:
+            std::vector<T> items;
+            size_t capacity = 0;
+        };
+
+        /**
+         * @brief   buffers and containers kept by each thread across sketching calls,
+         *          so that sketching a fragment doesn't go through the allocator
+         */
+        struct SketchWorkspace {
+          std::vector<char> seqRev;
+          std::vector<char> unpackedSpan;
+          BottomSketch<MinmerInfo> bottomSketch;
+          std::vector<KmerInfo> heapWindow;
+
+          //Larger reverse complement buffers are given back after use
+          static constexpr size_t maxRetainedSeqRev = 1 << 24;
+
+          void releaseLargeBuffers() {
+            if (seqRev.capacity() > maxRetainedSeqRev)
+              std::vector<char>().swap(seqRev);
+          }
+        };
+
+        inline SketchWorkspace& threadSketchWorkspace() {
+          thread_local SketchWorkspace workspace;
+          return workspace;
+        }
+
         /**
          * @brief       Compute the minimum s kmers for a string.
          * @param[out]  minmerIndex     container storing sketched Kmers 
@@ -178,6 +532,9 @@ namespace skch {
          * @param[in]   kmerSize
          * @param[in]   s                   sketch size. 
          * @param[in]   seqCounter          current sequence number, used while saving the position of minimizer
+         * @param[in]   rollingHash         hash kmers with RollingKmerHasher
+         * @param[in]   spacedSeeds         sketch spaced seeds instead of kmers, with RollingKmerHasher
+         * @param[in]   syncmerSize         sketch only open syncmers of this s-mer size, 0 for all kmers
          */
         template <typename T>
           inline void sketchSequence(
@@ -187,21 +544,39 @@ namespace skch {
               int kmerSize, 
               int alphabetSize,
               int sketchSize,
-              seqno_t seqCounter)
+              seqno_t seqCounter,
+              bool rollingHash = false,
+              const SpacedSeedMasks* spacedSeeds = nullptr,
+              int syncmerSize = 0)
         {
           makeUpperCaseAndValidDNA(seq, len);
 
+          if (spacedSeeds != nullptr)
+            kmerSize = spacedSeeds->span;
+          const bool useRolling = (rollingHash || spacedSeeds != nullptr) && RollingKmerHasher::supports(kmerSize, alphabetSize);
+          RollingKmerHasher roller(useRolling ? kmerSize : 1, spacedSeeds);
+          for (offset_t j = 0; useRolling && j < kmerSize - 1 && j < len; j++)
+            roller.push(seq[j]);
+          SyncmerFilter syncmers(kmerSize, syncmerSize);
+          for (offset_t j = 0; syncmers.enabled() && j < kmerSize - 1 && j < len; j++)
+            syncmers.push(seq[j]);
+
+          SketchWorkspace& workspace = threadSketchWorkspace();
+
           //Compute reverse complement of seq
-          std::unique_ptr<char[]> seqRev(new char[len]);
-          //char* seqRev = new char[len];
+          std::vector<char>& seqRev = workspace.seqRev;
 
-          if(alphabetSize == 4) //not protein
-            CommonFunc::reverseComplement(seq, seqRev.get(), len);
+          //Sized for proteins as well, for the kernel to be handed a pointer into it
+          if (!useRolling)
+          {
+            seqRev.resize(len);
+            if(alphabetSize == 4) //not protein
+              CommonFunc::reverseComplement(seq, seqRev.data(), len);
+          }
 
-          // TODO cleanup
-          ankerl::unordered_dense::map<hash_t, MinmerInfo> sketched_vals;
-          std::vector<hash_t> sketched_heap;
-          sketched_heap.reserve(sketchSize+1);
+          BottomSketch<MinmerInfo>& sketched = workspace.bottomSketch;
+          sketched.reset(sketchSize);
+          const KmerHashKernel hashKmer(kmerSize, alphabetSize);
             
           // Get distance until last "N"
           int ambig_kmer_count = 0;
@@ -222,16 +597,23 @@ namespace skch {
               ambig_kmer_count = kmerSize;
             }
             //Hash kmers
-            hash_t hashFwd = CommonFunc::getHash(seq + i, kmerSize); 
+            hash_t hashFwd;
             hash_t hashBwd;
 
-            if(alphabetSize == 4)
-              hashBwd = CommonFunc::getHash(seqRev.get() + len - i - kmerSize, kmerSize);
-            else  //proteins
-              hashBwd = std::numeric_limits<hash_t>::max();   //Pick a dummy high value so that it is ignored later
+            if (useRolling)
+            {
+              roller.push(seq[i + kmerSize - 1]);
+              roller.hashes(hashFwd, hashBwd);
+            }
+            else
+            {
+              //For proteins, hashBwd is a dummy high value so that it is ignored later
+              hashKmer(seq + i, seqRev.data() + len - i - kmerSize, hashFwd, hashBwd);
+            }
+            syncmers.push(seq[i + kmerSize - 1]);
 
             //Consider non-symmetric kmers only
-            if(hashBwd != hashFwd && ambig_kmer_count == 0)
+            if(hashBwd != hashFwd && ambig_kmer_count == 0 && syncmers.keep())
             {
               //Take minimum value of kmer and its reverse complement
               hash_t currentKmer = std::min(hashFwd, hashBwd);
@@ -239,35 +621,14 @@ namespace skch {
               //Check the strand of this minimizer hash value
               auto currentStrand = hashFwd < hashBwd ? strnd::FWD : strnd::REV;
 
-              if (sketched_heap.size() < sketchSize || currentKmer <= sketched_heap.front())
-              {
-                if (sketched_heap.empty() || sketched_vals.find(currentKmer) == sketched_vals.end()) 
-                {
-
-                  // Add current hash to heap
-                  if (sketched_vals.size() < sketchSize || currentKmer < sketched_heap.front())  
-                  {
-                      sketched_vals[currentKmer] = MinmerInfo{currentKmer, i, i, seqCounter, currentStrand};
-                      sketched_heap.push_back(currentKmer);
-                      std::push_heap(sketched_heap.begin(), sketched_heap.end());
-                  }
-
-                  // Remove one if too large
-                  if (sketched_vals.size() > sketchSize) 
-                  {
-                      sketched_vals.erase(sketched_heap[0]);
-                      std::pop_heap(sketched_heap.begin(), sketched_heap.end());
-                      sketched_heap.pop_back();
-                  }
-                } 
-                else 
-                {
-                  // TODO these sketched values might never be useful, might save memory by deleting
-                  // extend the length of the window
-                  sketched_vals[currentKmer].wpos_end = i;
-                  sketched_vals[currentKmer].strand += currentStrand == strnd::FWD ? 1 : -1;
-                }
-              }
+              sketched.offer(currentKmer,
+                  [&]() { return MinmerInfo{currentKmer, i, i, seqCounter, currentStrand}; },
+                  [&](MinmerInfo& mi) {
+                    // TODO these sketched values might never be useful, might save memory by deleting
+                    // extend the length of the window
+                    mi.wpos_end = i;
+                    mi.strand += currentStrand == strnd::FWD ? 1 : -1;
+                  });
             }
             if (ambig_kmer_count > 0)
             {
@@ -275,19 +636,213 @@ namespace skch {
             }
           }
 
-          minmerIndex.resize(sketched_heap.size());
-          for (auto rev_it = minmerIndex.rbegin(); rev_it != minmerIndex.rend(); rev_it++)
+          minmerIndex.assign(sketched.sorted().begin(), sketched.sorted().end());
+          for (auto& mi : minmerIndex)
           {
-            *rev_it = (std::move(sketched_vals[sketched_heap.front()]));
-            (*rev_it).strand = (*rev_it).strand > 0 ? strnd::FWD : ((*rev_it).strand == 0 ? strnd::AMBIG : strnd::REV);
-
-            std::pop_heap(sketched_heap.begin(), sketched_heap.end());
-            sketched_heap.pop_back();
+            mi.strand = mi.strand > 0 ? strnd::FWD : (mi.strand == 0 ? strnd::AMBIG : strnd::REV);
           }
+          workspace.releaseLargeBuffers();
           return;
         }
         
 
+        /**
+         * @brief   canonical kmer hashes of a whole query, computed once and shared
+         *          by the sketches of its fragments
+         * @details the query is normalized once, and hashes are kept for a sliding
+         *          range of kmer positions: fragments sketched in increasing order of
+         *          position hash each kmer once, overlapping ones included, while
+         *          memory stays bounded by the fragment length
+         */
+        class KmerHashStream {
+          public:
+            //The sequence must be normalized by makeUpperCaseAndValidDNA, so that streams over
+            //parts of it can run concurrently
+            KmerHashStream(const char* seq, offset_t len, int kmerSize, int alphabetSize, bool rollingHash,
+                const SpacedSeedMasks* spacedSeeds = nullptr, int syncmerSize = 0)
+              : seq(seq), len(len), kmerSize(spacedSeeds != nullptr ? spacedSeeds->span : kmerSize), alphabetSize(alphabetSize),
+                useRolling((rollingHash || spacedSeeds != nullptr) && RollingKmerHasher::supports(this->kmerSize, alphabetSize)),
+                roller(useRolling ? this->kmerSize : 1, spacedSeeds),
+                syncmers(this->kmerSize, syncmerSize), hashKmer(this->kmerSize, alphabetSize) {}
+
+            //Over a packed sequence, the rolling hash reads 2-bit codes as they are
+            KmerHashStream(const PackedSequence& packedSeq, int kmerSize, int alphabetSize, bool rollingHash,
+                const SpacedSeedMasks* spacedSeeds = nullptr, int syncmerSize = 0)
+              : seq(nullptr), len(packedSeq.len), kmerSize(spacedSeeds != nullptr ? spacedSeeds->span : kmerSize), alphabetSize(alphabetSize),
+                useRolling((rollingHash || spacedSeeds != nullptr) && RollingKmerHasher::supports(this->kmerSize, alphabetSize)),
+                roller(useRolling ? this->kmerSize : 1, spacedSeeds),
+                syncmers(this->kmerSize, syncmerSize), hashKmer(this->kmerSize, alphabetSize), packed(&packedSeq) {}
+
+            /**
+             * @brief       Compute the minimum s kmers of a fragment, as sketchSequence would
+             * @param[in]   begin       fragment offset, never lower than at the previous call
+             * @param[in]   fragLen     fragment length
+             */
+            template <typename T>
+              void sketch(std::vector<T>& minmerIndex, offset_t begin, offset_t fragLen, int sketchSize, seqno_t seqCounter)
+              {
+                const offset_t end = std::max(begin, begin + fragLen - kmerSize + 1);
+                hashUpTo(end);
+
+                // Kmers before this fragment won't be needed again
+                const size_t dropped = std::min<size_t>(begin - hashesBegin, hashes.size());
+                hashes.erase(hashes.begin(), hashes.begin() + dropped);
+                hashesBegin += dropped;
+
+                BottomSketch<MinmerInfo>& sketched = threadSketchWorkspace().bottomSketch;
+                sketched.reset(sketchSize);
+                for (offset_t i = begin; i < end; i++)
+                {
+                  const KmerHash& kh = hashes[i - hashesBegin];
+                  if (kh.strand == strnd::AMBIG)
+                    continue;
+                  const offset_t pos = i - begin;
+                  sketched.offer(kh.hash,
+                      [&]() { return MinmerInfo{kh.hash, pos, pos, seqCounter, kh.strand}; },
+                      [&](MinmerInfo& mi) {
+                        mi.wpos_end = pos;
+                        mi.strand += kh.strand == strnd::FWD ? 1 : -1;
+                      });
+                }
+
+                minmerIndex.assign(sketched.sorted().begin(), sketched.sorted().end());
+                for (auto& mi : minmerIndex)
+                {
+                  mi.strand = mi.strand > 0 ? strnd::FWD : (mi.strand == 0 ? strnd::AMBIG : strnd::REV);
+                }
+              }
+
+            /**
+             * @brief       Start the stream at a position instead of the beginning of the sequence
+             * @details     only valid before the first call to sketch
+             */
+            void seek(offset_t pos)
+            {
+              hashesBegin = pos;
+              nextBase = pos;
+            }
+
+            /**
+             * @brief       Hand the kmers of the whole sequence whose hashes are below a
+             *              threshold to sampled, with their position, hash and strand, as a
+             *              FracMinHash sketch of it, hashed a block at a time
+             * @details     only valid before the first call to sketch
+             */
+            template <typename Sampled>
+            void sampleBelow(hash_t below, Sampled&& sampled)
+            {
+              const offset_t last = std::max<offset_t>(hashesBegin, len - kmerSize + 1);
+              while (hashesBegin + (offset_t)hashes.size() < last)
+              {
+                hashUpTo(std::min<offset_t>(last, hashesBegin + (offset_t)hashes.size() + sampleBlock));
+                for (size_t i = 0; i < hashes.size(); i++)
+                {
+                  const KmerHash& kh = hashes[i];
+                  if (kh.strand != strnd::AMBIG && kh.hash < below)
+                    sampled(hashesBegin + (offset_t)i, kh.hash, kh.strand);
+                }
+                hashesBegin += hashes.size();
+                hashes.clear();
+              }
+            }
+
+          private:
+            //Canonical hash of the kmer at a position, strand AMBIG if it isn't sketched
+            struct KmerHash {
+              hash_t hash;
+              strand_t strand;
+            };
+
+            const char* seq;
+            offset_t len;
+            int kmerSize;
+            int alphabetSize;
+            bool useRolling;
+            RollingKmerHasher roller;
+            SyncmerFilter syncmers;
+            KmerHashKernel hashKmer;
+            const PackedSequence* packed = nullptr;
+            size_t nextRun = 0;           //first 'N' run of packed not entirely before nextBase
+
+            std::vector<KmerHash> hashes;
+            offset_t hashesBegin = 0;     //position of the kmer in hashes[0]
+            offset_t nextBase = 0;        //next base to feed to the rolling hash and N tracking
+            offset_t lastAmbig = -1;      //position of the last 'N' fed
+
+            //Kmers hashed at a time by sampleBelow
+            static constexpr offset_t sampleBlock = 1 << 16;
+
+            void hashUpTo(offset_t end)
+            {
+              const offset_t from = hashesBegin + hashes.size();
+              if (end <= from)
+                return;
+
+              //Bases of the new kmers, unpacked unless the rolling hash reads the packed codes
+              SketchWorkspace& workspace = threadSketchWorkspace();
+              const offset_t spanLen = end - from + kmerSize - 1;
+              const bool readCodes = packed != nullptr && useRolling;
+              const char* span = seq != nullptr ? seq + from : nullptr;
+              if (packed != nullptr && !useRolling)
+              {
+                workspace.unpackedSpan.resize(spanLen);
+                packed->unpack(from, spanLen, workspace.unpackedSpan.data());
+                span = workspace.unpackedSpan.data();
+              }
+
+              //Reverse complement of the bases of the new kmers
+              std::vector<char>& seqRev = workspace.seqRev;
+              if (!useRolling)
+              {
+                seqRev.resize(spanLen);
+                if (alphabetSize == 4)
+                  reverseComplement(span, seqRev.data(), spanLen);
+              }
+
+              hashes.reserve(end - hashesBegin);
+              for (offset_t i = from; i < end; i++)
+              {
+                for (; nextBase < i + kmerSize; nextBase++)
+                {
+                  if (readCodes)
+                  {
+                    const auto& nRuns = packed->nRuns;
+                    while (nextRun < nRuns.size() && nRuns[nextRun].second <= nextBase)
+                      nextRun++;
+                    if (nextRun < nRuns.size() && nRuns[nextRun].first <= nextBase)
+                      lastAmbig = nextBase;
+                    roller.pushCode(packed->code(nextBase));
+                    syncmers.pushCode(packed->code(nextBase));
+                    continue;
+                  }
+                  const char base = span[nextBase - from];
+                  if (base == 'N')
+                    lastAmbig = nextBase;
+                  if (useRolling)
+                    roller.push(base);
+                  syncmers.push(base);
+                }
+
+                hash_t hashFwd;
+                hash_t hashBwd;
+                if (useRolling)
+                {
+                  roller.hashes(hashFwd, hashBwd);
+                }
+                else
+                {
+                  hashKmer(span + (i - from), seqRev.data() + spanLen - (i - from) - kmerSize, hashFwd, hashBwd);
+                }
+
+                //Consider non-symmetric kmers without 'N' only
+                if (hashFwd != hashBwd && lastAmbig < i && syncmers.keep())
+                  hashes.push_back(KmerHash{std::min(hashFwd, hashBwd), hashFwd < hashBwd ? strnd::FWD : strnd::REV});
+                else
+                  hashes.push_back(KmerHash{0, strnd::AMBIG});
+              }
+            }
+        };
+
         /**
          * @brief       Compute winnowed minmers from a given sequence and add to the index
          * @param[out]  minmerIndex  table storing minmers and their position as we compute them
@@ -297,6 +852,9 @@ namespace skch {
          * @param[in]   windowSize
          * @param[in]   sketchSize      sketch size. 
          * @param[in]   seqCounter      current sequence number, used while saving the position of minimizer
+         * @param[in]   rollingHash     hash kmers with RollingKmerHasher
+         * @param[in]   spacedSeeds     sketch spaced seeds instead of kmers, with RollingKmerHasher
+         * @param[in]   syncmerSize     sketch only open syncmers of this s-mer size, 0 for all kmers
          */
         template <typename T>
           inline void addMinmers(std::vector<T> &minmerIndex, 
@@ -305,7 +863,10 @@ namespace skch {
               int windowSize,
               int alphabetSize,
               int sketchSize,
-              seqno_t seqCounter)
+              seqno_t seqCounter,
+              bool rollingHash = false,
+              const SpacedSeedMasks* spacedSeeds = nullptr,
+              int syncmerSize = 0)
           {
             /**
              * Double-ended queue (saves minimum at front end)
@@ -320,15 +881,23 @@ namespace skch {
               {return std::tie(a.hash, a.pos) > std::tie(b.hash, b.pos);};
             using windowMap_t = std::map<hash_t, MinmerKmerPair_t>;
             windowMap_t sortedWindow;
-            std::vector<KmerInfo> heapWindow;
+            SketchWorkspace& workspace = threadSketchWorkspace();
+            std::vector<KmerInfo>& heapWindow = workspace.heapWindow;
+            heapWindow.clear();
 
             makeUpperCaseAndValidDNA(seq, len);
 
-            //Compute reverse complement of seq
-            std::unique_ptr<char[]> seqRev(new char[kmerSize]);
-
-            //if(alphabetSize == 4) //not protein
-              //CommonFunc::reverseComplement(seq, seqRev.get(), len);
+            if (spacedSeeds != nullptr)
+              kmerSize = spacedSeeds->span;
+            const bool useRolling = (rollingHash || spacedSeeds != nullptr) && RollingKmerHasher::supports(kmerSize, alphabetSize);
+            RollingKmerHasher roller(useRolling ? kmerSize : 1, spacedSeeds);
+            for (offset_t j = 0; useRolling && j < kmerSize - 1 && j < len; j++)
+              roller.push(seq[j]);
+            SyncmerFilter syncmers(kmerSize, syncmerSize);
+            for (offset_t j = 0; syncmers.enabled() && j < kmerSize - 1 && j < len; j++)
+              syncmers.push(seq[j]);
+
+            const KmerHashKernel hashKmer(kmerSize, alphabetSize);
             
             // Get distance until last "N"
             int ambig_kmer_count = 0;
@@ -354,16 +923,20 @@ namespace skch {
               }
 
               //Hash kmers
-              hash_t hashFwd = CommonFunc::getHash(seq + i, kmerSize); 
+              hash_t hashFwd;
               hash_t hashBwd;
 
-              if(alphabetSize == 4) 
+              if (useRolling)
+              {
+                roller.push(seq[i + kmerSize - 1]);
+                roller.hashes(hashFwd, hashBwd);
+              }
+              else
               {
-                CommonFunc::reverseComplement(seq + i, seqRev.get(), kmerSize);
-                hashBwd = CommonFunc::getHash(seqRev.get(), kmerSize);
+                //For proteins, hashBwd is a dummy high value so that it is ignored later
+                hashKmer(seq + i, hashFwd, hashBwd);
               }
-              else  //proteins
-                hashBwd = std::numeric_limits<hash_t>::max();   //Pick a dummy high value so that it is ignored later
+              syncmers.push(seq[i + kmerSize - 1]);
 
               //Take minimum value of kmer and its reverse complement
               hash_t currentKmer = std::min(hashFwd, hashBwd);
@@ -414,7 +987,7 @@ namespace skch {
                 ambig_kmer_count = kmerSize;
               }
               //Consider non-symmetric kmers only
-              if(hashBwd != hashFwd && ambig_kmer_count == 0)
+              if(hashBwd != hashFwd && ambig_kmer_count == 0 && syncmers.keep())
               {
                 // Add current hash to window
                 Q.push_back(std::make_tuple(currentKmer, currentStrand, i)); 
@@ -0,0 +1,128 @@
+/**
+ * @file    compressedPointLists.hpp
+ * @brief   interval point lists of the seed lookup index, delta and varint encoded
+ */
+
+#ifndef COMPRESSED_POINT_LISTS_HPP
+#define COMPRESSED_POINT_LISTS_HPP
+
+#include <cstdint>
+#include <vector>
+
+#include "map/include/base_types.hpp"
+
+namespace skch
+{
+  /**
+   * @brief     interval point lists of the keys of a flattened lookup index, in a few bytes
+   *            per point rather than 8, for --compressed-index
+   * @details   the list of a key is its count of points, then the bits of its first point
+   *            and the zigzag deltas between the next ones, each as a varint. Lists are
+   *            grouped in blocks of listsPerBlock whose byte offsets are kept, so that a
+   *            list is found by skipping at most listsPerBlock - 1 lists of its block
+   */
+  class CompressedPointLists
+  {
+    public:
+
+      static constexpr uint64_t listsPerBlock = 16;
+
+      /**
+       * @brief               encode the lists of a flattened index
+       * @param[in] offsets   CSR offsets of the lists of each key into points, lists + 1 of them
+       */
+      void build(const uint64_t* offsets, const PackedIntervalPoint* points, uint64_t lists)
+      {
+        data.clear();
+        blockOffsets.clear();
+        blockOffsets.reserve(lists / listsPerBlock + 1);
+        for (uint64_t list = 0; list < lists; list++)
+        {
+          if (list % listsPerBlock == 0)
+            blockOffsets.push_back(data.size());
+          putVarint(offsets[list + 1] - offsets[list]);
+          uint64_t previous = 0;
+          for (uint64_t p = offsets[list]; p < offsets[list + 1]; p++)
+          {
+            const int64_t delta = int64_t(points[p].bits - previous);
+            putVarint((uint64_t(delta) << 1) ^ uint64_t(delta >> 63));
+            previous = points[p].bits;
+          }
+        }
+        data.shrink_to_fit();
+      }
+
+      /**
+       * @brief               append the points of a list to out
+       * @return              count of points of the list
+       */
+      uint64_t decode(uint64_t list, std::vector<PackedIntervalPoint>& out) const
+      {
+        const uint8_t* cursor = data.data() + blockOffsets[list / listsPerBlock];
+        for (uint64_t skipped = list % listsPerBlock; skipped > 0; skipped--)
+        {
+          for (uint64_t count = getVarint(cursor); count > 0; count--)
+          {
+            while (*cursor & 0x80)
+              cursor++;
+            cursor++;
+          }
+        }
+        const uint64_t count = getVarint(cursor);
+        uint64_t bits = 0;
+        for (uint64_t p = 0; p < count; p++)
+        {
+          const uint64_t zigzag = getVarint(cursor);
+          bits += (zigzag >> 1) ^ (~(zigzag & 1) + 1);
+          PackedIntervalPoint point;
+          point.bits = bits;
+          out.push_back(point);
+        }
+        return count;
+      }
+
+      void prefetch(uint64_t list) const
+      {
+        __builtin_prefetch(data.data() + blockOffsets[list / listsPerBlock]);
+      }
+
+      uint64_t bytes() const
+      {
+        return data.capacity() + blockOffsets.capacity() * sizeof(uint64_t);
+      }
+
+      bool empty() const
+      {
+        return blockOffsets.empty();
+      }
+
+    private:
+
+      std::vector<uint8_t> data;
+      std::vector<uint64_t> blockOffsets;
+
+      void putVarint(uint64_t value)
+      {
+        while (value >= 0x80)
+        {
+          data.push_back(uint8_t(value) | 0x80);
+          value >>= 7;
+        }
+        data.push_back(uint8_t(value));
+      }
+
+      static uint64_t getVarint(const uint8_t*& cursor)
+      {
+        uint64_t value = 0;
+        for (int shift = 0; ; shift += 7)
+        {
+          const uint8_t byte = *cursor++;
+          value |= uint64_t(byte & 0x7f) << shift;
+          if (!(byte & 0x80))
+            return value;
+        }
+      }
+  };
+}
+
+#endif
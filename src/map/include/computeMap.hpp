@@ -11,8 +11,13 @@
 #include <limits>
 #include <vector>
 #include <algorithm>
+#include <map>
+#include <deque>
+#include <chrono>
+#include <cstdio>
 #include <unordered_map>
 #include <fstream>
+#include <sstream>
 #include <zlib.h>
 #include <cassert>
 #include <numeric>
@@ -20,9 +25,12 @@
 #include <filesystem>
 namespace fs = std::filesystem;
 #include <queue>
+#include <memory>
+#include <mutex>
 
 //Own includes
 #include "map/include/base_types.hpp"
+#include "map/include/nameArena.hpp"
 #include "map/include/map_parameters.hpp"
 #include "map/include/commonFunc.hpp"
 #include "map/include/winSketch.hpp"
@@ -31,10 +39,26 @@ namespace fs = std::filesystem;
 #include "map/include/MIIteratorL2.hpp"
 #include "map/include/ThreadPool.hpp"
 #include "map/include/filter.hpp"
+#include "map/include/mappingSpill.hpp"
+#include "map/include/cutoffCache.hpp"
+#include "map/include/mappingQueue.hpp"
+#include "map/include/binaryMappings.hpp"
+#include "map/include/memoryBudget.hpp"
+#include "map/include/mappingCheckpoint.hpp"
+#include "map/include/mappingCache.hpp"
+#include "map/include/seedAnchors.hpp"
+#include "map/include/queryDedup.hpp"
+#include "map/include/shardedMapping.hpp"
 
 //External includes
 #include "common/seqiter.hpp"
 #include "common/progress.hpp"
+#include "common/task_executor.hpp"
+#include "common/output_writer.hpp"
+#include "common/run_report.hpp"
+#include "common/hot_counters.hpp"
+#include "common/trace.hpp"
+#include "common/probes.hpp"
 #include "map_stats.hpp"
 #include "robin-hood-hashing/robin_hood.h"
 // if we ever want to do the union-find chaining in parallel
@@ -46,12 +70,17 @@ namespace fs = std::filesystem;
 
 namespace skch
 {
+  //Benchmarks of the kernels of Map, see src/bench/wfmash_bench.cpp
+  struct MapBench;
+
   /**
    * @class     skch::Map
    * @brief     L1 and L2 mapping stages
    */
   class Map
   {
+    friend struct MapBench;
+
     public:
 
       //Type for Stage L1's predicted candidate location
@@ -100,18 +129,127 @@ namespace skch
       typedef std::function< void(const MappingResult&) > PostProcessResultsFn_t;
       PostProcessResultsFn_t processMappingResults;
 
+      //Optional source of the queries in place of the query files, handing each named sequence to its argument
+      typedef std::function< void(const std::function< void(const std::string&, std::string&&) >&) > QuerySourceFn_t;
+      QuerySourceFn_t querySource;
+
       //Container to store query sequence name and length
       //used only if one-to-one filtering is ON
       std::vector<ContigInfo> qmetadata;
+      NameArena qmetadataNames;
+
+      //Reference group of each query of qmetadata, with skip_prefix
+      std::vector<int> qmetadataGroups;
 
       //Vector for sketch cutoffs. Position [i] indicates the minimum intersection size required
       //for an L1 candidate if the best intersection size is i;
       std::vector<int> sketchCutoffs; 
 
+      //Position [s] is the fewest shared sketch elements an L2 mapping of a query with sketch
+      //size s needs to pass the identity threshold
+      std::vector<int> minReportedShared;
+
+      //Identities of L2 mappings by sketch size and shared sketch elements
+      Stat::IdentityTable identityTable;
+
+      //Position [s] is the minimum count of hits of an L1 candidate of a query with sketch size s,
+      //from estimateMinimumHitsRelaxed
+      std::vector<int> minimumHitsRelaxed;
+
       //Vector for obtaining group from refId
       //if refIdGroup[i] == refIdGroup[j], then sequence i and j have the same prefix;
       std::vector<int> refIdGroup; 
 
+      //Group of the first reference contig of each prefix, for getRefGroup
+      ankerl::unordered_dense::map<std::string_view, int> prefixGroup;
+
+      //First reference id of each group, the groups being runs of ids, and past the last one
+      std::vector<seqno_t> groupBegin;
+
+      //Reference id of each reference name, with skip_self
+      ankerl::unordered_dense::map<std::string_view, seqno_t> refIdByName;
+
+      //Hash of the name of each reference sequence, with sparsify_pairs
+      std::vector<uint64_t> refNameHash;
+
+      //With several index shards, what the shards mapped against so far found for each query
+      ShardedMapping* sharded;
+
+      //If set, reported mappings are handed to the alignment stage here instead of the output file
+      MappingQueue* mappingQueue;
+
+      //Set while mappings are reported in the binary format
+      std::unique_ptr<binmap::Writer> binaryWriter;
+
+      //With a mapping cache: the cache, and the target groups of its entries, by their first
+      //target id, and past the last one, and by their fingerprint, see setMappingCache
+      std::unique_ptr<MappingCache> mappingCache;
+      std::vector<seqno_t> cacheGroupBegin;
+      std::vector<uint64_t> cacheGroupFingerprint;
+
+      //With dedup_queries, set while the queries are read
+      std::unique_ptr<QueryDedup> queryDedup;
+
+      //Scratch of mergeMappingsInRange, reset rather than reallocated between queries
+      struct MergeWorkspace
+      {
+        std::vector<dsets::DisjointSets::Aint> ufv;
+        std::vector<size_t> partitionOrder;
+        std::vector<std::pair<size_t, size_t>> partitions;
+        std::vector<bool> isCuttable;
+      };
+
+      //Workspaces not in use. A worker waiting on the chaining tasks of a query may merge the
+      //mappings of another one meanwhile, so each merge takes a workspace of its own from here
+      std::mutex mergeWorkspacesMutex;
+      std::vector<std::unique_ptr<MergeWorkspace>> mergeWorkspaces;
+
+      //Objects not in use, taken by a query and given back once done with, so that their
+      //vectors keep their capacity from one query to the next. Per object rather than per
+      //thread, as a worker waiting on the nested tasks of a query may map another meanwhile
+      template <typename T>
+      class SparePool
+      {
+        public:
+
+          std::unique_ptr<T> take()
+          {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (spare.empty())
+              return std::unique_ptr<T>(new T());
+            std::unique_ptr<T> object = std::move(spare.back());
+            spare.pop_back();
+            return object;
+          }
+
+          void give(std::unique_ptr<T> object, size_t maxSpare)
+          {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (spare.size() < maxSpare)
+              spare.push_back(std::move(object));
+          }
+
+        private:
+
+          std::mutex mutex;
+          std::vector<std::unique_ptr<T>> spare;
+      };
+
+      //Vectors of mapModule and mapQueryFragments for a query
+      struct MappingWorkspace
+      {
+        std::vector<IntervalPoint> intervalPoints;
+        std::vector<L1_candidateLocus_t> l1Mappings;
+        MappingResultsVector_t l2Mappings;
+        MappingResultsVector_t unfilteredMappings;
+        MappingResultsVector_t filteredMappings;
+        ShardQueryOutput shard;
+      };
+      SparePool<MappingWorkspace> mappingWorkspaces;
+
+      //Outputs of the queries handled, recycled by mapModuleHandleOutput
+      SparePool<MapModuleOutput> spareOutputs;
+
     public:
 
       /**
@@ -119,27 +257,72 @@ namespace skch
        * @param[in] p           algorithm parameters
        * @param[in] refSketch   reference sketch
        * @param[in] f           optional user defined custom function to post process the reported mapping results
+       * @param[in] sharded        state of the run over index shards, required if p.index_shards > 1,
+       *                           started for the shard of refSketch
+       * @param[in] mappingQueue   optional queue receiving the reported mappings as they are made,
+       *                           not with mappings held back until the end of the run
+       * @param[in] querySource    optional source of the queries, mapped in place of p.querySequences
+       *                           as a stream, in the order it hands them out
        */
       Map(const skch::Parameters &p, const skch::Sketch &refsketch,
-          PostProcessResultsFn_t f = nullptr) :
+          PostProcessResultsFn_t f = nullptr,
+          ShardedMapping* sharded = nullptr,
+          MappingQueue* mappingQueue = nullptr,
+          QuerySourceFn_t querySource = nullptr) :
         param(p),
         refSketch(refsketch),
         processMappingResults(f),
+        querySource(querySource),
         sketchCutoffs(std::min<double>(p.sketchSize, skch::fixed::ss_table_max) + 1, 1),
-        refIdGroup(refsketch.metadata.size())
+        refIdGroup(refsketch.metadata.size()),
+        sharded(sharded),
+        mappingQueue(mappingQueue)
     {
+      assert(p.index_shards == 1 || sharded != nullptr);
+      assert(mappingQueue == nullptr || !collectAllMappings());
       if (p.stage1_topANI_filter) {
+        run_report::StageTimer timer("setProbs", 1);
         this->setProbs();
       }
+      this->setIdentityTables();
+      this->setMinReportedShared();
       if (p.skip_prefix)
       {
         this->setRefGroups();
       }
+      if (p.skip_self)
+      {
+        for (seqno_t i = 0; i < (seqno_t)refsketch.metadata.size(); i++)
+          refIdByName.emplace(refsketch.metadata[i].name, i);
+      }
+      if (sparsifyPairs())
+      {
+        refNameHash.resize(refsketch.metadata.size());
+        for (seqno_t i = 0; i < (seqno_t)refsketch.metadata.size(); i++)
+          refNameHash[i] = CommonFunc::getHash(refsketch.metadata[i].name.data(), refsketch.metadata[i].name.size());
+      }
+      if (!p.mapping_cache_file.empty())
+      {
+        this->setMappingCache();
+      }
       this->mapQuery();
     }
 
     private:
 
+      // Mappings are held back until the end of the run, for one-to-one filtering
+      bool collectAllMappings() const
+      {
+        return param.filterMode == filter::ONETOONE;
+      }
+
+      // With index shards, whether what this one finds is held for the last one, nothing
+      // being reported yet
+      bool holdsForLastShard() const
+      {
+        return sharded != nullptr && !sharded->last();
+      }
+
       // Sets the groups of reference contigs based on prefix
       void setRefGroups()
       {
@@ -150,6 +333,8 @@ namespace skch
         {
           const auto currPrefix = prefix(this->refSketch.metadata[start_idx].name, param.prefix_delim);
           idx = start_idx;
+          prefixGroup.emplace(currPrefix, group);
+          groupBegin.push_back(start_idx);
           while (idx < this->refSketch.metadata.size()
               && currPrefix == prefix(this->refSketch.metadata[idx].name, param.prefix_delim))
           {
@@ -158,23 +343,538 @@ namespace skch
           group++;
           start_idx = idx;
         }
+        groupBegin.push_back(this->refSketch.metadata.size());
+      }
+
+      /**
+       * @brief   load the mapping cache, keyed by the target groups of the index
+       * @details the mappings of a query on the targets of a skip_prefix group do not depend on
+       *          those of the other groups, each group being mapped and filtered on its own,
+       *          unless max_seed_points caps the seeds by their hits over all of them. A group
+       *          is fingerprinted by its targets as indexed and the mapping parameters, so that
+       *          the groups of the assemblies that did not change keep their entries
+       */
+      void setMappingCache()
+      {
+        run_report::StageTimer timer("mapping_cache", param.threads);
+        if (param.skip_prefix && param.max_seed_points == 0)
+          cacheGroupBegin = groupBegin;
+        else
+          cacheGroupBegin = {0, (seqno_t)refSketch.metadata.size()};
+        const size_t groups = cacheGroupBegin.size() - 1;
+        const uint64_t parameters = mappingParameterFingerprint();
+        cacheGroupFingerprint.resize(groups);
+        {
+          tasks::TaskGroup fingerprintTasks(tasks::sharedExecutor(param.threads));
+          for (size_t g = 0; g < groups; g++)
+            fingerprintTasks.run([&, g]() {
+                uint64_t parts[2] = {refSketch.targetsFingerprint(cacheGroupBegin[g], cacheGroupBegin[g + 1]), parameters};
+                uint64_t out[2];
+                MurmurHash3_x64_128(parts, sizeof(parts), 42, out);
+                cacheGroupFingerprint[g] = out[0];
+                });
+          fingerprintTasks.wait();
+        }
+        mappingCache.reset(new MappingCache());
+        mappingCache->load(param.mapping_cache_file,
+            std::unordered_set<uint64_t>(cacheGroupFingerprint.begin(), cacheGroupFingerprint.end()));
+      }
+
+      /**
+       * @brief   fingerprint of the parameters the mappings depend on, other than those of the index
+       */
+      uint64_t mappingParameterFingerprint() const
+      {
+        std::ostringstream desc;
+        desc << std::hexfloat << "version=" << fixed::VERSION
+          << ";l=" << param.segLength << ";c=" << param.chain_gap << ";b=" << param.block_length
+          << ";sparse=" << param.sparse_chaining << ";P=" << param.max_mapping_length
+          << ";p=" << param.percentageIdentity << ";lowid=" << param.keep_low_pct_id
+          << ";full=" << param.stage2_full_scan << ";hg=" << param.stage1_topANI_filter
+          << "/" << param.ANIDiff << "/" << param.ANIDiffConf
+          << ";filter=" << param.filterMode << ";n=" << param.numMappingsForSegment
+          << "/" << param.numMappingsForShortSequence << ";rand=" << param.dropRand
+          << ";overlap=" << param.overlap_threshold << ";split=" << param.split
+          << ";merge=" << param.mergeMappings << ";lengths=" << param.filterLengthMismatches
+          << ";J=" << param.kmerComplexityThreshold << ";seeds=" << param.max_seed_points << ";prefilter=" << param.target_prefilter << ";coarse=" << param.coarse_level
+          << ";self=" << param.skip_self << ";prefix=" << param.skip_prefix << param.prefix_delim
+          << ";x=" << param.sparsity_hash_threshold << "/" << param.sparsify_pairs
+          << ";world=" << param.world_minimizers << ";refsize=" << param.referenceSize;
+        const std::string described = desc.str();
+        uint64_t data[2];
+        MurmurHash3_x64_128(described.data(), described.size(), 42, data);
+        return data[0];
+      }
+
+      /**
+       * @brief   target group of the mapping cache of a target
+       */
+      int cacheGroupOf(seqno_t refId) const
+      {
+        return cacheGroupBegin.size() > 2 ? refIdGroup[refId] : 0;
+      }
+
+      /**
+       * @brief   mappings of a query on the target groups cached, and the targets of the others
+       */
+      std::unique_ptr<CachedQueryMappings> lookupCachedQuery(const std::string& seqName, const std::string& seq) const
+      {
+        std::unique_ptr<CachedQueryMappings> cached(new CachedQueryMappings());
+        MappingCache::queryKey(seqName, seq, cached->key);
+        const size_t groups = cacheGroupBegin.size() - 1;
+        cached->mappings.resize(groups);
+        cached->l2Mappings.assign(groups, -1);
+        size_t hits = 0;
+        for (size_t g = 0; g < groups; g++)
+          if (mappingCache->get(cacheKey(*cached, g), cached->mappings[g], cached->l2Mappings[g]))
+            hits++;
+        cached->complete = hits == groups;
+        if (hits == 0 || cached->complete)
+          return cached;
+        cached->uncached.assign((refSketch.metadata.size() + 63) / 64, 0);
+        for (size_t g = 0; g < groups; g++)
+          if (cached->l2Mappings[g] < 0)
+            for (seqno_t id = cacheGroupBegin[g]; id < cacheGroupBegin[g + 1]; id++)
+              cached->uncached[id >> 6] |= uint64_t(1) << (id & 63);
+        return cached;
+      }
+
+      MappingCache::Key cacheKey(const CachedQueryMappings& cached, size_t group) const
+      {
+        return MappingCache::Key {{cached.key[0], cached.key[1]}, cacheGroupFingerprint[group]};
+      }
+
+      /**
+       * @brief   whether the mappings of a query are all replayed from the mapping cache
+       */
+      static bool replaysCached(const InputSeqProgContainer* input)
+      {
+        return input->cached != nullptr && input->cached->complete;
+      }
+
+      /**
+       * @brief   whether the output of a query is a copy of that of an earlier one, see QueryDedup
+       */
+      static bool copiesEarlier(const InputSeqProgContainer* input)
+      {
+        return input->firstCopy >= 0 && input->firstCopy != input->seqCounter;
+      }
+
+      /**
+       * @brief   with dedup_queries, the key of a query, false if its mappings depend on more
+       *          than its sequence and the context keyed: under lower_triangular and the
+       *          sparsity of the mappings, on its input order, and under skip_self, on its name
+       *          if it is a target
+       * @details a query that is a target is sketched from the index, so keyed apart from the
+       *          others, and its prefix decides the targets it may map on under skip_prefix and
+       *          sparsify_pairs
+       */
+      bool dedupKey(const std::string& seqName, const std::string& seq, QueryDedup::Key& key) const
+      {
+        if (param.lower_triangular || sparsifiesMappings() || (param.skip_self && refIdByName.count(seqName) > 0))
+          return false;
+        std::string context(refSketch.selfSeqId(seqName, seq.size()) >= 0 ? "T" : "Q");
+        if (param.skip_prefix || sparsifyPairs())
+          context.append(prefix(seqName, param.prefix_delim));
+        key = QueryDedup::key(seq, context);
+        return true;
+      }
+
+      /**
+       * @brief   output of a query copying an earlier one, filled with its mappings once handled
+       */
+      MapModuleOutput* copyQuery(InputSeqProgContainer* input)
+      {
+        MapModuleOutput* output = takeOutput();
+        output->qseqName = input->seqName;
+        output->qseqLen = input->len;
+        input->progress.increment(input->len);
+        return output;
+      }
+
+      /**
+       * @brief   leave the target groups of a query cached out of the targets it may map on
+       */
+      static void admitUncachedOnly(const InputSeqProgContainer* input, std::vector<uint64_t>& admissible)
+      {
+        if (input->cached == nullptr || input->cached->uncached.empty())
+          return;
+        if (admissible.empty())
+        {
+          admissible = input->cached->uncached;
+          return;
+        }
+        for (size_t i = 0; i < admissible.size(); i++)
+          admissible[i] &= input->cached->uncached[i];
+      }
+
+      /**
+       * @brief   hand the kmers of a query whose hashes are below a threshold to sampled, with
+       *          their position, hash and strand; its sequence is normalized here unless packed
+       */
+      template <typename Sampled>
+      void sampleQuery(InputSeqProgContainer* input, hash_t below, Sampled&& sampled) const
+      {
+        if (!input->packed)
+          CommonFunc::makeUpperCaseAndValidDNA(&(input->seq)[0u], input->len);
+        CommonFunc::KmerHashStream hashStream = input->packed
+          ? CommonFunc::KmerHashStream(input->packedSeq, param.kmerSize, param.alphabetSize, param.rolling_hash,
+              refSketch.spacedSeeds(), refSketch.syncmerSize())
+          : CommonFunc::KmerHashStream(&(input->seq)[0u], input->len, param.kmerSize, param.alphabetSize, param.rolling_hash,
+              refSketch.spacedSeeds(), refSketch.syncmerSize());
+        hashStream.sampleBelow(below, sampled);
+      }
+
+      /**
+       * @brief   with target_prefilter, the targets sharing at least that many seeds of the
+       *          contig-level sketches with a query, kept with it
+       * @details the seeds of a query that is a target are those of its sketch in the index,
+       *          the others are sampled from its sequence
+       */
+      void prefilterQuery(InputSeqProgContainer* input) const
+      {
+        if (param.target_prefilter <= 0 || !input->prefiltered.empty())
+          return;
+        const TargetPrefilter& prefilter = refSketch.targetPrefilter();
+        const seqno_t selfSeqId = refSketch.selfSeqId(input->seqName, input->len);
+        std::vector<hash_t> sample;
+        std::pair<const hash_t*, const hash_t*> seeds;
+        if (selfSeqId >= 0)
+        {
+          seeds = prefilter.targetSample(selfSeqId);
+        }
+        else
+        {
+          sampleQuery(input, prefilter.sampleBelow(), [&](offset_t, hash_t hash, strand_t) {
+            sample.push_back(hash);
+          });
+          std::sort(sample.begin(), sample.end());
+          sample.erase(std::unique(sample.begin(), sample.end()), sample.end());
+          seeds = {sample.data(), sample.data() + sample.size()};
+        }
+        prefilter.admit(seeds.first, seeds.second, param.target_prefilter, refSketch.metadata.size(),
+                        input->prefiltered, input->prefilteredBegin, input->prefilteredEnd);
+      }
+
+      /**
+       * @brief   with coarse_level, the target regions of each coarse window of a query at least
+       *          CoarseLevel::minWindows windows long, from the hits of its sampled kmers in the
+       *          coarse level of the index
+       */
+      void coarseQuery(InputSeqProgContainer* input) const
+      {
+        if (param.coarse_level <= 0 || input->coarse != nullptr)
+          return;
+        const CoarseLevel& coarse = refSketch.coarseLevel();
+        if (input->len < CoarseLevel::minWindows * coarse.window())
+          return;
+        std::vector<std::tuple<offset_t, hash_t, strand_t>> samples;
+        sampleQuery(input, coarse.sampleBelow(), [&](offset_t pos, hash_t hash, strand_t strand) {
+          samples.emplace_back(pos, hash, strand);
+        });
+        input->coarse.reset(new CoarseCandidates);
+        coarse.candidates(samples, input->len, [&](seqno_t seqId) { return refSketch.metadata[seqId].len; },
+                          *input->coarse);
+      }
+
+      /**
+       * @brief   whether the workers find the seed anchors of the mappings, for the binary
+       *          output: not for the mappings collected for filtering at the end, their
+       *          queries being gone by then, nor with index shards, which hold the windows
+       *          of their own targets only
+       */
+      bool findsSeedAnchors() const
+      {
+        return param.seed_anchors && binaryWriter != nullptr && !collectAllMappings() && sharded == nullptr;
+      }
+
+      /**
+       * @brief   the seed anchors of the final mappings of a query, see SeedAnchors, from its
+       *          sampled kmers and the minmers of the index around each mapping
+       */
+      void seedAnchorsOf(InputSeqProgContainer* input, MapModuleOutput& output) const
+      {
+        output.anchors.clear();
+        output.anchorEnds.clear();
+        if (output.readMappings.empty())
+          return;
+        const hash_t below = SeedAnchors::thresholdFor(param.sketchSize, param.segLength);
+        std::vector<std::tuple<offset_t, hash_t, strand_t>> samples;
+        sampleQuery(input, below, [&](offset_t pos, hash_t hash, strand_t strand) {
+          samples.emplace_back(pos, hash, strand);
+        });
+        SeedAnchors anchors;
+        anchors.setQuery(samples);
+        const offset_t kmerSize = refSketch.spacedSeeds() != nullptr ? refSketch.spacedSeeds()->span : param.kmerSize;
+        refSketch.withMinmerIndex([&](const auto& index) {
+          for (const auto& e : output.readMappings)
+          {
+            anchors.chain(e, kmerSize, [&](const auto& add) {
+              const size_t seqEnd = refSketch.seqMinmerOffsets[e.refSeqId + 1];
+              for (size_t idx = refSketch.lowerBoundMinmer(index, e.refSeqId, e.refStartPos - param.segLength); idx < seqEnd; ++idx)
+              {
+                const MinmerInfo& mi = Sketch::minmerOf(index[idx], e.refSeqId);
+                if (mi.wpos > e.refEndPos)
+                  break;
+                if (mi.hash < below)
+                  add(mi.hash, mi.wpos_end - 1, mi.strand);
+              }
+            }, output.anchors);
+            output.anchorEnds.push_back(output.anchors.size());
+          }
+        });
+      }
+
+      /**
+       * @brief   leave the targets a query shares too few contig-level seeds with out of the
+       *          targets it may map on
+       */
+      static void admitPrefiltered(const InputSeqProgContainer* input, std::vector<uint64_t>& admissible)
+      {
+        if (input->prefiltered.empty())
+          return;
+        if (admissible.empty())
+        {
+          admissible = input->prefiltered;
+          return;
+        }
+        for (size_t i = 0; i < admissible.size(); i++)
+          admissible[i] &= input->prefiltered[i];
+      }
+
+      /**
+       * @brief   keep the mappings of a query on the target groups it was mapped on in the
+       *          mapping cache, its mappings becoming those joined with the ones replayed,
+       *          if it was mapped on some groups only
+       */
+      void cacheQueryMappings(InputSeqProgContainer* input, MapModuleOutput& output)
+      {
+        CachedQueryMappings& cached = *input->cached;
+        if (cached.complete)
+          return;
+        const size_t groups = cacheGroupBegin.size() - 1;
+        const bool chains = !mapsWhole(input) && param.mergeMappings;
+        //Chain ids are positions among the L2 mappings of the query sorted by target,
+        //those of a group are kept from its first one
+        std::vector<offset_t> chainBase(groups + 1, 0);
+        if (chains)
+          std::partial_sum(output.l2Mappings.begin(), output.l2Mappings.end(), chainBase.begin() + 1);
+        for (const auto& e : output.readMappings)
+        {
+          const int g = cacheGroupOf(e.refSeqId);
+          cached.mappings[g].push_back(e);
+          cached.mappings[g].back().refSeqId -= cacheGroupBegin[g];
+          cached.mappings[g].back().querySeqId = 0;
+          if (chains)
+            cached.mappings[g].back().splitMappingId -= chainBase[g];
+        }
+        const bool partly = !cached.uncached.empty();
+        for (size_t g = 0; g < groups; g++)
+        {
+          if (cached.l2Mappings[g] >= 0)
+            continue;
+          cached.l2Mappings[g] = chains ? output.l2Mappings[g] : 0;
+          mappingCache->put(cacheKey(cached, g), cached.mappings[g], cached.l2Mappings[g]);
+        }
+        if (partly)
+          joinCachedMappings(input, output.readMappings);
       }
 
-      // Gets the ref group of a query based on the prefix
-      int getRefGroup(const std::string& seqName)
+      /**
+       * @brief   the mappings of a query from those of each target group, see CachedQueryMappings,
+       *          in the order they are reported in when mapped on all the groups at once
+       */
+      void joinCachedMappings(const InputSeqProgContainer* input, MappingResultsVector_t& mappings) const
       {
-        const auto queryPrefix = prefix(seqName, param.prefix_delim);
-        for (int i = 0; i < this->refSketch.metadata.size(); i++)
+        const CachedQueryMappings& cached = *input->cached;
+        const bool chains = !mapsWhole(input) && param.mergeMappings;
+        mappings.clear();
+        offset_t chainBase = 0;
+        for (size_t g = 0; g + 1 < cacheGroupBegin.size(); g++)
         {
-          const auto currPrefix = prefix(this->refSketch.metadata[i].name, param.prefix_delim);
-          if (queryPrefix == currPrefix)
+          for (const auto& e : cached.mappings[g])
+          {
+            mappings.push_back(e);
+            mappings.back().refSeqId += cacheGroupBegin[g];
+            mappings.back().querySeqId = input->seqCounter;
+            if (chains)
+              mappings.back().splitMappingId += chainBase;
+          }
+          chainBase += cached.l2Mappings[g];
+        }
+        //As filterByGroup leaves them, mappings on several groups at once being left in group order otherwise
+        if (param.filterMode == filter::MAP)
+          sortByKey(mappings, [](const MappingResult &e) {
+              return std::make_tuple(e.queryStartPos, e.refSeqId, e.refStartPos);
+          });
+      }
+
+      /**
+       * @brief   output of a query whose mappings are all replayed from the mapping cache
+       */
+      MapModuleOutput* replayCachedQuery(InputSeqProgContainer* input)
+      {
+        MapModuleOutput* output = takeOutput();
+        output->qseqName = input->seqName;
+        output->qseqLen = input->len;
+        joinCachedMappings(input, output->readMappings);
+        input->progress.increment(input->len);
+        return output;
+      }
+
+      bool sparsifyPairs() const
+      {
+        return param.sparsify_pairs && param.sparsity_hash_threshold < std::numeric_limits<uint64_t>::max();
+      }
+
+      /**
+       * @brief   whether the pairs of a query group and a target are kept with sparsify_pairs,
+       *          from the hashes of their names, so that the same pairs are kept in every run
+       */
+      bool keepPair(uint64_t queryGroupHash, seqno_t refId) const
+      {
+        //splitmix64 finalizer of the combined hashes
+        uint64_t h = queryGroupHash ^ (refNameHash[refId] * 0x9E3779B97F4A7C15ULL);
+        h = (h ^ (h >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        h = (h ^ (h >> 27)) * 0x94D049BB133111EBULL;
+        h ^= h >> 31;
+        return h <= param.sparsity_hash_threshold;
+      }
+
+      /**
+       * @brief   targets a query may be mapped on under skip_self, skip_prefix,
+       *          lower_triangular and sparsify_pairs, one bit per reference id, left empty
+       *          if all of them, so that the seed stage tests a bit instead of the pair
+       *          constraints
+       */
+      void setAdmissibleTargets(const std::string& seqName, seqno_t seqCounter, int refGroup,
+                                std::vector<uint64_t>& admissible) const
+      {
+        admissible.clear();
+        if (!param.skip_self && !param.skip_prefix && !param.lower_triangular && !sparsifyPairs())
+          return;
+        const seqno_t refCount = this->refSketch.metadata.size();
+        admissible.assign((refCount + 63) / 64, ~uint64_t(0));
+        const auto clearRange = [&](seqno_t begin, seqno_t end) {
+          begin = std::max<seqno_t>(begin, 0);
+          end = std::min(end, refCount);
+          while (begin < end)
           {
-            return this->refIdGroup[i];
+            //whole words at once
+            if ((begin & 63) == 0 && begin + 64 <= end)
+            {
+              admissible[begin >> 6] = 0;
+              begin += 64;
+            }
+            else
+            {
+              admissible[begin >> 6] &= ~(uint64_t(1) << (begin & 63));
+              begin++;
+            }
           }
+        };
+        if (param.lower_triangular)
+          clearRange(seqCounter, refCount);
+        if (param.skip_prefix && refGroup >= 0)
+          clearRange(groupBegin[refGroup], groupBegin[refGroup + 1]);
+        if (param.skip_self)
+        {
+          const auto it = refIdByName.find(seqName);
+          if (it != refIdByName.end())
+            clearRange(it->second, it->second + 1);
         }
+        if (sparsifyPairs())
+        {
+          //queries of a -Y prefix group keep the same targets
+          const std::string_view queryGroup = prefix(seqName, param.prefix_delim);
+          const uint64_t queryGroupHash = CommonFunc::getHash(queryGroup.data(), queryGroup.size());
+          for (seqno_t refId = 0; refId < refCount; refId++)
+            if (!keepPair(queryGroupHash, refId))
+              clearRange(refId, refId + 1);
+        }
+      }
+
+      // Gets the ref group of a query based on the prefix, that of the first reference contig with it
+      int getRefGroup(std::string_view seqName)
+      {
+        const auto it = prefixGroup.find(prefix(seqName, param.prefix_delim));
         // Doesn't belong to any ref group
-        return -1;
+        return it != prefixGroup.end() ? it->second : -1;
       }
+      //Largest sketch size of the identity tables, larger ones are computed as needed
+      static constexpr int identityTableMaxSketchSize = 2048;
+
+      void setIdentityTables()
+      {
+        const int maxSketchSize = std::min<int>(param.sketchSize + 1, identityTableMaxSketchSize);
+        identityTable = Stat::IdentityTable(maxSketchSize, param.kmerSize, skch::fixed::confidence_interval, param.threads);
+
+        //estimateMinimumHitsRelaxed, with the upper bounds of the table
+        minimumHitsRelaxed.assign(maxSketchSize + 1, 0);
+        for (int s = 1; s <= maxSketchSize; s++)
+        {
+          const int first = Stat::estimateMinimumHits(s, param.kmerSize, param.percentageIdentity);
+          int relaxed = first;
+          for (int i = first; i >= 0 && identityTable.identityUpperBound(s, i) >= param.percentageIdentity; i--)
+            relaxed = i;
+          minimumHitsRelaxed[s] = relaxed;
+        }
+      }
+
+      float identityOf(int sharedSketchSize, int sketchSize) const
+      {
+        if (identityTable.covers(sketchSize))
+          return identityTable.identity(sketchSize, sharedSketchSize);
+        return 1 - Stat::j2md(1.0 * sharedSketchSize/sketchSize, param.kmerSize);
+      }
+
+      float identityUpperBoundOf(int sharedSketchSize, int sketchSize) const
+      {
+        if (identityTable.covers(sketchSize))
+          return identityTable.identityUpperBound(sketchSize, sharedSketchSize);
+        float mash_dist = Stat::j2md(1.0 * sharedSketchSize/sketchSize, param.kmerSize);
+        return 1 - Stat::md_lower_bound(mash_dist, sketchSize, param.kmerSize, skch::fixed::confidence_interval);
+      }
+
+      int minimumHitsOf(int sketchSize) const
+      {
+        if (identityTable.covers(sketchSize))
+          return minimumHitsRelaxed[sketchSize];
+        return Stat::estimateMinimumHitsRelaxed(sketchSize, param.kmerSize, param.percentageIdentity, skch::fixed::confidence_interval);
+      }
+
+      /**
+       * @brief   whether an L2 mapping sharing this many sketch elements is reported,
+       *          the identity test of doL2Mapping
+       */
+      bool passesIdentity(int sharedSketchSize, int sketchSize) const
+      {
+        if (identityOf(sharedSketchSize, sketchSize) >= param.percentageIdentity)
+          return true;
+        if (!param.keep_low_pct_id)
+          return false;
+        return identityUpperBoundOf(sharedSketchSize, sketchSize) >= param.percentageIdentity;
+      }
+
+      void setMinReportedShared()
+      {
+        minReportedShared.assign(param.sketchSize + 1, 0);
+        for (int s = 1; s <= param.sketchSize; s++)
+        {
+          // Identities grow with the count of shared elements
+          int lo = 0, hi = s + 1;
+          while (lo < hi)
+          {
+            const int mid = (lo + hi) / 2;
+            if (passesIdentity(mid, s))
+              hi = mid;
+            else
+              lo = mid + 1;
+          }
+          minReportedShared[s] = lo;
+        }
+      }
+
       void setProbs() 
       {
 
@@ -182,6 +882,13 @@ namespace skch
         float min_p = 1 - param.ANIDiffConf;
         int ss = std::min<double>(param.sketchSize, skch::fixed::ss_table_max);
 
+        // Tables of identical settings are the same, most jobs find theirs cached
+        const std::string cacheKey = CutoffCache::key(ss, param.kmerSize, param.ANIDiff, param.ANIDiffConf);
+        if (CutoffCache::load(param.cache_dir, cacheKey, sketchCutoffs))
+        {
+          return;
+        }
+
         // Cache hg pmf results
         std::vector<std::vector<double>> sketchProbs(
             ss + 1,
@@ -251,6 +958,7 @@ namespace skch
             sketchCutoffs[cmax] = 1;
           }
         }
+        CutoffCache::store(param.cache_dir, cacheKey, sketchCutoffs);
         //for (auto overlap = 1; overlap <= ss; overlap++) 
         //{
           //DEBUG_ASSERT(sketchCutoffs[overlap] <= overlap);
@@ -262,17 +970,78 @@ namespace skch
        */
       void mapQuery()
       {
+        run_report::StageTimer stageTimer("mapping", param.threads);
+        const double mapStart = run_report::Report::get().elapsed();
+        uint64_t queryBases = 0;
+
         //Count of reads mapped by us
         //Some reads are dropped because of short length
         seqno_t totalReadsPickedForMapping = 0;
         seqno_t totalReadsMapped = 0;
         seqno_t seqCounter = 0;
+        seqno_t replayedQueries = 0;
+        seqno_t partlyReplayedQueries = 0;
+
+        //With a checkpoint, the output is resumed after the queries it has
+        MappingCheckpoint checkpoint;
+        MappingResultsVector_t checkpointMappings;
+        const bool checkpointing = !param.map_checkpoint_file.empty() && mappingQueue == nullptr;
+        const bool resuming = checkpointing && checkpoint.load(param.map_checkpoint_file, param.querySequences, checkpointMappings);
+
+        output::ShardedWriter shards;
+        output::SortedWriter sorted;
+        output::Writer outstrm;
+        if (resuming)
+        {
+          if (!outstrm.openAt(param.outFileName, checkpoint.outputBytes))
+          {
+            std::cerr << "[mashmap::skch::Map::mapQuery] ERROR: could not resume " << param.outFileName
+                      << ", which has to be the output of the checkpointed run, appended to" << std::endl;
+            exit(1);
+          }
+          std::cerr << "[mashmap::skch::Map::mapQuery] resuming after the " << checkpoint.queries
+                    << " queries mapped in " << param.map_checkpoint_file << std::endl;
+        }
+        else if (mappingQueue == nullptr && param.output_shards > 0 && !param.binary_output)
+        {
+          output::ShardedWriter::Key key = output::ShardedWriter::Key::Query;
+          output::ShardedWriter::parseKey(param.shard_by, key);
+          if (!shards.open(param.outFileName, param.output_shards, key, false, param.bgzf_output, param.threads, param.bgzf_level))
+          {
+            std::cerr << "[mashmap::skch::Map::mapQuery] ERROR: could not open the " << param.output_shards
+                      << " output shards of " << param.outFileName << " for writing" << std::endl;
+            exit(1);
+          }
+          outstrm.open(shards);
+        }
+        else if (mappingQueue == nullptr && !param.sort_by.empty() && !param.binary_output)
+        {
+          output::SortedWriter::Key key = output::SortedWriter::Key::Target;
+          output::SortedWriter::parseKey(param.sort_by, key);
+          if (!sorted.open(param.outFileName, key, param.threads, param.bgzf_level))
+          {
+            std::cerr << "[mashmap::skch::Map::mapQuery] ERROR: could not open " << param.outFileName << " for writing" << std::endl;
+            exit(1);
+          }
+          outstrm.open(sorted);
+        }
+        else if (mappingQueue == nullptr)
+        {
+          if (!outstrm.open(param.outFileName, param.bgzf_output, param.threads, param.bgzf_level))
+          {
+            std::cerr << "[mashmap::skch::Map::mapQuery] ERROR: could not open " << param.outFileName << " for writing" << std::endl;
+            exit(1);
+          }
+          if (param.binary_output)
+            binaryWriter.reset(new binmap::Writer(outstrm));
+        }
+        MappingResultsVector_t allReadMappings = std::move(checkpointMappings);  //Aggregate mapping results for the complete run
 
-        std::ofstream outstrm(param.outFileName);
-        MappingResultsVector_t allReadMappings;  //Aggregate mapping results for the complete run
-
-        //Create the thread pool
-        ThreadPool<InputSeqProgContainer, MapModuleOutput> threadPool( [this](InputSeqProgContainer* e){return mapModule(e);}, param.threads);
+        //Create the thread pool, mappings held back until the end are sorted anyway, and the
+        //copies of queries have to be handled after the first of their sequence
+        const bool ordered = (!param.unordered_output && !param.deterministic_output) || collectAllMappings()
+          || param.dedup_queries;
+        ThreadPool<InputSeqProgBatch, MapModuleBatchOutput> threadPool( [this](InputSeqProgBatch* e){return mapModuleBatch(e);}, param.threads, ordered);
 
 		// allowed set of queries
 		std::unordered_set<std::string> allowed_query_names;
@@ -284,72 +1053,195 @@ namespace skch
 			}
 		}
 
-		// Count the total number of sequences and sequence length
-		uint64_t total_seqs = 0;
+		// Index each query file once, the lengths of the selected queries come from the index
+		// and the mapping pass reads them through the same one. Without a .fai, building the
+		// index is a pass over the file, made once here. Stdin and pipes can't be indexed and
+		// are read in a single pass instead, with no index (nullptr)
+		std::vector<std::pair<faidx_t*, std::vector<std::string>>> queryFiles;
 		uint64_t total_seq_length = 0;
+		if (param.dedup_queries) {
+			queryDedup.reset(new QueryDedup());
+		}
+		if (querySource) {
+			queryFiles.emplace_back(nullptr, std::vector<std::string>());
+			if (queryDedup) {
+				queryDedup->expectUnknownLengths();
+			}
+		}
 		for (const auto& fileName : param.querySequences) {
-			// Check if there is a .fai file
-			std::string fai_name = fileName + ".fai";
-			if (fs::exists(fai_name)) {
-				std::string line;
-				std::ifstream in(fai_name.c_str());
-                while (std::getline(in, line)) {
-                    auto line_split = CommonFunc::split(line, '\t');
-					// if we have a param.target_prefix and the sequence name matches, skip it
-					auto seq_name = line_split[0];
-					bool prefix_skip = true;
-					for (const auto& prefix : param.query_prefix) {
-						if (seq_name.substr(0, prefix.size()) == prefix) {
-							prefix_skip = false;
-							break;
-						}
-					}
-					if (!allowed_query_names.empty() && allowed_query_names.find(seq_name) != allowed_query_names.end()
-						|| !param.query_prefix.empty() && !prefix_skip) {
-						total_seqs++;
-						total_seq_length += std::stoul(line_split[1]);
-					}
+			if (querySource) {
+				break;
+			}
+			if (seqiter::is_stream(fileName)) {
+				queryFiles.emplace_back(nullptr, std::vector<std::string>());
+				if (queryDedup) {
+					queryDedup->expectUnknownLengths();
+				}
+				continue;
+			}
+			if (!seqiter::fai_index_exists(fileName)) {
+				std::cerr << "[mashmap::skch::Map::mapQuery] WARNING, no .fai index found for " << fileName << ", indexing it (slow)" << std::endl;
+			}
+			faidx_t* fai = fai_load(fileName.c_str());
+			if (fai == nullptr) {
+				std::cerr << "[mashmap::skch::Map::mapQuery] ERROR, failed to load the FASTA index of " << fileName << std::endl;
+				exit(1);
+			}
+			std::vector<std::string> names = seqiter::filtered_seq_names(fai, param.query_prefix, allowed_query_names);
+			for (const auto& name : names) {
+				const offset_t len = faidx_seq_len(fai, name.c_str());
+				total_seq_length += len;
+				if (queryDedup) {
+					queryDedup->expectLength(len);
 				}
-			} else {
-				// If .fai file doesn't exist, warn and use the for_each_seq_in_file_filtered function
-				std::cerr << "[mashmap::skch::Map::mapQuery] WARNING, no .fai index found for " << fileName << ", reading the file to filter query sequences (slow)" << std::endl;
-				seqiter::for_each_seq_in_file_filtered(
-					fileName,
-					param.query_prefix,
-					allowed_query_names,
-					[&](const std::string& seq_name, const std::string& seq) {
-						++total_seqs;
-						total_seq_length += seq.size();
-					});
 			}
+			queryFiles.emplace_back(fai, std::move(names));
 		}
 		
-        progress_meter::ProgressMeter progress(total_seq_length, "[mashmap::skch::Map::mapQuery] mapped");
+        progress_meter::ProgressMeter progress(total_seq_length, "[mashmap::skch::Map::mapQuery] mapped", "map");
+
+        //One-to-one mappings past the memory budget go to sorted runs on disk
+        const bool spillOneToOne = param.filterMode == filter::ONETOONE && param.onetoone_mem_budget > 0;
+        MappingSpill oneToOneSpill;
+        OneToOneRuns queryRuns;
+
+        //Queries are only read in while their estimated memory fits in --max-memory
+        MemoryBudget budget(param.max_memory);
+
+        //Batches are handled in input order, the checkpoint counts the queries up to the last one
+        //handled, and is only saved once the output it counts is on disk
+        std::deque<seqno_t> batchEnds;
+        auto lastCheckpoint = std::chrono::steady_clock::now();
+        const auto checkpointBatch = [&]()
+        {
+          checkpoint.queries = batchEnds.front();
+          batchEnds.pop_front();
+          if (std::chrono::steady_clock::now() - lastCheckpoint < std::chrono::seconds(checkpointSeconds))
+            return;
+          if (!outstrm.sync())
+          {
+            std::cerr << "[mashmap::skch::Map::mapQuery] ERROR: could not write " << param.outFileName << std::endl;
+            exit(1);
+          }
+          checkpoint.outputBytes = outstrm.bytesWritten();
+          if (!checkpoint.save(param.map_checkpoint_file, param.querySequences, allReadMappings))
+            std::cerr << "[mashmap::skch::Map::mapQuery] WARNING, failed to save the checkpoint " << param.map_checkpoint_file << std::endl;
+          lastCheckpoint = std::chrono::steady_clock::now();
+        };
+
+        const auto accountCollected = [&]()
+        {
+          memory_accounting::set(memory_accounting::map_collected, allReadMappings.capacity() * sizeof(MappingResult)
+              + (sharded != nullptr ? sharded->bytes() : 0));
+        };
+
+        const auto handleBatchOutput = [&](MapModuleBatchOutput* output)
+        {
+          const uint64_t reservedBytes = output->reservedBytes;
+          memory_accounting::add(memory_accounting::map_mappings, -(int64_t)output->mappingBytes);
+          if (mappingQueue != nullptr)
+          {
+            output::Writer chunk;
+            mapModuleHandleBatchOutput(output, allReadMappings, totalReadsMapped, chunk, progress);
+            mappingQueue->push(chunk.take());
+          }
+          else
+          {
+            mapModuleHandleBatchOutput(output, allReadMappings, totalReadsMapped, outstrm, progress);
+          }
+          if (spillOneToOne && allReadMappings.size() * sizeof(MappingResult) >= (uint64_t)param.onetoone_mem_budget)
+          {
+            queryRuns.assign(allReadMappings, *this);
+            oneToOneSpill.spill(allReadMappings, queryRuns.byRunAndRef());
+          }
+          if (collectAllMappings() || holdsForLastShard())
+            accountCollected();
+          budget.release(reservedBytes);
+          if (checkpointing)
+            checkpointBatch();
+        };
 
-        for(const auto &fileName : param.querySequences)
+        //With deterministic output, batches done ahead of a slow one are held until their turn
+        //rather than left waiting in the pool, so the threads go on with the batches after it
+        std::map<uint64_t, MapModuleBatchOutput*> heldOutputs;
+        uint64_t nextOutput = 0;
+        const auto collectBatchOutput = [&]()
+        {
+          if (ordered)
+          {
+            handleBatchOutput(threadPool.popOutputWhenAvailable());
+            return;
+          }
+          uint64_t order = 0;
+          MapModuleBatchOutput* output = threadPool.popOutputWhenAvailable(&order);
+          if (!param.deterministic_output)
+          {
+            handleBatchOutput(output);
+            return;
+          }
+          heldOutputs.emplace(order, output);
+          while (!heldOutputs.empty() && heldOutputs.begin()->first == nextOutput)
+          {
+            handleBatchOutput(heldOutputs.begin()->second);
+            heldOutputs.erase(heldOutputs.begin());
+            ++nextOutput;
+          }
+        };
+
+        //Short queries are dispatched together, to not pay the thread pool handshake per read
+        InputSeqProgBatch* batch = new InputSeqProgBatch();
+        const auto dispatchBatch = [&]()
+        {
+          if (batch->queries.empty())
+            return;
+          if (checkpointing)
+            batchEnds.push_back(batch->queries.back()->seqCounter + 1);
+          threadPool.runWhenThreadAvailable(batch);
+          progress.set_queue_depth(threadPool.inFlight());
+          batch = new InputSeqProgBatch();
+
+          //Collect output if available
+          while ( threadPool.outputAvailable() ) {
+            collectBatchOutput();
+          }
+        };
+
+        for(size_t f = 0; f < queryFiles.size(); f++)
         {
 
 #ifdef DEBUG
-            std::cerr << "[mashmap::skch::Map::mapQuery] mapping reads in " << fileName << std::endl;
+            if (!querySource)
+              std::cerr << "[mashmap::skch::Map::mapQuery] mapping reads in " << param.querySequences[f] << std::endl;
 #endif
 
-			seqiter::for_each_seq_in_file_filtered(
-				fileName,
-				param.query_prefix,
-				allowed_query_names,
+			const auto mapQuerySeq =
                 [&](const std::string& seq_name,
-                    const std::string& seq) {
+                    std::string&& seq) {
                     // todo: offset_t is an 32-bit integer, which could cause problems
                     offset_t len = seq.length();
+                    queryBases += len;
+                    if (queryDedup)
+                      queryDedup->read(len);
+                    if (param.keep_sequence && !querySource)
+                      param.keep_sequence(param.querySequences[f], seq_name, seq);
 					if (param.skip_self
 						&& param.target_prefix != ""
 						&& seq_name.substr(0, param.target_prefix.size()) == param.target_prefix) {
 						// skip
 					} else {
-						if (param.filterMode == filter::ONETOONE)
-							qmetadata.push_back( ContigInfo{seq_name, len} );
+						if (collectAllMappings())
+						{
+							qmetadata.push_back( ContigInfo{qmetadataNames.store(seq_name), len} );
+							if (param.skip_prefix)
+								qmetadataGroups.push_back(getRefGroup(seq_name));
+						}
+						//Were its mappings output before the checkpoint?
+						if (resuming && seqCounter < checkpoint.queries)
+						{
+							progress.increment(len);
+						}
 						//Is the read too short?
-						if(len < param.kmerSize)
+						else if(len < param.kmerSize)
 						{
 //#ifdef DEBUG
 							// TODO Should we somehow revert to < windowSize?
@@ -363,27 +1255,107 @@ namespace skch
 						else
 						{
 							totalReadsPickedForMapping++;
-							//Dispatch input to thread
-							threadPool.runWhenThreadAvailable(new InputSeqProgContainer(seq, seq_name, seqCounter, progress));
 
-							//Collect output if available
-							while ( threadPool.outputAvailable() ) {
-								mapModuleHandleOutput(threadPool.popOutputWhenAvailable(), allReadMappings, totalReadsMapped, outstrm, progress);
+							//With dedup_queries, a query of the sequence of an earlier one is only
+							//copied, with no bases to hold either
+							seqno_t firstCopy = -1;
+							QueryDedup::Key dedupKeyOf;
+							if (queryDedup && dedupKey(seq_name, seq, dedupKeyOf))
+								firstCopy = queryDedup->firstOf(dedupKeyOf, seqCounter);
+							const bool isCopy = firstCopy >= 0 && firstCopy != seqCounter;
+
+							//With a mapping cache, a query cached on all the target groups is only
+							//replayed, with no bases to hold
+							std::unique_ptr<CachedQueryMappings> cached;
+							if (mappingCache && !isCopy)
+							{
+								cached = lookupCachedQuery(seq_name, seq);
+								replayedQueries += cached->complete;
+								partlyReplayedQueries += !cached->complete && !cached->uncached.empty();
+							}
+							const bool replayed = (cached && cached->complete) || isCopy;
+
+							//Until the query fits in the budget, hand out the queries of the batch
+							//so far and wait for outputs, unless there is nothing left to wait for
+							const uint64_t queryBytes = budget.enabled() && !replayed ? MemoryBudget::estimateQueryBytes(len, param) : 0;
+							while (!budget.fits(queryBytes, allReadMappings.size() * sizeof(MappingResult) + (sharded != nullptr ? sharded->bytes() : 0)))
+							{
+								if (!batch->queries.empty())
+									dispatchBatch();
+								else if (threadPool.running())
+									collectBatchOutput();
+								else
+									break;
 							}
+							budget.reserve(queryBytes);
+							batch->reservedBytes += queryBytes;
+
+							//Dispatch input to thread once the batch is full
+							InputSeqProgContainer* query = new InputSeqProgContainer(
+								replayed ? std::string() : std::move(seq), seq_name, seqCounter, progress, param.pack_queries);
+							query->cached = std::move(cached);
+							query->firstCopy = firstCopy;
+							batch->add(query);
+							if (replayed)
+								query->len = len;
+							if (batch->totalLen >= queryBatchBases || batch->queries.size() >= queryBatchMaxQueries)
+								dispatchBatch();
 						}
 						//progress.increment(seq.size()/2);
 						seqCounter++;
 					}
-                }); //Finish reading query input file
-
-        }
+                };
+
+			if (queryFiles[f].first == nullptr)
+			{
+				//A stream, read once as it comes: its total is only known as it is read
+				const auto mapStreamSeq = [&](const std::string& seq_name, std::string&& seq) {
+					if (seqiter::keep_seq_name(seq_name.c_str(), param.query_prefix, allowed_query_names)) {
+						progress.add_total(seq.length());
+						mapQuerySeq(seq_name, std::move(seq));
+					}
+				};
+				if (querySource)
+					querySource(mapStreamSeq);
+				else
+					seqiter::for_each_owned_seq_in_file(param.querySequences[f], {}, "", mapStreamSeq);
+			}
+			else
+			{
+				seqiter::for_each_owned_seq_in_file(queryFiles[f].first, queryFiles[f].second, mapQuerySeq);
+				fai_destroy(queryFiles[f].first);
+			}
+        } //Finish reading query input files
+        dispatchBatch();
+        delete batch;
 
         //Collect remaining output objects
         while ( threadPool.running() )
-            mapModuleHandleOutput(threadPool.popOutputWhenAvailable(), allReadMappings, totalReadsMapped, outstrm, progress);
+            collectBatchOutput();
+
+        if (holdsForLastShard())
+        {
+          //Nothing is reported before the last shard
+          progress.finish();
+          std::cerr << "[mashmap::skch::Map::mapQuery] "
+                    << "mapped against index shard " << refSketch.getShard() + 1 << "/" << param.index_shards
+                    << (sharded->pass() == ShardedMapping::Pass::Bests ? " for the best hits" : "")
+                    << ", bytes held = " << sharded->bytes() << std::endl;
+          return;
+        }
+        if (sharded != nullptr)
+          sharded->clear();
 
         //Filter over reference axis and report the mappings
-        if (param.filterMode == filter::ONETOONE)
+        run_report::StageTimer filterTimer("filtering", 1);
+        filterTimer.count("mappings_in", allReadMappings.size());
+        if (param.filterMode == filter::ONETOONE && !oneToOneSpill.empty())
+        {
+          queryRuns.assign(allReadMappings, *this);
+          oneToOneSpill.spill(allReadMappings, queryRuns.byRunAndRef());
+          filterSpilledOneToOne(oneToOneSpill, queryRuns, outstrm);
+        }
+        else if (param.filterMode == filter::ONETOONE)
         {
           // how many secondary mappings to keep
           int n_mappings = param.numMappingsForSegment - 1;
@@ -398,9 +1370,9 @@ namespace skch
           {
             if (param.skip_prefix)
             {
-              int currGroup = this->getRefGroup(qmetadata[subrange_begin->querySeqId].name);
+              int currGroup = qmetadataGroups[subrange_begin->querySeqId];
               subrange_end = std::find_if_not(subrange_begin, allReadMappings.end(), [this, currGroup] (const auto& allReadMappings_candidate) {
-                  return currGroup == this->getRefGroup(this->qmetadata[allReadMappings_candidate.querySeqId].name);
+                  return currGroup == this->qmetadataGroups[allReadMappings_candidate.querySeqId];
               });
             }
             else
@@ -422,24 +1394,308 @@ namespace skch
 
           //Re-sort mappings by input order of query sequences
           //This order may be needed for any post analysis of output
-          std::sort(
-              allReadMappings.begin(), allReadMappings.end(),
-              [](const MappingResult &a, const MappingResult &b) {
-                  return std::tie(a.querySeqId, a.queryStartPos, a.refSeqId, a.refStartPos) 
-                    < std::tie(b.querySeqId, b.queryStartPos, b.refSeqId, b.refStartPos);
-              });
+          sortByKey(allReadMappings, [](const MappingResult &e) {
+              return std::make_tuple(e.querySeqId, e.queryStartPos, e.refSeqId, e.refStartPos);
+          });
+
+          reportReadMappings(allReadMappings, "", outstrm);
+        }
+        filterTimer.stop();
+        memory_accounting::set(memory_accounting::map_collected, 0);
+        if (binaryWriter != nullptr)
+          binaryWriter->finish();
+        binaryWriter.reset();
+        const bool written = outstrm.close();
+        if (!shards.close())
+        {
+          std::cerr << "[mashmap::skch::Map::mapQuery] ERROR: could not write the output shards of " << param.outFileName << std::endl;
+          exit(1);
+        }
+        if (!sorted.close())
+        {
+          std::cerr << "[mashmap::skch::Map::mapQuery] ERROR: could not sort and index " << param.outFileName << std::endl;
+          exit(1);
+        }
+        if (checkpointing && written)
+          std::remove(param.map_checkpoint_file.c_str());
+        if (mappingCache)
+        {
+          std::cerr << "[mashmap::skch::Map::mapQuery] mapping cache: " << replayedQueries << " queries replayed, "
+                    << partlyReplayedQueries << " mapped again on the target groups that changed only" << std::endl;
+          if (!mappingCache->save(param.mapping_cache_file))
+            std::cerr << "[mashmap::skch::Map::mapQuery] WARNING, failed to save the mapping cache " << param.mapping_cache_file << std::endl;
+        }
+
+        if (queryDedup)
+        {
+          std::cerr << "[mashmap::skch::Map::mapQuery] duplicate queries: " << queryDedup->copied()
+                    << " output as copies of the first of their sequence" << std::endl;
+          stageTimer.count("duplicate_queries", queryDedup->copied());
+          queryDedup.reset();
+        }
+
+        progress.finish();
+
+        std::cerr << "[mashmap::skch::Map::mapQuery] "
+                  << "count of mapped reads = " << totalReadsMapped
+                  << ", reads qualified for mapping = " << totalReadsPickedForMapping
+                  << ", total input reads = " << seqCounter
+                  << ", total input bp = " << total_seq_length << std::endl;
+
+        stageTimer.count("queries", seqCounter);
+        stageTimer.count("mapped_queries", totalReadsMapped);
+        stageTimer.count("bp", queryBases);
+        stageTimer.count("bp_per_second", queryBases / std::max(1e-9, run_report::Report::get().elapsed() - mapStart));
+      }
+
+      /**
+       * @brief     runs of consecutive mapped queries of the same prefix group, which the
+       *            one-to-one filter handles apart from each other
+       */
+      class OneToOneRuns
+      {
+        public:
+
+          //Give a run to the queries of mappings in query order, following the ones given so far
+          void assign(const MappingResultsVector_t& mappings, Map& map)
+          {
+            for (const auto& m : mappings)
+            {
+              if (m.querySeqId < (seqno_t)runOfQuery.size() && runOfQuery[m.querySeqId] >= 0)
+                continue;
+              if (m.querySeqId >= (seqno_t)runOfQuery.size())
+                runOfQuery.resize(std::max<size_t>(m.querySeqId + 1, map.qmetadata.size()), -1);
+              const int group = map.param.skip_prefix ? map.qmetadataGroups[m.querySeqId] : 0;
+              if (lastRun >= 0 && group != lastGroup)
+                lastRun++;
+              lastRun = std::max(lastRun, 0);
+              lastGroup = group;
+              runOfQuery[m.querySeqId] = lastRun;
+            }
+          }
+
+          //Order of the one-to-one filter, by run then target
+          struct ByRunAndRef
+          {
+            const std::vector<int>* runOfQuery;
+
+            bool operator()(const MappingResult& a, const MappingResult& b) const
+            {
+              return std::make_tuple((*runOfQuery)[a.querySeqId], a.refSeqId, a.queryStartPos, a.refStartPos)
+                < std::make_tuple((*runOfQuery)[b.querySeqId], b.refSeqId, b.queryStartPos, b.refStartPos);
+            }
+          };
+
+          ByRunAndRef byRunAndRef() const
+          {
+            return ByRunAndRef{&runOfQuery};
+          }
+
+          int run(const MappingResult& m) const
+          {
+            return runOfQuery[m.querySeqId];
+          }
+
+        private:
+
+          std::vector<int> runOfQuery;
+          int lastRun = -1;
+          int lastGroup = 0;
+      };
+
+      /**
+       * @brief               one-to-one filter and report of mappings spilled to disk
+       * @details             the reference axis filter of filterByGroup only compares mappings of
+       *                      the same query run and target, so the runs are merged one target of a
+       *                      query run at a time. Kept mappings past the memory budget are spilled
+       *                      again, in output order
+       */
+      void filterSpilledOneToOne(MappingSpill& spill, const OneToOneRuns& queryRuns, output::Writer& outstrm)
+      {
+        // how many secondary mappings to keep
+        int n_mappings = param.numMappingsForSegment - 1;
+
+        const auto byOutputOrder = [](const MappingResult &a, const MappingResult &b)
+        {
+          return std::tie(a.querySeqId, a.queryStartPos, a.refSeqId, a.refStartPos)
+            < std::tie(b.querySeqId, b.queryStartPos, b.refSeqId, b.refStartPos);
+        };
+
+        MappingSpill keptSpill;
+        MappingResultsVector_t group;
+        MappingResultsVector_t kept;
+        const auto filterGroup = [&]()
+        {
+          skch::Filter::ref::filterMappingsBySequence(group, this->refSketch, n_mappings, param.dropRand, param.overlap_threshold, param.threads);
+          kept.insert(kept.end(), group.begin(), group.end());
+          group.clear();
+          if (kept.size() * sizeof(MappingResult) >= (uint64_t)param.onetoone_mem_budget)
+            keptSpill.spill(kept, byOutputOrder);
+        };
+
+        spill.merge(queryRuns.byRunAndRef(), [&](const MappingResult& m)
+        {
+          if (!group.empty() && (queryRuns.run(group.front()) != queryRuns.run(m) || group.front().refSeqId != m.refSeqId))
+            filterGroup();
+          group.push_back(m);
+        });
+        if (!group.empty())
+          filterGroup();
+
+        if (keptSpill.empty())
+        {
+          std::sort(kept.begin(), kept.end(), byOutputOrder);
+          reportReadMappings(kept, "", outstrm);
+          return;
+        }
+
+        keptSpill.spill(kept, byOutputOrder);
+        keptSpill.merge(byOutputOrder, [&](const MappingResult& m)
+        {
+          kept.push_back(m);
+          if (kept.size() >= reportChunkMappings)
+          {
+            reportReadMappings(kept, "", outstrm);
+            kept.clear();
+          }
+        });
+        reportReadMappings(kept, "", outstrm);
+      }
+
+      /**
+       * @brief               sort mappings by keyOf, ties kept in their order
+       * @details             sorts the small keys, each with the index of its mapping, and
+       *                      then moves every mapping once to its place, rather than moving
+       *                      whole mappings around while sorting
+       */
+      template <typename KeyFn>
+      static void sortByKey(MappingResultsVector_t &mappings, KeyFn keyOf)
+      {
+        sortByKey(mappings, 0, mappings.size(), keyOf);
+      }
+
+      /**
+       * @brief               sort the mappings [begin, end) by keyOf, ties kept in their order
+       */
+      template <typename KeyFn>
+      static void sortByKey(MappingResultsVector_t &mappings, size_t begin, size_t end, KeyFn keyOf)
+      {
+        using Key = decltype(keyOf(mappings.front()));
+        if (end - begin < 2)
+          return;
+        //Few mappings are as fast to move as their keys
+        if (end - begin < sortByKeyMinMappings)
+        {
+          std::stable_sort(mappings.begin() + begin, mappings.begin() + end,
+              [&](const MappingResult &a, const MappingResult &b) { return keyOf(a) < keyOf(b); });
+          return;
+        }
+
+        //Kept by the thread for the next sort, unless grown past what a query needs
+        thread_local std::vector<std::pair<Key, uint32_t>> keys;
+        thread_local MappingResultsVector_t sorted;
+        keys.clear();
+        keys.reserve(end - begin);
+        for (size_t i = begin; i < end; i++)
+          keys.emplace_back(keyOf(mappings[i]), i - begin);
+        std::sort(keys.begin(), keys.end());
+
+        sorted.clear();
+        sorted.reserve(end - begin);
+        for (const auto& k : keys)
+          sorted.push_back(std::move(mappings[begin + k.second]));
+        if (begin == 0 && end == mappings.size())
+          mappings.swap(sorted);
+        else
+          std::move(sorted.begin(), sorted.end(), mappings.begin() + begin);
+        sorted.clear();
+        if (sorted.capacity() > sortScratchMaxMappings)
+        {
+          MappingResultsVector_t().swap(sorted);
+          std::vector<std::pair<Key, uint32_t>>().swap(keys);
+        }
+      }
+
+      //Mappings under which sortByKey sorts them in place
+      static constexpr size_t sortByKeyMinMappings = 16;
+
+      //Mappings past which the scratch of sortByKey is released after a sort, as with the
+      //mappings of a whole run
+      static constexpr size_t sortScratchMaxMappings = 1 << 20;
+
+      /**
+       * @brief               runs the mappings through a chain of stages in a single pass
+       * @details             each stage is called with a mapping, which it may update, and returns
+       *                      whether to keep it; the later stages only see the mappings kept by the
+       *                      earlier ones, which are compacted to the front of the vector in order
+       * @param[in/out] readMappings
+       * @param[in]     stages
+       */
+      template <typename... Stages>
+      static void runMappingStages(MappingResultsVector_t &readMappings, Stages&&... stages)
+      {
+          auto kept = readMappings.begin();
+          for (auto it = readMappings.begin(); it != readMappings.end(); ++it) {
+              if ((stages(*it) && ...)) {
+                  if (kept != it) {
+                      *kept = std::move(*it);
+                  }
+                  ++kept;
+              }
+          }
+          readMappings.erase(kept, readMappings.end());
+      }
 
-          reportReadMappings(allReadMappings, "", outstrm);
-        }
+      /**
+       * @brief               stage keeping mappings with at least the block length and
+       *                      the target number of merged base mappings
+       */
+      auto strongMappingStage(int64_t min_count) const
+      {
+          return [this, min_count](const MappingResult &e) {
+              return !(e.blockLength < param.block_length //e.queryLen > e.blockLength
+                  || e.n_merged < min_count);
+          };
+      }
 
-        progress.finish();
+      static bool setBlockCoordsToMappingCoords(MappingResult &m) {
+          m.blockRefStartPos = m.refStartPos;
+          m.blockRefEndPos = m.refEndPos;
+          m.blockQueryStartPos = m.queryStartPos;
+          m.blockQueryEndPos = m.queryEndPos;
+          m.blockLength = std::max(m.blockRefEndPos - m.blockRefStartPos, m.blockQueryEndPos - m.blockQueryStartPos);
+          m.blockNucIdentity = m.nucIdentity;
+          return true;
+      }
 
-        std::cerr << "[mashmap::skch::Map::mapQuery] "
-                  << "count of mapped reads = " << totalReadsMapped
-                  << ", reads qualified for mapping = " << totalReadsPickedForMapping
-                  << ", total input reads = " << seqCounter
-                  << ", total input bp = " << total_seq_length << std::endl;
+      /**
+       * @brief               stage keeping mappings whose identity and query/ref length agree
+       */
+      auto lengthAgreementStage() const
+      {
+          const double min_len_id_bound = std::min(0.7, std::pow(param.percentageIdentity,3));
+          return [min_len_id_bound](const MappingResult &e) {
+              int64_t q_l = (int64_t)e.blockQueryEndPos - (int64_t)e.blockQueryStartPos;
+              int64_t r_l = (int64_t)e.blockRefEndPos - (int64_t)e.blockRefStartPos;
+              uint64_t delta = std::abs(r_l - q_l);
+              double len_id_bound = (1.0 - (double)delta/(((double)q_l+r_l)/2));
+              return !(len_id_bound < min_len_id_bound);
+          };
+      }
+
+      /**
+       * @brief               stage keeping the mappings that hash below the sparsity threshold
+       */
+      auto sparsityStage() const
+      {
+          return [this](MappingResult &e) {
+              return e.hash() <= param.sparsity_hash_threshold;
+          };
+      }
 
+      bool sparsifiesMappings() const
+      {
+          return param.sparsity_hash_threshold < std::numeric_limits<uint64_t>::max() && !param.sparsify_pairs;
       }
 
       /**
@@ -450,24 +1706,12 @@ namespace skch
        */
       void filterWeakMappings(MappingResultsVector_t &readMappings, int64_t min_count)
       {
-          readMappings.erase(
-              std::remove_if(readMappings.begin(),
-                             readMappings.end(),
-                             [&](MappingResult &e){
-                                 return e.blockLength < param.block_length //e.queryLen > e.blockLength
-                                     || e.n_merged < min_count;
-                             }),
-              readMappings.end());
+          runMappingStages(readMappings, strongMappingStage(min_count));
       }
 
       void setBlockCoordsToMappingCoords(MappingResultsVector_t &readMappings) {
           for (auto& m : readMappings) {
-              m.blockRefStartPos = m.refStartPos;
-              m.blockRefEndPos = m.refEndPos;
-              m.blockQueryStartPos = m.queryStartPos;
-              m.blockQueryEndPos = m.queryEndPos;
-              m.blockLength = std::max(m.blockRefEndPos - m.blockRefStartPos, m.blockQueryEndPos - m.blockQueryStartPos);
-              m.blockNucIdentity = m.nucIdentity;
+              setBlockCoordsToMappingCoords(m);
           }
       }
 
@@ -479,17 +1723,7 @@ namespace skch
        */
       void filterFalseHighIdentity(MappingResultsVector_t &readMappings)
       {
-          readMappings.erase(
-              std::remove_if(readMappings.begin(),
-                             readMappings.end(),
-                             [&](MappingResult &e){
-                                 int64_t q_l = (int64_t)e.blockQueryEndPos - (int64_t)e.blockQueryStartPos;
-                                 int64_t r_l = (int64_t)e.blockRefEndPos - (int64_t)e.blockRefStartPos;
-                                 uint64_t delta = std::abs(r_l - q_l);
-                                 double len_id_bound = (1.0 - (double)delta/(((double)q_l+r_l)/2));
-                                 return len_id_bound < std::min(0.7, std::pow(param.percentageIdentity,3));
-                             }),
-              readMappings.end());
+          runMappingStages(readMappings, lengthAgreementStage());
       }
 
       /**
@@ -520,14 +1754,8 @@ namespace skch
        */
       void sparsifyMappings(MappingResultsVector_t &readMappings)
       {
-          if (param.sparsity_hash_threshold < std::numeric_limits<uint64_t>::max()) {
-              readMappings.erase(
-                  std::remove_if(readMappings.begin(),
-                                 readMappings.end(),
-                                 [&](MappingResult &e){
-                                     return e.hash() > param.sparsity_hash_threshold;
-                                 }),
-                  readMappings.end());
+          if (sparsifiesMappings()) {
+              runMappingStages(readMappings, sparsityStage());
           }
       }
 
@@ -548,13 +1776,16 @@ namespace skch
       {
         filteredMappings.reserve(unfilteredMappings.size());
 
-        std::sort(unfilteredMappings.begin(), unfilteredMappings.end(), [](const auto& a, const auto& b) 
-            { return std::tie(a.refSeqId, a.refStartPos) < std::tie(b.refSeqId, b.refStartPos); });
+        //Only the groups of reference sequences need to be contiguous, there is one without skip_prefix
+        if (param.skip_prefix)
+          sortByKey(unfilteredMappings, [](const MappingResult &e) { return std::make_tuple(e.refSeqId, e.refStartPos); });
+        bool sortedByQuery = false;
         auto subrange_begin = unfilteredMappings.begin();
         auto subrange_end = unfilteredMappings.begin();
         if (param.filterMode == filter::MAP || param.filterMode == filter::ONETOONE) 
         {
-          std::vector<skch::MappingResult> tmpMappings;
+          // the groups of reference sequences are filtered independently, in parallel
+          std::vector<std::pair<size_t, size_t>> groups;
           while (subrange_end != unfilteredMappings.end())
           {
             if (param.skip_prefix)
@@ -568,37 +1799,54 @@ namespace skch
             {
               subrange_end = unfilteredMappings.end();
             }
-            tmpMappings.insert(
-                tmpMappings.end(), 
-                std::make_move_iterator(subrange_begin), 
-                std::make_move_iterator(subrange_end));
-            std::sort(tmpMappings.begin(), tmpMappings.end(), [](const auto& a, const auto& b) 
-                { return std::tie(a.queryStartPos, a.refSeqId, a.refStartPos) < std::tie(b.queryStartPos, b.refSeqId, b.refStartPos); });
-            if (filter_ref)
-            {
-                skch::Filter::ref::filterMappings(tmpMappings, this->refSketch, n_mappings, param.dropRand, param.overlap_threshold);
-            }
-            else
+            groups.emplace_back(subrange_begin - unfilteredMappings.begin(), subrange_end - unfilteredMappings.begin());
+            subrange_begin = subrange_end;
+          }
+
+          std::vector<MappingResultsVector_t> groupMappings(groups.size());
+          {
+            tasks::TaskGroup filterTasks(tasks::sharedExecutor(param.threads));
+            for (size_t g = 0; g < groups.size(); g++)
             {
-                skch::Filter::query::filterMappings(tmpMappings, n_mappings, param.dropRand, param.overlap_threshold);
+              const auto filterGroup = [&, g]()
+              {
+                auto& tmpMappings = groupMappings[g];
+                tmpMappings.assign(
+                    std::make_move_iterator(unfilteredMappings.begin() + groups[g].first),
+                    std::make_move_iterator(unfilteredMappings.begin() + groups[g].second));
+                sortByKey(tmpMappings, [](const MappingResult &e)
+                    { return std::make_tuple(e.queryStartPos, e.refSeqId, e.refStartPos); });
+                if (filter_ref)
+                {
+                    skch::Filter::ref::filterMappingsBySequence(tmpMappings, this->refSketch, n_mappings, param.dropRand, param.overlap_threshold, param.threads);
+                }
+                else
+                {
+                    skch::Filter::query::filterMappings(tmpMappings, n_mappings, param.dropRand, param.overlap_threshold);
+                }
+              };
+              if (groups.size() > 1 && groups[g].second - groups[g].first >= filterTaskMinMappings)
+                filterTasks.run(filterGroup);
+              else
+                filterGroup();
             }
+            filterTasks.wait();
+          }
+          for (auto& tmpMappings : groupMappings)
+          {
             filteredMappings.insert(
                 filteredMappings.end(), 
                 std::make_move_iterator(tmpMappings.begin()), 
                 std::make_move_iterator(tmpMappings.end()));
-            tmpMappings.clear();
-            subrange_begin = subrange_end;
           }
+          //the filters keep the order of the mappings of a group
+          sortedByQuery = groups.size() <= 1;
         }
         //Sort the mappings by query (then reference) position
-        std::sort(
-            filteredMappings.begin(), filteredMappings.end(),
-            [](const MappingResult &a, const MappingResult &b) {
-                return std::tie(a.queryStartPos, a.refSeqId, a.refStartPos) 
-                  < std::tie(b.queryStartPos, b.refSeqId, b.refStartPos);
-                //return std::tie(a.refSeqId, a.refStartPos, a.queryStartPos)
-                    //< std::tie(b.refSeqId, b.refStartPos, b.queryStartPos);
-            });
+        if (!sortedByQuery)
+          sortByKey(filteredMappings, [](const MappingResult &e) {
+              return std::make_tuple(e.queryStartPos, e.refSeqId, e.refStartPos);
+          });
       }
 
 
@@ -610,125 +1858,431 @@ namespace skch
        */
       MapModuleOutput* mapModule (InputSeqProgContainer* input)
       {
-        MapModuleOutput* output = new MapModuleOutput();
-
-        //save query sequence name and length
-        output->qseqName = input->seqName;
-        output->qseqLen = input->len;
-        bool split_mapping = true;
-        std::vector<IntervalPoint> intervalPoints;
-        // Reserve the "expected" number of interval points
-        intervalPoints.reserve(
-            2 * param.sketchSize * refSketch.minmerIndex.size() / refSketch.minmerPosLookupIndex.size());
-        std::vector<L1_candidateLocus_t> l1Mappings;
-        MappingResultsVector_t l2Mappings;
-        MappingResultsVector_t unfilteredMappings;
-        int refGroup = this->getRefGroup(input->seqName);
-
-        if(! param.split || input->len <= param.segLength)
+        if (mapsWhole(input))
         {
           QueryMetaData <MinVec_Type> Q;
-          Q.seq = &(input->seq)[0u];
-          Q.len = input->len;
-          Q.fullLen = input->len;
-          Q.seqCounter = input->seqCounter;
-          Q.seqName = input->seqName;
-          Q.refGroup = refGroup;
+          std::vector<uint64_t> admissible;
+          prepareWholeQuery(input, Q, admissible);
+          return mapWholeQuery(input, Q, nullptr);
+        }
+
+        //Split read mapping
+        trace::Span span("map_query", input->seqName);
+        WFMASH_PROBE(map_query_start, input->seqName.c_str(), input->len);
+        std::unique_ptr<MappingWorkspace> workspace = mappingWorkspaces.take();
+        MappingResultsVector_t& unfilteredMappings = workspace->unfilteredMappings;
+        unfilteredMappings.clear();
+        workspace->shard.clear();
+
+        //The stream reads the sequence in place
+        if (!input->packed)
+          CommonFunc::makeUpperCaseAndValidDNA(&(input->seq)[0u], input->len);
+
+        const int fragments = fragmentCount(input->len);
+        const int splitTasks = splitQueryTaskCount(input->len);
+        prefilterQuery(input);
+        coarseQuery(input);
+        if (splitTasks > 1)
+        {
+          //Fragments of a long query are spread over the threads, as nested tasks
+          std::vector<MappingResultsVector_t> taskMappings(splitTasks);
+          std::vector<ShardQueryOutput> taskShards(splitTasks);
+          {
+            tasks::TaskGroup fragmentTasks(tasks::sharedExecutor(param.threads));
+            for (int t = 0; t < splitTasks; t++)
+              fragmentTasks.run([&, t]() {
+                  mapQueryFragments(input, (int64_t)fragments * t / splitTasks, (int64_t)fragments * (t + 1) / splitTasks,
+                      taskMappings[t], taskShards[t]);
+                  });
+            fragmentTasks.wait();
+          }
+          for (int t = 0; t < splitTasks; t++)
+          {
+            unfilteredMappings.insert(unfilteredMappings.end(), taskMappings[t].begin(), taskMappings[t].end());
+            workspace->shard.append(taskShards[t]);
+          }
+        }
+        else
+        {
+          mapQueryFragments(input, 0, fragments, unfilteredMappings, workspace->shard);
+        }
 
-          //Map this sequence
-          mapSingleQueryFrag(Q, intervalPoints, l1Mappings, l2Mappings);
+        const size_t l2Mappings = unfilteredMappings.size();
+        MapModuleOutput* output = finishQueryMappings(input, *workspace, true);
+        giveMappingWorkspace(std::move(workspace));
+        WFMASH_PROBE(map_query_end, input->seqName.c_str(), input->len, l2Mappings, output->readMappings.size());
+        return output;
+      }
 
-          // save the output
-          unfilteredMappings.insert(unfilteredMappings.end(), l2Mappings.begin(), l2Mappings.end());
+      /**
+       * @brief               whether a query is mapped whole, as a single fragment, rather than split
+       */
+      bool mapsWhole(const InputSeqProgContainer* input) const
+      {
+        return !param.split || input->len <= param.segLength;
+      }
 
-          // indicate that we mapped full length
-          split_mapping = false;
+      /**
+       * @brief                   set up a query mapped whole, to be sketched
+       * @param[out]  admissible  targets the query may map on, pointed to by Q
+       */
+      void prepareWholeQuery(InputSeqProgContainer* input, QueryMetaData <MinVec_Type>& Q,
+                             std::vector<uint64_t>& admissible)
+      {
+        const int refGroup = this->getRefGroup(input->seqName);
 
-          input->progress.increment(input->len);
+        //Sketched as a whole, so a packed query is unpacked for the time it is mapped
+        if (input->packed)
+        {
+          input->seq.resize(input->len);
+          input->packedSeq.unpack(0, input->len, &(input->seq)[0u]);
         }
-        else  //Split read mapping
+
+        Q.seq = &(input->seq)[0u];
+        Q.len = input->len;
+        Q.fullLen = input->len;
+        Q.seqCounter = input->seqCounter;
+        Q.seqName = input->seqName;
+        Q.refGroup = refGroup;
+        prefilterQuery(input);
+        setAdmissibleTargets(input->seqName, input->seqCounter, refGroup, admissible);
+        admitUncachedOnly(input, admissible);
+        admitPrefiltered(input, admissible);
+        Q.admissibleTargets = admissible.empty() ? nullptr : admissible.data();
+        Q.admittedBegin = input->prefilteredBegin;
+        Q.admittedEnd = input->prefilteredEnd;
+        if (input->len == param.segLength)
+          Q.selfSeqId = refSketch.selfSeqId(input->seqName, input->len);
+      }
+
+      /**
+       * @brief                   map a query whole: its single fragment needs no merging or chaining
+       * @param[in]   Q           query set up by prepareWholeQuery
+       * @param[in]   seedFinds   interval points of its seeds, if already looked up, see mapSingleQueryFrag
+       * @return                  output object containing the mappings
+       */
+      MapModuleOutput* mapWholeQuery(InputSeqProgContainer* input, QueryMetaData <MinVec_Type>& Q,
+                                     std::vector<Sketch::SeedRange>* seedFinds)
+      {
+        trace::Span span("map_query", input->seqName);
+        WFMASH_PROBE(map_query_start, input->seqName.c_str(), input->len);
+        std::unique_ptr<MappingWorkspace> workspace = mappingWorkspaces.take();
+        std::vector<IntervalPoint>& intervalPoints = workspace->intervalPoints;
+        std::vector<L1_candidateLocus_t>& l1Mappings = workspace->l1Mappings;
+        MappingResultsVector_t& l2Mappings = workspace->l2Mappings;
+        intervalPoints.clear();
+        l1Mappings.clear();
+        l2Mappings.clear();
+        workspace->shard.clear();
+        Q.shardOutput = &workspace->shard;
+        // Reserve the "expected" number of interval points
+        intervalPoints.reserve(
+            2 * param.sketchSize * refSketch.minmerCount() / std::max<size_t>(1, refSketch.uniqueMinmerCount()));
+
+        //Map this sequence
+        mapSingleQueryFrag(Q, intervalPoints, l1Mappings, l2Mappings, seedFinds);
+
+        // save the output
+        workspace->unfilteredMappings.swap(l2Mappings);
+        input->progress.increment(input->len);
+
+        const size_t l2MappingCount = workspace->unfilteredMappings.size();
+        MapModuleOutput* output = finishQueryMappings(input, *workspace, false);
+        giveMappingWorkspace(std::move(workspace));
+        WFMASH_PROBE(map_query_end, input->seqName.c_str(), input->len, l2MappingCount, output->readMappings.size());
+        return output;
+      }
+
+      /**
+       * @brief               map queries [begin, end) of a batch whole, their seeds looked up together
+       * @param[out]  outputs outputs of the queries are appended here, in their order
+       */
+      void mapWholeQueries(const std::vector<InputSeqProgContainer*>& queries, size_t begin, size_t end,
+                           std::vector<MapModuleOutput*>& outputs)
+      {
+        std::vector<QueryMetaData <MinVec_Type>> block(end - begin);
+        std::vector<std::vector<uint64_t>> admissible(end - begin);
+        std::vector<std::vector<Sketch::SeedRange>> blockSeedFinds;
+        std::vector<PackedIntervalPoint> blockPoints;
+        for (size_t q = begin; q < end; q++)
         {
-          int noOverlapFragmentCount = input->len / param.segLength;
+          prepareWholeQuery(queries[q], block[q - begin], admissible[q - begin]);
+          getSeedHits(block[q - begin]);
+        }
+        findSeedsOfFragments(block, blockSeedFinds, blockPoints);
+        for (size_t q = begin; q < end; q++)
+          outputs.push_back(mapWholeQuery(queries[q], block[q - begin], &blockSeedFinds[q - begin]));
+      }
+
+      /**
+       * @brief               count of fragments a query is split into, the last one overlapping
+       *                      the previous one to cover the whole query
+       */
+      int fragmentCount(offset_t len) const
+      {
+        const int noOverlapFragmentCount = len / param.segLength;
+        return noOverlapFragmentCount + (noOverlapFragmentCount >= 1 && len % param.segLength != 0);
+      }
 
-          //Map individual non-overlapping fragments in the read
-          for (int i = 0; i < noOverlapFragmentCount; i++)
+      /**
+       * @brief                           map fragments [fragBegin, fragEnd) of a split query
+       * @param[in]   input               query, normalized unless packed
+       * @param[out]  unfilteredMappings  mappings of the fragments are appended here
+       * @param[out]  shardOutput         with index shards, what the fragments find for the last
+       *                                  one is appended here, see holdsForLastShard
+       */
+      void mapQueryFragments(InputSeqProgContainer* input, int fragBegin, int fragEnd,
+                             MappingResultsVector_t& unfilteredMappings, ShardQueryOutput& shardOutput)
+      {
+        std::unique_ptr<MappingWorkspace> workspace = mappingWorkspaces.take();
+        std::vector<IntervalPoint>& intervalPoints = workspace->intervalPoints;
+        intervalPoints.reserve(
+            2 * param.sketchSize * refSketch.minmerCount() / std::max<size_t>(1, refSketch.uniqueMinmerCount()));
+        std::vector<L1_candidateLocus_t>& l1Mappings = workspace->l1Mappings;
+        MappingResultsVector_t& l2Mappings = workspace->l2Mappings;
+        const int refGroup = this->getRefGroup(input->seqName);
+        const int noOverlapFragmentCount = input->len / param.segLength;
+        std::vector<uint64_t> admissible;
+        setAdmissibleTargets(input->seqName, input->seqCounter, refGroup, admissible);
+        admitUncachedOnly(input, admissible);
+        admitPrefiltered(input, admissible);
+
+        //All-vs-all, fragments of a target are sketched from the index
+        const seqno_t selfSeqId = refSketch.selfSeqId(input->seqName, input->len);
+
+        //Fragments share the kmer hashes of the whole query
+        CommonFunc::KmerHashStream hashStream = input->packed
+          ? CommonFunc::KmerHashStream(input->packedSeq, param.kmerSize, param.alphabetSize, param.rolling_hash,
+              refSketch.spacedSeeds(), refSketch.syncmerSize())
+          : CommonFunc::KmerHashStream(&(input->seq)[0u], input->len, param.kmerSize, param.alphabetSize, param.rolling_hash,
+              refSketch.spacedSeeds(), refSketch.syncmerSize());
+
+        //Fragments are sketched a block at a time, for their seeds to be looked up together
+        std::vector<QueryMetaData <MinVec_Type>> block;
+        std::vector<std::vector<Sketch::SeedRange>> blockSeedFinds;
+        std::vector<PackedIntervalPoint> blockPoints;
+        for (int blockBegin = fragBegin; blockBegin < fragEnd; blockBegin += seedLookupBlockFragments)
+        {
+          const int blockEnd = std::min(fragEnd, blockBegin + seedLookupBlockFragments);
+          block.clear();
+          block.resize(blockEnd - blockBegin);
+          for (int i = blockBegin; i < blockEnd; i++)
           {
+            //Non-overlapping fragments, then the last overlapping one
+            const offset_t fragStart = i < noOverlapFragmentCount ? i * param.segLength : input->len - param.segLength;
+            if (i == fragBegin)
+              hashStream.seek(fragStart);
+
             //Prepare fragment sequence object
-            QueryMetaData <MinVec_Type> Q;
-            Q.seq = &(input->seq)[0u] + i * param.segLength;
+            QueryMetaData <MinVec_Type>& Q = block[i - blockBegin];
+            Q.seq = input->packed ? nullptr : &(input->seq)[0u] + fragStart;
             Q.len = param.segLength;
+            Q.hashStream = &hashStream;
+            Q.streamOffset = fragStart;
+            Q.selfSeqId = selfSeqId;
             Q.fullLen = input->len;
             Q.seqCounter = input->seqCounter;
             Q.seqName = input->seqName;
             Q.refGroup = refGroup;
+            Q.admissibleTargets = admissible.empty() ? nullptr : admissible.data();
+            Q.admittedBegin = input->prefilteredBegin;
+            Q.admittedEnd = input->prefilteredEnd;
+            Q.shardOutput = &shardOutput;
+            if (input->coarse != nullptr)
+            {
+              //a window the coarse level found nothing for is looked up everywhere
+              const auto regions = input->coarse->regionsAt(fragStart + Q.len / 2);
+              if (regions.first != regions.second)
+              {
+                Q.regionsBegin = regions.first;
+                Q.regionsEnd = regions.second;
+              }
+            }
+            getSeedHits(Q);
+          }
+          findSeedsOfFragments(block, blockSeedFinds, blockPoints);
+
+          for (int i = blockBegin; i < blockEnd; i++)
+          {
+            QueryMetaData <MinVec_Type>& Q = block[i - blockBegin];
+            const offset_t fragStart = Q.streamOffset;
 
             intervalPoints.clear();
             l1Mappings.clear();
             l2Mappings.clear();
 
             //Map this fragment
-            mapSingleQueryFrag(Q, intervalPoints, l1Mappings, l2Mappings);
+            mapSingleQueryFrag(Q, intervalPoints, l1Mappings, l2Mappings, &blockSeedFinds[i - blockBegin]);
 
             //Adjust query coordinates and length in the reported mapping
             std::for_each(l2Mappings.begin(), l2Mappings.end(), [&](MappingResult &e){
                 e.queryLen = input->len;
-                e.queryStartPos = i * param.segLength;
-                e.queryEndPos = i * param.segLength + Q.len;
+                e.queryStartPos = fragStart;
+                e.queryEndPos = fragStart + Q.len;
                 });
 
             // save the output
             unfilteredMappings.insert(unfilteredMappings.end(), l2Mappings.begin(), l2Mappings.end());
-            input->progress.increment(param.segLength);
+            input->progress.increment(i < noOverlapFragmentCount ? param.segLength : input->len % param.segLength);
           }
+        }
+        giveMappingWorkspace(std::move(workspace));
+      }
 
-          //Map last overlapping fragment to cover the whole read
-          if (noOverlapFragmentCount >= 1 && input->len % param.segLength != 0)
-          {
-            //Prepare fragment sequence object
-            QueryMetaData <MinVec_Type> Q;
-            Q.seq = &(input->seq)[0u] + input->len - param.segLength;
-            Q.len = param.segLength;
-            Q.seqCounter = input->seqCounter;
-            Q.seqName = input->seqName;
-            Q.refGroup = refGroup;
+      //Vectors kept by the spare workspaces and outputs at most, larger ones are freed
+      static constexpr size_t spareWorkspaceMaxBytes = 1 << 20;
+      static constexpr size_t spareOutputMaxBytes = 1 << 12;
+      static constexpr size_t spareOutputsMax = 1 << 11;
 
-            intervalPoints.clear();
-            l1Mappings.clear();
-            l2Mappings.clear();
+      template <typename T>
+      static void releaseIfLarger(std::vector<T>& v, size_t maxBytes)
+      {
+        if (v.capacity() * sizeof(T) > maxBytes)
+          std::vector<T>().swap(v);
+      }
 
-            //Map this fragment
-            mapSingleQueryFrag(Q, intervalPoints, l1Mappings, l2Mappings);
+      void giveMappingWorkspace(std::unique_ptr<MappingWorkspace> workspace)
+      {
+        releaseIfLarger(workspace->intervalPoints, spareWorkspaceMaxBytes);
+        releaseIfLarger(workspace->l1Mappings, spareWorkspaceMaxBytes);
+        releaseIfLarger(workspace->l2Mappings, spareWorkspaceMaxBytes);
+        releaseIfLarger(workspace->unfilteredMappings, spareWorkspaceMaxBytes);
+        releaseIfLarger(workspace->filteredMappings, spareWorkspaceMaxBytes);
+        releaseIfLarger(workspace->shard.bests, spareWorkspaceMaxBytes);
+        releaseIfLarger(workspace->shard.candidates, spareWorkspaceMaxBytes);
+        mappingWorkspaces.give(std::move(workspace), std::numeric_limits<size_t>::max());
+      }
 
-            //Adjust query coordinates and length in the reported mapping
-            std::for_each(l2Mappings.begin(), l2Mappings.end(), [&](MappingResult &e){
-                e.queryLen = input->len;
-                e.queryStartPos = input->len - param.segLength;
-                e.queryEndPos = input->len;
-                });
+      /**
+       * @brief               an output of a query, empty, recycled from one handled before if any
+       */
+      MapModuleOutput* takeOutput()
+      {
+        MapModuleOutput* output = spareOutputs.take().release();
+        output->reset();
+        output->records.clear();
+        output->l2Mappings.clear();
+        return output;
+      }
 
-            unfilteredMappings.insert(unfilteredMappings.end(), l2Mappings.begin(), l2Mappings.end());
+      /**
+       * @brief               recycle an output once handled, unless its vectors grew large
+       */
+      void recycleOutput(MapModuleOutput* output)
+      {
+        if (output->readMappings.capacity() * sizeof(MappingResult) > spareOutputMaxBytes
+            || output->records.capacity() > spareOutputMaxBytes
+            || output->anchors.capacity() * sizeof(SeedAnchor) > spareOutputMaxBytes
+            || output->shard.candidates.capacity() * sizeof(ShardCandidate) > spareOutputMaxBytes)
+        {
+          delete output;
+          return;
+        }
+        spareOutputs.give(std::unique_ptr<MapModuleOutput>(output), spareOutputsMax);
+      }
 
-            input->progress.increment(input->len % param.segLength);
+      /**
+       * @brief                   look the seeds of a block of fragments up in one pass
+       * @details                 the seeds of all the fragments are looked up in hash order and
+       *                          each distinct hash once, so that consecutive lookups fall close in
+       *                          the index, then their interval points are handed back to each
+       *                          fragment. Sketches are sorted by hash, so this is a merge
+       * @param[in]   fragments   sketched fragments, see getSeedHits
+       * @param[out]  seedFinds   interval points of each seed of each fragment, empty for the
+       *                          fragments doL1Mapping won't go on with
+       * @param[out]  decodedPoints points of a compressed index, which seedFinds point into
+       */
+      template <typename Q_Info>
+        void findSeedsOfFragments(const std::vector<Q_Info>& fragments, std::vector<std::vector<Sketch::SeedRange>>& seedFinds,
+                                  std::vector<PackedIntervalPoint>& decodedPoints) const
+        {
+          const auto seedsLookedUp = [&](const Q_Info& Q) {
+            return Q.sketchSize > 0 && Q.kmerComplexity >= param.kmerComplexityThreshold;
+          };
+
+          thread_local MinVec_Type seeds;
+          thread_local std::vector<Sketch::SeedRange> found;
+          seeds.clear();
+          for (const auto& Q : fragments)
+            if (seedsLookedUp(Q))
+              seeds.insert(seeds.end(), Q.minmerTableQuery.begin(), Q.minmerTableQuery.end());
+          std::sort(seeds.begin(), seeds.end(), [](const MinmerInfo& l, const MinmerInfo& r) { return l.hash < r.hash; });
+          seeds.erase(std::unique(seeds.begin(), seeds.end(),
+                [](const MinmerInfo& l, const MinmerInfo& r) { return l.hash == r.hash; }), seeds.end());
+          found.resize(seeds.size());
+          refSketch.findIntervalPointsBatch(seeds.data(), seeds.size(), found.data(), decodedPoints);
+          hot_counters::add(hot_counters::seeds_looked_up, seeds.size());
+
+          seedFinds.resize(fragments.size());
+          for (size_t f = 0; f < fragments.size(); f++)
+          {
+            const Q_Info& Q = fragments[f];
+            seedFinds[f].clear();
+            if (!seedsLookedUp(Q))
+              continue;
+            seedFinds[f].resize(Q.minmerTableQuery.size());
+            size_t j = 0;
+            for (size_t i = 0; i < Q.minmerTableQuery.size(); i++)
+            {
+              while (seeds[j].hash < Q.minmerTableQuery[i].hash)
+                j++;
+              seedFinds[f][i] = found[j];
+            }
           }
         }
 
+      /**
+       * @brief                           chain and filter the mappings of all the fragments of a query
+       * @param[in]   input               query
+       * @param[in]   workspace           with the unfilteredMappings of the query, consumed
+       * @param[in]   split_mapping       whether the query was mapped as fragments
+       * @return                          output object containing the mappings
+       */
+      MapModuleOutput* finishQueryMappings(InputSeqProgContainer* input,
+                                           MappingWorkspace& workspace,
+                                           bool split_mapping)
+      {
+        MapModuleOutput* output = takeOutput();
+        MappingResultsVector_t& unfilteredMappings = workspace.unfilteredMappings;
+
+        //save query sequence name and length
+        output->qseqName = input->seqName;
+        output->qseqLen = input->len;
+
+        //The mappings of each candidate are held as they are, for the last shard to filter
+        if (holdsForLastShard())
+        {
+          output->readMappings.swap(unfilteredMappings);
+          std::swap(output->shard, workspace.shard);
+          return output;
+        }
+
         // how many mappings to keep
         int n_mappings = (input->len < param.segLength ?
                           param.numMappingsForShortSequence
                           : param.numMappingsForSegment) - 1;
 
+        hot_counters::add(hot_counters::mappings_l2, unfilteredMappings.size());
+        if (mappingCache && split_mapping && param.mergeMappings)
+        {
+          output->l2Mappings.assign(cacheGroupBegin.size() - 1, 0);
+          for (const auto& e : unfilteredMappings)
+            output->l2Mappings[cacheGroupOf(e.refSeqId)]++;
+        }
         if (split_mapping) 
         {
           if (param.mergeMappings) 
           {
             // hardcore merge using the chain gap
             mergeMappingsInRange(unfilteredMappings, param.chain_gap);
-
-            // remove short chains that didn't exceed block length
-            filterWeakMappings(unfilteredMappings, std::floor(param.block_length / param.segLength));
-
-            // now that filtering has happened, set back the individual mapping coordinates and block length
-            setBlockCoordsToMappingCoords(unfilteredMappings);
+            hot_counters::add(hot_counters::mappings_merged, unfilteredMappings.size());
+
+            // remove short chains that didn't exceed block length, then
+            // set back the individual mapping coordinates and block length of those kept
+            runMappingStages(unfilteredMappings,
+                strongMappingStage(std::floor(param.block_length / param.segLength)),
+                [](MappingResult &e) { return setBlockCoordsToMappingCoords(e); });
+            hot_counters::add(hot_counters::mappings_weak_filtered, unfilteredMappings.size());
           } else {
               // set block coordinates
               setBlockCoordsToMappingCoords(unfilteredMappings);
@@ -739,29 +2293,108 @@ namespace skch
         }
 
         if (param.filterMode == filter::MAP || param.filterMode == filter::ONETOONE) {
-          MappingResultsVector_t tmpMappings;
-          tmpMappings.reserve(output->readMappings.size());
-          filterByGroup(unfilteredMappings, tmpMappings, n_mappings, false);
-          unfilteredMappings = std::move(tmpMappings);
+          MappingResultsVector_t& filteredMappings = workspace.filteredMappings;
+          filteredMappings.clear();
+          filterByGroup(unfilteredMappings, filteredMappings, n_mappings, false);
+          unfilteredMappings.swap(filteredMappings);
+          hot_counters::add(hot_counters::mappings_group_filtered, unfilteredMappings.size());
         }
 
-        output->readMappings = std::move(unfilteredMappings);
+        //The capacity of the recycled output goes back to the workspace
+        output->readMappings.swap(unfilteredMappings);
+
+        //In one pass: make sure mapping boundary don't exceed sequence lengths, remove
+        //alignments where the ratio between query and target length is < our identity
+        //threshold and sparsify the mappings, if requested
+        const auto lengthAgreement = lengthAgreementStage();
+        const auto sparsity = sparsityStage();
+        const bool filterLengths = param.filterLengthMismatches;
+        const bool sparsify = sparsifiesMappings();
+        const offset_t queryLen = input->len;
+        runMappingStages(output->readMappings,
+            [&](MappingResult &e) { return clampMappingBoundaries(queryLen, e); },
+            [&](MappingResult &e) { return !filterLengths || lengthAgreement(e); },
+            [&](MappingResult &e) { return !sparsify || sparsity(e); });
 
-        //Make sure mapping boundary don't exceed sequence lengths
-        this->mappingBoundarySanityCheck(input, output->readMappings);
+        return output;
+      }
 
-        // remove alignments where the ratio between query and target length is < our identity threshold
-        if (param.filterLengthMismatches)
+      /**
+       * @brief               map each query of a batch in turn
+       * @details             run in parallel by multiple threads, the thread pool deletes the input
+       * @param[in]   input   queries in input order
+       * @return              outputs of mapModule in the same order
+       */
+      MapModuleBatchOutput* mapModuleBatch (InputSeqProgBatch* input)
+      {
+        MapModuleBatchOutput* output = new MapModuleBatchOutput();
+        output->reservedBytes = input->reservedBytes;
+        output->outputs.reserve(input->queries.size());
+        const auto& queries = input->queries;
+        for (size_t q = 0; q < queries.size();)
         {
-          this->filterFalseHighIdentity(output->readMappings);
+          //Runs of short queries are mapped a block at a time, their seeds looked up together
+          size_t end = q;
+          while (end < queries.size() && end - q < seedLookupBlockFragments && mapsWhole(queries[end])
+              && !replaysCached(queries[end]) && !copiesEarlier(queries[end]))
+            end++;
+          if (end - q > 1)
+          {
+            mapWholeQueries(queries, q, end, output->outputs);
+          }
+          else
+          {
+            end = q + 1;
+            output->outputs.push_back(copiesEarlier(queries[q]) ? copyQuery(queries[q])
+                : replaysCached(queries[q]) ? replayCachedQuery(queries[q]) : mapModule(queries[q]));
+          }
+          for (; q < end; q++)
+          {
+            MapModuleOutput* queryOutput = output->outputs[q];
+            queryOutput->seqCounter = queries[q]->seqCounter;
+            queryOutput->firstCopy = queries[q]->firstCopy;
+            if (copiesEarlier(queries[q]))
+              continue;
+            if (mappingCache)
+              cacheQueryMappings(queries[q], *queryOutput);
+            if (findsSeedAnchors())
+              seedAnchorsOf(queries[q], *queryOutput);
+            if (formatsRecordsInWorkers())
+              formatReadMappings(*queryOutput);
+            output->mappingBytes += queryOutput->readMappings.capacity() * sizeof(MappingResult)
+              + queryOutput->records.capacity() + queryOutput->anchors.capacity() * sizeof(SeedAnchor);
+          }
         }
-
-        // sparsify the mappings, if requested
-        this->sparsifyMappings(output->readMappings);
-
+        memory_accounting::add(memory_accounting::map_mappings, output->mappingBytes);
         return output;
       }
 
+      /**
+       * @brief               count of tasks to map a query with, more than one for long
+       *                      queries, so that they don't keep the other threads waiting
+       */
+      int splitQueryTaskCount(offset_t len) const
+      {
+        if (!param.split || param.threads <= 1 || len / longQueryTaskBases < 2)
+          return 1;
+        return std::min<int64_t>({(int64_t)param.threads, len / longQueryTaskBases, fragmentCount(len)});
+      }
+
+      /**
+       * @brief                       handle the outputs of a batch in order, see mapModuleHandleOutput
+       */
+      template <typename Vec>
+      void mapModuleHandleBatchOutput(MapModuleBatchOutput* output,
+                                      Vec &allReadMappings,
+                                      seqno_t &totalReadsMapped,
+                                      output::Writer &outstrm,
+                                      progress_meter::ProgressMeter& progress)
+        {
+          for (auto queryOutput : output->outputs)
+            mapModuleHandleOutput(queryOutput, allReadMappings, totalReadsMapped, outstrm, progress);
+          delete output;
+        }
+
       /**
        * @brief                       routine to handle mapModule's output of mappings
        * @param[in] output            mapping output object
@@ -773,26 +2406,52 @@ namespace skch
       void mapModuleHandleOutput(MapModuleOutput* output,
                                  Vec &allReadMappings,
                                  seqno_t &totalReadsMapped,
-                                 std::ofstream &outstrm,
+                                 output::Writer &outstrm,
                                  progress_meter::ProgressMeter& progress)
         {
+          //Copies of earlier queries take their mappings, kept for them until then
+          const bool copied = queryDedup && output->firstCopy >= 0 && output->firstCopy != output->seqCounter;
+          if (holdsForLastShard())
+          {
+            //Copies take the mappings of their first query on the last shard only
+            if (!copied)
+              sharded->hold(output->seqCounter, output->shard, output->readMappings);
+            progress.add_records(1);
+            recycleOutput(output);
+            return;
+          }
+          if (copied)
+            queryDedup->copy(*output);
+          else if (queryDedup && output->firstCopy >= 0)
+            queryDedup->keep(*output);
+
           if(output->readMappings.size() > 0)
             totalReadsMapped++;
 
-          if (param.filterMode == filter::ONETOONE)
+          if (collectAllMappings())
           {
             //Save for another filtering round
             allReadMappings.insert(allReadMappings.end(), output->readMappings.begin(), output->readMappings.end());
           }
+          else if (formatsRecordsInWorkers() && !copied)
+          {
+            //Records formatted by the worker, only written here
+            outstrm.write(output->records);
+#ifdef DEBUG
+            outstrm.flush();
+#endif
+            countReportedMappings(output->readMappings);
+          }
           else
           {
             //Report mapping
-            reportReadMappings(output->readMappings, output->qseqName, outstrm);
+            reportReadMappings(output->readMappings, output->qseqName, outstrm, output);
           }
 
           //progress.increment(output->qseqLen/2 + (output->qseqLen % 2 != 0));
+          progress.add_records(1);
 
-          delete output;
+          recycleOutput(output);
         }
 
       /**
@@ -800,15 +2459,24 @@ namespace skch
        * @param[in]   Q           metadata about query sequence
        * @param[in]   outstrm     outstream stream where mappings will be reported
        * @param[out]  l2Mappings  Mapping results in the L2 stage
+       * @param[in]   seedFinds   interval points of the seeds of Q, if already sketched and looked up
        */
       template<typename Q_Info, typename IPVec, typename L1Vec, typename VecOut>
-        void mapSingleQueryFrag(Q_Info &Q, IPVec& intervalPoints, L1Vec& l1Mappings, VecOut &l2Mappings)
+        void mapSingleQueryFrag(Q_Info &Q, IPVec& intervalPoints, L1Vec& l1Mappings, VecOut &l2Mappings,
+                                std::vector<Sketch::SeedRange>* seedFinds = nullptr)
         {
 #ifdef ENABLE_TIME_PROFILE_L1_L2
           auto t0 = skch::Time::now();
 #endif
           //L1 Mapping
-          doL1Mapping(Q, intervalPoints, l1Mappings);
+          doL1Mapping(Q, intervalPoints, l1Mappings, seedFinds);
+          if (holdsForLastShard())
+          {
+            holdCandidates(Q, l1Mappings, l2Mappings);
+            return;
+          }
+          if (sharded != nullptr)
+            addHeldCandidates(Q, l1Mappings);
           if (l1Mappings.size() == 0) {
             return;
           }
@@ -846,8 +2514,7 @@ namespace skch
           }
 
           // Sort output mappings
-          std::sort(l2Mappings.begin(), l2Mappings.end(), [](const auto& a, const auto& b) 
-              { return std::tie(a.refSeqId, a.refStartPos) < std::tie(b.refSeqId, b.refStartPos); });
+          sortByKey(l2Mappings, [](const MappingResult &e) { return std::make_tuple(e.refSeqId, e.refStartPos); });
 
 #ifdef ENABLE_TIME_PROFILE_L1_L2
           {
@@ -863,11 +2530,83 @@ namespace skch
 #endif
         }
 
+      /**
+       * @brief                   with index shards, whether a target is in the index of this one
+       */
+      bool inShard(seqno_t seqId) const
+      {
+        return seqId % param.index_shards == refSketch.getShard();
+      }
+
+      /**
+       * @brief                   on a shard before the last one, put the L1 candidates of a query
+       *                          fragment in its shardOutput, with the L2 mappings of those that
+       *                          may be reported in l2Mappings, for the last shard to go through
+       *                          as doL2Mapping would
+       */
+      template <typename Q_Info, typename L1Vec, typename VecOut>
+        void holdCandidates(Q_Info &Q, L1Vec& l1Mappings, VecOut &l2Mappings)
+        {
+          if (sharded->pass() == ShardedMapping::Pass::Bests)
+            return;
+          for (auto& candidateLocus : l1Mappings)
+          {
+            const size_t l2Before = l2Mappings.size();
+            if (candidateLocus.intersectionSize >= minReportedShared[std::min(Q.sketchSize, param.sketchSize)])
+              mapL2Candidate(Q, candidateLocus, l2Mappings);
+            Q.shardOutput->candidates.push_back(ShardCandidate {Q.streamOffset, candidateLocus.seqId,
+                candidateLocus.rangeStartPos, candidateLocus.rangeEndPos, candidateLocus.intersectionSize,
+                0, uint32_t(l2Mappings.size() - l2Before)});
+          }
+        }
+
+      /**
+       * @brief                   on the last shard, add the L1 candidates the shards before held
+       *                          for a query fragment to its own, in the order of a single index
+       */
+      template <typename Q_Info, typename L1Vec>
+        void addHeldCandidates(Q_Info &Q, L1Vec& l1Mappings)
+        {
+          const auto held = sharded->candidates(Q.seqCounter, Q.streamOffset);
+          if (held.first == held.second)
+            return;
+          const size_t own = l1Mappings.size();
+          for (auto c = held.first; c != held.second; ++c)
+            l1Mappings.push_back(L1_candidateLocus_t {c->seqId, c->rangeStartPos, c->rangeEndPos, c->intersectionSize});
+          std::inplace_merge(l1Mappings.begin(), l1Mappings.begin() + own, l1Mappings.end(),
+              [](const L1_candidateLocus_t& a, const L1_candidateLocus_t& b) {
+                return std::tie(a.seqId, a.rangeStartPos) < std::tie(b.seqId, b.rangeStartPos);
+              });
+        }
+
+      /**
+       * @brief                   on the last shard, append the L2 mappings held for a candidate
+       *                          on a target of another shard
+       */
+      template <typename Q_Info, typename VecOut>
+        void addHeldMappings(Q_Info &Q, const L1_candidateLocus_t& candidateLocus, VecOut &l2Mappings) const
+        {
+          const auto held = sharded->candidates(Q.seqCounter, Q.streamOffset);
+          const ShardCandidate* c = std::lower_bound(held.first, held.second, candidateLocus,
+              [](const ShardCandidate& a, const L1_candidateLocus_t& b) {
+                return std::tie(a.seqId, a.rangeStartPos) < std::tie(b.seqId, b.rangeStartPos);
+              });
+          assert(c != held.second && c->seqId == candidateLocus.seqId && c->rangeStartPos == candidateLocus.rangeStartPos);
+          const auto mappings = sharded->mappings(Q.seqCounter, *c);
+          l2Mappings.insert(l2Mappings.end(), mappings.first, mappings.second);
+        }
+
       template <typename Q_Info>
         void getSeedHits(Q_Info &Q)
         {
           Q.minmerTableQuery.reserve(param.sketchSize + 1);
-          CommonFunc::sketchSequence(Q.minmerTableQuery, Q.seq, Q.len, param.kmerSize, param.alphabetSize, param.sketchSize, Q.seqCounter);
+          if (Q.selfSeqId >= 0)
+            refSketch.windowSketch(Q.selfSeqId, Q.streamOffset, Q.minmerTableQuery);
+          else if (Q.hashStream != nullptr)
+            Q.hashStream->sketch(Q.minmerTableQuery, Q.streamOffset, Q.len, param.sketchSize, Q.seqCounter);
+          else
+            CommonFunc::sketchSequence(Q.minmerTableQuery, Q.seq, Q.len, param.kmerSize, param.alphabetSize, param.sketchSize, Q.seqCounter, param.rolling_hash,
+                refSketch.spacedSeeds(), refSketch.syncmerSize());
           if(Q.minmerTableQuery.size() == 0) {
             Q.sketchSize = 0;
             return;
@@ -883,6 +2622,7 @@ namespace skch
           auto new_end = std::remove_if(Q.minmerTableQuery.begin(), Q.minmerTableQuery.end(), [&](auto& mi) {
             return refSketch.isFreqSeed(mi.hash);
           });
+          hot_counters::add(hot_counters::seeds_skipped_frequent, Q.minmerTableQuery.end() - new_end);
           Q.minmerTableQuery.erase(new_end, Q.minmerTableQuery.end());
 
           Q.sketchSize = Q.minmerTableQuery.size();
@@ -901,9 +2641,10 @@ namespace skch
        *              the following L2 stage.
        * @param[in]   Q                         query sequence details 
        * @param[out]  l1Mappings                all the read mapping locations
+       * @param[in]   found                     interval points of the seeds of Q, looked up here if null
        */
       template <typename Q_Info, typename Vec>
-        void getSeedIntervalPoints(Q_Info &Q, Vec& intervalPoints)
+        void getSeedIntervalPoints(Q_Info &Q, Vec& intervalPoints, std::vector<Sketch::SeedRange>* found = nullptr)
         {
 
 #ifdef DEBUG
@@ -915,33 +2656,60 @@ namespace skch
           if(Q.minmerTableQuery.size() == 0)
             return;
 
+          const uint64_t* admissible = Q.admissibleTargets;
+          const auto keepTarget = [admissible](seqno_t seqId) {
+            return admissible == nullptr || (admissible[seqId >> 6] >> (seqId & 63) & 1);
+          };
+
           // Priority queue for sorting interval points
-          using IP_const_iterator = std::vector<IntervalPoint>::const_iterator;
+          using IP_const_iterator = const PackedIntervalPoint*;
           std::vector<boundPtr<IP_const_iterator>> pq;
           pq.reserve(Q.sketchSize);
           constexpr auto heap_cmp = [](const auto& a, const auto& b) {return b < a;};
 
-          for(auto it = Q.minmerTableQuery.begin(); it != Q.minmerTableQuery.end(); it++)
+          //Look the seeds up in the reference lookup index, unless done with those of other fragments
+          std::vector<Sketch::SeedRange> lookedUp;
+          std::vector<PackedIntervalPoint> decodedPoints;
+          if (found == nullptr)
           {
-            //Check if hash value exists in the reference lookup index
-            const auto seedFind = refSketch.minmerPosLookupIndex.find(it->hash);
-
-            if(seedFind != refSketch.minmerPosLookupIndex.end())
+            lookedUp.resize(Q.minmerTableQuery.size());
+            refSketch.findIntervalPointsBatch(Q.minmerTableQuery.data(), Q.minmerTableQuery.size(), lookedUp.data(), decodedPoints);
+            hot_counters::add(hot_counters::seeds_looked_up, Q.minmerTableQuery.size());
+          }
+          std::vector<Sketch::SeedRange>& seedFinds = found == nullptr ? lookedUp : *found;
+          const size_t pointsBefore = intervalPoints.size();
+          if (admissible != nullptr)
+            pruneSeedRanges(Q, seedFinds);
+          if (param.max_seed_points > 0)
+            capSeedPoints(Q, seedFinds);
+          size_t totalPoints = 0;
+          for (size_t i = 0; i < seedFinds.size(); i++)
+          {
+            if (Q.regionsBegin != nullptr)
             {
-              pq.emplace_back(boundPtr<IP_const_iterator> {seedFind->second.cbegin(), seedFind->second.cend()});
+              pushRegionPoints(Q, seedFinds[i], Q.minmerTableQuery[i].hash, pq, totalPoints);
             }
+            else if(seedFinds[i].first != seedFinds[i].second)
+            {
+              pq.emplace_back(boundPtr<IP_const_iterator> {seedFinds[i].first, seedFinds[i].second, Q.minmerTableQuery[i].hash});
+              totalPoints += seedFinds[i].second - seedFinds[i].first;
+            }
+          }
+
+          // With many points from many seeds, sorting them all beats the log(#seeds) heap
+          if (totalPoints >= radixMergeMinPoints && pq.size() >= radixMergeMinSeeds)
+          {
+            radixMergeIntervalPoints(pq, totalPoints, keepTarget, intervalPoints);
+            pq.clear();
           }
+
           std::make_heap(pq.begin(), pq.end(), heap_cmp);
 
           while(!pq.empty())
           {
             const IP_const_iterator ip_it = pq.front().it;
-            const auto& ref = this->refSketch.metadata[ip_it->seqId];
-            if ((!param.skip_self || Q.seqName != ref.name)
-                && (!param.skip_prefix || this->refIdGroup[ip_it->seqId] != Q.refGroup)
-                && (!param.lower_triangular || Q.seqCounter > ip_it->seqId)
-            ) {
-              intervalPoints.push_back(*ip_it);
+            if (keepTarget(ip_it->seqId())) {
+              intervalPoints.push_back(ip_it->unpack(pq.front().hash));
             }
             std::pop_heap(pq.begin(), pq.end(), heap_cmp);
             pq.back().it++;
@@ -954,6 +2722,7 @@ namespace skch
               std::push_heap(pq.begin(), pq.end(), heap_cmp);
             }
           }
+          hot_counters::add(hot_counters::interval_points, intervalPoints.size() - pointsBefore);
 
 #ifdef DEBUG
           std::cerr << "INFO, skch::Map:getSeedHits, read id " << Q.seqCounter << ", Count of seed hits in the reference = " << intervalPoints.size() / 2 << "\n";
@@ -961,6 +2730,204 @@ namespace skch
         }
 
 
+      /**
+       * @brief       queue the interval points of a seed within the candidate regions of Q
+       * @details     the points of a seed are sorted by target and position, a window of it
+       *              being an open point followed by its close point: the points of a region
+       *              are cut so that no window is split, nor queued twice by two regions
+       */
+      template <typename Q_Info, typename Seeds>
+        void pushRegionPoints(const Q_Info &Q, const Sketch::SeedRange& found, hash_t hash,
+                              Seeds& pq, size_t& totalPoints) const
+        {
+          const PackedIntervalPoint* done = found.first;
+          for (const CandidateRegion* r = Q.regionsBegin; r != Q.regionsEnd && done != found.second; ++r)
+          {
+            const PackedIntervalPoint* begin = std::lower_bound(done, found.second,
+                PackedIntervalPoint(r->begin, r->seqId, side::CLOSE));
+            if (begin != found.second && begin->side() == side::CLOSE && begin > done)
+              --begin;
+            const PackedIntervalPoint* end = std::lower_bound(begin, found.second,
+                PackedIntervalPoint(r->end, r->seqId, side::CLOSE));
+            if (end != begin && (end - 1)->side() == side::OPEN)
+              ++end;
+            if (begin != end)
+            {
+              pq.push_back({begin, end, hash});
+              totalPoints += end - begin;
+              done = end;
+            }
+          }
+        }
+
+      /**
+       * @brief       narrow the interval points of each seed to the targets the query may
+       *              be mapped on, before they are merged
+       * @details     the points of a seed are sorted by target id: under lower_triangular
+       *              those from the id of the query on are cut off, and a seed whose points
+       *              all fall in the group of the query under skip_prefix is emptied, so that
+       *              these never reach the merge, and with a target prefilter the points
+       *              out of the range of the targets admitted are cut off. The admissible
+       *              bits filter the others
+       */
+      template <typename Q_Info>
+        void pruneSeedRanges(const Q_Info &Q, std::vector<Sketch::SeedRange>& seedFinds) const
+        {
+          const bool excludeGroup = param.skip_prefix && Q.refGroup >= 0;
+          for (auto& found : seedFinds)
+          {
+            if (Q.admittedBegin > 0)
+              found.first = std::lower_bound(found.first, found.second,
+                  PackedIntervalPoint(0, Q.admittedBegin, side::CLOSE));
+            if (Q.admittedEnd < std::numeric_limits<seqno_t>::max())
+              found.second = std::lower_bound(found.first, found.second,
+                  PackedIntervalPoint(0, Q.admittedEnd, side::CLOSE));
+            if (param.lower_triangular)
+              found.second = std::lower_bound(found.first, found.second,
+                  PackedIntervalPoint(0, std::max<seqno_t>(Q.seqCounter, 0), side::CLOSE));
+            if (excludeGroup && found.first != found.second
+                && found.first->seqId() >= groupBegin[Q.refGroup]
+                && (found.second - 1)->seqId() < groupBegin[Q.refGroup + 1])
+              found.second = found.first;
+          }
+        }
+
+      /**
+       * @brief       drop the most frequent seeds of a query fragment until the interval
+       *              points of the others fit in param.max_seed_points
+       * @details     the dropped seeds leave the query sketch, as the globally frequent
+       *              ones do, so that the sketch size and the minimum hits derived from
+       *              it only count the seeds that can still hit
+       * @param[in]   Q             query sequence details, with its sketch shrunk
+       * @param[in]   seedFinds     interval points of each seed of the sketch, shrunk alongside
+       */
+      template <typename Q_Info>
+        void capSeedPoints(Q_Info &Q, std::vector<Sketch::SeedRange>& seedFinds)
+        {
+          size_t totalPoints = 0;
+          for (const auto& found : seedFinds)
+            totalPoints += found.second - found.first;
+          if (totalPoints <= param.max_seed_points)
+            return;
+
+          std::vector<uint32_t> byFrequency(seedFinds.size());
+          std::iota(byFrequency.begin(), byFrequency.end(), 0);
+          std::sort(byFrequency.begin(), byFrequency.end(), [&](uint32_t a, uint32_t b) {
+            return seedFinds[a].second - seedFinds[a].first > seedFinds[b].second - seedFinds[b].first;
+          });
+          std::vector<bool> dropped(seedFinds.size(), false);
+          for (size_t i = 0; i < byFrequency.size() && totalPoints > param.max_seed_points; i++)
+          {
+            totalPoints -= seedFinds[byFrequency[i]].second - seedFinds[byFrequency[i]].first;
+            dropped[byFrequency[i]] = true;
+          }
+
+          size_t kept = 0;
+          for (size_t i = 0; i < seedFinds.size(); i++)
+          {
+            if (!dropped[i])
+            {
+              seedFinds[kept] = seedFinds[i];
+              Q.minmerTableQuery[kept] = Q.minmerTableQuery[i];
+              kept++;
+            }
+          }
+          seedFinds.resize(kept);
+          Q.minmerTableQuery.resize(kept);
+          Q.sketchSize = kept;
+        }
+
+      //Mappings merged back from disk per report call
+      static constexpr size_t reportChunkMappings = 1 << 12;
+
+      //Bases and count of queries bundled into one mapping task, a longer query goes alone
+      static constexpr offset_t queryBatchBases = 1 << 16;
+      static constexpr size_t queryBatchMaxQueries = 1024;
+
+      //Fragments of a split query, or short queries of a batch, whose seeds are looked up
+      //together, see findSeedsOfFragments
+      static constexpr int seedLookupBlockFragments = 32;
+
+      //Bases of a long query mapped per task at least, when it is split across threads
+      static constexpr offset_t longQueryTaskBases = 1 << 22;
+
+      //Seconds between checkpoints of the progress, with --map-checkpoint
+      static constexpr int checkpointSeconds = 300;
+
+      //Mappings of a group of reference sequences filtered per task at least, in filterByGroup
+      static constexpr size_t filterTaskMinMappings = 1 << 10;
+
+      //Below these, getSeedIntervalPoints merges the interval points of seeds with a heap
+      static constexpr size_t radixMergeMinPoints = 1 << 12;
+      static constexpr size_t radixMergeMinSeeds = 16;
+
+      /**
+       * @brief       merge the sorted interval points of seeds by sorting their concatenation
+       * @details     LSD radix sort of the packed points on 8-bit digits, skipping the digits
+       *              all points share, which are most of the seqId bits and of the high pos
+       *              bits. Points are kept in (seqId, pos, side) order, as the heap merge does
+       * @param[in]   seeds         interval points of each seed
+       * @param[in]   totalPoints   number of interval points of all seeds
+       * @param[in]   keepTarget    whether to keep points of a target
+       * @param[out]  intervalPoints
+       */
+      template <typename Seeds, typename KeepFn, typename Vec>
+        void radixMergeIntervalPoints(const Seeds& seeds, size_t totalPoints, const KeepFn& keepTarget, Vec& intervalPoints)
+        {
+          struct HashedPoint {
+            uint64_t bits;
+            hash_t hash;
+          };
+          thread_local std::vector<HashedPoint> points;
+          thread_local std::vector<HashedPoint> sorted;
+          points.clear();
+          points.reserve(totalPoints);
+          uint64_t allOr = 0;
+          uint64_t allAnd = ~uint64_t(0);
+          for (const auto& seed : seeds)
+          {
+            for (auto it = seed.it; it != seed.end; ++it)
+            {
+              if (keepTarget(it->seqId()))
+              {
+                points.push_back(HashedPoint{it->bits, seed.hash});
+                allOr |= it->bits;
+                allAnd &= it->bits;
+              }
+            }
+          }
+          sorted.resize(points.size());
+
+          // Digits where some points differ
+          const uint64_t varying = allOr & ~allAnd;
+          for (int shift = 0; shift < 64; shift += 8)
+          {
+            if (((varying >> shift) & 0xFF) == 0)
+              continue;
+            size_t counts[256] = {0};
+            for (const auto& p : points)
+              counts[(p.bits >> shift) & 0xFF]++;
+            size_t offset = 0;
+            for (size_t& c : counts)
+            {
+              const size_t n = c;
+              c = offset;
+              offset += n;
+            }
+            for (const auto& p : points)
+              sorted[counts[(p.bits >> shift) & 0xFF]++] = p;
+            points.swap(sorted);
+          }
+
+          intervalPoints.reserve(intervalPoints.size() + points.size());
+          for (const auto& p : points)
+          {
+            PackedIntervalPoint packed;
+            packed.bits = p.bits;
+            intervalPoints.push_back(packed.unpack(p.hash));
+          }
+        }
+
       template <typename Q_Info, typename IP_iter, typename Vec2>
         void computeL1CandidateRegions(
             Q_Info &Q, 
@@ -991,11 +2958,31 @@ namespace skch
           int clusterLen = param.segLength;
 
           // Used to keep track of how many minmer windows for a particular hash are currently "open"
-          // Only necessary when windowLen != 0.
-          std::unordered_map<hash_t, int> hash_to_freq;
+          // Only necessary when windowLen != 0. Points are first given the rank of their hash in
+          // the query sketch, so that counts are kept in a flat array instead of a hash map
+          thread_local std::vector<uint32_t> hashRanks;
+          thread_local std::vector<int> hash_to_freq;
+          if (windowLen != 0)
+          {
+            hashRanks.resize(ip_end - ip_begin);
+            for (auto it = ip_begin; it != ip_end; ++it)
+            {
+              hashRanks[it - ip_begin] = std::lower_bound(Q.minmerTableQuery.begin(), Q.minmerTableQuery.end(), it->hash,
+                  [](const MinmerInfo& mi, hash_t h) { return mi.hash < h; }) - Q.minmerTableQuery.begin();
+            }
+            hash_to_freq.assign(Q.minmerTableQuery.size(), 0);
+          }
+
+          //With index shards, the best intersection size is over the targets of all of them
+          const int group = param.skip_prefix ? this->refIdGroup[ip_begin->seqId] : 0;
+          const bool bestOfShards = param.stage1_topANI_filter && sharded != nullptr
+            && sharded->pass() == ShardedMapping::Pass::Candidates;
+          if (bestOfShards) {
+            bestIntersectionSize = sharded->best(Q.seqCounter, Q.streamOffset, group);
+          }
 
           if (param.stage1_topANI_filter) {
-            while (leadingIt != ip_end)
+            while (!bestOfShards && leadingIt != ip_end)
             {
               // Catch the trailing iterator up to the leading iterator - windowLen
               while (
@@ -1005,8 +2992,8 @@ namespace skch
               {
                 if (trailingIt->side == side::CLOSE) {
                   if (windowLen != 0)
-                    hash_to_freq[trailingIt->hash]--;
-                  if (windowLen == 0 || hash_to_freq[trailingIt->hash] == 0) {
+                    hash_to_freq[hashRanks[trailingIt - ip_begin]]--;
+                  if (windowLen == 0 || hash_to_freq[hashRanks[trailingIt - ip_begin]] == 0) {
                     overlapCount--;
                   }
                 }
@@ -1015,11 +3002,11 @@ namespace skch
               auto currentPos = leadingIt->pos;
               while (leadingIt != ip_end && leadingIt->pos == currentPos) {
                 if (leadingIt->side == side::OPEN) {
-                  if (windowLen == 0 || hash_to_freq[leadingIt->hash] == 0) {
+                  if (windowLen == 0 || hash_to_freq[hashRanks[leadingIt - ip_begin]] == 0) {
                     overlapCount++;
                   }
                   if (windowLen != 0)
-                    hash_to_freq[leadingIt->hash]++;
+                    hash_to_freq[hashRanks[leadingIt - ip_begin]]++;
                 }
                 leadingIt++;
               }
@@ -1031,6 +3018,12 @@ namespace skch
               bestIntersectionSize = std::max(bestIntersectionSize, overlapCount);
             }
 
+            if (sharded != nullptr && sharded->pass() == ShardedMapping::Pass::Bests)
+            {
+              Q.shardOutput->bests.push_back(ShardFragmentBest {Q.streamOffset, group, bestIntersectionSize});
+              return;
+            }
+
             // Only go back through to find local opts if we know that there are some that are 
             // large enough
             if (bestIntersectionSize < minimumHits) 
@@ -1049,7 +3042,7 @@ namespace skch
           
           // Clear freq dict, as there will be left open CLOSE points at the end of the last seq
           // that we never got to
-          hash_to_freq.clear();
+          std::fill(hash_to_freq.begin(), hash_to_freq.end(), 0);
 
           // Since there can be more than sketchSize windows that overlap w/ [i, i+windowLen]
           // cap the best intersection size 
@@ -1086,8 +3079,8 @@ namespace skch
             {
               if (trailingIt->side == side::CLOSE) {
                 if (windowLen != 0)
-                  hash_to_freq[trailingIt->hash]--;
-                if (windowLen == 0 || hash_to_freq[trailingIt->hash] == 0) {
+                  hash_to_freq[hashRanks[trailingIt - ip_begin]]--;
+                if (windowLen == 0 || hash_to_freq[hashRanks[trailingIt - ip_begin]] == 0) {
                   overlapCount--;
                 }
               }
@@ -1100,11 +3093,11 @@ namespace skch
             while (leadingIt != ip_end && leadingIt->pos == currentPos.pos) 
             {
               if (leadingIt->side == side::OPEN) {
-                if (windowLen == 0 || hash_to_freq[leadingIt->hash] == 0) {
+                if (windowLen == 0 || hash_to_freq[hashRanks[leadingIt - ip_begin]] == 0) {
                   overlapCount++;
                 }
                 if (windowLen != 0)
-                  hash_to_freq[leadingIt->hash]++;
+                  hash_to_freq[hashRanks[leadingIt - ip_begin]]++;
               }
               leadingIt++;
             }
@@ -1174,12 +3167,15 @@ namespace skch
        *              the following L2 stage.
        * @param[in]   Q                         query sequence details
        * @param[out]  l1Mappings                all the read mapping locations
+       * @param[in]   seedFinds                 interval points of the seeds of Q, if already sketched and looked up
        */
       template <typename Q_Info, typename IPVec, typename L1Vec>
-        void doL1Mapping(Q_Info &Q, IPVec& intervalPoints, L1Vec& l1Mappings)
+        void doL1Mapping(Q_Info &Q, IPVec& intervalPoints, L1Vec& l1Mappings,
+                         std::vector<Sketch::SeedRange>* seedFinds = nullptr)
         {
           //1. Compute the minmers
-          getSeedHits(Q);
+          if (seedFinds == nullptr)
+            getSeedHits(Q);
 
           //Catch all NNNNNN case
           if (Q.sketchSize == 0 || Q.kmerComplexity < param.kmerComplexityThreshold) {
@@ -1187,10 +3183,11 @@ namespace skch
           }
 
           //2. Compute windows and sort
-          getSeedIntervalPoints(Q, intervalPoints);
+          getSeedIntervalPoints(Q, intervalPoints, seedFinds);
 
           //3. Compute L1 windows
-          int minimumHits = Stat::estimateMinimumHitsRelaxed(Q.sketchSize, param.kmerSize, param.percentageIdentity, skch::fixed::confidence_interval);
+          const size_t l1Before = l1Mappings.size();
+          int minimumHits = minimumHitsOf(Q.sketchSize);
 
           // For each "group"
           auto ip_begin = intervalPoints.begin();
@@ -1212,11 +3209,12 @@ namespace skch
 
             ip_begin = ip_end;
           }
+          hot_counters::add(hot_counters::l1_candidates, l1Mappings.size() - l1Before);
         }
 
 
       // helper to get the prefix of a string
-      const std::string prefix(const std::string& s, const char c) {
+      std::string_view prefix(std::string_view s, const char c) const {
           //std::cerr << "prefix of " << s << " by " << c << " is " << s.substr(0, s.find_last_of(c)) << std::endl;
           return s.substr(0, s.find_last_of(c));
       }
@@ -1231,74 +3229,51 @@ namespace skch
         void doL2Mapping(Q_Info &Q, L1_Iter l1_begin, L1_Iter l1_end, VecOut &l2Mappings)
         {
           ///2. Walk the read over the candidate regions and compute the jaccard similarity with minimum s sketches
-          std::vector<L2_mapLocus_t> l2_vec;
           double bestJaccardNumerator = 0;
+          //Jaccard cutoff of the top ANI filter, for the best numerator it was computed for
+          double cutoffJaccardNumerator = -1;
+          double cutoff_j = 0;
           auto loc_iterator = l1_begin;
           while (loc_iterator != l1_end)
           {
             L1_candidateLocus_t& candidateLocus = *loc_iterator;
 
+            // L2 mappings of a candidate share at most its L1 intersection, skip those
+            // that can't pass the identity threshold. Taken best-first, the rest can't either
+            if (candidateLocus.intersectionSize < minReportedShared[std::min(Q.sketchSize, param.sketchSize)])
+            {
+              if (param.stage1_topANI_filter)
+                break;
+              loc_iterator++;
+              continue;
+            }
+
             if (param.stage1_topANI_filter)
             {
               // If using HG filter, don't consider any mappings which have no chance of being 
               // within param.ANIDiff of the best mapping seen so far
-              double cutoff_ani = std::max(0.0, double((1 - Stat::j2md(bestJaccardNumerator / Q.sketchSize, param.kmerSize)) - param.ANIDiff));
-              double cutoff_j = Stat::md2j(1 - cutoff_ani, param.kmerSize);
+              if (bestJaccardNumerator != cutoffJaccardNumerator)
+              {
+                double cutoff_ani = std::max(0.0, double(identityOf(bestJaccardNumerator, Q.sketchSize) - param.ANIDiff));
+                cutoff_j = Stat::md2j(1 - cutoff_ani, param.kmerSize);
+                cutoffJaccardNumerator = bestJaccardNumerator;
+              }
               if (double(candidateLocus.intersectionSize) / Q.sketchSize < cutoff_j) 
               {
                 break;
               }
             }
 
+            //With index shards, the candidates on the targets of the others were mapped by them
+            const size_t l2Before = l2Mappings.size();
+            if (sharded != nullptr && !inShard(candidateLocus.seqId))
+              addHeldMappings(Q, candidateLocus, l2Mappings);
+            else
+              mapL2Candidate(Q, candidateLocus, l2Mappings);
 
-            l2_vec.clear();
-            computeL2MappedRegions(Q, candidateLocus, l2_vec);
-
-            for (auto& l2 : l2_vec) 
-            {
-              //Compute mash distance using calculated jaccard
-              float mash_dist = Stat::j2md(1.0 * l2.sharedSketchSize/Q.sketchSize, param.kmerSize);
-
-              float nucIdentity = (1 - mash_dist);
-              //float nucIdentityUpperBound = getANIUBfromJaccardNum(Q.sketchSize, l2.sharedSketchSize);
-              float nucIdentityUpperBound = 1 - Stat::md_lower_bound(mash_dist, Q.sketchSize, param.kmerSize, skch::fixed::confidence_interval);
-
-              //Report the alignment if it passes our identity threshold and,
-              // if we are in all-vs-all mode, it isn't a self-mapping,
-              // and if we are self-mapping, the query is shorter than the target
-              const auto& ref = this->refSketch.metadata[l2.seqId];
-              if((param.keep_low_pct_id && nucIdentityUpperBound >= param.percentageIdentity)
-                  || nucIdentity >= param.percentageIdentity)
-              {
-                //Track the best jaccard numerator
-                bestJaccardNumerator = std::max<double>(bestJaccardNumerator, l2.sharedSketchSize);
-
-                MappingResult res;
-
-                //Save the output
-                {
-                  res.queryLen = Q.len;
-                  res.refStartPos = l2.meanOptimalPos;
-                  res.refEndPos = l2.meanOptimalPos + Q.len;
-                  res.queryStartPos = 0;
-                  res.queryEndPos = Q.len;
-                  res.refSeqId = l2.seqId;
-                  res.querySeqId = Q.seqCounter;
-                  res.nucIdentity = nucIdentity;
-                  res.nucIdentityUpperBound = nucIdentityUpperBound;
-                  res.sketchSize = Q.sketchSize;
-                  res.conservedSketches = l2.sharedSketchSize;
-                  res.blockLength = std::max(res.refEndPos - res.refStartPos, res.queryEndPos - res.queryStartPos);
-                  res.approxMatches = std::round(res.nucIdentity * res.blockLength / 100.0);
-                  res.strand = l2.strand; 
-                  res.kmerComplexity = Q.kmerComplexity;
-
-                  res.selfMapFilter = ((param.skip_self || param.skip_prefix) && Q.fullLen > ref.len);
-
-                } 
-                l2Mappings.push_back(res);
-              }
-            }
+            //Track the best jaccard numerator
+            for (size_t i = l2Before; i < l2Mappings.size(); i++)
+              bestJaccardNumerator = std::max<double>(bestJaccardNumerator, l2Mappings[i].conservedSketches);
 
             if (param.stage1_topANI_filter) 
             {
@@ -1315,6 +3290,68 @@ namespace skch
             //<< " there were " << l2Mappings.size() << " L2 mappings\n";
         }
 
+      /**
+       * @brief                                 Append the L2 mappings of an L1 candidate that
+       *                                        pass the identity threshold
+       * @param[in]   Q                         query sequence information
+       * @param[in]   candidateLocus            L1 candidate location
+       * @param[out]  l2Mappings                Mapping results in the L2 stage
+       */
+      template <typename Q_Info, typename VecOut>
+        void mapL2Candidate(Q_Info &Q, L1_candidateLocus_t& candidateLocus, VecOut &l2Mappings)
+        {
+          thread_local std::vector<L2_mapLocus_t> l2_vec;
+          l2_vec.clear();
+          computeL2MappedRegions(Q, candidateLocus, l2_vec);
+
+          for (auto& l2 : l2_vec) 
+          {
+            //Only the shared count decides whether an L2 mapping is reported, its
+            //statistics are computed for those that are. Same as passesIdentity(),
+            //which minReportedShared is built with
+            const bool reported = Q.sketchSize <= param.sketchSize
+              ? l2.sharedSketchSize >= minReportedShared[Q.sketchSize]
+              : passesIdentity(l2.sharedSketchSize, Q.sketchSize);
+
+            //Report the alignment if it passes our identity threshold and,
+            // if we are in all-vs-all mode, it isn't a self-mapping,
+            // and if we are self-mapping, the query is shorter than the target
+            if (reported)
+            {
+              //Mash distance of the calculated jaccard, and its lower bound, as identities
+              float nucIdentity = identityOf(l2.sharedSketchSize, Q.sketchSize);
+              //float nucIdentityUpperBound = getANIUBfromJaccardNum(Q.sketchSize, l2.sharedSketchSize);
+              float nucIdentityUpperBound = identityUpperBoundOf(l2.sharedSketchSize, Q.sketchSize);
+              const auto& ref = this->refSketch.metadata[l2.seqId];
+
+              MappingResult res;
+
+              //Save the output
+              {
+                res.queryLen = Q.len;
+                res.refStartPos = l2.meanOptimalPos;
+                res.refEndPos = l2.meanOptimalPos + Q.len;
+                res.queryStartPos = 0;
+                res.queryEndPos = Q.len;
+                res.refSeqId = l2.seqId;
+                res.querySeqId = Q.seqCounter;
+                res.nucIdentity = nucIdentity;
+                res.nucIdentityUpperBound = nucIdentityUpperBound;
+                res.sketchSize = Q.sketchSize;
+                res.conservedSketches = l2.sharedSketchSize;
+                res.blockLength = std::max(res.refEndPos - res.refStartPos, res.queryEndPos - res.queryStartPos);
+                res.approxMatches = std::round(res.nucIdentity * res.blockLength / 100.0);
+                res.strand = l2.strand; 
+                res.kmerComplexity = Q.kmerComplexity;
+
+                res.selfMapFilter = ((param.skip_self || param.skip_prefix) && Q.fullLen > ref.len);
+
+              } 
+              l2Mappings.push_back(res);
+            }
+          }
+        }
+
       /**
        * @brief                                 Find optimal mapping within an L1 candidate
        * @param[in]   Q                         query sequence information
@@ -1326,20 +3363,33 @@ namespace skch
             L1_candidateLocus_t &candidateLocus,
             Vec &l2_vec_out)
         {
+          refSketch.withMinmerIndex([&](const auto& minmerIndex) {
+              computeL2MappedRegions(Q, candidateLocus, l2_vec_out, minmerIndex);
+          });
+        }
+
+      /**
+       * @brief                       computeL2MappedRegions over the minmer windows of the index,
+       *                              packed or not, see Sketch::withMinmerIndex
+       */
+      template <typename Q_Info, typename Vec, typename MinmerArray>
+        void computeL2MappedRegions(Q_Info &Q,
+            L1_candidateLocus_t &candidateLocus,
+            Vec &l2_vec_out,
+            const MinmerArray &minmerIndex)
+        {
 #ifdef DEBUG
           //std::cerr << "INFO, skch::Map:computeL2MappedRegions, read id " << Q.seqName << "_" << Q.startPos << std::endl; 
 #endif
            
-          auto& minmerIndex = refSketch.minmerIndex;
-
           //candidateLocus.rangeStartPos -= param.segLength;
           //candidateLocus.rangeEndPos += param.segLength;
           
           // Get first potential mashimizer
-          const MinmerInfo first_minmer = MinmerInfo {0, candidateLocus.rangeStartPos - param.segLength - 1, 0, candidateLocus.seqId, 0};
-
-          //const MinmerInfo first_minmer = MinmerInfo {0, candidateLocus.seqId, -1, 0, 0};
-          auto firstOpenIt = std::lower_bound(minmerIndex.begin(), minmerIndex.end(), first_minmer); 
+          const seqno_t seqId = candidateLocus.seqId;
+          const size_t firstOpenIdx = refSketch.lowerBoundMinmer(minmerIndex, seqId, candidateLocus.rangeStartPos - param.segLength - 1);
+          const size_t seqEnd = refSketch.seqMinmerOffsets[seqId + 1];
+          const auto windowAt = [&](size_t idx) -> decltype(auto) { return Sketch::minmerOf(minmerIndex[idx], seqId); };
 
           // Keeps track of the lowest end position
           std::vector<skch::MinmerInfo> slidingWindow;
@@ -1348,8 +3398,8 @@ namespace skch
           // Used to make a min-heap
           constexpr auto heap_cmp = [](const skch::MinmerInfo& l, const skch::MinmerInfo& r) {return l.wpos_end > r.wpos_end;};
 
-          // windowIt keeps track of the end of window
-          auto windowIt = firstOpenIt;
+          // windowIdx keeps track of the end of window
+          size_t windowIdx = firstOpenIdx;
 
           // Keep track of all minmer windows that intersect with [i, i+windowLen]
           int windowLen = std::max<offset_t>(0, Q.len - param.segLength);
@@ -1369,28 +3419,33 @@ namespace skch
           L2_mapLocus_t l2_out = {};
 
           // Set up the window
-          while (windowIt != minmerIndex.end() && windowIt->seqId == candidateLocus.seqId && windowIt->wpos < candidateLocus.rangeStartPos) 
+          for (; windowIdx < seqEnd; windowIdx++)
           {
-            if (windowIt->wpos_end > candidateLocus.rangeStartPos) 
+            const MinmerInfo& window = windowAt(windowIdx);
+            if (window.wpos >= candidateLocus.rangeStartPos)
+              break;
+            if (window.wpos_end > candidateLocus.rangeStartPos) 
             {
               if (windowLen > 0) 
               {
-                hash_to_freq[windowIt->hash]++;
+                hash_to_freq[window.hash]++;
               }
-              if (windowLen == 0 || hash_to_freq[windowIt->hash] == 1) {
-                slidingWindow.push_back(*windowIt);
+              if (windowLen == 0 || hash_to_freq[window.hash] == 1) {
+                slidingWindow.push_back(window);
                 std::push_heap(slidingWindow.begin(), slidingWindow.end(), heap_cmp);
-                slideMap.insert_minmer(*windowIt);
+                slideMap.insert_minmer(window);
               }
             }
-            windowIt++;
           }
 
-          while (windowIt != minmerIndex.end() && windowIt->seqId == candidateLocus.seqId && windowIt->wpos <= candidateLocus.rangeEndPos + windowLen) 
+          while (windowIdx < seqEnd) 
           {
+            const MinmerInfo& window = windowAt(windowIdx);
+            if (window.wpos > candidateLocus.rangeEndPos + windowLen)
+              break;
             int prev_strand_votes = slideMap.strand_votes;
             bool inserted = false;
-            while (!slidingWindow.empty() && slidingWindow.front().wpos_end <= windowIt->wpos - windowLen) {
+            while (!slidingWindow.empty() && slidingWindow.front().wpos_end <= window.wpos - windowLen) {
 
               // Remove minmer from end-ordered heap
               if (windowLen > 0) 
@@ -1408,14 +3463,14 @@ namespace skch
             inserted = true;
             if (windowLen > 0) 
             {
-              hash_to_freq[windowIt->hash]++;
+              hash_to_freq[window.hash]++;
             }
-            if (windowLen == 0 || hash_to_freq[windowIt->hash] == 1) {
-              slideMap.insert_minmer(*windowIt);
-              slidingWindow.push_back(*windowIt);
+            if (windowLen == 0 || hash_to_freq[window.hash] == 1) {
+              slideMap.insert_minmer(window);
+              slidingWindow.push_back(window);
               std::push_heap(slidingWindow.begin(), slidingWindow.end(), heap_cmp);
             } else {
-              windowIt++;
+              windowIdx++;
               continue;
             }
 
@@ -1432,8 +3487,8 @@ namespace skch
               l2_out.sharedSketchSize = slideMap.sharedSketchElements;
 
               //Save the position
-              l2_out.optimalStart = windowIt->wpos - windowLen;
-              l2_out.optimalEnd = windowIt->wpos - windowLen;
+              l2_out.optimalStart = window.wpos - windowLen;
+              l2_out.optimalEnd = window.wpos - windowLen;
             }
             else if(slideMap.sharedSketchElements == bestSketchSize)
             {
@@ -1441,17 +3496,17 @@ namespace skch
                 l2_out.sharedSketchSize = slideMap.sharedSketchElements;
 
                 //Save the position
-                l2_out.optimalStart = windowIt->wpos - windowLen;
+                l2_out.optimalStart = window.wpos - windowLen;
               }
 
               in_candidate = true;
               //Still save the position
-              l2_out.optimalEnd = windowIt->wpos - windowLen;
+              l2_out.optimalEnd = window.wpos - windowLen;
             } else {
               if (in_candidate) {
                 // Save and reset
                 l2_out.meanOptimalPos =  (l2_out.optimalStart + l2_out.optimalEnd) / 2;
-                l2_out.seqId = windowIt->seqId;
+                l2_out.seqId = seqId;
                 l2_out.strand = prev_strand_votes >= 0 ? strnd::FWD : strnd::REV;
                 if (l2_vec_out.empty() 
                     || l2_vec_out.back().optimalEnd + param.segLength < l2_out.optimalStart)
@@ -1468,13 +3523,14 @@ namespace skch
               in_candidate = false;
             }
             if (inserted) {
-              windowIt++;
+              windowIdx++;
             }
           }
+          hot_counters::add(hot_counters::l2_windows_scanned, windowIdx - firstOpenIdx);
           if (in_candidate) {
             // Save and reset
             l2_out.meanOptimalPos =  (l2_out.optimalStart + l2_out.optimalEnd) / 2;
-            l2_out.seqId = std::prev(windowIt)->seqId;
+            l2_out.seqId = seqId;
             l2_out.strand = slideMap.strand_votes >= 0 ? strnd::FWD : strnd::REV;
             if (l2_vec_out.empty() 
                 || l2_vec_out.back().optimalEnd + param.segLength < l2_out.optimalStart)
@@ -1528,15 +3584,15 @@ namespace skch
 
           fragment.n_merged = std::distance(start, end);
 
-          // Calculate mean nucleotide identity
-          fragment.nucIdentity = std::accumulate(start, end, 0.0,
-                                                 [](double sum, const MappingResult& e) { return sum + e.nucIdentity; }
-              ) / fragment.n_merged;
-
-          // Calculate mean kmer complexity
-          fragment.kmerComplexity = std::accumulate(start, end, 0.0,
-                                                    [](double sum, const MappingResult& e) { return sum + e.kmerComplexity; }
-              ) / fragment.n_merged;
+          // Calculate mean nucleotide identity and kmer complexity, in one pass
+          double sumNucIdentity = 0.0;
+          double sumKmerComplexity = 0.0;
+          for (auto it = start; it != end; ++it) {
+              sumNucIdentity += it->nucIdentity;
+              sumKmerComplexity += it->kmerComplexity;
+          }
+          fragment.nucIdentity = sumNucIdentity / fragment.n_merged;
+          fragment.kmerComplexity = sumKmerComplexity / fragment.n_merged;
 
           // Mark other mappings in this fragment for discard
           std::for_each(std::next(start), end, [](MappingResult& e) { e.discard = 1; });
@@ -1586,6 +3642,190 @@ namespace skch
           }
       }
 
+      //Mappings of a (refSeqId, strand) partition to chain as a task of its own, at least
+      static constexpr size_t chainTaskMinMappings = 1 << 12;
+
+      /**
+       * @brief                       link each mapping of a partition to its closest successor
+       * @param[in]     readMappings  mappings sorted by reference (then query) position
+       * @param[in]     order         indices of the partition in readMappings, in sorted order
+       * @param[in]     max_dist      Distance to look in target and query
+       * @param[in/out] disjoint_sets union find over readMappings, by splitMappingId
+       */
+      template <typename VecIn>
+      void chainPartition(const VecIn &readMappings, const size_t* order, size_t count,
+                          int max_dist, dsets::DisjointSets& disjoint_sets) {
+          for (size_t a = 0; a < count; a++) {
+              const MappingResult& m = readMappings[order[a]];
+              //Closest successor by weighted distance, then distance, then id
+              std::tuple<double, double, int64_t> best;
+              bool found = false;
+              for (size_t b = a + 1; b < count; b++) {
+                  const MappingResult& m2 = readMappings[order[b]];
+                  //If this mapping is for the same segment, ignore
+                  if (m2.queryStartPos == m.queryStartPos) {
+                      continue;
+                  }
+                  //If this mapping is too far from current mapping being evaluated, stop finding a merge
+                  if (m2.refStartPos > m.refEndPos + max_dist) {
+                      break;
+                  }
+                  int64_t ref_dist = m2.refStartPos - m.refEndPos;
+                  int64_t query_dist = std::numeric_limits<int64_t>::max();
+                  auto dist = std::numeric_limits<double>::max();
+                  auto awed = std::numeric_limits<double>::max();
+                  if (m.strand == strnd::FWD && m.queryStartPos <= m2.queryStartPos) {
+                      query_dist = m2.queryStartPos - m.queryEndPos;
+                      dist = std::sqrt(std::pow(query_dist,2) + std::pow(ref_dist,2));
+                      awed = axis_weighted_euclidean_distance(query_dist, ref_dist, 0.9);
+                  } else if (m.strand != strnd::FWD && m.queryEndPos >= m2.queryEndPos) {
+                      query_dist = m.queryStartPos - m2.queryEndPos;
+                      dist = std::sqrt(std::pow(query_dist,2) + std::pow(ref_dist,2));
+                      awed = axis_weighted_euclidean_distance(query_dist, ref_dist, 0.9);
+                  }
+                  if (dist < max_dist) {
+                      const auto candidate = std::make_tuple(awed, dist, (int64_t)m2.splitMappingId);
+                      if (!found || candidate < best) {
+                          best = candidate;
+                          found = true;
+                      }
+                  }
+              }
+              if (found) {
+                  disjoint_sets.unite(m.splitMappingId, std::get<2>(best));
+              }
+          }
+      }
+
+      /**
+       * @brief                       link each mapping of a partition to its best co-linear predecessor,
+       *                              by sparse dynamic programming in O(n log n)
+       * @details                     the score of a mapping is its query length plus the best score of a
+       *                              predecessor, less the gaps between them in query and target. The
+       *                              predecessors lie within max_dist in the target, kept in a range-max
+       *                              tree over their query coordinate, which gives the best of those within
+       *                              max_dist in the query, in the order of the strand. Chains are traced
+       *                              back from the best scores, each a co-linear path of the partition
+       * @param[in]     readMappings  mappings sorted by reference (then query) position
+       * @param[in]     order         indices of the partition in readMappings, in sorted order
+       * @param[in]     max_dist      Distance to look in target and query
+       * @param[in/out] disjoint_sets union find over readMappings, by splitMappingId
+       */
+      template <typename VecIn>
+      void chainPartitionSparse(const VecIn &readMappings, const size_t* order, size_t count,
+                                int max_dist, dsets::DisjointSets& disjoint_sets) {
+          const bool forward = readMappings[order[0]].strand == strnd::FWD;
+          //Predecessors are found by their query end on the forward strand, by their query start on the reverse
+          const auto queryKey = [&](size_t a) -> int64_t {
+              const MappingResult& m = readMappings[order[a]];
+              return forward ? m.queryEndPos : m.queryStartPos;
+          };
+
+          //Leaves of the range-max tree, in the order of the query key
+          //Scratch kept by the thread, a chaining task never waiting on another
+          thread_local std::vector<size_t> byKey, leafOf, byRefEnd, byScore;
+          thread_local std::vector<int64_t> keys, predecessor;
+          thread_local std::vector<double> score;
+          thread_local std::vector<bool> taken;
+          byKey.resize(count);
+          std::iota(byKey.begin(), byKey.end(), 0);
+          std::sort(byKey.begin(), byKey.end(), [&](size_t a, size_t b) {
+              return std::make_pair(queryKey(a), a) < std::make_pair(queryKey(b), b);
+          });
+          keys.resize(count);
+          leafOf.resize(count);
+          for (size_t i = 0; i < count; i++) {
+              keys[i] = queryKey(byKey[i]);
+              leafOf[byKey[i]] = i;
+          }
+
+          //Best (score, -position) of the predecessors in each node, the position breaking ties towards the earliest
+          using Best = std::pair<double, int64_t>;
+          const Best none(-std::numeric_limits<double>::infinity(), 0);
+          size_t leaves = 1;
+          while (leaves < count) {
+              leaves <<= 1;
+          }
+          thread_local std::vector<Best> tree;
+          tree.assign(2 * leaves, none);
+          const auto update = [&](size_t leaf, const Best& value) {
+              size_t node = leaf + leaves;
+              tree[node] = value;
+              for (node >>= 1; node > 0; node >>= 1) {
+                  tree[node] = std::max(tree[2 * node], tree[2 * node + 1]);
+              }
+          };
+          const auto rangeMax = [&](size_t lo, size_t hi) {
+              Best best = none;
+              for (lo += leaves, hi += leaves; lo < hi; lo >>= 1, hi >>= 1) {
+                  if (lo & 1) {
+                      best = std::max(best, tree[lo++]);
+                  }
+                  if (hi & 1) {
+                      best = std::max(best, tree[--hi]);
+                  }
+              }
+              return best;
+          };
+
+          //Predecessors leave the tree once they end more than max_dist before the mapping in the target
+          byRefEnd.resize(count);
+          std::iota(byRefEnd.begin(), byRefEnd.end(), 0);
+          std::sort(byRefEnd.begin(), byRefEnd.end(), [&](size_t a, size_t b) {
+              return readMappings[order[a]].refEndPos < readMappings[order[b]].refEndPos;
+          });
+          size_t expired = 0;
+
+          score.resize(count);
+          predecessor.assign(count, -1);
+          for (size_t a = 0; a < count; a++) {
+              const MappingResult& m = readMappings[order[a]];
+              while (expired < count && readMappings[order[byRefEnd[expired]]].refEndPos <= m.refStartPos - max_dist) {
+                  if (byRefEnd[expired] < a) {
+                      update(leafOf[byRefEnd[expired]], none);
+                  }
+                  expired++;
+              }
+
+              //Query keys of the co-linear predecessors within max_dist, as [lo, hi)
+              const int64_t lo = forward ? (int64_t)m.queryStartPos - max_dist + 1 : (int64_t)m.queryStartPos + 1;
+              const int64_t hi = forward ? (int64_t)m.queryEndPos : (int64_t)m.queryEndPos + max_dist;
+              const Best best = rangeMax(std::lower_bound(keys.begin(), keys.end(), lo) - keys.begin(),
+                                         std::lower_bound(keys.begin(), keys.end(), hi) - keys.begin());
+
+              //Gaps are charged through the coordinates of the two mappings, so that the tree holds
+              //scores independent of the mapping looking them up
+              const double gapBase = forward ? (double)m.refStartPos + m.queryStartPos
+                                             : (double)m.refStartPos - m.queryEndPos;
+              const double length = m.queryEndPos - m.queryStartPos;
+              score[a] = length;
+              if (best.first != none.first && best.first - gapBase > 0) {
+                  score[a] += best.first - gapBase;
+                  predecessor[a] = -best.second;
+              }
+              const double carried = forward ? (double)m.refEndPos + m.queryEndPos
+                                             : (double)m.refEndPos - m.queryStartPos;
+              update(leafOf[a], Best(score[a] + carried, -(int64_t)a));
+          }
+
+          //Chains are traced back from the best scoring mappings, each up to a mapping taken by a better one
+          byScore.resize(count);
+          std::iota(byScore.begin(), byScore.end(), 0);
+          std::sort(byScore.begin(), byScore.end(), [&](size_t a, size_t b) {
+              return std::make_pair(-score[a], a) < std::make_pair(-score[b], b);
+          });
+          taken.assign(count, false);
+          for (size_t end : byScore) {
+              for (int64_t a = end; a >= 0 && !taken[a]; a = predecessor[a]) {
+                  taken[a] = true;
+                  if (predecessor[a] >= 0 && !taken[predecessor[a]]) {
+                      disjoint_sets.unite(readMappings[order[a]].splitMappingId,
+                                          readMappings[order[predecessor[a]]].splitMappingId);
+                  }
+              }
+          }
+      }
+
       double axis_weighted_euclidean_distance(int64_t dx, int64_t dy, double w = 0.5) {
           double euclidean = std::sqrt(dx*dx + dy*dy);
           double axis_factor = 1.0 - (2.0 * std::min(std::abs(dx), std::abs(dy))) / (std::abs(dx) + std::abs(dy));
@@ -1605,12 +3845,9 @@ namespace skch
           if(readMappings.size() < 2) return;
 
           //Sort the mappings by reference (then query) position
-          std::sort(
-              readMappings.begin(), readMappings.end(),
-              [](const MappingResult &a, const MappingResult &b) {
-                  return std::tie(a.refSeqId, a.refStartPos, a.queryStartPos)
-                      < std::tie(b.refSeqId, b.refStartPos, b.queryStartPos);
-              });
+          sortByKey(readMappings, [](const MappingResult &e) {
+              return std::make_tuple(e.refSeqId, e.refStartPos, e.queryStartPos);
+          });
 
           //First assign a unique id to each split mapping in the sorted order
           for (auto it = readMappings.begin(); it != readMappings.end(); it++) {
@@ -1618,47 +3855,69 @@ namespace skch
               it->discard = 0;
           }
 
+          std::unique_ptr<MergeWorkspace> workspace;
+          {
+              std::lock_guard<std::mutex> lock(mergeWorkspacesMutex);
+              if (mergeWorkspaces.empty()) {
+                  workspace.reset(new MergeWorkspace());
+              } else {
+                  workspace = std::move(mergeWorkspaces.back());
+                  mergeWorkspaces.pop_back();
+              }
+          }
+
           // set up our union find data structure to track merges
-          std::vector<dsets::DisjointSets::Aint> ufv(readMappings.size());
+          std::vector<dsets::DisjointSets::Aint>& ufv = workspace->ufv;
+          ufv.resize(readMappings.size());
           // this initializes everything
           auto disjoint_sets = dsets::DisjointSets(ufv.data(), ufv.size());
 
-          //Start the procedure to identify the chains
-          for (auto it = readMappings.begin(); it != readMappings.end(); it++) {
-              std::vector<std::tuple<double, double, int64_t>> distances;
-              for (auto it2 = std::next(it); it2 != readMappings.end(); it2++) {
-                  //If this mapping is for the same segment, ignore
-                  if (it2->refSeqId == it->refSeqId && it2->queryStartPos == it->queryStartPos) {
-                      continue;
+          //Mappings only chain with mappings of the same target and strand, so each
+          //(refSeqId, strand) partition is chained on its own, the large ones in parallel.
+          //Partitions hold disjoint sets of the union find, which no lock needs to guard
+          std::vector<size_t>& partitionOrder = workspace->partitionOrder;
+          partitionOrder.clear();
+          partitionOrder.reserve(readMappings.size());
+          std::vector<std::pair<size_t, size_t>>& partitions = workspace->partitions;
+          partitions.clear();
+          for (size_t begin = 0; begin < readMappings.size();) {
+              size_t end = begin;
+              while (end < readMappings.size() && readMappings[end].refSeqId == readMappings[begin].refSeqId) {
+                  end++;
+              }
+              for (bool forward : {true, false}) {
+                  const size_t first = partitionOrder.size();
+                  for (size_t i = begin; i < end; i++) {
+                      if ((readMappings[i].strand == strnd::FWD) == forward) {
+                          partitionOrder.push_back(i);
+                      }
                   }
-                  //If this mapping is too far from current mapping being evaluated, stop finding a merge
-                  if (it2->refSeqId != it->refSeqId || it2->refStartPos > it->refEndPos + max_dist) {
-                      break;
+                  if (partitionOrder.size() - first > 1) {
+                      partitions.emplace_back(first, partitionOrder.size());
                   }
-                  //If the next mapping is within range, check if it's in range and
-                  if (it2->strand == it->strand) {
-                      int64_t ref_dist = it2->refStartPos - it->refEndPos;
-                      int64_t query_dist = std::numeric_limits<int64_t>::max();
-                      auto dist = std::numeric_limits<double>::max();
-                      auto awed = std::numeric_limits<double>::max();
-                      if (it->strand == strnd::FWD && it->queryStartPos <= it2->queryStartPos) {
-                          query_dist = it2->queryStartPos - it->queryEndPos;
-                          dist = std::sqrt(std::pow(query_dist,2) + std::pow(ref_dist,2));
-                          awed = axis_weighted_euclidean_distance(query_dist, ref_dist, 0.9);
-                      } else if (it->strand != strnd::FWD && it->queryEndPos >= it2->queryEndPos) {
-                          query_dist = it->queryStartPos - it2->queryEndPos;
-                          dist = std::sqrt(std::pow(query_dist,2) + std::pow(ref_dist,2));
-                          awed = axis_weighted_euclidean_distance(query_dist, ref_dist, 0.9);
-                      }
-                      if (dist < max_dist) {
-                          distances.push_back(std::make_tuple(awed, dist, it2->splitMappingId));
+              }
+              begin = end;
+          }
+
+          {
+              tasks::TaskGroup chainTasks(tasks::sharedExecutor(param.threads));
+              for (const auto& partition : partitions) {
+                  const auto chain = [&, partition]() {
+                      if (param.sparse_chaining) {
+                          chainPartitionSparse(readMappings, &partitionOrder[partition.first], partition.second - partition.first,
+                              max_dist, disjoint_sets);
+                      } else {
+                          chainPartition(readMappings, &partitionOrder[partition.first], partition.second - partition.first,
+                              max_dist, disjoint_sets);
                       }
+                  };
+                  if (partitions.size() > 1 && partition.second - partition.first >= chainTaskMinMappings) {
+                      chainTasks.run(chain);
+                  } else {
+                      chain();
                   }
               }
-              if (distances.size()) {
-                  std::sort(distances.begin(), distances.end());
-                  disjoint_sets.unite(it->splitMappingId, std::get<2>(distances.front()));
-              }
+              chainTasks.wait();
           }
 
           //Assign the merged mapping ids
@@ -1667,25 +3926,15 @@ namespace skch
           }
 
           //Sort the mappings by post-merge split mapping id, then by query position, then by target position
-          std::sort(
-              readMappings.begin(),
-              readMappings.end(),
-              [](const MappingResult &a, const MappingResult &b) {
-                  return a.splitMappingId < b.splitMappingId
-                      || (a.splitMappingId == b.splitMappingId
-                          && (a.queryStartPos < b.queryStartPos
-                              || (a.queryStartPos == b.queryStartPos
-                                  && a.refStartPos < b.refStartPos)));
-              });
+          sortByKey(readMappings, [](const MappingResult &e) {
+              return std::make_tuple(e.splitMappingId, e.queryStartPos, e.refStartPos);
+          });
 
           for(auto it = readMappings.begin(); it != readMappings.end();) {
               //Bucket by each chain
               auto it_end = std::find_if(it, readMappings.end(), [&](const MappingResult &e){return e.splitMappingId != it->splitMappingId;} );
 
-              // Sort the chain by query, then reference, start position
-              std::sort(it, it_end, [](const MappingResult &a, const MappingResult &b) {
-                  return std::tie(a.queryStartPos, a.refStartPos) < std::tie(b.queryStartPos, b.refStartPos);
-              });
+              // The chain is sorted by query, then reference, start position by the sort above
 
               // if we have an infinite max mappinng length, we should just emit the chain here
               if (param.max_mapping_length == std::numeric_limits<int64_t>::max()) {
@@ -1702,7 +3951,8 @@ namespace skch
 
               // First pass: Mark cuttable positions
               const int consecutive_mappings_window = 4; // Configurable parameter
-              std::vector<bool> is_cuttable(std::distance(it, it_end), false);
+              std::vector<bool>& is_cuttable = workspace->isCuttable;
+              is_cuttable.assign(std::distance(it, it_end), false);
     
               auto window_start = it;
               int consecutive_count = 0;
@@ -1784,6 +4034,11 @@ namespace skch
               it = it_end;
           }
 
+          {
+              std::lock_guard<std::mutex> lock(mergeWorkspacesMutex);
+              mergeWorkspaces.push_back(std::move(workspace));
+          }
+
           // After processing all chains, remove discarded mappings
           readMappings.erase(
               std::remove_if(readMappings.begin(), readMappings.end(), 
@@ -1795,106 +4050,158 @@ namespace skch
      /**
        * @brief                       This routine is to make sure that all mapping boundaries
        *                              on query and reference are not outside total
-       *                              length of sequeunces involved
-       * @param[in]     input         input read details
-       * @param[in/out] readMappings  Mappings computed by Mashmap (L2 stage) for a read
+       *                              length of sequeunces involved, a stage of runMappingStages
+       * @param[in]     queryLen      length of the query
+       * @param[in/out] e             Mapping computed by Mashmap (L2 stage) for the query
        */
-      template <typename VecIn>
-        void mappingBoundarySanityCheck(InputSeqProgContainer* input, VecIn &readMappings)
+      bool clampMappingBoundaries(offset_t queryLen, MappingResult &e) const
+      {
+        //reference start pos
         {
-          for(auto &e : readMappings)
-          {
-            //reference start pos
-            {
-              if(e.refStartPos < 0)
-                e.refStartPos = 0;
-              if(e.refStartPos >= this->refSketch.metadata[e.refSeqId].len)
-                e.refStartPos = this->refSketch.metadata[e.refSeqId].len - 1;
-            }
+          if(e.refStartPos < 0)
+            e.refStartPos = 0;
+          if(e.refStartPos >= this->refSketch.metadata[e.refSeqId].len)
+            e.refStartPos = this->refSketch.metadata[e.refSeqId].len - 1;
+        }
 
-            //reference end pos
-            {
-              if(e.refEndPos < e.refStartPos)
-                e.refEndPos = e.refStartPos;
-              if(e.refEndPos >= this->refSketch.metadata[e.refSeqId].len)
-                e.refEndPos = this->refSketch.metadata[e.refSeqId].len - 1;
-            }
+        //reference end pos
+        {
+          if(e.refEndPos < e.refStartPos)
+            e.refEndPos = e.refStartPos;
+          if(e.refEndPos >= this->refSketch.metadata[e.refSeqId].len)
+            e.refEndPos = this->refSketch.metadata[e.refSeqId].len - 1;
+        }
 
-            //query start pos
-            {
-              if(e.queryStartPos < 0)
-                e.queryStartPos = 0;
-              if(e.queryStartPos >= input->len)
-                e.queryStartPos = input->len;
-            }
+        //query start pos
+        {
+          if(e.queryStartPos < 0)
+            e.queryStartPos = 0;
+          if(e.queryStartPos >= queryLen)
+            e.queryStartPos = queryLen;
+        }
 
-            //query end pos
-            {
-              if(e.queryEndPos < e.queryStartPos)
-                e.queryEndPos = e.queryStartPos;
-              if(e.queryEndPos >= input->len)
-                e.queryEndPos = input->len;
-            }
-          }
+        //query end pos
+        {
+          if(e.queryEndPos < e.queryStartPos)
+            e.queryEndPos = e.queryStartPos;
+          if(e.queryEndPos >= queryLen)
+            e.queryEndPos = queryLen;
         }
+        return true;
+      }
 
       /**
        * @brief                         Report the final read mappings to output stream
        * @param[in]   readMappings      mapping results for single or multiple reads
        * @param[in]   queryName         input required if reporting one read at a time
        * @param[in]   outstrm           file output stream object
+       * @param[in]   anchored          output of readMappings with their seed anchors, if found
        */
       void reportReadMappings(MappingResultsVector_t &readMappings, const std::string &queryName,
-          std::ofstream &outstrm)
-      {
-        //Print the results
-        for(auto &e : readMappings)
-        {
-          assert(e.refSeqId < this->refSketch.metadata.size());
-
-          float fakeMapQ = e.nucIdentity == 1 ? 255 : std::round(-10.0 * std::log10(1-(e.nucIdentity)));
-          std::string sep = param.legacy_output ? " " : "\t";
-
-          outstrm  << (param.filterMode == filter::ONETOONE ? qmetadata[e.querySeqId].name : queryName)
-                   << sep << e.queryLen
-                   << sep << e.queryStartPos
-                   << sep << e.queryEndPos - (param.legacy_output ? 1 : 0)
-                   << sep << (e.strand == strnd::FWD ? "+" : "-")
-                   << sep << this->refSketch.metadata[e.refSeqId].name
-                   << sep << this->refSketch.metadata[e.refSeqId].len
-                   << sep << e.refStartPos
-                   << sep << e.refEndPos - (param.legacy_output ? 1 : 0);
-
-          if (!param.legacy_output) 
-          {
-            outstrm  << sep << e.conservedSketches
-                     << sep << e.blockLength
-                     << sep << fakeMapQ
-                     << sep << "id:f:" << e.nucIdentity
-                     << sep << "kc:f:" << e.kmerComplexity;
-            if (!param.mergeMappings) 
-            {
-              outstrm << sep << "jc:f:" << float(e.conservedSketches) / e.sketchSize;
-            } else {
-              outstrm << sep << "chain:i:" << e.splitMappingId;
-            }
-          } else
+          output::Writer &outstrm, const MapModuleOutput* anchored = nullptr)
+      {
+        if (binaryWriter != nullptr)
+        {
+          const bool anchors = anchored != nullptr && anchored->anchorEnds.size() == readMappings.size();
+          for (size_t i = 0; i < readMappings.size(); i++)
           {
-            outstrm << sep << e.nucIdentity * 100.0;
+            const MappingResult &e = readMappings[i];
+            assert(e.refSeqId < this->refSketch.metadata.size());
+            const uint64_t anchorsBegin = anchors && i > 0 ? anchored->anchorEnds[i - 1] : 0;
+            binaryWriter->write(e, collectAllMappings() ? qmetadata[e.querySeqId].name : queryName,
+                this->refSketch.metadata[e.refSeqId].name, this->refSketch.metadata[e.refSeqId].len,
+                anchors ? anchored->anchors.data() + anchorsBegin : nullptr,
+                anchors ? anchored->anchorEnds[i] - anchorsBegin : 0);
           }
-
+        }
+        else
+        {
+          for(auto &e : readMappings)
+          {
+            formatReadMapping(e, collectAllMappings() ? qmetadata[e.querySeqId].name : queryName, outstrm);
 #ifdef DEBUG
-          outstrm << std::endl;
-#else
-          outstrm << "\n";
+            outstrm.flush();
 #endif
+          }
+        }
+        countReportedMappings(readMappings);
+      }
+
+      /**
+       * @brief     whether the workers format the records of their queries, leaving the
+       *            output thread only to write them: unless the mappings are collected for
+       *            filtering at the end, held for the last index shard, or written in binary
+       */
+      bool formatsRecordsInWorkers() const
+      {
+        return !collectAllMappings() && !holdsForLastShard() && binaryWriter == nullptr;
+      }
+
+      /**
+       * @brief                 format the final mappings of a query into its records, in the worker
+       */
+      void formatReadMappings(MapModuleOutput &output) const
+      {
+        output::Writer records;
+        for(auto &e : output.readMappings)
+          formatReadMapping(e, output.qseqName, records);
+        output.records = records.take();
+      }
 
-          //User defined processing of the results
-          if(processMappingResults != nullptr)
+      /**
+       * @brief                 count the mappings reported and run the user defined processing on them
+       */
+      void countReportedMappings(MappingResultsVector_t &readMappings)
+      {
+        hot_counters::add(hot_counters::mappings_reported, readMappings.size());
+        if(processMappingResults != nullptr)
+        {
+          for(auto &e : readMappings)
             processMappingResults(e);
         }
       }
 
+      /**
+       * @brief                 format a mapping as a PAF line
+       */
+      void formatReadMapping(const MappingResult &e, std::string_view queryName, output::Writer &outstrm) const
+      {
+        assert(e.refSeqId < this->refSketch.metadata.size());
+
+        float fakeMapQ = e.nucIdentity == 1 ? 255 : std::round(-10.0 * std::log10(1-(e.nucIdentity)));
+        const char* sep = param.legacy_output ? " " : "\t";
+
+        outstrm  << queryName
+                 << sep << e.queryLen
+                 << sep << e.queryStartPos
+                 << sep << e.queryEndPos - (param.legacy_output ? 1 : 0)
+                 << sep << (e.strand == strnd::FWD ? "+" : "-")
+                 << sep << this->refSketch.metadata[e.refSeqId].name
+                 << sep << this->refSketch.metadata[e.refSeqId].len
+                 << sep << e.refStartPos
+                 << sep << e.refEndPos - (param.legacy_output ? 1 : 0);
+
+        if (!param.legacy_output) 
+        {
+          outstrm  << sep << e.conservedSketches
+                   << sep << e.blockLength
+                   << sep << fakeMapQ
+                   << sep << "id:f:" << e.nucIdentity
+                   << sep << "kc:f:" << e.kmerComplexity;
+          if (!param.mergeMappings) 
+          {
+            outstrm << sep << "jc:f:" << float(e.conservedSketches) / e.sketchSize;
+          } else {
+            outstrm << sep << "chain:i:" << e.splitMappingId;
+          }
+        } else
+        {
+          outstrm << sep << e.nucIdentity * 100.0;
+        }
+
+        outstrm << '\n';
+      }
+
     public:
 
       /**
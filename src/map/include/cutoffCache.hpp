@@ -0,0 +1,151 @@
+/**
+ * @file    cutoffCache.hpp
+ * @brief   on-disk cache of the stage 1 hypergeometric cutoff tables
+ */
+
+#ifndef CUTOFF_CACHE_HPP
+#define CUTOFF_CACHE_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+namespace skch
+{
+  /**
+   * @brief     sketch cutoff tables of previous runs, one small text file per parameter set
+   * @details   tables are kept in memory for the Map objects of the same run, and on disk
+   *            only in a directory given with --hg-cache-dir; failing to read or write a
+   *            cache file only means computing the table again
+   */
+  class CutoffCache
+  {
+    private:
+
+      //Bump when the way tables are computed changes
+      static constexpr int formatVersion = 1;
+
+      static std::mutex& memoMutex()
+      {
+        static std::mutex m;
+        return m;
+      }
+
+      static std::unordered_map<std::string, std::vector<int>>& memo()
+      {
+        static std::unordered_map<std::string, std::vector<int>> m;
+        return m;
+      }
+
+      template <typename T>
+        static std::string bitsOf(T value)
+        {
+          uint64_t bits = 0;
+          std::memcpy(&bits, &value, sizeof(T));
+          std::ostringstream ss;
+          ss << std::hex << bits;
+          return ss.str();
+        }
+
+      static std::string fileOf(const std::string& dir, const std::string& key)
+      {
+        return (std::filesystem::path(dir) / ("sketch-cutoffs-" + key + ".txt")).string();
+      }
+
+    public:
+
+      /**
+       * @brief               key of a table, from all the parameters it is computed from
+       * @details             floats are keyed by their bits, so that only identical values match
+       */
+      static std::string key(int sketchSize, int kmerSize, float ANIDiff, float ANIDiffConf)
+      {
+        return "v" + std::to_string(formatVersion)
+          + "-s" + std::to_string(sketchSize)
+          + "-k" + std::to_string(kmerSize)
+          + "-d" + bitsOf(ANIDiff)
+          + "-c" + bitsOf(ANIDiffConf);
+      }
+
+      /**
+       * @brief               fill table with the cached one of key, if any of the expected size
+       */
+      static bool load(const std::string& dir, const std::string& key, std::vector<int>& table)
+      {
+        {
+          std::lock_guard<std::mutex> lock(memoMutex());
+          auto found = memo().find(key);
+          if (found != memo().end() && found->second.size() == table.size())
+          {
+            table = found->second;
+            return true;
+          }
+        }
+        if (dir.empty())
+          return false;
+
+        std::ifstream in(fileOf(dir, key));
+        std::string storedKey;
+        size_t n = 0;
+        if (!(in >> storedKey >> n) || storedKey != key || n != table.size())
+          return false;
+
+        std::vector<int> stored(n);
+        for (auto& c : stored)
+          if (!(in >> c))
+            return false;
+
+        table = stored;
+        std::lock_guard<std::mutex> lock(memoMutex());
+        memo()[key] = stored;
+        return true;
+      }
+
+      /**
+       * @brief               save table under key
+       * @details             written to a temporary file renamed into place, so that
+       *                      concurrent jobs never read a partial table
+       */
+      static void store(const std::string& dir, const std::string& key, const std::vector<int>& table)
+      {
+        {
+          std::lock_guard<std::mutex> lock(memoMutex());
+          memo()[key] = table;
+        }
+        if (dir.empty())
+          return;
+
+        std::error_code ec;
+        std::filesystem::create_directories(dir, ec);
+        if (ec)
+          return;
+
+        const std::string fileName = fileOf(dir, key);
+        const std::string tmpName = fileName + "." + std::to_string(getpid()) + ".tmp";
+        {
+          std::ofstream out(tmpName);
+          out << key << "\n" << table.size() << "\n";
+          for (const auto c : table)
+            out << c << "\n";
+          out.close();
+          if (!out)
+          {
+            std::filesystem::remove(tmpName, ec);
+            return;
+          }
+        }
+        std::filesystem::rename(tmpName, fileName, ec);
+        if (ec)
+          std::filesystem::remove(tmpName, ec);
+      }
+  };
+}
+
+#endif
@@ -0,0 +1,247 @@
+/**
+ * @file    dnaKernels.hpp
+ * @brief   vectorized per-base passes over DNA sequences
+ * @details AVX2 and AVX-512 kernels are compiled with target attributes and picked
+ *          at runtime, so that builds for a baseline such as -march=x86-64-v3 still
+ *          use AVX-512 when the CPU has it. NEON is part of the aarch64 baseline
+ */
+
+#ifndef DNA_KERNELS_HPP
+#define DNA_KERNELS_HPP
+
+#include <cstdint>
+#include <cstddef>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define DNA_KERNELS_X86 1
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#define DNA_KERNELS_NEON 1
+#include <arm_neon.h>
+#endif
+
+namespace skch
+{
+  namespace DnaKernels
+  {
+    using Kernel_t = void (*)(const char*, char*, size_t);
+
+    //Below this length the dispatch isn't worth it
+    constexpr size_t minVectorLength = 32;
+
+    /**
+     * @brief   uppercase ACGT stay, anything else becomes 'N'
+     * @details lowercase acgt are the only other bytes equal to ACGT once bit 5 is cleared
+     */
+    inline char upperValidBase(char c)
+    {
+      const char u = c & 0xDF;
+      return (u == 'A' || u == 'C' || u == 'G' || u == 'T') ? u : 'N';
+    }
+
+    inline char complementBase(char c)
+    {
+      switch (c)
+      {
+        case 'A': return 'T';
+        case 'C': return 'G';
+        case 'G': return 'C';
+        case 'T': return 'A';
+        default: return c;
+      }
+    }
+
+    inline void upperValidScalar(const char* src, char* dest, size_t len)
+    {
+      for (size_t i = 0; i < len; i++)
+        dest[i] = upperValidBase(src[i]);
+    }
+
+    //dest[len - 1 - i] = complement of src[i]
+    inline void reverseComplementScalar(const char* src, char* dest, size_t len)
+    {
+      for (size_t i = 0; i < len; i++)
+        dest[len - i - 1] = complementBase(src[i]);
+    }
+
+#ifdef DNA_KERNELS_X86
+
+    // A <-> T and C <-> G are xors with 0x15 and 0x04
+
+    __attribute__((target("avx2")))
+    inline void upperValidAVX2(const char* src, char* dest, size_t len)
+    {
+      const __m256i caseMask = _mm256_set1_epi8((char)0xDF);
+      const __m256i a = _mm256_set1_epi8('A'), c = _mm256_set1_epi8('C');
+      const __m256i g = _mm256_set1_epi8('G'), t = _mm256_set1_epi8('T');
+      const __m256i n = _mm256_set1_epi8('N');
+      size_t i = 0;
+      for (; i + 32 <= len; i += 32)
+      {
+        const __m256i u = _mm256_and_si256(_mm256_loadu_si256((const __m256i*)(src + i)), caseMask);
+        const __m256i valid = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(u, a), _mm256_cmpeq_epi8(u, c)),
+            _mm256_or_si256(_mm256_cmpeq_epi8(u, g), _mm256_cmpeq_epi8(u, t)));
+        _mm256_storeu_si256((__m256i*)(dest + i), _mm256_blendv_epi8(n, u, valid));
+      }
+      upperValidScalar(src + i, dest + i, len - i);
+    }
+
+    __attribute__((target("avx2")))
+    inline void reverseComplementAVX2(const char* src, char* dest, size_t len)
+    {
+      const __m256i a = _mm256_set1_epi8('A'), c = _mm256_set1_epi8('C');
+      const __m256i g = _mm256_set1_epi8('G'), t = _mm256_set1_epi8('T');
+      const __m256i xorAT = _mm256_set1_epi8(0x15), xorCG = _mm256_set1_epi8(0x04);
+      const __m256i reverse = _mm256_setr_epi8(
+          15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0,
+          15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+      size_t i = 0;
+      for (; i + 32 <= len; i += 32)
+      {
+        const __m256i v = _mm256_loadu_si256((const __m256i*)(src + i));
+        const __m256i isAT = _mm256_or_si256(_mm256_cmpeq_epi8(v, a), _mm256_cmpeq_epi8(v, t));
+        const __m256i isCG = _mm256_or_si256(_mm256_cmpeq_epi8(v, c), _mm256_cmpeq_epi8(v, g));
+        __m256i comp = _mm256_xor_si256(v, _mm256_or_si256(
+              _mm256_and_si256(isAT, xorAT), _mm256_and_si256(isCG, xorCG)));
+        comp = _mm256_shuffle_epi8(comp, reverse);
+        comp = _mm256_permute2x128_si256(comp, comp, 0x01);
+        _mm256_storeu_si256((__m256i*)(dest + len - i - 32), comp);
+      }
+      reverseComplementScalar(src + i, dest, len - i);
+    }
+
+    __attribute__((target("avx512f,avx512bw")))
+    inline void upperValidAVX512(const char* src, char* dest, size_t len)
+    {
+      const __m512i caseMask = _mm512_set1_epi8((char)0xDF);
+      const __m512i a = _mm512_set1_epi8('A'), c = _mm512_set1_epi8('C');
+      const __m512i g = _mm512_set1_epi8('G'), t = _mm512_set1_epi8('T');
+      const __m512i n = _mm512_set1_epi8('N');
+      size_t i = 0;
+      for (; i + 64 <= len; i += 64)
+      {
+        const __m512i u = _mm512_and_si512(_mm512_loadu_si512((const void*)(src + i)), caseMask);
+        const __mmask64 valid = _mm512_cmpeq_epi8_mask(u, a) | _mm512_cmpeq_epi8_mask(u, c)
+          | _mm512_cmpeq_epi8_mask(u, g) | _mm512_cmpeq_epi8_mask(u, t);
+        _mm512_storeu_si512((void*)(dest + i), _mm512_mask_blend_epi8(valid, n, u));
+      }
+      upperValidScalar(src + i, dest + i, len - i);
+    }
+
+    __attribute__((target("avx512f,avx512bw")))
+    inline void reverseComplementAVX512(const char* src, char* dest, size_t len)
+    {
+      const __m512i a = _mm512_set1_epi8('A'), c = _mm512_set1_epi8('C');
+      const __m512i g = _mm512_set1_epi8('G'), t = _mm512_set1_epi8('T');
+      const __m512i xorAT = _mm512_set1_epi8(0x15), xorCG = _mm512_set1_epi8(0x04);
+      const __m512i reverse = _mm512_broadcast_i32x4(_mm_setr_epi8(
+          15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0));
+      size_t i = 0;
+      for (; i + 64 <= len; i += 64)
+      {
+        const __m512i v = _mm512_loadu_si512((const void*)(src + i));
+        const __mmask64 isAT = _mm512_cmpeq_epi8_mask(v, a) | _mm512_cmpeq_epi8_mask(v, t);
+        const __mmask64 isCG = _mm512_cmpeq_epi8_mask(v, c) | _mm512_cmpeq_epi8_mask(v, g);
+        __m512i comp = _mm512_mask_blend_epi8(isAT, v, _mm512_xor_si512(v, xorAT));
+        comp = _mm512_mask_blend_epi8(isCG, comp, _mm512_xor_si512(v, xorCG));
+        comp = _mm512_shuffle_epi8(comp, reverse);
+        comp = _mm512_shuffle_i64x2(comp, comp, 0x1B);
+        _mm512_storeu_si512((void*)(dest + len - i - 64), comp);
+      }
+      reverseComplementScalar(src + i, dest, len - i);
+    }
+
+    inline Kernel_t selectUpperValid()
+    {
+      __builtin_cpu_init();
+      if (__builtin_cpu_supports("avx512bw"))
+        return upperValidAVX512;
+      if (__builtin_cpu_supports("avx2"))
+        return upperValidAVX2;
+      return upperValidScalar;
+    }
+
+    inline Kernel_t selectReverseComplement()
+    {
+      __builtin_cpu_init();
+      if (__builtin_cpu_supports("avx512bw"))
+        return reverseComplementAVX512;
+      if (__builtin_cpu_supports("avx2"))
+        return reverseComplementAVX2;
+      return reverseComplementScalar;
+    }
+
+#elif defined(DNA_KERNELS_NEON)
+
+    inline void upperValidNEON(const char* src, char* dest, size_t len)
+    {
+      const uint8x16_t caseMask = vdupq_n_u8(0xDF);
+      const uint8x16_t a = vdupq_n_u8('A'), c = vdupq_n_u8('C');
+      const uint8x16_t g = vdupq_n_u8('G'), t = vdupq_n_u8('T');
+      const uint8x16_t n = vdupq_n_u8('N');
+      size_t i = 0;
+      for (; i + 16 <= len; i += 16)
+      {
+        const uint8x16_t u = vandq_u8(vld1q_u8((const uint8_t*)(src + i)), caseMask);
+        const uint8x16_t valid = vorrq_u8(vorrq_u8(vceqq_u8(u, a), vceqq_u8(u, c)),
+            vorrq_u8(vceqq_u8(u, g), vceqq_u8(u, t)));
+        vst1q_u8((uint8_t*)(dest + i), vbslq_u8(valid, u, n));
+      }
+      upperValidScalar(src + i, dest + i, len - i);
+    }
+
+    inline void reverseComplementNEON(const char* src, char* dest, size_t len)
+    {
+      const uint8x16_t a = vdupq_n_u8('A'), c = vdupq_n_u8('C');
+      const uint8x16_t g = vdupq_n_u8('G'), t = vdupq_n_u8('T');
+      const uint8x16_t xorAT = vdupq_n_u8(0x15), xorCG = vdupq_n_u8(0x04);
+      size_t i = 0;
+      for (; i + 16 <= len; i += 16)
+      {
+        const uint8x16_t v = vld1q_u8((const uint8_t*)(src + i));
+        const uint8x16_t isAT = vorrq_u8(vceqq_u8(v, a), vceqq_u8(v, t));
+        const uint8x16_t isCG = vorrq_u8(vceqq_u8(v, c), vceqq_u8(v, g));
+        uint8x16_t comp = veorq_u8(v, vorrq_u8(vandq_u8(isAT, xorAT), vandq_u8(isCG, xorCG)));
+        comp = vrev64q_u8(comp);
+        comp = vextq_u8(comp, comp, 8);
+        vst1q_u8((uint8_t*)(dest + len - i - 16), comp);
+      }
+      reverseComplementScalar(src + i, dest, len - i);
+    }
+
+    inline Kernel_t selectUpperValid() { return upperValidNEON; }
+    inline Kernel_t selectReverseComplement() { return reverseComplementNEON; }
+
+#else
+
+    inline Kernel_t selectUpperValid() { return upperValidScalar; }
+    inline Kernel_t selectReverseComplement() { return reverseComplementScalar; }
+
+#endif
+
+    /**
+     * @brief   uppercase DNA in place, non-canonical bases becoming 'N'
+     */
+    inline void upperValid(char* seq, size_t len)
+    {
+      if (len < minVectorLength)
+        return upperValidScalar(seq, seq, len);
+      static const Kernel_t kernel = selectUpperValid();
+      kernel(seq, seq, len);
+    }
+
+    /**
+     * @brief   reverse complement of src into dest, which must not overlap it
+     */
+    inline void reverseComplement(const char* src, char* dest, size_t len)
+    {
+      if (len < minVectorLength)
+        return reverseComplementScalar(src, dest, len);
+      static const Kernel_t kernel = selectReverseComplement();
+      kernel(src, dest, len);
+    }
+  }
+}
+
+#endif
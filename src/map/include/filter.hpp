@@ -9,11 +9,14 @@
 
 #include <vector>
 #include <algorithm>
+#include <numeric>
 #include <set>
+#include <tuple>
 #include <fstream>
 #include <zlib.h>
 
 //Own includes
+#include "common/task_executor.hpp"
 #include "map/include/base_types.hpp"
 #include "map/include/map_parameters.hpp"
 
@@ -27,6 +30,80 @@ namespace skch
    */
   namespace Filter
   {
+    /**
+     * @brief     events of the plane sweeps packed in 64 bits, in <position, event type, segment id>
+     *            order: the position in the high 32 bits, then a bit set for end events and 31 bits
+     *            of segment id
+     */
+    inline uint64_t packEvent(offset_t position, int type, int segment)
+    {
+      return (uint64_t(position) << 32) | (uint64_t(type == event::END) << 31) | uint32_t(segment);
+    }
+
+    inline uint64_t eventPosition(uint64_t e) { return e >> 32; }
+
+    inline bool eventIsEnd(uint64_t e) { return (e >> 31) & 1; }
+
+    inline int eventSegment(uint64_t e) { return e & 0x7FFFFFFF; }
+
+    //Fewer events are sorted by comparison
+    constexpr size_t radixSortMinEvents = 256;
+
+    //Event buffers of a thread are kept for the next sweep up to this size
+    constexpr size_t eventScratchMaxEvents = 1 << 20;
+
+    /**
+     * @brief     sort packed events, by LSD radix sort on 8-bit digits skipping the digits all
+     *            events share, such as the high position bits
+     */
+    inline void sortEvents(std::vector<uint64_t> &events)
+    {
+      if (events.size() < radixSortMinEvents)
+      {
+        std::sort(events.begin(), events.end());
+        return;
+      }
+
+      thread_local std::vector<uint64_t> sorted;
+      sorted.resize(events.size());
+      uint64_t allOr = 0;
+      uint64_t allAnd = ~uint64_t(0);
+      for (const uint64_t e : events)
+      {
+        allOr |= e;
+        allAnd &= e;
+      }
+
+      // Digits where some events differ
+      const uint64_t varying = allOr & ~allAnd;
+      for (int shift = 0; shift < 64; shift += 8)
+      {
+        if (((varying >> shift) & 0xFF) == 0)
+          continue;
+        size_t counts[256] = {0};
+        for (const uint64_t e : events)
+          counts[(e >> shift) & 0xFF]++;
+        size_t offset = 0;
+        for (size_t& c : counts)
+        {
+          const size_t n = c;
+          c = offset;
+          offset += n;
+        }
+        for (const uint64_t e : events)
+          sorted[counts[(e >> shift) & 0xFF]++] = e;
+        events.swap(sorted);
+      }
+      if (sorted.capacity() > eventScratchMaxEvents)
+        std::vector<uint64_t>().swap(sorted);
+    }
+
+    inline void releaseEvents(std::vector<uint64_t> &events)
+    {
+      if (events.capacity() > eventScratchMaxEvents)
+        std::vector<uint64_t>().swap(events);
+    }
+
     /**
      * @namespace skch::filter::query
      * @brief     filter routines (best for query sequence)
@@ -173,42 +250,36 @@ namespace skch
           //binary search tree of segment ids, ordered by their scores
           std::set <int, Helper> bst (obj);
 
-          //Event point schedule
-          //vector of triplets <position, event type, segment id>
-          typedef std::tuple<offset_t, int, int> eventRecord_t;
-          std::vector <eventRecord_t>  eventSchedule (2*readMappings.size());
+          //Event point schedule, packed <position, event type, segment id>
+          thread_local std::vector<uint64_t> eventSchedule;
+          eventSchedule.clear();
+          eventSchedule.reserve(2 * readMappings.size());
 
           for(int i = 0; i < readMappings.size(); i++)
           {
-            eventSchedule.emplace_back (readMappings[i].queryStartPos, event::BEGIN, i);
-            eventSchedule.emplace_back (readMappings[i].queryEndPos, event::END, i);
+            eventSchedule.push_back (packEvent(readMappings[i].queryStartPos, event::BEGIN, i));
+            eventSchedule.push_back (packEvent(readMappings[i].queryEndPos, event::END, i));
           }
 
-          std::sort(eventSchedule.begin(), eventSchedule.end());
+          sortEvents(eventSchedule);
 
           //Execute the plane sweep algorithm
-          for(auto it = eventSchedule.begin(); it!= eventSchedule.end();)
+          for(size_t i = 0; i < eventSchedule.size();)
           {
-            //Find events that correspond to current position
-            auto it2 = std::find_if(it, eventSchedule.end(), [&](const eventRecord_t &e)
-                                    {
-                                      return std::get<0>(e) != std::get<0>(*it);
-                                    });
-
-            //update sweep line status by adding/removing segments
-            std::for_each(it, it2, [&](const eventRecord_t &e)
-                                    {
-                                      if (std::get<1>(e) == event::BEGIN)
-                                        bst.insert (std::get<2>(e));
-                                      else
-                                        bst.erase (std::get<2>(e));
-                                    });
+            //update sweep line status by adding/removing the segments of the current position
+            const uint64_t position = eventPosition(eventSchedule[i]);
+            for ( ; i < eventSchedule.size() && eventPosition(eventSchedule[i]) == position; i++)
+            {
+              if (eventIsEnd(eventSchedule[i]))
+                bst.erase (eventSegment(eventSchedule[i]));
+              else
+                bst.insert (eventSegment(eventSchedule[i]));
+            }
 
             //mark mappings as good
             obj.markGood(bst, secondaryToKeep, dropRand, overlapThreshold);
-
-            it = it2;
           }
+          releaseEvents(eventSchedule);
 
           //Remove bad mappings
           readMappings.erase(
@@ -234,39 +305,42 @@ namespace skch
           //Initialize object of Helper struct
           Helper obj (readMappings);
 
-          //Event point schedule
-          //vector of triplets <position, event type, segment id>
-          typedef std::tuple<offset_t, double, int, int> eventRecord_t;
-          std::vector <eventRecord_t>  eventSchedule (2*readMappings.size());
+          //Begin events, packed <position, segment id>; end events never keep a mapping
+          thread_local std::vector<uint64_t> eventSchedule;
+          eventSchedule.clear();
+          eventSchedule.reserve(readMappings.size());
 
-          for(int i = 0; i < readMappings.size(); i++) {
-              eventSchedule.emplace_back (readMappings[i].queryStartPos, obj.get_score(i), event::BEGIN, i);
-              eventSchedule.emplace_back (readMappings[i].queryEndPos, 0, event::END, i); // end should not be preferred
-          }
+          for(int i = 0; i < readMappings.size(); i++)
+            eventSchedule.push_back (packEvent(readMappings[i].queryStartPos, event::BEGIN, i));
 
-          std::sort(eventSchedule.begin(), eventSchedule.end());
+          sortEvents(eventSchedule);
 
-          //Execute the plane sweep algorithm
-          for(auto it = eventSchedule.begin(); it!= eventSchedule.end();)
+          //mark the secondaryToKeep+1 mappings beginning at each position first in
+          //(score, segment id) order as good
+          const auto scoreOrder = [&](const uint64_t x, const uint64_t y)
           {
-            //Find events that correspond to current position
-            auto it2 = std::find_if(it, eventSchedule.end(), [&](const eventRecord_t &e)
-                                    {
-                                      return std::get<0>(e) != std::get<0>(*it);
-                                    });
-
-            //mark best secondaryToKeep+1 mappings as good
-            int kept = 0;
-            std::for_each(it, it2, [&](const eventRecord_t &e)
+            return std::make_tuple(obj.get_score(eventSegment(x)), eventSegment(x))
+              < std::make_tuple(obj.get_score(eventSegment(y)), eventSegment(y));
+          };
+          const size_t toKeep = std::max(0, secondaryToKeep + 1);
+          for(size_t i = 0; i < eventSchedule.size();)
+          {
+            const uint64_t position = eventPosition(eventSchedule[i]);
+            size_t j = i;
+            while (j < eventSchedule.size() && eventPosition(eventSchedule[j]) == position)
+              j++;
+
+            auto last = eventSchedule.begin() + std::min(j, i + toKeep);
+            if (j - i > toKeep && toKeep > 0)
+              std::nth_element(eventSchedule.begin() + i, last - 1, eventSchedule.begin() + j, scoreOrder);
+            std::for_each(eventSchedule.begin() + i, last, [&](const uint64_t e)
                                     {
-                                        if (std::get<2>(e) == event::BEGIN && kept <= secondaryToKeep) {
-                                            obj.vec[std::get<3>(e)].discard = 0;
-                                            ++kept;
-                                        }
+                                      obj.vec[eventSegment(e)].discard = 0;
                                     });
 
-            it = it2;
+            i = j;
           }
+          releaseEvents(eventSchedule);
 
           //Remove bad mappings
           readMappings.erase(
@@ -511,6 +585,360 @@ namespace skch
               std::remove_if(readMappings.begin(), readMappings.end(), [&](MappingResult &e){ return e.discard == 1; }),
               readMappings.end());
         }
+
+      //Sequences with fewer mappings are swept by the calling thread
+      constexpr size_t sweepTaskMinMappings = 1024;
+
+      /**
+       * @brief     occupancy of a fixed range of ranks, as a tree of 64 bit words, to walk the
+       *            ranks occupied in order and find the next one in O(log64 n)
+       */
+      class RankOccupancy
+      {
+        public:
+
+          void reset(size_t n)
+          {
+            levels.clear();
+            do
+            {
+              n = (n + 63) / 64;
+              levels.emplace_back(n, 0);
+            } while (n > 1);
+          }
+
+          void insert(size_t r)
+          {
+            for (auto &level : levels)
+            {
+              const bool wasEmpty = level[r / 64] == 0;
+              level[r / 64] |= uint64_t(1) << (r % 64);
+              if (!wasEmpty)
+                break;
+              r /= 64;
+            }
+          }
+
+          void erase(size_t r)
+          {
+            for (auto &level : levels)
+            {
+              level[r / 64] &= ~(uint64_t(1) << (r % 64));
+              if (level[r / 64] != 0)
+                break;
+              r /= 64;
+            }
+          }
+
+          //first rank occupied at or after r, -1 if none
+          int64_t next(size_t r) const
+          {
+            size_t l = 0;
+            while (true)
+            {
+              if (l == levels.size() || r / 64 >= levels[l].size())
+                return -1;
+              const uint64_t bits = levels[l][r / 64] & (~uint64_t(0) << (r % 64));
+              if (bits != 0)
+              {
+                r = (r / 64) * 64 + __builtin_ctzll(bits);
+                break;
+              }
+              r = r / 64 + 1;
+              l++;
+            }
+            while (l > 0)
+            {
+              l--;
+              r = r * 64 + __builtin_ctzll(levels[l][r]);
+            }
+            return r;
+          }
+
+        private:
+
+          std::vector<std::vector<uint64_t>> levels;
+      };
+
+      /**
+       * @brief     plane sweep of filterMappings over the mappings of one reference sequence
+       * @details   the sweep line status is a static array of the ranks of the (score, refStartPos)
+       *            keys of the sequence, equal keys sharing a slot as they do in the std::set of
+       *            filterMappings, with the occupied slots kept in a RankOccupancy. The overlaps
+       *            with the mappings kept are only checked again for all the mappings of the
+       *            status when the mappings kept change, and otherwise only for those inserted
+       *            since, as the outcome of the check can not change in between
+       */
+      class SequenceSweep
+      {
+        public:
+
+          SequenceSweep(MappingResultsVector_t &v, const std::vector<double> &s) : vec(v), score(s) {}
+
+          /**
+           * @param[in]   own       mappings of the sequence, by index in vec
+           * @param[in]   carryIn   mappings of the previous sequence ending at its last base, whose end
+           *                        events in the std::set sweep are at the first base of this one
+           */
+          void run(const std::vector<int> &own, const std::vector<int> &carryIn, const skch::Sketch &refsketch,
+                   int secondaryToKeep, bool dropRand, double overlapThreshold)
+          {
+            ids = own;
+            std::sort(ids.begin(), ids.end(), [&](int x, int y) { return greaterKey(x, y); });
+            rank.assign(ids.size(), 0);
+            slot.clear();
+            for (size_t l = 0; l < ids.size(); l++)
+            {
+              if (l == 0 || greaterKey(ids[l - 1], ids[l]))
+                slot.push_back(-1);
+              rank[l] = slot.size() - 1;
+            }
+            occupied.reset(slot.size());
+
+            //Event point schedule, <ref seq offset, event type, segment id, local index>
+            //of this sequence only
+            std::vector<std::tuple<offset_t, int, int, int>> eventSchedule;
+            eventSchedule.reserve(2 * ids.size() + carryIn.size());
+            const offset_t lastPos = refsketch.metadata[vec[ids.front()].refSeqId].len - 1;
+            for (int l = 0; l < (int)ids.size(); l++)
+            {
+              const MappingResult &m = vec[ids[l]];
+              eventSchedule.emplace_back(m.refStartPos, event::BEGIN, ids[l], l);
+              //ends at the last base are events of the next sequence
+              if (m.refEndPos != lastPos)
+                eventSchedule.emplace_back(m.refEndPos + 1, event::END, ids[l], l);
+            }
+            for (int c : carryIn)
+            {
+              //only erases the slot of a mapping of this sequence with the same key
+              auto same = std::equal_range(ids.begin(), ids.end(), c, [&](int x, int y) { return greaterKey(x, y); });
+              if (same.first != same.second)
+                eventSchedule.emplace_back(0, event::END, c, same.first - ids.begin());
+            }
+            std::sort(eventSchedule.begin(), eventSchedule.end());
+
+            keptBefore.clear();
+            good.clear();
+            inGood.assign(ids.size(), 0);
+            for (auto it = eventSchedule.begin(); it != eventSchedule.end();)
+            {
+              auto it2 = it;
+              inserted.clear();
+              for ( ; it2 != eventSchedule.end() && std::get<0>(*it2) == std::get<0>(*it); it2++)
+              {
+                const int r = rank[std::get<3>(*it2)];
+                if (std::get<1>(*it2) == event::BEGIN)
+                {
+                  if (slot[r] == -1)
+                  {
+                    slot[r] = std::get<3>(*it2);
+                    occupied.insert(r);
+                    inserted.push_back(std::get<3>(*it2));
+                  }
+                }
+                else if (slot[r] != -1)
+                {
+                  slot[r] = -1;
+                  occupied.erase(r);
+                }
+              }
+
+              markGood(secondaryToKeep, dropRand, overlapThreshold);
+
+              it = it2;
+            }
+          }
+
+        private:
+
+          MappingResultsVector_t &vec;
+          const std::vector<double> &score;
+
+          std::vector<int> ids;               //mappings of the sequence by key, greatest first
+          std::vector<int> rank;              //of the key of each local index
+          std::vector<int> slot;              //local index holding each rank, -1 if none
+          RankOccupancy occupied;
+          std::vector<int> inserted;          //local indices inserted at the current position
+          std::vector<int> kept;
+          std::vector<int> keptBefore;        //mappings kept at the previous position
+          std::vector<int> good;              //local indices that may have discard == 0, for dropRand
+          std::vector<char> inGood;
+
+          //Greater than comparison by score and begin position, as Helper
+          bool greaterKey(int x, int y) const
+          {
+            return std::tie(score[x], vec[x].refStartPos) > std::tie(score[y], vec[y].refStartPos);
+          }
+
+          MappingResult &mapping(int l) { return vec[ids[l]]; }
+
+          bool active(int l) const { return slot[rank[l]] == l; }
+
+          void overlapKept(int l, double overlapThreshold)
+          {
+            for (int k : keptBefore)
+            {
+              if (overlap(ids[l], ids[k]) > overlapThreshold)
+              {
+                mapping(l).overlapped = 1;
+                mapping(l).discard = 1;
+                break;
+              }
+            }
+          }
+
+          double overlap(const int x, const int y) const
+          {
+            offset_t overlap_start = std::max(vec[x].blockRefStartPos, vec[y].blockRefStartPos);
+            offset_t overlap_end = std::min(vec[x].blockRefEndPos, vec[y].blockRefEndPos);
+            offset_t overlap_length = std::max(0, static_cast<int>(overlap_end - overlap_start));
+            offset_t x_length = vec[x].blockRefEndPos - vec[x].blockRefStartPos;
+            offset_t y_length = vec[y].blockRefEndPos - vec[y].blockRefStartPos;
+            return static_cast<double>(overlap_length) / std::min(x_length, y_length);
+          }
+
+          /**
+           * @brief     Helper::markGood over the slots occupied
+           */
+          void markGood(int secondaryToKeep, bool dropRand, double overlapThreshold)
+          {
+            int64_t r = occupied.next(0);
+            if (r < 0)
+            {
+              keptBefore.clear();
+              return;
+            }
+            const double best = score[ids[slot[r]]];
+
+            kept.clear();
+            for ( ; r >= 0; r = occupied.next(r + 1))
+            {
+              const int l = slot[r];
+              if ((best > score[ids[l]] || mapping(l).discard == 0) && (int)kept.size() > secondaryToKeep)
+                break;
+
+              mapping(l).discard = 0;
+              kept.push_back(l);
+              if (dropRand && !inGood[l])
+              {
+                inGood[l] = 1;
+                good.push_back(l);
+              }
+            }
+            const int64_t firstNotKept = r;
+            const int keptCount = kept.size();
+
+            // Check for overlaps and mark bad if necessary
+            std::sort(kept.begin(), kept.end());
+            if (kept != keptBefore)
+            {
+              keptBefore.swap(kept);
+              for ( ; r >= 0; r = occupied.next(r + 1))
+                overlapKept(slot[r], overlapThreshold);
+            }
+            else if (firstNotKept >= 0)
+            {
+              for (int l : inserted)
+                if (active(l) && rank[l] >= firstNotKept)
+                  overlapKept(l, overlapThreshold);
+            }
+
+            if (keptCount > secondaryToKeep && dropRand)
+            {
+              // break the ties by the hash of the mappings, as Helper::markGood, among the
+              // mappings still good (a mapping with discard == 0 is always in good)
+              std::vector<std::tuple<double, size_t, MappingResult*, int>> score_and_hash;
+              for (int l : good)
+              {
+                if (active(l) && mapping(l).discard == 0)
+                  score_and_hash.emplace_back(score[ids[l]], mapping(l).hash(), &mapping(l), l);
+                inGood[l] = 0;
+              }
+              good.clear();
+              std::sort(score_and_hash.begin(), score_and_hash.end(), std::greater{});
+              for (auto& x : score_and_hash)
+                std::get<2>(x)->discard = 1;
+              for (int i = 0; i < (int)score_and_hash.size() && i <= secondaryToKeep; i++)
+              {
+                std::get<2>(score_and_hash[i])->discard = 0;
+                inGood[std::get<3>(score_and_hash[i])] = 1;
+                good.push_back(std::get<3>(score_and_hash[i]));
+              }
+            }
+          }
+      };
+
+      /**
+       * @brief                       filter mappings (best for reference sequence), with the keep and
+       *                              discard decisions of filterMappings
+       * @details                     the sweep of each reference sequence runs on its own, in parallel
+       *                              with those of the others. In the std::set sweep of filterMappings,
+       *                              a mapping ending at the last base of a sequence is only removed at
+       *                              the first base of the next one, where it has no effect but erasing
+       *                              the mapping of the same key beginning there
+       * @param[in/out] readMappings  Mappings computed by Mashmap (post merge step)
+       * @param[in]     refsketch     reference index class object, used to determine ref sequence lengths
+       * @param[in]     threads       for the sweeps of the sequences
+       */
+      template <typename VecIn>
+      void filterMappingsBySequence(VecIn &readMappings, const skch::Sketch &refsketch, uint16_t secondaryToKeep,
+                                    bool dropRand, double overlapThreshold, int threads)
+      {
+        if(readMappings.size() <= 1)
+          return;
+
+        std::for_each(readMappings.begin(), readMappings.end(), [&](MappingResult &e){ e.discard = 1; });
+
+        std::vector<double> score(readMappings.size());
+        for (size_t i = 0; i < readMappings.size(); i++)
+          score[i] = readMappings[i].blockNucIdentity * log(readMappings[i].blockLength);
+
+        //Mappings of each sequence, and those of the previous sequence ending at its last base
+        std::vector<int> bySequence(readMappings.size());
+        std::iota(bySequence.begin(), bySequence.end(), 0);
+        std::stable_sort(bySequence.begin(), bySequence.end(), [&](int x, int y)
+            { return readMappings[x].refSeqId < readMappings[y].refSeqId; });
+        std::vector<std::vector<int>> own;
+        std::vector<std::vector<int>> carryIn;
+        for (size_t i = 0; i < bySequence.size(); )
+        {
+          const seqno_t seqId = readMappings[bySequence[i]].refSeqId;
+          size_t j = i;
+          while (j < bySequence.size() && readMappings[bySequence[j]].refSeqId == seqId)
+            j++;
+          own.emplace_back(bySequence.begin() + i, bySequence.begin() + j);
+          carryIn.emplace_back();
+          if (i > 0 && readMappings[bySequence[i - 1]].refSeqId == seqId - 1)
+          {
+            const offset_t lastPos = refsketch.metadata[seqId - 1].len - 1;
+            for (int x : own[own.size() - 2])
+              if (readMappings[x].refEndPos == lastPos)
+                carryIn.back().push_back(x);
+          }
+          i = j;
+        }
+
+        {
+          tasks::TaskGroup sweepTasks(tasks::sharedExecutor(threads));
+          for (size_t s = 0; s < own.size(); s++)
+          {
+            const auto sweep = [&, s]()
+            {
+              SequenceSweep(readMappings, score).run(own[s], carryIn[s], refsketch, secondaryToKeep, dropRand, overlapThreshold);
+            };
+            if (threads > 1 && own.size() > 1 && own[s].size() >= sweepTaskMinMappings)
+              sweepTasks.run(sweep);
+            else
+              sweep();
+          }
+          sweepTasks.wait();
+        }
+
+        //Remove bad mappings
+        readMappings.erase(
+            std::remove_if(readMappings.begin(), readMappings.end(), [&](MappingResult &e){ return e.discard == 1; }),
+            readMappings.end());
+      }
     } //End of reference namespace
   }
 }
@@ -0,0 +1,159 @@
+/**
+ * @file    indexSectionWriter.hpp
+ * @brief   sections of the index file written with a few large writes, and checksummed
+ *          in parallel by blocks
+ */
+
+#ifndef INDEX_SECTION_WRITER_HPP
+#define INDEX_SECTION_WRITER_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+//External includes
+#include "common/murmur3.h"
+
+namespace skch
+{
+  /**
+   * @brief     a section of the index, gathered as the arrays it is made of and written
+   *            out by finish() with one write per array
+   * @details   the checksum of a section is the hash of the hashes of its blocks of
+   *            blockBytes, each computed on its own thread, so that checksumming the
+   *            largest sections takes a fraction of the time of writing them. The small
+   *            values between the arrays, such as their sizes, are copied in
+   */
+  class IndexSectionWriter
+  {
+    public:
+
+      //Bytes of the blocks hashed one by one
+      static constexpr uint64_t blockBytes = uint64_t(16) << 20;
+
+    private:
+
+      struct Span
+      {
+        const char* data;
+        uint64_t size;
+      };
+
+      std::ofstream& outStream;
+      int threads;
+      std::vector<Span> spans;
+      std::deque<std::string> values;
+
+    public:
+
+      IndexSectionWriter(std::ofstream& outStream, int threads) : outStream(outStream), threads(threads)
+      {
+      }
+
+      /**
+       * @brief               add size bytes of data to the section, left in place until finish()
+       */
+      void add(const void* data, uint64_t size)
+      {
+        if (size > 0)
+          spans.push_back(Span {(const char*)data, size});
+      }
+
+      /**
+       * @brief               add a copy of value to the section
+       */
+      template <typename T>
+      void addValue(const T& value)
+      {
+        values.emplace_back((const char*)&value, sizeof(T));
+        add(values.back().data(), sizeof(T));
+      }
+
+      /**
+       * @brief               write the section out
+       * @return              its checksum
+       */
+      uint64_t finish()
+      {
+        const uint64_t sum = checksum(spans, threads);
+        for (const Span& span : spans)
+          outStream.write(span.data, span.size);
+        spans.clear();
+        values.clear();
+        return sum;
+      }
+
+      /**
+       * @brief               checksum of the size bytes of a section at data, as finish() gives it
+       */
+      static uint64_t checksum(const char* data, uint64_t size, int threads)
+      {
+        return checksum(std::vector<Span> {Span {data, size}}, threads);
+      }
+
+    private:
+
+      static uint64_t checksum(const std::vector<Span>& spans, int threads)
+      {
+        //Section offset of each span
+        std::vector<uint64_t> starts(spans.size() + 1, 0);
+        for (size_t i = 0; i < spans.size(); i++)
+          starts[i + 1] = starts[i] + spans[i].size;
+        const uint64_t blocks = (starts.back() + blockBytes - 1) / blockBytes;
+
+        std::vector<uint64_t> blockHashes(blocks);
+        const auto hashBlocks = [&](std::atomic<uint64_t>& next) {
+          std::string joined;
+          for (uint64_t b = next++; b < blocks; b = next++)
+          {
+            const uint64_t begin = b * blockBytes;
+            const uint64_t end = std::min(starts.back(), begin + blockBytes);
+            size_t s = std::upper_bound(starts.begin(), starts.end(), begin) - starts.begin() - 1;
+            const char* data;
+            if (end <= starts[s + 1])
+              data = spans[s].data + (begin - starts[s]);
+            else
+            {
+              //A block over several spans is copied together
+              joined.clear();
+              for (uint64_t at = begin; at < end; s++)
+              {
+                const uint64_t to = std::min(end, starts[s + 1]);
+                joined.append(spans[s].data + (at - starts[s]), to - at);
+                at = to;
+              }
+              data = joined.data();
+            }
+            uint64_t hash[2];
+            MurmurHash3_x64_128(data, end - begin, 42, hash);
+            blockHashes[b] = hash[0];
+          }
+        };
+
+        std::atomic<uint64_t> next(0);
+        const size_t numThreads = std::min<uint64_t>(std::max(1, threads), blocks);
+        if (numThreads <= 1)
+          hashBlocks(next);
+        else
+        {
+          std::vector<std::thread> workers;
+          for (size_t t = 0; t < numThreads; t++)
+            workers.emplace_back([&]() { hashBlocks(next); });
+          for (auto& w : workers)
+            w.join();
+        }
+
+        uint64_t hash[2];
+        MurmurHash3_x64_128(blockHashes.data(), blockHashes.size() * sizeof(uint64_t), 42, hash);
+        return hash[0];
+      }
+  };
+}
+
+#endif
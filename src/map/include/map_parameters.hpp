@@ -6,6 +6,7 @@
 #ifndef SKETCH_CONFIG_HPP
 #define SKETCH_CONFIG_HPP
 
+#include <functional>
 #include <vector>
 #include <unordered_set>
 #include <filesystem>
@@ -33,10 +34,16 @@ struct Parameters
 {
     int kmerSize;                                     //kmer size for sketching
     float kmer_pct_threshold;                         //use only kmers not in the top kmer_pct_threshold %-ile
+    bool kmer_freq_sketch;                            //spot frequent kmers with a count-min sketch while indexing
+    bool rolling_hash;                                //hash kmers with a rolling 2-bit encoding instead of murmur3
+    bool pack_queries;                                //hold query sequences at 2 bits per base while mapping
+    int sampling_scheme;                              //kmer sampling scheme, a skch::sampling
+    int syncmer_size;                                 //s-mer size of open syncmers
     offset_t segLength;                                //For split mapping case, this represents the fragment length
                                                       //for noSplit, it represents minimum read length to multimap
     offset_t block_length;                             // minimum (potentially merged) block to keep if we aren't split
     offset_t chain_gap;                                // max distance for 2d range union-find mapping chaining
+    bool sparse_chaining;                             // chain by co-linear sparse dynamic programming rather than closest successors
     uint64_t max_mapping_length;                      // maximum length of a mapping
     int alphabetSize;                                 //alphabet size
     offset_t referenceSize;                           //Approximate reference size
@@ -45,7 +52,12 @@ struct Parameters
     bool stage1_topANI_filter;                        //Use the ANI filter in stage 1
     float ANIDiff;                                    //ANI distance threshold below best mapping to retain in stage 1 filtering
     float ANIDiffConf;                                //Confidence of stage 1 ANI filtering threshold
+    std::string cache_dir;                            //directory caching the stage 1 cutoff tables and the spaced seeds, empty to not cache them
     int filterMode;                                   //filtering mode in mashmap
+    int64_t max_memory;                               //bytes of queries in flight and mappings held back while mapping, 0 for no limit
+    std::function<void(const std::string&, const std::string&, const std::string&)>
+      keep_sequence;                                  //given the file, name and bases of each sequence read, for the alignment, if set
+    int64_t onetoone_mem_budget;                      //bytes of mappings held for one-to-one filtering before spilling to disk, 0 for no limit
     uint32_t numMappingsForSegment;                   //how many mappings to retain for each segment
     uint32_t numMappingsForShortSequence;             //how many secondary alignments we keep for reads < segLength
     bool dropRand;                                    //drop mappings w/ same score until only numMappingsForSegment remain
@@ -53,9 +65,28 @@ struct Parameters
     std::vector<std::string> refSequences;            //reference sequence(s)
     std::vector<std::string> querySequences;          //query sequence(s)
     std::string outFileName;                          //output file name
+    bool bgzf_output;                                 //compress the mapping output in the BGZF format
+    int bgzf_level;                                   //BGZF compression level of the mapping output, -1 for the default
+    bool unordered_output;                            //report the mappings of queries as they are done rather than in input order
+    bool deterministic_output;                        //report the mappings in input order without waiting on the oldest batch
+    int output_shards;                                //files the mapping output is split over, named after outFileName, 0 for a single one
+    std::string shard_by;                             //records going to the same shard: query, target, query-sample or target-sample
+    std::string sort_by;                              //coordinates the mapping output is sorted and indexed by: target or query, empty for none
+    bool binary_output;                               //report mappings in the binary format of binaryMappings.hpp instead of PAF
+    bool seed_anchors;                                //with binary_output, write the seeds each mapping shares with its target along with it
     stdfs::path indexFilename;                        //output file name of index
     bool overwrite_index;                             //overwrite index if it exists
     bool create_index_only;                           //only create index and exit
+    bool append_index;                                //add new target sequences to an existing index
+    bool freeze_index;                                //look seeds up through a minimal perfect hash
+    bool compress_index;                              //keep the interval points of the seed lookup index delta and varint encoded
+    bool numa_interleave;                             //interleave the index pages over the NUMA nodes
+    bool huge_pages;                                  //back the index arrays with transparent huge pages
+    bool require_resident_index;                      //fail unless the index file is already in the page cache
+    std::string map_checkpoint_file;                  //progress of the mapping kept to resume it, empty for none
+    std::string mapping_cache_file;                   //mappings of the queries kept across runs, read before mapping and written after, empty for none
+    bool dedup_queries;                               //map the queries of the same sequence once, copying the mappings of the first to the others
+    int index_shards;                                 //number of index shards built and mapped against one at a time
     bool split;                                       //Split read mapping (done if this is true)
     bool lower_triangular;                            // set to true if we should filter out half of the mappings
     bool skip_self;                                   //skip self mappings
@@ -68,6 +99,9 @@ struct Parameters
     bool report_ANI_percentage;                       //true if ANI should be in [0,100] as opposed to [0,1] (this is necessary for wfmash
     bool filterLengthMismatches;                      //true if filtering out length mismatches
     float kmerComplexityThreshold;                    //minimum kmer complexity to consider (default 0)
+    uint64_t max_seed_points;                         //interval points of a query fragment kept at most, dropping its most frequent seeds (0 for no cap)
+    int target_prefilter;                             //seeds of the contig-level sketches a target shares with a query at least to be mapped on (0 for all targets)
+    int coarse_level;                                 //windows of the coarse level of the index, in segments, confining the lookups of long queries (0 for none)
 
 	std::string query_list;                           // file containing list of query sequence names
 	std::vector<std::string> query_prefix;            // prefix for query sequences to use
@@ -79,6 +113,7 @@ struct Parameters
     std::vector<ales::spaced_seed> spaced_seeds;      //
     bool world_minimizers;
     uint64_t sparsity_hash_threshold;                 // keep mappings that hash to <= this value
+    bool sparsify_pairs;                              // apply sparsity_hash_threshold to (query group, target) pairs before mapping
     double overlap_threshold;                         // minimum overlap for a mapping to be considered
 
     bool legacy_output;
@@ -104,6 +139,7 @@ float confidence_interval = 0.95;                   // Confidence interval to re
 float percentage_identity = 0.70;                   // Percent identity in the mapping step
 float ANIDiff = 0.0;                                // Stage 1 ANI diff threshold
 float ANIDiffConf = 0.999;                          // ANI diff confidence
+uint32_t freq_sketch_min_count = 32;                // Estimated occurrences above which a seed's interval points are held back as frequent
 std::string VERSION = "3.1.1";                      // Version of MashMap
 }
 }
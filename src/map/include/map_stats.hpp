@@ -19,6 +19,7 @@
 #endif
 
 //Own includes
+#include "common/task_executor.hpp"
 #include "map/include/base_types.hpp"
 #include "map/include/map_parameters.hpp"
 
@@ -168,6 +169,102 @@ namespace skch
       return minimumSharedMinimizers_relaxed;
     }
 
+    /**
+     * @brief     identity and identity upper bound of a mapping by its sketch size s and count of
+     *            shared sketch elements, as computed with j2md and md_lower_bound, for the sketch
+     *            sizes up to a maximum, so that the mapping stage looks them up
+     * @details   md_lower_bound searches for the binomial quantile from the jaccard of each count;
+     *            along a row, the search resumes from the quantile of the previous count, which
+     *            is moved by a few steps only, so that a row costs O(s) evaluations of the cdf.
+     *            The rows are filled in parallel with threads
+     */
+    class IdentityTable
+    {
+      public:
+
+        IdentityTable() = default;
+
+        IdentityTable(int maxSketchSize, int k, float ci, int threads = 1) : maxSketchSize(std::max(maxSketchSize, 0))
+        {
+          identities.resize(offset(this->maxSketchSize + 1));
+          upperBounds.resize(identities.size());
+          if (threads <= 1 || this->maxSketchSize < parallelMinSketchSize)
+          {
+            for (int s = 1; s <= this->maxSketchSize; s++)
+              fillRow(s, k, ci);
+            return;
+          }
+          //Interleaved rows, the cost of a row growing with s
+          tasks::TaskGroup rows(tasks::sharedExecutor(threads));
+          for (int t = 0; t < threads; t++)
+          {
+            rows.run([this, t, threads, k, ci]()
+            {
+              for (int s = 1 + t; s <= this->maxSketchSize; s += threads)
+                fillRow(s, k, ci);
+            });
+          }
+          rows.wait();
+        }
+
+        bool covers(int s) const { return s >= 1 && s <= maxSketchSize; }
+
+        //1 - j2md(shared / s, k)
+        float identity(int s, int shared) const { return identities[offset(s) + shared]; }
+
+        //1 - md_lower_bound(j2md(shared / s, k), s, k, ci)
+        float identityUpperBound(int s, int shared) const { return upperBounds[offset(s) + shared]; }
+
+      private:
+
+        static constexpr int parallelMinSketchSize = 256;
+
+        int maxSketchSize = 0;
+        std::vector<float> identities;
+        std::vector<float> upperBounds;
+
+        //Row s holds the counts 0 to s
+        static size_t offset(int s) { return size_t(s - 1) * (s + 2) / 2; }
+
+        void fillRow(int s, int k, float ci)
+        {
+          float* identity = &identities[offset(s)];
+          float* upperBound = &upperBounds[offset(s)];
+#ifdef USE_BOOST
+          for (int shared = 0; shared <= s; shared++)
+          {
+            const float mash_dist = j2md(1.0 * shared / s, k);
+            identity[shared] = 1 - mash_dist;
+            upperBound[shared] = 1 - md_lower_bound(mash_dist, s, k, ci);
+          }
+#else
+          const float q2 = (1.0 - ci)/2;
+
+          //First x with fewer than q2 chances of x or more shared sketches, at the jaccard of
+          //the count being filled
+          int firstBelow = 1;
+          for (int shared = 0; shared <= s; shared++)
+          {
+            const float mash_dist = j2md(1.0 * shared / s, k);
+            identity[shared] = 1 - mash_dist;
+
+            //Same search result as md_lower_bound, which goes up from x0
+            const float jaccard = md2j(mash_dist, k);
+            const int x0 = std::max( int(ceil(s * jaccard)), 1 );
+            while (firstBelow > 1 && gsl_cdf_binomial_Q(firstBelow - 2, jaccard, s) < q2)
+              firstBelow--;
+            while (firstBelow <= s && !(gsl_cdf_binomial_Q(firstBelow - 1, jaccard, s) < q2))
+              firstBelow++;
+            int x = x0;
+            if (x0 <= s)
+              x = std::max(x0, firstBelow) <= s ? std::max(x0, firstBelow) - 1 : s + 1;
+
+            upperBound[shared] = 1 - j2md(float(x) / s, k);
+          }
+#endif
+        }
+    };
+
     /**
      * @brief                     calculate p-value for a given alignment identity, sketch size..
      * @param[in] s               sketch size
@@ -0,0 +1,177 @@
+/**
+ * @file    mappingCache.hpp
+ * @brief   mappings of the queries of previous runs, replayed for the queries and targets
+ *          that did not change
+ */
+
+#ifndef MAPPING_CACHE_HPP
+#define MAPPING_CACHE_HPP
+
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+//Own includes
+#include "map/include/base_types.hpp"
+
+//External includes
+#include "common/murmur3.h"
+
+namespace skch
+{
+  /**
+   * @brief     final mappings of each query on each group of targets, kept in a file across
+   *            runs, for incremental builds where few of the queries and targets change
+   * @details   the mappings of a query on a target group only depend on the bases and name
+   *            of the query, on the targets of the group as indexed and on the mapping
+   *            parameters, so an entry is keyed by a 128-bit hash of the query and the
+   *            fingerprint of the group and parameters, see Map::setMappingCache. Mappings are
+   *            kept relative to their group: target ids from its first target, chain ids from
+   *            the first L2 mapping of the group, whose count is kept along. Entries are kept
+   *            in the file as long as their group is in the index
+   */
+  class MappingCache
+  {
+    public:
+
+      struct Key
+      {
+        uint64_t query[2];
+        uint64_t group;
+
+        bool operator==(const Key& other) const
+        {
+          return query[0] == other.query[0] && query[1] == other.query[1] && group == other.group;
+        }
+      };
+
+    private:
+
+      struct KeyHash
+      {
+        size_t operator()(const Key& k) const
+        {
+          return k.query[0] ^ (k.group * 0x9e3779b97f4a7c15ULL);
+        }
+      };
+
+      struct Entry
+      {
+        offset_t l2Mappings;                  //L2 mappings of the group before merging, for the chain ids
+        MappingResultsVector_t mappings;
+      };
+
+      static constexpr const char* magic = "wfmash-mapping-cache-1";
+
+      std::mutex mutex;
+      std::unordered_map<Key, Entry, KeyHash> entries;
+
+    public:
+
+      MappingCache() = default;
+      MappingCache(const MappingCache&) = delete;
+      MappingCache& operator=(const MappingCache&) = delete;
+
+      /**
+       * @brief             hash of a query, of its bases as read and of its name, which
+       *                    decides the targets it may map on with skip_self or skip_prefix
+       */
+      static void queryKey(const std::string& name, const std::string& seq, uint64_t out[2])
+      {
+        uint64_t parts[3];
+        MurmurHash3_x64_128(seq.data(), seq.size(), 42, &parts[0]);
+        parts[2] = seq.size();
+        std::string keyed(name);
+        keyed.append(reinterpret_cast<const char*>(parts), sizeof(parts));
+        MurmurHash3_x64_128(keyed.data(), keyed.size(), 43, out);
+      }
+
+      /**
+       * @brief             the mappings kept for key, false if there are none
+       * @param[out] l2Mappings   L2 mappings of the group before merging
+       */
+      bool get(const Key& key, MappingResultsVector_t& mappings, offset_t& l2Mappings)
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = entries.find(key);
+        if (it == entries.end())
+          return false;
+        mappings = it->second.mappings;
+        l2Mappings = it->second.l2Mappings;
+        return true;
+      }
+
+      void put(const Key& key, MappingResultsVector_t mappings, offset_t l2Mappings)
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        entries[key] = Entry {l2Mappings, std::move(mappings)};
+      }
+
+      /**
+       * @brief             entries of fileName, if it exists, exits if it is not a cache
+       * @param[in] groups  fingerprints of the target groups of the index, those of the
+       *                    other groups can never be met again and are left out
+       */
+      void load(const std::string& fileName, const std::unordered_set<uint64_t>& groups)
+      {
+        std::ifstream in(fileName, std::ios::binary);
+        if (!in.is_open())
+          return;
+        std::string tag;
+        if (!std::getline(in, tag) || tag != magic)
+        {
+          std::cerr << "[mashmap::skch::MappingCache] ERROR: " << fileName << " is not a mapping cache" << std::endl;
+          exit(1);
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        Key key;
+        int64_t l2Mappings;
+        uint64_t count;
+        while (in.read(reinterpret_cast<char*>(&key), sizeof(key))
+            && in.read(reinterpret_cast<char*>(&l2Mappings), sizeof(l2Mappings))
+            && in.read(reinterpret_cast<char*>(&count), sizeof(count)))
+        {
+          MappingResultsVector_t mappings(count);
+          if (!in.read(reinterpret_cast<char*>(mappings.data()), count * sizeof(MappingResult)))
+            break;
+          if (groups.count(key.group))
+            entries[key] = Entry {l2Mappings, std::move(mappings)};
+        }
+      }
+
+      /**
+       * @brief             write the entries to fileName, through a rename so that an
+       *                    interruption leaves either the old or the new cache
+       */
+      bool save(const std::string& fileName)
+      {
+        const std::string tmp = fileName + ".tmp";
+        {
+          std::ofstream out(tmp, std::ios::binary);
+          out << magic << "\n";
+          std::lock_guard<std::mutex> lock(mutex);
+          for (const auto& e : entries)
+          {
+            const int64_t l2Mappings = e.second.l2Mappings;
+            const uint64_t count = e.second.mappings.size();
+            out.write(reinterpret_cast<const char*>(&e.first), sizeof(e.first));
+            out.write(reinterpret_cast<const char*>(&l2Mappings), sizeof(l2Mappings));
+            out.write(reinterpret_cast<const char*>(&count), sizeof(count));
+            out.write(reinterpret_cast<const char*>(e.second.mappings.data()), count * sizeof(MappingResult));
+          }
+          if (!out.flush())
+            return false;
+        }
+        return std::rename(tmp.c_str(), fileName.c_str()) == 0;
+      }
+  };
+}
+
+#endif
@@ -0,0 +1,100 @@
+/**
+ * @file    mappingCheckpoint.hpp
+ * @brief   progress of the mapping of the queries, kept to resume it after an interruption
+ */
+
+#ifndef MAPPING_CHECKPOINT_HPP
+#define MAPPING_CHECKPOINT_HPP
+
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+
+//Own includes
+#include "map/include/base_types.hpp"
+
+namespace skch
+{
+  /**
+   * @brief     queries whose mappings are all in the output, the output bytes they took, and
+   *            the mappings held back for a filter over all the queries
+   * @details   batches of queries are reported in input order, so the queries done are always
+   *            the first ones, counted by their sequence counter: those still mapping are mapped
+   *            again when resuming. One-to-one filtering only reports at the end, its mappings
+   *            so far are kept in the checkpoint instead, after its header line. The sizes of
+   *            the query files are kept to refuse resuming the mapping of other queries
+   */
+  struct MappingCheckpoint
+  {
+    seqno_t queries = 0;
+    uint64_t outputBytes = 0;
+
+    static constexpr const char* magic = "wfmash-mapping-checkpoint-1";
+
+    static uint64_t inputSize(const std::vector<std::string>& fileNames)
+    {
+      uint64_t size = 0;
+      for (const auto& fileName : fileNames)
+      {
+        struct stat st;
+        size += stat(fileName.c_str(), &st) == 0 ? st.st_size : 0;
+      }
+      return size;
+    }
+
+    /**
+     * @brief             checkpoint of the queries of inputFiles kept in fileName, with the
+     *                    mappings held back so far into held
+     * @return            false if there is none, exits if it is of other queries
+     */
+    bool load(const std::string& fileName, const std::vector<std::string>& inputFiles, std::vector<MappingResult>& held)
+    {
+      std::ifstream in(fileName, std::ios::binary);
+      if (!in.is_open())
+        return false;
+      std::string tag;
+      uint64_t inputBytes = 0;
+      uint64_t heldCount = 0;
+      if (!(in >> tag >> inputBytes >> queries >> outputBytes >> heldCount) || tag != magic || in.get() != '\n')
+      {
+        std::cerr << "[mashmap::skch::MappingCheckpoint] ERROR: " << fileName << " is not a mapping checkpoint" << std::endl;
+        exit(1);
+      }
+      if (inputBytes != inputSize(inputFiles))
+      {
+        std::cerr << "[mashmap::skch::MappingCheckpoint] ERROR: " << fileName << " is the checkpoint of other queries" << std::endl;
+        exit(1);
+      }
+      held.resize(heldCount);
+      if (!in.read(reinterpret_cast<char*>(held.data()), heldCount * sizeof(MappingResult)))
+      {
+        std::cerr << "[mashmap::skch::MappingCheckpoint] ERROR: " << fileName << " is truncated" << std::endl;
+        exit(1);
+      }
+      return true;
+    }
+
+    /**
+     * @brief             replace the checkpoint in fileName, through a rename so that an
+     *                    interruption leaves either the old or the new one
+     */
+    bool save(const std::string& fileName, const std::vector<std::string>& inputFiles, const std::vector<MappingResult>& held) const
+    {
+      const std::string tmp = fileName + ".tmp";
+      {
+        std::ofstream out(tmp, std::ios::binary);
+        out << magic << "\t" << inputSize(inputFiles) << "\t" << queries << "\t" << outputBytes << "\t" << held.size() << "\n";
+        out.write(reinterpret_cast<const char*>(held.data()), held.size() * sizeof(MappingResult));
+        if (!out.flush())
+          return false;
+      }
+      return std::rename(tmp.c_str(), fileName.c_str()) == 0;
+    }
+  };
+}
+
+#endif
@@ -0,0 +1,82 @@
+/**
+ * @file    mappingQueue.hpp
+ * @brief   in-memory handoff of reported mappings from the mapping to the alignment stage
+ */
+
+#ifndef MAPPING_QUEUE_HPP
+#define MAPPING_QUEUE_HPP
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+
+namespace skch
+{
+  /**
+   * @brief     bounded queue of PAF text, each entry holding the whole mapping lines
+   *            reported for a batch of queries
+   * @details   pushing waits while the queued text is over the bound, so that mapping
+   *            can not run arbitrarily far ahead of alignment
+   */
+  class MappingQueue
+  {
+    private:
+
+      std::mutex mutex;
+      std::condition_variable changed;
+      std::deque<std::string> chunks;
+      size_t queuedBytes = 0;
+      const size_t maxQueuedBytes;
+      bool closed = false;
+
+    public:
+
+      explicit MappingQueue(size_t maxQueuedBytes = 1 << 26)
+        : maxQueuedBytes(maxQueuedBytes) {}
+
+      MappingQueue(const MappingQueue&) = delete;
+      MappingQueue& operator=(const MappingQueue&) = delete;
+
+      void push(std::string&& chunk)
+      {
+        if (chunk.empty())
+          return;
+        std::unique_lock<std::mutex> lock(mutex);
+        //a chunk larger than the bound still goes through an empty queue
+        changed.wait(lock, [this]() { return queuedBytes < maxQueuedBytes; });
+        queuedBytes += chunk.size();
+        chunks.push_back(std::move(chunk));
+        changed.notify_all();
+      }
+
+      /**
+       * @brief           no more mappings are coming
+       */
+      void close()
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        changed.notify_all();
+      }
+
+      /**
+       * @brief           wait for the next chunk
+       * @return          false once the queue is closed and drained
+       */
+      bool pop(std::string& chunk)
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [this]() { return closed || !chunks.empty(); });
+        if (chunks.empty())
+          return false;
+        chunk = std::move(chunks.front());
+        chunks.pop_front();
+        queuedBytes -= chunk.size();
+        changed.notify_all();
+        return true;
+      }
+  };
+}
+
+#endif
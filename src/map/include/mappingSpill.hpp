@@ -0,0 +1,142 @@
+/**
+ * @file    mappingSpill.hpp
+ * @brief   mappings kept in temporary files as sorted runs, read back with a k-way merge
+ */
+
+#ifndef MAPPING_SPILL_HPP
+#define MAPPING_SPILL_HPP
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <queue>
+#include <string>
+#include <vector>
+
+//Own includes
+#include "map/include/base_types.hpp"
+#include "interface/temp_file.hpp"
+
+namespace skch
+{
+  /**
+   * @brief     sorted runs of mappings written to temporary files, so that the mappings
+   *            held in memory stay under a budget
+   * @details   runs are raw MappingResult records, they are only read back by the same process
+   */
+  class MappingSpill
+  {
+    private:
+
+      std::vector<std::string> runFiles;
+
+      //Mappings read at a time from each run while merging
+      static constexpr size_t readBufferMappings = 1 << 12;
+
+      struct RunReader
+      {
+        std::ifstream in;
+        std::vector<MappingResult> buffer;
+        size_t pos = 0;
+
+        explicit RunReader(const std::string& fileName)
+          : in(fileName, std::ios::binary) {}
+
+        //false once the run is exhausted
+        bool fill()
+        {
+          buffer.resize(readBufferMappings);
+          in.read(reinterpret_cast<char*>(buffer.data()), buffer.size() * sizeof(MappingResult));
+          buffer.resize(in.gcount() / sizeof(MappingResult));
+          pos = 0;
+          return !buffer.empty();
+        }
+
+        MappingResult& head() { return buffer[pos]; }
+
+        bool advance()
+        {
+          return ++pos < buffer.size() || fill();
+        }
+      };
+
+    public:
+
+      MappingSpill() = default;
+      MappingSpill(const MappingSpill&) = delete;
+      MappingSpill& operator=(const MappingSpill&) = delete;
+
+      ~MappingSpill()
+      {
+        for (const auto& fileName : runFiles)
+          yeet::temp_file::remove(fileName);
+      }
+
+      bool empty() const
+      {
+        return runFiles.empty();
+      }
+
+      /**
+       * @brief               sort mappings and write them as a new run, leaving mappings empty
+       */
+      template <typename Cmp>
+        void spill(MappingResultsVector_t& mappings, Cmp cmp)
+        {
+          std::sort(mappings.begin(), mappings.end(), cmp);
+
+          const std::string fileName = yeet::temp_file::create("wfmash-spill-", ".bin");
+          std::ofstream out(fileName, std::ios::binary);
+          out.write(reinterpret_cast<const char*>(mappings.data()), mappings.size() * sizeof(MappingResult));
+          out.close();
+          if (!out)
+          {
+            std::cerr << "[mashmap::skch::MappingSpill::spill] ERROR: could not write mappings to " << fileName << std::endl;
+            exit(1);
+          }
+
+          runFiles.push_back(fileName);
+          mappings.clear();
+        }
+
+      /**
+       * @brief               call fn on each spilled mapping in cmp order, then drop the runs
+       * @details             equal mappings come in the order of the runs they were spilled in
+       */
+      template <typename Cmp, typename Fn>
+        void merge(Cmp cmp, Fn fn)
+        {
+          std::vector<RunReader> readers;
+          readers.reserve(runFiles.size());
+          for (const auto& fileName : runFiles)
+            readers.emplace_back(fileName);
+
+          const auto later = [&](size_t a, size_t b)
+          {
+            if (cmp(readers[b].head(), readers[a].head()))
+              return true;
+            return !cmp(readers[a].head(), readers[b].head()) && b < a;
+          };
+          std::priority_queue<size_t, std::vector<size_t>, decltype(later)> heads(later);
+          for (size_t r = 0; r < readers.size(); r++)
+            if (readers[r].fill())
+              heads.push(r);
+
+          while (!heads.empty())
+          {
+            const size_t r = heads.top();
+            heads.pop();
+            fn(readers[r].head());
+            if (readers[r].advance())
+              heads.push(r);
+          }
+
+          readers.clear();
+          for (const auto& fileName : runFiles)
+            yeet::temp_file::remove(fileName);
+          runFiles.clear();
+        }
+  };
+}
+
+#endif
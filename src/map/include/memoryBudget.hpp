@@ -0,0 +1,77 @@
+/**
+ * @file    memoryBudget.hpp
+ * @brief   bound on the memory of the queries being mapped and the mappings held back
+ */
+
+#ifndef MEMORY_BUDGET_HPP
+#define MEMORY_BUDGET_HPP
+
+#include <cstdint>
+
+//Own includes
+#include "map/include/base_types.hpp"
+#include "map/include/map_parameters.hpp"
+
+namespace skch
+{
+  /**
+   * @brief     bytes reserved by the queries handed to the mapping tasks, against a limit
+   * @details   only used from the thread dispatching the queries, which also handles the
+   *            outputs; the reference index is not counted
+   */
+  class MemoryBudget
+  {
+    private:
+
+      uint64_t limit;
+      uint64_t reserved = 0;
+
+      //Rough working memory per sketch element of a query: the minmer, its seed hits
+      //and the L1/L2 candidates made from them
+      static constexpr uint64_t bytesPerSketchElement = 256;
+
+    public:
+
+      /**
+       * @param[in] limit   bytes, 0 for no limit
+       */
+      explicit MemoryBudget(uint64_t limit) : limit(limit) {}
+
+      bool enabled() const
+      {
+        return limit > 0;
+      }
+
+      /**
+       * @brief             estimated bytes to map a query of length len, its
+       *                    sequence and the sketch of all its segments
+       */
+      static uint64_t estimateQueryBytes(offset_t len, const Parameters& param)
+      {
+        const uint64_t seqBytes = param.pack_queries ? len / 4 + 1 : len;
+        const uint64_t sketchElements = (len / param.segLength + 1) * param.sketchSize;
+        return sizeof(InputSeqProgContainer) + seqBytes + sketchElements * bytesPerSketchElement;
+      }
+
+      /**
+       * @brief             true if bytes more fit next to the reserved ones and heldBytes
+       *                    of mappings kept back
+       */
+      bool fits(uint64_t bytes, uint64_t heldBytes = 0) const
+      {
+        return !enabled() || reserved + heldBytes + bytes <= limit;
+      }
+
+      void reserve(uint64_t bytes)
+      {
+        reserved += bytes;
+      }
+
+      void release(uint64_t bytes)
+      {
+        reserved -= bytes;
+      }
+  };
+}
+
+#endif
@@ -0,0 +1,78 @@
+/**
+ * @file    nameArena.hpp
+ * @brief   sequence names stored once, packed in large blocks
+ */
+
+#ifndef NAME_ARENA_HPP
+#define NAME_ARENA_HPP
+
+#include <cstring>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+namespace skch
+{
+  /**
+   * @brief     storage of the names of the sequences, which are only ever appended
+   * @details   for assemblies of millions of contigs, a std::string per name costs a heap
+   *            allocation and its header each, and as much again for each table holding a
+   *            copy. Names are rather packed back to back in blocks that never move, so that
+   *            the views handed out stay valid for the life of the arena, and are shared by
+   *            the tables that look names up. Sequences are known by their dense ids, the
+   *            names being read only for filtering and formatting the output
+   */
+  class NameArena
+  {
+    private:
+
+      static constexpr size_t blockBytes = 1 << 20;
+
+      std::vector<std::unique_ptr<char[]>> blocks;
+      char* current = nullptr;                //block names are appended to
+      size_t currentUsed = blockBytes;
+
+    public:
+
+      NameArena() = default;
+      NameArena(const NameArena&) = delete;
+      NameArena& operator=(const NameArena&) = delete;
+
+      /**
+       * @brief             copy of name in the arena, valid as long as the arena
+       */
+      std::string_view store(std::string_view name)
+      {
+        char* copy;
+        if (name.size() > blockBytes / 2)
+        {
+          // a long name gets a block of its own, the current one keeps filling
+          blocks.emplace_back(new char[name.size()]);
+          copy = blocks.back().get();
+        }
+        else
+        {
+          if (name.size() > blockBytes - currentUsed)
+          {
+            blocks.emplace_back(new char[blockBytes]);
+            current = blocks.back().get();
+            currentUsed = 0;
+          }
+          copy = current + currentUsed;
+          currentUsed += name.size();
+        }
+        std::memcpy(copy, name.data(), name.size());
+        return std::string_view(copy, name.size());
+      }
+
+      /**
+       * @brief             bytes of the blocks, a name of its own block counted as a full one
+       */
+      size_t bytes() const
+      {
+        return blocks.size() * blockBytes;
+      }
+  };
+}
+
+#endif
@@ -0,0 +1,80 @@
+/**
+ * @file    packedSequence.hpp
+ * @brief   DNA sequence stored at 2 bits per base
+ */
+
+#ifndef PACKED_SEQUENCE_HPP
+#define PACKED_SEQUENCE_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "map/include/dnaKernels.hpp"
+
+namespace skch
+{
+  /**
+   * @brief     sequence normalized as by CommonFunc::makeUpperCaseAndValidDNA, packed
+   *            32 bases per word with A,C,G,T = 0,1,2,3 and a side list of 'N' runs
+   * @details   packing is lossless for sketching, which normalizes sequences anyway
+   */
+  struct PackedSequence
+  {
+    int64_t len = 0;
+    std::vector<uint64_t> words;
+    std::vector<std::pair<int64_t, int64_t>> nRuns;  //sorted [begin, end) runs of 'N'
+
+    PackedSequence() = default;
+
+    explicit PackedSequence(const std::string& s)
+      : len(s.length())
+      , words((s.length() + 31) / 32, 0)
+    {
+      for (int64_t i = 0; i < len; i++)
+      {
+        uint64_t code;
+        switch (DnaKernels::upperValidBase(s[i]))
+        {
+          case 'A': code = 0; break;
+          case 'C': code = 1; break;
+          case 'G': code = 2; break;
+          case 'T': code = 3; break;
+          default:
+            code = 0;
+            if (!nRuns.empty() && nRuns.back().second == i)
+              nRuns.back().second++;
+            else
+              nRuns.emplace_back(i, i + 1);
+        }
+        words[i / 32] |= code << (2 * (i % 32));
+      }
+    }
+
+    inline uint64_t code(int64_t i) const
+    {
+      return (words[i / 32] >> (2 * (i % 32))) & 3;
+    }
+
+    /**
+     * @brief   write bases [begin, begin + n) as characters to dest
+     */
+    void unpack(int64_t begin, int64_t n, char* dest) const
+    {
+      static constexpr char bases[4] = {'A', 'C', 'G', 'T'};
+      for (int64_t i = 0; i < n; i++)
+        dest[i] = bases[code(begin + i)];
+
+      auto run = std::upper_bound(nRuns.begin(), nRuns.end(), std::make_pair(begin, int64_t(0)),
+          [](const auto& a, const auto& b) { return a.first < b.first; });
+      if (run != nRuns.begin() && std::prev(run)->second > begin)
+        --run;
+      for (; run != nRuns.end() && run->first < begin + n; ++run)
+        std::fill(dest + std::max(run->first, begin) - begin, dest + std::min(run->second, begin + n) - begin, 'N');
+    }
+  };
+}
+
+#endif
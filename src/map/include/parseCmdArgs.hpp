@@ -164,6 +164,10 @@ sequences shorter than segment length will be ignored", ArgvParser::OptionRequir
    */
   void validateInputFile(std::string &fileName)
   {
+    //Remote files are opened by htslib
+    if (fileName.find("://") != std::string::npos)
+      return;
+
     //Open file one by one
     std::ifstream in(fileName);
 
@@ -213,6 +217,8 @@ sequences shorter than segment length will be ignored", ArgvParser::OptionRequir
     std::cerr << "[mashmap] Query = " << parameters.querySequences << std::endl;
     std::cerr << "[mashmap] Kmer size = " << parameters.kmerSize << std::endl;
     std::cerr << "[mashmap] Sketch size = " << parameters.sketchSize << std::endl;
+    if (parameters.sampling_scheme == sampling::OPEN_SYNCMER)
+      std::cerr << "[mashmap] Sampling open syncmers, s-mer size = " << parameters.syncmer_size << std::endl;
     std::cerr << "[mashmap] Segment length = " << parameters.segLength << (parameters.split ? " (read split allowed)": " (read split disabled)") << std::endl;
     if (parameters.block_length <= parameters.segLength)
     {
@@ -232,6 +238,26 @@ sequences shorter than segment length will be ignored", ArgvParser::OptionRequir
       std::cerr << "[mashmap] Kmer complexity threshold = " << 100 * parameters.kmerComplexityThreshold << "\%" << std::endl;
     }
 
+    if (parameters.max_seed_points > 0)
+    {
+      std::cerr << "[mashmap] Seed interval points per fragment = " << parameters.max_seed_points << std::endl;
+    }
+
+    if (parameters.target_prefilter > 0)
+    {
+      std::cerr << "[mashmap] Target prefilter, contig-level seeds shared = " << parameters.target_prefilter << std::endl;
+    }
+
+    if (parameters.coarse_level > 0)
+    {
+      std::cerr << "[mashmap] Coarse level windows = " << parameters.coarse_level * parameters.segLength << std::endl;
+    }
+
+    if (parameters.dedup_queries)
+    {
+      std::cerr << "[mashmap] Duplicate queries mapped once" << std::endl;
+    }
+
     std::cerr << "[mashmap] " << (parameters.skip_self ? "Skip" : "Do not skip") << " self mappings" << std::endl;
 
     if (parameters.skip_prefix) 
@@ -245,8 +271,15 @@ sequences shorter than segment length will be ignored", ArgvParser::OptionRequir
     else
       std::cerr << "[mashmap] " <<  "No hypergeometric filter" << std::endl;
 
-    std::cerr << "[mashmap] Mapping output file = " << parameters.outFileName << std::endl;
+    if (parameters.index_shards > 1)
+      std::cerr << "[mashmap] Index shards = " << parameters.index_shards << std::endl;
+
+    std::cerr << "[mashmap] Mapping output file = " << (parameters.outFileName.empty() ? "(streamed to alignment)" : parameters.outFileName) << std::endl;
     std::cerr << "[mashmap] Filter mode = " << parameters.filterMode << " (1 = map, 2 = one-to-one, 3 = none)" << std::endl;
+    if (parameters.filterMode == filter::ONETOONE && parameters.onetoone_mem_budget > 0)
+      std::cerr << "[mashmap] One-to-one mappings held in memory = " << parameters.onetoone_mem_budget << " bytes" << std::endl;
+    if (parameters.max_memory > 0)
+      std::cerr << "[mashmap] Mapping memory budget = " << parameters.max_memory << " bytes" << std::endl;
     std::cerr << "[mashmap] Execution threads  = " << parameters.threads << std::endl;
   }
 
@@ -379,6 +412,32 @@ sequences shorter than segment length will be ignored", ArgvParser::OptionRequir
     }
 
     parameters.overwrite_index = cmd.foundOption("overwriteIndex");
+    parameters.index_shards = 1;
+    parameters.onetoone_mem_budget = 0;
+    parameters.max_memory = 0;
+    parameters.cache_dir = "";
+    parameters.mapping_cache_file = "";
+    parameters.dedup_queries = false;
+    parameters.sparse_chaining = false;
+    parameters.binary_output = false;
+    parameters.seed_anchors = false;
+    parameters.bgzf_output = false;
+    parameters.bgzf_level = -1;
+    parameters.unordered_output = false;
+    parameters.deterministic_output = false;
+    parameters.output_shards = 0;
+    parameters.shard_by = "query";
+    parameters.sort_by = "";
+    parameters.append_index = false;
+    parameters.kmer_freq_sketch = false;
+    parameters.rolling_hash = false;
+    parameters.pack_queries = false;
+    parameters.sampling_scheme = sampling::BOTTOM_SKETCH;
+    parameters.syncmer_size = 0;
+    parameters.freeze_index = false;
+    parameters.compress_index = false;
+    parameters.numa_interleave = false;
+    parameters.huge_pages = false;
 
     parameters.alphabetSize = 4;
     //Do not expose the option to set protein alphabet in mashmap
@@ -556,6 +615,10 @@ sequences shorter than segment length will be ignored", ArgvParser::OptionRequir
       parameters.kmerComplexityThreshold = 0.0;
     str.clear();
 
+    parameters.max_seed_points = 0;
+    parameters.target_prefilter = 0;
+    parameters.coarse_level = 0;
+
 
     if (cmd.foundOption("hgFilterAniDiff")) {
       str << cmd.optionValue("hgFilterAniDiff");
@@ -600,6 +663,7 @@ sequences shorter than segment length will be ignored", ArgvParser::OptionRequir
         parameters.sparsity_hash_threshold
             = std::numeric_limits<uint64_t>::max();
     }
+    parameters.sparsify_pairs = false;
     str.clear();
 
     if(cmd.foundOption("threads"))
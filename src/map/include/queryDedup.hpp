@@ -0,0 +1,186 @@
+/**
+ * @file    queryDedup.hpp
+ * @brief   byte-identical queries mapped once, their mappings copied to the others at output
+ */
+
+#ifndef QUERY_DEDUP_HPP
+#define QUERY_DEDUP_HPP
+
+#include <cassert>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "map/include/base_types.hpp"
+
+//External includes
+#include "common/ankerl/unordered_dense.hpp"
+#include "common/murmur3.h"
+
+namespace skch
+{
+  /**
+   * @brief     first query of each sequence, and the mappings of those whose copies are still
+   *            to be output
+   * @details   a query is keyed by its bases and the context its mappings depend on besides
+   *            them. A query with the key of an earlier one is not mapped: its output takes the
+   *            mappings of the first, handled before it as outputs are handled in input order.
+   *            The mappings of a first query are only kept if a copy of it is waiting when it
+   *            is output, or a query of its length is still to be read, as the lengths of the
+   *            queries of indexed files are known in advance, and dropped with its last copy
+   */
+  class QueryDedup
+  {
+    public:
+
+      struct Key
+      {
+        uint64_t hash[2];
+
+        bool operator==(const Key& other) const
+        {
+          return hash[0] == other.hash[0] && hash[1] == other.hash[1];
+        }
+      };
+
+    private:
+
+      struct KeyHash
+      {
+        size_t operator()(const Key& k) const
+        {
+          return k.hash[0];
+        }
+      };
+
+      //Mappings of a first query, as the output of its copies
+      struct Kept
+      {
+        offset_t len = 0;
+        seqno_t waiting = 0;              //copies read and not output yet
+        bool handled = false;             //its own output handled, and the mappings kept
+        MappingResultsVector_t mappings;
+        std::vector<SeedAnchor> anchors;
+        std::vector<uint64_t> anchorEnds;
+      };
+
+      ankerl::unordered_dense::map<Key, seqno_t, KeyHash> firstByKey;
+      ankerl::unordered_dense::map<seqno_t, Kept> kept;
+
+      //Queries of each length still to be read, unless some are of unknown length
+      ankerl::unordered_dense::map<offset_t, seqno_t> lengthsLeft;
+      bool unknownLengths = false;
+
+      seqno_t copies = 0;
+
+      bool lengthExpected(offset_t len) const
+      {
+        return unknownLengths || lengthsLeft.count(len) > 0;
+      }
+
+    public:
+
+      /**
+       * @brief               key of a query, from its bases and context, such as its prefix
+       *                      group where the targets it may map on depend on it
+       */
+      static Key key(const std::string& seq, std::string_view context)
+      {
+        uint64_t parts[3];
+        MurmurHash3_x64_128(seq.data(), seq.size(), 42, &parts[0]);
+        parts[2] = seq.size();
+        std::string keyed(context);
+        keyed.append(reinterpret_cast<const char*>(parts), sizeof(parts));
+        Key k;
+        MurmurHash3_x64_128(keyed.data(), keyed.size(), 43, k.hash);
+        return k;
+      }
+
+      /**
+       * @brief               a query of length len is to be read, from the index of its file
+       */
+      void expectLength(offset_t len)
+      {
+        lengthsLeft[len]++;
+      }
+
+      /**
+       * @brief               queries are to be read whose lengths are not known in advance
+       */
+      void expectUnknownLengths()
+      {
+        unknownLengths = true;
+      }
+
+      /**
+       * @brief               a query of length len was read
+       */
+      void read(offset_t len)
+      {
+        const auto it = lengthsLeft.find(len);
+        if (it != lengthsLeft.end() && --it->second == 0)
+          lengthsLeft.erase(it);
+      }
+
+      /**
+       * @brief               the first query with key, seqCounter itself if there is none
+       *                      before it
+       */
+      seqno_t firstOf(const Key& k, seqno_t seqCounter)
+      {
+        const auto inserted = firstByKey.emplace(k, seqCounter);
+        const seqno_t first = inserted.first->second;
+        if (first != seqCounter)
+        {
+          kept[first].waiting++;
+          copies++;
+        }
+        return first;
+      }
+
+      /**
+       * @brief               keep the mappings of the output of a first query for its copies,
+       *                      if any may come
+       */
+      void keep(const MapModuleOutput& output)
+      {
+        const auto it = kept.find(output.seqCounter);
+        if (it == kept.end() && !lengthExpected(output.qseqLen))
+          return;
+        Kept& k = it != kept.end() ? it->second : kept[output.seqCounter];
+        k.len = output.qseqLen;
+        k.handled = true;
+        k.mappings = output.readMappings;
+        k.anchors = output.anchors;
+        k.anchorEnds = output.anchorEnds;
+      }
+
+      /**
+       * @brief               fill the output of a copy with the mappings of its first query
+       */
+      void copy(MapModuleOutput& output)
+      {
+        const auto it = kept.find(output.firstCopy);
+        assert(it != kept.end() && it->second.handled);
+        Kept& k = it->second;
+        output.readMappings = k.mappings;
+        for (auto& e : output.readMappings)
+          e.querySeqId = output.seqCounter;
+        output.anchors = k.anchors;
+        output.anchorEnds = k.anchorEnds;
+        if (--k.waiting == 0 && !lengthExpected(k.len))
+          kept.erase(it);
+      }
+
+      /**
+       * @brief               count of the queries output as copies
+       */
+      seqno_t copied() const
+      {
+        return copies;
+      }
+  };
+}
+
+#endif
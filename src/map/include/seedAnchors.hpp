@@ -0,0 +1,163 @@
+/**
+ * @file    seedAnchors.hpp
+ * @brief   co-linear seeds a mapping shares with its target, carried to the aligner so that
+ *          it does not look for the path of the alignment far from them
+ */
+
+#ifndef SEED_ANCHORS_HPP
+#define SEED_ANCHORS_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "map/include/base_types.hpp"
+
+namespace skch
+{
+  /**
+   * @brief     the sampled kmers of a query, chained over the minmers of the target of each
+   *            of its mappings
+   * @details   the hashes below a fraction of the sketch density are taken, so that a kmer of
+   *            the target sampled is nearly always a minmer of all the windows it is in: it
+   *            then leaves the sketch only as the windows slide past it, which places it
+   *            exactly, one before the end of its minmer window. Kmers found more than once
+   *            on the query or in the target range are left out, and the matches of a
+   *            mapping chained into the longest co-linear run on its strand, thinned out to
+   *            one anchor per minSpacing bases of the query
+   */
+  class SeedAnchors
+  {
+    public:
+
+      //Sketch density over the share of the hash space sampled
+      static constexpr double thinning = 8;
+
+      //Bases between consecutive anchors on the query at least
+      static constexpr offset_t minSpacing = 64;
+
+    private:
+
+      //Sampled kmers of the query found once, sorted by hash
+      std::vector<std::tuple<hash_t, offset_t, strand_t>> unique;
+
+      //Matches of a mapping, as their position on the query and the target
+      std::vector<std::pair<hash_t, offset_t>> refSeeds;
+      std::vector<std::pair<offset_t, offset_t>> matches;
+
+    public:
+
+      /**
+       * @brief               threshold of the hashes sampled, for sketchSize minmers per
+       *                      segLength bases
+       */
+      static hash_t thresholdFor(int sketchSize, offset_t segLength)
+      {
+        const double share = sketchSize / (double(std::max<offset_t>(1, segLength)) * thinning);
+        return share >= 1 ? std::numeric_limits<hash_t>::max() : hash_t(std::ldexp(share, 64));
+      }
+
+      /**
+       * @brief               take the sampled kmers of a query
+       * @param[in] samples   position, hash and strand of its kmers below the threshold
+       */
+      void setQuery(const std::vector<std::tuple<offset_t, hash_t, strand_t>>& samples)
+      {
+        unique.clear();
+        unique.reserve(samples.size());
+        for (const auto& s : samples)
+          unique.emplace_back(std::get<1>(s), std::get<0>(s), std::get<2>(s));
+        std::sort(unique.begin(), unique.end());
+        size_t kept = 0;
+        for (size_t i = 0; i < unique.size(); )
+        {
+          size_t j = i + 1;
+          while (j < unique.size() && std::get<0>(unique[j]) == std::get<0>(unique[i]))
+            j++;
+          if (j == i + 1)
+            unique[kept++] = unique[i];
+          i = j;
+        }
+        unique.resize(kept);
+      }
+
+      /**
+       * @brief               append the anchors of mapping e to out
+       * @param[in] kmerSize  span of the kmers
+       * @param[in] forEach   calls its argument with the hash, position and strand of each
+       *                      sampled minmer of the target around the mapping
+       */
+      template <typename ForEachMinmer>
+      void chain(const MappingResult& e, offset_t kmerSize, ForEachMinmer&& forEach, std::vector<SeedAnchor>& out)
+      {
+        const bool forward = e.strand == strnd::FWD;
+        refSeeds.clear();
+        matches.clear();
+        forEach([&](hash_t hash, offset_t pos, strand_t strand) {
+          if (pos < e.refStartPos || pos + kmerSize > e.refEndPos + 1)
+            return;
+          const auto it = std::lower_bound(unique.begin(), unique.end(), std::make_tuple(hash, offset_t(0), strand_t(0)),
+              [](const auto& a, const auto& b) { return std::get<0>(a) < std::get<0>(b); });
+          if (it == unique.end() || std::get<0>(*it) != hash)
+            return;
+          const offset_t qpos = std::get<1>(*it);
+          if (qpos < e.queryStartPos || qpos + kmerSize > e.queryEndPos || (std::get<2>(*it) == strand) != forward)
+            return;
+          refSeeds.emplace_back(hash, pos);
+        });
+
+        //Hashes found once in the target range, on the query in the orientation of the mapping
+        std::sort(refSeeds.begin(), refSeeds.end());
+        for (size_t i = 0; i < refSeeds.size(); )
+        {
+          size_t j = i + 1;
+          while (j < refSeeds.size() && refSeeds[j].first == refSeeds[i].first)
+            j++;
+          if (j == i + 1)
+          {
+            const auto it = std::lower_bound(unique.begin(), unique.end(), std::make_tuple(refSeeds[i].first, offset_t(0), strand_t(0)),
+                [](const auto& a, const auto& b) { return std::get<0>(a) < std::get<0>(b); });
+            const offset_t qpos = std::get<1>(*it);
+            matches.emplace_back(forward ? qpos - e.queryStartPos : e.queryEndPos - qpos - kmerSize,
+                                 refSeeds[i].second);
+          }
+          i = j;
+        }
+        if (matches.empty())
+          return;
+
+        //Longest run increasing on both
+        std::sort(matches.begin(), matches.end());
+        std::vector<size_t> tails, previous(matches.size());
+        for (size_t i = 0; i < matches.size(); i++)
+        {
+          const size_t at = std::lower_bound(tails.begin(), tails.end(), matches[i].second,
+              [&](size_t t, offset_t pos) { return matches[t].second < pos; }) - tails.begin();
+          previous[i] = at > 0 ? tails[at - 1] : matches.size();
+          if (at == tails.size())
+            tails.push_back(i);
+          else
+            tails[at] = i;
+        }
+        std::vector<size_t> run;
+        for (size_t i = tails.back(); i < matches.size(); i = previous[i])
+          run.push_back(i);
+
+        offset_t last = std::numeric_limits<offset_t>::min();
+        for (auto it = run.rbegin(); it != run.rend(); ++it)
+        {
+          const std::pair<offset_t, offset_t>& m = matches[*it];
+          if (last != std::numeric_limits<offset_t>::min() && m.first - last < minSpacing)
+            continue;
+          last = m.first;
+          out.push_back(SeedAnchor {forward ? e.queryStartPos + m.first : e.queryEndPos - m.first, m.second});
+        }
+      }
+  };
+}
+
+#endif
@@ -0,0 +1,189 @@
+/**
+ * @file    shardedMapping.hpp
+ * @brief   what the index shards of a run find for each query, for the last one to map it
+ *          as a single index would
+ */
+
+#ifndef SHARDED_MAPPING_HPP
+#define SHARDED_MAPPING_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "map/include/base_types.hpp"
+
+namespace skch
+{
+  /**
+   * @brief     state of a run over index shards, held in memory one at a time
+   * @details   the L1 candidates of a query fragment depend on its best intersection size over
+   *            all the targets, and the L2 stage walks them best first until the best mapping
+   *            so far rules the others out. With the hypergeometric filter, the shards are then
+   *            gone through twice: first for the best intersection sizes, then for the
+   *            candidates, each held with its L2 mappings. The last shard walks the candidates
+   *            of all the shards together, mapping its own as they are reached, and filters
+   *            the mappings of each query as a single index would, so that nothing is output
+   *            before
+   */
+  class ShardedMapping
+  {
+    public:
+
+      enum class Pass
+      {
+        Bests,                            //best L1 intersection sizes
+        Candidates                        //L1 candidates and their L2 mappings
+      };
+
+    private:
+
+      struct Query
+      {
+        std::vector<ShardFragmentBest> bests;
+        std::vector<ShardCandidate> candidates;
+        MappingResultsVector_t mappings;
+      };
+
+      std::vector<Query> queries;
+      Pass currentPass = Pass::Candidates;
+      bool lastShard = false;
+      uint64_t heldBytes = 0;
+
+      static bool fragmentGroupLess(const ShardFragmentBest& a, const ShardFragmentBest& b)
+      {
+        return std::tie(a.fragStart, a.group) < std::tie(b.fragStart, b.group);
+      }
+
+      static bool candidateLess(const ShardCandidate& a, const ShardCandidate& b)
+      {
+        return std::tie(a.fragStart, a.seqId, a.rangeStartPos) < std::tie(b.fragStart, b.seqId, b.rangeStartPos);
+      }
+
+    public:
+
+      /**
+       * @brief               a shard is to be mapped against in pass, the last shard of the run
+       *                      if last, which then finds the candidates held by the shards before
+       *                      sorted as a single index would
+       */
+      void start(Pass pass, bool last)
+      {
+        currentPass = pass;
+        lastShard = last;
+        if (last)
+          for (auto& q : queries)
+            std::sort(q.candidates.begin(), q.candidates.end(), candidateLess);
+      }
+
+      Pass pass() const
+      {
+        return currentPass;
+      }
+
+      bool last() const
+      {
+        return lastShard;
+      }
+
+      /**
+       * @brief               hold what a shard found for a query, the L2 mappings of its
+       *                      candidates in turn in mappings
+       */
+      void hold(seqno_t query, const ShardQueryOutput& output, const MappingResultsVector_t& mappings)
+      {
+        if (query >= (seqno_t)queries.size())
+          queries.resize(query + 1);
+        Query& q = queries[query];
+
+        //Best over the shards of each fragment and group
+        if (!output.bests.empty())
+        {
+          const size_t before = q.bests.size();
+          q.bests.insert(q.bests.end(), output.bests.begin(), output.bests.end());
+          std::sort(q.bests.begin() + before, q.bests.end(), fragmentGroupLess);
+          std::inplace_merge(q.bests.begin(), q.bests.begin() + before, q.bests.end(), fragmentGroupLess);
+          auto kept = q.bests.begin();
+          for (auto it = q.bests.begin() + 1; it != q.bests.end(); ++it)
+          {
+            if (fragmentGroupLess(*kept, *it))
+              *++kept = *it;
+            else
+              kept->best = std::max(kept->best, it->best);
+          }
+          heldBytes -= (q.bests.end() - kept - 1) * sizeof(ShardFragmentBest);
+          q.bests.erase(kept + 1, q.bests.end());
+          heldBytes += output.bests.size() * sizeof(ShardFragmentBest);
+        }
+
+        uint64_t mappingsBegin = q.mappings.size();
+        for (const auto& c : output.candidates)
+        {
+          q.candidates.push_back(c);
+          q.candidates.back().mappingsBegin = mappingsBegin;
+          mappingsBegin += c.mappingCount;
+        }
+        q.mappings.insert(q.mappings.end(), mappings.begin(), mappings.end());
+        heldBytes += output.candidates.size() * sizeof(ShardCandidate) + mappings.size() * sizeof(MappingResult);
+      }
+
+      /**
+       * @brief               best L1 intersection size of the fragment of query at fragStart
+       *                      on the targets of group, over all the shards
+       */
+      int best(seqno_t query, offset_t fragStart, int group) const
+      {
+        if (query >= (seqno_t)queries.size())
+          return 0;
+        const auto& bests = queries[query].bests;
+        const ShardFragmentBest key {fragStart, group, 0};
+        const auto it = std::lower_bound(bests.begin(), bests.end(), key, fragmentGroupLess);
+        return it != bests.end() && !fragmentGroupLess(key, *it) ? it->best : 0;
+      }
+
+      /**
+       * @brief               candidates held for the fragment of query at fragStart, by target
+       *                      and position, once the last shard is started
+       */
+      std::pair<const ShardCandidate*, const ShardCandidate*> candidates(seqno_t query, offset_t fragStart) const
+      {
+        if (query >= (seqno_t)queries.size())
+          return {nullptr, nullptr};
+        const auto& candidates = queries[query].candidates;
+        const auto range = std::equal_range(candidates.data(), candidates.data() + candidates.size(),
+            ShardCandidate {fragStart, 0, 0, 0, 0, 0, 0},
+            [](const ShardCandidate& a, const ShardCandidate& b) { return a.fragStart < b.fragStart; });
+        return {range.first, range.second};
+      }
+
+      /**
+       * @brief               L2 mappings held for candidate, one of those of query
+       */
+      std::pair<const MappingResult*, const MappingResult*> mappings(seqno_t query, const ShardCandidate& candidate) const
+      {
+        const MappingResult* begin = queries[query].mappings.data() + candidate.mappingsBegin;
+        return {begin, begin + candidate.mappingCount};
+      }
+
+      /**
+       * @brief               free what is held, once the last shard is done with it
+       */
+      void clear()
+      {
+        std::vector<Query>().swap(queries);
+        heldBytes = 0;
+      }
+
+      /**
+       * @brief               bytes held for the queries
+       */
+      uint64_t bytes() const
+      {
+        return heldBytes;
+      }
+  };
+}
+
+#endif
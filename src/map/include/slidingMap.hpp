@@ -60,6 +60,9 @@ namespace skch
         typename VecType::iterator pivot;
         typename VecType::size_type pivRank;
 
+        //Hashes of slidingWindowMinhashes past its first element, searched on every event
+        std::vector<hash_t> sortedHashes;
+
 
       public:
 
@@ -118,6 +121,32 @@ namespace skch
           //Point pivot to last element in the map
           this->pivot = std::prev(this->slidingWindowMinhashes.end());
           pivRank = slidingWindowMinhashes.size() - 1;
+
+          sortedHashes.resize(slidingWindowMinhashes.size() - 1);
+          for (size_t i = 0; i < sortedHashes.size(); i++)
+            sortedHashes[i] = slidingWindowMinhashes[i + 1].hash_val;
+        }
+
+        /**
+         * @brief       index in slidingWindowMinhashes of the first query minmer not below h
+         * @details     the insert and delete events are otherwise O(1), the pivot moving by one
+         *              element at most, so this search is their cost. It runs over the hashes
+         *              alone, which take a third of the cache lines of the map elements, and
+         *              without data dependent branches
+         */
+        inline size_t locate(hash_t h) const
+        {
+          if (sortedHashes.empty())
+            return 1;
+          const hash_t* first = sortedHashes.data();
+          size_t len = sortedHashes.size();
+          while (len > 1)
+          {
+            const size_t half = len / 2;
+            first = first[half - 1] < h ? first + half : first;
+            len -= half;
+          }
+          return 1 + (first - sortedHashes.data()) + (*first < h);
         }
 
       public:
@@ -125,10 +154,7 @@ namespace skch
         void insert_minmer(const skch::MinmerInfo& mi)
         {
           // Find where minmer goes in vector
-          auto insert_loc = std::lower_bound(
-              std::next(slidingWindowMinhashes.begin()), slidingWindowMinhashes.end(),
-              mi.hash,
-              [](const slidingMapContainerValueType& a, hash_t b) {return a.hash_val < b;});
+          auto insert_loc = slidingWindowMinhashes.begin() + locate(mi.hash);
 
           if (insert_loc == slidingWindowMinhashes.end()) 
           {
@@ -171,10 +197,7 @@ namespace skch
         void delete_minmer(const skch::MinmerInfo& mi)
         {
           // Find where minmer goes in vector
-          auto insert_loc = std::lower_bound(
-              std::next(slidingWindowMinhashes.begin()), slidingWindowMinhashes.end(),
-              mi.hash,
-              [](const slidingMapContainerValueType& a, hash_t b) {return a.hash_val < b;});
+          auto insert_loc = slidingWindowMinhashes.begin() + locate(mi.hash);
 
           if (insert_loc == slidingWindowMinhashes.end()) 
           {
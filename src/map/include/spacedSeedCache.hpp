@@ -0,0 +1,127 @@
+/**
+ * @file    spacedSeedCache.hpp
+ * @brief   on-disk library of the spaced seeds found by ALeS for each parameter set
+ */
+
+#ifndef SPACED_SEED_CACHE_HPP
+#define SPACED_SEED_CACHE_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "common/ALeS.hpp"
+#include "map/include/map_parameters.hpp"
+
+namespace skch
+{
+  /**
+   * @brief     spaced seeds searched for by previous runs, one small text file per parameter set
+   * @details   the search takes seconds to minutes and its seeds only depend on the ALeS
+   *            parameters; failing to read or write a cache file only means searching again
+   */
+  class SpacedSeedCache
+  {
+    private:
+
+      //Bump when the way seeds are searched for changes
+      static constexpr int formatVersion = 1;
+
+      static std::string fileOf(const std::string& dir, const std::string& key)
+      {
+        return (std::filesystem::path(dir) / ("spaced-seeds-" + key + ".txt")).string();
+      }
+
+    public:
+
+      /**
+       * @brief               key of a seed set, from the ALeS parameters it is searched for
+       * @details             the similarity is keyed by its bits, so that only identical values match
+       */
+      static std::string key(const ales_params& params)
+      {
+        uint32_t similarityBits = 0;
+        std::memcpy(&similarityBits, &params.similarity, sizeof(similarityBits));
+        std::ostringstream ss;
+        ss << "v" << formatVersion
+          << "-w" << params.weight
+          << "-n" << params.seed_count
+          << "-p" << std::hex << similarityBits << std::dec
+          << "-r" << params.region_length;
+        return ss.str();
+      }
+
+      /**
+       * @brief               fill seeds with the cached set of params, if any
+       */
+      static bool load(const std::string& dir, const ales_params& params, ales::spaced_seeds& seeds)
+      {
+        if (dir.empty())
+          return false;
+
+        const std::string seedKey = key(params);
+        std::ifstream in(fileOf(dir, seedKey));
+        std::string storedKey;
+        size_t n = 0;
+        ales::spaced_seeds stored;
+        if (!(in >> storedKey >> stored.sensitivity >> n) || storedKey != seedKey || n != params.seed_count)
+          return false;
+
+        for (size_t i = 0; i < n; i++)
+        {
+          std::string seed;
+          if (!(in >> seed) || seed.size() > params.region_length
+              || seed.find_first_not_of("01") != std::string::npos)
+            return false;
+          char* copy = new char[seed.size() + 1];
+          std::memcpy(copy, seed.c_str(), seed.size() + 1);
+          stored.seeds.push_back(ales::spaced_seed{copy, seed.size()});
+        }
+
+        seeds = stored;
+        return true;
+      }
+
+      /**
+       * @brief               save the seeds found for params
+       * @details             written to a temporary file renamed into place, so that
+       *                      concurrent jobs never read a partial set
+       */
+      static void store(const std::string& dir, const ales_params& params, const ales::spaced_seeds& seeds)
+      {
+        if (dir.empty())
+          return;
+
+        std::error_code ec;
+        std::filesystem::create_directories(dir, ec);
+        if (ec)
+          return;
+
+        const std::string fileName = fileOf(dir, key(params));
+        const std::string tmpName = fileName + "." + std::to_string(getpid()) + ".tmp";
+        {
+          std::ofstream out(tmpName);
+          out.precision(17);
+          out << key(params) << "\n" << seeds.sensitivity << "\n" << seeds.seeds.size() << "\n";
+          for (const auto& sp : seeds.seeds)
+            out << std::string(sp.seed, sp.length) << "\n";
+          out.close();
+          if (!out)
+          {
+            std::filesystem::remove(tmpName, ec);
+            return;
+          }
+        }
+        std::filesystem::rename(tmpName, fileName, ec);
+        if (ec)
+          std::filesystem::remove(tmpName, ec);
+      }
+  };
+}
+
+#endif
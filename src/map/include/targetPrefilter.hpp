@@ -0,0 +1,173 @@
+/**
+ * @file    targetPrefilter.hpp
+ * @brief   contig-level sketches of the targets, narrowing the targets the seeds of a query
+ *          are looked up against
+ */
+
+#ifndef TARGET_PREFILTER_HPP
+#define TARGET_PREFILTER_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <utility>
+#include <vector>
+
+#include "map/include/base_types.hpp"
+
+//External includes
+#include "common/ankerl/unordered_dense.hpp"
+
+namespace skch
+{
+  /**
+   * @brief     FracMinHash sketch of each target: the hashes of its minmers below a
+   *            threshold, with the targets of each of these hashes
+   * @details   in all-vs-all runs over many contigs, the seeds of every query fragment are
+   *            looked up against all of the targets, although most share no homology with
+   *            the query. The hashes below a fixed fraction of the hash space are sampled
+   *            from the whole query, and the targets sharing at least a few of them are
+   *            the only ones its fragments are mapped on. The threshold is a fraction of
+   *            the sketch density, so that a kmer sampled is nearly always a minmer of the
+   *            windows it is in, and the sampling the same in every run
+   */
+  class TargetPrefilter
+  {
+    public:
+
+      //Sketch density over the share of the hash space sampled
+      static constexpr double thinning = 8;
+
+    private:
+
+      hash_t below = 0;
+
+      //Sampled hashes of each target, sorted, by target id
+      std::vector<uint64_t> targetOffsets;
+      std::vector<hash_t> targetHashes;
+
+      //Targets of each sampled hash, as their offset and count in hashTargets
+      ankerl::unordered_dense::map<hash_t, std::pair<uint64_t, uint32_t>> byHash;
+      std::vector<seqno_t> hashTargets;
+
+    public:
+
+      /**
+       * @brief               threshold of the hashes sampled, for sketchSize minmers per
+       *                      segLength bases
+       */
+      static hash_t thresholdFor(int sketchSize, offset_t segLength)
+      {
+        const double share = sketchSize / (double(std::max<offset_t>(1, segLength)) * thinning);
+        return share >= 1 ? std::numeric_limits<hash_t>::max() : hash_t(std::ldexp(share, 64));
+      }
+
+      /**
+       * @brief               sketch targetCount targets from their minmers
+       * @param[in] forEach   calls its argument with the target id and hash of each minmer,
+       *                      by increasing target id
+       */
+      template <typename ForEachMinmer>
+      void build(seqno_t targetCount, hash_t sampleBelow, ForEachMinmer&& forEach)
+      {
+        below = sampleBelow;
+        targetOffsets.assign(targetCount + 1, 0);
+        targetHashes.clear();
+        std::vector<std::pair<hash_t, seqno_t>> pairs;
+        forEach([&](seqno_t seqId, hash_t hash) {
+          if (hash < below)
+            pairs.emplace_back(hash, seqId);
+        });
+
+        //By target first, its hashes once each
+        std::sort(pairs.begin(), pairs.end(), [](const auto& a, const auto& b) {
+          return a.second != b.second ? a.second < b.second : a.first < b.first;
+        });
+        pairs.erase(std::unique(pairs.begin(), pairs.end()), pairs.end());
+        targetHashes.reserve(pairs.size());
+        for (const auto& p : pairs)
+        {
+          targetHashes.push_back(p.first);
+          targetOffsets[p.second + 1]++;
+        }
+        for (seqno_t seqId = 0; seqId < targetCount; seqId++)
+          targetOffsets[seqId + 1] += targetOffsets[seqId];
+
+        //Then by hash
+        std::sort(pairs.begin(), pairs.end());
+        hashTargets.clear();
+        hashTargets.reserve(pairs.size());
+        byHash.clear();
+        for (size_t i = 0; i < pairs.size(); )
+        {
+          size_t j = i;
+          while (j < pairs.size() && pairs[j].first == pairs[i].first)
+            hashTargets.push_back(pairs[j++].second);
+          byHash.emplace(pairs[i].first, std::make_pair(uint64_t(i), uint32_t(j - i)));
+          i = j;
+        }
+      }
+
+      /**
+       * @brief               hashes sampled are those below this
+       */
+      hash_t sampleBelow() const
+      {
+        return below;
+      }
+
+      /**
+       * @brief               sampled hashes of a target, which are those of a query that is
+       *                      this target, as [begin, end)
+       */
+      std::pair<const hash_t*, const hash_t*> targetSample(seqno_t seqId) const
+      {
+        return {targetHashes.data() + targetOffsets[seqId], targetHashes.data() + targetOffsets[seqId + 1]};
+      }
+
+      /**
+       * @brief               targets sharing at least minShared of the sampled hashes of a
+       *                      query, one bit per target id
+       * @param[in] sampleBegin   sampled hashes of the query, each once, up to sampleEnd
+       * @param[out] first    lowest target id admitted, targetCount if none
+       * @param[out] last     highest target id admitted plus one, 0 if none
+       */
+      void admit(const hash_t* sampleBegin, const hash_t* sampleEnd, uint32_t minShared, seqno_t targetCount,
+                 std::vector<uint64_t>& bits, seqno_t& first, seqno_t& last) const
+      {
+        bits.assign((targetCount + 63) / 64, 0);
+        first = targetCount;
+        last = 0;
+        ankerl::unordered_dense::map<seqno_t, uint32_t> shared;
+        for (const hash_t* h = sampleBegin; h != sampleEnd; ++h)
+        {
+          const auto it = byHash.find(*h);
+          if (it == byHash.end())
+            continue;
+          for (uint64_t t = it->second.first; t < it->second.first + it->second.second; t++)
+          {
+            const seqno_t seqId = hashTargets[t];
+            if (++shared[seqId] == minShared)
+            {
+              bits[seqId >> 6] |= uint64_t(1) << (seqId & 63);
+              first = std::min(first, seqId);
+              last = std::max(last, seqId + 1);
+            }
+          }
+        }
+      }
+
+      /**
+       * @brief               bytes held, for the memory accounting
+       */
+      uint64_t bytes() const
+      {
+        return targetOffsets.size() * sizeof(uint64_t) + targetHashes.size() * sizeof(hash_t)
+          + byHash.size() * (sizeof(hash_t) + sizeof(std::pair<uint64_t, uint32_t>))
+          + hashTargets.size() * sizeof(seqno_t);
+      }
+  };
+}
+
+#endif
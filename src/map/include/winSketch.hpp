@@ -13,20 +13,41 @@
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
+#include <numeric>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <sstream>
 #include <filesystem>
 namespace fs = std::filesystem;
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 //#include <zlib.h>
 
 //Own includes
 #include "map/include/base_types.hpp"
+#include "map/include/nameArena.hpp"
 #include "map/include/map_parameters.hpp"
 #include "map/include/commonFunc.hpp"
 #include "map/include/ThreadPool.hpp"
+#include "map/include/spacedSeedCache.hpp"
+#include "map/include/compressedPointLists.hpp"
+#include "map/include/targetPrefilter.hpp"
+#include "map/include/coarseLevel.hpp"
+#include "map/include/indexSectionWriter.hpp"
 
 //External includes
 #include "common/murmur3.h"
 #include "common/prettyprint.hpp"
+#include "common/page_cache.hpp"
+#include "common/probes.hpp"
+#include "common/memory_accounting.hpp"
+#include "common/numa.hpp"
+#include "common/huge_pages.hpp"
 #include "csv.h"
 
 //#include "common/sparsehash/dense_hash_map"
@@ -37,6 +58,8 @@ namespace fs = std::filesystem;
 #include "common/ankerl/unordered_dense.hpp"
 
 #include "common/seqiter.hpp"
+#include "common/mphf.hpp"
+#include "common/bloom_filter.hpp"
 
 //#include "assert.hpp"
 
@@ -61,27 +84,115 @@ namespace skch
       //algorithm parameters
       const skch::Parameters &param;
 
+      //Index shard built by this sketch, out of param.index_shards
+      int shard;
+
+      //Index file of this shard, if any
+      stdfs::path indexFilename;
+
+      //Masks of param.spaced_seeds, if sketching spaced seeds
+      CommonFunc::SpacedSeedMasks spacedSeedMasks;
+
       //Minmers that occur this or more times will be ignored (computed based on percentageThreshold)
       uint64_t freqThreshold = std::numeric_limits<uint64_t>::max();
 
       //Set of frequent seeds to be ignored
       ankerl::unordered_dense::set<hash_t> frequentSeeds;
 
+      //With index shards, the frequent seeds of all of them, see frequentSeedsOfShards
+      const ankerl::unordered_dense::set<hash_t>* shardedFrequentSeeds;
+
+      //Filter in front of frequentSeeds, as nearly all query seeds aren't frequent
+      bloom::BlockedBloomFilter frequentSeedFilter;
+
       //Make the default constructor private, non-accessible
       Sketch();
 
+      /*
+       * Read-only mapping of an on-disk index. When set, the seed lookup
+       * index is served directly from the mapped pages: a sorted hash array,
+       * CSR offsets into it and one contiguous pool of interval points
+       */
+      void* indexMapping = nullptr;
+      size_t indexMappingSize = 0;
+      uint64_t numMappedKeys = 0;
+      const MinmerMapKeyType* mappedKeys = nullptr;
+      const uint64_t* mappedOffsets = nullptr;
+      const PackedIntervalPoint* mappedPoints = nullptr;
+
+      /*
+       * Frozen lookup index: an index built in memory flattened to the same layout
+       * as a mapped one, and a minimal perfect hash over the keys of either,
+       * seedHashToKey giving the rank of each key in the sorted key array
+       */
+      std::vector<MinmerMapKeyType> frozenKeys;
+      std::vector<uint64_t> frozenOffsets;
+      std::vector<PackedIntervalPoint> frozenPoints;
+      mphf::MinimalPerfectHash seedHash;
+      std::vector<uint32_t> seedHashToKey;
+
+      //Interval points of the flattened lookup index, encoded with --compressed-index,
+      //looked up instead of mappedPoints
+      CompressedPointLists compressedPoints;
+
+      //Identifies the index layout, bump the version when it changes
+      static constexpr uint64_t indexMagic = 0x5844494d48534d57;  // "WMSHMIDX"
+      static constexpr uint64_t indexVersion = 9;
+
+      //Sections of the index file, found through the table in its header
+      enum IndexSection : uint64_t
+      {
+        SKETCH_SECTION = 1,
+        DIRECTORY_SECTION,
+        POSLIST_SECTION,
+        FREQKMERS_SECTION,
+        FREQMINMERS_SECTION,
+        SPACED_SEEDS_SECTION
+      };
+      static constexpr uint64_t indexSectionCount = 6;
+
+      struct IndexSectionEntry
+      {
+        uint64_t id;
+        uint64_t offset;
+        uint64_t size;
+        uint64_t checksum;    //as IndexSectionWriter gives it
+      };
+      std::vector<IndexSectionEntry> indexSections;
+
+      //minmerIndex and its directory are left on disk until L2 first needs them
+      bool minmerIndexPending = false;
+      uint64_t pendingMinmerCount = 0;
+      mutable std::once_flag minmerIndexLoaded;
+
+      //Contig-level sketches of the targets, built from minmerIndex on first use
+      mutable std::once_flag targetPrefilterBuilt;
+      TargetPrefilter prefilter;
+
+      //Coarse level of the index, built from minmerIndex on first use
+      mutable std::once_flag coarseLevelBuilt;
+      CoarseLevel coarse;
+
+      //Count of target sequences covered by the index read from disk
+      uint64_t indexedSeqCount = 0;
+
+      //Minmers of the frequent seeds, dropped from minmerIndex but saved so that the index can be extended
+      //and, when the queries are the targets, so that query windows can be sketched from the index
+      std::vector<MinmerInfo> frequentMinmers;
+
+      //Ids of the targets held by this index, by name, when the queries are the targets
+      ankerl::unordered_dense::map<std::string_view, seqno_t> selfSeqIds;
+
       public:
 
       using MI_Type = std::vector< MinmerInfo >;
       using MIIter_t = MI_Type::const_iterator;
-      using HF_Map_t = ankerl::unordered_dense::map<hash_t, uint64_t>;
-
-      // Frequency of each hash
-      HF_Map_t hashFreq;
-
       //Keep sequence length, name that appear in the sequence (for printing the mappings later)
       std::vector< ContigInfo > metadata;
 
+      //Names of the metadata entries
+      NameArena metadataNames;
+
       /*
        * Keep the information of what sequences come from what file#
        * Example [a, b, c] implies 
@@ -102,9 +213,29 @@ namespace skch
       //using MI_Map_t = absl::flat_hash_map< MinmerMapKeyType, MinmerMapValueType >;
       //using MI_Map_t = tsl::sparse_map< MinmerMapKeyType, MinmerMapValueType >;
       using MI_Map_t = ankerl::unordered_dense::map< MinmerMapKeyType, MinmerMapValueType >;
-      MI_Map_t minmerPosLookupIndex;
+
+      /*
+       * The lookup index is partitioned into shards by the low bits of the hash,
+       * each shard being built by its own thread. The high bits are no use here
+       * as the sketch keeps the smallest hashes, which all share leading zeros
+       */
+      std::vector<MI_Map_t> minmerPosLookupIndex;
       MI_Type minmerIndex;
 
+      //minmerIndex packed for L2 once the index is complete, minmerIndex being freed then;
+      //left unpacked if a window does not pack, see PackedMinmer
+      std::vector<PackedMinmer> packedMinmerIndex;
+      bool minmersPacked = false;
+
+      /*
+       * Directory over minmerIndex for the L2 stage:
+       * minmers of sequence i are [seqMinmerOffsets[i], seqMinmerOffsets[i+1]),
+       * and minmerDirectory[k] is the window position of minmerIndex[k * minmerDirectoryStride]
+       */
+      static constexpr size_t minmerDirectoryStride = 64;
+      std::vector<uint64_t> seqMinmerOffsets;
+      std::vector<offset_t> minmerDirectory;
+
       private:
 
       /**
@@ -117,41 +248,152 @@ namespace skch
       //[... ,x -> y, ...] implies y number of minmers occur x times
       std::map<uint64_t, uint64_t> minmerFreqHistogram;
 
+      //Rows of the count-min sketch used to spot frequent seeds while building
+      static constexpr size_t freqSketchDepth = 4;
+
+      //Per shard, seeds the count-min sketch estimated as frequent: their exact
+      //interval point count (and last window end), and the indices of their minmers
+      struct CandidateSeeds
+      {
+        ankerl::unordered_dense::map<hash_t, std::pair<uint64_t, offset_t>> pointCounts;
+        std::vector<uint64_t> minmers;
+      };
+      std::vector<CandidateSeeds> candidateSeeds;
+
+      //Count of distinct hashes held back as frequent seed candidates
+      size_t candidateSeedCount() const
+      {
+        size_t count = 0;
+        for (auto& shardCandidates : candidateSeeds)
+          count += shardCandidates.pointCounts.size();
+        return count;
+      }
+
       public:
 
       /**
        * @brief   constructor
        *          also builds, indexes the minmer table
+       * @param[in] shardedFrequentSeeds  with index shards, the seeds frequent over all of them,
+       *                                  from frequentSeedsOfShards, in place of those of this one
        */
-      Sketch(const skch::Parameters &p) 
+      Sketch(const skch::Parameters &p, int shard = 0,
+             const ankerl::unordered_dense::set<hash_t>* shardedFrequentSeeds = nullptr)
         :
-          param(p) {
-            if (param.indexFilename.empty() 
-                || !stdfs::exists(param.indexFilename)
-                || param.overwrite_index)
+          param(p),
+          shard(shard),
+          shardedFrequentSeeds(shardedFrequentSeeds),
+          indexFilename(indexFileOf(p, shard)),
+          spacedSeedMasks(p.use_spaced_seeds ? CommonFunc::SpacedSeedMasks(p.spaced_seeds) : CommonFunc::SpacedSeedMasks()) {
+            const bool indexExists = !indexFilename.empty() && stdfs::exists(indexFilename);
+            if (param.require_resident_index)
+            {
+              const double resident = indexExists ? page_cache::resident_fraction(indexFilename) : -1;
+              if (resident < 1)
+              {
+                std::cerr << "[mashmap::skch::Sketch] ERROR: index " << indexFilename << " is not resident ("
+                  << (resident < 0 ? std::string("missing") : std::to_string(int(resident * 100)) + "% of its pages in memory")
+                  << "), warm it with --warm-index first" << std::endl;
+                exit(1);
+              }
+            }
+            if (indexExists && param.append_index && !param.overwrite_index)
             {
-              this->build(true);
-              this->computeFreqHist();
+              this->readIndexForAppend();
+            }
+            if (!indexExists || param.overwrite_index || param.append_index)
+            {
+              WFMASH_PROBE(index_build_start, shard);
+              this->build(true, indexedSeqCount);
+              if (metadata.size() < indexedSeqCount)
+              {
+                std::cerr << "[mashmap::skch::Sketch] ERROR: " << indexFilename << " indexes " << indexedSeqCount
+                  << " target sequences but only " << metadata.size() << " were given" << std::endl;
+                exit(1);
+              }
+              if (shardedFrequentSeeds == nullptr)
+                this->computeFreqHist();
               this->computeFreqSeedSet();
               this->dropFreqSeedSet();
-              this->hashFreq.clear();
-              if (!param.indexFilename.empty())
+              this->buildMinmerDirectory();
+              WFMASH_PROBE(index_build_end, shard, minmerCount());
+              if (!indexFilename.empty())
               {
                 this->writeIndex();
               }
-              if (param.create_index_only)
+              if (!selfMapping())
+                this->frequentMinmers.clear();
+              if (param.create_index_only && shard == param.index_shards - 1)
               {
                 std::cerr << "[mashmap::skch::Sketch] Index created successfully. Exiting." << std::endl;
                 exit(0);
               }
             } else {
+              WFMASH_PROBE(index_load_start, shard);
               this->build(false);
               this->readIndex();
+              WFMASH_PROBE(index_load_end, shard, minmerCount());
+            }
+            this->buildFreqSeedFilter();
+            if (param.freeze_index)
+            {
+              this->freezeLookupIndex();
+            }
+            if (param.compress_index)
+            {
+              this->compressLookupIndex();
             }
-            std::cerr << "[mashmap::skch::Sketch] Unique minmer hashes after pruning = " << (minmerPosLookupIndex.size() - this->frequentSeeds.size()) << std::endl;
-            std::cerr << "[mashmap::skch::Sketch] Total minmer windows after pruning = " << minmerIndex.size() << std::endl;
+            if (selfMapping())
+            {
+              this->indexSelfSeqIds();
+            }
+            this->packMinmerIndex();
+            this->placeIndexPages();
+            this->accountMemory();
+            std::cerr << "[mashmap::skch::Sketch] Unique minmer hashes after pruning = " << uniqueMinmerCount() << std::endl;
+            std::cerr << "[mashmap::skch::Sketch] Total minmer windows after pruning = " << minmerCount() << std::endl;
           }
 
+      Sketch(const Sketch&) = delete;
+      Sketch& operator=(const Sketch&) = delete;
+
+      ~Sketch()
+      {
+        if (indexMapping != nullptr)
+          munmap(indexMapping, indexMappingSize);
+        for (auto pool : {memory_accounting::index_minmers, memory_accounting::index_lookup, memory_accounting::index_mapped,
+                          memory_accounting::index_frequent_seeds, memory_accounting::index_directory, memory_accounting::index_names})
+          memory_accounting::set(pool, 0);
+      }
+
+      /**
+       * @brief  Bytes reserved by each structure of the index, for memory_accounting
+       */
+      void accountMemory() const
+      {
+        using namespace memory_accounting;
+        set(index_minmers, (minmerIndex.capacity() + frequentMinmers.capacity()) * sizeof(MinmerInfo)
+          + packedMinmerIndex.capacity() * sizeof(PackedMinmer));
+        uint64_t lookup = frozenKeys.capacity() * sizeof(MinmerMapKeyType) + frozenOffsets.capacity() * sizeof(uint64_t)
+          + frozenPoints.capacity() * sizeof(PackedIntervalPoint) + seedHash.bytes() + seedHashToKey.capacity() * sizeof(uint32_t)
+          + compressedPoints.bytes() + prefilter.bytes() + coarse.bytes();
+        for (const auto& shardIndex : minmerPosLookupIndex)
+        {
+          lookup += shardIndex.values().capacity() * sizeof(MI_Map_t::value_type)
+            + shardIndex.bucket_count() * sizeof(MI_Map_t::bucket_type);
+          for (const auto& entry : shardIndex)
+            lookup += entry.second.capacity() * sizeof(PackedIntervalPoint);
+        }
+        set(index_lookup, lookup);
+        set(index_mapped, indexMapping != nullptr ? indexMappingSize : 0);
+        set(index_frequent_seeds, frequentSeeds.values().capacity() * sizeof(hash_t)
+          + frequentSeeds.bucket_count() * sizeof(decltype(frequentSeeds)::bucket_type) + frequentSeedFilter.bytes());
+        set(index_directory, seqMinmerOffsets.capacity() * sizeof(uint64_t) + minmerDirectory.capacity() * sizeof(offset_t));
+        set(index_names, metadata.capacity() * sizeof(ContigInfo) + metadataNames.bytes()
+          + selfSeqIds.values().capacity() * sizeof(decltype(selfSeqIds)::value_type)
+          + selfSeqIds.bucket_count() * sizeof(decltype(selfSeqIds)::bucket_type));
+      }
+
       private:
 
       /**
@@ -160,8 +402,9 @@ namespace skch
        * @details   Iterate through ref sequences to get metadata and
        *            optionally compute and save minmers from the reference sequence(s)
        *            assuming a fixed window size
+       * @param[in] firstSeqToSketch  sequences before this one are already in the index
        */
-      void build(bool compute_seeds)
+      void build(bool compute_seeds, seqno_t firstSeqToSketch = 0)
       {
 
         // allowed set of targets
@@ -175,9 +418,15 @@ namespace skch
         }
 		
 
+        if (compute_seeds && param.index_shards > 1)
+          std::cerr << "[mashmap::skch::Sketch::build] Building index shard " << shard + 1 << "/" << param.index_shards << std::endl;
+
         //sequence counter while parsing file
         seqno_t seqCounter = 0;
 
+        //minmers from here on are new to the lookup index
+        const size_t firstNewMinmer = minmerIndex.size();
+
         //Create the thread pool 
         ThreadPool<InputSeqContainer, MI_Type> threadPool( [this](InputSeqContainer* e) {return buildHelper(e);}, param.threads);
 
@@ -188,17 +437,21 @@ namespace skch
         std::cerr << "[mashmap::skch::Sketch::build] building minmer index for " << fileName << std::endl;
 #endif
 
-        seqiter::for_each_seq_in_file(
+        seqiter::for_each_owned_seq_in_file_parallel(
             fileName,
             allowed_target_names,
             param.target_prefix,
+            param.threads,
             [&](const std::string& seq_name,
-                const std::string& seq) {
+                std::string&& seq) {
                 // todo: offset_t is an 32-bit integer, which could cause problems
                 offset_t len = seq.length();
 
+                if (param.keep_sequence)
+                    param.keep_sequence(fileName, seq_name, seq);
+
                 //Save the sequence name
-                metadata.push_back( ContigInfo{seq_name, len} );
+                metadata.push_back( ContigInfo{metadataNames.store(seq_name), len} );
 
                 //Is the sequence too short?
                 if(len < param.kmerSize)
@@ -209,8 +462,9 @@ namespace skch
                 }
                 else
                 {
-                  if (compute_seeds) {
-                    threadPool.runWhenThreadAvailable(new InputSeqContainer(seq, seq_name, seqCounter));
+                  // Sequences are dealt round-robin to the index shards
+                  if (compute_seeds && seqCounter >= firstSeqToSketch && seqCounter % param.index_shards == shard) {
+                    threadPool.runWhenThreadAvailable(new InputSeqContainer(std::move(seq), seq_name, seqCounter));
                     
                     //Collect output if available
                     while ( threadPool.outputAvailable() )
@@ -233,7 +487,8 @@ namespace skch
           //Collect remaining output objects
           while ( threadPool.running() )
             this->buildHandleThreadOutput(threadPool.popOutputWhenAvailable());
-          std::cerr << "[mashmap::skch::Sketch::build] Unique minmer hashes before pruning = " << minmerPosLookupIndex.size() << std::endl;
+          this->buildPosLookupIndex(minmerIndex, firstNewMinmer, param.kmer_freq_sketch && firstNewMinmer == 0);
+          std::cerr << "[mashmap::skch::Sketch::build] Unique minmer hashes before pruning = " << uniqueMinmerCount() + candidateSeedCount() << std::endl;
           std::cerr << "[mashmap::skch::Sketch::build] Total minmer windows before pruning = " << minmerIndex.size() << std::endl;
         }
       }
@@ -257,7 +512,10 @@ namespace skch
                 param.segLength, 
                 param.alphabetSize, 
                 param.sketchSize,
-                input->seqCounter);
+                input->seqCounter,
+                param.rolling_hash,
+                spacedSeedMasks.ifUsed(),
+                syncmerSize());
 
         return thread_output;
       }
@@ -268,20 +526,6 @@ namespace skch
        */
       void buildHandleThreadOutput(MI_Type* contigMinmerIndex)
       {
-        for (MinmerInfo& mi : *contigMinmerIndex)
-        {
-          this->hashFreq[mi.hash]++;
-          if (minmerPosLookupIndex[mi.hash].size() == 0 
-                  || minmerPosLookupIndex[mi.hash].back().hash != mi.hash 
-                  || minmerPosLookupIndex[mi.hash].back().pos != mi.wpos)
-            {
-              minmerPosLookupIndex[mi.hash].push_back(IntervalPoint {mi.wpos, mi.hash, mi.seqId, side::OPEN});
-              minmerPosLookupIndex[mi.hash].push_back(IntervalPoint {mi.wpos_end, mi.hash, mi.seqId, side::CLOSE});
-            } else {
-              minmerPosLookupIndex[mi.hash].back().pos = mi.wpos_end;
-          }
-        }
-
         this->minmerIndex.insert(
             this->minmerIndex.end(), 
             std::make_move_iterator(contigMinmerIndex->begin()), 
@@ -290,6 +534,174 @@ namespace skch
         delete contigMinmerIndex;
       }
 
+      /**
+       * @brief     shard of the lookup index holding a hash
+       */
+      size_t shardOf(hash_t h) const
+      {
+        return h & (minmerPosLookupIndex.size() - 1);
+      }
+
+      /**
+       * @brief     allocate the shards of the position lookup index, if not done yet
+       */
+      void initPosLookupShards()
+      {
+        if (!minmerPosLookupIndex.empty())
+          return;
+        size_t numShards = 1;
+        while (numShards < 4 * std::max<size_t>(1, param.threads) && numShards < 1024)
+          numShards <<= 1;
+        minmerPosLookupIndex.assign(numShards, MI_Map_t());
+      }
+
+      /**
+       * @brief     append a minmer to its interval points,
+       *            consecutive windows of a hash being merged into one interval
+       */
+      static void addIntervalPoints(MinmerMapValueType& ipVec, const MinmerInfo& mi)
+      {
+        if (ipVec.size() == 0 || ipVec.back().pos() != mi.wpos)
+        {
+          ipVec.push_back(PackedIntervalPoint {mi.wpos, mi.seqId, side::OPEN});
+          ipVec.push_back(PackedIntervalPoint {mi.wpos_end, mi.seqId, side::CLOSE});
+        } else {
+          ipVec.back().setPos(mi.wpos_end);
+        }
+      }
+
+      /**
+       * @brief     build the sharded position lookup index from a minmer table, in parallel
+       * @details   minmers are first bucketed by shard over contiguous chunks of the table,
+       *            then each shard replays its buckets in chunk order so that the interval
+       *            points of every hash stay sorted by seqId and position
+       *
+       *            With the frequency sketch, the bucketing pass also fills a count-min sketch
+       *            of the hashes. Hashes it estimates to be frequent are only counted; their
+       *            interval points are added by computeFreqSeedSet() if they turn out not to
+       *            be frequent after all
+       * @param[in] minmers       minmer table, ordered by seqId and position
+       * @param[in] firstMinmer   minmers before this one are already in the lookup index;
+       *                          they must belong to sequences before the new ones
+       * @param[in] useFreqSketch prune frequent seeds with the count-min sketch
+       */
+      void buildPosLookupIndex(const MI_Type& minmers, size_t firstMinmer, bool useFreqSketch)
+      {
+        if (metadata.size() > (size_t(1) << PackedIntervalPoint::seqIdBits))
+        {
+          std::cerr << "[mashmap::skch::Sketch::build] ERROR: the index supports at most "
+            << (size_t(1) << PackedIntervalPoint::seqIdBits) << " target sequences" << std::endl;
+          exit(1);
+        }
+        for (const auto& contig : metadata)
+        {
+          if (contig.len > (offset_t)PackedIntervalPoint::posMask)
+          {
+            std::cerr << "[mashmap::skch::Sketch::build] ERROR: target sequence " << contig.name
+              << " is longer than the " << PackedIntervalPoint::posMask << "bp supported by the index" << std::endl;
+            exit(1);
+          }
+        }
+
+        const size_t numThreads = std::max(1, param.threads);
+        initPosLookupShards();
+        const size_t numShards = minmerPosLookupIndex.size();
+
+        // Count-min sketch: freqSketchDepth rows of freqSketchWidth counters
+        size_t freqSketchWidth = 1;
+        if (useFreqSketch)
+        {
+          while (freqSketchWidth < (minmers.size() - firstMinmer) / 4 && freqSketchWidth < (size_t(1) << 28))
+            freqSketchWidth <<= 1;
+          candidateSeeds.assign(numShards, CandidateSeeds());
+        }
+        std::vector<std::atomic<uint32_t>> freqSketch(useFreqSketch ? freqSketchDepth * freqSketchWidth : 0);
+        const auto freqSketchCell = [freqSketchWidth](hash_t h, size_t row) {
+          // murmur3 fmix64 with a per-row seed, as shards already use the low bits
+          h ^= (row + 1) * 0x9e3779b97f4a7c15ULL;
+          h ^= h >> 33; h *= 0xff51afd7ed558ccdULL;
+          h ^= h >> 33; h *= 0xc4ceb9fe1a85ec53ULL;
+          h ^= h >> 33;
+          return row * freqSketchWidth + (h & (freqSketchWidth - 1));
+        };
+
+        const size_t chunkSize = (minmers.size() - firstMinmer + numThreads - 1) / numThreads;
+        std::vector<std::vector<std::vector<uint64_t>>> buckets(numThreads, std::vector<std::vector<uint64_t>>(numShards));
+
+        std::vector<std::thread> workers;
+        for (size_t t = 0; t < numThreads; t++)
+        {
+          workers.emplace_back([&, t]() {
+            const size_t chunkEnd = std::min(minmers.size(), firstMinmer + (t + 1) * chunkSize);
+            for (size_t idx = firstMinmer + t * chunkSize; idx < chunkEnd; idx++)
+            {
+              buckets[t][shardOf(minmers[idx].hash)].push_back(idx);
+              for (size_t row = 0; row < freqSketch.size() / freqSketchWidth; row++)
+                freqSketch[freqSketchCell(minmers[idx].hash, row)].fetch_add(1, std::memory_order_relaxed);
+            }
+          });
+        }
+        for (auto& w : workers)
+          w.join();
+        workers.clear();
+
+        const auto estimatedCount = [&](hash_t h) {
+          uint32_t count = std::numeric_limits<uint32_t>::max();
+          for (size_t row = 0; row < freqSketchDepth; row++)
+            count = std::min(count, freqSketch[freqSketchCell(h, row)].load(std::memory_order_relaxed));
+          return count;
+        };
+
+        std::atomic<size_t> nextShard(0);
+        for (size_t t = 0; t < numThreads; t++)
+        {
+          workers.emplace_back([&]() {
+            for (size_t shard = nextShard++; shard < numShards; shard = nextShard++)
+            {
+              MI_Map_t& shardIndex = minmerPosLookupIndex[shard];
+              for (size_t c = 0; c < numThreads; c++)
+              {
+                for (uint64_t idx : buckets[c][shard])
+                {
+                  const MinmerInfo& mi = minmers[idx];
+                  if (useFreqSketch && estimatedCount(mi.hash) >= skch::fixed::freq_sketch_min_count)
+                  {
+                    // Count the interval points without storing them
+                    auto& candidate = candidateSeeds[shard].pointCounts[mi.hash];
+                    if (candidate.first == 0 || candidate.second != mi.wpos)
+                      candidate.first += 2;
+                    candidate.second = mi.wpos_end;
+                    candidateSeeds[shard].minmers.push_back(idx);
+                  } else {
+                    addIntervalPoints(shardIndex[mi.hash], mi);
+                  }
+                }
+                std::vector<uint64_t>().swap(buckets[c][shard]);
+              }
+            }
+          });
+        }
+        for (auto& w : workers)
+          w.join();
+      }
+
+
+      /**
+       * @brief     compute the per sequence offsets and the position directory of minmerIndex
+       */
+      void buildMinmerDirectory()
+      {
+        seqMinmerOffsets.assign(metadata.size() + 1, 0);
+        for (const auto& mi : minmerIndex)
+          seqMinmerOffsets[mi.seqId + 1]++;
+        std::partial_sum(seqMinmerOffsets.begin(), seqMinmerOffsets.end(), seqMinmerOffsets.begin());
+
+        minmerDirectory.clear();
+        minmerDirectory.reserve(minmerIndex.size() / minmerDirectoryStride + 1);
+        for (size_t idx = 0; idx < minmerIndex.size(); idx += minmerDirectoryStride)
+          minmerDirectory.push_back(minmerIndex[idx].wpos);
+      }
+
 
       /**
        * @brief  Write sketch as tsv. TSV indexing is slower but can be debugged easier
@@ -297,7 +709,7 @@ namespace skch
       void writeSketchTSV() 
       {
         std::ofstream outStream;
-        outStream.open(std::string(param.indexFilename) + ".tsv");
+        outStream.open(std::string(indexFilename) + ".tsv");
         outStream << "seqId" << "\t" << "strand" << "\t" << "start" << "\t" << "end" << "\t" << "hash\n";
         for (auto& mi : this->minmerIndex) {
           outStream << mi.seqId << "\t" << std::to_string(mi.strand) << "\t" << mi.wpos << "\t" << mi.wpos_end << "\t" << mi.hash << "\n";
@@ -309,73 +721,233 @@ namespace skch
       /**
        * @brief  Write sketch for quick loading
        */
-      void writeSketchBinary(std::ofstream& outStream) 
+      void writeSketchBinary(IndexSectionWriter& section) 
+      {
+        section.addValue<typename MI_Type::size_type>(minmerIndex.size());
+        section.add(minmerIndex.data(), minmerIndex.size() * sizeof(MinmerInfo));
+      }
+
+      /**
+       * @brief  Write the directory of minmerIndex
+       */
+      void writeMinmerDirectoryBinary(IndexSectionWriter& section) 
       {
-        typename MI_Type::size_type size = minmerIndex.size();
-        outStream.write((char*)&size, sizeof(size));
-        outStream.write((char*)&minmerIndex[0], minmerIndex.size() * sizeof(MinmerInfo));
+        section.addValue<uint64_t>(seqMinmerOffsets.size());
+        section.add(seqMinmerOffsets.data(), seqMinmerOffsets.size() * sizeof(uint64_t));
+        section.addValue<uint64_t>(minmerDirectory.size());
+        section.add(minmerDirectory.data(), minmerDirectory.size() * sizeof(offset_t));
       }
 
       /**
        * @brief  Write posList for quick loading
+       * @details Layout is a sorted hash array, numKeys+1 CSR offsets and the
+       *          concatenated interval points, so that it can be mmap'ed as is;
+       *          the lookup index is flattened into these arrays first
        */
-      void writePosListBinary(std::ofstream& outStream) 
+      void writePosListBinary(IndexSectionWriter& section) 
       {
-        typename MI_Map_t::size_type size = minmerPosLookupIndex.size();
-        outStream.write((char*)&size, sizeof(size));
+        section.addValue<uint64_t>(numMappedKeys);
+        section.add(mappedKeys, numMappedKeys * sizeof(MinmerMapKeyType));
+        section.add(mappedOffsets, (numMappedKeys + 1) * sizeof(uint64_t));
+        section.add(mappedPoints, mappedOffsets[numMappedKeys] * sizeof(PackedIntervalPoint));
+      }
+
+
+      /**
+       * @brief  Write the frequent seeds
+       */
+      void writeFreqKmersBinary(IndexSectionWriter& section) 
+      {
+        section.addValue<typename MI_Map_t::size_type>(frequentSeeds.size());
+        section.add(frequentSeeds.values().data(), frequentSeeds.size() * sizeof(MinmerMapKeyType));
+      }
+
 
-        for (auto& [hash, ipVec] : minmerPosLookupIndex) 
+      /**
+       * @brief  Write the minmers of frequent seeds, only read back when extending the index
+       */
+      void writeFrequentMinmersBinary(IndexSectionWriter& section) 
+      {
+        section.addValue<typename MI_Type::size_type>(frequentMinmers.size());
+        section.add(frequentMinmers.data(), frequentMinmers.size() * sizeof(MinmerInfo));
+      }
+
+      /**
+       * @brief  Write the spaced seeds sketched, with the ALeS parameters they were searched
+       *         for and their sensitivity, so that a run loading the index needs no search
+       */
+      void writeSpacedSeedsBinary(IndexSectionWriter& section)
+      {
+        uint64_t count = param.use_spaced_seeds ? param.spaced_seeds.size() : 0;
+        section.addValue(count);
+        section.add(&param.spaced_seed_params, sizeof(param.spaced_seed_params));
+        section.add(&param.spaced_seed_sensitivity, sizeof(param.spaced_seed_sensitivity));
+        for (uint64_t i = 0; i < count; i++)
         {
-          MinmerMapKeyType key = hash;
-          outStream.write((char*)&key, sizeof(key));
-          typename MI_Type::size_type size = ipVec.size();
-          outStream.write((char*)&size, sizeof(size));
-          outStream.write((char*)&ipVec[0], ipVec.size() * sizeof(MinmerMapValueType::value_type));
+          section.addValue<uint64_t>(param.spaced_seeds[i].length);
+          section.add(param.spaced_seeds[i].seed, param.spaced_seeds[i].length);
         }
       }
 
 
       /**
-       * @brief  Write posList for quick loading
+       * @brief  Fingerprint of every parameter changing the content of the index
        */
-      void writeFreqKmersBinary(std::ofstream& outStream) 
+      uint64_t parameterFingerprint() const
       {
-        typename MI_Map_t::size_type size = frequentSeeds.size();
-        outStream.write((char*)&size, sizeof(size));
-
-        for (hash_t kmerHash : frequentSeeds) 
+        std::ostringstream desc;
+        desc << "k=" << param.kmerSize << ";s=" << param.sketchSize << ";l=" << param.segLength
+          << ";a=" << param.alphabetSize << ";pct=" << param.kmer_pct_threshold
+          << ";shard=" << shard << "/" << param.index_shards
+          << ";hash=" << (param.rolling_hash ? "rolling" : "murmur3")
+          << ";sampling=" << param.sampling_scheme << "/" << syncmerSize();
+        if (spacedSeedMasks.ifUsed() != nullptr)
         {
-          MinmerMapKeyType key = kmerHash;
-          outStream.write((char*)&key, sizeof(key));
+          desc << ";seeds=";
+          for (const auto& sp : param.spaced_seeds)
+            desc << std::string(sp.seed, sp.length) << ",";
         }
+        return fingerprintOf(desc.str());
+      }
+
+      /**
+       * @brief  Fingerprint of the target files and of the target selection
+       * @details Files are identified by name and size, so that an index moved
+       *          along with its inputs is still recognized
+       */
+      uint64_t inputFingerprint() const
+      {
+        std::ostringstream desc;
+        std::error_code ec;
+        for (const auto& fileName : param.refSequences)
+          desc << stdfs::path(fileName).filename().string() << ":" << stdfs::file_size(fileName, ec) << ";";
+        desc << "prefix=" << param.target_prefix << ";list=";
+        if (!param.target_list.empty())
+          desc << stdfs::file_size(param.target_list, ec);
+        return fingerprintOf(desc.str());
       }
 
+      static uint64_t fingerprintOf(const std::string& desc)
+      {
+        uint64_t data[2];
+        MurmurHash3_x64_128(desc.data(), desc.size(), 42, data);
+        return data[0];
+      }
 
       /**
        * @brief Write parameters 
+       * @details The section table is left zeroed, writeIndex fills it in at the end
        */
       void writeParameters(std::ofstream& outStream)
       {
+        outStream.write((char*) &indexMagic, sizeof(indexMagic));
+        outStream.write((char*) &indexVersion, sizeof(indexVersion));
+
         // Write segment length, sketch size, and kmer size
         outStream.write((char*) &param.segLength, sizeof(param.segLength));
         outStream.write((char*) &param.sketchSize, sizeof(param.sketchSize));
         outStream.write((char*) &param.kmerSize, sizeof(param.kmerSize));
+
+        // Write the kmer sampling scheme
+        outStream.write((char*) &param.sampling_scheme, sizeof(param.sampling_scheme));
+        outStream.write((char*) &param.syncmer_size, sizeof(param.syncmer_size));
+
+        // Count of target sequences in the index
+        uint64_t seqCount = metadata.size();
+        outStream.write((char*) &seqCount, sizeof(seqCount));
+
+        uint64_t fingerprint = parameterFingerprint();
+        outStream.write((char*) &fingerprint, sizeof(fingerprint));
+        fingerprint = inputFingerprint();
+        outStream.write((char*) &fingerprint, sizeof(fingerprint));
+
+        indexSections.assign(indexSectionCount, IndexSectionEntry{0, 0, 0, 0});
+        outStream.write((char*) &indexSectionCount, sizeof(indexSectionCount));
+        outStream.write((char*) indexSections.data(), indexSections.size() * sizeof(IndexSectionEntry));
       }
 
 
       /**
        * @brief  Write all index data structures to disk
+       * @details Each section goes out in one write per array, checksummed on the way
        */
       void writeIndex() 
       {
-        fs::path freqListFilename = fs::path(param.indexFilename);
+        flattenLookupIndex();
+        fs::path freqListFilename = fs::path(indexFilename);
         std::ofstream outStream;
         outStream.open(freqListFilename, std::ios::binary);
 
         writeParameters(outStream);
-        writeSketchBinary(outStream);
-        writePosListBinary(outStream);
-        writeFreqKmersBinary(outStream);
+        const std::streampos sectionTablePos = outStream.tellp() - std::streamoff(indexSectionCount * sizeof(IndexSectionEntry));
+
+        const auto writeSection = [&](IndexSection id, auto writer) {
+          const uint64_t offset = outStream.tellp();
+          IndexSectionWriter section(outStream, param.threads);
+          (this->*writer)(section);
+          const uint64_t checksum = section.finish();
+          indexSections[id - 1] = IndexSectionEntry{id, offset, uint64_t(outStream.tellp()) - offset, checksum};
+        };
+        writeSection(SKETCH_SECTION, &Sketch::writeSketchBinary);
+        writeSection(DIRECTORY_SECTION, &Sketch::writeMinmerDirectoryBinary);
+        writeSection(POSLIST_SECTION, &Sketch::writePosListBinary);
+        writeSection(FREQKMERS_SECTION, &Sketch::writeFreqKmersBinary);
+        writeSection(FREQMINMERS_SECTION, &Sketch::writeFrequentMinmersBinary);
+        writeSection(SPACED_SEEDS_SECTION, &Sketch::writeSpacedSeedsBinary);
+
+        outStream.seekp(sectionTablePos);
+        outStream.write((char*) indexSections.data(), indexSections.size() * sizeof(IndexSectionEntry));
+        if (!outStream)
+        {
+          std::cerr << "[mashmap::skch::Sketch::writeIndex] ERROR: failed to write index " << indexFilename << std::endl;
+          exit(1);
+        }
+      }
+
+      /**
+       * @brief  Position inStream at the start of a section of the index
+       */
+      void seekIndexSection(std::ifstream& inStream, IndexSection id) const
+      {
+        for (const auto& section : indexSections)
+        {
+          if (section.id == id)
+          {
+            inStream.seekg(section.offset);
+            return;
+          }
+        }
+        std::cerr << "[mashmap::skch::Sketch::readIndex] ERROR: index " << indexFilename << " has no section " << id << std::endl;
+        exit(1);
+      }
+
+      /**
+       * @brief  Check a section of the mapped index file against its checksum
+       */
+      void verifyIndexSection(IndexSection id) const
+      {
+        for (const auto& section : indexSections)
+        {
+          if (section.id != id)
+            continue;
+          const char* data = (const char*)indexMapping + section.offset;
+          bool intact = section.offset + section.size <= indexMappingSize;
+          if (intact)
+          {
+            // read in ahead of the hashing, the mapping is read at random otherwise
+            const uintptr_t page = sysconf(_SC_PAGESIZE);
+            const uintptr_t begin = uintptr_t(data) & ~(page - 1);
+            madvise((void*)begin, uintptr_t(data) + section.size - begin, MADV_WILLNEED);
+            intact = IndexSectionWriter::checksum(data, section.size, param.threads) == section.checksum;
+          }
+          if (!intact)
+          {
+            std::cerr << "[mashmap::skch::Sketch::readIndex] ERROR: index " << indexFilename << " is corrupt in section " << id
+              << ", rebuild it with --overwrite-mm-index" << std::endl;
+            exit(1);
+          }
+          return;
+        }
       }
 
       /**
@@ -383,7 +955,7 @@ namespace skch
        */
       void readSketchTSV() 
       {
-        io::CSVReader<5, io::trim_chars<' '>, io::no_quote_escape<'\t'>> inReader(std::string(param.indexFilename) + ".tsv");
+        io::CSVReader<5, io::trim_chars<' '>, io::no_quote_escape<'\t'>> inReader(std::string(indexFilename) + ".tsv");
         inReader.read_header(io::ignore_missing_column, "seqId", "strand", "start", "end", "hash");
         hash_t hash;
         offset_t start, end;
@@ -407,24 +979,183 @@ namespace skch
       }
 
       /**
-       * @brief  Save posList for quick reading
+       * @brief  Read the sketch into packedMinmerIndex, a chunk at a time so that the unpacked
+       *         minmers are never all held
+       * @return false, with the stream back at the sketch, if a window does not pack
        */
-      void readPosListBinary(std::ifstream& inStream) 
+      bool readPackedSketchBinary(std::ifstream& inStream)
       {
-        typename MI_Map_t::size_type numKeys = 0;
-        inStream.read((char*)&numKeys, sizeof(numKeys));
-        minmerPosLookupIndex.reserve(numKeys);
+        const std::streampos sketchBegin = inStream.tellg();
+        typename MI_Type::size_type size = 0;
+        inStream.read((char*)&size, sizeof(size));
+        packedMinmerIndex.reserve(size);
+        MI_Type chunk;
+        for (typename MI_Type::size_type done = 0; done < size; done += chunk.size())
+        {
+          chunk.resize(std::min<typename MI_Type::size_type>(size - done, packChunkMinmers));
+          inStream.read((char*)chunk.data(), chunk.size() * sizeof(MinmerInfo));
+          for (const auto& mi : chunk)
+          {
+            if (!PackedMinmer::packs(mi))
+            {
+              std::vector<PackedMinmer>().swap(packedMinmerIndex);
+              inStream.seekg(sketchBegin);
+              return false;
+            }
+            packedMinmerIndex.emplace_back(mi);
+          }
+        }
+        minmersPacked = true;
+        return true;
+      }
 
-        for (auto idx = 0; idx < numKeys; idx++) 
+      //Minmers read at a time by readPackedSketchBinary
+      static constexpr size_t packChunkMinmers = 1 << 16;
+
+      /**
+       * @brief  Pack minmerIndex for L2 and free it, unless a window does not pack
+       */
+      void packMinmerIndex()
+      {
+        if (minmerIndexPending || minmersPacked)
+          return;
+        if (!std::all_of(minmerIndex.begin(), minmerIndex.end(), [](const MinmerInfo& mi) { return PackedMinmer::packs(mi); }))
+          return;
+        packedMinmerIndex.reserve(minmerIndex.size());
+        for (const auto& mi : minmerIndex)
+          packedMinmerIndex.emplace_back(mi);
+        MI_Type().swap(minmerIndex);
+        minmersPacked = true;
+      }
+
+      /**
+       * @brief  Read the directory of minmerIndex
+       */
+      void readMinmerDirectoryBinary(std::ifstream& inStream) 
+      {
+        uint64_t size = 0;
+        inStream.read((char*)&size, sizeof(size));
+        seqMinmerOffsets.resize(size);
+        inStream.read((char*)seqMinmerOffsets.data(), size * sizeof(uint64_t));
+        inStream.read((char*)&size, sizeof(size));
+        minmerDirectory.resize(size);
+        inStream.read((char*)minmerDirectory.data(), size * sizeof(offset_t));
+      }
+
+      /**
+       * @brief  Read the minmers of frequent seeds
+       */
+      void readFrequentMinmersBinary(std::ifstream& inStream) 
+      {
+        typename MI_Type::size_type size = 0;
+        inStream.read((char*)&size, sizeof(size));
+        frequentMinmers.resize(size);
+        inStream.read((char*)frequentMinmers.data(), frequentMinmers.size() * sizeof(MinmerInfo));
+      }
+
+      /**
+       * @brief  Spaced seeds an index was sketched with, if it was built with seeds searched
+       *         for the ALeS parameters of p
+       * @return whether p.spaced_seeds and p.spaced_seed_sensitivity were set from the index
+       */
+      static bool readIndexedSpacedSeeds(const stdfs::path& indexFile, Parameters& p)
+      {
+        std::ifstream inStream(indexFile, std::ios::binary);
+        uint64_t index_magic = 0;
+        uint64_t index_version = 0;
+        inStream.read((char*) &index_magic, sizeof(index_magic));
+        inStream.read((char*) &index_version, sizeof(index_version));
+        if (!inStream || index_magic != indexMagic || index_version != indexVersion)
+          return false;
+
+        // the fields of the header ahead of the section table, as writeParameters writes them
+        inStream.seekg(sizeof(p.segLength) + sizeof(p.sketchSize) + sizeof(p.kmerSize)
+                         + sizeof(p.sampling_scheme) + sizeof(p.syncmer_size) + 3 * sizeof(uint64_t),
+                       std::ios::cur);
+        uint64_t numSections = 0;
+        inStream.read((char*) &numSections, sizeof(numSections));
+        std::vector<IndexSectionEntry> sections(inStream ? numSections : 0);
+        inStream.read((char*) sections.data(), sections.size() * sizeof(IndexSectionEntry));
+        auto section = std::find_if(sections.begin(), sections.end(),
+                                    [](const IndexSectionEntry& e) { return e.id == SPACED_SEEDS_SECTION; });
+        if (!inStream || section == sections.end())
+          return false;
+
+        inStream.seekg(section->offset);
+        uint64_t count = 0;
+        ales_params params;
+        double sensitivity = 0;
+        inStream.read((char*)&count, sizeof(count));
+        inStream.read((char*)&params, sizeof(params));
+        inStream.read((char*)&sensitivity, sizeof(sensitivity));
+        if (!inStream || count == 0
+            || params.weight != p.spaced_seed_params.weight
+            || params.seed_count != p.spaced_seed_params.seed_count
+            || params.similarity != p.spaced_seed_params.similarity
+            || params.region_length != p.spaced_seed_params.region_length)
+          return false;
+
+        std::vector<ales::spaced_seed> seeds;
+        for (uint64_t i = 0; i < count; i++)
         {
-          MinmerMapKeyType key = 0;
-          inStream.read((char*)&key, sizeof(key));
-          typename MinmerMapValueType::size_type size = 0;
-          inStream.read((char*)&size, sizeof(size));
+          uint64_t length = 0;
+          inStream.read((char*)&length, sizeof(length));
+          if (!inStream || length > 64)
+            return false;
+          char* seed = new char[length + 1]();
+          inStream.read(seed, length);
+          seeds.push_back(ales::spaced_seed{seed, length});
+        }
+        if (!inStream)
+          return false;
+        p.spaced_seeds = seeds;
+        p.spaced_seed_sensitivity = sensitivity;
+        return true;
+      }
+
+      /**
+       * @brief  Map posList read-only from the index file, without copying it
+       * @details Leaves inStream positioned right after the posList section
+       */
+      void readPosListBinary(std::ifstream& inStream) 
+      {
+        const size_t sectionBegin = inStream.tellg();
 
-          minmerPosLookupIndex[key].resize(size);
-          inStream.read((char*)&minmerPosLookupIndex[key][0], size * sizeof(MinmerMapValueType::value_type));
+        int fd = open(indexFilename.c_str(), O_RDONLY);
+        struct stat st;
+        if (fd == -1 || fstat(fd, &st) == -1)
+        {
+          std::cerr << "[mashmap::skch::Sketch::readIndex] ERROR: cannot open index " << indexFilename << std::endl;
+          exit(1);
         }
+        indexMappingSize = st.st_size;
+        indexMapping = mmap(nullptr, indexMappingSize, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (indexMapping == MAP_FAILED)
+        {
+          indexMapping = nullptr;
+          std::cerr << "[mashmap::skch::Sketch::readIndex] ERROR: cannot mmap index " << indexFilename << std::endl;
+          exit(1);
+        }
+        // Seed lookups hit random pages, don't let the kernel read ahead
+        madvise(indexMapping, indexMappingSize, MADV_RANDOM);
+
+        const char* cursor = (const char*)indexMapping + sectionBegin;
+        numMappedKeys = *(const uint64_t*)cursor;
+        cursor += sizeof(uint64_t);
+        mappedKeys = (const MinmerMapKeyType*)cursor;
+        cursor += numMappedKeys * sizeof(MinmerMapKeyType);
+        mappedOffsets = (const uint64_t*)cursor;
+        cursor += (numMappedKeys + 1) * sizeof(uint64_t);
+        mappedPoints = (const PackedIntervalPoint*)cursor;
+        cursor += mappedOffsets[numMappedKeys] * sizeof(PackedIntervalPoint);
+
+        if (cursor > (const char*)indexMapping + indexMappingSize)
+        {
+          std::cerr << "[mashmap::skch::Sketch::readIndex] ERROR: index " << indexFilename << " is truncated" << std::endl;
+          exit(1);
+        }
+        inStream.seekg(cursor - (const char*)indexMapping);
       }
 
 
@@ -451,6 +1182,17 @@ namespace skch
        */
       void readParameters(std::ifstream& inStream)
       {
+        uint64_t index_magic = 0;
+        uint64_t index_version = 0;
+        inStream.read((char*) &index_magic, sizeof(index_magic));
+        inStream.read((char*) &index_version, sizeof(index_version));
+        if (index_magic != indexMagic || index_version != indexVersion)
+        {
+          std::cerr << "[mashmap::skch::Sketch::build] ERROR: " << indexFilename
+            << " is not an index of this wfmash version, rebuild it with --overwrite-mm-index" << std::endl;
+          exit(1);
+        }
+
         // Read segment length, sketch size, and kmer size
         decltype(param.segLength) index_segLength;
         decltype(param.sketchSize) index_sketchSize;
@@ -471,21 +1213,322 @@ namespace skch
             << " sketchSize=" << param.sketchSize << " kmerSize=" << param.kmerSize << std::endl;
           exit(1);
         }
+
+        decltype(param.sampling_scheme) index_samplingScheme;
+        decltype(param.syncmer_size) index_syncmerSize;
+        inStream.read((char*) &index_samplingScheme, sizeof(index_samplingScheme));
+        inStream.read((char*) &index_syncmerSize, sizeof(index_syncmerSize));
+        if (param.sampling_scheme != index_samplingScheme
+            || (param.sampling_scheme == sampling::OPEN_SYNCMER && param.syncmer_size != index_syncmerSize))
+        {
+          std::cerr << "[mashmap::skch::Sketch::build] ERROR: Sampling scheme of indexed sketch differs from CLI parameters" << std::endl;
+          std::cerr << "[mashmap::skch::Sketch::build] ERROR: Index --> scheme=" << index_samplingScheme
+            << " syncmerSize=" << index_syncmerSize << std::endl;
+          std::cerr << "[mashmap::skch::Sketch::build] ERROR: CLI   --> scheme=" << param.sampling_scheme
+            << " syncmerSize=" << param.syncmer_size << std::endl;
+          exit(1);
+        }
+
+        inStream.read((char*) &indexedSeqCount, sizeof(indexedSeqCount));
+
+        uint64_t index_parameterFingerprint = 0;
+        uint64_t index_inputFingerprint = 0;
+        inStream.read((char*) &index_parameterFingerprint, sizeof(index_parameterFingerprint));
+        inStream.read((char*) &index_inputFingerprint, sizeof(index_inputFingerprint));
+        if (index_parameterFingerprint != parameterFingerprint())
+        {
+          std::cerr << "[mashmap::skch::Sketch::build] ERROR: " << indexFilename
+            << " was built with different sketching parameters or index shards, rebuild it with --overwrite-mm-index" << std::endl;
+          exit(1);
+        }
+        // New target files are expected when extending the index
+        if (index_inputFingerprint != inputFingerprint() && !param.append_index)
+        {
+          std::cerr << "[mashmap::skch::Sketch::build] ERROR: " << indexFilename
+            << " was built from different target sequences, rebuild it with --overwrite-mm-index" << std::endl;
+          exit(1);
+        }
+
+        uint64_t numSections = 0;
+        inStream.read((char*) &numSections, sizeof(numSections));
+        indexSections.resize(numSections);
+        inStream.read((char*) indexSections.data(), numSections * sizeof(IndexSectionEntry));
+        if (!inStream)
+        {
+          std::cerr << "[mashmap::skch::Sketch::build] ERROR: index " << indexFilename << " is truncated" << std::endl;
+          exit(1);
+        }
       }
 
+      /**
+       * @brief  Load minmerIndex and its directory if readIndex left them on disk
+       * @details Safe to call from several mapping threads at once
+       */
+      void loadMinmerIndex() const
+      {
+        if (!minmerIndexPending)
+          return;
+        std::call_once(minmerIndexLoaded, [this]() {
+          Sketch* self = const_cast<Sketch*>(this);
+          if (indexMapping != nullptr)
+          {
+            verifyIndexSection(SKETCH_SECTION);
+            verifyIndexSection(DIRECTORY_SECTION);
+          }
+          std::ifstream inStream;
+          inStream.open(indexFilename, std::ios::binary);
+          self->seekIndexSection(inStream, SKETCH_SECTION);
+          if (!self->readPackedSketchBinary(inStream))
+            self->readSketchBinary(inStream);
+          self->seekIndexSection(inStream, DIRECTORY_SECTION);
+          self->readMinmerDirectoryBinary(inStream);
+          self->placeArray(minmerIndex);
+          self->placeArray(packedMinmerIndex);
+          self->placeArray(minmerDirectory);
+          self->accountMemory();
+        });
+      }
 
       /**
-       * @brief  Read all index data structures from file
+       * @brief  Back a read-only index array with huge pages and spread it over
+       *         the NUMA nodes, as requested
+       */
+      template <typename T>
+      void placeArray(const std::vector<T>& v)
+      {
+        if (param.huge_pages)
+          huge_pages::advise(v);
+        if (param.numa_interleave)
+          numa::interleave(v);
+      }
+
+      /**
+       * @brief  Place the pages of the read-only index for mapping
+       * @details Built in memory, the index sits on the node of the threads that
+       *          built it, and the mapping threads of the other nodes all go there.
+       *          Only the contiguous arrays are placed, not the hash map shards of
+       *          an unfrozen index; an mmapped index file only gets huge pages
+       */
+      void placeIndexPages()
+      {
+        placeArray(frozenKeys);
+        placeArray(frozenOffsets);
+        placeArray(frozenPoints);
+        placeArray(seedHashToKey);
+        placeArray(minmerIndex);
+        placeArray(packedMinmerIndex);
+        placeArray(minmerDirectory);
+        if (param.huge_pages && indexMapping != nullptr)
+          huge_pages::advise(indexMapping, indexMappingSize);
+      }
+
+
+      /**
+       * @brief  Flatten an index built in memory into the sorted key, CSR offset and
+       *         interval point arrays of a mapped one, in parallel over ranges of keys
+       */
+      void flattenLookupIndex()
+      {
+        if (mappedKeys != nullptr)
+          return;
+        const size_t numShards = minmerPosLookupIndex.size();
+
+        //Keys are split by their top bits into ranges sorted apart, laid one after the other
+        int rangeBits = 0;
+        while ((size_t(1) << rangeBits) < 4 * size_t(std::max(1, param.threads)) && rangeBits < 16)
+          rangeBits++;
+        const size_t numRanges = size_t(1) << rangeBits;
+        const auto rangeOf = [rangeBits](MinmerMapKeyType key) {
+          return rangeBits == 0 ? size_t(0) : size_t(key >> (64 - rangeBits));
+        };
+
+        //Keys of each range in each shard, then where they go, by range first
+        std::vector<uint64_t> starts(numShards * numRanges + 1, 0);
+        forEachInParallel(numShards, [&](size_t shard) {
+          for (const auto& e : minmerPosLookupIndex[shard])
+            starts[rangeOf(e.first) * numShards + shard + 1]++;
+        });
+        for (size_t i = 0; i < numShards * numRanges; i++)
+          starts[i + 1] += starts[i];
+        frozenKeys.resize(starts.back());
+        forEachInParallel(numShards, [&](size_t shard) {
+          std::vector<uint64_t> at(numRanges);
+          for (size_t r = 0; r < numRanges; r++)
+            at[r] = starts[r * numShards + shard];
+          for (const auto& e : minmerPosLookupIndex[shard])
+            frozenKeys[at[rangeOf(e.first)]++] = e.first;
+        });
+        const auto rangeBegin = [&](size_t r) { return starts[r * numShards]; };
+        forEachInParallel(numRanges, [&](size_t r) {
+          std::sort(frozenKeys.begin() + rangeBegin(r), frozenKeys.begin() + rangeBegin(r + 1));
+        });
+
+        frozenOffsets.assign(frozenKeys.size() + 1, 0);
+        forEachInParallel(numRanges, [&](size_t r) {
+          for (uint64_t idx = rangeBegin(r); idx < rangeBegin(r + 1); idx++)
+            frozenOffsets[idx + 1] = minmerPosLookupIndex[shardOf(frozenKeys[idx])].find(frozenKeys[idx])->second.size();
+        });
+        for (uint64_t idx = 0; idx < frozenKeys.size(); idx++)
+          frozenOffsets[idx + 1] += frozenOffsets[idx];
+
+        frozenPoints.resize(frozenOffsets.back());
+        forEachInParallel(numRanges, [&](size_t r) {
+          for (uint64_t idx = rangeBegin(r); idx < rangeBegin(r + 1); idx++)
+          {
+            auto& ipVec = minmerPosLookupIndex[shardOf(frozenKeys[idx])].find(frozenKeys[idx])->second;
+            std::copy(ipVec.begin(), ipVec.end(), frozenPoints.begin() + frozenOffsets[idx]);
+            MinmerMapValueType().swap(ipVec);
+          }
+        });
+        minmerPosLookupIndex.clear();
+
+        numMappedKeys = frozenKeys.size();
+        mappedKeys = frozenKeys.data();
+        mappedOffsets = frozenOffsets.data();
+        mappedPoints = frozenPoints.data();
+      }
+
+      /**
+       * @brief  Run f(0) ... f(count - 1) over the threads of the run
+       */
+      template <typename F>
+      void forEachInParallel(size_t count, F f) const
+      {
+        std::atomic<size_t> next(0);
+        std::vector<std::thread> workers;
+        for (size_t t = 0; t < std::min<size_t>(std::max(1, param.threads), count); t++)
+        {
+          workers.emplace_back([&]() {
+            for (size_t i = next++; i < count; i = next++)
+              f(i);
+          });
+        }
+        for (auto& w : workers)
+          w.join();
+      }
+
+      /**
+       * @brief  Encode the interval points of the lookup index, with --compressed-index
+       * @details The index is flattened first. The points of an index built in memory
+       *          are freed, those of a mapped one are left to the page cache
+       */
+      void compressLookupIndex()
+      {
+        flattenLookupIndex();
+        compressedPoints.build(mappedOffsets, mappedPoints, numMappedKeys);
+        std::vector<PackedIntervalPoint>().swap(frozenPoints);
+        mappedPoints = nullptr;
+        std::cerr << "[mashmap::skch::Sketch] Compressed the interval points of the lookup index to "
+          << compressedPoints.bytes() / (1024.0 * 1024.0) << " MB, from "
+          << mappedOffsets[numMappedKeys] * sizeof(PackedIntervalPoint) / (1024.0 * 1024.0) << " MB" << std::endl;
+      }
+
+      /**
+       * @brief  Freeze the seed lookup index for mapping
+       * @details An index built in memory is first flattened into the sorted key,
+       *          CSR offset and interval point arrays of a mapped index. A minimal
+       *          perfect hash over the keys then replaces their binary search
+       */
+      void freezeLookupIndex()
+      {
+        flattenLookupIndex();
+
+        if (numMappedKeys >= std::numeric_limits<uint32_t>::max())
+        {
+          std::cerr << "[mashmap::skch::Sketch] WARNING: too many seeds for the perfect hash, using binary search" << std::endl;
+          return;
+        }
+
+        seedHash.build(mappedKeys, numMappedKeys, param.threads);
+        seedHashToKey.resize(numMappedKeys);
+        const size_t numThreads = std::max(1, param.threads);
+        const size_t chunkSize = (numMappedKeys + numThreads - 1) / numThreads;
+        std::vector<std::thread> workers;
+        for (size_t t = 0; t < numThreads; t++)
+        {
+          workers.emplace_back([&, t]() {
+            const size_t chunkEnd = std::min<size_t>(numMappedKeys, (t + 1) * chunkSize);
+            for (size_t idx = t * chunkSize; idx < chunkEnd; idx++)
+              seedHashToKey[seedHash.lookup(mappedKeys[idx])] = idx;
+          });
+        }
+        for (auto& w : workers)
+          w.join();
+      }
+
+
+      /**
+       * @brief  Read all index data structures from file
        */
       void readIndex() 
       { 
-        fs::path indexFilename = fs::path(param.indexFilename);
         std::ifstream inStream;
         inStream.open(indexFilename, std::ios::binary);
         readParameters(inStream);
+
+        seekIndexSection(inStream, SKETCH_SECTION);
+        inStream.read((char*)&pendingMinmerCount, sizeof(pendingMinmerCount));
+        minmerIndexPending = true;
+
+        seekIndexSection(inStream, POSLIST_SECTION);
+        readPosListBinary(inStream);
+        // the sections read whole are checked, the lookup index is only mapped
+        verifyIndexSection(FREQKMERS_SECTION);
+        verifyIndexSection(SPACED_SEEDS_SECTION);
+        seekIndexSection(inStream, FREQKMERS_SECTION);
+        readFreqKmersBinary(inStream);
+        if (selfMapping())
+        {
+          verifyIndexSection(FREQMINMERS_SECTION);
+          seekIndexSection(inStream, FREQMINMERS_SECTION);
+          readFrequentMinmersBinary(inStream);
+        }
+      }
+
+      /**
+       * @brief  Read an index which is going to be extended with new target sequences
+       * @details The lookup index is copied out of the mapped file and the minmers of
+       *          frequent seeds go back into minmerIndex, as seed frequencies change
+       *          with the new sequences
+       */
+      void readIndexForAppend()
+      {
+        std::ifstream inStream;
+        inStream.open(indexFilename, std::ios::binary);
+        readParameters(inStream);
+        seekIndexSection(inStream, SKETCH_SECTION);
         readSketchBinary(inStream);
+        seekIndexSection(inStream, DIRECTORY_SECTION);
+        readMinmerDirectoryBinary(inStream);
+        seekIndexSection(inStream, POSLIST_SECTION);
         readPosListBinary(inStream);
+        // all of the index is copied out of it, all of it is checked
+        for (const auto& section : indexSections)
+          verifyIndexSection(IndexSection(section.id));
+        seekIndexSection(inStream, FREQKMERS_SECTION);
         readFreqKmersBinary(inStream);
+        seekIndexSection(inStream, FREQMINMERS_SECTION);
+        readFrequentMinmersBinary(inStream);
+
+        initPosLookupShards();
+        for (uint64_t idx = 0; idx < numMappedKeys; idx++)
+        {
+          minmerPosLookupIndex[shardOf(mappedKeys[idx])][mappedKeys[idx]].assign(
+              mappedPoints + mappedOffsets[idx], mappedPoints + mappedOffsets[idx + 1]);
+        }
+        munmap(indexMapping, indexMappingSize);
+        indexMapping = nullptr;
+        mappedKeys = nullptr;
+
+        // Frequent seeds were dropped from the lookup index, add them back
+        buildPosLookupIndex(frequentMinmers, 0, false);
+
+        frequentSeeds.clear();
+        const auto firstFrequent = minmerIndex.insert(minmerIndex.end(), frequentMinmers.begin(), frequentMinmers.end());
+        std::inplace_merge(minmerIndex.begin(), firstFrequent, minmerIndex.end());
+        frequentMinmers.clear();
+
+        std::cerr << "[mashmap::skch::Sketch] Extending " << indexFilename << " holding " << indexedSeqCount << " target sequences" << std::endl;
       }
 
 
@@ -495,75 +1538,493 @@ namespace skch
        */
       void computeFreqHist()
       {
-          if (!this->minmerPosLookupIndex.empty()) {
+          if (uniqueMinmerCount() + candidateSeedCount() != 0) {
               //1. Compute histogram
 
-              for (auto& e : this->minmerPosLookupIndex)
-                  this->minmerFreqHistogram[e.second.size()]++;
+              for (auto& shardIndex : this->minmerPosLookupIndex)
+                  for (auto& e : shardIndex)
+                      this->minmerFreqHistogram[e.second.size()]++;
+              for (auto& shardCandidates : this->candidateSeeds)
+                  for (auto& e : shardCandidates.pointCounts)
+                      this->minmerFreqHistogram[e.second.first]++;
 
               std::cerr << "[mashmap::skch::Sketch::computeFreqHist] Frequency histogram of minmer interval points = "
                         << *this->minmerFreqHistogram.begin() << " ... " << *this->minmerFreqHistogram.rbegin()
                         << std::endl;
 
               //2. Compute frequency threshold to ignore most frequent minmers
+              this->freqThreshold = freqThresholdOf(this->minmerFreqHistogram, uniqueMinmerCount() + candidateSeedCount(),
+                                                    param.kmer_pct_threshold, "computeFreqHist");
+          } else {
+              std::cerr << "[mashmap::skch::Sketch::computeFreqHist] No minmers." << std::endl;
+          }
+      }
 
-              int64_t totalUniqueMinmers = this->minmerPosLookupIndex.size();
-              int64_t minmerToIgnore = totalUniqueMinmers * param.kmer_pct_threshold / 100;
+      /**
+       * @brief   count of interval points from which minmers are ignored, the top pct % of
+       *          the unique minmers by their count in histogram
+       * @param[in] caller  function reporting the threshold
+       */
+      static uint64_t freqThresholdOf(const std::map<uint64_t, uint64_t>& histogram, int64_t totalUniqueMinmers,
+                                      float pct, const char* caller)
+      {
+          uint64_t threshold = std::numeric_limits<uint64_t>::max();
+          int64_t minmerToIgnore = totalUniqueMinmers * pct / 100;
+
+          int64_t sum = 0;
+
+          //Iterate from highest frequent minmers
+          for (auto it = histogram.rbegin(); it != histogram.rend(); it++) {
+              sum += it->second; //add frequency
+              if (sum < minmerToIgnore) {
+                  threshold = it->first;
+                  //continue
+              } else if (sum == minmerToIgnore) {
+                  threshold = it->first;
+                  break;
+              } else {
+                  break;
+              }
+          }
 
-              int64_t sum = 0;
+          if (threshold != std::numeric_limits<uint64_t>::max())
+              std::cerr << "[mashmap::skch::Sketch::" << caller << "] With threshold " << pct
+                        << "\%, ignore minmers with more than >= " << threshold << " interval points during mapping."
+                        << std::endl;
+          else
+              std::cerr << "[mashmap::skch::Sketch::" << caller << "] With threshold " << pct
+                        << "\%, consider all minmers during mapping." << std::endl;
+          return threshold;
+      }
 
-              //Iterate from highest frequent minmers
-              for (auto it = this->minmerFreqHistogram.rbegin(); it != this->minmerFreqHistogram.rend(); it++) {
-                  sum += it->second; //add frequency
-                  if (sum < minmerToIgnore) {
-                      this->freqThreshold = it->first;
-                      //continue
-                  } else if (sum == minmerToIgnore) {
-                      this->freqThreshold = it->first;
-                      break;
-                  } else {
-                      break;
-                  }
-              }
+      public:
 
-              if (this->freqThreshold != std::numeric_limits<uint64_t>::max())
-                  std::cerr << "[mashmap::skch::Sketch::computeFreqHist] With threshold " << this->param.kmer_pct_threshold
-                            << "\%, ignore minmers with more than >= " << this->freqThreshold << " interval points during mapping."
-                            << std::endl;
-              else
-                  std::cerr << "[mashmap::skch::Sketch::computeFreqHist] With threshold " << this->param.kmer_pct_threshold
-                            << "\%, consider all minmers during mapping." << std::endl;
-          } else {
-              std::cerr << "[mashmap::skch::Sketch::computeFreqHist] No minmers." << std::endl;
+      /**
+       * @brief   index file of a shard, if any
+       */
+      static stdfs::path indexFileOf(const skch::Parameters &p, int shard)
+      {
+        return p.indexFilename.empty() || p.index_shards == 1
+          ? p.indexFilename
+          : stdfs::path(p.indexFilename.string() + "." + std::to_string(shard));
+      }
+
+      /**
+       * @brief   whether some index shard is to be sketched rather than read from its file
+       */
+      static bool sketchesAnyShard(const skch::Parameters &p)
+      {
+        for (int shard = 0; shard < p.index_shards; shard++)
+        {
+          const stdfs::path indexFile = indexFileOf(p, shard);
+          if (indexFile.empty() || !stdfs::exists(indexFile) || p.overwrite_index || p.append_index)
+            return true;
+        }
+        return false;
+      }
+
+      /**
+       * @brief   seeds frequent over the targets of all the index shards, as a single index
+       *          would find them, for the shards to ignore the same ones
+       * @details the targets are sketched once more, and the interval points of each hash
+       *          counted as addIntervalPoints would make them, in target order
+       */
+      static ankerl::unordered_dense::set<hash_t> frequentSeedsOfShards(const skch::Parameters &p)
+      {
+        std::unordered_set<std::string> allowed_target_names;
+        if (!p.target_list.empty()) {
+                std::ifstream filter_list(p.target_list);
+                std::string name;
+                while (getline(filter_list, name)) {
+                        allowed_target_names.insert(name);
+                }
+        }
+
+        std::cerr << "[mashmap::skch::Sketch::frequentSeedsOfShards] Counting minmers over the " << p.index_shards
+                  << " index shards" << std::endl;
+
+        //Interval point count and last window end of each hash
+        ankerl::unordered_dense::map<hash_t, std::pair<uint64_t, offset_t>> pointCounts;
+        const auto countHandleThreadOutput = [&](MI_Type* contigMinmers) {
+          for (const MinmerInfo& mi : *contigMinmers)
+          {
+            auto& count = pointCounts[mi.hash];
+            if (count.first == 0 || count.second != mi.wpos)
+              count.first += 2;
+            count.second = mi.wpos_end;
           }
+          delete contigMinmers;
+        };
+
+        const CommonFunc::SpacedSeedMasks spacedSeedMasks(p.use_spaced_seeds ? CommonFunc::SpacedSeedMasks(p.spaced_seeds)
+                                                                              : CommonFunc::SpacedSeedMasks());
+        const int syncmerSize = p.sampling_scheme == sampling::OPEN_SYNCMER ? p.syncmer_size : 0;
+        ThreadPool<InputSeqContainer, MI_Type> threadPool( [&](InputSeqContainer* input) {
+          MI_Type* thread_output = new MI_Type();
+          skch::CommonFunc::addMinmers(*thread_output, &(input->seq[0u]), input->len, p.kmerSize, p.segLength,
+              p.alphabetSize, p.sketchSize, input->seqCounter, p.rolling_hash, spacedSeedMasks.ifUsed(), syncmerSize);
+          return thread_output;
+        }, p.threads);
+
+        seqno_t seqCounter = 0;
+        for (const auto &fileName : p.refSequences)
+        {
+          seqiter::for_each_owned_seq_in_file_parallel(
+              fileName,
+              allowed_target_names,
+              p.target_prefix,
+              p.threads,
+              [&](const std::string& seq_name, std::string&& seq) {
+                if ((offset_t)seq.length() >= p.kmerSize)
+                {
+                  threadPool.runWhenThreadAvailable(new InputSeqContainer(std::move(seq), seq_name, seqCounter));
+                  while (threadPool.outputAvailable())
+                    countHandleThreadOutput(threadPool.popOutputWhenAvailable());
+                }
+                seqCounter++;
+              });
+        }
+        while (threadPool.running())
+          countHandleThreadOutput(threadPool.popOutputWhenAvailable());
+
+        std::map<uint64_t, uint64_t> histogram;
+        for (const auto& e : pointCounts)
+          histogram[e.second.first]++;
+        const uint64_t threshold = freqThresholdOf(histogram, pointCounts.size(), p.kmer_pct_threshold, "frequentSeedsOfShards");
+
+        ankerl::unordered_dense::set<hash_t> frequent;
+        for (const auto& e : pointCounts)
+          if (e.second.first >= threshold)
+            frequent.insert(e.first);
+        return frequent;
       }
 
-      public:
+      /**
+       * @brief   set the spaced seeds of p.spaced_seed_params: those of the index being loaded,
+       *          else those of the seed cache, else searched for by ALeS and added to the cache
+       */
+      static void loadSpacedSeeds(Parameters& p)
+      {
+        const stdfs::path indexFile = indexFileOf(p, 0);
+        ales::spaced_seeds sps;
+        if (!indexFile.empty() && !p.overwrite_index && stdfs::exists(indexFile)
+            && readIndexedSpacedSeeds(indexFile, p))
+        {
+          std::cerr << "[wfmash::map] Spaced seeds of the index " << indexFile << std::endl;
+        }
+        else if (SpacedSeedCache::load(p.cache_dir, p.spaced_seed_params, sps))
+        {
+          std::cerr << "[wfmash::map] Spaced seeds of the cache in " << p.cache_dir << std::endl;
+          p.spaced_seeds = sps.seeds;
+          p.spaced_seed_sensitivity = sps.sensitivity;
+        }
+        else
+        {
+          std::cerr << "[wfmash::map] Generating spaced seeds" << std::endl;
+          auto t0 = skch::Time::now();
+          sps = ales::generate_spaced_seeds(p.spaced_seed_params.weight, p.spaced_seed_params.seed_count,
+                                            p.spaced_seed_params.similarity, p.spaced_seed_params.region_length, p.threads);
+          std::chrono::duration<double> timeSpacedSeeds = skch::Time::now() - t0;
+          std::cerr << "[wfmash::map] Time spent generating spaced seeds " << timeSpacedSeeds.count() << " seconds" << std::endl;
+          SpacedSeedCache::store(p.cache_dir, p.spaced_seed_params, sps);
+          p.spaced_seeds = sps.seeds;
+          p.spaced_seed_sensitivity = sps.sensitivity;
+        }
+        ales::printSpacedSeeds(p.spaced_seeds);
+        std::cerr << "[wfmash::map] Spaced seed sensitivity " << p.spaced_seed_sensitivity << std::endl;
+      }
+
+      /**
+       * @brief   spaced seeds the index was sketched with, or nullptr for plain kmers
+       */
+      const CommonFunc::SpacedSeedMasks* spacedSeeds() const
+      {
+        return spacedSeedMasks.ifUsed();
+      }
 
       /**
-       * @brief               search hash associated with given position inside the index
-       * @details             if MIIter_t iter is returned, than *iter's wpos >= winpos
+       * @brief   s-mer size of the open syncmers the index samples, or 0 for all kmers
+       */
+      int syncmerSize() const
+      {
+        return param.sampling_scheme == sampling::OPEN_SYNCMER ? param.syncmer_size : 0;
+      }
+
+      /**
+       * @brief               the minmer windows of the index as an array, packed or not
+       * @details             f is called with the array, whose elements are read with minmerOf
+       */
+      template <typename F>
+      auto withMinmerIndex(F&& f) const
+      {
+        loadMinmerIndex();
+        return minmersPacked ? f(packedMinmerIndex) : f(minmerIndex);
+      }
+
+      /**
+       * @brief               contig-level sketches of the targets, from the minmer windows of
+       *                      the index, built on first use
+       * @details             safe to call from several mapping threads at once
+       */
+      const TargetPrefilter& targetPrefilter() const
+      {
+        std::call_once(targetPrefilterBuilt, [this]() {
+          Sketch* self = const_cast<Sketch*>(this);
+          const seqno_t targets = metadata.size();
+          withMinmerIndex([&](const auto& index) {
+            self->prefilter.build(targets, TargetPrefilter::thresholdFor(param.sketchSize, param.segLength),
+                [&](const auto& add) {
+                  for (seqno_t seqId = 0; seqId < targets; seqId++)
+                    for (size_t i = seqMinmerOffsets[seqId]; i < seqMinmerOffsets[seqId + 1]; i++)
+                      add(seqId, minmerOf(index[i], seqId).hash);
+                });
+          });
+          accountMemory();
+        });
+        return prefilter;
+      }
+
+      /**
+       * @brief               coarse level of the index, of windows param.coarse_level times
+       *                      longer than the segments, from the minmer windows of the index,
+       *                      built on first use
+       * @details             safe to call from several mapping threads at once
+       */
+      const CoarseLevel& coarseLevel() const
+      {
+        std::call_once(coarseLevelBuilt, [this]() {
+          Sketch* self = const_cast<Sketch*>(this);
+          const seqno_t targets = metadata.size();
+          withMinmerIndex([&](const auto& index) {
+            self->coarse.build(CoarseLevel::thresholdFor(param.sketchSize, param.segLength, param.coarse_level),
+                param.segLength * std::max(1, param.coarse_level),
+                [&](const auto& add) {
+                  for (seqno_t seqId = 0; seqId < targets; seqId++)
+                    for (size_t i = seqMinmerOffsets[seqId]; i < seqMinmerOffsets[seqId + 1]; i++)
+                    {
+                      const MinmerInfo mi = minmerOf(index[i], seqId);
+                      add(mi.hash, seqId, mi.wpos, mi.strand);
+                    }
+                });
+          });
+          accountMemory();
+        });
+        return coarse;
+      }
+
+      /**
+       * @brief               fingerprint of the targets [begin, end) as indexed: of their names
+       *                      and lengths, of their minmer windows, frequent seeds being left
+       *                      out, and of the parameters of the index
+       * @details             what the mappings on these targets depend on, rather than the
+       *                      target files, so that it only changes with the targets themselves
+       */
+      uint64_t targetsFingerprint(seqno_t begin, seqno_t end) const
+      {
+        //splitmix64 finalizer of each value, folded in
+        uint64_t h = parameterFingerprint();
+        const auto fold = [&h](uint64_t v) {
+          v += h + 0x9E3779B97F4A7C15ULL;
+          v = (v ^ (v >> 30)) * 0xBF58476D1CE4E5B9ULL;
+          v = (v ^ (v >> 27)) * 0x94D049BB133111EBULL;
+          h = v ^ (v >> 31);
+        };
+        for (seqno_t seqId = begin; seqId < end; seqId++)
+        {
+          fold(fingerprintOf(std::string(metadata[seqId].name)));
+          fold(metadata[seqId].len);
+        }
+        withMinmerIndex([&](const auto& index) {
+          for (seqno_t seqId = begin; seqId < end; seqId++)
+          {
+            fold(seqMinmerOffsets[seqId + 1] - seqMinmerOffsets[seqId]);
+            for (size_t i = seqMinmerOffsets[seqId]; i < seqMinmerOffsets[seqId + 1]; i++)
+            {
+              const MinmerInfo mi = minmerOf(index[i], seqId);
+              fold(mi.hash);
+              fold((uint64_t(mi.wpos) << 1) | (mi.strand == strnd::REV ? 1 : 0));
+              fold(mi.wpos_end);
+            }
+          }
+        });
+        return h;
+      }
+
+      /**
+       * @brief               minmer window of sequence seqId of the index, packed or not
+       */
+      static const MinmerInfo& minmerOf(const MinmerInfo& mi, seqno_t)
+      {
+        return mi;
+      }
+
+      static MinmerInfo minmerOf(const PackedMinmer& mi, seqno_t seqId)
+      {
+        return mi.unpack(seqId);
+      }
+
+      /**
+       * @brief               first minmer window of a sequence starting at or after a position
+       * @details             jumps to the sequence with the offset table, then narrows the
+       *                      search down to one directory stride
+       * @param[in]   index   minmer windows of the index, from withMinmerIndex
        * @param[in]   seqId
-       * @param[in]   winpos
-       * @return              iterator to the minmer in the index
+       * @param[in]   pos
+       * @return              position in index of the first minmer of seqId with wpos >= pos,
+       *                      or of the first minmer of the next sequence
+       */
+      template <typename MinmerArray>
+      size_t lowerBoundMinmer(const MinmerArray& index, seqno_t seqId, offset_t pos) const
+      {
+        const size_t seqBegin = seqMinmerOffsets[seqId];
+        const size_t seqEnd = seqMinmerOffsets[seqId + 1];
+        if (seqBegin == seqEnd)
+          return seqBegin;
+
+        // Directory entries falling inside the sequence
+        const size_t dirBegin = (seqBegin + minmerDirectoryStride - 1) / minmerDirectoryStride;
+        const size_t dirEnd = (seqEnd - 1) / minmerDirectoryStride + 1;
+        const size_t dirIdx = std::lower_bound(
+            minmerDirectory.begin() + dirBegin, minmerDirectory.begin() + dirEnd, pos) - minmerDirectory.begin();
+
+        const size_t searchBegin = dirIdx == dirBegin ? seqBegin : (dirIdx - 1) * minmerDirectoryStride;
+        const size_t searchEnd = dirIdx == dirEnd ? seqEnd : dirIdx * minmerDirectoryStride;
+        return std::lower_bound(index.begin() + searchBegin, index.begin() + searchEnd, pos,
+            [seqId](const auto& mi, offset_t p) { return minmerOf(mi, seqId).wpos < p; }) - index.begin();
+      }
+
+      /**
+       * @brief     Count of minmer windows in the index, loaded or not
        */
+      uint64_t minmerCount() const
+      {
+        return minmerIndexPending ? pendingMinmerCount : minmersPacked ? packedMinmerIndex.size() : minmerIndex.size();
+      }
 
       /**
-       * @brief                 check if iterator points to index end
-       * @param[in]   iterator
-       * @return                boolean value
+       * @brief               interval points of a seed in the reference
+       * @param[in]   h       seed hash
+       * @return              [begin, end) range, empty if the hash isn't indexed
        */
-      bool isMinmerIndexEnd(const MIIter_t &it) const
+      using SeedRange = std::pair<const PackedIntervalPoint*, const PackedIntervalPoint*>;
+
+      std::pair<const PackedIntervalPoint*, const PackedIntervalPoint*> findIntervalPoints(hash_t h) const
       {
-        return it == this->minmerIndex.end();
+        if (!seedHashToKey.empty())
+        {
+          const uint64_t idx = findHashedKeyRank(h);
+          if (idx == numMappedKeys)
+            return {nullptr, nullptr};
+          return {mappedPoints + mappedOffsets[idx], mappedPoints + mappedOffsets[idx + 1]};
+        }
+
+        if (mappedKeys != nullptr)
+          return findMappedKey(h, guessMappedKey(h));
+
+        if (minmerPosLookupIndex.empty())
+          return {nullptr, nullptr};
+        const MI_Map_t& shardIndex = minmerPosLookupIndex[shardOf(h)];
+        const auto seedFind = shardIndex.find(h);
+        if (seedFind == shardIndex.end())
+          return {nullptr, nullptr};
+        return {seedFind->second.data(), seedFind->second.data() + seedFind->second.size()};
       }
 
       /**
-       * @brief     Return end iterator on minmerIndex
+       * @brief               interval points of many seeds, looked up in batches
+       * @details             a first pass over a batch prefetches the memory the lookup of
+       *                      each seed starts with, the second one resolves the lookups, so
+       *                      that the cache misses of a batch overlap. The interval points
+       *                      found are prefetched as well, for the caller to read next
+       * @param[in]   minmers seeds
+       * @param[in]   count   number of seeds
+       * @param[out]  ranges  findIntervalPoints() of each seed
+       * @param[out]  decoded points of a compressed index, which ranges point into
        */
-      MIIter_t getMinmerIndexEnd() const
+      void findIntervalPointsBatch(const MinmerInfo* minmers, size_t count, SeedRange* ranges,
+                                   std::vector<PackedIntervalPoint>& decoded) const
       {
-        return this->minmerIndex.end();
+        if (!compressedPoints.empty())
+        {
+          findCompressedPointsBatch(minmers, count, ranges, decoded);
+          return;
+        }
+        for (size_t batch = 0; batch < count; batch += seedLookupBatch)
+        {
+          const size_t batchEnd = std::min(count, batch + seedLookupBatch);
+          size_t guesses[seedLookupBatch];
+          for (size_t i = batch; i < batchEnd; i++)
+          {
+            const hash_t h = minmers[i].hash;
+            if (!seedHashToKey.empty())
+              seedHash.prefetch(h);
+            else if (mappedKeys != nullptr)
+              __builtin_prefetch(mappedKeys + (guesses[i - batch] = guessMappedKey(h)));
+          }
+          for (size_t i = batch; i < batchEnd; i++)
+          {
+            const hash_t h = minmers[i].hash;
+            ranges[i] = seedHashToKey.empty() && mappedKeys != nullptr
+              ? findMappedKey(h, guesses[i - batch])
+              : findIntervalPoints(h);
+            if (ranges[i].first != ranges[i].second)
+              __builtin_prefetch(ranges[i].first);
+          }
+        }
+      }
+
+      /**
+       * @brief               findIntervalPointsBatch() on a compressed index, the points of
+       *                      the seeds being decoded into decoded
+       */
+      void findCompressedPointsBatch(const MinmerInfo* minmers, size_t count, SeedRange* ranges,
+                                     std::vector<PackedIntervalPoint>& decoded) const
+      {
+        //Decoded first, as the buffer may move, then pointed to
+        std::vector<uint64_t> ends(count);
+        decoded.clear();
+        for (size_t batch = 0; batch < count; batch += seedLookupBatch)
+        {
+          const size_t batchEnd = std::min(count, batch + seedLookupBatch);
+          uint64_t ranks[seedLookupBatch];
+          for (size_t i = batch; i < batchEnd; i++)
+          {
+            const hash_t h = minmers[i].hash;
+            ranks[i - batch] = seedHashToKey.empty() ? findMappedKeyRank(h, guessMappedKey(h)) : findHashedKeyRank(h);
+            if (ranks[i - batch] != numMappedKeys)
+              compressedPoints.prefetch(ranks[i - batch]);
+          }
+          for (size_t i = batch; i < batchEnd; i++)
+          {
+            if (ranks[i - batch] != numMappedKeys)
+              compressedPoints.decode(ranks[i - batch], decoded);
+            ends[i] = decoded.size();
+          }
+        }
+        for (size_t i = 0; i < count; i++)
+        {
+          const uint64_t begin = i == 0 ? 0 : ends[i - 1];
+          ranges[i] = begin == ends[i] ? SeedRange {nullptr, nullptr}
+            : SeedRange {decoded.data() + begin, decoded.data() + ends[i]};
+        }
+      }
+
+      /**
+       * @brief     Number of distinct hashes in the seed lookup index
+       */
+      size_t uniqueMinmerCount() const
+      {
+        if (mappedKeys != nullptr)
+          return numMappedKeys;
+        size_t count = 0;
+        for (auto& shardIndex : minmerPosLookupIndex)
+          count += shardIndex.size();
+        return count;
+      }
+
+      int getShard() const
+      {
+        return shard;
       }
 
       int getFreqThreshold() const
@@ -573,25 +2034,205 @@ namespace skch
 
       void computeFreqSeedSet()
       {
-        for(auto &e : this->minmerPosLookupIndex) {
-          if (e.second.size() >= this->freqThreshold) {
-            this->frequentSeeds.insert(e.first);
+        if (shardedFrequentSeeds != nullptr) {
+          this->frequentSeeds = *shardedFrequentSeeds;
+        } else {
+          for(auto &shardIndex : this->minmerPosLookupIndex) {
+            for(auto &e : shardIndex) {
+              if (e.second.size() >= this->freqThreshold) {
+                this->frequentSeeds.insert(e.first);
+              }
+            }
           }
         }
+
+        // Frequent seed candidates are either frequent, or get their interval points now
+        for (size_t shard = 0; shard < candidateSeeds.size(); shard++) {
+          for(auto &e : candidateSeeds[shard].pointCounts) {
+            if (shardedFrequentSeeds == nullptr && e.second.first >= this->freqThreshold) {
+              this->frequentSeeds.insert(e.first);
+            }
+          }
+          for (uint64_t idx : candidateSeeds[shard].minmers) {
+            const MinmerInfo& mi = this->minmerIndex[idx];
+            if (this->frequentSeeds.find(mi.hash) == this->frequentSeeds.end())
+              addIntervalPoints(this->minmerPosLookupIndex[shard][mi.hash], mi);
+          }
+        }
+        this->candidateSeeds.clear();
       }
 
       void dropFreqSeedSet()
       {
-        this->minmerIndex.erase(
-          std::remove_if(minmerIndex.begin(), minmerIndex.end(), [&] 
-            (auto& mi) {return this->frequentSeeds.find(mi.hash) != this->frequentSeeds.end();}
-          ), minmerIndex.end()
-        );
+        const auto firstFrequent = std::stable_partition(minmerIndex.begin(), minmerIndex.end(), [&] 
+            (auto& mi) {return this->frequentSeeds.find(mi.hash) == this->frequentSeeds.end();});
+        // Saved with the index, to be able to extend it later, or to sketch query windows
+        if (!indexFilename.empty() || selfMapping())
+          this->frequentMinmers.assign(firstFrequent, minmerIndex.end());
+        this->minmerIndex.erase(firstFrequent, minmerIndex.end());
+
+        // Frequent seeds are never looked up, drop their interval points as well
+        for (hash_t h : this->frequentSeeds)
+          this->minmerPosLookupIndex[shardOf(h)].erase(h);
       }
 
       bool isFreqSeed(hash_t h) const
       {
-        return frequentSeeds.find(h) != frequentSeeds.end();
+        return frequentSeedFilter.mayContain(h) && frequentSeeds.find(h) != frequentSeeds.end();
+      }
+
+      /**
+       * @brief   whether the queries are the targets, as in all-vs-all mapping
+       */
+      bool selfMapping() const
+      {
+        return param.querySequences == param.refSequences;
+      }
+
+      /**
+       * @brief   target that a query is, if its windows are in this index
+       * @return  target id, or -1
+       */
+      seqno_t selfSeqId(const std::string& seqName, offset_t len) const
+      {
+        const auto it = selfSeqIds.find(seqName);
+        return it != selfSeqIds.end() && metadata[it->second].len == len ? it->second : -1;
+      }
+
+      /**
+       * @brief               sketch of a query fragment of segLength bases, taken from the
+       *                      window of the index where the fragment is a target
+       * @details             the minmers of a window are those whose interval covers it, as
+       *                      computeL2MappedRegions reads them. These are the bottom s kmers
+       *                      of the window, frequent seeds included, so the sketch is the one
+       *                      sketchSequence would compute, up to strand ties read as FWD
+       * @param[in]   seqId   target id, from selfSeqId()
+       * @param[in]   pos     offset of the fragment in the target
+       */
+      void windowSketch(seqno_t seqId, offset_t pos, std::vector<MinmerInfo>& sketch) const
+      {
+        sketch.clear();
+        // Windows of minmers are at most segLength long
+        withMinmerIndex([&](const auto& index) {
+          const size_t seqEnd = seqMinmerOffsets[seqId + 1];
+          for (size_t idx = lowerBoundMinmer(index, seqId, pos - param.segLength); idx < seqEnd; ++idx)
+          {
+            const MinmerInfo& mi = minmerOf(index[idx], seqId);
+            if (mi.wpos > pos)
+              break;
+            if (mi.wpos_end > pos)
+              sketch.push_back(mi);
+          }
+        });
+        for (auto it = std::lower_bound(frequentMinmers.begin(), frequentMinmers.end(), std::make_pair(seqId, pos - param.segLength),
+              [](const MinmerInfo& mi, const std::pair<seqno_t, offset_t>& p) { return std::tie(mi.seqId, mi.wpos) < std::tie(p.first, p.second); });
+            it != frequentMinmers.end() && it->seqId == seqId && it->wpos <= pos; ++it)
+          if (it->wpos_end > pos)
+            sketch.push_back(*it);
+
+        std::sort(sketch.begin(), sketch.end(), [](const MinmerInfo& l, const MinmerInfo& r) { return l.hash < r.hash; });
+        sketch.erase(std::unique(sketch.begin(), sketch.end(),
+              [](const MinmerInfo& l, const MinmerInfo& r) { return l.hash == r.hash; }), sketch.end());
+      }
+
+      private:
+
+      //Seeds per batch of findIntervalPointsBatch(), about the misses a core keeps in flight
+      static constexpr size_t seedLookupBatch = 16;
+
+      /**
+       * @brief   likely position of a hash in mappedKeys
+       * @details hashes are close to uniform, so their rank is close to h / 2^64 of the keys
+       */
+      size_t guessMappedKey(hash_t h) const
+      {
+        return numMappedKeys == 0 ? 0 : (size_t)(((unsigned __int128) h * numMappedKeys) >> 64);
+      }
+
+      /**
+       * @brief   interval points of a hash in mappedKeys, searching from a guessed position
+       */
+      SeedRange findMappedKey(hash_t h, size_t guess) const
+      {
+        const uint64_t idx = findMappedKeyRank(h, guess);
+        if (idx == numMappedKeys)
+          return {nullptr, nullptr};
+        return {mappedPoints + mappedOffsets[idx], mappedPoints + mappedOffsets[idx + 1]};
+      }
+
+      /**
+       * @brief   rank of a hash in mappedKeys, numMappedKeys if it is not there, searching
+       *          from a guessed position
+       * @details galloping out of the guess keeps the search within a few cache lines,
+       *          where a binary search over the whole array would miss at each step
+       */
+      uint64_t findMappedKeyRank(hash_t h, size_t guess) const
+      {
+        const MinmerMapKeyType* keys = mappedKeys;
+        size_t lo = 0, hi = numMappedKeys;
+        if (guess < numMappedKeys)
+        {
+          size_t step = 1;
+          if (keys[guess] < h)
+          {
+            lo = guess + 1;
+            while (lo + step < numMappedKeys && keys[lo + step] < h)
+            {
+              lo += step + 1;
+              step *= 2;
+            }
+            hi = std::min(numMappedKeys, lo + step + 1);
+          }
+          else
+          {
+            hi = guess + 1;
+            while (hi > step && keys[hi - step - 1] >= h)
+            {
+              hi -= step + 1;
+              step *= 2;
+            }
+            lo = hi > step + 1 ? hi - step - 1 : 0;
+          }
+        }
+        const MinmerMapKeyType* keyIt = std::lower_bound(keys + lo, keys + hi, h);
+        if (keyIt == keys + numMappedKeys || *keyIt != h)
+          return numMappedKeys;
+        return keyIt - keys;
+      }
+
+      /**
+       * @brief   rank of a hash in mappedKeys through the perfect hash, numMappedKeys if it
+       *          is not there
+       */
+      uint64_t findHashedKeyRank(hash_t h) const
+      {
+        const uint64_t slot = seedHash.lookup(h);
+        if (slot == mphf::MinimalPerfectHash::notFound)
+          return numMappedKeys;
+        const uint64_t idx = seedHashToKey[slot];
+        return mappedKeys[idx] == h ? idx : numMappedKeys;
+      }
+
+      /**
+       * @brief   fill frequentSeedFilter from frequentSeeds, once they are final
+       */
+      void buildFreqSeedFilter()
+      {
+        frequentSeedFilter.reset(frequentSeeds.size());
+        for (hash_t h : frequentSeeds)
+          frequentSeedFilter.insert(h);
+      }
+
+      /**
+       * @brief   fill selfSeqIds with the targets sketched into this index
+       */
+      void indexSelfSeqIds()
+      {
+        for (seqno_t seqId = 0; seqId < (seqno_t) metadata.size(); seqId++)
+          if (seqId % param.index_shards == shard && metadata[seqId].len >= param.segLength)
+            selfSeqIds.emplace(metadata[seqId].name, seqId);
+        std::cerr << "[mashmap::skch::Sketch] Queries are the targets, " << selfSeqIds.size()
+          << " of them are sketched from the index" << std::endl;
       }
 
     }; //End of class Sketch
@@ -0,0 +1 @@
+#define WFMASH_GIT_VERSION "8a5ab90"